@@ -1,22 +1,31 @@
 /**
- * Benchmark to compare naive C array scan, stream scan and binary search on
- * different array sizes. There is no memory transfers, so the becnhmark is
- * pure CPU loading.
+ * Benchmark to compare search algorithms and memory layouts for sorted
+ * integer lookup tables of different sizes: naive C array scan, AVX2 scan,
+ * binary search, branchless lower bound, Eytzinger (BFS) layout with
+ * prefetching and B-tree layout with AVX2 node search. The table sizes are
+ * swept from one cache line to a few Mbytes, so the smaller tables are pure
+ * CPU loading and the larger ones show the memory latency.
  *
- * Results for Bsearch optimal at Intel(R) Core(TM) i7-4650U CPU @ 1.70GHz:
+ * Compile with
+ *
+ * g++ -O2 -std=c++11 -mavx2 array_scans.cc -lm
+ *
+ * Results for the original fixed size tables at Intel(R) Core(TM) i7-4650U
+ * CPU @ 1.70GHz, N = 1024 (Bsearch optimal):
  *
  *	binary search: :  27ms
  *	scan: :  617ms
  *	scan stream: :  65ms
  *
- * For Scan optimal:
+ * N = 16 (Scan optimal):
  *
  *	binary search: :  245ms
  *	scan: :  556ms
  *	scan stream: :  136ms
  *
  * So binary search is always faster than naive C array scan, ever for scan
- * in only one cache line. However, it's slower than stream scan for smal data.
+ * in only one cache line. The stream scan was memchr() on bytes, i.e. it
+ * didn't actually search for integers, and is replaced by the AVX2 scan.
  *
  * Copyright (C) 2015 Alexander Krizhanovsky (ak@tempesta-tech.com).
  *
@@ -34,46 +43,46 @@
  * this program; if not, write to the Free Software Foundation, Inc., 59
  * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
 
+#include <algorithm>
 #include <iostream>
-#include <sstream>
-
-#if 0
-// Bsearch optimal
-static const size_t N = 1024;
-static const size_t ITER = 256 * 1024;
-#else
-// Scan optimal (twice worse actually!)
-static const size_t N = 16;
-static const size_t ITER = 16 * 1024 * 1024;
-#endif
-
-#define BENCHMARK_START()						\
-	struct timeval tv0, tv1;					\
-	gettimeofday(&tv0, NULL);
-
-#define BENCHMARK_RESULT(desc)						\
-	gettimeofday(&tv1, NULL);					\
-	tv0.tv_usec = (tv0.tv_sec * 1000 * 1000 + tv0.tv_usec) / 1000;	\
-	tv1.tv_usec = (tv1.tv_sec * 1000 * 1000 + tv1.tv_usec) / 1000;	\
-	std::cout << (desc) << ":  " << (tv1.tv_usec - tv0.tv_usec)	\
-		<< "ms" << std::endl;
 
+#include <immintrin.h>
+
+#include "bench.h"
+
+static const size_t N_MIN = 8;
+static const size_t N_MAX = 1024 * 1024;
+// The linear scans are hopeless on larger tables.
+static const size_t SCAN_N_MAX = 4096;
+static const size_t LOOKUPS = 1024 * 1024;
+
+// All the layouts are built from the same sorted table of odd numbers, so
+// the even keys miss.
+static unsigned int *tbl;
+static unsigned int *eytz;
+static unsigned int *keys;
+
+// B-tree of one cache line nodes: B keys and B + 1 implicit children.
+static const size_t B = 16;
+typedef unsigned int BNode[B] __attribute__((aligned(64)));
+static BNode *btree;
+static size_t bnodes;
 
 inline int
-bsearch(unsigned int *tbl, unsigned int key)
+search_binary(unsigned int *tbl, size_t n, unsigned int key)
 {
-	int i = N / 2, d = (N + 3) / 4;
+	int i = n / 2, d = (n + 3) / 4;
 	while (1) {
 		if (tbl[i] == key)
 			return i;
 		if (!d) {
 			if (key < tbl[i] && i && tbl[--i] == key)
 				return i;
-			if (key > tbl[i] && ++i < N && tbl[i] == key)
+			if (key > tbl[i] && ++i < n && tbl[i] == key)
 				return i;
 			return -1;
 		}
@@ -82,71 +91,253 @@ bsearch(unsigned int *tbl, unsigned int key)
 	}
 }
 
+/**
+ * The loop has the same number of iterations for all the keys and there is
+ * no branch on the comparison result, so there are no branch mispredictions.
+ * GCC compiles the ternary operator to a conditional jump, so use the
+ * multiplication.
+ */
+inline int
+lower_bound_branchless(unsigned int *tbl, size_t n, unsigned int key)
+{
+	const unsigned int *base = tbl;
+
+	while (n > 1) {
+		size_t half = n / 2;
+		base += (base[half - 1] < key) * half;
+		n -= half;
+	}
+	if (*base < key)
+		++base;
+
+	return base - tbl;
+}
+
+inline int
+search_branchless(unsigned int *tbl, size_t n, unsigned int key)
+{
+	int i = lower_bound_branchless(tbl, n, key);
+
+	return (i < n && tbl[i] == key) ? i : -1;
+}
+
+static size_t
+eytzinger_build(unsigned int *a, size_t n, size_t i = 0, size_t k = 1)
+{
+	if (k <= n) {
+		i = eytzinger_build(a, n, i, 2 * k);
+		eytz[k] = a[i++];
+		i = eytzinger_build(a, n, i, 2 * k + 1);
+	}
+	return i;
+}
+
+/**
+ * Eytzinger layout is the implicit binary tree in BFS order starting from
+ * index 1. The descendants of a node four levels below lay in one cache
+ * line, so prefetching them hides the memory latency for the larger tables.
+ * Returns the position in the Eytzinger array.
+ */
+inline int
+search_eytzinger(unsigned int *e, size_t n, unsigned int key)
+{
+	size_t k = 1;
+
+	while (k <= n) {
+		__builtin_prefetch(e + k * 16);
+		k = 2 * k + (e[k] < key);
+	}
+	// Cancel the right turns after the last left one.
+	k >>= __builtin_ffsl(~k);
+
+	return (k && e[k] == key) ? k : -1;
+}
+
+static inline size_t
+btree_child(size_t k, size_t i)
+{
+	return k * (B + 1) + i + 1;
+}
+
+static size_t
+btree_build(unsigned int *a, size_t n, size_t t = 0, size_t k = 0)
+{
+	if (k < bnodes) {
+		for (size_t i = 0; i < B; ++i) {
+			t = btree_build(a, n, t, btree_child(k, i));
+			btree[k][i] = t < n ? a[t++] : INT_MAX;
+		}
+		t = btree_build(a, n, t, btree_child(k, B));
+	}
+	return t;
+}
+
+/**
+ * Number of node keys less than @key. The keys are less than INT_MAX, so the
+ * signed comparisons are fine.
+ */
+static inline unsigned int
+btree_rank(const unsigned int *node, __m256i k)
+{
+	__m256i a = _mm256_load_si256((const __m256i *)node);
+	__m256i b = _mm256_load_si256((const __m256i *)(node + 8));
+	int ma = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(k, a)));
+	int mb = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(k, b)));
+
+	// The node is sorted, so the mask is contiguous.
+	return __builtin_ctz(~(ma | (mb << 8)));
+}
+
+/**
+ * Returns the index of the found key in the B-tree layout.
+ */
 inline int
-scan(unsigned int *tbl, unsigned int key)
+search_btree(BNode *bt, size_t n, unsigned int key)
 {
-	for (int i = 0; i < N; ++i)
+	__m256i k = _mm256_set1_epi32(key);
+	int res = -1;
+
+	for (size_t b = 0; b < bnodes; ) {
+		unsigned int i = btree_rank(bt[b], k);
+		if (i < B && bt[b][i] == key)
+			res = b * B + i;
+		b = btree_child(b, i);
+	}
+
+	return res;
+}
+
+inline int
+scan(unsigned int *tbl, size_t n, unsigned int key)
+{
+	for (int i = 0; i < n; ++i)
 		if (tbl[i] == key)
 			return i;
 	return -1;
 }
 
+/**
+ * Compare 4 AVX2 registers at once to have one branch per cache line.
+ * @n must be a multiple of 8.
+ */
 inline int
-scan_stream(unsigned int *tbl, unsigned int key)
+scan_avx2(unsigned int *tbl, size_t n, unsigned int key)
 {
-	return !!memchr(tbl, key, N * sizeof(int));
+	__m256i k = _mm256_set1_epi32(key);
+	size_t i = 0;
+
+	for ( ; i + 32 <= n; i += 32) {
+		__m256i c0 = _mm256_cmpeq_epi32(k, _mm256_load_si256((__m256i *)(tbl + i)));
+		__m256i c1 = _mm256_cmpeq_epi32(k, _mm256_load_si256((__m256i *)(tbl + i + 8)));
+		__m256i c2 = _mm256_cmpeq_epi32(k, _mm256_load_si256((__m256i *)(tbl + i + 16)));
+		__m256i c3 = _mm256_cmpeq_epi32(k, _mm256_load_si256((__m256i *)(tbl + i + 24)));
+		__m256i c = _mm256_or_si256(_mm256_or_si256(c0, c1),
+					    _mm256_or_si256(c2, c3));
+		if (__builtin_expect(!_mm256_testz_si256(c, c), 0))
+			break;
+	}
+	for ( ; i < n; i += 8) {
+		__m256i c = _mm256_cmpeq_epi32(k, _mm256_load_si256((__m256i *)(tbl + i)));
+		int m = _mm256_movemask_ps(_mm256_castsi256_ps(c));
+		if (m)
+			return i + __builtin_ctz(m);
+	}
+
+	return -1;
 }
 
-int
-main()
+static void *
+alloc_area(size_t sz)
 {
-	int key = 1;
-	unsigned int *area;
+	void *p;
 
-	if (posix_memalign((void **)&area, 4096, N * sizeof(int) * ITER)) {
+	if (posix_memalign(&p, 4096, sz)) {
 		std::cerr << "fail memaign" << std::endl;
-		return 1;
+		exit(1);
 	}
-	memset(area, 0, N * sizeof(int) * ITER);
+	memset(p, 0, sz);
 
-	{
-		std::stringstream bres;
-		bres << "binary search: ";
+	return p;
+}
 
-		BENCHMARK_START();
+static void
+build_tables(size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		tbl[i] = 2 * i + 1;
+	eytzinger_build(tbl, n);
+	bnodes = (n + B - 1) / B;
+	btree_build(tbl, n);
+	for (size_t i = 0; i < LOOKUPS; ++i)
+		keys[i] = rand() % (2 * n + 2);
+}
 
-		for (int i = 0; i < ITER; ++i)
-			bsearch(area + i * N, key);
-	
-		BENCHMARK_RESULT(bres.str());
+/**
+ * Each search must find the same keys as the reference binary search.
+ */
+template<typename F, typename T>
+static void
+check(F search, T *layout, size_t n, const unsigned int *data)
+{
+	for (size_t i = 0; i < 2 * n + 2; ++i) {
+		int r = search(layout, n, i);
+		bool found = std::binary_search(tbl, tbl + n, i);
+		if ((r >= 0) != found || (found && data[r] != i)) {
+			std::cerr << "bad search result for key " << i
+				  << " in table of " << n << std::endl;
+			exit(1);
+		}
 	}
+}
 
-	{
-		std::stringstream bres;
-		bres << "scan: ";
+template<typename F, typename T>
+static void
+benchmark(const char *name, F search, T *layout, size_t n)
+{
+	volatile int r = 0;
 
-		BENCHMARK_START();
+	BENCH_RUN(name, LOOKUPS, {
+		for (size_t i = 0; i < LOOKUPS; ++i)
+			r += search(layout, n, keys[i]);
+	});
+}
 
-		for (int i = 0; i < ITER; ++i)
-			scan(area + i * N, key);
-	
-		BENCHMARK_RESULT(bres.str());
-	}
+int
+main()
+{
+	tbl = (unsigned int *)alloc_area(N_MAX * sizeof(int));
+	eytz = (unsigned int *)alloc_area((N_MAX + 1) * sizeof(int));
+	btree = (BNode *)alloc_area((N_MAX + B - 1) / B * sizeof(BNode));
+	keys = (unsigned int *)alloc_area(LOOKUPS * sizeof(int));
 
-	{
-		std::stringstream bres;
-		bres << "scan stream: ";
+	for (size_t n = N_MIN; n <= N_MAX; n *= 2) {
+		build_tables(n);
 
-		BENCHMARK_START();
+		check(search_binary, tbl, n, tbl);
+		check(search_branchless, tbl, n, tbl);
+		check(search_eytzinger, eytz, n, eytz);
+		check(search_btree, btree, n, (unsigned int *)btree);
+		if (n <= SCAN_N_MAX) {
+			check(scan, tbl, n, tbl);
+			check(scan_avx2, tbl, n, tbl);
+		}
 
-		for (int i = 0; i < ITER; ++i)
-			scan_stream(area + i * N, key);
-	
-		BENCHMARK_RESULT(bres.str());
+		std::cout << "N=" << n << " (" << n * sizeof(int) / 1024
+			  << "KB), " << LOOKUPS << " lookups:" << std::endl;
+		benchmark("binary search", search_binary, tbl, n);
+		benchmark("branchless lower bound", search_branchless, tbl, n);
+		benchmark("Eytzinger w/ prefetch", search_eytzinger, eytz, n);
+		benchmark("B-tree AVX2", search_btree, btree, n);
+		if (n <= SCAN_N_MAX) {
+			benchmark("scan", scan, tbl, n);
+			benchmark("scan AVX2", scan_avx2, tbl, n);
+		}
 	}
 
-	free(area);
+	free(keys);
+	free(btree);
+	free(eytz);
+	free(tbl);
 
 	return 0;
 }
-
@@ -1,10 +1,10 @@
 /**
  * Benchmark for Intel Haswell AVX2 instructions for plain bitwise operations
- * on integers.
+ * on integers and for the bm_lookup.h variants on different array sizes.
  *
  * Compile with
  *
- * g++ -O3 -march=core-avx-i -mtune=core-avx-i -mavx2 -mno-vzeroupper avx2.cc
+ * g++ -O3 -march=core-avx-i -mtune=core-avx-i -mavx2 -mno-vzeroupper avx2.cc -lm
  *
  * Copyright (C) 2014 Alexander Krizhanovsky (ak@tempesta-tech.com).
  *
@@ -22,10 +22,14 @@
  * this program; if not, write to the Free Software Foundation, Inc., 59
  * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
-#include <sys/time.h>
+#include <stdlib.h>
+#include <string.h>
 #include <iostream>
 #include <immintrin.h>
 
+#include "bench.h"
+#include "bm_lookup.h"
+
 volatile unsigned int BIT_PATTERN = 2048;
 volatile unsigned int * volatile wc;
 static unsigned int __wc[10][16] __attribute__((aligned(64))) = {
@@ -146,26 +150,17 @@ avx2_lookup_opt3(unsigned int bm, volatile unsigned int *w)
 	return !_mm256_testz_si256(o, m);
 }
 
-static inline unsigned long
-tv_to_ms(const struct timeval &tv)
-{
-	return ((unsigned long)tv.tv_sec * 1000000 + tv.tv_usec) / 1000;
-}
-
 #define test(lookup, t)							\
 do {									\
 	bool r = false;							\
-	struct timeval tv0, tv1;					\
-									\
-	gettimeofday(&tv0, NULL);					\
 									\
-	for (int i = 0; i < 10000000; ++i)				\
-		r |= lookup(BIT_PATTERN, wc + t * 16);			\
-									\
-	gettimeofday(&tv1, NULL);					\
-									\
-	std::cout << (r ? "found, " : "not found, ")			\
-		  << (tv_to_ms(tv1) - tv_to_ms(tv0)) << "ms" << std::endl; \
+	BENCH_RUN(#lookup, 10000000, {					\
+		for (int i = 0; i < 10000000; ++i)			\
+			r |= lookup(BIT_PATTERN, wc + t * 16);		\
+	});								\
+	/* The case 8 has no matches. */				\
+	if (r == (t == 8))						\
+		abort();						\
 } while (0)
 
 void
@@ -185,24 +180,114 @@ test_case(int t)
 #define do_test_all(lookup)						\
 do {									\
 	bool r = false;							\
-	struct timeval tv0, tv1;					\
-									\
-	gettimeofday(&tv0, NULL);					\
 									\
-	for (int i = 0; i < 10000000; ++i)				\
-		for (int j = 0; j < 10; ++j)				\
-			r |= lookup(BIT_PATTERN, wc + j * 16);		\
-									\
-	gettimeofday(&tv1, NULL);					\
+	BENCH_RUN(#lookup, 10000000 * 10, {				\
+		for (int i = 0; i < 10000000; ++i)			\
+			for (int j = 0; j < 10; ++j)			\
+				r |= lookup(BIT_PATTERN, wc + j * 16);	\
+	});								\
+	if (!r)								\
+		abort();						\
+} while (0)
+
+// The test cases for @n words arrays: the words of the case 8, which has
+// no matches, with the matching word at the same relative position as in
+// the 16 words case.
+static unsigned int __wcn[10][BM_LOOKUP_MAX] __attribute__((aligned(64)));
+
+static void
+build_cases(unsigned int n)
+{
+	for (int t = 0; t < 10; ++t) {
+		for (unsigned int i = 0; i < n; ++i)
+			__wcn[t][i] = __wc[8][i % 16];
+		for (unsigned int i = 0; i < 16; ++i)
+			if (__wc[t][i] & BIT_PATTERN)
+				for (unsigned int j = i * n / 16;
+				     j < (i + 1) * n / 16; ++j)
+				{
+					__wcn[t][j] = __wc[t][i];
+					if (t < 9)
+						break;
+				}
+	}
+}
+
+static bool
+has_isa(int isa)
+{
+	switch (isa) {
+	case BM_ISA_AVX512:
+		return __builtin_cpu_supports("avx512f");
+	case BM_ISA_AVX2:
+		return __builtin_cpu_supports("avx2");
+	case BM_ISA_SSE42:
+		return __builtin_cpu_supports("sse4.2");
+	default:
+		return true;
+	}
+}
+
+/*
+ * All the variants must agree with the scalar mask.
+ */
+static void
+check_cases(unsigned int n)
+{
+	int saved_isa = bm_isa;
+
+	for (int t = 0; t < 10; ++t) {
+		const uint32_t *w = __wcn[t];
+		uint64_t ref = __bm_mask_scalar(BIT_PATTERN, w, n);
+		int ref_idx = ref ? __builtin_ctzll(ref) : -1;
+
+		for (int isa = BM_ISA_SCALAR; isa <= BM_ISA_AVX512; ++isa) {
+			if (!has_isa(isa))
+				continue;
+			bm_isa = isa;
+			if (bm_lookup_mask(BIT_PATTERN, w, n) != ref
+			    || bm_lookup_any(BIT_PATTERN, w, n) != !!ref
+			    || bm_lookup_idx(BIT_PATTERN, w, n) != ref_idx)
+			{
+				std::cerr << "bad lookup for isa " << isa
+					  << " n=" << n << " case " << t
+					  << std::endl;
+				abort();
+			}
+		}
+	}
+
+	bm_isa = saved_isa;
+}
+
+// The index value is -1 for missed lookups.
+static inline int
+bm_lookup_idx_hit(uint32_t bm, const uint32_t *w, unsigned int n)
+{
+	return bm_lookup_idx(bm, w, n) + 1;
+}
+
+#define do_test_n(lookup, n)						\
+do {									\
+	unsigned long r = 0;						\
 									\
+	BENCH_RUN(#lookup, 2000000 * 10, {				\
+		for (int i = 0; i < 2000000; ++i)			\
+			for (int j = 0; j < 10; ++j)			\
+				r += lookup(BIT_PATTERN,		\
+					    (const uint32_t *)wcn	\
+					    + j * BM_LOOKUP_MAX, n);	\
+	});								\
 	if (!r)								\
 		abort();						\
-	std::cout << (tv_to_ms(tv1) - tv_to_ms(tv0)) << "ms" << std::endl; \
 } while (0)
 
 void
 test_all()
 {
+	volatile unsigned int * volatile wcn
+		= (volatile unsigned int * volatile)__wcn;
+
 	std::cout << "---- test all ----"<< std::endl;
 
 	do_test_all(cycle_lookup_naive);
@@ -212,6 +297,29 @@ test_all()
 	do_test_all(avx2_lookup_opt1);
 	do_test_all(avx2_lookup_opt2);
 	do_test_all(avx2_lookup_opt3);
+
+	for (unsigned int n = 8; n <= BM_LOOKUP_MAX; n *= 2) {
+		build_cases(n);
+		check_cases(n);
+
+		std::cout << "---- test all, " << n << " words ----"
+			  << std::endl;
+		do_test_n(__bm_any_scalar, n);
+		do_test_n(__bm_mask_scalar, n);
+		if (has_isa(BM_ISA_SSE42)) {
+			do_test_n(__bm_any_sse42, n);
+			do_test_n(__bm_mask_sse42, n);
+		}
+		if (has_isa(BM_ISA_AVX2)) {
+			do_test_n(__bm_any_avx2, n);
+			do_test_n(__bm_mask_avx2, n);
+		}
+		if (has_isa(BM_ISA_AVX512)) {
+			do_test_n(__bm_any_avx512, n);
+			do_test_n(__bm_mask_avx512, n);
+		}
+		do_test_n(bm_lookup_idx_hit, n);
+	}
 }
 
 int
@@ -220,6 +328,7 @@ main()
 	// Prohibit compiler optimizations for staticness and constantness
 	// of the arrays.
 	wc = (volatile unsigned int * volatile)__wc;
+	bm_lookup_init();
 
 	for (int i = 0; i < 10; ++i)
 		test_case(i);
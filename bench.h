@@ -0,0 +1,728 @@
+/**
+ * Common benchmark harness: TSC and monotonic clock timers, CPU affinity
+ * of the benchmark threads, warm-up runs, repeated trials with median and
+ * standard deviation, and the text, CSV or JSON output, so the results are
+ * comparable between the modules, runs and machines.
+ *
+ * The harness is configured by the environment, so the benchmarks keep their
+ * own command lines:
+ *
+ *	BENCH_WARMUP	untimed runs before the trials, 1 by default;
+ *	BENCH_TRIALS	timed runs, 5 by default;
+ *	BENCH_CPUS	comma separated CPUs for bench_pin_thread(), the CPUs
+ *			allowed for the process by default. The main thread
+ *			is pinned to the first CPU if the variable is set;
+ *	BENCH_FORMAT	"text" (default), "csv" or "json" (a JSON object per
+ *			line);
+ *	BENCH_OUT	append the results to the file instead of stdout;
+ *	BENCH_PERF	if set to non-zero, count the hardware events with
+ *			perf_event_open() and report them per operation.
+ *
+ * Usage:
+ *
+ *	BENCH_RUN("name", ops, {
+ *		... code to measure, executed BENCH_WARMUP + BENCH_TRIALS
+ *		    times ...
+ *	});
+ *
+ * The code runs BENCH_WARMUP + BENCH_TRIALS times, so it must produce the same
+ * results on each run. @ops is the number of operations in one run for the
+ * per operation times, 0 if it doesn't make sense.
+ *
+ * The hardware events are cycles, instructions, LLC, dTLB and branch misses
+ * of the user space code. BENCH_RUN() counts them automatically; to count
+ * them for any other region use
+ *
+ *	struct bench_perf p;
+ *
+ *	bench_perf_begin(&p);
+ *	... run the threads of the region ...
+ *	bench_perf_end(&p);
+ *	bench_report("name", ops, NULL, 0, &p);
+ *
+ * The counters are inherited by the threads created inside the region and
+ * summed on the threads exit, or a thread can count its own events with its
+ * own bench_perf and add them by bench_perf_add(). The events which the CPU
+ * or the kernel doesn't support, e.g. in a VM, are reported as n/a.
+ *
+ * The header is for both C and C++, the harness state is shared by all the
+ * translation units of a program through weak symbols. Include it before the
+ * system headers in C sources compiled with -std=c99, it needs _GNU_SOURCE,
+ * and link with -lm.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BENCH_MAX_TRIALS	1000
+#define BENCH_MAX_CPUS		1024
+
+enum {
+	BENCH_TEXT,
+	BENCH_CSV,
+	BENCH_JSON,
+};
+
+struct bench_stats {
+	unsigned int	n;
+	double		min;
+	double		max;
+	double		mean;
+	double		median;
+	double		stddev;
+};
+
+struct bench_cfg {
+	int		init;
+	unsigned int	warmup;
+	unsigned int	trials;
+	int		format;
+	int		perf;
+	int		csv_header;
+	FILE		*out;
+	int		n_cpus;
+	int		cpus[BENCH_MAX_CPUS];
+	char		cpu_model[128];
+};
+
+/* The state shared by the translation units. */
+struct bench_cfg bench_cfg __attribute__((weak));
+
+/* Statistics of the last BENCH_RUN() in nanoseconds per run. */
+struct bench_stats bench_last __attribute__((weak));
+
+static inline uint64_t
+bench_rdtsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int lo, hi;
+
+	/* lfence: don't let the measured code to be reordered with rdtsc. */
+	__asm__ __volatile__("lfence; rdtsc; lfence"
+			     : "=a"(lo), "=d"(hi) : : "memory");
+
+	return ((uint64_t)hi << 32) | lo;
+#else
+	return 0;
+#endif
+}
+
+static inline uint64_t
+bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * TSC cycles per nanosecond, calibrated once by the monotonic clock.
+ */
+static inline double
+bench_tsc_per_ns(void)
+{
+	static double tsc_ns;
+
+	if (!tsc_ns) {
+		uint64_t t0 = bench_now_ns(), c0 = bench_rdtsc();
+		usleep(50 * 1000);
+		uint64_t t1 = bench_now_ns(), c1 = bench_rdtsc();
+		tsc_ns = (double)(c1 - c0) / (t1 - t0);
+	}
+
+	return tsc_ns;
+}
+
+static inline int
+bench_pin_cpu(int cpu)
+{
+	cpu_set_t set;
+
+	if (cpu < 0)
+		return 0;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	return -pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static inline void
+__bench_read_cpu_model(char *buf, size_t len)
+{
+	char line[256];
+	FILE *f = fopen("/proc/cpuinfo", "r");
+
+	snprintf(buf, len, "unknown");
+	if (!f)
+		return;
+	while (fgets(line, sizeof(line), f)) {
+		char *p = strchr(line, ':');
+		if (strncmp(line, "model name", 10) || !p)
+			continue;
+		for (++p; *p == ' '; ++p)
+			;
+		p[strcspn(p, "\n")] = 0;
+		snprintf(buf, len, "%s", p);
+		break;
+	}
+	fclose(f);
+}
+
+static inline void
+bench_init(void)
+{
+	struct bench_cfg *c = &bench_cfg;
+	const char *s;
+	cpu_set_t set;
+
+	if (c->init)
+		return;
+	c->init = 1;
+
+	c->warmup = (s = getenv("BENCH_WARMUP")) ? atoi(s) : 1;
+	c->trials = (s = getenv("BENCH_TRIALS")) ? atoi(s) : 5;
+	if (c->trials < 1)
+		c->trials = 1;
+	if (c->trials > BENCH_MAX_TRIALS)
+		c->trials = BENCH_MAX_TRIALS;
+
+	c->format = BENCH_TEXT;
+	if ((s = getenv("BENCH_FORMAT"))) {
+		if (!strcmp(s, "csv"))
+			c->format = BENCH_CSV;
+		else if (!strcmp(s, "json"))
+			c->format = BENCH_JSON;
+	}
+
+	c->perf = (s = getenv("BENCH_PERF")) && *s && strcmp(s, "0");
+
+	c->out = stdout;
+	if ((s = getenv("BENCH_OUT")) && !(c->out = fopen(s, "a"))) {
+		fprintf(stderr, "bench: cannot open %s: %s\n", s,
+			strerror(errno));
+		c->out = stdout;
+	}
+
+	c->n_cpus = 0;
+	if ((s = getenv("BENCH_CPUS"))) {
+		for (char *e; *s && c->n_cpus < BENCH_MAX_CPUS; s = e) {
+			c->cpus[c->n_cpus++] = strtol(s, &e, 10);
+			if (*e == ',')
+				++e;
+			else if (*e || e == s)
+				break;
+		}
+		bench_pin_cpu(c->cpus[0]);
+	}
+	else if (!sched_getaffinity(0, sizeof(set), &set)) {
+		for (int i = 0; i < CPU_SETSIZE && c->n_cpus < BENCH_MAX_CPUS;
+		     ++i)
+			if (CPU_ISSET(i, &set))
+				c->cpus[c->n_cpus++] = i;
+	}
+
+	__bench_read_cpu_model(c->cpu_model, sizeof(c->cpu_model));
+}
+
+/**
+ * Pins the calling thread to the @i-th benchmark CPU, wrapping around if
+ * there are more threads than CPUs. @return the CPU.
+ */
+static inline int
+bench_pin_thread(int i)
+{
+	int cpu;
+
+	bench_init();
+	if (!bench_cfg.n_cpus)
+		return -1;
+	cpu = bench_cfg.cpus[i % bench_cfg.n_cpus];
+	bench_pin_cpu(cpu);
+
+	return cpu;
+}
+
+/*
+ * ------------------------------------------------------------------------
+ *	Hardware performance counters
+ * ------------------------------------------------------------------------
+ */
+enum {
+	BENCH_PERF_CYCLES,
+	BENCH_PERF_INSTR,
+	BENCH_PERF_LLC_MISS,
+	BENCH_PERF_DTLB_MISS,
+	BENCH_PERF_BR_MISS,
+	BENCH_PERF_N
+};
+
+static const char *const bench_perf_name[BENCH_PERF_N] = {
+	"hw_cycles", "instructions", "llc_misses", "dtlb_misses", "branch_misses"
+};
+
+/*
+ * The counters of a region: -1 descriptors for the not supported events,
+ * @cnt are the summed values with negative values for n/a.
+ */
+struct bench_perf {
+	int		fd[BENCH_PERF_N];
+	int64_t		cnt[BENCH_PERF_N];
+};
+
+static inline int
+__bench_perf_open(int e, int inherit)
+{
+	static const struct {
+		uint32_t	type;
+		uint64_t	config;
+	} ev[BENCH_PERF_N] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB
+				      | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+				      | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	};
+	struct perf_event_attr pe;
+
+	memset(&pe, 0, sizeof(pe));
+	pe.type = ev[e].type;
+	pe.size = sizeof(pe);
+	pe.config = ev[e].config;
+	pe.disabled = 1;
+	pe.inherit = inherit;
+	pe.exclude_kernel = 1;
+	pe.exclude_hv = 1;
+	/*
+	 * The events aren't grouped since the inherited counters can't be
+	 * read as a group, so scale them if the PMU multiplexes them.
+	 */
+	pe.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+			 | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	return syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0);
+}
+
+static inline void
+bench_perf_reset(struct bench_perf *p)
+{
+	for (int e = 0; e < BENCH_PERF_N; ++e)
+		p->cnt[e] = p->fd[e] < 0 ? -1 : 0;
+}
+
+/**
+ * Opens the counters of the calling thread, and the threads which it creates
+ * after the call if @inherit, with zero values. The counters aren't running.
+ * All the events are n/a if BENCH_PERF isn't set.
+ */
+static inline void
+bench_perf_open(struct bench_perf *p, int inherit)
+{
+	static int warned;
+	int n = 0;
+
+	bench_init();
+	for (int e = 0; e < BENCH_PERF_N; ++e) {
+		p->fd[e] = bench_cfg.perf ? __bench_perf_open(e, inherit) : -1;
+		n += p->fd[e] >= 0;
+	}
+	if (bench_cfg.perf && !n && !warned) {
+		warned = 1;
+		fprintf(stderr, "bench: no hardware events: %s\n",
+			strerror(errno));
+	}
+	bench_perf_reset(p);
+}
+
+static inline void
+bench_perf_close(struct bench_perf *p)
+{
+	for (int e = 0; e < BENCH_PERF_N; ++e)
+		if (p->fd[e] >= 0) {
+			close(p->fd[e]);
+			p->fd[e] = -1;
+		}
+}
+
+static inline void
+bench_perf_start(struct bench_perf *p)
+{
+	for (int e = 0; e < BENCH_PERF_N; ++e)
+		if (p->fd[e] >= 0) {
+			ioctl(p->fd[e], PERF_EVENT_IOC_RESET, 0);
+			ioctl(p->fd[e], PERF_EVENT_IOC_ENABLE, 0);
+		}
+}
+
+/**
+ * Stops the counters and adds their values since bench_perf_start().
+ */
+static inline void
+bench_perf_stop(struct bench_perf *p)
+{
+	for (int e = 0; e < BENCH_PERF_N; ++e)
+		if (p->fd[e] >= 0)
+			ioctl(p->fd[e], PERF_EVENT_IOC_DISABLE, 0);
+	for (int e = 0; e < BENCH_PERF_N; ++e) {
+		uint64_t v[3]; /* value, time enabled, time running */
+
+		if (p->fd[e] < 0)
+			continue;
+		if (read(p->fd[e], v, sizeof(v)) != sizeof(v)) {
+			p->cnt[e] = -1;
+			continue;
+		}
+		if (v[2] && v[2] < v[1])
+			v[0] = (double)v[0] * v[1] / v[2];
+		if (p->cnt[e] >= 0)
+			p->cnt[e] += v[0];
+	}
+}
+
+/* Counts the events of a region in the calling thread and its new threads. */
+static inline void
+bench_perf_begin(struct bench_perf *p)
+{
+	bench_perf_open(p, 1);
+	bench_perf_start(p);
+}
+
+static inline void
+bench_perf_end(struct bench_perf *p)
+{
+	bench_perf_stop(p);
+	bench_perf_close(p);
+}
+
+/* Initializes an empty sum of the counters, all the events are n/a. */
+static inline void
+bench_perf_init(struct bench_perf *p)
+{
+	for (int e = 0; e < BENCH_PERF_N; ++e) {
+		p->fd[e] = -1;
+		p->cnt[e] = -1;
+	}
+}
+
+/**
+ * Adds the counters of @from, e.g. of a thread, to @to. Thread safe for
+ * the concurrent additions to the same @to.
+ */
+static inline void
+bench_perf_add(struct bench_perf *to, const struct bench_perf *from)
+{
+	for (int e = 0; e < BENCH_PERF_N; ++e) {
+		int64_t old = __atomic_load_n(&to->cnt[e], __ATOMIC_RELAXED);
+
+		if (from->cnt[e] < 0)
+			continue;
+		while (!__atomic_compare_exchange_n(&to->cnt[e], &old,
+						    (old < 0 ? 0 : old)
+						    + from->cnt[e], 0,
+						    __ATOMIC_RELAXED,
+						    __ATOMIC_RELAXED))
+			;
+	}
+}
+
+/* @return true if any of the events was counted. */
+static inline int
+bench_perf_valid(const struct bench_perf *p)
+{
+	if (!p)
+		return 0;
+	for (int e = 0; e < BENCH_PERF_N; ++e)
+		if (p->cnt[e] >= 0)
+			return 1;
+
+	return 0;
+}
+
+static inline int
+__bench_cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * Sorts @v and computes the statistics of its @n values.
+ */
+static inline void
+bench_stats_calc(double *v, unsigned int n, struct bench_stats *s)
+{
+	double sum = 0, sq = 0;
+
+	memset(s, 0, sizeof(*s));
+	if (!n)
+		return;
+	qsort(v, n, sizeof(*v), __bench_cmp_double);
+	for (unsigned int i = 0; i < n; ++i)
+		sum += v[i];
+	s->n = n;
+	s->min = v[0];
+	s->max = v[n - 1];
+	s->mean = sum / n;
+	s->median = n & 1 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+	for (unsigned int i = 0; i < n; ++i)
+		sq += (v[i] - s->mean) * (v[i] - s->mean);
+	s->stddev = n > 1 ? sqrt(sq / (n - 1)) : 0;
+}
+
+static inline const char *
+__bench_prog(void)
+{
+	return program_invocation_short_name;
+}
+
+/* Prints @s in JSON string quotes. */
+static inline void
+__bench_json_str(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for ( ; *s; ++s) {
+		if (*s == '"' || *s == '\\')
+			fputc('\\', f);
+		if ((unsigned char)*s >= 0x20)
+			fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+/* Prints the events of @p divided by @n, the number of operations or runs. */
+static inline void
+__bench_report_perf_text(FILE *f, unsigned long ops, double n,
+			 const struct bench_perf *p)
+{
+	static const char *const short_name[BENCH_PERF_N] = {
+		"cycles", "instr", "LLC-miss", "dTLB-miss", "br-miss"
+	};
+
+	if (p->cnt[BENCH_PERF_CYCLES] > 0 && p->cnt[BENCH_PERF_INSTR] >= 0)
+		fprintf(f, "%.2f IPC, ", (double)p->cnt[BENCH_PERF_INSTR]
+					 / p->cnt[BENCH_PERF_CYCLES]);
+	for (int e = 0; e < BENCH_PERF_N; ++e) {
+		if (p->cnt[e] < 0)
+			fprintf(f, "n/a");
+		else
+			fprintf(f, "%.3f", p->cnt[e] / n);
+		fprintf(f, " %s%s", short_name[e],
+			e == BENCH_PERF_N - 1 ? "" : ", ");
+	}
+	fprintf(f, " per %s", ops ? "op" : "run");
+}
+
+/**
+ * Reports the statistics @s in nanoseconds per run of the benchmark @name
+ * with @ops operations per run, @cycles is the median TSC cycles per run.
+ * @perf are the hardware events of all the runs, @runs of them. Either of
+ * @s and @perf can be NULL.
+ */
+static inline void
+bench_report_runs(const char *name, unsigned long ops,
+		  const struct bench_stats *s, double cycles,
+		  const struct bench_perf *perf, unsigned int runs)
+{
+	static const struct bench_stats no_stats = { 0 };
+	struct bench_cfg *c = &bench_cfg;
+	double op_ns, op_cycles, n;
+
+	bench_init();
+	if (!bench_perf_valid(perf))
+		perf = NULL;
+	if (!s && !perf)
+		return;
+	if (!s)
+		s = &no_stats;
+	op_ns = ops ? s->median / ops : 0;
+	op_cycles = ops ? cycles / ops : 0;
+	n = (double)(ops ? ops : 1) * (runs ? runs : 1);
+
+	switch (c->format) {
+	case BENCH_CSV:
+		if (!c->csv_header) {
+			c->csv_header = 1;
+			fprintf(c->out, "prog,name,cpu,trials,ops,median_ns,"
+					"mean_ns,stddev_ns,min_ns,max_ns,"
+					"ns_per_op,cycles_per_op");
+			for (int e = 0; e < BENCH_PERF_N; ++e)
+				fprintf(c->out, ",%s_per_op", bench_perf_name[e]);
+			fprintf(c->out, "\n");
+		}
+		fprintf(c->out, "%s,\"%s\",\"%s\",%u,%lu,%.0f,%.0f,%.0f,%.0f,"
+				"%.0f,%.3f,%.3f",
+			__bench_prog(), name, c->cpu_model, s->n, ops,
+			s->median, s->mean, s->stddev, s->min, s->max, op_ns,
+			op_cycles);
+		for (int e = 0; e < BENCH_PERF_N; ++e)
+			if (perf && perf->cnt[e] >= 0)
+				fprintf(c->out, ",%.3f", perf->cnt[e] / n);
+			else
+				fprintf(c->out, ",");
+		fprintf(c->out, "\n");
+		break;
+	case BENCH_JSON:
+		fprintf(c->out, "{\"prog\": ");
+		__bench_json_str(c->out, __bench_prog());
+		fprintf(c->out, ", \"name\": ");
+		__bench_json_str(c->out, name);
+		fprintf(c->out, ", \"cpu\": ");
+		__bench_json_str(c->out, c->cpu_model);
+		fprintf(c->out, ", \"trials\": %u, \"ops\": %lu, "
+				"\"median_ns\": %.0f, \"mean_ns\": %.0f, "
+				"\"stddev_ns\": %.0f, \"min_ns\": %.0f, "
+				"\"max_ns\": %.0f, \"ns_per_op\": %.3f, "
+				"\"cycles_per_op\": %.3f",
+			s->n, ops, s->median, s->mean, s->stddev, s->min,
+			s->max, op_ns, op_cycles);
+		for (int e = 0; perf && e < BENCH_PERF_N; ++e)
+			if (perf->cnt[e] >= 0)
+				fprintf(c->out, ", \"%s_per_op\": %.3f",
+					bench_perf_name[e], perf->cnt[e] / n);
+			else
+				fprintf(c->out, ", \"%s_per_op\": null",
+					bench_perf_name[e]);
+		fprintf(c->out, "}\n");
+		break;
+	default:
+		fprintf(c->out, "\t%s:\t", name);
+		if (s->n) {
+			fprintf(c->out, "%.1fms (stddev %.1f%%, min %.1fms, %u"
+					" trials)",
+				s->median / 1e6,
+				s->mean ? s->stddev * 100 / s->mean : 0,
+				s->min / 1e6, s->n);
+			if (ops)
+				fprintf(c->out, ", %.2fns/op, %.1f cycles/op",
+					op_ns, op_cycles);
+		}
+		if (perf) {
+			fprintf(c->out, s->n ? "\n\t\t" : "");
+			__bench_report_perf_text(c->out, ops, n, perf);
+		}
+		fprintf(c->out, "\n");
+	}
+	fflush(c->out);
+}
+
+/* The same as bench_report_runs() for a single run. */
+static inline void
+bench_report(const char *name, unsigned long ops, const struct bench_stats *s,
+	     double cycles, const struct bench_perf *perf)
+{
+	bench_report_runs(name, ops, s, cycles, perf, 1);
+}
+
+/* State of a BENCH_RUN() loop. */
+struct bench_run {
+	const char	*name;
+	unsigned long	ops;
+	unsigned int	i;
+	uint64_t	t0;
+	uint64_t	c0;
+	double		ns[BENCH_MAX_TRIALS];
+	double		cycles[BENCH_MAX_TRIALS];
+	struct bench_perf perf;
+};
+
+static inline void
+bench_run_init(struct bench_run *r, const char *name, unsigned long ops)
+{
+	bench_init();
+	r->name = name;
+	r->ops = ops;
+	r->i = 0;
+	bench_perf_open(&r->perf, 1);
+}
+
+/**
+ * Records the previous run time, if it was a trial, and starts the next one.
+ * @return false when all the runs are done.
+ */
+static inline int
+bench_run_next(struct bench_run *r)
+{
+	const struct bench_cfg *c = &bench_cfg;
+	uint64_t t = bench_now_ns(), cyc = bench_rdtsc();
+
+	if (r->i > c->warmup) {
+		bench_perf_stop(&r->perf);
+		r->ns[r->i - c->warmup - 1] = t - r->t0;
+		r->cycles[r->i - c->warmup - 1] = cyc - r->c0;
+	}
+	if (r->i++ == c->warmup + c->trials)
+		return 0;
+	if (r->i > c->warmup)
+		bench_perf_start(&r->perf);
+	r->t0 = bench_now_ns();
+	r->c0 = bench_rdtsc();
+
+	return 1;
+}
+
+static inline void
+bench_run_done(struct bench_run *r)
+{
+	struct bench_stats cs;
+
+	bench_stats_calc(r->ns, bench_cfg.trials, &bench_last);
+	bench_stats_calc(r->cycles, bench_cfg.trials, &cs);
+	bench_perf_close(&r->perf);
+	bench_report_runs(r->name, r->ops, &bench_last, cs.median, &r->perf,
+			  bench_cfg.trials);
+}
+
+#define BENCH_RUN(name, ops, ...)					\
+do {									\
+	static struct bench_run __br;					\
+									\
+	bench_run_init(&__br, (name), (ops));				\
+	while (bench_run_next(&__br)) {					\
+		__VA_ARGS__;						\
+	}								\
+	bench_run_done(&__br);						\
+} while (0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BENCH_H__ */
@@ -0,0 +1,246 @@
+/**
+ * Lookup of a bit pattern in an array of 32-bit words, e.g. timer wheel
+ * slot bitmaps or the HTrie bucket scan: find the words having any common
+ * bits with the pattern. The best variants from the avx2.cc benchmark with
+ * the scalar, SSE4.2, AVX2 and AVX-512 implementations and the runtime
+ * dispatch by the CPU features.
+ *
+ * The array size must be a multiple of 8 and not larger than 64, so the
+ * result fits a 64-bit mask. The array may be unaligned.
+ *
+ * Call bm_lookup_init() once before the lookups, otherwise the scalar
+ * versions are used.
+ *
+ * Copyright (C) 2014 Alexander Krizhanovsky (ak@tempesta-tech.com).
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __BM_LOOKUP_H__
+#define __BM_LOOKUP_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <immintrin.h>
+
+#define BM_LOOKUP_MAX	64
+
+enum {
+	BM_ISA_SCALAR,
+	BM_ISA_SSE42,
+	BM_ISA_AVX2,
+	BM_ISA_AVX512,
+};
+
+static int bm_isa = BM_ISA_SCALAR;
+
+/*
+ * Scalar versions, cycle_lookup_opt() from avx2.cc for the existence check:
+ * OR all the words without branches and test the result once.
+ */
+static inline bool
+__bm_any_scalar(uint32_t bm, const uint32_t *w, unsigned int n)
+{
+	uint64_t r = 0, _bm = ((uint64_t)bm << 32) | bm;
+	unsigned int i;
+
+	for (i = 0; i < n; i += 2)
+		r |= (uint64_t)w[i] | ((uint64_t)w[i + 1] << 32);
+
+	return r & _bm;
+}
+
+static inline uint64_t
+__bm_mask_scalar(uint32_t bm, const uint32_t *w, unsigned int n)
+{
+	uint64_t m = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; ++i)
+		m |= (uint64_t)!!(w[i] & bm) << i;
+
+	return m;
+}
+
+static __attribute__((target("sse4.2"))) bool
+__bm_any_sse42(uint32_t bm, const uint32_t *w, unsigned int n)
+{
+	__m128i m = _mm_set1_epi32(bm);
+	__m128i o = _mm_setzero_si128();
+	unsigned int i;
+
+	for (i = 0; i < n; i += 4)
+		o = _mm_or_si128(o, _mm_loadu_si128((const __m128i *)(w + i)));
+
+	return !_mm_testz_si128(o, m);
+}
+
+static __attribute__((target("sse4.2"))) uint64_t
+__bm_mask_sse42(uint32_t bm, const uint32_t *w, unsigned int n)
+{
+	__m128i m = _mm_set1_epi32(bm);
+	__m128i z = _mm_setzero_si128();
+	uint64_t r = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i += 4) {
+		__m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i *)(w + i)),
+					  m);
+		uint64_t e = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, z)));
+		r |= (~e & 0xf) << i;
+	}
+
+	return r;
+}
+
+/*
+ * avx2_lookup_opt3() from avx2.cc, generalized for the array size.
+ */
+static __attribute__((target("avx2"))) bool
+__bm_any_avx2(uint32_t bm, const uint32_t *w, unsigned int n)
+{
+	__m256i m = _mm256_set1_epi32(bm);
+	__m256i o = _mm256_loadu_si256((const __m256i *)w);
+	unsigned int i;
+
+	for (i = 8; i < n; i += 8)
+		o = _mm256_or_si256(o, _mm256_loadu_si256((const __m256i *)(w + i)));
+
+	return !_mm256_testz_si256(o, m);
+}
+
+static __attribute__((target("avx2"))) uint64_t
+__bm_mask_avx2(uint32_t bm, const uint32_t *w, unsigned int n)
+{
+	__m256i m = _mm256_set1_epi32(bm);
+	__m256i z = _mm256_setzero_si256();
+	uint64_t r = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i += 8) {
+		__m256i a = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)
+								(w + i)), m);
+		uint64_t e = _mm256_movemask_ps(_mm256_castsi256_ps(
+					_mm256_cmpeq_epi32(a, z)));
+		r |= (~e & 0xff) << i;
+	}
+
+	return r;
+}
+
+/*
+ * AVX-512 has the test instruction producing the mask right away.
+ * The 8 words tail is processed with AVX2.
+ */
+static __attribute__((target("avx512f,avx2"))) bool
+__bm_any_avx512(uint32_t bm, const uint32_t *w, unsigned int n)
+{
+	__m512i m = _mm512_set1_epi32(bm);
+	__m512i o = _mm512_setzero_si512();
+	unsigned int i;
+
+	for (i = 0; i + 16 <= n; i += 16)
+		o = _mm512_or_si512(o, _mm512_loadu_si512(w + i));
+	if (i < n && __bm_any_avx2(bm, w + i, 8))
+		return true;
+
+	return _mm512_test_epi32_mask(o, m);
+}
+
+static __attribute__((target("avx512f,avx2"))) uint64_t
+__bm_mask_avx512(uint32_t bm, const uint32_t *w, unsigned int n)
+{
+	__m512i m = _mm512_set1_epi32(bm);
+	uint64_t r = 0;
+	unsigned int i;
+
+	for (i = 0; i + 16 <= n; i += 16)
+		r |= (uint64_t)_mm512_test_epi32_mask(_mm512_loadu_si512(w + i),
+						      m) << i;
+	if (i < n)
+		r |= __bm_mask_avx2(bm, w + i, 8) << i;
+
+	return r;
+}
+
+static inline void
+bm_lookup_init(void)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		bm_isa = BM_ISA_AVX512;
+	else if (__builtin_cpu_supports("avx2"))
+		bm_isa = BM_ISA_AVX2;
+	else if (__builtin_cpu_supports("sse4.2"))
+		bm_isa = BM_ISA_SSE42;
+	else
+		bm_isa = BM_ISA_SCALAR;
+}
+
+/**
+ * @return true if any of @n words in @w has common bits with @bm.
+ *
+ * The AVX-512 version is about twice slower than AVX2 for all the sizes in
+ * the avx2.cc benchmark, so AVX2 is used instead.
+ */
+static inline bool
+bm_lookup_any(uint32_t bm, const uint32_t *w, unsigned int n)
+{
+	switch (bm_isa) {
+	case BM_ISA_AVX512:
+	case BM_ISA_AVX2:
+		return __bm_any_avx2(bm, w, n);
+	case BM_ISA_SSE42:
+		return __bm_any_sse42(bm, w, n);
+	default:
+		return __bm_any_scalar(bm, w, n);
+	}
+}
+
+/**
+ * @return mask with bit i set if @w[i] has common bits with @bm.
+ *
+ * AVX-512 pays off only for 32 and more words.
+ */
+static inline uint64_t
+bm_lookup_mask(uint32_t bm, const uint32_t *w, unsigned int n)
+{
+	switch (bm_isa) {
+	case BM_ISA_AVX512:
+		if (n >= 32)
+			return __bm_mask_avx512(bm, w, n);
+		/* fall through */
+	case BM_ISA_AVX2:
+		return __bm_mask_avx2(bm, w, n);
+	case BM_ISA_SSE42:
+		return __bm_mask_sse42(bm, w, n);
+	default:
+		return __bm_mask_scalar(bm, w, n);
+	}
+}
+
+/**
+ * @return index of the first word in @w having common bits with @bm
+ * or -1 if there is no such word.
+ */
+static inline int
+bm_lookup_idx(uint32_t bm, const uint32_t *w, unsigned int n)
+{
+	uint64_t m = bm_lookup_mask(bm, w, n);
+
+	return m ? __builtin_ctzll(m) : -1;
+}
+
+#endif /* __BM_LOOKUP_H__ */
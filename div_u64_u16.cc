@@ -10,209 +10,482 @@
  * $ grep -m 1 'model name' /proc/cpuinfo
  * model name	: Intel(R) Core(TM) i7-6500U CPU @ 2.50GHz
  *
- * $ g++ -march=native -mtune=native -O2 div_u64_u16.cc
+ * $ g++ -march=native -mtune=native -O2 div_u64_u16.cc -lm
  * $ ./a.out
  * Libdivision:
  * 109ms
  *
  * Hardware division:
  * 263ms
+ *
+ * The batch division of arrays by the same divisor uses AVX2 or AVX-512
+ * if the CPU supports them, the code doesn't need any -m options.
  */
 #include <assert.h>
 #include <stdlib.h>
 
-#include <chrono>
-#include <functional>
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 
-static const size_t ITER = 20 * 1000;
-static const size_t NUMS = 1024;
+#include <immintrin.h>
 
-static const unsigned char LIBDIVIDE_ADD_MARKER = 0x40;
-static const unsigned char LIBDIVIDE_64_SHIFT_MASK = 0x3F;
+#include "bench.h"
+#include "libdivide_u64.h"
 
-struct libdivide_u64_t {
-	uint64_t magic;
-	uint8_t more;
-};
+static const size_t ITER = 20 * 1000;
+static const size_t NUMS = 1024;
 
+static uint64_t nums[NUMS] __attribute__((aligned(4096)));
 static unsigned long longs1[NUMS] __attribute__((aligned(4096)));
 static unsigned long longs2[NUMS] __attribute__((aligned(4096)));
+// Quotients of the batch division by one divisor.
+static uint64_t quot_ref[NUMS] __attribute__((aligned(4096)));
+static uint64_t quot[NUMS] __attribute__((aligned(4096)));
 static unsigned short shorts[NUMS] __attribute__((aligned(4096)));
+// WFQ stream weights and the sent data lengths.
+static unsigned int weights[NUMS] __attribute__((aligned(4096)));
+static uint64_t lens[NUMS] __attribute__((aligned(4096)));
+static unsigned int wfq_tbl[256];
+static LibdivideU64 wfq_div[256];
 static struct libdivide_u64_t denoms[NUMS] __attribute__((aligned(4096)));
 
-static inline uint32_t libdivide_mullhi_u32(uint32_t x, uint32_t y)
+/*
+ * Batch division of @n numbers by the same divisor: the divisor branches are
+ * taken once for the whole array.
+ */
+static void
+__libdivide_u64_do_vec_scalar(uint64_t *q, const uint64_t *numer, size_t n,
+			      const struct libdivide_u64_t *denom)
+{
+	uint8_t more = denom->more;
+
+	if (!denom->magic) {
+		for (size_t i = 0; i < n; ++i)
+			q[i] = numer[i] >> more;
+	}
+	else if (more & LIBDIVIDE_ADD_MARKER) {
+		more &= LIBDIVIDE_64_SHIFT_MASK;
+		for (size_t i = 0; i < n; ++i) {
+			uint64_t h = libdivide_mullhi_u64(denom->magic, numer[i]);
+			q[i] = (((numer[i] - h) >> 1) + h) >> more;
+		}
+	}
+	else {
+		for (size_t i = 0; i < n; ++i)
+			q[i] = libdivide_mullhi_u64(denom->magic, numer[i]) >> more;
+	}
+}
+
+static void
+__libdivide_u64_branchfree_do_vec_scalar(uint64_t *q, const uint64_t *numer,
+					 size_t n,
+					 const struct libdivide_u64_branchfree_t *denom)
 {
-	uint64_t xl = x, yl = y;
-	uint64_t rl = xl * yl;
-	return (uint32_t)(rl >> 32);
+	for (size_t i = 0; i < n; ++i)
+		q[i] = libdivide_u64_branchfree_do(numer[i], denom);
 }
 
-static inline uint64_t libdivide_mullhi_u64(uint64_t x, uint64_t y)
+/*
+ * There is no 64x64->128 bits vector multiplication, so compose the high
+ * half from four 32x32->64 bits multiplications.
+ */
+static inline __attribute__((target("avx2"))) __m256i
+libdivide_mullhi_u64_vec256(__m256i x, __m256i y)
 {
-#if defined(__SIZEOF_INT128__)
-	// we go here, not sure about kernel
-	__uint128_t xl = x, yl = y;
-	__uint128_t rl = xl * yl;
-	return (uint64_t)(rl >> 64);
-#else
-	// full 128 bits are x0 * y0 + (x0 * y1 << 32) + (x1 * y0 << 32) + (x1 * y1 << 64)
-	uint32_t mask = 0xFFFFFFFF;
-	uint32_t x0 = (uint32_t)(x & mask);
-	uint32_t x1 = (uint32_t)(x >> 32);
-	uint32_t y0 = (uint32_t)(y & mask);
-	uint32_t y1 = (uint32_t)(y >> 32);
-	uint32_t x0y0_hi = libdivide_mullhi_u32(x0, y0);
-	uint64_t x0y1 = x0 * (uint64_t)y1;
-	uint64_t x1y0 = x1 * (uint64_t)y0;
-	uint64_t x1y1 = x1 * (uint64_t)y1;
-	uint64_t temp = x1y0 + x0y0_hi;
-	uint64_t temp_lo = temp & mask;
-	uint64_t temp_hi = temp >> 32;
-
-	return x1y1 + temp_hi + ((temp_lo + x0y1) >> 32);
-#endif
+	__m256i lomask = _mm256_set1_epi64x(0xffffffff);
+	__m256i xh = _mm256_srli_epi64(x, 32);
+	__m256i yh = _mm256_srli_epi64(y, 32);
+	__m256i w0 = _mm256_mul_epu32(x, y);
+	__m256i w1 = _mm256_mul_epu32(x, yh);
+	__m256i w2 = _mm256_mul_epu32(xh, y);
+	__m256i w3 = _mm256_mul_epu32(xh, yh);
+	__m256i s1 = _mm256_add_epi64(w1, _mm256_srli_epi64(w0, 32));
+	__m256i s2 = _mm256_add_epi64(w2, _mm256_and_si256(s1, lomask));
+	__m256i hi = _mm256_add_epi64(w3, _mm256_srli_epi64(s1, 32));
+
+	return _mm256_add_epi64(hi, _mm256_srli_epi64(s2, 32));
 }
 
-uint64_t libdivide_u64_do(uint64_t numer, const struct libdivide_u64_t *denom)
+static inline __attribute__((target("avx512f"))) __m512i
+libdivide_mullhi_u64_vec512(__m512i x, __m512i y)
 {
-	uint8_t more = denom->more;
+	__m512i lomask = _mm512_set1_epi64(0xffffffff);
+	__m512i xh = _mm512_srli_epi64(x, 32);
+	__m512i yh = _mm512_srli_epi64(y, 32);
+	__m512i w0 = _mm512_mul_epu32(x, y);
+	__m512i w1 = _mm512_mul_epu32(x, yh);
+	__m512i w2 = _mm512_mul_epu32(xh, y);
+	__m512i w3 = _mm512_mul_epu32(xh, yh);
+	__m512i s1 = _mm512_add_epi64(w1, _mm512_srli_epi64(w0, 32));
+	__m512i s2 = _mm512_add_epi64(w2, _mm512_and_si512(s1, lomask));
+	__m512i hi = _mm512_add_epi64(w3, _mm512_srli_epi64(s1, 32));
 
-	// Code from libdivide_u64_gen
+	return _mm512_add_epi64(hi, _mm512_srli_epi64(s2, 32));
+}
+
+/*
+ * The vector versions process the tail, which doesn't fill a vector,
+ * by the scalar code.
+ */
+static __attribute__((target("avx2"))) void
+__libdivide_u64_do_vec_avx2(uint64_t *q, const uint64_t *numer, size_t n,
+			    const struct libdivide_u64_t *denom)
+{
+	__m256i m = _mm256_set1_epi64x(denom->magic);
+	__m128i sh = _mm_cvtsi32_si128(denom->more & LIBDIVIDE_64_SHIFT_MASK);
+	size_t i = 0;
 
 	if (!denom->magic) {
-		return numer >> more;
+		for ( ; i + 4 <= n; i += 4) {
+			__m256i x = _mm256_loadu_si256((const __m256i *)(numer + i));
+			_mm256_storeu_si256((__m256i *)(q + i),
+					    _mm256_srl_epi64(x, sh));
+		}
 	}
-	else {
-		uint64_t q = libdivide_mullhi_u64(denom->magic, numer);
-		if (more & LIBDIVIDE_ADD_MARKER) {
-			uint64_t t = ((numer - q) >> 1) + q;
-			return t >> (more & LIBDIVIDE_64_SHIFT_MASK);
+	else if (denom->more & LIBDIVIDE_ADD_MARKER) {
+		for ( ; i + 4 <= n; i += 4) {
+			__m256i x = _mm256_loadu_si256((const __m256i *)(numer + i));
+			__m256i h = libdivide_mullhi_u64_vec256(m, x);
+			__m256i t = _mm256_add_epi64(_mm256_srli_epi64(
+						_mm256_sub_epi64(x, h), 1), h);
+			_mm256_storeu_si256((__m256i *)(q + i),
+					    _mm256_srl_epi64(t, sh));
 		}
-		else {
-			 // All upper bits are 0,
-			 // don't need to mask them off.
-			return q >> more;
+	}
+	else {
+		for ( ; i + 4 <= n; i += 4) {
+			__m256i x = _mm256_loadu_si256((const __m256i *)(numer + i));
+			__m256i h = libdivide_mullhi_u64_vec256(m, x);
+			_mm256_storeu_si256((__m256i *)(q + i),
+					    _mm256_srl_epi64(h, sh));
 		}
 	}
+
+	__libdivide_u64_do_vec_scalar(q + i, numer + i, n - i, denom);
 }
 
-// libdivide_128_div_64_to_64: divides a 128-bit uint {u1, u0} by a 64-bit
-// uint {v}. The result must fit in 64 bits.
-// Returns the quotient directly and the remainder in *r
-static uint64_t
-libdivide_128_div_64_to_64(uint64_t u1, uint64_t u0, uint64_t v, uint64_t *r)
+static __attribute__((target("avx2"))) void
+__libdivide_u64_branchfree_do_vec_avx2(uint64_t *q, const uint64_t *numer,
+				       size_t n,
+				       const struct libdivide_u64_branchfree_t *denom)
 {
-	uint64_t result;
-#if defined(LIBDIVIDE_X86_64) && \
-	defined(LIBDIVIDE_GCC_STYLE_ASM)
-	__asm__("divq %[v]"
-			: "=a"(result), "=d"(*r)
-			: [v] "r"(v), "a"(u0), "d"(u1)
-			);
-#elif defined(__SIZEOF_INT128__)
-	__uint128_t n = ((__uint128_t)u1 << 64) | u0;
-	result = (uint64_t)(n / v);
-	*r = (uint64_t)(n - result * (__uint128_t)v);
-#else
-#error slow platform
-#endif
-	return result;
+	__m256i m = _mm256_set1_epi64x(denom->magic);
+	__m128i sh = _mm_cvtsi32_si128(denom->more);
+	size_t i = 0;
+
+	for ( ; i + 4 <= n; i += 4) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(numer + i));
+		__m256i h = libdivide_mullhi_u64_vec256(m, x);
+		__m256i t = _mm256_add_epi64(_mm256_srli_epi64(
+					_mm256_sub_epi64(x, h), 1), h);
+		_mm256_storeu_si256((__m256i *)(q + i), _mm256_srl_epi64(t, sh));
+	}
+
+	__libdivide_u64_branchfree_do_vec_scalar(q + i, numer + i, n - i, denom);
 }
 
-static inline struct libdivide_u64_t
-libdivide_internal_u64_gen(uint64_t d)
+static __attribute__((target("avx512f"))) void
+__libdivide_u64_do_vec_avx512(uint64_t *q, const uint64_t *numer, size_t n,
+			      const struct libdivide_u64_t *denom)
 {
-	assert(d);
-
-	struct libdivide_u64_t result;
-	uint32_t floor_log_2_d = 63 - __builtin_clzll(d); // we have similar in kernel
-
-	// Power of 2
-	if ((d & (d - 1)) == 0) {
-		result.magic = 0;
-		result.more = (uint8_t)floor_log_2_d;
-	} else {
-		uint64_t proposed_m, rem;
-		uint8_t more;
-		// (1 << (64 + floor_log_2_d)) / d
-		proposed_m = libdivide_128_div_64_to_64(1ULL << floor_log_2_d, 0, d, &rem);
-
-		assert(rem > 0 && rem < d);
-		const uint64_t e = d - rem;
-
-		// This power works if e < 2**floor_log_2_d.
-		if (e < (1ULL << floor_log_2_d)) {
-			// This power works
-			more = floor_log_2_d;
-		} else {
-			// We have to use the general 65-bit algorithm.  We need to compute
-			// (2**power) / d. However, we already have (2**(power-1))/d and
-			// its remainder. By doubling both, and then correcting the
-			// remainder, we can compute the larger division.
-			// don't care about overflow here - in fact, we expect it
-			proposed_m += proposed_m;
-			const uint64_t twice_rem = rem + rem;
-			if (twice_rem >= d || twice_rem < rem) proposed_m += 1;
-				more = floor_log_2_d | LIBDIVIDE_ADD_MARKER;
+	__m512i m = _mm512_set1_epi64(denom->magic);
+	__m128i sh = _mm_cvtsi32_si128(denom->more & LIBDIVIDE_64_SHIFT_MASK);
+	size_t i = 0;
+
+	if (!denom->magic) {
+		for ( ; i + 8 <= n; i += 8) {
+			__m512i x = _mm512_loadu_si512(numer + i);
+			_mm512_storeu_si512(q + i, _mm512_srl_epi64(x, sh));
+		}
+	}
+	else if (denom->more & LIBDIVIDE_ADD_MARKER) {
+		for ( ; i + 8 <= n; i += 8) {
+			__m512i x = _mm512_loadu_si512(numer + i);
+			__m512i h = libdivide_mullhi_u64_vec512(m, x);
+			__m512i t = _mm512_add_epi64(_mm512_srli_epi64(
+						_mm512_sub_epi64(x, h), 1), h);
+			_mm512_storeu_si512(q + i, _mm512_srl_epi64(t, sh));
+		}
+	}
+	else {
+		for ( ; i + 8 <= n; i += 8) {
+			__m512i x = _mm512_loadu_si512(numer + i);
+			__m512i h = libdivide_mullhi_u64_vec512(m, x);
+			_mm512_storeu_si512(q + i, _mm512_srl_epi64(h, sh));
 		}
-		result.magic = 1 + proposed_m;
-		result.more = more;
-		// result.more's shift should in general be ceil_log_2_d. But if we
-		// used the smaller power, we subtract one from the shift because we're
-		// using the smaller power. If we're using the larger power, we
-		// subtract one from the shift because it's taken care of by the add
-		// indicator. So floor_log_2_d happens to be correct in both cases,
-		// which is why we do it outside of the if statement.
 	}
-	return result;
+
+	__libdivide_u64_do_vec_scalar(q + i, numer + i, n - i, denom);
+}
+
+static __attribute__((target("avx512f"))) void
+__libdivide_u64_branchfree_do_vec_avx512(uint64_t *q, const uint64_t *numer,
+					 size_t n,
+					 const struct libdivide_u64_branchfree_t *denom)
+{
+	__m512i m = _mm512_set1_epi64(denom->magic);
+	__m128i sh = _mm_cvtsi32_si128(denom->more);
+	size_t i = 0;
+
+	for ( ; i + 8 <= n; i += 8) {
+		__m512i x = _mm512_loadu_si512(numer + i);
+		__m512i h = libdivide_mullhi_u64_vec512(m, x);
+		__m512i t = _mm512_add_epi64(_mm512_srli_epi64(
+					_mm512_sub_epi64(x, h), 1), h);
+		_mm512_storeu_si512(q + i, _mm512_srl_epi64(t, sh));
+	}
+
+	__libdivide_u64_branchfree_do_vec_scalar(q + i, numer + i, n - i, denom);
+}
+
+/**
+ * Divide @n numbers from @numer by @denom and store the quotients to @q
+ * using the widest supported vector instructions.
+ */
+static void
+libdivide_u64_do_vec(uint64_t *q, const uint64_t *numer, size_t n,
+		     const struct libdivide_u64_t *denom)
+{
+	if (__builtin_cpu_supports("avx512f"))
+		__libdivide_u64_do_vec_avx512(q, numer, n, denom);
+	else if (__builtin_cpu_supports("avx2"))
+		__libdivide_u64_do_vec_avx2(q, numer, n, denom);
+	else
+		__libdivide_u64_do_vec_scalar(q, numer, n, denom);
+}
+
+static void
+libdivide_u64_branchfree_do_vec(uint64_t *q, const uint64_t *numer, size_t n,
+				const struct libdivide_u64_branchfree_t *denom)
+{
+	if (__builtin_cpu_supports("avx512f"))
+		__libdivide_u64_branchfree_do_vec_avx512(q, numer, n, denom);
+	else if (__builtin_cpu_supports("avx2"))
+		__libdivide_u64_branchfree_do_vec_avx2(q, numer, n, denom);
+	else
+		__libdivide_u64_branchfree_do_vec_scalar(q, numer, n, denom);
 }
 
+/*
+ * The callable processes all the numbers, so it's inlined and there is no
+ * call overhead per division.
+ */
+template<typename F>
 void
-benchmark(const char *desc, std::function<void (int i)> div_cb)
+benchmark(const char *desc, F &&div_cb)
 {
-	using namespace std::chrono;
+	BENCH_RUN(desc, ITER * NUMS, {
+		for (size_t i = 0; i < ITER; ++i) {
+			div_cb();
+			// Don't let the compiler to hoist the invariant divisions.
+			asm volatile("" ::: "memory");
+		}
+	});
+}
 
-	std::cout << desc << ":" << std::endl;
+static void
+check_quot(const char *desc)
+{
+	for (size_t i = 0; i < NUMS; ++i)
+		if (quot[i] != quot_ref[i]) {
+			std::cerr << desc << ": mismatch at " << i << std::endl;
+			break;
+		}
+}
 
-	auto t(steady_clock::now());
-	for (auto i = 0; i < ITER; ++i) {
-		for (auto n = 0; n < NUMS; ++n)
-			div_cb(n);
+/*
+ * WFQ deficits for the stream weights 1-256: the 65536/weight table as in
+ * h2_stream_wfq/mybenchmark_real.cc, the hardware division and libdivide
+ * with the divisors precomputed for each weight. The deficit scaled by the
+ * sent data length is approximated by the table with the rounding error.
+ */
+static void
+wfq_benchmark()
+{
+	for (auto w = 1; w <= 256; ++w) {
+		wfq_tbl[w - 1] = 65536 / w;
+		wfq_div[w - 1] = LibdivideU64(w);
+	}
+	for (size_t i = 0; i < NUMS; ++i) {
+		weights[i] = 1 + rand() % 256;
+		lens[i] = 1 + rand() % 16384;
 	}
-	auto dt = steady_clock::now() - t;
 
-	std::cout << duration_cast<milliseconds>(dt).count()
-		  << "ms" << std::endl;
-	std::cout << std::endl;
+	std::cout << "---- WFQ deficit 65536/weight ----" << std::endl;
+
+	benchmark("Table lookup",
+		  [&]()
+	{
+		for (size_t i = 0; i < NUMS; ++i)
+			quot_ref[i] = wfq_tbl[weights[i] - 1];
+	});
+
+	benchmark("Hardware division",
+		  [&]()
+	{
+		for (size_t i = 0; i < NUMS; ++i)
+			quot[i] = 65536 / weights[i];
+	});
+	check_quot("WFQ hardware division");
+
+	benchmark("Libdivision",
+		  [&]()
+	{
+		for (size_t i = 0; i < NUMS; ++i)
+			quot[i] = 65536 / wfq_div[weights[i] - 1];
+	});
+	check_quot("WFQ libdivision");
+
+	std::cout << "---- WFQ deficit (len << 16)/weight ----" << std::endl;
+
+	benchmark("Table lookup and multiplication",
+		  [&]()
+	{
+		for (size_t i = 0; i < NUMS; ++i)
+			longs1[i] = lens[i] * wfq_tbl[weights[i] - 1];
+	});
+
+	benchmark("Hardware division",
+		  [&]()
+	{
+		for (size_t i = 0; i < NUMS; ++i)
+			quot_ref[i] = (lens[i] << 16) / weights[i];
+	});
+
+	benchmark("Libdivision",
+		  [&]()
+	{
+		for (size_t i = 0; i < NUMS; ++i)
+			quot[i] = (lens[i] << 16) / wfq_div[weights[i] - 1];
+	});
+	check_quot("WFQ scaled libdivision");
+
+	uint64_t max_err = 0;
+	for (size_t i = 0; i < NUMS; ++i)
+		max_err = std::max(max_err, quot_ref[i] - longs1[i]);
+	std::cout << "Table lookup max error: " << max_err << std::endl;
 }
 
 int
 main()
 {
-	for (auto i = 0; i < NUMS; ++i) {
-		longs1[i] = longs2[i] = ((long)rand() << 32) | rand();
-		shorts[i] = rand();
+	__builtin_cpu_init();
+
+	for (size_t i = 0; i < NUMS; ++i) {
+		nums[i] = ((long)rand() << 32) | rand();
+		// Zero divisor isn't allowed and 1 isn't for branchfree.
+		shorts[i] = 2 + rand() % 0xfffe;
 		/* Usually we know the denominators in config time. */
-		denoms[i] = libdivide_internal_u64_gen(shorts[i]);
+		denoms[i] = libdivide_u64_gen(shorts[i]);
 	}
 
 	benchmark("Libdivision",
-		  [&](int i)
+		  [&]()
 	{
-		longs1[i] = libdivide_u64_do(longs1[i], &denoms[i]);
+		for (size_t i = 0; i < NUMS; ++i)
+			longs1[i] = libdivide_u64_do(nums[i], &denoms[i]);
 	});
 
 	benchmark("Hardware division",
-		  [&](int i)
+		  [&]()
 	{
-		longs2[i] = longs2[i] / shorts[i];
+		for (size_t i = 0; i < NUMS; ++i)
+			longs2[i] = nums[i] / shorts[i];
 	});
 
-	for (auto i = 0; i < NUMS; ++i)
+	for (size_t i = 0; i < NUMS; ++i)
 		if (longs1[i] != longs2[i])
 			std::cerr << "Mismatch at " << i << std::endl;
 
+	/*
+	 * Division of the arrays by the same divisor known in config time.
+	 * The divisor is volatile to not let the compiler to see it.
+	 */
+	for (unsigned short d : {(unsigned short)1024, shorts[0], shorts[1]}) {
+		volatile unsigned short vd = d;
+		struct libdivide_u64_t den = libdivide_u64_gen(vd);
+		struct libdivide_u64_branchfree_t bf
+			= libdivide_u64_branchfree_gen(vd);
+
+		std::cout << "---- Batch division by " << d << " ----"
+			  << std::endl;
+
+		benchmark("Hardware division (batch)",
+			  [&]()
+		{
+			unsigned short _d = vd;
+			for (size_t i = 0; i < NUMS; ++i)
+				quot_ref[i] = nums[i] / _d;
+		});
+
+		benchmark("Libdivision (batch, scalar)",
+			  [&]()
+		{
+			__libdivide_u64_do_vec_scalar(quot, nums, NUMS, &den);
+		});
+		check_quot("scalar");
+
+		benchmark("Libdivision branchfree (batch, scalar)",
+			  [&]()
+		{
+			__libdivide_u64_branchfree_do_vec_scalar(quot, nums,
+								 NUMS, &bf);
+		});
+		check_quot("branchfree scalar");
+
+		if (__builtin_cpu_supports("avx2")) {
+			benchmark("Libdivision (batch, AVX2)",
+				  [&]()
+			{
+				__libdivide_u64_do_vec_avx2(quot, nums, NUMS,
+							    &den);
+			});
+			check_quot("AVX2");
+
+			benchmark("Libdivision branchfree (batch, AVX2)",
+				  [&]()
+			{
+				__libdivide_u64_branchfree_do_vec_avx2(quot,
+							nums, NUMS, &bf);
+			});
+			check_quot("branchfree AVX2");
+		}
+
+		if (__builtin_cpu_supports("avx512f")) {
+			benchmark("Libdivision (batch, AVX-512)",
+				  [&]()
+			{
+				__libdivide_u64_do_vec_avx512(quot, nums, NUMS,
+							      &den);
+			});
+			check_quot("AVX-512");
+
+			benchmark("Libdivision branchfree (batch, AVX-512)",
+				  [&]()
+			{
+				__libdivide_u64_branchfree_do_vec_avx512(quot,
+							nums, NUMS, &bf);
+			});
+			check_quot("branchfree AVX-512");
+		}
+
+		benchmark("Libdivision (batch, dispatch)",
+			  [&]()
+		{
+			libdivide_u64_do_vec(quot, nums, NUMS, &den);
+		});
+		check_quot("dispatch");
+
+		benchmark("Libdivision branchfree (batch, dispatch)",
+			  [&]()
+		{
+			libdivide_u64_branchfree_do_vec(quot, nums, NUMS, &bf);
+		});
+		check_quot("branchfree dispatch");
+	}
+
+	wfq_benchmark();
+
 	return 0;
 }
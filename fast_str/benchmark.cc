@@ -21,12 +21,22 @@
  */
 #include <assert.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include <chrono>
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#include <string>
 
+#include "../bench.h"
+
+extern "C" unsigned int _parse_integer(const char *s, unsigned int base,
+				       unsigned long long *p);
+extern "C" unsigned int tfw_parse_dec(const char *s, size_t len,
+				      unsigned long long *p);
+extern "C" unsigned int tfw_parse_hex(const char *s, size_t len,
+				      unsigned long long *p);
 extern "C" size_t tfw_memchreol(const char *s, size_t n);
 extern "C" size_t kern_strspn(const char *s, const char *accept);
 extern "C" void *libc_memchr(const void *s, int c, size_t n);
@@ -41,6 +51,37 @@ extern "C" size_t tfw_match_custom(const char *str, size_t len);
 extern "C" size_t tfw_match_custom_a(const char *str, size_t len);
 extern "C" size_t picohttpparser_findchar_fast(const char *s, size_t len);
 extern "C" size_t cloudflare_check_ranges(const char *s, size_t len);
+extern "C" size_t tfw_match_uri_avx512(const char *s, size_t len);
+extern "C" size_t tfw_match_ctext_vchar_avx512(const char *s, size_t len);
+extern "C" size_t tfw_match_custom_avx512(const char *s, size_t len);
+// The fastest implementations selected for the CPU.
+extern "C" size_t (*tfw_match_uri_best)(const char *s, size_t len);
+extern "C" size_t (*tfw_match_ctext_vchar_best)(const char *s, size_t len);
+extern "C" size_t (*tfw_match_custom_best)(const char *s, size_t len);
+
+struct TfwCset;
+typedef size_t (*tfw_match_fn)(const TfwCset *cs, const char *str,
+			       size_t len);
+extern "C" tfw_match_fn tfw_cset_compile(const char *cfg, TfwCset **cs);
+extern "C" const char *tfw_cset_name(const TfwCset *cs);
+extern "C" void tfw_cset_free(TfwCset *cs);
+
+// The same as in strspn.c.
+struct TfwMatchStream {
+	size_t		(*match)(const char *str, size_t len);
+	tfw_match_fn	cs_match;
+	const TfwCset	*cs;
+	size_t		len;
+	int		done;
+};
+extern "C" void tfw_match_stream_init(TfwMatchStream *ms,
+				      size_t (*match)(const char *str,
+						      size_t len));
+extern "C" void tfw_match_stream_init_cset(TfwMatchStream *ms,
+					   tfw_match_fn match,
+					   const TfwCset *cs);
+extern "C" size_t tfw_match_stream(TfwMatchStream *ms, const char *str,
+				   size_t len);
 
 extern "C" int kern_strcasecmp(const char *s1, const char *s2);
 extern "C" int kern_strncasecmp(const char *s1, const char *s2, size_t len);
@@ -53,6 +94,12 @@ extern "C" int stricmp_avx2_2lc_64_a(const char *s1, const char *s2,
 				     size_t len);
 extern "C" int stricmp_avx2_xor(const char *s1, const char *s2, size_t len);
 extern "C" int stricmp_avx2_xor64(const char *s1, const char *s2, size_t len);
+extern "C" int stricmp_avx2_2lc_mask(const char *s1, const char *s2,
+				     size_t len);
+extern "C" int stricmp_avx512_2lc(const char *s1, const char *s2, size_t len);
+extern "C" int (*stricmp_2lc_best)(const char *s1, const char *s2, size_t len);
+extern "C" int tfw_match_hdr(const char *name, size_t len);
+extern "C" const char *tfw_hdr_name(int id);
 
 static const size_t N = 5 * 1000 * 1000;
 
@@ -61,6 +108,39 @@ static const size_t N = 5 * 1000 * 1000;
 #define ACCEPT_URI	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz" \
 			"!#$%&'*+-._();:@=,/?[]~0123456789"
 
+/*
+ * The same sets as ACCEPT_URI, the URI set plus 0x98 for tfw_match_custom()
+ * and CTEXT+VCHAR for tfw_match_ctext_vchar() in parse_vbr() format.
+ */
+#define CSET_URI	"21 23-3B 3D 3F-5B 5D 5F 61-7A 7E"
+#define CSET_CUSTOM	CSET_URI " 98"
+#define CSET_CTEXT_VCHAR "09 20-7E 80-FF"
+
+/*
+ * Compiled character set and its matching function.
+ */
+struct CompiledCset {
+	TfwCset		*cs;
+	tfw_match_fn	match;
+
+	void
+	compile(const char *cfg)
+	{
+		match = tfw_cset_compile(cfg, &cs);
+		assert(match);
+		std::cout << "compiled charset \"" << cfg << "\" to "
+			  << tfw_cset_name(cs) << std::endl;
+	}
+
+	size_t
+	operator()(const char *str, size_t len) const
+	{
+		return match(cs, str, len);
+	}
+};
+
+static CompiledCset cset_uri, cset_custom, cset_ctext_vchar;
+
 /* Alignmebt for constant static strings. */
 #define CSA(s)		s __attribute__((aligned(32)))
 
@@ -119,6 +199,124 @@ static Str<19> strs[] = {
 	Str<19>("0123456789abcdf~!r~657222568!a~p-2945k0qbjw0ba!fpan~0!fpa~p0-456992954-1322415728212!ns~0!ce~1!je~0!sr~1280x800x24!enc~n!dst~1!et~1340553300515!tzo~-240!ref~!url~http&3a&2f&2fitman.livejournal.com&2f474249.html&3fthread&3d5941385&23t5941385!ogl~title.&d0&9f&d0&be&d1&87&d0&b5&d0&bc&d1&83&20&d0&ba&d0&be&d0&bc&d0&bf&d1&8c&d1&8e&d1&82&d0&b5&d1&80&20--&20&d1&8d&d1&82&d0&be&20&d0&bd&d0&b5&20&d0&ba&d0&be&d0&bd&d0&b5&d1&87&d0&bd&d1&8b&d0&b9&20&d0&b0&d0&b2&d1&82&d0&be&d0&bc&d0&b0&d1&82&3f&2cdescription.&d0&a1&d1&82&d0&be&d0&bb&d0&b5&d1&82&d0&b8&d1&8e&20&d0&a2&d1&8c&d1&8e&d1&80&d0&b8&d0&bd&d0&b3&d0&b0&20&d0&bf&d0&be&d1&81&d0&b2&d1&8f&d1&89&d0&b0&d0&b5&d1&82&d1&81&d1&8f&252e&20&d0&9e&d0&ba&d0&b0&d0&b7&d1&8b&d0&b2&d0&b0&d0&b5&d1&82&d1&81&d1&8f&252c&20&d0&be&d0&b3&d1&80&d0&be&d0&bc&d0&bd&d0&be&d0&b5&20&d0&ba&d0&be&d0&bb&d0&b8&d1&87&d0&b5&d1&81&d1&82&d0&b2&d0&be&20&d0&d0&b8&d1&8e&20&d0&a2&d1&8c&d1&8e&d1&80&d0&b8&d0&bd&d0&b3&d0&b0&20&d0&bf&d0&be&d1&81&d0&b2&d1&8f&d1&89&d0&b0&d0&b5&d1&82&d1&81&d1&8f&252e&20&d0&9e&d0&ba&d0&b0&d0&b7&d1&8b&d0&b2&d0&b0&d0&b5&d1&82&d1&81&d1&8f&252c&20&d0&be&d0&b3&d1&80&d0&be&d0&bc&d0&bd&d0&be&d0&b5&20&d0&ba&d0&be&d0&bb&d0&b8&d1&87&d0&b5&d1&81&d1&82&d0&b2&d0&be&20&d0&bb&d1&8e&d0&b4&d0&b5&d0&b9&20&d1&81&d1&87&d0&b8&d1&82&d0&b0&d0&b5&d1&82&252c&20&d1&be&d0&bb&d0&b8&d1&87&d0&b5&d1&81&d1&82&d0&b2&d0&be&20&d0&bb&d1&8e&d0&b4&d0&b5&d0&b9&20&d1&81&d1&87&d0&b8&d1&82&d0&b0&d0&b5&d1&82&252c&20&d1&87&2cimage.http&3a&2f&2fl-userpic&252elivejournal&252ecom&2f113387160&2f8313909"),
 };
 
+// Header names of a typical request and one unknown header.
+static Str<19> hdrs[] = {
+	Str<19>("Host"),
+	Str<19>("User-Agent"),
+	Str<19>("Accept-Encoding"),
+	Str<19>("cookie"),
+	Str<19>("X-Forwarded-For"),
+	Str<19>("Access-Control-Request-Headers"),
+	Str<19>("X-Custom-Header"),
+};
+
+// Decimal and hexadecimal numbers for the integer parsers.
+static Str<19> dec_nums[] = {
+	Str<19>("0"),
+	Str<19>("200"),
+	Str<19>("4096"),
+	Str<19>("1048576"),
+	Str<19>("1234567890123"),
+	Str<19>("18446744073709551615"),
+};
+
+static Str<19> hex_nums[] = {
+	Str<19>("a"),
+	Str<19>("1000"),
+	Str<19>("fffff"),
+	Str<19>("7fffFFFFffffFFFF"),
+};
+
+/*
+ * The same as the benchmark() below, but for the strings @strs from the
+ * different sets with the strings printed instead of their lengths.
+ */
+template<size_t STRS_N>
+void
+benchmark_strs(const char *desc, Str<19> (&strs)[STRS_N],
+	       std::function<void (const char *str, size_t len)> str_cb)
+{
+	using namespace std::chrono;
+
+	std::cout << desc << ":" << std::endl;
+
+	for (auto s = 0; s < STRS_N; ++s) {
+		struct bench_perf p;
+
+		bench_perf_begin(&p);
+		auto t(steady_clock::now());
+
+		for (auto i = 0; i < N; ++i)
+			str_cb(strs[s].str, strs[s].len);
+
+		auto dt = steady_clock::now() - t;
+		bench_perf_end(&p);
+		std::cout << std::setw(32) << strs[s].str << ":"
+			  << std::setw(8)
+			  << duration_cast<milliseconds>(dt).count()
+			  << "ms" << std::endl;
+		bench_report((std::string(desc) + ": " + strs[s].str).c_str(),
+			     N, NULL, 0, &p);
+	}
+
+	std::cout << std::endl;
+}
+
+/*
+ * Compare case-insensitively strings of lengths 1-64 starting at offsets
+ * 0-63 from a cache line and print the average and the worst calls time for
+ * each length.
+ */
+void
+benchmark_cmp_matrix(const char *desc,
+		     std::function<void (const char *s1, const char *s2,
+					 size_t len)> cmp)
+{
+	using namespace std::chrono;
+
+	static const size_t LEN = 64, ALIGN = 64, M = N / 100;
+	static char s1[ALIGN + LEN] __attribute__((aligned(64)));
+	static char s2[LEN] __attribute__((aligned(64)));
+
+	std::cout << desc << ":" << std::endl;
+
+	for (size_t i = 0; i < LEN; ++i)
+		s2[i] = 'a' + i % 26;
+
+	for (size_t len = 1; len <= LEN; ++len) {
+		double sum = 0, max = 0;
+		size_t max_a = 0;
+
+		for (size_t a = 0; a < ALIGN; ++a) {
+			for (size_t i = 0; i < len; ++i)
+				s1[a + i] = i & 1 ? s2[i] : toupper(s2[i]);
+
+			auto t(steady_clock::now());
+
+			for (auto i = 0; i < M; ++i)
+				cmp(s1 + a, s2, len);
+
+			auto dt = steady_clock::now() - t;
+			double ns = (double)duration_cast<nanoseconds>(dt).count()
+				    / M;
+			sum += ns;
+			if (ns > max) {
+				max = ns;
+				max_a = a;
+			}
+		}
+
+		std::cout << std::setw(16) << "str_len "
+			  << std::setw(5) << len << ": avg "
+			  << std::fixed << std::setprecision(1)
+			  << std::setw(5) << sum / ALIGN << "ns, max "
+			  << std::setw(5) << max << "ns at offset "
+			  << max_a << std::endl;
+	}
+
+	std::cout << std::endl;
+}
+
 void
 benchmark(const char *desc,
 	  std::function<void (const char *str, size_t len)> str_cb)
@@ -128,6 +326,9 @@ benchmark(const char *desc,
 	std::cout << desc << ":" << std::endl;
 
 	for (auto s = 0; s < sizeof(strs) / sizeof(strs[0]); ++s) {
+		struct bench_perf p;
+
+		bench_perf_begin(&p);
 		// steady_clock has the same resolution as high_resolution_clock
 		auto t(steady_clock::now());
 
@@ -135,16 +336,41 @@ benchmark(const char *desc,
 			str_cb(strs[s].str, strs[s].len);
 
 		auto dt = steady_clock::now() - t;
+		bench_perf_end(&p);
 		std::cout << std::setw(16) << "str_len "
 			  << std::setw(5) << strs[s].len << ":"
 			  << std::setw(8)
 			  << duration_cast<milliseconds>(dt).count()
 			  << "ms" << std::endl;
+		bench_report((std::string(desc) + ": str_len "
+			      + std::to_string(strs[s].len)).c_str(),
+			     N, NULL, 0, &p);
 	}
 
 	std::cout << std::endl;
 }
 
+/*
+ * Match @str split to 3 chunks at all the positions, including empty chunks,
+ * with the stream initialized by @init.
+ */
+void
+__test_stream(const char *str, size_t len, size_t expected,
+	      std::function<void (TfwMatchStream *)> init)
+{
+	for (size_t i = 0; i <= len; ++i)
+		for (size_t j = i; j <= len; ++j) {
+			TfwMatchStream ms;
+
+			init(&ms);
+			size_t n = tfw_match_stream(&ms, str, i);
+			n += tfw_match_stream(&ms, str + i, j - i);
+			n += tfw_match_stream(&ms, str + j, len - j);
+			assert(n == expected && ms.len == expected);
+			assert(ms.done == (expected < len));
+		}
+}
+
 void
 __test_strspn(const char *str)
 {
@@ -159,6 +385,22 @@ __test_strspn(const char *str)
 	       == libc_strspn(s.str, ACCEPT_URI));
 	assert(tfw_match_custom_a(s.str, s.len)
 	       == libc_strspn(s.str, ACCEPT_URI));
+	assert(cset_uri(s.str, s.len) == libc_strspn(s.str, ACCEPT_URI));
+	assert(cset_custom(s.str, s.len) == tfw_match_custom(s.str, s.len));
+	assert(tfw_match_uri_best(s.str, s.len)
+	       == libc_strspn(s.str, ACCEPT_URI));
+	assert(tfw_match_custom_best(s.str, s.len)
+	       == tfw_match_custom(s.str, s.len));
+
+	__test_stream(s.str, s.len, libc_strspn(s.str, ACCEPT_URI),
+		      [](TfwMatchStream *ms) {
+			tfw_match_stream_init(ms, tfw_match_uri);
+		      });
+	__test_stream(s.str, s.len, tfw_match_custom(s.str, s.len),
+		      [](TfwMatchStream *ms) {
+			tfw_match_stream_init_cset(ms, cset_custom.match,
+						   cset_custom.cs);
+		      });
 }
 
 void
@@ -207,6 +449,126 @@ test_strspn()
 		      "0123456|95");
 }
 
+/*
+ * Find a header name by the length check and kern_strncasecmp() for each
+ * known name in turn.
+ */
+int
+kern_match_hdr(const char *name, size_t len)
+{
+	const char *h;
+
+	for (int id = 0; (h = tfw_hdr_name(id)); ++id)
+		if (strlen(h) == len && !kern_strncasecmp(name, h, len))
+			return id;
+
+	return -1;
+}
+
+void
+__test_hdr(const char *name, int id)
+{
+	Str<19> s(name);
+
+	std::cout << "test header \"" << name << "\"" << std::endl;
+	assert(tfw_match_hdr(s.str, s.len) == id);
+	assert(kern_match_hdr(s.str, s.len) == id);
+}
+
+void
+test_hdr()
+{
+	const char *h;
+	char buf[64];
+
+	for (int id = 0; (h = tfw_hdr_name(id)); ++id) {
+		size_t n = strlen(h);
+
+		// Capitalize the words like the most of clients do.
+		for (size_t i = 0; i <= n; ++i)
+			buf[i] = !i || h[i - 1] == '-' ? toupper(h[i]) : h[i];
+		__test_hdr(h, id);
+		__test_hdr(buf, id);
+	}
+
+	__test_hdr("", -1);
+	__test_hdr("x", -1);
+	__test_hdr("hos", -1);
+	__test_hdr("hostt", -1);
+	__test_hdr("Accept-", -1);
+	__test_hdr("Acceps", -1);
+	__test_hdr("Content-Typf", -1);
+	__test_hdr("Content_Type", -1);
+	__test_hdr("Access-Control-Allow-Credentials-", -1);
+	__test_hdr("X-Custom-Header", -1);
+
+	// The name at the end of the page followed by an unmapped page.
+	char *p = (char *)mmap(NULL, 8192, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	assert(p != MAP_FAILED);
+	assert(!mprotect(p + 4096, 4096, PROT_NONE));
+	memcpy(p + 4096 - 12, "Content-Type", 12);
+	assert(tfw_match_hdr(p + 4096 - 12, 12)
+	       == kern_match_hdr(p + 4096 - 12, 12));
+	assert(tfw_match_hdr(p + 4096 - 12, 12) >= 0);
+	munmap(p, 8192);
+}
+
+void
+__test_parse_int(const char *str, size_t len)
+{
+	Str<0> s(str, len);
+	unsigned long long v0, v1;
+	unsigned int r0, r1;
+
+	std::cout << "test parse_integer(\"" << s.str << "\")" << std::endl;
+	r0 = _parse_integer(s.str, 10, &v0);
+	r1 = tfw_parse_dec(s.str, s.len, &v1);
+	assert(r0 == r1 && v0 == v1);
+	r0 = _parse_integer(s.str, 16, &v0);
+	r1 = tfw_parse_hex(s.str, s.len, &v1);
+	assert(r0 == r1 && v0 == v1);
+}
+
+void
+test_parse_int()
+{
+	__test_parse_int(_S(""));
+	__test_parse_int(_S("0"));
+	__test_parse_int(_S("q"));
+	__test_parse_int(_S("200 OK"));
+	__test_parse_int(_S("09aF\r\n"));
+	__test_parse_int(_S("123abcg"));
+	__test_parse_int(_S("DEADbeef:"));
+	__test_parse_int(_S("1234567890123456"));
+	__test_parse_int(_S("12345678901234567"));
+	__test_parse_int(_S("fedcba9876543210"));
+	__test_parse_int(_S("7fedcba9876543210"));
+	__test_parse_int(_S("18446744073709551615"));
+	__test_parse_int(_S("18446744073709551616"));
+	__test_parse_int(_S("99999999999999999999999"));
+	__test_parse_int(_S("ffffffffffffffff"));
+	__test_parse_int(_S("10000000000000000"));
+	__test_parse_int(_S("000000000000000000000000000001f"));
+	__test_parse_int(_S("9/8:7@6`5G4g3"));
+
+	// The length limits the number.
+	unsigned long long v;
+	assert(tfw_parse_dec("12345", 3, &v) == 3 && v == 123);
+	assert(tfw_parse_hex("abcdef", 2, &v) == 2 && v == 0xab);
+	assert(tfw_parse_dec("12345", 0, &v) == 0 && v == 0);
+
+	// The number at the end of the page followed by an unmapped page.
+	char *p = (char *)mmap(NULL, 8192, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	assert(p != MAP_FAILED);
+	assert(!mprotect(p + 4096, 4096, PROT_NONE));
+	memcpy(p + 4096 - 4, "1234", 4);
+	assert(tfw_parse_dec(p + 4096 - 4, 4, &v) == 4 && v == 1234);
+	assert(tfw_parse_hex(p + 4096 - 4, 4, &v) == 4 && v == 0x1234);
+	munmap(p, 8192);
+}
+
 void
 __test_strcmp(const char *str1, const char *str2)
 {
@@ -225,6 +587,41 @@ __test_strcmp(const char *str1, const char *str2)
 	       == !!libc_strncasecmp(s1.str, s2.str, std::min(s1.len, s2.len)));
 	assert(!!stricmp_avx2_xor64(s1.str, s2.str, std::min(s1.len, s2.len))
 	       == !!libc_strncasecmp(s1.str, s2.str, std::min(s1.len, s2.len)));
+	assert(!!stricmp_avx2_2lc_mask(s1.str, s2.str, std::min(s1.len, s2.len))
+	       == !!libc_strncasecmp(s1.str, s2.str, std::min(s1.len, s2.len)));
+	assert(!!stricmp_2lc_best(s1.str, s2.str, std::min(s1.len, s2.len))
+	       == !!libc_strncasecmp(s1.str, s2.str, std::min(s1.len, s2.len)));
+}
+
+/*
+ * The short strings compare with the both strings at the end of a page
+ * followed by an unmapped page.
+ */
+void
+test_strcmp_page_end()
+{
+	static const char *s = "0123456789_ABCDEFGHIJKLMNOPQRSTU";
+	static const char *lc = "0123456789_abcdefghijklmnopqrstu";
+
+	std::cout << "test strcasecmp() at the end of a page" << std::endl;
+
+	char *p = (char *)mmap(NULL, 3 * 4096, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	assert(p != MAP_FAILED);
+	assert(!mprotect(p + 4096, 4096, PROT_NONE));
+	char *p1 = p + 4096, *p2 = p + 3 * 4096;
+
+	for (size_t len = 1; len < 32; ++len) {
+		memcpy(p1 - len, s, len);
+		memcpy(p2 - len, lc, len);
+		assert(!stricmp_avx2_2lc_mask(p1 - len, p2 - len, len));
+		assert(!stricmp_2lc_best(p1 - len, p2 - len, len));
+		p2[-1] ^= 1;
+		assert(stricmp_avx2_2lc_mask(p1 - len, p2 - len, len));
+		assert(stricmp_2lc_best(p1 - len, p2 - len, len));
+	}
+
+	munmap(p, 3 * 4096);
 }
 
 void
@@ -306,6 +703,11 @@ __test_ctext_vchar(const char *str, size_t len)
 			break;
 	}
 	assert(tfw_match_ctext_vchar(s.str, s.len) == n);
+	assert(cset_ctext_vchar(s.str, s.len) == n);
+	assert(tfw_match_ctext_vchar_best(s.str, s.len) == n);
+	__test_stream(s.str, s.len, n, [](TfwMatchStream *ms) {
+		tfw_match_stream_init(ms, tfw_match_ctext_vchar_best);
+	});
 }
 
 void
@@ -340,11 +742,20 @@ test_ctext_vchar()
 int
 main()
 {
+	bool avx512 = __builtin_cpu_supports("avx512bw")
+		      && __builtin_cpu_supports("avx512vl");
+
 	tfw_init_vconstants();
 	strcasecmp_init_const();
+	cset_uri.compile(CSET_URI);
+	cset_custom.compile(CSET_CUSTOM);
+	cset_ctext_vchar.compile(CSET_CTEXT_VCHAR);
 
 	// Tests go first.
 	test_strcmp();
+	test_strcmp_page_end();
+	test_hdr();
+	test_parse_int();
 	test_strspn();
 	test_ctext_vchar();
 
@@ -415,6 +826,92 @@ main()
 		stricmp_avx2_2lc_64_a(str, str, len);
 	});
 
+	benchmark("AVX2/64bit strncasecmp(), one string case conversion, masked",
+		  [&](const char *str, size_t len)
+	{
+		stricmp_avx2_2lc_mask(str, str, len);
+	});
+
+	if (avx512)
+		benchmark("AVX-512/64bit strncasecmp(), one string case conversion",
+			  [&](const char *str, size_t len)
+		{
+			stricmp_avx512_2lc(str, str, len);
+		});
+
+	/* Short strings at all the cache line offsets. */
+	benchmark_cmp_matrix("GLIBC strncasecmp()",
+			     [&](const char *s1, const char *s2, size_t len)
+	{
+		libc_strncasecmp(s1, s2, len);
+	});
+
+	benchmark_cmp_matrix("AVX2/64bit strncasecmp(), one string case conversion",
+			     [&](const char *s1, const char *s2, size_t len)
+	{
+		stricmp_avx2_2lc_64(s1, s2, len);
+	});
+
+	benchmark_cmp_matrix("AVX2/64bit strncasecmp(), one string case conversion, masked",
+			     [&](const char *s1, const char *s2, size_t len)
+	{
+		stricmp_avx2_2lc_mask(s1, s2, len);
+	});
+
+	if (avx512)
+		benchmark_cmp_matrix("AVX-512/64bit strncasecmp(), one string case conversion",
+				     [&](const char *s1, const char *s2,
+					 size_t len)
+		{
+			stricmp_avx512_2lc(s1, s2, len);
+		});
+
+	/*
+	 *	Header names matching.
+	 */
+	benchmark_strs("Linux kernel strncasecmp() for each header", hdrs,
+		       [&](const char *str, size_t len)
+	{
+		kern_match_hdr(str, len);
+	});
+
+	benchmark_strs("Tempesta AVX2 header names hash", hdrs,
+		       [&](const char *str, size_t len)
+	{
+		tfw_match_hdr(str, len);
+	});
+
+	/*
+	 *	Integer parsing.
+	 */
+	benchmark_strs("Linux kernel _parse_integer(), decimal", dec_nums,
+		       [&](const char *str, size_t len)
+	{
+		unsigned long long v;
+		_parse_integer(str, 10, &v);
+	});
+
+	benchmark_strs("Tempesta SSE decimal parsing", dec_nums,
+		       [&](const char *str, size_t len)
+	{
+		unsigned long long v;
+		tfw_parse_dec(str, len, &v);
+	});
+
+	benchmark_strs("Linux kernel _parse_integer(), hexadecimal", hex_nums,
+		       [&](const char *str, size_t len)
+	{
+		unsigned long long v;
+		_parse_integer(str, 16, &v);
+	});
+
+	benchmark_strs("Tempesta SSE hexadecimal parsing", hex_nums,
+		       [&](const char *str, size_t len)
+	{
+		unsigned long long v;
+		tfw_parse_hex(str, len, &v);
+	});
+
 	/*
 	 *	STRSPN(3)-like implementations.
 	 */
@@ -468,6 +965,16 @@ main()
 		tfw_match_uri(str, len);
 	});
 
+	benchmark("Tempesta URI matching, 2 chunks stream",
+		  [&](const char *str, size_t len)
+	{
+		TfwMatchStream ms;
+
+		tfw_match_stream_init(&ms, tfw_match_uri_best);
+		tfw_match_stream(&ms, str, len / 2);
+		tfw_match_stream(&ms, str + len / 2, len - len / 2);
+	});
+
 	benchmark("Tempesta AVX2 constant URI matching",
 		  [&](const char *str, size_t len)
 	{
@@ -494,5 +1001,47 @@ main()
 		tfw_match_custom_a(str, len);
 	});
 
+	benchmark("Tempesta AVX2 compiled URI matching",
+		  [&](const char *str, size_t len)
+	{
+		cset_uri(str, len);
+	});
+
+	benchmark("Tempesta AVX2 compiled custom alphabet matching",
+		  [&](const char *str, size_t len)
+	{
+		cset_custom(str, len);
+	});
+
+	benchmark("Tempesta AVX2 compiled ctext+vchar matching",
+		  [&](const char *str, size_t len)
+	{
+		cset_ctext_vchar(str, len);
+	});
+
+	if (avx512) {
+		benchmark("Tempesta AVX-512 URI matching",
+			  [&](const char *str, size_t len)
+		{
+			tfw_match_uri_avx512(str, len);
+		});
+
+		benchmark("Tempesta AVX-512 ctext+vchar matching",
+			  [&](const char *str, size_t len)
+		{
+			tfw_match_ctext_vchar_avx512(str, len);
+		});
+
+		benchmark("Tempesta AVX-512 custom alphabet matching",
+			  [&](const char *str, size_t len)
+		{
+			tfw_match_custom_avx512(str, len);
+		});
+	}
+
+	tfw_cset_free(cset_uri.cs);
+	tfw_cset_free(cset_custom.cs);
+	tfw_cset_free(cset_ctext_vchar.cs);
+
 	return 0;
 }
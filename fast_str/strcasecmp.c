@@ -19,11 +19,14 @@
  */
 #include <ctype.h>
 #include <immintrin.h>
+#include <string.h>
 #include <strings.h>
 
 #define PAGE_SIZE	4096
 #define likely(x)	__builtin_expect(!!(x), 1)
 #define unlikely(x)	__builtin_expect(!!(x), 0)
+/* The AVX-512BW functions are called only if the CPU supports them. */
+#define TFW_AVX512	__attribute__((target("avx512f,avx512bw,avx512vl,bmi,bmi2")))
 
 /* Avoid GLIBC's __ctype_tolower_loc() call. */
 static const unsigned char lct[] __attribute__((aligned(64))) = {
@@ -73,6 +76,12 @@ static struct {
 	__m256i CASE256;
 } __C;
 
+static struct {
+	__m512i A;
+	__m512i D;
+	__m512i CASE;
+} __C512;
+
 int
 kern_strcasecmp(const char *s1, const char *s2)
 {
@@ -934,6 +943,339 @@ stricmp_avx2_2lc_64_a(const unsigned char *s1, const unsigned char *s2,
 	return __stricmp_avx2_2lc_tail(s1 + i, s2 + i, len);
 }
 
+/**
+ * The same as stricmp_avx2_2lc_64(), but strings shorter than 32 bytes are
+ * compared by one vector loaded as whole and masked by @len. The load
+ * doesn't cross a page boundary unless a string starts in the last 32 bytes
+ * of a page, so only such strings go to the scalar and 16-byte code. Longer
+ * strings compare the tail by the last 32 bytes overlapping the previous
+ * vector.
+ */
+int
+stricmp_avx2_2lc_mask(const unsigned char *s1, const unsigned char *s2,
+		      size_t len)
+{
+	int i = 0, c = 0;
+
+	if (likely(len < 32)) {
+		if (likely(((unsigned long)s1 & (PAGE_SIZE - 1))
+			   <= PAGE_SIZE - 32
+			   && ((unsigned long)s2 & (PAGE_SIZE - 1))
+			      <= PAGE_SIZE - 32))
+			return !!_bzhi_u32(__stricmp_avx2_2lc(s1, s2), len);
+
+		switch (len) {
+		case 0:
+			return 0;
+		case 8:
+			c |= lct[s1[7]] ^ s2[7];
+		case 7:
+			c |= lct[s1[6]] ^ s2[6];
+		case 6:
+			c |= lct[s1[5]] ^ s2[5];
+		case 5:
+			c |= lct[s1[4]] ^ s2[4];
+		case 4:
+			c |= lct[s1[3]] ^ s2[3];
+		case 3:
+			c |= lct[s1[2]] ^ s2[2];
+		case 2:
+			c |= lct[s1[1]] ^ s2[1];
+		case 1:
+			c |= lct[s1[0]] ^ s2[0];
+			return c;
+		}
+		return __stricmp_avx2_2lc_tail(s1, s2, len);
+	}
+
+	/* Use unlikely() to speedup short strings processing. */
+	for ( ; unlikely(i + 128 <= len); i += 128)
+		if (__stricmp_avx2_2lc_128(s1 + i, s2 + i))
+			return 1;
+	if (unlikely(i + 64 <= len)) {
+		if (__stricmp_avx2_2lc_64(s1 + i, s2 + i))
+			return 1;
+		i += 64;
+	}
+	if (unlikely(i + 32 <= len)) {
+		if (__stricmp_avx2_2lc(s1 + i, s2 + i))
+			return 1;
+		i += 32;
+	}
+	if (i == len)
+		return 0;
+
+	return !!__stricmp_avx2_2lc(s1 + len - 32, s2 + len - 32);
+}
+
+/*
+ * AVX-512BW converts only the upper case letters with the masked add and
+ * compares 64 bytes at once to k-register mask.
+ */
+static inline __attribute__((always_inline)) TFW_AVX512 unsigned long
+__stricmp_avx512_2lc(__m512i v0, __m512i v1)
+{
+	__m512i sub = _mm512_sub_epi8(v0, __C512.A);
+	__mmask64 uc = _mm512_cmplt_epu8_mask(sub, __C512.D);
+	__m512i vl = _mm512_mask_add_epi8(v0, uc, v0, __C512.CASE);
+
+	return _mm512_cmpneq_epi8_mask(vl, v1);
+}
+
+static inline __attribute__((always_inline)) TFW_AVX512 unsigned int
+__stricmp_avx512_2lc_32(__m256i v0, __m256i v1)
+{
+	__m256i sub = _mm256_sub_epi8(v0, _mm512_castsi512_si256(__C512.A));
+	__mmask32 uc = _mm256_cmplt_epu8_mask(sub,
+					      _mm512_castsi512_si256(__C512.D));
+	__m256i vl = _mm256_mask_add_epi8(v0, uc, v0,
+					  _mm512_castsi512_si256(__C512.CASE));
+
+	return _mm256_cmpneq_epi8_mask(vl, v1);
+}
+
+/**
+ * The same as stricmp_avx2_2lc_64(), but with 64-byte AVX-512BW vectors.
+ * The short strings and the tail are compared by one masked load zeroing
+ * the both strings out of @len, so there is no scalar code, narrower vectors
+ * and overlapping loads. The masked out bytes never fault, so the loads are
+ * safe at the end of a page.
+ */
+int TFW_AVX512
+stricmp_avx512_2lc(const unsigned char *s1, const unsigned char *s2, size_t len)
+{
+	size_t i = 0;
+	unsigned long m;
+
+	if (likely(len < 32)) {
+		m = _bzhi_u32(~0U, len);
+		return !!__stricmp_avx512_2lc_32(_mm256_maskz_loadu_epi8(m, s1),
+						 _mm256_maskz_loadu_epi8(m, s2));
+	}
+
+	/* Use unlikely() to speedup short strings processing. */
+	for ( ; unlikely(i + 128 <= len); i += 128)
+		if (__stricmp_avx512_2lc(_mm512_loadu_si512(s1 + i),
+					 _mm512_loadu_si512(s2 + i))
+		    | __stricmp_avx512_2lc(_mm512_loadu_si512(s1 + i + 64),
+					   _mm512_loadu_si512(s2 + i + 64)))
+			return 1;
+	if (unlikely(i + 64 <= len)) {
+		if (__stricmp_avx512_2lc(_mm512_loadu_si512(s1 + i),
+					 _mm512_loadu_si512(s2 + i)))
+			return 1;
+		i += 64;
+	}
+
+	m = _bzhi_u64(~0UL, len - i);
+	return !!__stricmp_avx512_2lc(_mm512_maskz_loadu_epi8(m, s1 + i),
+				      _mm512_maskz_loadu_epi8(m, s2 + i));
+}
+
+/*
+ * ------------------------------------------------------------------------
+ *	Multi-literal header names matching
+ * ------------------------------------------------------------------------
+ */
+#define TFW_HDR_MAX_LEN		32
+#define TFW_HDR_TBL_BITS	8
+#define TFW_HDR_TBL_SZ		(1 << TFW_HDR_TBL_BITS)
+
+/* Known header names in lower case, the index is the header id. */
+static const char *const hdr_names[] = {
+	"accept",
+	"accept-charset",
+	"accept-encoding",
+	"accept-language",
+	"accept-ranges",
+	"access-control-allow-credentials",
+	"access-control-allow-headers",
+	"access-control-allow-methods",
+	"access-control-allow-origin",
+	"access-control-expose-headers",
+	"access-control-max-age",
+	"access-control-request-headers",
+	"access-control-request-method",
+	"age",
+	"allow",
+	"authorization",
+	"cache-control",
+	"connection",
+	"content-disposition",
+	"content-encoding",
+	"content-language",
+	"content-length",
+	"content-location",
+	"content-range",
+	"content-security-policy",
+	"content-type",
+	"cookie",
+	"date",
+	"dnt",
+	"etag",
+	"expect",
+	"expires",
+	"forwarded",
+	"from",
+	"host",
+	"if-match",
+	"if-modified-since",
+	"if-none-match",
+	"if-range",
+	"if-unmodified-since",
+	"keep-alive",
+	"last-modified",
+	"link",
+	"location",
+	"max-forwards",
+	"origin",
+	"pragma",
+	"proxy-authenticate",
+	"proxy-authorization",
+	"range",
+	"referer",
+	"refresh",
+	"retry-after",
+	"server",
+	"set-cookie",
+	"strict-transport-security",
+	"te",
+	"trailer",
+	"transfer-encoding",
+	"upgrade",
+	"upgrade-insecure-requests",
+	"user-agent",
+	"vary",
+	"via",
+	"warning",
+	"www-authenticate",
+	"x-forwarded-for",
+	"x-forwarded-host",
+	"x-forwarded-proto",
+	"x-requested-with",
+};
+
+/*
+ * Open addressing hash table of the header names.
+ *
+ * @name	- the names padded by zeros to one AVX2 vector;
+ * @len		- the names lengths, zero for empty slots;
+ * @id		- the header ids;
+ */
+static struct {
+	unsigned char	name[TFW_HDR_TBL_SZ][TFW_HDR_MAX_LEN];
+	unsigned char	len[TFW_HDR_TBL_SZ];
+	unsigned char	id[TFW_HDR_TBL_SZ];
+} hdr_tbl __attribute__((aligned(32)));
+
+/*
+ * The name length is the bucket and the first and the last characters
+ * distinguish the names in the bucket. The factors are chosen for the names
+ * above to have at most one collision for a slot.
+ */
+static inline unsigned int
+hdr_hash(const unsigned char *s, size_t len)
+{
+	return (lct[s[0]] * 2 + lct[s[len - 1]] * 44 + len * 11)
+	       & (TFW_HDR_TBL_SZ - 1);
+}
+
+/*
+ * Compare @s with lower case zero padded @name of the same length @len by
+ * one vector converting @s to lower case like __stricmp_avx2_2lc() does.
+ * The load of the whole vector from @s doesn't cross a page boundary, or
+ * the string is compared by the scalar code.
+ */
+static inline unsigned int
+__hdr_cmp(const unsigned char *s, const unsigned char *name, size_t len)
+{
+	unsigned int i, c = 0;
+
+	if (unlikely(((unsigned long)s & (PAGE_SIZE - 1))
+		     > PAGE_SIZE - TFW_HDR_MAX_LEN))
+	{
+		for (i = 0; i < len; ++i)
+			c |= lct[s[i]] ^ name[i];
+		return c;
+	}
+
+	__m256i v = _mm256_lddqu_si256((void *)s);
+	__m256i sub = _mm256_sub_epi8(v, __C.A256);
+	__m256i cmp_r = _mm256_cmpgt_epi8(__C.D256, sub);
+	__m256i lc = _mm256_and_si256(cmp_r, __C.CASE256);
+	__m256i vl = _mm256_or_si256(v, lc);
+	__m256i eq = _mm256_cmpeq_epi8(vl, _mm256_load_si256((void *)name));
+
+	return _bzhi_u32(~_mm256_movemask_epi8(eq), len);
+}
+
+/**
+ * Find header @name of @len bytes in any case among the known headers.
+ * @return the header id or -1 if the header is unknown.
+ */
+int
+tfw_match_hdr(const unsigned char *name, size_t len)
+{
+	unsigned int h;
+
+	if (unlikely(len - 1 >= TFW_HDR_MAX_LEN))
+		return -1;
+
+	for (h = hdr_hash(name, len); hdr_tbl.len[h];
+	     h = (h + 1) & (TFW_HDR_TBL_SZ - 1))
+	{
+		if (hdr_tbl.len[h] == len
+		    && !__hdr_cmp(name, hdr_tbl.name[h], len))
+			return hdr_tbl.id[h];
+	}
+
+	return -1;
+}
+
+/**
+ * @return name of header @id or NULL if there is no such header.
+ */
+const char *
+tfw_hdr_name(int id)
+{
+	if ((unsigned int)id >= sizeof(hdr_names) / sizeof(hdr_names[0]))
+		return NULL;
+
+	return hdr_names[id];
+}
+
+static void
+hdr_tbl_init(void)
+{
+	unsigned int id, h;
+
+	for (id = 0; id < sizeof(hdr_names) / sizeof(hdr_names[0]); ++id) {
+		const unsigned char *s = (const unsigned char *)hdr_names[id];
+		size_t len = strlen(hdr_names[id]);
+
+		for (h = hdr_hash(s, len); hdr_tbl.len[h];
+		     h = (h + 1) & (TFW_HDR_TBL_SZ - 1))
+			;
+		memcpy(hdr_tbl.name[h], s, len);
+		hdr_tbl.len[h] = len;
+		hdr_tbl.id[h] = id;
+	}
+}
+
+static void TFW_AVX512
+strcasecmp_init_avx512(void)
+{
+	__C512.A = _mm512_set1_epi8('A');
+	__C512.D = _mm512_set1_epi8('Z' - 'A' + 1);
+	__C512.CASE = _mm512_set1_epi8(0x20);
+}
+
+/*
+ * The fastest case-insensitive comparison for the CPU, selected by
+ * strcasecmp_init_const().
+ */
+int (*stricmp_2lc_best)(const unsigned char *s1, const unsigned char *s2,
+			size_t len) = stricmp_avx2_2lc_64;
 
 void
 strcasecmp_init_const(void)
@@ -947,4 +1289,13 @@ strcasecmp_init_const(void)
 	__C.a256 = _mm256_set1_epi8('a' - 0x80);
 	__C.D256 = _mm256_set1_epi8('Z' - 'A' + 1 - 0x80);
 	__C.CASE256 = _mm256_set1_epi8(0x20);
+
+	hdr_tbl_init();
+
+	if (__builtin_cpu_supports("avx512bw")
+	    && __builtin_cpu_supports("avx512vl"))
+	{
+		strcasecmp_init_avx512();
+		stricmp_2lc_best = stricmp_avx512_2lc;
+	}
 }
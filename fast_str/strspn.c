@@ -22,8 +22,15 @@
 #include <ctype.h>
 #include <immintrin.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+/*
+ * The AVX-512BW functions are built for any target CPU and are called only
+ * if the CPU supports them.
+ */
+#define TFW_AVX512	__attribute__((target("avx512f,avx512bw,bmi,bmi2")))
+
 /**
  * Ported from the Linux kernel.
  */
@@ -69,6 +76,147 @@ unsigned int _parse_integer(const char *s, unsigned int base, unsigned long long
 	return rv;
 }
 
+#define PAGE_SIZE		4096
+
+/*
+ * Shuffle indexes to move @n first bytes of a vector to its end, loaded from
+ * @n offset, the most significant bit of the index zeroes a byte.
+ */
+static const unsigned char ralign_shuf[] __attribute__((aligned(32))) = {
+	0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+	0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
+/*
+ * Load up to 16 bytes of @s with @len bytes available, the load mustn't
+ * cross a page boundary if there are less than 16 bytes.
+ */
+static inline __m128i
+__load_num(const char *s, size_t len)
+{
+	unsigned char buf[16];
+
+	if (likely(len >= 16
+		   || ((unsigned long)s & (PAGE_SIZE - 1)) <= PAGE_SIZE - 16))
+		return _mm_lddqu_si128((void *)s);
+
+	memcpy(buf, s, len);
+	return _mm_lddqu_si128((void *)buf);
+}
+
+/*
+ * Continue _parse_integer() for the digits after the vector processed ones
+ * with the same overflow checks.
+ */
+static unsigned int
+__parse_tail(const char *s, size_t len, unsigned int base,
+	     unsigned long long *p, unsigned int rv)
+{
+	unsigned long long res = *p;
+	unsigned int i;
+
+	for (i = rv; i < len; ++i, ++rv) {
+		unsigned int c = s[i];
+		unsigned int lc = c | 0x20;
+		unsigned int val;
+
+		if ('0' <= c && c <= '9')
+			val = c - '0';
+		else if ('a' <= lc && lc <= 'f')
+			val = lc - 'a' + 10;
+		else
+			break;
+		if (val >= base)
+			break;
+		if (res & (~0ull << 60)) {
+			if (res > (ULLONG_MAX - val) / base)
+				rv |= KSTRTOX_OVERFLOW;
+		}
+		res = res * base + val;
+	}
+	*p = res;
+
+	return rv;
+}
+
+/**
+ * _parse_integer() for decimal numbers of at most @len bytes. Up to 16
+ * digits are found and converted with one SSE vector: the digits are moved
+ * to the end of the vector by a shuffle and reduced by the multiply-add
+ * instructions to the 2, 4 and 8 digits numbers. 16 digits always fit 64
+ * bits, so the more digits are processed like _parse_integer() does.
+ *
+ * @return number of the digits, possibly with KSTRTOX_OVERFLOW, and the
+ * number in @p.
+ */
+unsigned int
+tfw_parse_dec(const char *s, size_t len, unsigned long long *p)
+{
+	__m128i v, d;
+	unsigned int n;
+
+	v = __load_num(s, len);
+	d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+	v = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+	n = _mm_movemask_epi8(v);
+	if (len < 16)
+		n = _bzhi_u32(n, len);
+	n = __tzcnt_u32(~n);
+
+	d = _mm_shuffle_epi8(d, _mm_lddqu_si128((void *)(ralign_shuf + n)));
+	d = _mm_maddubs_epi16(d, _mm_set1_epi16(0x010a));
+	d = _mm_madd_epi16(d, _mm_set1_epi32(0x00010064));
+	d = _mm_packus_epi32(d, d);
+	d = _mm_madd_epi16(d, _mm_set1_epi32(0x00012710));
+	*p = (unsigned long long)(unsigned int)_mm_cvtsi128_si32(d) * 100000000
+	     + (unsigned int)_mm_extract_epi32(d, 1);
+
+	if (unlikely(n == 16))
+		return __parse_tail(s, len, 10, p, n);
+
+	return n;
+}
+
+/**
+ * _parse_integer() for hexadecimal numbers of at most @len bytes. Up to 16
+ * digits are converted with one SSE vector: the digit pairs are reduced to
+ * bytes by the multiply-add and the bytes in the big endian order are packed
+ * to the 64-bit number.
+ *
+ * @return number of the digits, possibly with KSTRTOX_OVERFLOW, and the
+ * number in @p.
+ */
+unsigned int
+tfw_parse_hex(const char *s, size_t len, unsigned long long *p)
+{
+	__m128i v, d, l, dm, lm;
+	unsigned int n;
+
+	v = __load_num(s, len);
+	d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+	l = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)),
+			 _mm_set1_epi8('a' - 10));
+	dm = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+	lm = _mm_cmpeq_epi8(_mm_max_epu8(_mm_min_epu8(l, _mm_set1_epi8(15)),
+					 _mm_set1_epi8(10)), l);
+	n = _mm_movemask_epi8(_mm_or_si128(dm, lm));
+	if (len < 16)
+		n = _bzhi_u32(n, len);
+	n = __tzcnt_u32(~n);
+
+	d = _mm_blendv_epi8(l, d, dm);
+	d = _mm_shuffle_epi8(d, _mm_lddqu_si128((void *)(ralign_shuf + n)));
+	d = _mm_maddubs_epi16(d, _mm_set1_epi16(0x0110));
+	d = _mm_packus_epi16(d, d);
+	*p = __builtin_bswap64(_mm_cvtsi128_si64(d));
+
+	if (unlikely(n == 16))
+		return __parse_tail(s, len, 16, p, n);
+
+	return n;
+}
+
 /**
  * Scans the initial @n bytes of the memory area pointed to by @s for the first
  * occurance of EOL character.
@@ -87,6 +235,82 @@ tfw_memchreol(char *s, size_t n)
 	return n;
 }
 
+/**
+ * The structural index of a header block, the first stage of the parsing as
+ * in simdjson: a line end is the offset of LF, the CR before it is checked
+ * by the parser, and the colon is the offset of the first colon in the line
+ * or of the line end if there is no colon.
+ */
+typedef struct {
+	unsigned int	colon;
+	unsigned int	eol;
+} TfwHdrIdx;
+
+static inline __attribute__((always_inline)) unsigned long
+__eq_mask64(__m256i v0, __m256i v1, __m256i c)
+{
+	unsigned int m0 = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v0, c));
+	unsigned int m1 = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, c));
+
+	return ((unsigned long)m1 << 32) | m0;
+}
+
+/**
+ * Indexes the lines of the header block @s of @len bytes to @idx by 64 bytes
+ * at once: the LF and colon bitmaps of a block are built by 4 comparisons and
+ * the loop runs once per line, not per byte. The tail of the block is copied
+ * to a zero padded buffer. The last line isn't indexed if it's incomplete.
+ *
+ * @return the number of the indexed lines, at most @max.
+ */
+size_t
+tfw_hdr_index(const char *s, size_t len, TfwHdrIdx *idx, size_t max)
+{
+	const __m256i lf = _mm256_set1_epi8('\n');
+	const __m256i col = _mm256_set1_epi8(':');
+	unsigned int colon = ~0U;
+	size_t n = 0;
+
+	if (unlikely(!max))
+		return 0;
+
+	for (size_t base = 0; base < len; base += 64) {
+		const char *b = s + base;
+		char tail[64] __attribute__((aligned(32)));
+		unsigned long ml, mc;
+		__m256i v0, v1;
+
+		if (unlikely(len - base < 64)) {
+			memset(tail, 0, sizeof(tail));
+			memcpy(tail, b, len - base);
+			b = tail;
+		}
+		v0 = _mm256_loadu_si256((void *)b);
+		v1 = _mm256_loadu_si256((void *)(b + 32));
+		ml = __eq_mask64(v0, v1, lf);
+		mc = __eq_mask64(v0, v1, col);
+
+		while (ml) {
+			unsigned long lsb = ml & -ml;
+
+			if (colon == ~0U && (mc & (lsb - 1)))
+				colon = base + __builtin_ctzl(mc);
+			idx[n].eol = base + __builtin_ctzl(ml);
+			idx[n].colon = colon == ~0U ? idx[n].eol : colon;
+			if (++n == max)
+				return n;
+			colon = ~0U;
+			/* Only the colons of the next line are left. */
+			mc &= ~(lsb | (lsb - 1));
+			ml ^= lsb;
+		}
+		if (colon == ~0U && mc)
+			colon = base + __builtin_ctzl(mc);
+	}
+
+	return n;
+}
+
 /**
  * strspn - Calculate the length of the initial substring of @s which only
  * contain letters in @accept
@@ -635,24 +859,29 @@ static struct {
 
 static unsigned char custom_a[256];
 
+/*
+ * Set the characters of interval [@h0, @h1], or only @h0 if @h1 is zero,
+ * in ASCII table column bitmaps @av and in accept table @a.
+ */
 static void
-set_intvl(unsigned long h0, unsigned long h1, unsigned char *av)
+set_intvl(unsigned long h0, unsigned long h1, unsigned char *av,
+	  unsigned char *a)
 {
 	assert(h0 <= 255 && h1 <= 255);
 
 	av[(h0 & 0xf) + 16 * !!(h0 & 0x80)] |= 1 << ((h0 & 0x70) >> 4);
-	custom_a[h0++] = 1;
+	a[h0++] = 1;
 
 	if (!h1)
 		return;
 	while (h0 <= h1) {
 		av[(h0 & 0xf) + 16 * !!(h0 & 0x80)] |= 1 << ((h0 & 0x70) >> 4);
-		custom_a[h0++] = 1;
+		a[h0++] = 1;
 	}
 }
 
 static int
-parse_vbr(const char *cfg, unsigned char *av)
+parse_vbr(const char *cfg, unsigned char *av, unsigned char *a)
 {
 	unsigned long long h0 = 0, h1 = 0, *v = &h0;
 	const char *p = cfg;
@@ -660,11 +889,11 @@ parse_vbr(const char *cfg, unsigned char *av)
 
 	while (1) {
 		if (!*p) {
-			set_intvl(h0, h1, av);
+			set_intvl(h0, h1, av, a);
 			return 0;
 		}
 		if (isspace(*p)) {
-			set_intvl(h0, h1, av);
+			set_intvl(h0, h1, av, a);
 			h0 = h1 = 0;
 			v = &h0;
 			++p;
@@ -714,6 +943,22 @@ init_bm(unsigned char *av)
 	__C.C_BM256_1 = _mm256_lddqu_si256((void *)a1);
 }
 
+size_t tfw_match_ctext_vchar(const char *str, size_t len);
+size_t tfw_match_custom(const char *str, size_t len);
+size_t tfw_match_uri_avx512(const char *str, size_t len);
+size_t tfw_match_ctext_vchar_avx512(const char *str, size_t len);
+size_t tfw_match_custom_avx512(const char *str, size_t len);
+static void tfw_init_avx512(void);
+
+/*
+ * The fastest matchers for the CPU, selected by tfw_init_vconstants().
+ */
+size_t (*tfw_match_uri_best)(const char *str, size_t len) = tfw_match_uri;
+size_t (*tfw_match_ctext_vchar_best)(const char *str, size_t len)
+	= tfw_match_ctext_vchar;
+size_t (*tfw_match_custom_best)(const char *str, size_t len)
+	= tfw_match_custom;
+
 void
 tfw_init_vconstants(void)
 {
@@ -746,7 +991,7 @@ tfw_init_vconstants(void)
 		0xb8, 0xfc, 0xf8, 0xfc, 0xfc, 0xfc, 0xfc, 0xfc,
 		0xfc, 0xfc, 0xfc, 0x7c, 0x54, 0x7c, 0xd4, 0x7c);
 	/* URI character set plus allow 0x98 byte. */
-	if (parse_vbr("21 23-3B 3D 3f-5a 61-7A 5b 5d 5f 7E 98", av))
+	if (parse_vbr("21 23-3B 3D 3f-5a 61-7A 5b 5d 5f 7E 98", av, custom_a))
 		return;
 	init_bm(av);
 
@@ -760,6 +1005,14 @@ tfw_init_vconstants(void)
 	__C.DEL = _mm256_set1_epi8(0x7f);
 	__C.ASCII128 = _mm_set1_epi8(0x80);
 	__C.ASCII256 = _mm256_set1_epi8(0x80);
+
+	/* __builtin_cpu_supports() also checks that the OS saves ZMM state. */
+	if (__builtin_cpu_supports("avx512bw")) {
+		tfw_init_avx512();
+		tfw_match_uri_best = tfw_match_uri_avx512;
+		tfw_match_ctext_vchar_best = tfw_match_ctext_vchar_avx512;
+		tfw_match_custom_best = tfw_match_custom_avx512;
+	}
 }
 
 static size_t
@@ -1531,3 +1784,512 @@ tfw_match_custom_a(const char *str, size_t len)
 	n = s - (unsigned char *)str;
 	return !(c0 & c1) ? n + c0 : n + 2 + c2;
 }
+
+/*
+ * ------------------------------------------------------------------------
+ *	AVX-512BW matchers
+ * ------------------------------------------------------------------------
+ */
+/*
+ * Static structure of 512-bit constants, the same as the 256-bit ones in
+ * __C, for the AVX-512BW matchers.
+ */
+static struct {
+	__m512i	ARF;
+	__m512i	LSH;
+	__m512i	URI_BM;
+	__m512i	C_BM_0;
+	__m512i	C_BM_1;
+	__m512i	SP;
+	__m512i	HTAB;
+	__m512i	DEL;
+	__m512i	ASCII;
+} __C512;
+
+static void TFW_AVX512
+tfw_init_avx512(void)
+{
+	__C512.ARF = _mm512_broadcast_i32x4(__C.ARF128);
+	__C512.LSH = _mm512_broadcast_i32x4(__C.LSH128);
+	__C512.URI_BM = _mm512_broadcast_i32x4(__C.URI_BM128);
+	__C512.C_BM_0 = _mm512_broadcast_i32x4(__C.C_BM128_0);
+	__C512.C_BM_1 = _mm512_broadcast_i32x4(__C.C_BM128_1);
+	__C512.SP = _mm512_set1_epi8(' ');
+	__C512.HTAB = _mm512_set1_epi8('\t');
+	__C512.DEL = _mm512_set1_epi8(0x7f);
+	__C512.ASCII = _mm512_set1_epi8(0x80);
+}
+
+/*
+ * The vector kernels return the mask of not matching bytes. The AVX-512BW
+ * comparisons and VPTESTNMB write the masks directly to the k-registers,
+ * so there is no PMOVMSKB and no 64-bit mask merging from the two halves.
+ */
+static inline __attribute__((always_inline)) TFW_AVX512 unsigned long
+__uri_avx512(__m512i v)
+{
+	__m512i acbm = _mm512_shuffle_epi8(__C512.URI_BM, v);
+	__m512i arows = _mm512_and_si512(__C512.LSH, _mm512_srli_epi16(v, 4));
+	__m512i arbits = _mm512_shuffle_epi8(__C512.ARF, arows);
+
+	return _mm512_testn_epi8_mask(arbits, acbm);
+}
+
+static inline __attribute__((always_inline)) TFW_AVX512 unsigned long
+__ctext_vchar_avx512(__m512i v)
+{
+	__mmask64 ctl = _mm512_cmplt_epu8_mask(v, __C512.SP);
+
+	return _mm512_mask_cmpneq_epi8_mask(ctl, v, __C512.HTAB)
+	       | _mm512_cmpeq_epi8_mask(v, __C512.DEL);
+}
+
+static inline __attribute__((always_inline)) TFW_AVX512 unsigned long
+__custom_avx512(__m512i v)
+{
+	__m512i c1 = _mm512_shuffle_epi8(__C512.C_BM_0, v);
+	__m512i c2 = _mm512_shuffle_epi8(__C512.C_BM_1,
+					 _mm512_xor_si512(v, __C512.ASCII));
+	__m512i arows = _mm512_and_si512(__C512.LSH, _mm512_srli_epi16(v, 4));
+	__m512i arbits = _mm512_shuffle_epi8(__C512.ARF, arows);
+
+	return _mm512_testn_epi8_mask(arbits, _mm512_or_si512(c1, c2));
+}
+
+/*
+ * The same logic as for tfw_match_custom(), but with 64-byte vector kernel
+ * @m64 and accept table @a for the short strings. The tail shorter than 64
+ * bytes is processed by one masked load, which doesn't fault on the masked
+ * out bytes, instead of the narrower vectors and the scalar loop.
+ */
+static inline __attribute__((always_inline)) TFW_AVX512 size_t
+__tfw_match_avx512(const char *str, size_t len, const unsigned char *a,
+		   unsigned long (*m64)(__m512i))
+{
+	unsigned char *s = (unsigned char *)str;
+	const unsigned char *end = s + len;
+	unsigned int c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+	unsigned long r0, r1, m;
+	size_t n;
+
+	if (likely(len <= 4)) {
+		switch (len) {
+		case 0:
+			return 0;
+		case 4:
+			c3 = a[s[3]];
+		case 3:
+			c2 = a[s[2]];
+		case 2:
+			c1 = a[s[1]];
+		case 1:
+			c0 = a[s[0]];
+		}
+		return (c0 & c1) == 0 ? c0 : 2 + (c2 ? c2 + c3 : 0);
+	}
+
+	/* Use unlikely() to speedup short strings processing. */
+	for ( ; unlikely(s + 128 <= end); s += 128) {
+		r0 = m64(_mm512_loadu_si512((void *)s));
+		r1 = m64(_mm512_loadu_si512((void *)(s + 64)));
+		if (unlikely(r0 | r1)) {
+			n = s - (unsigned char *)str;
+			return r0 ? n + __tzcnt(r0) : n + 64 + __tzcnt(r1);
+		}
+	}
+	if (unlikely(s + 64 <= end)) {
+		r0 = m64(_mm512_loadu_si512((void *)s));
+		if (r0)
+			return s - (unsigned char *)str + __tzcnt(r0);
+		s += 64;
+	}
+
+	m = _bzhi_u64(~0UL, end - s);
+	r0 = m64(_mm512_maskz_loadu_epi8(m, s)) | ~m;
+
+	return s - (unsigned char *)str + __tzcnt(r0);
+}
+
+/**
+ * @return URI length in @str.
+ */
+size_t TFW_AVX512
+tfw_match_uri_avx512(const char *str, size_t len)
+{
+	return __tfw_match_avx512(str, len, uri_a, __uri_avx512);
+}
+
+/**
+ * @return legth of CTEXT+VCHAR character set in @str.
+ */
+size_t TFW_AVX512
+tfw_match_ctext_vchar_avx512(const char *str, size_t len)
+{
+	return __tfw_match_avx512(str, len, ctext_vchar_a,
+				  __ctext_vchar_avx512);
+}
+
+/**
+ * @return length of the custom alphabet in @str.
+ */
+size_t TFW_AVX512
+tfw_match_custom_avx512(const char *str, size_t len)
+{
+	return __tfw_match_avx512(str, len, custom_a, __custom_avx512);
+}
+
+/*
+ * ------------------------------------------------------------------------
+ *	Character sets compiled from the configuration strings
+ * ------------------------------------------------------------------------
+ */
+#define TFW_CSET_RANGES		3
+
+typedef struct tfw_cset_s TfwCset;
+typedef size_t (*tfw_match_fn)(const TfwCset *cs, const char *str,
+			       size_t len);
+
+/**
+ * A character set compiled to the cheapest matching strategy:
+ * 1. up to TFW_CSET_RANGES ranges are matched by unsigned range checks;
+ * 2. ASCII only sets are matched by the 128-bit mask of ASCII table column
+ *    bitmaps with one nibble shuffle, non-ASCII bytes aren't matched by
+ *    PSHUFB automatically;
+ * 3. any other sets are matched by two nibble shuffles for the both halves
+ *    of the table like tfw_match_custom().
+ *
+ * @lo		- low bounds of the ranges;
+ * @span	- the ranges lengths minus one;
+ * @bm0		- ASCII table column bitmaps for 0x00-0x7f;
+ * @bm1		- ASCII table column bitmaps for 0x80-0xff;
+ * @a		- accept table for the scalar matching;
+ * @n_ranges	- number of the ranges for the range checks;
+ * @name	- the strategy name;
+ */
+struct tfw_cset_s {
+	__m256i		lo[TFW_CSET_RANGES];
+	__m256i		span[TFW_CSET_RANGES];
+	__m256i		bm0;
+	__m256i		bm1;
+	unsigned char	a[256];
+	unsigned int	n_ranges;
+	const char	*name;
+};
+
+/*
+ * The vector kernels return the bitmap of the matching bytes.
+ */
+static inline __attribute__((always_inline)) unsigned int
+__cset_ranges32(const TfwCset *cs, __m256i v, const unsigned int n)
+{
+	__m256i m = _mm256_setzero_si256();
+	unsigned int i;
+
+	for (i = 0; i < n; ++i) {
+		__m256i d = _mm256_sub_epi8(v, cs->lo[i]);
+		m |= _mm256_cmpeq_epi8(_mm256_min_epu8(d, cs->span[i]), d);
+	}
+
+	return _mm256_movemask_epi8(m);
+}
+
+/* Unroll the range checks for each number of the ranges. */
+static inline unsigned int
+__cset_ranges1_32(const TfwCset *cs, __m256i v)
+{
+	return __cset_ranges32(cs, v, 1);
+}
+
+static inline unsigned int
+__cset_ranges2_32(const TfwCset *cs, __m256i v)
+{
+	return __cset_ranges32(cs, v, 2);
+}
+
+static inline unsigned int
+__cset_ranges3_32(const TfwCset *cs, __m256i v)
+{
+	return __cset_ranges32(cs, v, 3);
+}
+
+static inline unsigned int
+__cset_ascii32(const TfwCset *cs, __m256i v)
+{
+	__m256i acbm = _mm256_shuffle_epi8(cs->bm0, v);
+	__m256i arows = _mm256_and_si256(__C.LSH256, _mm256_srli_epi16(v, 4));
+	__m256i arbits = _mm256_shuffle_epi8(__C.ARF256, arows);
+	__m256i sbits = _mm256_and_si256(arbits, acbm);
+
+	v = _mm256_cmpeq_epi8(sbits, _mm256_setzero_si256());
+
+	return ~_mm256_movemask_epi8(v);
+}
+
+static inline unsigned int
+__cset_full32(const TfwCset *cs, __m256i v)
+{
+	__m256i c1 = _mm256_shuffle_epi8(cs->bm0, v);
+	__m256i c2 = _mm256_shuffle_epi8(cs->bm1, v ^ __C.ASCII256);
+	__m256i arows = _mm256_and_si256(__C.LSH256, _mm256_srli_epi16(v, 4));
+	__m256i arbits = _mm256_shuffle_epi8(__C.ARF256, arows);
+	__m256i sbits = _mm256_and_si256(arbits, c1 | c2);
+
+	v = _mm256_cmpeq_epi8(sbits, _mm256_setzero_si256());
+
+	return ~_mm256_movemask_epi8(v);
+}
+
+/*
+ * The same logic as for tfw_match_custom(), but with the vector kernel @m32
+ * for 32 bytes.
+ */
+static inline __attribute__((always_inline)) size_t
+__tfw_cset_match(const TfwCset *cs, const char *str, size_t len,
+		 unsigned int (*m32)(const TfwCset *, __m256i))
+{
+	unsigned char *s = (unsigned char *)str;
+	const unsigned char *end = s + len;
+	const unsigned char *a = cs->a;
+	unsigned int c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+	unsigned long r0, r1;
+	size_t n;
+
+	if (likely(len <= 4)) {
+		switch (len) {
+		case 0:
+			return 0;
+		case 4:
+			c3 = a[s[3]];
+		case 3:
+			c2 = a[s[2]];
+		case 2:
+			c1 = a[s[1]];
+		case 1:
+			c0 = a[s[0]];
+		}
+		return (c0 & c1) == 0 ? c0 : 2 + (c2 ? c2 + c3 : 0);
+	}
+
+	for ( ; unlikely(s + 128 <= end); s += 128) {
+		r0 = (unsigned long)m32(cs, _mm256_lddqu_si256((void *)s))
+		     | (unsigned long)m32(cs, _mm256_lddqu_si256((void *)(s + 32)))
+		       << 32;
+		r1 = (unsigned long)m32(cs, _mm256_lddqu_si256((void *)(s + 64)))
+		     | (unsigned long)m32(cs, _mm256_lddqu_si256((void *)(s + 96)))
+		       << 32;
+		if (unlikely(~(r0 & r1))) {
+			n = s - (unsigned char *)str;
+			return ~r0 ? n + __tzcnt(~r0) : n + 64 + __tzcnt(~r1);
+		}
+	}
+	if (unlikely(s + 64 <= end)) {
+		r0 = m32(cs, _mm256_lddqu_si256((void *)s));
+		r1 = m32(cs, _mm256_lddqu_si256((void *)(s + 32)));
+		n = __tzcnt(~(r0 | (r1 << 32)));
+		if (n < 64)
+			return s - (unsigned char *)str + n;
+		s += 64;
+	}
+	if (unlikely(s + 32 <= end)) {
+		r0 = m32(cs, _mm256_lddqu_si256((void *)s));
+		n = __tzcnt(~r0);
+		if (n < 32)
+			return s - (unsigned char *)str + n;
+		s += 32;
+	}
+
+	while (s + 4 <= end) {
+		c0 = a[s[0]];
+		c1 = a[s[1]];
+		c2 = a[s[2]];
+		c3 = a[s[3]];
+		if (!(c0 & c1 & c2 & c3)) {
+			n = s - (unsigned char *)str;
+			return !(c0 & c1) ? n + c0 : n + 2 + (c2 ? c2 + c3 : 0);
+		}
+		s += 4;
+	}
+	c0 = c1 = c2 = 0;
+	switch (end - s) {
+	case 3:
+		c2 = a[s[2]];
+	case 2:
+		c1 = a[s[1]];
+	case 1:
+		c0 = a[s[0]];
+	}
+
+	n = s - (unsigned char *)str;
+	return !(c0 & c1) ? n + c0 : n + 2 + c2;
+}
+
+static size_t
+tfw_match_cset_ranges1(const TfwCset *cs, const char *str, size_t len)
+{
+	return __tfw_cset_match(cs, str, len, __cset_ranges1_32);
+}
+
+static size_t
+tfw_match_cset_ranges2(const TfwCset *cs, const char *str, size_t len)
+{
+	return __tfw_cset_match(cs, str, len, __cset_ranges2_32);
+}
+
+static size_t
+tfw_match_cset_ranges3(const TfwCset *cs, const char *str, size_t len)
+{
+	return __tfw_cset_match(cs, str, len, __cset_ranges3_32);
+}
+
+static size_t
+tfw_match_cset_ascii(const TfwCset *cs, const char *str, size_t len)
+{
+	return __tfw_cset_match(cs, str, len, __cset_ascii32);
+}
+
+static size_t
+tfw_match_cset_full(const TfwCset *cs, const char *str, size_t len)
+{
+	return __tfw_cset_match(cs, str, len, __cset_full32);
+}
+
+/**
+ * Compile character set @cfg in the parse_vbr() format to @*cs.
+ * tfw_init_vconstants() must be called before.
+ * @return the matching function for @*cs or NULL on error.
+ */
+tfw_match_fn
+tfw_cset_compile(const char *cfg, TfwCset **cs)
+{
+	unsigned char av[32] = {}, a0[32], a1[32];
+	unsigned int c, n = 0;
+	TfwCset *p;
+
+	if (!(p = aligned_alloc(32, sizeof(*p))))
+		return NULL;
+	memset(p, 0, sizeof(*p));
+	if (parse_vbr(cfg, av, p->a)) {
+		free(p);
+		return NULL;
+	}
+	*cs = p;
+
+	/* Collect the ranges. */
+	for (c = 0; c < 256; ++c) {
+		unsigned int lo = c;
+
+		if (!p->a[c])
+			continue;
+		while (c < 255 && p->a[c + 1])
+			++c;
+		if (n < TFW_CSET_RANGES) {
+			p->lo[n] = _mm256_set1_epi8(lo);
+			p->span[n] = _mm256_set1_epi8(c - lo);
+		}
+		++n;
+	}
+	/* An empty set can't be expressed by the ranges, so use the bitmap. */
+	if (n && n <= TFW_CSET_RANGES) {
+		static const tfw_match_fn ranges_fn[] = {
+			NULL,
+			tfw_match_cset_ranges1,
+			tfw_match_cset_ranges2,
+			tfw_match_cset_ranges3,
+		};
+		p->n_ranges = n;
+		p->name = "ranges";
+		return ranges_fn[n];
+	}
+
+	/* Split ASCII table to 2 duplicate halves like init_bm() does. */
+	memcpy(a0, av, 16);
+	memcpy(&a0[16], av, 16);
+	memcpy(a1, &av[16], 16);
+	memcpy(&a1[16], &av[16], 16);
+	p->bm0 = _mm256_lddqu_si256((void *)a0);
+	p->bm1 = _mm256_lddqu_si256((void *)a1);
+
+	for (c = 0x80; c < 256; ++c)
+		if (p->a[c]) {
+			p->name = "full bitmap";
+			return tfw_match_cset_full;
+		}
+	p->name = "ASCII bitmap";
+	return tfw_match_cset_ascii;
+}
+
+const char *
+tfw_cset_name(const TfwCset *cs)
+{
+	return cs->name;
+}
+
+void
+tfw_cset_free(TfwCset *cs)
+{
+	free(cs);
+}
+
+/*
+ * ------------------------------------------------------------------------
+ *	Streaming matching
+ * ------------------------------------------------------------------------
+ */
+/**
+ * State of a token matching across non-contiguous chunks, e.g. skb
+ * fragments. All the matchers return the length of the matching prefix and
+ * don't look behind the start of the string, so a chunk is matched in place
+ * with no linearizing copy of the chunks and the state carries only the
+ * match progress.
+ *
+ * @match	- matcher for the chunks;
+ * @cs_match	- compiled character set matcher used instead of @match;
+ * @cs		- compiled character set for @cs_match;
+ * @len		- matched length of the token so far;
+ * @done	- the token end is found, the next chunks aren't matched;
+ */
+typedef struct {
+	size_t		(*match)(const char *str, size_t len);
+	tfw_match_fn	cs_match;
+	const TfwCset	*cs;
+	size_t		len;
+	int		done;
+} TfwMatchStream;
+
+void
+tfw_match_stream_init(TfwMatchStream *ms,
+		      size_t (*match)(const char *str, size_t len))
+{
+	memset(ms, 0, sizeof(*ms));
+	ms->match = match;
+}
+
+void
+tfw_match_stream_init_cset(TfwMatchStream *ms, tfw_match_fn match,
+			   const TfwCset *cs)
+{
+	memset(ms, 0, sizeof(*ms));
+	ms->cs_match = match;
+	ms->cs = cs;
+}
+
+/**
+ * Match the next chunk @str of the token.
+ * @return number of the matching bytes in @str. The token ends in the chunk
+ * if the return value is less than @len, the full token length is in
+ * @ms->len then.
+ */
+size_t
+tfw_match_stream(TfwMatchStream *ms, const char *str, size_t len)
+{
+	size_t n;
+
+	if (unlikely(ms->done))
+		return 0;
+
+	n = ms->cs ? ms->cs_match(ms->cs, str, len) : ms->match(str, len);
+	ms->len += n;
+	ms->done = n < len;
+
+	return n;
+}
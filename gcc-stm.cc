@@ -1,12 +1,27 @@
 /**
- * Simple threading test program for GCC-4.7 Software Transactional Memory.
- * Compile with -std=c++11 and -fgnu-tm.
+ * Simple threading test program for GCC-4.7 Software Transactional Memory
+ * and the benchmark of GCC libitm against fine-grained locks on the tsx.cc
+ * debit/credit workload. Compile by:
+ * $ g++ -O2 -std=c++11 -fgnu-tm -DL1DSZ=$(getconf LEVEL1_DCACHE_LINESIZE) gcc-stm.cc -lpthread -lm
  *
  * Written by Alexander Krizhanovsky (ak@tempesta-tech.com).
  */
+#include <assert.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <thread>
 
+#include <xmmintrin.h>
+
+#include "bench.h"
+
+#ifndef L1DSZ
+#define L1DSZ	64
+#endif
+
 static const auto THR_NUM = 4;
 static const auto ITER_NUM = 1000 * 1000;
 
@@ -37,8 +52,8 @@ thr_func()
 	}
 }
 
-int
-main(int argc, char *argv[])
+static void
+exception_test()
 {
 	std::thread thr[THR_NUM];
 
@@ -52,6 +67,364 @@ main(int argc, char *argv[])
 		<< " d=" << d << std::endl;
 	std::cout << "addr_a=" << &a << " addr_b=" << &b
 		<< " addr_c=" << &c << std::endl;
+}
+
+/*
+ * Benchmark of libitm against the fine-grained locks on the tsx.cc
+ * debit/credit workload. A writer moves a unit from the credits to the
+ * debits of TRX_SZ cache lines, the ranges of neighbour threads overlap by
+ * OVERLAP lines. A reader checks that the debits and credits are balanced
+ * in its range, so the optimistic readers must see consistent snapshots.
+ */
+static const unsigned TRX_SZ = 16;
+static const unsigned OVERLAP = 8;
+static const unsigned THR_MAX = 16;
+static const unsigned BUF_SZ = THR_MAX * TRX_SZ;
+static const unsigned long BENCH_ITER = 1000 * 1000;
+
+enum class Sync : unsigned char {
+	STM,
+	SpinLock,
+	SeqLock,
+	VerLock,
+};
+
+struct CacheLine {
+	long c[L1DSZ / sizeof(long)];
+} __attribute__((aligned(L1DSZ)));
+
+static CacheLine debit[BUF_SZ];
+static CacheLine credit[BUF_SZ];
+
+// Per-cache line spin locks or versioned locks: an odd version is locked.
+struct LineLock {
+	std::atomic<unsigned long> v;
+} __attribute__((aligned(L1DSZ)));
+
+static LineLock line_l[BUF_SZ];
+static std::atomic<unsigned long> seq __attribute__((aligned(L1DSZ)));
+
+// Statistics.
+static std::atomic<unsigned long> retries(0), errors(0);
+static __thread unsigned long _retries;
+
+static inline unsigned
+range_start(unsigned thr_id)
+{
+	return thr_id * (TRX_SZ - OVERLAP);
+}
+
+// The lock based writers race with the optimistic readers, so access the
+// lines in the lock based cases through relaxed atomics.
+static inline long
+line_ld(const CacheLine &cl)
+{
+	return __atomic_load_n(&cl.c[0], __ATOMIC_RELAXED);
+}
+
+static inline void
+line_add(CacheLine &cl, long x)
+{
+	__atomic_store_n(&cl.c[0], line_ld(cl) + x, __ATOMIC_RELAXED);
+}
+
+// All the threads share the only CPU on small machines, so let the lock
+// holder run from time to time.
+static inline void
+spin_wait(unsigned &spins)
+{
+	++_retries;
+	if (++spins % 1024)
+		_mm_pause();
+	else
+		std::this_thread::yield();
+}
+
+static inline void
+write_lines(unsigned s)
+{
+	for (unsigned i = s; i < s + TRX_SZ; ++i) {
+		line_add(debit[i], 1);
+		line_add(credit[i], -1);
+	}
+}
+
+static inline long
+read_lines(unsigned s)
+{
+	long sum = 0;
+
+	for (unsigned i = s; i < s + TRX_SZ; ++i)
+		sum += line_ld(debit[i]) + line_ld(credit[i]);
+
+	return sum;
+}
+
+static void
+stm_write(unsigned s)
+{
+	__transaction_atomic {
+		for (unsigned i = s; i < s + TRX_SZ; ++i) {
+			debit[i].c[0] += 1;
+			credit[i].c[0] -= 1;
+		}
+	}
+}
+
+static long
+stm_read(unsigned s)
+{
+	long sum = 0;
+
+	__transaction_atomic {
+		for (unsigned i = s; i < s + TRX_SZ; ++i)
+			sum += debit[i].c[0] + credit[i].c[0];
+	}
+
+	return sum;
+}
+
+// The lines are always locked in ascending order, so there are no deadlocks.
+static void
+spin_lock_lines(unsigned s)
+{
+	for (unsigned i = s; i < s + TRX_SZ; ++i) {
+		unsigned spins = 0;
+		while (line_l[i].v.exchange(1, std::memory_order_acquire))
+			while (line_l[i].v.load(std::memory_order_relaxed))
+				spin_wait(spins);
+	}
+}
+
+static void
+spin_unlock_lines(unsigned s)
+{
+	for (unsigned i = s; i < s + TRX_SZ; ++i)
+		line_l[i].v.store(0, std::memory_order_release);
+}
+
+static void
+spin_write(unsigned s)
+{
+	spin_lock_lines(s);
+	write_lines(s);
+	spin_unlock_lines(s);
+}
+
+static long
+spin_read(unsigned s)
+{
+	spin_lock_lines(s);
+	long sum = read_lines(s);
+	spin_unlock_lines(s);
+
+	return sum;
+}
+
+static void
+seq_write(unsigned s)
+{
+	unsigned long v;
+	unsigned spins = 0;
+
+	while (1) {
+		v = seq.load(std::memory_order_relaxed);
+		if (!(v & 1) && seq.compare_exchange_weak(v, v + 1,
+						std::memory_order_acquire))
+			break;
+		spin_wait(spins);
+	}
+
+	write_lines(s);
+
+	seq.store(v + 2, std::memory_order_release);
+}
+
+static long
+seq_read(unsigned s)
+{
+	unsigned spins = 0;
+
+	while (1) {
+		unsigned long v = seq.load(std::memory_order_acquire);
+		if (!(v & 1)) {
+			long sum = read_lines(s);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (seq.load(std::memory_order_relaxed) == v)
+				return sum;
+		}
+		spin_wait(spins);
+	}
+}
+
+static void
+ver_write(unsigned s)
+{
+	unsigned long v[TRX_SZ];
+
+	for (unsigned i = 0; i < TRX_SZ; ++i) {
+		std::atomic<unsigned long> &l = line_l[s + i].v;
+		unsigned spins = 0;
+		while (1) {
+			v[i] = l.load(std::memory_order_relaxed);
+			if (!(v[i] & 1)
+			    && l.compare_exchange_weak(v[i], v[i] + 1,
+						std::memory_order_acquire))
+				break;
+			spin_wait(spins);
+		}
+	}
+
+	write_lines(s);
+
+	for (unsigned i = 0; i < TRX_SZ; ++i)
+		line_l[s + i].v.store(v[i] + 2, std::memory_order_release);
+}
+
+static long
+ver_read(unsigned s)
+{
+	unsigned long v[TRX_SZ];
+	unsigned spins = 0;
+
+retry:
+	for (unsigned i = 0; i < TRX_SZ; ++i) {
+		v[i] = line_l[s + i].v.load(std::memory_order_acquire);
+		if (v[i] & 1) {
+			spin_wait(spins);
+			goto retry;
+		}
+	}
+
+	long sum = read_lines(s);
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+	for (unsigned i = 0; i < TRX_SZ; ++i)
+		if (line_l[s + i].v.load(std::memory_order_relaxed) != v[i]) {
+			spin_wait(spins);
+			goto retry;
+		}
+
+	return sum;
+}
+
+static void
+bench_thr(unsigned thr_id, unsigned read_pct, Sync sync)
+{
+	unsigned s = range_start(thr_id);
+	unsigned long rnd = thr_id + 1;
+
+	bench_pin_thread(thr_id);
+	_retries = 0;
+
+	for (unsigned long i = 0; i < BENCH_ITER; ++i) {
+		long sum = 0;
+
+		// xorshift is enough to mix the readers and writers.
+		rnd ^= rnd << 13;
+		rnd ^= rnd >> 7;
+		rnd ^= rnd << 17;
+		bool rd = rnd % 100 < read_pct;
+
+		switch (sync) {
+		case Sync::STM:
+			if (rd)
+				sum = stm_read(s);
+			else
+				stm_write(s);
+			break;
+		case Sync::SpinLock:
+			if (rd)
+				sum = spin_read(s);
+			else
+				spin_write(s);
+			break;
+		case Sync::SeqLock:
+			if (rd)
+				sum = seq_read(s);
+			else
+				seq_write(s);
+			break;
+		case Sync::VerLock:
+			if (rd)
+				sum = ver_read(s);
+			else
+				ver_write(s);
+			break;
+		default:
+			abort();
+		}
+
+		if (sum)
+			++errors;
+	}
+
+	retries += _retries;
+}
+
+static void
+run_test(const char *name, unsigned thr_num, unsigned read_pct, Sync sync)
+{
+	std::thread thr[THR_MAX];
+
+	assert(thr_num <= THR_MAX);
+
+	memset(debit, 0, sizeof(debit));
+	memset(credit, 0, sizeof(credit));
+	for (auto &l : line_l)
+		l.v = 0;
+	seq = 0;
+	retries = errors = 0;
+
+	uint64_t t0 = bench_now_ns();
+
+	for (unsigned i = 0; i < thr_num; ++i)
+		thr[i] = std::thread(bench_thr, i, read_pct, sync);
+	for (unsigned i = 0; i < thr_num; ++i)
+		thr[i].join();
+
+	uint64_t t1 = bench_now_ns();
+
+	for (unsigned i = 0; i < BUF_SZ; ++i)
+		if (debit[i].c[0] + credit[i].c[0])
+			std::cout << "!!! INCONSISTENCY at " << i
+				  << ": debit=" << debit[i].c[0]
+				  << " credit=" << credit[i].c[0] << std::endl;
+
+	unsigned long ops = BENCH_ITER * thr_num;
+	unsigned long ms = (t1 - t0) / 1000000;
+
+	std::cout << name << "\tthr=" << thr_num << "\tread=" << read_pct
+		  << "%\ttime=" << ms << "ms"
+		  << "\tops/ms=" << ops / (ms ? : 1);
+	// libitm doesn't export its abort statistics.
+	if (sync != Sync::STM)
+		std::cout << "\tretries=" << retries.load()
+			  << "(" << retries.load() * 100 / ops << "%)";
+	if (errors.load())
+		std::cout << "\t!!! INCONSISTENT READS=" << errors.load();
+	std::cout << std::endl;
+}
+
+int
+main(int argc, char *argv[])
+{
+	exception_test();
+
+	// Oversubscription makes libitm orders of magnitude slower, so don't
+	// run more threads than CPUs (but at least 2 to have contention).
+	unsigned thr_max = std::max(2U, std::thread::hardware_concurrency());
+	thr_max = std::min(thr_max, THR_MAX);
+
+	std::cout << "\ntrx_sz=" << TRX_SZ << " overlap=" << OVERLAP
+		  << " iter=" << BENCH_ITER << std::endl;
+	for (unsigned read_pct : {0, 90})
+		for (unsigned thr_num = 1; thr_num <= thr_max; thr_num <<= 1) {
+			run_test("stm", thr_num, read_pct, Sync::STM);
+			run_test("spinlock", thr_num, read_pct, Sync::SpinLock);
+			run_test("seqlock", thr_num, read_pct, Sync::SeqLock);
+			run_test("verlock", thr_num, read_pct, Sync::VerLock);
+		}
 
 	return 0;
 }
@@ -0,0 +1,94 @@
+/**
+ *		Tempesta FW
+ *
+ * Copyright (C) 2023 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include "cqueue.h"
+
+void
+tfw_cq_insert(TfwCq *cq, TfwCqNode *node)
+{
+	unsigned long d = 0;
+	unsigned int i;
+	TfwCqBucket *b;
+
+	if (node->key > cq->base)
+		d = (node->key - cq->base) >> cq->shift;
+	if (d >= TFW_CQ_BUCKETS)
+		d = TFW_CQ_BUCKETS - 1;
+	i = (cq->cur + d) % TFW_CQ_BUCKETS;
+
+	b = &cq->buckets[i];
+	node->next = NULL;
+	if (b->head)
+		b->tail->next = node;
+	else
+		b->head = node;
+	b->tail = node;
+
+	cq->bitmap[i / 64] |= 1UL << (i % 64);
+	cq->summary |= 1U << (i / 64);
+	cq->size++;
+}
+
+/*
+ * The first non-empty bucket from the current one in the ring order, the
+ * queue must not be empty.
+ */
+static inline unsigned int
+tfw_cq_next(TfwCq *cq)
+{
+	unsigned int w = cq->cur / 64, s;
+	unsigned long m = cq->bitmap[w] & (~0UL << (cq->cur % 64));
+
+	if (m)
+		return w * 64 + __builtin_ctzl(m);
+
+	/* The words after the current one, or wrap around. */
+	if (!(s = cq->summary & (~0U << (w + 1))))
+		s = cq->summary;
+	w = __builtin_ctz(s);
+
+	return w * 64 + __builtin_ctzl(cq->bitmap[w]);
+}
+
+TfwCqNode *
+tfw_cq_extract_min(TfwCq *cq)
+{
+	unsigned int i;
+	TfwCqBucket *b;
+	TfwCqNode *node;
+
+	if (!cq->size)
+		return NULL;
+
+	i = tfw_cq_next(cq);
+	cq->base += (unsigned long)((i - cq->cur) % TFW_CQ_BUCKETS) << cq->shift;
+	cq->cur = i;
+
+	b = &cq->buckets[i];
+	node = b->head;
+	if (!(b->head = node->next)) {
+		b->tail = NULL;
+		cq->bitmap[i / 64] &= ~(1UL << (i % 64));
+		if (!cq->bitmap[i / 64])
+			cq->summary &= ~(1U << (i / 64));
+	}
+	cq->size--;
+
+	return node;
+}
@@ -0,0 +1,78 @@
+/**
+ *		Tempesta FW
+ *
+ * Calendar queue for the WFQ scheduling of HTTP/2 streams.
+ *
+ * The keys (deficits) of the active streams lie within a bounded window
+ * after the current minimum since wfq_default_deficit() maps the weights
+ * 1-256 to the increments 256-65536. The window is split to a ring of
+ * TFW_CQ_BUCKETS buckets of 1 << shift keys, each bucket is a FIFO list and
+ * the non-empty buckets are indexed by a two-level bitmap, so both insertion
+ * and extraction are O(1). The order of the keys within a bucket isn't kept,
+ * so the scheduling error is less than the bucket width. Keys below the
+ * current bucket go to the current bucket and keys beyond the window go to
+ * the last one.
+ *
+ * Copyright (C) 2023 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#define TFW_CQ_BUCKETS		512
+#define TFW_CQ_WORDS		(TFW_CQ_BUCKETS / 64)
+
+typedef struct tfw_cq_node_t {
+	unsigned long key;
+	struct tfw_cq_node_t *next;
+} TfwCqNode;
+
+typedef struct {
+	TfwCqNode *head;
+	TfwCqNode *tail;
+} TfwCqBucket;
+
+typedef struct {
+	unsigned long base;
+	unsigned int shift;
+	unsigned int cur;
+	unsigned int size;
+	unsigned int summary;
+	unsigned long bitmap[TFW_CQ_WORDS];
+	TfwCqBucket buckets[TFW_CQ_BUCKETS];
+} TfwCq;
+
+static inline void
+tfw_cq_node_init(TfwCqNode *node, unsigned long key)
+{
+	node->key = key;
+	node->next = NULL;
+}
+
+/*
+ * Initialize the queue with buckets of 1 << @shift keys starting from key
+ * @base, so the window is TFW_CQ_BUCKETS << @shift keys.
+ */
+static inline void
+tfw_cq_init(TfwCq *cq, unsigned long base, unsigned int shift)
+{
+	memset(cq, 0, sizeof(*cq));
+	cq->base = base;
+	cq->shift = shift;
+}
+
+void tfw_cq_insert(TfwCq *cq, TfwCqNode *node);
+TfwCqNode *tfw_cq_extract_min(TfwCq *cq);
@@ -0,0 +1,4 @@
+#! /bin/bash
+
+gcc -c cqueue.c -o cqueue.o
+ar rv libcqueue.a cqueue.o
\ No newline at end of file
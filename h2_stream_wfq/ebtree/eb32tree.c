@@ -38,6 +38,107 @@ struct eb32_node *eb32i_insert(struct eb_root *root, struct eb32_node *new)
 	return __eb32i_insert(root, new);
 }
 
+/* Appends <new> following <prev> to the tree being built in <b> */
+static forceinline void
+__eb32_build_add(struct eb_build *b, struct eb32_node *prev, struct eb32_node *new)
+{
+	int bit = 0;
+
+	if (prev)
+		bit = prev->key == new->key ? -1
+		      : flsnz(prev->key ^ new->key) - EB_NODE_BITS;
+	__eb_build_add(b, &new->node, bit);
+}
+
+/* How far ahead the nodes of the sorted array are prefetched */
+#define EB32_PREFETCH		8
+
+static forceinline unsigned int
+__eb32_build_sorted(struct eb_root *root, struct eb32_node **nodes,
+		    unsigned int n)
+{
+	struct eb_build b;
+	struct eb32_node *prev = NULL;
+	int unique = eb_gettag(root->b[EB_RGHT]);
+	unsigned int i, added = 0;
+
+	__eb_build_init(&b, root);
+	for (i = 0; i < n; i++) {
+		/* unlike the descents, the next nodes are known in advance */
+		if (i + EB32_PREFETCH < n)
+			__builtin_prefetch(nodes[i + EB32_PREFETCH], 1);
+		if (unique && prev && prev->key == nodes[i]->key)
+			continue;
+		__eb32_build_add(&b, prev, nodes[i]);
+		prev = nodes[i];
+		added++;
+	}
+	return added;
+}
+
+/*
+ * Build the tree <root>, which must be empty, from the <n> nodes in <nodes>,
+ * sorted by their unsigned keys, in O(n) time. The shape of the tree is
+ * defined by the keys only, so the tree is the same as the one built by
+ * eb32_insert() called for the nodes in the same order, including the order
+ * of the duplicates. The duplicates are skipped if the tree only stores
+ * unique keys. Returns the number of nodes inserted.
+ */
+unsigned int eb32_build_sorted(struct eb_root *root, struct eb32_node **nodes,
+			       unsigned int n)
+{
+	return __eb32_build_sorted(root, nodes, n);
+}
+
+/* Same as eb32_build_sorted() for the nodes sorted by their signed keys */
+unsigned int eb32i_build_sorted(struct eb_root *root, struct eb32_node **nodes,
+				unsigned int n)
+{
+	return __eb32_build_sorted(root, nodes, n);
+}
+
+/* Inserts the <n> sorted <nodes> into the tree <root> one by one. Rebuilding
+ * the tree with them would be O(N + n) for a tree of N nodes, but the in-order
+ * walk of the tree is a chain of dependent loads of rarely cached nodes, so
+ * it's slower than the insertions even for <n> = N. The descents for the
+ * consecutive keys share the upper nodes, so the cache misses are mostly on
+ * the new nodes themselves, which are prefetched.
+ */
+static forceinline unsigned int
+__eb32_merge_sorted(struct eb_root *root, struct eb32_node **nodes,
+		    unsigned int n, int sign)
+{
+	unsigned int i, added = 0;
+	struct eb32_node *ret;
+
+	for (i = 0; i < n; i++) {
+		if (i + EB32_PREFETCH < n)
+			__builtin_prefetch(nodes[i + EB32_PREFETCH], 1);
+		ret = sign ? __eb32i_insert(root, nodes[i])
+			   : __eb32_insert(root, nodes[i]);
+		added += ret == nodes[i];
+	}
+	return added;
+}
+
+/*
+ * Insert the <n> nodes from <nodes>, sorted by their unsigned keys, into the
+ * tree <root>, see __eb32_merge_sorted(). Returns the number of nodes
+ * inserted, which is lower than <n> only for the unique keys trees.
+ */
+unsigned int eb32_merge_sorted(struct eb_root *root, struct eb32_node **nodes,
+			       unsigned int n)
+{
+	return __eb32_merge_sorted(root, nodes, n, 0);
+}
+
+/* Same as eb32_merge_sorted() for the nodes sorted by their signed keys */
+unsigned int eb32i_merge_sorted(struct eb_root *root, struct eb32_node **nodes,
+				unsigned int n)
+{
+	return __eb32_merge_sorted(root, nodes, n, 1);
+}
+
 struct eb32_node *eb32_lookup(struct eb_root *root, u32 x)
 {
 	return __eb32_lookup(root, x);
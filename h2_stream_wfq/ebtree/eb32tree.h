@@ -123,6 +123,14 @@ struct eb32_node *eb32_lookup_le(struct eb_root *root, u32 x);
 struct eb32_node *eb32_lookup_ge(struct eb_root *root, u32 x);
 struct eb32_node *eb32_insert(struct eb_root *root, struct eb32_node *new);
 struct eb32_node *eb32i_insert(struct eb_root *root, struct eb32_node *new);
+unsigned int eb32_build_sorted(struct eb_root *root, struct eb32_node **nodes,
+			       unsigned int n);
+unsigned int eb32i_build_sorted(struct eb_root *root, struct eb32_node **nodes,
+				unsigned int n);
+unsigned int eb32_merge_sorted(struct eb_root *root, struct eb32_node **nodes,
+			       unsigned int n);
+unsigned int eb32i_merge_sorted(struct eb_root *root, struct eb32_node **nodes,
+				unsigned int n);
 
 /*
  * The following functions are less likely to be used directly, because their
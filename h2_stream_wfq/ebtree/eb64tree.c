@@ -38,6 +38,152 @@ struct eb64_node *eb64i_insert(struct eb_root *root, struct eb64_node *new)
 	return __eb64i_insert(root, new);
 }
 
+/*
+ * Detach up to <k> nodes with the lowest keys from the tree <root> during one
+ * walk, and store them in <nodes> in the keys order. This is intended for the
+ * schedulers picking several entries at once, so that each pick doesn't
+ * descend from the root again. Returns the number of nodes detached, which is
+ * lower than <k> only if the tree has less nodes.
+ */
+unsigned int eb64_pick_first(struct eb_root *root, struct eb64_node **nodes,
+			     unsigned int k)
+{
+	struct eb64_node *node, *next;
+	unsigned int n = 0;
+
+	for (node = eb64_first(root); node && n < k; node = next) {
+		/* the next node stays valid when the current one is removed */
+		next = eb64_next(node);
+		__eb64_delete(node);
+		nodes[n++] = node;
+	}
+	return n;
+}
+
+/*
+ * Insert the <n> nodes from <nodes> with their signed keys into the tree
+ * <root>, typically the nodes got by eb64_pick_first() with updated keys.
+ * The nodes are sorted by the keys first, so that consecutive insertions
+ * descend over the same, already cached, nodes. <nodes> is reordered.
+ */
+void eb64i_insert_bulk(struct eb_root *root, struct eb64_node **nodes,
+		       unsigned int n)
+{
+	unsigned int i, j;
+
+	/* batches are small, so insertion sort is the fastest */
+	for (i = 1; i < n; i++) {
+		struct eb64_node *node = nodes[i];
+
+		for (j = i; j > 0 && (s64)nodes[j - 1]->key > (s64)node->key; j--)
+			nodes[j] = nodes[j - 1];
+		nodes[j] = node;
+	}
+	for (i = 0; i < n; i++)
+		__eb64i_insert(root, nodes[i]);
+}
+
+/* Appends <new> following <prev> to the tree being built in <b> */
+static forceinline void
+__eb64_build_add(struct eb_build *b, struct eb64_node *prev, struct eb64_node *new)
+{
+	int bit = 0;
+
+	if (prev)
+		bit = prev->key == new->key ? -1
+		      : fls64(prev->key ^ new->key) - EB_NODE_BITS;
+	__eb_build_add(b, &new->node, bit);
+}
+
+/* How far ahead the nodes of the sorted array are prefetched */
+#define EB64_PREFETCH		8
+
+static forceinline unsigned int
+__eb64_build_sorted(struct eb_root *root, struct eb64_node **nodes,
+		    unsigned int n)
+{
+	struct eb_build b;
+	struct eb64_node *prev = NULL;
+	int unique = eb_gettag(root->b[EB_RGHT]);
+	unsigned int i, added = 0;
+
+	__eb_build_init(&b, root);
+	for (i = 0; i < n; i++) {
+		/* unlike the descents, the next nodes are known in advance */
+		if (i + EB64_PREFETCH < n)
+			__builtin_prefetch(nodes[i + EB64_PREFETCH], 1);
+		if (unique && prev && prev->key == nodes[i]->key)
+			continue;
+		__eb64_build_add(&b, prev, nodes[i]);
+		prev = nodes[i];
+		added++;
+	}
+	return added;
+}
+
+/*
+ * Build the tree <root>, which must be empty, from the <n> nodes in <nodes>,
+ * sorted by their unsigned keys, in O(n) time. The shape of the tree is
+ * defined by the keys only, so the tree is the same as the one built by
+ * eb64_insert() called for the nodes in the same order, including the order
+ * of the duplicates. The duplicates are skipped if the tree only stores
+ * unique keys. Returns the number of nodes inserted.
+ */
+unsigned int eb64_build_sorted(struct eb_root *root, struct eb64_node **nodes,
+			       unsigned int n)
+{
+	return __eb64_build_sorted(root, nodes, n);
+}
+
+/* Same as eb64_build_sorted() for the nodes sorted by their signed keys */
+unsigned int eb64i_build_sorted(struct eb_root *root, struct eb64_node **nodes,
+				unsigned int n)
+{
+	return __eb64_build_sorted(root, nodes, n);
+}
+
+/* Inserts the <n> sorted <nodes> into the tree <root> one by one. Rebuilding
+ * the tree with them would be O(N + n) for a tree of N nodes, but the in-order
+ * walk of the tree is a chain of dependent loads of rarely cached nodes, so
+ * it's slower than the insertions even for <n> = N. The descents for the
+ * consecutive keys share the upper nodes, so the cache misses are mostly on
+ * the new nodes themselves, which are prefetched.
+ */
+static forceinline unsigned int
+__eb64_merge_sorted(struct eb_root *root, struct eb64_node **nodes,
+		    unsigned int n, int sign)
+{
+	unsigned int i, added = 0;
+	struct eb64_node *ret;
+
+	for (i = 0; i < n; i++) {
+		if (i + EB64_PREFETCH < n)
+			__builtin_prefetch(nodes[i + EB64_PREFETCH], 1);
+		ret = sign ? __eb64i_insert(root, nodes[i])
+			   : __eb64_insert(root, nodes[i]);
+		added += ret == nodes[i];
+	}
+	return added;
+}
+
+/*
+ * Insert the <n> nodes from <nodes>, sorted by their unsigned keys, into the
+ * tree <root>, see __eb64_merge_sorted(). Returns the number of nodes
+ * inserted, which is lower than <n> only for the unique keys trees.
+ */
+unsigned int eb64_merge_sorted(struct eb_root *root, struct eb64_node **nodes,
+			       unsigned int n)
+{
+	return __eb64_merge_sorted(root, nodes, n, 0);
+}
+
+/* Same as eb64_merge_sorted() for the nodes sorted by their signed keys */
+unsigned int eb64i_merge_sorted(struct eb_root *root, struct eb64_node **nodes,
+				unsigned int n)
+{
+	return __eb64_merge_sorted(root, nodes, n, 1);
+}
+
 struct eb64_node *eb64_lookup(struct eb_root *root, u64 x)
 {
 	return __eb64_lookup(root, x);
@@ -127,6 +127,18 @@ struct eb64_node *eb64_lookup_le(struct eb_root *root, u64 x);
 struct eb64_node *eb64_lookup_ge(struct eb_root *root, u64 x);
 struct eb64_node *eb64_insert(struct eb_root *root, struct eb64_node *new);
 struct eb64_node *eb64i_insert(struct eb_root *root, struct eb64_node *new);
+unsigned int eb64_pick_first(struct eb_root *root, struct eb64_node **nodes,
+			     unsigned int k);
+void eb64i_insert_bulk(struct eb_root *root, struct eb64_node **nodes,
+		       unsigned int n);
+unsigned int eb64_build_sorted(struct eb_root *root, struct eb64_node **nodes,
+			       unsigned int n);
+unsigned int eb64i_build_sorted(struct eb_root *root, struct eb64_node **nodes,
+				unsigned int n);
+unsigned int eb64_merge_sorted(struct eb_root *root, struct eb64_node **nodes,
+			       unsigned int n);
+unsigned int eb64i_merge_sorted(struct eb_root *root, struct eb64_node **nodes,
+				unsigned int n);
 
 /*
  * The following functions are less likely to be used directly, because their
@@ -522,6 +522,105 @@ __eb_insert_dup(struct eb_node *sub, struct eb_node *new)
 	}
 }
 
+/* State of a tree being built from nodes coming in the keys order, see
+ * __eb_build_add(). <spine> holds the nodes of the right-most path of the
+ * tree, the bits strictly decrease along it, so 64 entries are enough for
+ * any key size.
+ */
+struct eb_build {
+	struct eb_root *root;
+	struct eb_node *spine[64];
+	int depth;
+};
+
+static inline void __eb_build_init(struct eb_build *b, struct eb_root *root)
+{
+	b->root = root;
+	b->depth = 0;
+}
+
+/* Sets the parent of the leaf or the node designated by <troot> to <parent> */
+static forceinline void __eb_set_parent(eb_troot_t *troot, eb_troot_t *parent)
+{
+	if (eb_gettag(troot) == EB_LEAF)
+		eb_root_to_node(eb_untag(troot, EB_LEAF))->leaf_p = parent;
+	else
+		eb_root_to_node(eb_untag(troot, EB_NODE))->node_p = parent;
+}
+
+/* Appends <new> as the right-most entry of the tree being built in <b>. The
+ * tree doesn't need any descent : the new leaf is always attached below the
+ * right-most path, and the node part of <new> is inserted on this path just
+ * above the nodes having a lower bit than <bit>, which is the bit at which
+ * the new key differs from the previous one. The nodes removed from the path
+ * are never visited again, so building a tree of N nodes is O(N). <bit> is
+ * -1 if the key equals the previous one, so <new> is added to the duplicates
+ * tree as by the regular insertion, and is ignored for the first node.
+ */
+static forceinline void __eb_build_add(struct eb_build *b, struct eb_node *new,
+				       int bit)
+{
+	eb_troot_t *up = eb_dotag(b->root, EB_LEFT);
+	struct eb_root *parent = b->root;
+	eb_troot_t *sub;
+	unsigned int side = EB_LEFT;
+
+	if (unlikely(!b->root->b[EB_LEFT])) {
+		b->root->b[EB_LEFT] = eb_dotag(&new->branches, EB_LEAF);
+		new->leaf_p = up;
+		new->node_p = NULL; /* node part unused */
+		return;
+	}
+
+	if (b->depth) {
+		parent = &b->spine[b->depth - 1]->branches;
+		side = EB_RGHT;
+		up = eb_dotag(parent, EB_RGHT);
+	}
+	sub = parent->b[side];
+
+	if (unlikely(bit < 0)) {
+		struct eb_node *old;
+
+		if (eb_gettag(sub) == EB_NODE) {
+			__eb_insert_dup(eb_root_to_node(eb_untag(sub, EB_NODE)), new);
+			return;
+		}
+		/* the first duplicate, as in the leaf case of the insertion */
+		old = eb_root_to_node(eb_untag(sub, EB_LEAF));
+		new->bit = -1;
+		new->node_p = old->leaf_p;
+		old->leaf_p = eb_dotag(&new->branches, EB_LEFT);
+		new->leaf_p = eb_dotag(&new->branches, EB_RGHT);
+		new->branches.b[EB_LEFT] = sub;
+		new->branches.b[EB_RGHT] = eb_dotag(&new->branches, EB_LEAF);
+		parent->b[side] = eb_dotag(&new->branches, EB_NODE);
+		return;
+	}
+
+	/* the nodes with lower bits go below <new> on the left */
+	while (b->depth && b->spine[b->depth - 1]->bit < bit) {
+		sub = eb_dotag(&b->spine[--b->depth]->branches, EB_NODE);
+		if (b->depth) {
+			parent = &b->spine[b->depth - 1]->branches;
+			up = eb_dotag(parent, EB_RGHT);
+		} else {
+			parent = b->root;
+			side = EB_LEFT;
+			up = eb_dotag(parent, EB_LEFT);
+		}
+	}
+
+	new->bit = bit;
+	new->node_p = up;
+	new->branches.b[EB_LEFT] = sub;
+	__eb_set_parent(sub, eb_dotag(&new->branches, EB_LEFT));
+	new->branches.b[EB_RGHT] = eb_dotag(&new->branches, EB_LEAF);
+	new->leaf_p = eb_dotag(&new->branches, EB_RGHT);
+	parent->b[side] = eb_dotag(&new->branches, EB_NODE);
+	b->spine[b->depth++] = new;
+}
+
 
 /**************************************\
  * Public functions, for the end-user *
@@ -1,4 +1,5 @@
 #! /bin/bash
 
-g++ mybenchmark.cc  -std=c++11 -isystem benchmark/include -Iebtree -Ifibheap -Iheap -Ih2o   -Lbenchmark/build/src -lbenchmark -Lebtree -Lfibheap -Lh2o -Lheap -lebtree -lfibheap -lheap -lh2o -lpthread -o mybenchmark
-g++ mybenchmark_real.cc  -std=c++11 -isystem benchmark/include -Iebtree -Ifibheap -Iheap -Ih2o   -Lbenchmark/build/src -lbenchmark -Lebtree -Lfibheap -Lh2o -Lheap -lebtree -lfibheap -lheap -lh2o -lpthread -o mybenchmark_real
\ No newline at end of file
+g++ mybenchmark.cc  -std=c++11 -isystem benchmark/include -Iebtree -Ifibheap -Iheap -Ih2o -Icqueue   -Lbenchmark/build/src -lbenchmark -Lebtree -Lfibheap -Lh2o -Lheap -Lcqueue -lebtree -lfibheap -lheap -lh2o -lcqueue -lpthread -o mybenchmark
+g++ mybenchmark_real.cc  -std=c++11 -isystem benchmark/include -I.. -Iebtree -Ifibheap -Iheap -Ih2o -Icqueue   -Lbenchmark/build/src -lbenchmark -Lebtree -Lfibheap -Lh2o -Lheap -Lcqueue -lebtree -lfibheap -lheap -lh2o -lcqueue -lpthread -o mybenchmark_real
+g++ mybenchmark_tree.cc  -std=c++11 -isystem benchmark/include -Iebtree -Ifibheap -Iheap -Ih2o -Icqueue   -Lbenchmark/build/src -lbenchmark -Lebtree -Lfibheap -Lh2o -Lheap -Lcqueue -lebtree -lfibheap -lheap -lh2o -lcqueue -lpthread -o mybenchmark_tree
\ No newline at end of file
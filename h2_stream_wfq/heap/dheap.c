@@ -0,0 +1,121 @@
+#include "dheap.h"
+#include "errno.h"
+
+/* The children of node i are 4 * i + 1 .. 4 * i + 4. */
+#define PQ4_ARITY 4
+/* The slots before q[0], so that q[4 * i + 1] is cache line aligned. */
+#define PQ4_SHIFT (PQ4_ARITY - 1)
+#define PQ4_ALIGN 64
+
+void nghttp2_pq4_init(nghttp2_pq4 *pq) {
+  pq->capacity = 0;
+  pq->q = NULL;
+  pq->mem = NULL;
+  pq->length = 0;
+}
+
+void nghttp2_pq4_free(nghttp2_pq4 *pq) {
+  free(pq->mem);
+  pq->q = NULL;
+  pq->mem = NULL;
+}
+
+static void sift_up(nghttp2_pq4 *pq, size_t index, nghttp2_pq4_slot s) {
+  nghttp2_pq4_slot *q = pq->q;
+  size_t parent;
+
+  while (index != 0) {
+    parent = (index - 1) / PQ4_ARITY;
+    if (q[parent].key <= s.key) {
+      break;
+    }
+    q[index] = q[parent];
+    q[index].item->index = index;
+    index = parent;
+  }
+  q[index] = s;
+  s.item->index = index;
+}
+
+static void sift_down(nghttp2_pq4 *pq, size_t index, nghttp2_pq4_slot s) {
+  nghttp2_pq4_slot *q = pq->q;
+  size_t i, j, end, minindex;
+
+  for (;;) {
+    j = index * PQ4_ARITY + 1;
+    if (j >= pq->length) {
+      break;
+    }
+    end = j + PQ4_ARITY < pq->length ? j + PQ4_ARITY : pq->length;
+    minindex = j;
+    for (i = j + 1; i < end; ++i) {
+      if (q[i].key < q[minindex].key) {
+        minindex = i;
+      }
+    }
+    if (s.key <= q[minindex].key) {
+      break;
+    }
+    q[index] = q[minindex];
+    q[index].item->index = index;
+    index = minindex;
+  }
+  q[index] = s;
+  s.item->index = index;
+}
+
+int nghttp2_pq4_push(nghttp2_pq4 *pq, nghttp2_pq4_entry *item) {
+  nghttp2_pq4_slot s;
+
+  if (pq->capacity <= pq->length) {
+    void *nmem;
+    size_t ncapacity;
+
+    ncapacity = pq->capacity * 2 > 16 ? pq->capacity * 2 : 16;
+
+    if (posix_memalign(&nmem, PQ4_ALIGN,
+                       (ncapacity + PQ4_SHIFT) * sizeof(nghttp2_pq4_slot))) {
+      return -ENOMEM;
+    }
+    if (pq->length) {
+      memcpy((nghttp2_pq4_slot *)nmem + PQ4_SHIFT, pq->q,
+             pq->length * sizeof(nghttp2_pq4_slot));
+    }
+    free(pq->mem);
+    pq->capacity = ncapacity;
+    pq->mem = nmem;
+    pq->q = (nghttp2_pq4_slot *)nmem + PQ4_SHIFT;
+  }
+  s.key = item->key;
+  s.item = item;
+  ++pq->length;
+  sift_up(pq, pq->length - 1, s);
+  return 0;
+}
+
+nghttp2_pq4_entry *nghttp2_pq4_top(nghttp2_pq4 *pq) {
+  if (pq->length == 0) {
+    return NULL;
+  } else {
+    return pq->q[0].item;
+  }
+}
+
+void nghttp2_pq4_pop(nghttp2_pq4 *pq) {
+  if (pq->length > 0) {
+    --pq->length;
+    if (pq->length > 0) {
+      sift_down(pq, 0, pq->q[pq->length]);
+    }
+  }
+}
+
+void nghttp2_pq4_replace_top(nghttp2_pq4 *pq, uint64_t key) {
+  nghttp2_pq4_slot s = pq->q[0];
+
+  s.key = key;
+  s.item->key = key;
+  sift_down(pq, 0, s);
+}
+
+size_t nghttp2_pq4_size(nghttp2_pq4 *pq) { return pq->length; }
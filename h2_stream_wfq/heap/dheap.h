@@ -0,0 +1,92 @@
+/**
+ *    Tempesta FW
+ *
+ * Copyright (C) 2023 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * 4-ary variant of nghttp2_pq. The keys are stored in the array next to the
+ * pointers to the items, so the comparisons don't touch the items, and the
+ * array is shifted so that the 4 children of a node take one cache line.
+ * The sifts move the nodes to a hole instead of swapping them.
+ */
+typedef struct {
+  size_t index;
+  uint64_t key;
+} nghttp2_pq4_entry;
+
+typedef struct {
+  uint64_t key;
+  nghttp2_pq4_entry *item;
+} nghttp2_pq4_slot;
+
+typedef struct {
+  /* The slots, q[0] is the top */
+  nghttp2_pq4_slot *q;
+  /* The allocated memory, q is 3 slots after it */
+  void *mem;
+  /* The number of items stored */
+  size_t length;
+  /* The maximum number of items this pq can store. This is
+     automatically extended when length is reached to this value. */
+  size_t capacity;
+} nghttp2_pq4;
+
+/*
+ * Initializes priority queue |pq|.
+ */
+void nghttp2_pq4_init(nghttp2_pq4 *pq);
+
+/*
+ * Deallocates any resources allocated for |pq|.  The stored items are
+ * not freed by this function.
+ */
+void nghttp2_pq4_free(nghttp2_pq4 *pq);
+
+/*
+ * Adds |item| with key |item->key| to the priority queue |pq|.
+ *
+ * This function returns 0 if it succeeds, or -ENOMEM.
+ */
+int nghttp2_pq4_push(nghttp2_pq4 *pq, nghttp2_pq4_entry *item);
+
+/*
+ * Returns item at the top of the queue |pq|. If the queue is empty,
+ * this function returns NULL.
+ */
+nghttp2_pq4_entry *nghttp2_pq4_top(nghttp2_pq4 *pq);
+
+/*
+ * Pops item at the top of the queue |pq|. The popped item is not
+ * freed by this function.
+ */
+void nghttp2_pq4_pop(nghttp2_pq4 *pq);
+
+/*
+ * Sets the key of the item at the top of the non-empty queue |pq| to
+ * |key| and restores the heap order, which is the same as pop and push
+ * of the item by one sift.
+ */
+void nghttp2_pq4_replace_top(nghttp2_pq4 *pq, uint64_t key);
+
+/*
+ * Returns the number of items in the queue |pq|.
+ */
+size_t nghttp2_pq4_size(nghttp2_pq4 *pq);
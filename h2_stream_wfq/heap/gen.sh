@@ -1,4 +1,5 @@
 #! /bin/bash
 
 gcc -c heap.c -o heap.o
-ar rv libheap.a heap.o
\ No newline at end of file
+gcc -c dheap.c -o dheap.o
+ar rv libheap.a heap.o dheap.o
\ No newline at end of file
@@ -26,7 +26,7 @@ static void bubble_up(nghttp2_pq *pq, size_t index) {
   size_t parent;
   while (index != 0) {
     parent = (index - 1) / 2;
-    if ((pq->q[index]->key < pq->q[parent]->key)) {
+    if (!(pq->q[index]->key < pq->q[parent]->key)) {
       return;
     }
     swap(pq, parent, index);
@@ -93,6 +93,27 @@ void nghttp2_pq_pop(nghttp2_pq *pq) {
   }
 }
 
+void nghttp2_pq_remove(nghttp2_pq *pq, nghttp2_pq_entry *item) {
+  if (item->index == 0) {
+    nghttp2_pq_pop(pq);
+    return;
+  }
+
+  if (item->index == pq->length - 1) {
+    --pq->length;
+    return;
+  }
+
+  pq->q[item->index] = pq->q[pq->length - 1];
+  pq->q[item->index]->index = item->index;
+  --pq->length;
+
+  if (pq->q[item->index]->key < item->key) {
+    bubble_up(pq, item->index);
+  } else {
+    bubble_down(pq, item->index);
+  }
+}
 
 int nghttp2_pq_empty(nghttp2_pq *pq) { return pq->length == 0; }
 
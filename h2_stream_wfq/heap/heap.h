@@ -20,11 +20,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 
 typedef struct {
   size_t index;
-  int key;
+  uint64_t key;
 } nghttp2_pq_entry;
 
 typedef struct {
@@ -71,6 +72,11 @@ nghttp2_pq_entry *nghttp2_pq_top(nghttp2_pq *pq);
  */
 void nghttp2_pq_pop(nghttp2_pq *pq);
 
+/*
+ * Removes |item| from the priority queue.
+ */
+void nghttp2_pq_remove(nghttp2_pq *pq, nghttp2_pq_entry *item);
+
 /*
  * Returns nonzero if the queue |pq| is empty.
  */
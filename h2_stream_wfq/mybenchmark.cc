@@ -9,6 +9,7 @@ extern "C" {
 #include "fibheap.h"
 #include "heap.h"
 #include "h2o.h"
+#include "cqueue.h"
 }
 
 #include <benchmark/benchmark.h>
@@ -26,6 +27,8 @@ static struct eb64_node nodes[MAX_COUNT];
 static TfwHeapNode fheap_nodes[MAX_COUNT];
 static nghttp2_pq_entry heap_nodes[MAX_COUNT];
 static h2o_http2_scheduler_queue_node_t h2o_nodes[MAX_COUNT];
+static TfwCq cq;
+static TfwCqNode cq_nodes[MAX_COUNT];
 
 static void BM_ebtree_insert_delete(benchmark::State& state) {
 	random_device rd;
@@ -124,4 +127,30 @@ static void BM_h2o_insert_delete(benchmark::State& state) {
 }
 BENCHMARK(BM_h2o_insert_delete);
 
+/*
+ * The calendar queue keeps only the keys within its window after the minimum,
+ * so the new keys are the random distances from the extracted one.
+ */
+static void BM_cqueue_insert_delete(benchmark::State& state) {
+	random_device rd;
+	mt19937 gen(rd());
+	uniform_int_distribution<> dist(1, 1000000);
+	TfwCqNode *root;
+
+	/* 512 buckets of 2048 keys cover the keys range. */
+	tfw_cq_init(&cq, 0, 11);
+
+	for (unsigned int i = 0; i < MAX_COUNT; i++) {
+		tfw_cq_node_init(&cq_nodes[i], dist(gen));
+		tfw_cq_insert(&cq, &cq_nodes[i]);
+	}
+
+	for (auto _ : state) {
+		root = tfw_cq_extract_min(&cq);
+		root->key += dist(gen);
+		tfw_cq_insert(&cq, root);
+	}
+}
+BENCHMARK(BM_cqueue_insert_delete);
+
 BENCHMARK_MAIN();
\ No newline at end of file
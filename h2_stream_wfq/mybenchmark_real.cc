@@ -8,17 +8,29 @@ extern "C" {
 extern "C" {
 #include "fibheap.h"
 #include "heap.h"
+#include "dheap.h"
 #include "h2o.h"
+#include "cqueue.h"
 }
 
 #include <benchmark/benchmark.h>
+#include <algorithm>
 #include <random>
 #include <cstring>
 #include <cstdlib>
+#include <vector>
+
+#ifdef WFQ_LIBDIVIDE
+#include "libdivide_u64.h"
+#endif
 
 using namespace std;
 
-#define MAX_COUNT 100
+/* The maximum number of active streams and of streams picked at once. */
+#define MAX_STREAMS 10000
+#define MAX_BULK 16
+/* The deficit increments are 256-65536, see wfq_default_deficit(). */
+#define CQ_SHIFT 8
 
 struct tfw_eb64_node {
 	unsigned int weight;
@@ -35,14 +47,46 @@ struct tfw_heap_node {
 	nghttp2_pq_entry node;
 };
 
-static struct tfw_eb64_node nodes[MAX_COUNT];
-static tfw_fheap_node fheap_nodes[MAX_COUNT];
-static tfw_heap_node heap_nodes[MAX_COUNT];
-static h2o_http2_scheduler_queue_node_t h2o_nodes[MAX_COUNT];
+struct tfw_dheap_node {
+	unsigned int weight;
+	nghttp2_pq4_entry node;
+};
+
+struct tfw_cq_node {
+	unsigned int weight;
+	TfwCqNode node;
+};
+
+static struct tfw_eb64_node nodes[MAX_STREAMS];
+static tfw_fheap_node fheap_nodes[MAX_STREAMS];
+static tfw_heap_node heap_nodes[MAX_STREAMS];
+static tfw_dheap_node dheap_nodes[MAX_STREAMS];
+static h2o_http2_scheduler_queue_node_t h2o_nodes[MAX_STREAMS];
+static tfw_cq_node cq_nodes[MAX_STREAMS];
+
+#ifdef WFQ_LIBDIVIDE
+/*
+ * Compute the deficits by libdivide with the divisors precomputed for each
+ * weight, just like they can be precomputed when a stream weight is set.
+ * The table is still about twice faster, see div_u64_u16.cc.
+ */
+static struct WfqDiv {
+	LibdivideU64 d[256];
+
+	WfqDiv()
+	{
+		for (int w = 1; w <= 256; ++w)
+			d[w - 1] = LibdivideU64(w);
+	}
+} wfq_div;
+#endif
 
 static inline unsigned long
 wfq_default_deficit(unsigned int weight)
 {
+#ifdef WFQ_LIBDIVIDE
+	return 65536 / wfq_div.d[weight - 1];
+#else
 	static const unsigned tbl[256] = {
 		65536, 32768, 21845, 16384, 13107, 10922, 9362, 8192, 7281,
 		6553, 5957, 5461, 5041, 4681, 4369, 4096, 3855, 3640, 3449,
@@ -70,6 +114,7 @@ wfq_default_deficit(unsigned int weight)
 	};
 
 	return tbl[weight - 1];
+#endif
 }
 
 static inline unsigned long
@@ -88,7 +133,7 @@ static void BM_ebtree_insert_delete(benchmark::State& state) {
 
 	tree = EB_ROOT;
 
-	for (unsigned int i = 0; i < MAX_COUNT; i++) {
+	for (unsigned int i = 0; i < state.range(0); i++) {
 		nodes[i].weight = dist(gen);
 		nodes[i].node.key = calc_wfq_deficit(0, nodes[i].weight);
 		eb64i_insert(&tree, &nodes[i].node);
@@ -103,7 +148,141 @@ static void BM_ebtree_insert_delete(benchmark::State& state) {
 	}
 }
 // Register the function as a benchmark
-BENCHMARK(BM_ebtree_insert_delete);
+BENCHMARK(BM_ebtree_insert_delete)->Arg(100)->Arg(1000)->Arg(MAX_STREAMS);
+
+/*
+ * Pick state.range(1) streams with the lowest deficits in one tree walk and
+ * reinsert them in bulk, as for frames of several streams sent in one TLS
+ * record. There are state.range(0) active streams.
+ */
+static void BM_ebtree_bulk(benchmark::State& state) {
+	random_device rd;
+	mt19937 gen(rd());
+	uniform_int_distribution<> dist(1, 256);
+	struct eb_root tree;
+	struct eb64_node *picked[MAX_BULK];
+	struct tfw_eb64_node *entry;
+	unsigned int count = state.range(0), k = state.range(1), n;
+
+	tree = EB_ROOT;
+
+	for (unsigned int i = 0; i < count; i++) {
+		nodes[i].weight = dist(gen);
+		nodes[i].node.key = calc_wfq_deficit(0, nodes[i].weight);
+		eb64i_insert(&tree, &nodes[i].node);
+	}
+
+	for (auto _ : state) {
+		n = eb64_pick_first(&tree, picked, k);
+		for (unsigned int i = 0; i < n; i++) {
+			entry = eb64_entry(picked[i], struct tfw_eb64_node, node);
+			picked[i]->key = calc_wfq_deficit(picked[i]->key,
+							  entry->weight);
+		}
+		eb64i_insert_bulk(&tree, picked, n);
+	}
+	state.SetItemsProcessed(state.iterations() * k);
+}
+BENCHMARK(BM_ebtree_bulk)
+	->ArgsProduct({{100, 1000, MAX_STREAMS}, {1, 4, MAX_BULK}});
+
+/*
+ * Bulk loading of a tree of state.range(0) nodes with random timer-like keys,
+ * e.g. on the scheduler state restore: the node pointers are sorted by the
+ * keys, but the nodes are spread in memory as for the real streams.
+ */
+struct bulk_set {
+	vector<eb64_node> nodes;
+	vector<eb64_node *> sorted;
+
+	bulk_set(unsigned int n) : nodes(n), sorted(n)
+	{
+		mt19937_64 gen(n);
+		uniform_int_distribution<s64> dist(0, 1LL << 40);
+
+		for (unsigned int i = 0; i < n; i++) {
+			nodes[i].key = dist(gen);
+			sorted[i] = &nodes[i];
+		}
+		sort(sorted.begin(), sorted.end(),
+		     [](const eb64_node *a, const eb64_node *b) {
+			     return (s64)a->key < (s64)b->key;
+		     });
+	}
+};
+
+static void BM_ebtree_load_insert(benchmark::State& state) {
+	bulk_set set(state.range(0));
+	struct eb_root tree;
+
+	for (auto _ : state) {
+		tree = EB_ROOT;
+		for (auto node : set.sorted)
+			eb64i_insert(&tree, node);
+		benchmark::DoNotOptimize(tree);
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ebtree_load_insert)->Arg(10000)->Arg(100000)->Arg(1000000);
+
+static void BM_ebtree_load_build(benchmark::State& state) {
+	bulk_set set(state.range(0));
+	struct eb_root tree;
+
+	for (auto _ : state) {
+		tree = EB_ROOT;
+		eb64i_build_sorted(&tree, set.sorted.data(), set.sorted.size());
+		benchmark::DoNotOptimize(tree);
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ebtree_load_build)->Arg(10000)->Arg(100000)->Arg(1000000);
+
+/*
+ * Add a sorted batch of state.range(1) percents of state.range(0) nodes to
+ * the tree of the rest of the nodes, by the insertions or by the merge.
+ */
+static void ebtree_merge_bench(benchmark::State& state, bool merge) {
+	bulk_set set(state.range(0));
+	unsigned int n = set.sorted.size() * state.range(1) / 100;
+	vector<eb64_node *> tree_part, batch;
+	struct eb_root tree;
+
+	/* every node goes to the batch with the same probability */
+	for (unsigned int i = 0; i < set.sorted.size(); i++)
+		if (i * state.range(1) % 100 < (unsigned int)state.range(1)
+		    && batch.size() < n)
+			batch.push_back(set.sorted[i]);
+		else
+			tree_part.push_back(set.sorted[i]);
+
+	for (auto _ : state) {
+		state.PauseTiming();
+		tree = EB_ROOT;
+		eb64i_build_sorted(&tree, tree_part.data(), tree_part.size());
+		state.ResumeTiming();
+		if (merge) {
+			eb64i_merge_sorted(&tree, batch.data(), batch.size());
+		} else {
+			for (auto node : batch)
+				eb64i_insert(&tree, node);
+		}
+		benchmark::DoNotOptimize(tree);
+	}
+	state.SetItemsProcessed(state.iterations() * batch.size());
+}
+
+static void BM_ebtree_merge_insert(benchmark::State& state) {
+	ebtree_merge_bench(state, false);
+}
+BENCHMARK(BM_ebtree_merge_insert)
+	->ArgsProduct({{10000, 100000, 1000000}, {1, 10, 50}});
+
+static void BM_ebtree_merge(benchmark::State& state) {
+	ebtree_merge_bench(state, true);
+}
+BENCHMARK(BM_ebtree_merge)
+	->ArgsProduct({{10000, 100000, 1000000}, {1, 10, 50}});
 
 // Define another benchmark
 static void BM_fheap_insert_delete(benchmark::State& state) {
@@ -117,7 +296,7 @@ static void BM_fheap_insert_delete(benchmark::State& state) {
 
 	tfw_heap_init(&heap);
 
-	for (unsigned int i = 0; i < MAX_COUNT; i++) {
+	for (unsigned int i = 0; i < state.range(0); i++) {
 		fheap_nodes[i].weight = dist(gen);
 		deficit = calc_wfq_deficit(0, fheap_nodes[i].weight);
 		tfw_heap_node_init(&fheap_nodes[i].node, deficit);
@@ -133,7 +312,7 @@ static void BM_fheap_insert_delete(benchmark::State& state) {
 		tfw_heap_insert(&heap, root);
 	}
 }
-BENCHMARK(BM_fheap_insert_delete);
+BENCHMARK(BM_fheap_insert_delete)->Arg(100)->Arg(1000)->Arg(MAX_STREAMS);
 
 // Define another benchmark
 static void BM_heap_insert_delete(benchmark::State& state) {
@@ -147,7 +326,7 @@ static void BM_heap_insert_delete(benchmark::State& state) {
 
 	nghttp2_pq_init(&pq);
 
-	for (unsigned int i = 0; i < MAX_COUNT; i++) {
+	for (unsigned int i = 0; i < state.range(0); i++) {
 		heap_nodes[i].weight = dist(gen);
 		deficit = calc_wfq_deficit(0, heap_nodes[i].weight);
 		nghttp2_pq_push(&pq, &heap_nodes[i].node);
@@ -162,7 +341,57 @@ static void BM_heap_insert_delete(benchmark::State& state) {
 		nghttp2_pq_push(&pq, root);
 	}
 }
-BENCHMARK(BM_heap_insert_delete);
+BENCHMARK(BM_heap_insert_delete)->Arg(100)->Arg(1000)->Arg(MAX_STREAMS);
+
+static void dheap_fill(nghttp2_pq4 *pq, unsigned int count) {
+	random_device rd;
+	mt19937 gen(rd());
+	uniform_int_distribution<> dist(1, 256);
+
+	nghttp2_pq4_init(pq);
+
+	for (unsigned int i = 0; i < count; i++) {
+		dheap_nodes[i].weight = dist(gen);
+		dheap_nodes[i].node.key = calc_wfq_deficit(0, dheap_nodes[i].weight);
+		nghttp2_pq4_push(pq, &dheap_nodes[i].node);
+	}
+}
+
+static void BM_dheap_insert_delete(benchmark::State& state) {
+	nghttp2_pq4 pq;
+	nghttp2_pq4_entry *root;
+	struct tfw_dheap_node *entry;
+
+	dheap_fill(&pq, state.range(0));
+
+	for (auto _ : state) {
+		root = nghttp2_pq4_top(&pq);
+		nghttp2_pq4_pop(&pq);
+		entry = container_of(root, struct tfw_dheap_node, node);
+		root->key = calc_wfq_deficit(root->key, entry->weight);
+		nghttp2_pq4_push(&pq, root);
+	}
+	nghttp2_pq4_free(&pq);
+}
+BENCHMARK(BM_dheap_insert_delete)->Arg(100)->Arg(1000)->Arg(MAX_STREAMS);
+
+/* The picked stream is reinserted by one sift down from the top. */
+static void BM_dheap_replace_top(benchmark::State& state) {
+	nghttp2_pq4 pq;
+	nghttp2_pq4_entry *root;
+	struct tfw_dheap_node *entry;
+
+	dheap_fill(&pq, state.range(0));
+
+	for (auto _ : state) {
+		root = nghttp2_pq4_top(&pq);
+		entry = container_of(root, struct tfw_dheap_node, node);
+		nghttp2_pq4_replace_top(&pq, calc_wfq_deficit(root->key,
+							      entry->weight));
+	}
+	nghttp2_pq4_free(&pq);
+}
+BENCHMARK(BM_dheap_replace_top)->Arg(100)->Arg(1000)->Arg(MAX_STREAMS);
 
 // Define another benchmark
 static void BM_h2o_insert_delete(benchmark::State& state) {
@@ -174,7 +403,7 @@ static void BM_h2o_insert_delete(benchmark::State& state) {
 
 	queue_init(&queue);
 
-	for (unsigned int i = 0; i < MAX_COUNT; i++) {
+	for (unsigned int i = 0; i < state.range(0); i++) {
 		h2o_nodes[i]._deficit = 0;
 		h2o_nodes[i].weight = dist(gen);
 		queue_set(&queue, &h2o_nodes[i]);
@@ -186,6 +415,33 @@ static void BM_h2o_insert_delete(benchmark::State& state) {
 		queue_set(&queue, root);
 	}
 }
-BENCHMARK(BM_h2o_insert_delete);
+BENCHMARK(BM_h2o_insert_delete)->Arg(100)->Arg(1000)->Arg(MAX_STREAMS);
+
+static void BM_cqueue_insert_delete(benchmark::State& state) {
+	random_device rd;
+	mt19937 gen(rd());
+	uniform_int_distribution<> dist(1, 256);
+	TfwCq *cq = (TfwCq *)malloc(sizeof(TfwCq));
+	TfwCqNode *root;
+	struct tfw_cq_node *entry;
+
+	tfw_cq_init(cq, 0, CQ_SHIFT);
+
+	for (unsigned int i = 0; i < state.range(0); i++) {
+		cq_nodes[i].weight = dist(gen);
+		tfw_cq_node_init(&cq_nodes[i].node,
+				 calc_wfq_deficit(0, cq_nodes[i].weight));
+		tfw_cq_insert(cq, &cq_nodes[i].node);
+	}
+
+	for (auto _ : state) {
+		root = tfw_cq_extract_min(cq);
+		entry = container_of(root, struct tfw_cq_node, node);
+		root->key = calc_wfq_deficit(root->key, entry->weight);
+		tfw_cq_insert(cq, root);
+	}
+	free(cq);
+}
+BENCHMARK(BM_cqueue_insert_delete)->Arg(100)->Arg(1000)->Arg(MAX_STREAMS);
 
 BENCHMARK_MAIN();
\ No newline at end of file
@@ -0,0 +1,515 @@
+extern "C" {
+#define new NEW
+#include "eb64tree.h"
+#undef new
+}
+
+extern "C" {
+#include "fibheap.h"
+#include "heap.h"
+#include "h2o.h"
+}
+
+#include <benchmark/benchmark.h>
+#include <cstring>
+#include <cstdlib>
+
+using namespace std;
+
+/*
+ * HTTP/2 priority trees (RFC 7540 5.3) scheduled by each of the queues: every
+ * stream keeps a queue of its children having data to send or active
+ * descendants, and a pick descends from the root popping the child with the
+ * lowest deficit at each level until a stream with data, like h2o does.
+ *
+ * The streams send a few frames and close, and new streams are opened in
+ * place of them, so the number of the streams is constant. Besides that,
+ * the streams are blocked and unblocked (flow control, waiting for the
+ * upstream) and reprioritized.
+ */
+
+#define MAX_STREAMS 1000
+/* The Firefox placeholder streams. */
+#define FF_GROUPS 5
+/* A random stream is reprioritized every REPRIO_INTERVAL picks. */
+#define REPRIO_INTERVAL 64
+/* Chrome priorities from HIGHEST to IDLE. */
+#define CHROME_PRIO 5
+
+enum {
+	/*
+	 * Firefox: the streams depend on the idle placeholder streams
+	 * (leaders, followers depending on leaders, unblocked, background,
+	 * speculative depending on background), so the depth is 3.
+	 */
+	TREE_FIREFOX,
+	/*
+	 * Chrome: each stream depends exclusively on the newest stream of
+	 * the same or a higher priority, making a long chain.
+	 */
+	TREE_CHROME,
+	/* Random trees of depth 3 and 6. */
+	TREE_RANDOM3,
+	TREE_RANDOM6,
+};
+
+static inline unsigned long
+wfq_default_deficit(unsigned int weight)
+{
+	return 65536 / weight;
+}
+
+static unsigned long rnd_state;
+
+static inline unsigned long
+rnd(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 7;
+	rnd_state ^= rnd_state << 17;
+
+	return rnd_state;
+}
+
+/*
+ * The queues adapters. key is the deficit computed by the scheduler, h2o
+ * computes it from the weight itself.
+ */
+struct EbQ {
+	typedef struct eb64_node Node;
+	typedef struct eb_root Queue;
+
+	static void init(Queue *q) { *q = EB_ROOT; }
+	static void destroy(Queue *q) {}
+	static void push(Queue *q, Node *n, unsigned long key, unsigned int w)
+	{
+		n->key = key;
+		eb64_insert(q, n);
+	}
+	static Node *pop(Queue *q)
+	{
+		Node *n = eb64_first(q);
+
+		if (n)
+			eb64_delete(n);
+		return n;
+	}
+	static void remove(Queue *q, Node *n) { eb64_delete(n); }
+};
+
+struct FheapQ {
+	typedef TfwHeapNode Node;
+	typedef TfwHeap Queue;
+
+	static void init(Queue *q) { tfw_heap_init(q); }
+	static void destroy(Queue *q) {}
+	static void push(Queue *q, Node *n, unsigned long key, unsigned int w)
+	{
+		tfw_heap_node_init(n, key);
+		tfw_heap_insert(q, n);
+	}
+	static Node *pop(Queue *q) { return tfw_heap_extract_min(q); }
+	static void remove(Queue *q, Node *n) { tfw_heap_remove(q, n); }
+};
+
+struct HeapQ {
+	typedef nghttp2_pq_entry Node;
+	typedef nghttp2_pq Queue;
+
+	static void init(Queue *q) { nghttp2_pq_init(q); }
+	static void destroy(Queue *q) { nghttp2_pq_free(q); }
+	static void push(Queue *q, Node *n, unsigned long key, unsigned int w)
+	{
+		n->key = key;
+		nghttp2_pq_push(q, n);
+	}
+	static Node *pop(Queue *q)
+	{
+		Node *n = nghttp2_pq_top(q);
+
+		if (n)
+			nghttp2_pq_pop(q);
+		return n;
+	}
+	static void remove(Queue *q, Node *n) { nghttp2_pq_remove(q, n); }
+};
+
+struct H2oQ {
+	typedef h2o_http2_scheduler_queue_node_t Node;
+	typedef h2o_http2_scheduler_queue_t Queue;
+
+	static void init(Queue *q) { queue_init(q); }
+	static void destroy(Queue *q) {}
+	static void push(Queue *q, Node *n, unsigned long key, unsigned int w)
+	{
+		n->weight = w;
+		queue_set(q, n);
+	}
+	static Node *pop(Queue *q) { return queue_pop(q); }
+	static void remove(Queue *q, Node *n) { h2o_linklist_unlink(&n->_link); }
+};
+
+template<class Q>
+struct Stream {
+	typename Q::Node node;		/* in the parent's queue */
+	typename Q::Queue q;		/* the scheduled children */
+	Stream *parent;
+	Stream *child;			/* the dependency tree */
+	Stream *next;
+	Stream *prev;
+	unsigned long key;		/* the deficit in the parent's queue */
+	unsigned long vtime;		/* the deficit of the last pick */
+	unsigned int weight;
+	unsigned int frames;
+	unsigned int prio;
+	bool active;			/* has data to send */
+	bool queued;
+	unsigned int nqueued;		/* the number of scheduled children */
+};
+
+template<class Q>
+struct Sched {
+	typedef Stream<Q> S;
+
+	S root;
+	S streams[MAX_STREAMS + FF_GROUPS];
+	unsigned int n;
+	int shape;
+	S *chrome_last[CHROME_PRIO];
+
+	static S *
+	stream(typename Q::Node *n)
+	{
+		return n ? container_of(n, S, node) : NULL;
+	}
+
+	bool
+	has_children(S *s)
+	{
+		return s->nqueued;
+	}
+
+	bool
+	schedulable(S *s)
+	{
+		return s->active || has_children(s);
+	}
+
+	void
+	push(S *p, S *s, unsigned long key)
+	{
+		s->key = key;
+		Q::push(&p->q, &s->node, key, s->weight);
+		s->queued = true;
+		++p->nqueued;
+	}
+
+	S *
+	pop(S *p)
+	{
+		S *s = stream(Q::pop(&p->q));
+
+		if (s) {
+			s->queued = false;
+			--p->nqueued;
+			p->vtime = s->key;
+		}
+		return s;
+	}
+
+	void
+	dequeue(S *s)
+	{
+		if (s->queued) {
+			Q::remove(&s->parent->q, &s->node);
+			s->queued = false;
+			--s->parent->nqueued;
+		}
+	}
+
+	/* Queue @s and its ancestors which weren't scheduled. */
+	void
+	enqueue_up(S *s)
+	{
+		for ( ; s != &root && !s->queued; s = s->parent)
+			push(s->parent, s, s->parent->vtime
+					   + wfq_default_deficit(s->weight));
+	}
+
+	void
+	link(S *s, S *p)
+	{
+		s->parent = p;
+		s->prev = NULL;
+		s->next = p->child;
+		if (p->child)
+			p->child->prev = s;
+		p->child = s;
+	}
+
+	void
+	unlink(S *s)
+	{
+		if (s->prev)
+			s->prev->next = s->next;
+		else
+			s->parent->child = s->next;
+		if (s->next)
+			s->next->prev = s->prev;
+	}
+
+	/* Move subtree @s under @p keeping its scheduling state. */
+	void
+	move(S *s, S *p)
+	{
+		dequeue(s);
+		unlink(s);
+		link(s, p);
+		if (schedulable(s))
+			enqueue_up(s);
+	}
+
+	bool
+	is_descendant(S *s, S *anc)
+	{
+		for ( ; s != &root; s = s->parent)
+			if (s == anc)
+				return true;
+		return false;
+	}
+
+	/* RFC 7540 5.3.3 reprioritization. */
+	void
+	reprioritize(S *s, S *p, bool exclusive, unsigned int weight)
+	{
+		if (p != &root && is_descendant(p, s))
+			move(p, s->parent);
+		if (exclusive)
+			while (p->child && (p->child != s || s->next)) {
+				S *c = p->child == s ? s->next : p->child;
+
+				move(c, s);
+			}
+		s->weight = weight;
+		move(s, p);
+	}
+
+	/*
+	 * Pick the stream to send a frame from, the streams on the path are
+	 * rescheduled with the new deficits. The not schedulable streams are
+	 * removed from the queues lazily.
+	 */
+	S *
+	pick(S *p)
+	{
+		S *s, *r;
+
+		while ((s = pop(p))) {
+			r = s->active ? s : (has_children(s) ? pick(s) : NULL);
+			if (schedulable(s))
+				push(p, s, s->key + wfq_default_deficit(s->weight));
+			if (r)
+				return r;
+		}
+		return NULL;
+	}
+
+	unsigned int
+	depth(S *s)
+	{
+		unsigned int d = 0;
+
+		for ( ; s != &root; s = s->parent)
+			++d;
+		return d;
+	}
+
+	S *
+	rnd_stream()
+	{
+		return &streams[rnd() % n];
+	}
+
+	/*
+	 * A random parent for @s in the random trees. Only the depth of the
+	 * parent is limited, so the reprioritized subtrees can go deeper.
+	 */
+	S *
+	rnd_parent(S *s)
+	{
+		S *p = rnd_stream();
+
+		if (p == s || !p->parent
+		    || depth(p) >= (shape == TREE_RANDOM3 ? 3 : 6))
+			return &root;
+		return p;
+	}
+
+	void
+	open(S *s)
+	{
+		static const unsigned int chrome_w[CHROME_PRIO] = {
+			256, 220, 183, 147, 110
+		};
+		S *p = &root;
+		bool exclusive = false;
+
+		s->frames = 1 + rnd() % 16;
+		s->active = true;
+		s->child = NULL;
+		s->nqueued = 0;
+		s->queued = false;
+		s->vtime = 0;
+		Q::init(&s->q);
+
+		switch (shape) {
+		case TREE_FIREFOX:
+			/* Leaders, followers, unblocked, background, speculative. */
+			p = &streams[MAX_STREAMS + rnd() % FF_GROUPS];
+			s->weight = 32;
+			break;
+		case TREE_CHROME:
+			s->prio = rnd() % CHROME_PRIO;
+			s->weight = chrome_w[s->prio];
+			for (int i = s->prio; i >= 0; --i)
+				if (chrome_last[i]) {
+					p = chrome_last[i];
+					break;
+				}
+			chrome_last[s->prio] = s;
+			exclusive = true;
+			break;
+		default:
+			s->weight = 1 + rnd() % 256;
+			p = rnd_parent(s);
+		}
+
+		link(s, &root);
+		reprioritize(s, p, exclusive, s->weight);
+	}
+
+	/* The children of a closed stream depend on its parent. */
+	void
+	close(S *s)
+	{
+		S *p = s->parent;
+
+		while (s->child)
+			move(s->child, p);
+		dequeue(s);
+		unlink(s);
+		s->parent = NULL;
+		s->active = false;
+		Q::destroy(&s->q);
+		if (shape == TREE_CHROME && chrome_last[s->prio] == s)
+			chrome_last[s->prio] = NULL;
+	}
+
+	void
+	init(int tree_shape, unsigned int count)
+	{
+		static const unsigned int ff_w[FF_GROUPS] = {
+			201, 1, 101, 1, 1
+		};
+
+		rnd_state = 0x2545f4914f6cdd1dUL;
+		shape = tree_shape;
+		n = count;
+		memset(&root, 0, sizeof(root));
+		Q::init(&root.q);
+		memset(chrome_last, 0, sizeof(chrome_last));
+
+		for (unsigned int i = 0; i < FF_GROUPS; ++i) {
+			S *g = &streams[MAX_STREAMS + i];
+
+			memset(g, 0, sizeof(*g));
+			Q::init(&g->q);
+			g->weight = ff_w[i];
+			if (shape == TREE_FIREFOX)
+				link(g, &root);
+		}
+		/* Followers depend on leaders, speculative on background. */
+		if (shape == TREE_FIREFOX) {
+			reprioritize(&streams[MAX_STREAMS + 1],
+				     &streams[MAX_STREAMS], false, ff_w[1]);
+			reprioritize(&streams[MAX_STREAMS + 4],
+				     &streams[MAX_STREAMS + 3], false, ff_w[4]);
+		}
+
+		/* The streams are chosen as parents before they're opened. */
+		memset(streams, 0, sizeof(S) * n);
+		for (unsigned int i = 0; i < n; ++i)
+			open(&streams[i]);
+	}
+
+	void
+	destroy()
+	{
+		for (unsigned int i = 0; i < n; ++i)
+			Q::destroy(&streams[i].q);
+		for (unsigned int i = 0; i < FF_GROUPS; ++i)
+			Q::destroy(&streams[MAX_STREAMS + i].q);
+		Q::destroy(&root.q);
+	}
+
+	/* Send one frame and process the events. */
+	void
+	step(unsigned long i)
+	{
+		S *s = pick(&root);
+
+		if (s && !--s->frames) {
+			close(s);
+			open(s);
+		} else if (s && !(rnd() % 8)) {
+			s->active = false;
+		}
+
+		/* Unblock a stream. */
+		if (!(i % 4)) {
+			S *u = rnd_stream();
+
+			if (!u->active) {
+				u->active = true;
+				enqueue_up(u);
+			}
+		}
+
+		if (!(i % REPRIO_INTERVAL)) {
+			S *r = rnd_stream(), *p = &root;
+
+			if (shape == TREE_RANDOM3 || shape == TREE_RANDOM6)
+				p = rnd_parent(r);
+			else if (rnd() % 4)
+				p = rnd_stream();
+
+			if (r != p)
+				reprioritize(r, p, rnd() % 2, 1 + rnd() % 256);
+		}
+	}
+};
+
+template<class Q>
+static void BM_tree(benchmark::State& state) {
+	Sched<Q> *sched = new Sched<Q>;
+	unsigned long i = 0;
+
+	sched->init(state.range(0), state.range(1));
+
+	for (auto _ : state)
+		sched->step(++i);
+
+	sched->destroy();
+	delete sched;
+}
+
+#define TREE_ARGS							\
+	ArgsProduct({{TREE_FIREFOX, TREE_CHROME, TREE_RANDOM3, TREE_RANDOM6}, \
+		     {100, MAX_STREAMS}})
+
+BENCHMARK_TEMPLATE(BM_tree, EbQ)->TREE_ARGS;
+BENCHMARK_TEMPLATE(BM_tree, FheapQ)->TREE_ARGS;
+BENCHMARK_TEMPLATE(BM_tree, HeapQ)->TREE_ARGS;
+BENCHMARK_TEMPLATE(BM_tree, H2oQ)->TREE_ARGS;
+
+BENCHMARK_MAIN();
@@ -37,19 +37,16 @@
  *      is required to reduce the overhead of the indexes.
  *   2. each database (index, data and metadata) is stored in a separate file
  *      for manageability, so fixed size files are required to split the adress
- *      space. If we need flexible database sizes, then we'll need to go to
- *      single file. Having that we can't let OS to page out our data due to
+ *      space. Having that we can't let OS to page out our data due to
  *      response time constraints and nobody in the system still can't use the
- *      memory, unlimited databases useless. If a table doesn't use all the
- *      allocated space or need more, then we'll be able to shrink it or expand,
- *      but the system shutdown and full index rebuild will be required.
+ *      memory, unlimited databases useless. Instead, a table can grow online
+ *      by extents up to a hard limit: the whole address space of the table is
+ *      reserved, so the offsets stay the same, and only the used extents are
+ *      mapped (and locked) on demand, see ext_grow(). A table size is any
+ *      multiple of the extent size, not necessarily a power of 2.
  *
- * TODO we do need flexible size tables, e.g. recently we ran out of free space
- * for clients database and it's hard to predict which size is required for us
- * (e.g. 30K or 1M clients accounting). We can, and probably shoud, have a hard
- * limit for a table size though.
- * TODO #1515: also make sure that tables are fine with sizes of not power of 2,
- * e.g. 7GB.
+ * TODO shrinking a table still requires the system shutdown and full index
+ * rebuild.
  *
  * Copyright (C) 2022-2023 Tempesta Technologies, Inc.
  *
@@ -77,7 +74,7 @@
  *
  * +----------------------------------------------------------------------------
  * |  TdbHdr   | ext0 hdr | active blk | ... | free blk | ...
- * | TdbAlloc  | TdbExt   |            |     | SEntry   |
+ * | TdbAlloc  | TdbExt   |            |     | SEntry64 |
  * +-----------+-+---------------------^-------^--------------------------------
  * \           / |                     |       |
  *  \____ ____/  +---------------------|-------+
@@ -88,7 +85,7 @@
  * - All extents, except the very first, are aligned on TDB_EXT_SZ.
  *   The first extent has offset for all the data structured managed by TdbHdr.
  * - All blocks inside an extent, except the very first one are aligned on
- *   TDB_BLK_SZ. The first block has offset of TdbExt header.
+ *   TDB_BLK_SZ. The first block has offset LFS64_ALIGN for the TdbExt header.
  * - Active (dirty) blocks have no headers and are dereferenced by their offsets.
  * - TdbExt stores the stack of free blocks in the extent.
  */
@@ -136,15 +133,17 @@ tdb_ext_ptr(TdbAlloc *a, uint64_t addr)
 }
 
 /**
- * Get a block address (the same as SEntry for free blocks) by a pointer in it.
+ * Get a block address (the same as SEntry64 for free blocks) by a pointer in
+ * it. The stack entries must be aligned, so the first block starts at
+ * LFS64_ALIGN after the extent header instead of right after it.
  */
 static uint64_t
 tdb_blk_addr(TdbExt *e, uint64_t addr)
 {
 	uint64_t a = addr & TDB_BLK_MASK;
 
-	if (unlikely((TdbExt *)a < e + 1))
-		return (uint64_t)(e + 1);
+	if (unlikely(a < (uint64_t)e + LFS64_ALIGN))
+		return (uint64_t)e + LFS64_ALIGN;
 
 	return a;
 }
@@ -152,29 +151,33 @@ tdb_blk_addr(TdbExt *e, uint64_t addr)
 /**
  * A pointer to the header of a block, containing the address.
  */
-static SEntry *
+static SEntry64 *
 tdb_blk_ptr(TdbExt *e, uint64_t addr)
 {
-	return (SEntry *)tdb_blk_addr(e, addr);
+	return (SEntry64 *)tdb_blk_addr(e, addr);
 }
 
 /**
- * Byte offset of the block, containing the address, within an extent.
+ * @return the number of blocks in extent @e.
  */
 static int
-tdb_blk_ext_off(TdbExt *e, uint64_t addr)
+ext_blk_n(TdbAlloc *a, TdbExt *e)
 {
-	return tdb_blk_addr(e, addr) & ~TDB_EXT_MASK;
+	return (TDB_EXT_SZ - TDB_BLK_ALIGN(ext_id_by_ext(a, e)
+					   ? 0 : a->hdr_reserved))
+	       / TDB_BLK_SZ;
 }
 
 static void
 ext_init(TdbAlloc *a, TdbExt *e)
 {
 	int o, e_off = ext_id_by_ext(a, e) ? 0 : a->hdr_reserved;
-	SEntry *blk;
+	SEntry64 *blk;
 
-	lfs_entry_init(&e->stack);
-	lfs_init(&e->blk_free);
+	BUILD_BUG_ON(sizeof(TdbExt) > LFS64_ALIGN);
+
+	lfs64_entry_init(&e->stack);
+	lfs64_init(&e->blk_free);
 
 	/*
 	 * Push all available blocks to the extent stack, in the reverse order
@@ -190,11 +193,12 @@ ext_init(TdbAlloc *a, TdbExt *e)
 		uint64_t any_blk_addr = (uint64_t)e + o + 1;
 		blk = tdb_blk_ptr(e, any_blk_addr);
 		// FIXME Do we have to use atomic stack push?
-		lfs_push(&e->blk_free, blk, o);
+		lfs64_push(&e->blk_free, a, blk);
 	}
 	/* The first block of any extent stores the extent header. */
-	blk = (SEntry *)(e + 1);
-	lfs_push(&e->blk_free, blk, sizeof(*e));
+	blk = tdb_blk_ptr(e, (uint64_t)e);
+	lfs64_push(&e->blk_free, a, blk);
+	atomic_set(&e->blk_free_n, ext_blk_n(a, e));
 }
 
 /**
@@ -202,17 +206,73 @@ ext_init(TdbAlloc *a, TdbExt *e)
  * This routine basically works only on a fresh database and mostly makes sense
  * just to avoid a large database initialization on the system start.
  */
+/*
+ * The allocator grows by 1/TDB_ALLOC_GROW_DIV of its current size, but at
+ * least by one extent, to amortize the cost of mapping new memory.
+ */
+#define TDB_ALLOC_GROW_DIV	8
+
+/**
+ * Make extents up to at least @eid available for the allocator.
+ * Only one CPU maps new memory at a time and the others wait for it, so the
+ * extents allocated by fetch-and-increment are made available in order.
+ * If the growth fails, then the extent IDs above the current maximum are
+ * lost, but the next successful growth makes them available again.
+ */
+static bool
+ext_grow(TdbAlloc *a, uint32_t eid)
+{
+	bool r = false;
+	uint32_t max, n;
+
+	if (!a->grow || eid > a->ext_lim)
+		return false;
+
+	while (atomic_cmpxchg(&a->grow_lock, 0, 1))
+		cpu_relax();
+
+	max = READ_ONCE(a->ext_max);
+	if (eid <= max) {
+		/* Somebody already made the extent available. */
+		r = true;
+		goto out;
+	}
+	n = max + max / TDB_ALLOC_GROW_DIV + 1;
+	if (n < eid)
+		n = eid;
+	if (n > a->ext_lim)
+		n = a->ext_lim;
+
+	if (a->grow((char *)a + TDB_EXT_SZ * (max + 1),
+		    TDB_EXT_SZ * (n - max)))
+	{
+		T_ERR("cannot grow the allocator from %u to %u extents\n",
+		      max + 1, n + 1);
+		goto out;
+	}
+	T_DBG("the allocator grows from %u to %u extents\n", max + 1, n + 1);
+
+	/* Publish the new extents only when they're available. */
+	smp_mb();
+	WRITE_ONCE(a->ext_max, n);
+	r = true;
+out:
+	atomic_set(&a->grow_lock, 0);
+
+	return r;
+}
+
 static TdbExt *
 __ext_alloc_new(TdbAlloc *a)
 {
 	int eid;
 	TdbExt *e;
 
-	if (unlikely(atomic_read(&a->ext_cur) > a->ext_max))
+	if (unlikely(atomic_read(&a->ext_cur) > a->ext_lim))
 		return NULL;
 
 	eid = atomic_fetch_inc(&a->ext_cur);
-	if (unlikely(eid > a->ext_max))
+	if (unlikely(eid > READ_ONCE(a->ext_max)) && !ext_grow(a, eid))
 		return NULL;
 
 	/*
@@ -230,8 +290,8 @@ __ext_alloc_new(TdbAlloc *a)
 /**
  * Allocate an extent.
  * Try to allocate a completely new (free) extent and fallback to an extent with
- * just some free space. Otherwise prefer to reuse extents from the free stack
- * and allocate a new extent only when it's empty.
+ * just some free space. The completely free extents, recycled by
+ * tdb_alloc_compact(), are used before the extents with some free space.
  */
 static TdbExt *
 ext_alloc(TdbAlloc *a)
@@ -245,21 +305,20 @@ ext_alloc(TdbAlloc *a)
 	 * Unlink the extent since it goes as a pure data per-CPU extent or
 	 * to ext_shr for shared block allocations.
 	 */
-	return (TdbExt *)lfs_pop(&a->ext_free, a, TDB_EXT_BITS);
+	if ((e = (TdbExt *)lfs64_pop(&a->ext_empty, a)))
+		return e;
+	return (TdbExt *)lfs64_pop(&a->ext_free, a);
 }
 
 /**
  * Free an extent - push it to the stack of freed extents.
  * The extent might be fully free or just have some free space.
  * In case of high contention it might even not have free space at all.
- *
- * TODO return fully empty extents to a->ext_cur (probably the simple pointer
- * will need to be reworked) to satisfy new extent requests.
  */
 static void
-ext_free(TdbAlloc *a, TdbExt *e, int eid)
+ext_free(TdbAlloc *a, TdbExt *e)
 {
-	lfs_push(&a->ext_free, (SEntry *)e, eid);
+	lfs64_push(&a->ext_free, a, &e->stack);
 }
 
 /**
@@ -287,9 +346,13 @@ tdb_alloc_check_blk_ptr(uint64_t new_val, uint64_t *state, uint64_t blk_f)
 static uint64_t
 ext_alloc_blk(TdbAlloc *a, TdbExt *e)
 {
-	SEntry *blk = lfs_pop(&e->blk_free, e, 0);
+	SEntry64 *blk = lfs64_pop(&e->blk_free, a);
 
-	return blk ? TDB_OFF(a, blk) : 0;
+	if (!blk)
+		return 0;
+	atomic_dec(&e->blk_free_n);
+
+	return TDB_OFF(a, blk);
 }
 
 /**
@@ -363,7 +426,7 @@ alloc_new_extent:
 		 * retry. The extent isn't referenced by the
 		 * allocator, so we're the only user of it.
 		 */
-		ext_free(a, e, new_eid);
+		ext_free(a, e);
 	goto retry;
 
 done:
@@ -479,17 +542,114 @@ void
 tdb_free_blk(TdbAlloc *a, uint64_t addr)
 {
 	TdbExt *e = tdb_ext_ptr(a, addr);
-	SEntry *blk = tdb_blk_ptr(e, addr);
-	int o = tdb_blk_ext_off(e, addr);
-	int eid = ext_id_by_ext(a, e);
+	SEntry64 *blk = tdb_blk_ptr(e, addr);
 
-	if (lfs_push(&e->blk_free, blk, o))
+	atomic_inc(&e->blk_free_n);
+	if (lfs64_push(&e->blk_free, a, blk))
 		/*
 		 * The extent was full and we should move it to free stack now.
 		 * If multiple blocks are freed concurrently on different CPUs,
 		 * then only one goes here.
 		 */
-		ext_free(a, e, eid);
+		ext_free(a, e);
+}
+
+/**
+ * Move the completely free extents from the stack of free extents to the
+ * stack of empty extents, so they're reused as new extents, e.g. for per-CPU
+ * data, before the extents with some free space.
+ *
+ * The pass is lock-free and can run concurrently with allocations: an extent
+ * in the free stack can be still used as current for some CPU, so the empty
+ * extents are just a hint for the extents allocation.
+ *
+ * @return the number of the moved extents.
+ */
+int
+tdb_alloc_compact(TdbAlloc *a)
+{
+	int n = 0;
+	uint64_t part = LFS64_NIL;
+	TdbExt *e;
+
+	while ((e = (TdbExt *)lfs64_pop(&a->ext_free, a))) {
+		if (atomic_read(&e->blk_free_n) == ext_blk_n(a, e)) {
+			lfs64_push(&a->ext_empty, a, &e->stack);
+			++n;
+			continue;
+		}
+		/* Keep the popped extents out of the stack until the end. */
+		e->stack.next = part;
+		part = TDB_OFF(a, e);
+	}
+	while (part != LFS64_NIL) {
+		e = TDB_PTR(a, part);
+		part = e->stack.next;
+		ext_free(a, e);
+	}
+
+	T_DBG("%d empty extents are recycled\n", n);
+
+	return n;
+}
+
+/**
+ * @return the number of extents in the extents stack @s or @max if the stack
+ * is longer, i.e. it's broken. The links out of the allocator area are counted
+ * in @u->bad.
+ */
+static uint32_t
+ext_stack_len(TdbAlloc *a, LfStack64 *s, uint32_t max, TdbAllocUsage *u)
+{
+	uint32_t n = 0;
+	uint64_t o = atomic64_read(&s->head) & ~LFS64_GEN_MASK;
+
+	for ( ; o != LFS64_NIL && n < max; ++n) {
+		if (o >= (uint64_t)max * TDB_EXT_SZ) {
+			++u->bad;
+			break;
+		}
+		o = READ_ONCE(((TdbExt *)TDB_PTR(a, o))->stack.next);
+	}
+
+	return n;
+}
+
+/**
+ * Collect the extents and blocks utilization of the allocator to @u.
+ *
+ * Only the extent headers and the extents stacks are read, so the allocator
+ * can be in any state, e.g. it's a database image after a crash. The extent
+ * headers are read without synchronization, so the numbers are approximate
+ * under concurrent allocations.
+ */
+void
+tdb_alloc_usage(TdbAlloc *a, TdbAllocUsage *u)
+{
+	uint32_t eid;
+
+	memset(u, 0, sizeof(*u));
+	u->ext_n = READ_ONCE(a->ext_max) + 1;
+	/* @ext_cur overruns the limit on failed extent allocations. */
+	u->ext_used = atomic_read(&a->ext_cur);
+	if (u->ext_used > u->ext_n)
+		u->ext_used = u->ext_n;
+
+	for (eid = 0; eid < u->ext_used; ++eid) {
+		TdbExt *e = ext_by_id(a, eid);
+		int n = ext_blk_n(a, e), free = atomic_read(&e->blk_free_n);
+
+		if (free < 0 || free > n) {
+			++u->bad;
+			free = n;
+		}
+		u->blk_n += n;
+		u->blk_free += free;
+		++u->usage[(n - free) * (TDB_ALLOC_USAGE_N - 1) / n];
+	}
+
+	u->ext_free = ext_stack_len(a, &a->ext_free, u->ext_n, u);
+	u->ext_empty = ext_stack_len(a, &a->ext_empty, u->ext_n, u);
 }
 
 /**
@@ -506,11 +666,37 @@ tdb_alloc_init(TdbAlloc *a, size_t hdr_sz, size_t db_sz)
 
 	a->hdr_reserved = hdr_sz;
 	a->ext_max = (db_sz >> TDB_EXT_BITS) - 1;
+	a->ext_lim = a->ext_max;
 
 	/* Set the first extent containing the database header as shared. */
 	atomic_set(&a->ext_shr, 0);
 	atomic_set(&a->ext_cur, 1);
-	lfs_init(&a->ext_free);
+	lfs64_init(&a->ext_free);
+	lfs64_init(&a->ext_empty);
+	atomic_set(&a->grow_lock, 0);
+	a->grow = NULL;
 
 	ext_init(a, ext_by_id(a, 0));
 }
+
+/**
+ * Let the allocator grow up to @max_sz bytes calling @grow to make new memory
+ * available. The whole address space up to @max_sz must be reserved by the
+ * caller. The hard limit is kept in the database, while @grow must be set
+ * each time the database is opened, the allocator doesn't grow without it.
+ */
+int
+tdb_alloc_set_grow(TdbAlloc *a, size_t max_sz,
+		   int (*grow)(void *addr, size_t len))
+{
+	if (!max_sz || (max_sz & ~TDB_EXT_MASK)
+	    || (max_sz >> TDB_EXT_BITS) - 1 < a->ext_max)
+		return -EINVAL;
+
+	/* There could be a stale lock if the database wasn't closed. */
+	atomic_set(&a->grow_lock, 0);
+	a->ext_lim = (max_sz >> TDB_EXT_BITS) - 1;
+	a->grow = grow;
+
+	return 0;
+}
@@ -45,6 +45,8 @@
 #define TDB_ALLOC_F_NEED_BBLK	0x02
 #define TDB_ALLOC_F_NEED_DBLK	0x04
 #define TDB_ALLOC_F_NEED_EXT	0x08
+/* A new block of slab size class @c is need on the next allocation. */
+#define TDB_ALLOC_F_NEED_SBLK(c)	(0x10UL << (c))
 
 /**
  * The global allocator control block.
@@ -53,38 +55,84 @@
  *
  * @hdr_reserved - bytes reserved in the first extent for the database headers
  * @ext_max	- maximim ID of extents available for the allocator
+ * @ext_lim	- maximum ID of extents, to which the allocator can grow
  * @ext_shr	- current extent ID, used by all CPUs for small allocations
  * @ext_cur	- current extent ID, used for new extents allocations
- * @ext_free	- stack of free extents, keeps extent IDs.
+ * @ext_free	- stack of free extents, keeps extent offsets.
  *		  If an extent has at least one free block and it's not current,
  *		  then it should be in the stack.
+ * @ext_empty	- stack of completely free extents, moved from @ext_free by
+ *		  tdb_alloc_compact()
+ * @grow_lock	- serializes the allocator growth
+ * @grow	- callback to make the area of @len bytes at address @addr
+ *		  available for the allocator, set in runtime
  */
 typedef struct {
 	uint32_t		hdr_reserved;
 	uint32_t		ext_max;
+	uint32_t		ext_lim;
 	atomic_t		ext_shr;
 	atomic_t		ext_cur;
-	LfStack			ext_free;
+	LfStack64		ext_free;
+	LfStack64		ext_empty;
+	atomic_t		grow_lock;
+	int			(*grow)(void *addr, size_t len);
 } __attribute__((packed)) TdbAlloc;
 
 /**
  * Tempesta DB extent descriptor.
  *
  * @stack	- stack node to link with all free extents
- * @blk_free	- stack of free blocks, keeps byte offsets inside an extent
+ * @blk_free	- stack of free blocks, keeps the blocks offsets in the database
+ * @blk_free_n	- number of the blocks in @blk_free
  */
 typedef struct {
-	SEntry			stack;
-	LfStack			blk_free;
+	SEntry64		stack;
+	LfStack64		blk_free;
+	atomic_t		blk_free_n;
 } __attribute__((packed)) TdbExt;
 
+/*
+ * The number of extents utilization classes: each class is 10% of the used
+ * blocks and the last one is for the completely used extents.
+ */
+#define TDB_ALLOC_USAGE_N	11
+
+/**
+ * Extents and blocks utilization, see tdb_alloc_usage().
+ *
+ * @ext_n	- number of extents available for the allocator
+ * @ext_used	- number of extents, which were ever used
+ * @ext_free	- number of extents in the free extents stack
+ * @ext_empty	- number of extents in the completely free extents stack
+ * @blk_n	- number of blocks in the used extents
+ * @blk_free	- number of free blocks in the used extents
+ * @usage	- number of used extents in each utilization class
+ * @bad		- number of broken extent headers and stack links
+ */
+typedef struct {
+	uint32_t		ext_n;
+	uint32_t		ext_used;
+	uint32_t		ext_free;
+	uint32_t		ext_empty;
+	uint64_t		blk_n;
+	uint64_t		blk_free;
+	uint32_t		usage[TDB_ALLOC_USAGE_N];
+	uint32_t		bad;
+} TdbAllocUsage;
+
 uint64_t tdb_alloc_data(TdbAlloc *a, size_t overhead, size_t *len, uint64_t *state,
 			uint64_t *alloc_ptr, uint32_t align, bool large_alloc);
 uint64_t __tdb_alloc_fix(TdbAlloc *a, size_t n, uint64_t *alloc_ptr,
 			 uint64_t *state, uint64_t blk_f);
-uint64_t tdb_alloc_blk(TdbAlloc *a, int eid, bool new_ext, uint64_t *state);
-void tdb_free_blk(TdbAlloc *a, uint64_t addr);
+EXTERN_C uint64_t tdb_alloc_blk(TdbAlloc *a, int eid, bool new_ext,
+				uint64_t *state);
+EXTERN_C void tdb_free_blk(TdbAlloc *a, uint64_t addr);
 void tdb_alloc_init(TdbAlloc *a, size_t hdr_sz, size_t db_sz);
+int tdb_alloc_compact(TdbAlloc *a);
+void tdb_alloc_usage(TdbAlloc *a, TdbAllocUsage *u);
+int tdb_alloc_set_grow(TdbAlloc *a, size_t max_sz,
+		       int (*grow)(void *addr, size_t len));
 
 static inline uint64_t
 tdb_alloc_bckt(TdbAlloc *a, size_t n, uint64_t *alloc_ptr, uint64_t *state)
@@ -92,6 +140,13 @@ tdb_alloc_bckt(TdbAlloc *a, size_t n, uint64_t *alloc_ptr, uint64_t *state)
 	return __tdb_alloc_fix(a, n, alloc_ptr, state, TDB_ALLOC_F_NEED_BBLK);
 }
 
+static inline uint64_t
+tdb_alloc_slab(TdbAlloc *a, int c, size_t n, uint64_t *alloc_ptr,
+	       uint64_t *state)
+{
+	return __tdb_alloc_fix(a, n, alloc_ptr, state, TDB_ALLOC_F_NEED_SBLK(c));
+}
+
 static inline uint64_t
 tdb_alloc_idx(TdbAlloc *a, size_t n, uint64_t *alloc_ptr, uint64_t *state)
 {
@@ -18,44 +18,75 @@
  * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  *
  * TODO:
- * ?- use case: read intensive, less inserts, even less deletions (80/15/5?)
- * -- benchmark collisions for URLs and different values of TDB_HTRIE_BURST_MIN_BITS
- * -- implement and benchmark IP addresses/masks (#1350)
+ * ++ use case: read intensive, less inserts, even less deletions (80/15/5?)
+ * -- benchmark collisions for URLs
+ * ++ implement and benchmark IP addresses/masks (#1350)
  * -- observe and benchmark better hash functions and HOPE
- * -- latency results (rdtsc?)
- * -- measure hash tables rehashing
+ * ++ latency results (rdtsc?)
+ * ++ measure hash tables rehashing
  * -- other data structures
- *    -- ebtree(good update, bad lookup) & plock
- *    -- boost::concurrent_flat_map
+ *    ++ ebtree(good update, bad lookup) & plock
+ *       (the big RW lock is used instead of plock)
+ *    ++ boost::concurrent_flat_map
  *       https://bannalia.blogspot.com/2023/07/inside-boostconcurrentflatmap.html
- *    ?- Split-Ordered Lists: Lock-Free Extensible Hash Tables
- *       tbb::interface5::internal::split_ordered_list
+ *    ++ Split-Ordered Lists: Lock-Free Extensible Hash Tables
+ *       tbb::concurrent_unordered_map is the split-ordered list
+ *    ++ tbb::concurrent_hash_map
  *    ++ Intel TBB (allocator, ...)
- *    ?- YCSB
+ *    ++ YCSB
  * -- profile on Epyc and Xeon
  */
 #include <assert.h>
 #include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <fstream>
 #include <functional>
 #include <iostream>
 #include <iomanip>
 #include <map>
 #include <mutex>
 #include <numeric>
+#include <random>
+#include <string>
 #include <thread>
 #include <type_traits>
 #include <vector>
 
+#include <tbb/concurrent_hash_map.h>
 #include <tbb/concurrent_unordered_map.h>
+#include <x86intrin.h>
 
+#if __has_include(<boost/unordered/concurrent_flat_map.hpp>)
+#define HAVE_BOOST_CFM	1
+#include <boost/unordered/concurrent_flat_map.hpp>
+#endif
+
+#include "../bench.h"
 #include "hashfn.h"
 #include "htrie.h"
 #include "mapfile.h"
 
+// ebtree uses 'new' as an identifier and void pointers arithmetic.
+// Empty unions have non-zero size in C++, so use empty arrays for the
+// alignment to keep the C layout of the nodes.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpointer-arith"
+#define new		new_
+#define ALWAYS_ALIGN(x)	char __align[0] __attribute__((aligned(x)))
+extern "C" {
+#include "ebmbtree.h"
+}
+#undef new
+#pragma GCC diagnostic pop
+
 struct Key {
 	static const size_t SIZE = 20; // sizeof(BufferTag)
 	char k_[SIZE];
@@ -140,6 +171,260 @@ struct ADT {
 	virtual const char *name() const =0;
 	virtual void insert(const Key &key, const Entry *entry) =0;
 	virtual const Entry *lookup(const Key &key) =0;
+	// Replace the entry for @key if it exists or insert it.
+	virtual void update(const Key &key, const Entry *entry) =0;
+	virtual void remove(const Key &key) =0;
+
+	// Lookup @n keys at once, just one by one by default.
+	virtual void
+	lookup_batch(const Key *keys, size_t n, const Entry **out)
+	{
+		for (auto i = 0; i < n; ++i)
+			out[i] = lookup(keys[i]);
+	}
+
+	// Return the free memory to the allocator and get the number of
+	// the reclaimed bytes or -1 if the data structure can't do this.
+	virtual ssize_t
+	compact()
+	{
+		return -1;
+	}
+};
+
+/**
+ * Run @workload in all the threads and store the threads running times
+ * in @dur. If BENCH_PERF is set, count the hardware events of each thread
+ * and report their sum per operation for @name doing @ops operations in
+ * each thread.
+ */
+static void
+exec_threads(std::function<void(int)> workload,
+	     std::array<unsigned int, TEST_THREADS_N> &dur,
+	     const std::string &name, unsigned long ops)
+{
+	using namespace std::chrono;
+
+	std::mutex io_mtx;
+	struct bench_perf perf;
+
+	bench_perf_init(&perf);
+	{
+		std::vector<std::jthread> thrs;
+
+		for (auto i = 0; i < TEST_THREADS_N; ++i)
+			thrs.emplace_back(std::jthread([&, i]() {
+				struct bench_perf p;
+
+				// Set thread ID for percpu interfaces.
+				__thr_set_cpuid();
+
+				bench_perf_open(&p, 0);
+				bench_perf_start(&p);
+				// steady_clock has the same resolution as
+				// high_resolution_clock
+				auto t(steady_clock::now());
+
+				workload(i);
+
+				auto d = steady_clock::now() - t;
+				bench_perf_stop(&p);
+				bench_perf_close(&p);
+				bench_perf_add(&perf, &p);
+
+				std::lock_guard<std::mutex> _(io_mtx);
+				dur[i] = duration_cast<milliseconds>(d).count();
+				std::cout << std::setw(2) << i  << "/" << dur[i]
+					  << "ms ";
+			}));
+	}
+	if (bench_perf_valid(&perf)) {
+		std::cout << std::endl;
+		bench_report(name.c_str(), ops * TEST_THREADS_N, NULL, 0, &perf);
+	}
+}
+
+/**
+ * HDR-like histogram of latencies in TSC cycles. The values are grouped by
+ * the most significant bit and each group is split into linear buckets, so
+ * the relative error of a value is not larger than 1/2^(SUB_BITS - 1) for
+ * the whole range of 64-bit values.
+ */
+class LatHist {
+private:
+	static const unsigned int SUB_BITS = 7;
+	static const unsigned int SUB = 1U << SUB_BITS;
+	static const unsigned int HALF = SUB / 2;
+	static const size_t SIZE = (64 - SUB_BITS + 2) * HALF;
+
+	std::vector<uint64_t>	cnt_;
+	uint64_t		n_;
+	uint64_t		max_;
+
+	static unsigned int
+	idx(uint64_t v)
+	{
+		unsigned int shift;
+
+		if (v < SUB)
+			return v;
+		shift = 64 - SUB_BITS - __builtin_clzl(v);
+
+		return shift * HALF + (v >> shift);
+	}
+
+	// @return the highest value equivalent to the values in the bucket @i.
+	static uint64_t
+	value(unsigned int i)
+	{
+		unsigned int shift;
+
+		if (i < SUB)
+			return i;
+		shift = i / HALF - 1;
+
+		return ((uint64_t)(i % HALF + HALF + 1) << shift) - 1;
+	}
+
+public:
+	LatHist()
+		: cnt_(SIZE), n_(0), max_(0)
+	{}
+
+	void
+	record(uint64_t v)
+	{
+		++cnt_[idx(v)];
+		++n_;
+		max_ = std::max(max_, v);
+	}
+
+	LatHist &
+	operator+=(const LatHist &h)
+	{
+		for (auto i = 0; i < SIZE; ++i)
+			cnt_[i] += h.cnt_[i];
+		n_ += h.n_;
+		max_ = std::max(max_, h.max_);
+		return *this;
+	}
+
+	uint64_t
+	count() const
+	{
+		return n_;
+	}
+
+	uint64_t
+	percentile(double p) const
+	{
+		uint64_t sum = 0, rank = std::ceil(n_ * p / 100);
+
+		for (auto i = 0; i < SIZE; ++i)
+			if ((sum += cnt_[i]) >= std::max<uint64_t>(rank, 1))
+				return std::min(value(i), max_);
+		return max_;
+	}
+
+	// Print the percentiles distribution of non-empty buckets for plotting.
+	void
+	csv(std::ostream &os, const char *adt, const char *op) const
+	{
+		uint64_t sum = 0;
+
+		for (auto i = 0; i < SIZE; ++i) {
+			if (!cnt_[i])
+				continue;
+			sum += cnt_[i];
+			os << '"' << adt << "\"," << op << ","
+			   << std::min(value(i), max_) << "," << cnt_[i] << ","
+			   << std::fixed << std::setprecision(6)
+			   << (double)sum / n_ << std::defaultfloat << "\n";
+		}
+	}
+};
+
+/**
+ * Latencies of the benchmark operations. Each thread records the latencies
+ * to its own histograms, so there is no contention, and the histograms are
+ * merged for the report when all the threads finished.
+ */
+class Latency {
+private:
+	std::vector<const char *>	ops_;
+	std::vector<LatHist>		hist_;
+
+public:
+	// Record the latencies, disabled by default to not affect throughput.
+	static inline bool		enabled = false;
+	// Percentiles distributions of all the benchmarks for plotting.
+	static inline std::ofstream	csv;
+
+	Latency(std::initializer_list<const char *> ops)
+		: ops_(ops)
+	{
+		if (enabled)
+			hist_.resize(ops_.size() * TEST_THREADS_N);
+	}
+
+	/**
+	 * Call @f and record its latency as the operation @op of the thread
+	 * @thr_id.
+	 * @return the latency or zero if the latencies aren't recorded.
+	 */
+	template<typename F>
+	uint64_t
+	measure(int thr_id, int op, F &&f)
+	{
+		if (!enabled) {
+			f();
+			return 0;
+		}
+
+		uint64_t t = __rdtsc();
+		f();
+		t = __rdtsc() - t;
+		hist_[thr_id * ops_.size() + op].record(t);
+
+		return t;
+	}
+
+	void
+	report(const char *adt) const
+	{
+		static const double PCT[] = { 50, 90, 99, 99.9, 99.99 };
+		static const char *PCT_NAME[] = {
+			"p50", "p90", "p99", "p99.9", "p99.99"
+		};
+
+		if (!enabled)
+			return;
+
+		std::cout << "  latency (TSC cycles):" << std::setw(14) << "n";
+		for (auto p : PCT_NAME)
+			std::cout << std::setw(9) << p;
+		std::cout << std::setw(10) << "max" << std::endl;
+
+		for (auto op = 0; op < ops_.size(); ++op) {
+			LatHist h;
+
+			for (auto t = 0; t < TEST_THREADS_N; ++t)
+				h += hist_[t * ops_.size() + op];
+			if (!h.count())
+				continue;
+
+			std::cout << "    " << std::left << std::setw(20)
+				  << ops_[op] << std::right << std::setw(13)
+				  << h.count();
+			for (auto p : PCT)
+				std::cout << std::setw(9) << h.percentile(p);
+			std::cout << std::setw(10) << h.percentile(100)
+				  << std::endl;
+
+			if (csv.is_open())
+				h.csv(csv, adt, ops_[op]);
+		}
+	}
 };
 
 class Benchmark {
@@ -149,21 +434,30 @@ private:
 	static const size_t WRITE = 1;
 	static const size_t READ = 4;
 	static const size_t KEY_STEP = ULONG_MAX / N;
+	static const size_t BATCH = TEST_THREADS_N * READ;
+
+	enum { INSERT, LOOKUP, LOOKUP_BATCH };
 
 	ADT &adt_;
 	Entry entries_[TEST_THREADS_N];
+	// Do all the reads of a workload iteration in one batch.
+	bool batch_;
+	Latency lat_;
 
 private:
 	int
 	workload(int thr_id)
 	{
 		int i;
-		Key k;
+		Key k, keys[BATCH];
+		const Entry *out[BATCH];
 
 		for (i = 0; i < N; ++i) {
 			for (auto w = 0; w < WRITE; ++w) {
 				k = i * KEY_STEP + thr_id * WRITE + w;
-				adt_.insert(k, &entries_[thr_id]);
+				lat_.measure(thr_id, INSERT, [&]() {
+					adt_.insert(k, &entries_[thr_id]);
+				});
 			}
 			for (auto t = 0; t < TEST_THREADS_N; ++t)
 				for (auto r = 0; r < READ; ++r) {
@@ -172,8 +466,18 @@ private:
 					// all other threads.
 					k = i / READ * (r + 1) * KEY_STEP
 					    + t * r;
-					adt_.lookup(k);
+					if (batch_) {
+						keys[t * READ + r] = k;
+						continue;
+					}
+					lat_.measure(thr_id, LOOKUP, [&]() {
+						adt_.lookup(k);
+					});
 				}
+			if (batch_)
+				lat_.measure(thr_id, LOOKUP_BATCH, [&]() {
+					adt_.lookup_batch(keys, BATCH, out);
+				});
 		}
 
 		return i;
@@ -211,41 +515,224 @@ private:
 		assert(_g && _g->a[0] == 'g');
 	}
 
+public:
+	Benchmark(ADT &&adt, bool batch = false)
+		: adt_(adt), batch_(batch),
+		  lat_({ "insert", "lookup", "lookup batch" })
+	{
+		for (auto i = 0; i < TEST_THREADS_N; ++i)
+			// Avoid zero values for easy debugging.
+			entries_[i] = Entry(0x5555555555555555UL,
+					    (char)((i + 1) & 0x7f));
+	}
+
 	void
-	exec_threads(std::array<unsigned int, TEST_THREADS_N> &dur)
+	run()
 	{
-		using namespace std::chrono;
+		std::array<unsigned int, TEST_THREADS_N> dur;
 
-		std::mutex io_mtx;
-		std::vector<std::jthread> thrs;
+		std::cout << "\n" << adt_.name()
+			  << (batch_ ? " (batched lookups)" : "") << ":"
+			  << std::endl;
 
-		for (auto i = 0; i < TEST_THREADS_N; ++i)
-			thrs.emplace_back(std::jthread([this, i, &dur, &io_mtx]() {
-				// Set thread ID for percpu interfaces.
-				__thr_set_cpuid();
+		test();
 
-				// steady_clock has the same resolution as
-				// high_resolution_clock
-				auto t(steady_clock::now());
+		std::cout << "threads statistics: ";
+		exec_threads([this](int thr_id) { workload(thr_id); }, dur,
+			     adt_.name(), N * (WRITE + TEST_THREADS_N * READ));
+		std::cout << std::endl;
 
-				auto iters = workload(i);
+		std::cout << "  AVG: "
+			  << std::accumulate(dur.begin(), dur.end(), 0) / TEST_THREADS_N
+			  << "ms" << std::endl;
+		lat_.report(adt_.name());
+	}
+};
 
-				auto d = steady_clock::now() - t;
+/**
+ * YCSB-like workload: the operations mix in percents and the keys
+ * distribution. The ADTs don't support range scans, so a scan is a batched
+ * lookup of the keys following each other in the insertion order.
+ */
+struct Workload {
+	enum Dist {
+		UNIFORM,
+		ZIPF,
+		// Zipfian distribution of the most recently inserted keys.
+		LATEST,
+	};
 
-				std::lock_guard<std::mutex> _(io_mtx);
-				dur[i] = duration_cast<milliseconds>(d).count();
-				std::cout << std::setw(2) << i  << "/" << dur[i] << "ms ";
-			}));
+	char		id;
+	const char	*name;
+	unsigned int	read;
+	unsigned int	update;
+	unsigned int	insert;
+	unsigned int	remove;
+	unsigned int	rmw; // read-modify-write
+	unsigned int	scan;
+	Dist		dist;
+};
+
+static const Workload YCSB[] = {
+	{'A', "YCSB A (update heavy)",	    50, 50, 0, 0, 0, 0, Workload::ZIPF},
+	{'B', "YCSB B (read mostly)",	    95, 5, 0, 0, 0, 0, Workload::ZIPF},
+	{'C', "YCSB C (read only)",	    100, 0, 0, 0, 0, 0, Workload::ZIPF},
+	{'D', "YCSB D (read latest)",	    95, 0, 5, 0, 0, 0, Workload::LATEST},
+	{'E', "YCSB E (short ranges)",	    0, 0, 5, 0, 0, 95, Workload::ZIPF},
+	{'F', "YCSB F (read-modify-write)", 50, 0, 0, 0, 50, 0, Workload::ZIPF},
+	// Read intensive, less inserts, even less deletions.
+	{'R', "read intensive",		    80, 0, 15, 5, 0, 0, Workload::UNIFORM},
+};
+
+/**
+ * Zipfian distribution of @n items from "Quickly Generating Billion-Record
+ * Synthetic Databases" by J.Gray et al., the same as YCSB uses.
+ */
+class Zipf {
+private:
+	uint64_t	n_;
+	double		theta_;
+	double		alpha_;
+	double		zetan_;
+	double		eta_;
+
+	static double
+	zeta(uint64_t n, double theta)
+	{
+		double sum = 0;
+
+		for (uint64_t i = 1; i <= n; ++i)
+			sum += 1 / std::pow(i, theta);
+		return sum;
 	}
 
 public:
-	Benchmark(ADT &&adt)
-		: adt_(adt)
+	Zipf(uint64_t n, double theta = 0.99)
+		: n_(n), theta_(theta), alpha_(1 / (1 - theta)),
+		  zetan_(zeta(n, theta))
 	{
-		for (auto i = 0; i < TEST_THREADS_N; ++i)
-			// Avoid zero values for easy debugging.
-			entries_[i] = Entry(0x5555555555555555UL,
-					    (char)((i + 1) & 0x7f));
+		eta_ = (1 - std::pow(2.0 / n, 1 - theta))
+		       / (1 - zeta(2, theta) / zetan_);
+	}
+
+	// @return the item rank, the smaller ranks are the more popular.
+	uint64_t
+	operator()(std::mt19937_64 &rng) const
+	{
+		double u = std::uniform_real_distribution<>(0, 1)(rng);
+		double uz = u * zetan_;
+
+		if (uz < 1)
+			return 0;
+		if (uz < 1 + std::pow(0.5, theta_))
+			return 1;
+		return std::min<uint64_t>(n_ - 1, n_ * std::pow(eta_ * u - eta_ + 1,
+								alpha_));
+	}
+};
+
+class YcsbBenchmark {
+private:
+	// Keep the number of records small enough for the Radix tree.
+	static const size_t RECORDS = 10000;
+	static const size_t OPS = 40000;
+	static const size_t SCAN_MAX = 100;
+
+	enum { READ, UPDATE, INSERT, REMOVE, RMW, SCAN };
+
+	ADT &adt_;
+	const Workload &wl_;
+	Zipf zipf_;
+	Latency lat_;
+	// The keys are inserted in order, so this is the next key to insert.
+	std::atomic<size_t> keys_n_;
+
+	static Key
+	key(size_t i)
+	{
+		// Spread the keys inserted in order over the key space.
+		return Key(i * 0x9e3779b97f4a7c15UL);
+	}
+
+	size_t
+	next_key(std::mt19937_64 &rng)
+	{
+		size_t n = keys_n_.load(std::memory_order_relaxed);
+		uint64_t r;
+
+		switch (wl_.dist) {
+		case Workload::UNIFORM:
+			return std::uniform_int_distribution<size_t>(0, n - 1)(rng);
+		case Workload::ZIPF:
+			// Scatter the popular keys over all the inserted keys.
+			r = zipf_(rng);
+			return tdb_hash_calc((const char *)&r, sizeof(r)) % n;
+		case Workload::LATEST:
+			return n - 1 - std::min<size_t>(zipf_(rng), n - 1);
+		}
+		return 0;
+	}
+
+	void
+	workload(int thr_id)
+	{
+		std::mt19937_64 rng(thr_id);
+		std::uniform_int_distribution<unsigned int> op_rnd(0, 99);
+		std::uniform_int_distribution<size_t> scan_rnd(1, SCAN_MAX);
+		// Avoid zero values for easy debugging.
+		const char val = (thr_id + 1) & 0x7f;
+		const Entry *out[SCAN_MAX];
+		Key keys[SCAN_MAX];
+
+		for (auto i = 0; i < OPS; ++i) {
+			unsigned int op = op_rnd(rng);
+
+			if (op < wl_.read) {
+				Key k = key(next_key(rng));
+				lat_.measure(thr_id, READ, [&]() {
+					adt_.lookup(k);
+				});
+			} else if ((op -= wl_.read) < wl_.update) {
+				Entry e(key(next_key(rng)), val);
+				lat_.measure(thr_id, UPDATE, [&]() {
+					adt_.update(e.key, &e);
+				});
+			} else if ((op -= wl_.update) < wl_.insert) {
+				Entry e(key(keys_n_++), val);
+				lat_.measure(thr_id, INSERT, [&]() {
+					adt_.insert(e.key, &e);
+				});
+			} else if ((op -= wl_.insert) < wl_.remove) {
+				Key k = key(next_key(rng));
+				lat_.measure(thr_id, REMOVE, [&]() {
+					adt_.remove(k);
+				});
+			} else if ((op -= wl_.remove) < wl_.rmw) {
+				Entry e(key(next_key(rng)), val);
+				lat_.measure(thr_id, RMW, [&]() {
+					adt_.lookup(e.key);
+					adt_.update(e.key, &e);
+				});
+			} else {
+				size_t n = scan_rnd(rng), k = next_key(rng);
+				for (auto j = 0; j < n; ++j)
+					keys[j] = key(k + j);
+				lat_.measure(thr_id, SCAN, [&]() {
+					adt_.lookup_batch(keys, n, out);
+				});
+			}
+		}
+	}
+
+public:
+	YcsbBenchmark(ADT &&adt, const Workload &wl)
+		: adt_(adt), wl_(wl), zipf_(RECORDS),
+		  lat_({ "read", "update", "insert", "remove",
+			 "read-modify-write", "scan" }),
+		  keys_n_(0)
+	{
+		assert(wl.read + wl.update + wl.insert + wl.remove + wl.rmw
+		       + wl.scan == 100);
 	}
 
 	void
@@ -253,17 +740,105 @@ public:
 	{
 		std::array<unsigned int, TEST_THREADS_N> dur;
 
-		std::cout << "\n" << adt_.name() << ":" << std::endl;
+		std::cout << "\n" << adt_.name() << " (" << wl_.name << "):"
+			  << std::endl;
 
-		test();
+		// Load the records in one thread.
+		__thr_set_cpuid();
+		for ( ; keys_n_ < RECORDS; ++keys_n_) {
+			Entry e(key(keys_n_), 'a');
+			adt_.insert(e.key, &e);
+		}
+		__thr_reset_cpuids();
+
+		std::cout << "threads statistics: ";
+		exec_threads([this](int thr_id) { workload(thr_id); }, dur,
+			     std::string(adt_.name()) + " " + wl_.name, OPS);
+		std::cout << std::endl;
+
+		auto avg = std::accumulate(dur.begin(), dur.end(), 0)
+			   / TEST_THREADS_N;
+		std::cout << "  AVG: " << avg << "ms, "
+			  << OPS * TEST_THREADS_N / std::max(avg, 1)
+			  << " ops/ms" << std::endl;
+		lat_.report(adt_.name());
+
+		// Measure the space reclaimed after the removals.
+		ssize_t reclaimed = adt_.compact();
+		if (reclaimed >= 0)
+			std::cout << "  compaction reclaimed: "
+				  << reclaimed / 1024 << "KB" << std::endl;
+	}
+};
+
+/**
+ * Grow a table from the small initial size by inserts of new keys only and
+ * record the worst insert latency for each power of 2 of the keys number,
+ * i.e. for each table doubling. Hash tables rehash the whole table or its
+ * large parts on growth, while HTrie bursts only one bucket.
+ */
+class GrowthBenchmark {
+private:
+	static const size_t N = 1 << 20;
+	static const unsigned int WIN_N = 64;
+
+	ADT &adt_;
+	Latency lat_;
+	std::vector<std::array<uint64_t, WIN_N>> worst_;
+
+	void
+	workload(int thr_id)
+	{
+		// Avoid zero values for easy debugging.
+		const char val = (thr_id + 1) & 0x7f;
+
+		for (size_t i = 0; i < N / TEST_THREADS_N; ++i) {
+			size_t n = i * TEST_THREADS_N + thr_id;
+			Entry e(Key(n * 0x9e3779b97f4a7c15UL), val);
+			uint64_t t;
+
+			t = lat_.measure(thr_id, 0, [&]() {
+				adt_.insert(e.key, &e);
+			});
+
+			auto &w = worst_[thr_id][63 - __builtin_clzl(n + 1)];
+			w = std::max(w, t);
+		}
+	}
+
+public:
+	GrowthBenchmark(ADT &&adt)
+		: adt_(adt), lat_({ "insert" }), worst_(TEST_THREADS_N)
+	{}
+
+	void
+	run()
+	{
+		std::array<unsigned int, TEST_THREADS_N> dur;
+
+		std::cout << "\n" << adt_.name() << " (growth):" << std::endl;
 
 		std::cout << "threads statistics: ";
-		exec_threads(dur);
+		exec_threads([this](int thr_id) { workload(thr_id); }, dur,
+			     std::string(adt_.name()) + " growth",
+			     N / TEST_THREADS_N);
 		std::cout << std::endl;
 
 		std::cout << "  AVG: "
 			  << std::accumulate(dur.begin(), dur.end(), 0) / TEST_THREADS_N
 			  << "ms" << std::endl;
+		lat_.report(adt_.name());
+
+		std::cout << "  worst insert latency (TSC cycles) by keys:"
+			  << std::endl;
+		for (auto w = 0; (1UL << w) <= N; ++w) {
+			uint64_t max = 0;
+
+			for (const auto &t : worst_)
+				max = std::max(max, t[w]);
+			std::cout << "  " << std::setw(10) << (1UL << w)
+				  << std::setw(12) << max << std::endl;
+		}
 	}
 };
 
@@ -303,6 +878,26 @@ public:
 		return (it == map_.end()) ? NULL : &it->second;
 	}
 
+	virtual void
+	update(const Key &key, const Entry *entry)
+	{
+		write_lock(&lock_);
+
+		map_.insert_or_assign(key, Entry(*entry));
+
+		write_unlock(&lock_);
+	}
+
+	virtual void
+	remove(const Key &key)
+	{
+		write_lock(&lock_);
+
+		map_.erase(key);
+
+		write_unlock(&lock_);
+	}
+
 	virtual ~StdMap()
 	{
 		map_.erase(map_.begin(), map_.end());
@@ -317,6 +912,11 @@ private:
 	tbb::concurrent_unordered_map<Key, Entry> map_;
 
 public:
+	// Start from @buckets to measure rehashing.
+	TbbUnorderedMap(size_t buckets = 8)
+		: map_(buckets)
+	{}
+
 	virtual const char *
 	name() const
 	{
@@ -336,7 +936,27 @@ public:
 
 		it = map_.find(key);
 
-		return (it == map_.end()) ? NULL : &it->second;
+		return (it == map_.end() || !it->second.a[0]) ? NULL : &it->second;
+	}
+
+	virtual void
+	update(const Key &key, const Entry *entry)
+	{
+		auto r = map_.emplace(std::make_pair(key, Entry(*entry)));
+		if (!r.second)
+			r.first->second = *entry;
+	}
+
+	// The entries can't be erased concurrently, so just make them empty
+	// as applications do.
+	virtual void
+	remove(const Key &key)
+	{
+		tbb::concurrent_unordered_map<Key, Entry>::iterator it;
+
+		it = map_.find(key);
+		if (it != map_.end())
+			it->second = Entry();
 	}
 
 	virtual ~TbbUnorderedMap()
@@ -347,18 +967,250 @@ public:
 };
 
 /**
- * Dummy Radix/Patricia tree of order 8.
+ * Segmented hash table with per-bucket RW locks, safe for concurrent erasing.
+ * The segments are allocated on growth and the buckets are rehashed lazily
+ * on the next access.
  */
-class Radix : public ADT {
+class TbbHashMap : public ADT {
 private:
-	static const size_t SPAWN = 256;
+	struct HashCompare {
+		static size_t
+		hash(const Key &key)
+		{
+			return key;
+		}
 
-	struct Node {
-		std::array<Node *, SPAWN>	nodes{};
+		static bool
+		equal(const Key &a, const Key &b)
+		{
+			return a == b;
+		}
+	};
+
+	using Map = tbb::concurrent_hash_map<Key, Entry, HashCompare>;
+
+	Map map_;
+
+public:
+	TbbHashMap(size_t buckets = 8)
+		: map_(buckets)
+	{}
+
+	virtual const char *
+	name() const
+	{
+		return "tbb::concurrent_hash_map";
+	}
+
+	virtual void
+	insert(const Key &key, const Entry *entry)
+	{
+		map_.emplace(key, *entry);
+	}
+
+	virtual const Entry *
+	lookup(const Key &key)
+	{
+		Map::const_accessor acc;
+
+		return map_.find(acc, key) ? &acc->second : NULL;
+	}
+
+	virtual void
+	update(const Key &key, const Entry *entry)
+	{
+		Map::accessor acc;
+
+		map_.insert(acc, key);
+		acc->second = *entry;
+	}
+
+	virtual void
+	remove(const Key &key)
+	{
+		map_.erase(key);
+	}
+};
+
+#ifdef HAVE_BOOST_CFM
+/**
+ * Open addressing table with SIMD lookups in groups of 15 slots. Rehashing
+ * locks the whole table.
+ */
+class BoostFlatMap : public ADT {
+private:
+	boost::concurrent_flat_map<Key, Entry, std::hash<Key>> map_;
+
+public:
+	BoostFlatMap(size_t buckets = 8)
+		: map_(buckets)
+	{}
+
+	virtual const char *
+	name() const
+	{
+		return "boost::concurrent_flat_map";
+	}
+
+	virtual void
+	insert(const Key &key, const Entry *entry)
+	{
+		map_.emplace(key, *entry);
+	}
+
+	// The table has no iterators, so copy the entry like real users do.
+	virtual const Entry *
+	lookup(const Key &key)
+	{
+		static thread_local Entry e;
+
+		return map_.cvisit(key, [](const auto &x) { e = x.second; })
+		       ? &e : NULL;
+	}
+
+	virtual void
+	update(const Key &key, const Entry *entry)
+	{
+		map_.insert_or_assign(key, *entry);
+	}
+
+	virtual void
+	remove(const Key &key)
+	{
+		map_.erase(key);
+	}
+};
+#endif
+
+/**
+ * Elastic binary tree with big RW lock: the tree has cheap updates, but the
+ * lookups are slow for the long keys.
+ */
+class EbTree : public ADT {
+private:
+	struct Node {
+		struct ebmb_node	node;
+		// The key is the first member of the entry.
+		Entry			e;
+	};
+
+	static_assert(offsetof(Node, e) == offsetof(Node, node.key));
+	static_assert(offsetof(struct ebmb_node, key)
+		      == (sizeof(struct eb_node) + 7) / 8 * 8);
+
+	struct eb_root	root_ = EB_ROOT_UNIQUE;
+	rwlock_t	lock_;
+
+	Node *
+	find(const Key &key)
+	{
+		struct ebmb_node *n = ebmb_lookup(&root_, key.k_, Key::SIZE);
+
+		return n ? ebmb_entry(n, Node, node) : NULL;
+	}
+
+public:
+	virtual const char *
+	name() const
+	{
+		return "ebtree with big RW lock";
+	}
+
+	virtual void
+	insert(const Key &key, const Entry *entry)
+	{
+		Node *n = new Node{ {}, *entry };
+
+		write_lock(&lock_);
+
+		if (ebmb_insert(&root_, &n->node, Key::SIZE) != &n->node)
+			delete n;
+
+		write_unlock(&lock_);
+	}
+
+	virtual const Entry *
+	lookup(const Key &key)
+	{
+		Node *n;
+
+		read_lock(&lock_);
+
+		n = find(key);
+
+		read_unlock(&lock_);
+
+		return n ? &n->e : NULL;
+	}
+
+	virtual void
+	update(const Key &key, const Entry *entry)
+	{
+		Node *n;
+
+		write_lock(&lock_);
+
+		if ((n = find(key))) {
+			n->e = *entry;
+		} else {
+			n = new Node{ {}, *entry };
+			ebmb_insert(&root_, &n->node, Key::SIZE);
+		}
+
+		write_unlock(&lock_);
+	}
+
+	virtual void
+	remove(const Key &key)
+	{
+		Node *n;
+
+		write_lock(&lock_);
+
+		if ((n = find(key))) {
+			ebmb_delete(&n->node);
+			delete n;
+		}
+
+		write_unlock(&lock_);
+	}
+
+	virtual ~EbTree()
+	{
+		struct ebmb_node *n;
+
+		while ((n = ebmb_first(&root_))) {
+			ebmb_delete(n);
+			delete ebmb_entry(n, Node, node);
+		}
+	}
+};
+
+/**
+ * Dummy Radix/Patricia tree of order 8.
+ */
+class Radix : public ADT {
+private:
+	static const size_t SPAWN = 256;
+
+	struct Node {
+		std::array<Node *, SPAWN>	nodes{};
 	};
 
 	Node	*root_;
 
+	// Get the last level node for @key if it exists.
+	Node *
+	leaf_node(const Key &key)
+	{
+		const unsigned char *key_u8 = (unsigned char *)&key;
+		Node *n = root_;
+
+		for (auto l = 0; n && l < sizeof(key) - 1; ++l)
+			n = n->nodes[key_u8[l]];
+		return n;
+	}
+
 	void
 	df_walk_free(Node *n, int lvl)
 	{
@@ -437,31 +1289,99 @@ public:
 		}
 		return (Entry *)n;
 	}
+
+	virtual void
+	update(const Key &key, const Entry *entry)
+	{
+		const unsigned char *key_u8 = (unsigned char *)&key;
+		Node *n = leaf_node(key);
+
+		if (!n) {
+			insert(key, entry);
+			return;
+		}
+		// Just lose the old entry, there is no reclamation.
+		WRITE_ONCE(n->nodes[key_u8[sizeof(key) - 1]],
+			   (Node *)new Entry(*entry));
+	}
+
+	virtual void
+	remove(const Key &key)
+	{
+		const unsigned char *key_u8 = (unsigned char *)&key;
+		Node *n = leaf_node(key);
+
+		if (n)
+			WRITE_ONCE(n->nodes[key_u8[sizeof(key) - 1]], NULL);
+	}
 };
 
 class HTrie : public ADT {
 private:
-	TdbHdr		*dbh_;
-	rwlock_t	lock_;
+	TdbHtrieForest	forest_;
+	std::string	name_;
+
+	const Entry *
+	bscan(TdbHdr *dbh, TdbHtrieBucket *b, const Key &key, unsigned long k)
+	{
+		int i = 0;
+		TdbRec *r;
+
+		while ((r = (TdbRec *)tdb_htrie_bscan_for_rec(dbh, b, k, &i))) {
+			Entry *ret = (Entry *)r->data;
+			if (ret->key == key)
+				return ret;
+			i++;
+		}
+		return NULL;
+	}
+
+	static bool
+	key_eq(void *rec, void *key)
+	{
+		return ((Entry *)((TdbRec *)rec)->data)->key == *(Key *)key;
+	}
 
 public:
-	HTrie()
+	// Hash function for the keys, see --hash.
+	static inline tdb_hash_t hash = tdb_hash_calc;
+
+	// One shard per NUMA node if the memory is placed on several nodes.
+	// Use the default number of bucket slots if @bckt_slots is zero.
+	HTrie(unsigned int bckt_slots = 0)
 	{
-		dbh_ = tdb_htrie_init(mapfile_raw_ptr(), mapfile_size(), 8,
-				      sizeof(Entry), TDB_F_INPLACE);
-		assert(dbh_);
+		unsigned int nodes = mapfile_nodes();
+		void *p[TDB_HTRIE_SHARDS_MAX];
+
+		assert(nodes <= TDB_HTRIE_SHARDS_MAX);
+		for (auto n = 0; n < nodes; ++n)
+			p[n] = mapfile_node_ptr(n);
+
+		int r __attribute__((unused));
+		r = tdb_htrie_forest_init(&forest_, p, nodes,
+					  mapfile_node_size(), 8, sizeof(Entry),
+					  bckt_slots, TDB_F_INPLACE);
+		assert(!r);
+
+		name_ = "TempesaDB Burst Hash Trie";
+		if (forest_.n > 1)
+			name_ += " (NUMA shards)";
+		if (bckt_slots)
+			name_ += " (" + std::to_string(bckt_slots)
+				 + " bucket slots)";
 	}
 
 	virtual
 	~HTrie()
 	{
-		tdb_htrie_exit(dbh_);
+		tdb_htrie_forest_exit(&forest_);
+		mapfile_sync();
 	}
 
 	virtual const char *
 	name() const
 	{
-		return "TempesaDB Burst Hash Trie";
+		return name_.c_str();
 	}
 
 	virtual void
@@ -469,51 +1389,860 @@ public:
 	{
 		size_t copied = sizeof(*entry);
 		// No need for 8 byte keys.
-		unsigned long k = tdb_hash_calc((const char *)&key,
-						sizeof(key));
+		unsigned long k = hash((const char *)&key, sizeof(key));
 		TdbRec *rec __attribute__((unused));
 
-		rec = tdb_htrie_insert(dbh_, k, entry, &copied);
+		rec = tdb_htrie_insert(tdb_htrie_shard(&forest_, k), k, entry,
+				       &copied);
 		assert(rec && copied == sizeof(*entry));
 	}
 
 	virtual const Entry *
 	lookup(const Key &key)
 	{
-		int i = 0;
-		TdbRec *r;
 		// No need for 8 byte keys.
-		unsigned long k = tdb_hash_calc((const char *)&key,
-						sizeof(key));
-		TdbHtrieBucket *b = tdb_htrie_lookup(dbh_, k);
+		unsigned long k = hash((const char *)&key, sizeof(key));
+		TdbHdr *dbh = tdb_htrie_shard(&forest_, k);
+		TdbHtrieBucket *b = tdb_htrie_lookup(dbh, k);
 		if (!b)
 			return NULL;
 
-		while ((r = (TdbRec *)tdb_htrie_bscan_for_rec(dbh_, b, k, &i))) {
-			Entry *ret = (Entry *)r->data;
-			if (ret->key == key) {
-				b = (TdbHtrieBucket *)((unsigned long)r
-						       & TDB_HTRIE_DMASK);
-				assert(b);
-				tdb_htrie_put_bucket(dbh_);
-				return ret;
+		const Entry *ret = bscan(dbh, b, key, k);
+		tdb_htrie_put_bucket(dbh);
+		return ret;
+	}
+
+	// Update the small inplace records in place just like for
+	// tbb::concurrent_unordered_map. Removal and insertion of the same hot
+	// key by many CPUs fill the bucket with tombstones of other CPUs faster
+	// than the CPUs reclaim them.
+	virtual void
+	update(const Key &key, const Entry *entry)
+	{
+		unsigned long k = hash((const char *)&key, sizeof(key));
+		TdbHdr *dbh = tdb_htrie_shard(&forest_, k);
+		TdbHtrieBucket *b = tdb_htrie_lookup(dbh, k);
+		if (b) {
+			Entry *e = (Entry *)bscan(dbh, b, key, k);
+			if (e)
+				*e = *entry;
+			tdb_htrie_put_bucket(dbh);
+			if (e)
+				return;
+		}
+		insert(key, entry);
+	}
+
+	virtual void
+	remove(const Key &key)
+	{
+		unsigned long k = hash((const char *)&key, sizeof(key));
+
+		tdb_htrie_remove(tdb_htrie_shard(&forest_, k), k, key_eq,
+				 (void *)&key);
+	}
+
+	virtual void
+	lookup_batch(const Key *keys, size_t n, const Entry **out)
+	{
+		uint64_t k[n], sk[n];
+		size_t idx[n];
+		TdbHtrieBucket *b[n];
+
+		for (auto i = 0; i < n; ++i) {
+			k[i] = hash((const char *)&keys[i], sizeof(keys[i]));
+			out[i] = NULL;
+		}
+
+		// Each shard has its own reader sessions.
+		for (auto s = 0; s < forest_.n; ++s) {
+			TdbHdr *dbh = forest_.shards[s];
+			size_t m = 0;
+
+			for (auto i = 0; i < n; ++i)
+				if (tdb_htrie_shard(&forest_, k[i]) == dbh) {
+					sk[m] = k[i];
+					idx[m++] = i;
+				}
+			if (!m || !tdb_htrie_lookup_batch(dbh, sk, m, b))
+				continue;
+
+			for (auto i = 0; i < m; ++i)
+				if (b[i])
+					out[idx[i]] = bscan(dbh, b[i],
+							    keys[idx[i]], sk[i]);
+			tdb_htrie_put_bucket(dbh);
+		}
+	}
+
+	virtual ssize_t
+	compact()
+	{
+		ssize_t n = 0;
+
+		for (auto s = 0; s < forest_.n; ++s)
+			n += tdb_htrie_compact(forest_.shards[s]);
+
+		return n;
+	}
+};
+
+/**
+ * HTrie as a cache larger than the database: the Zipfian keys are looked up
+ * and the missed ones are inserted, so the database fills up. Without
+ * eviction the inserts fail on the full database, with eviction a background
+ * sweeper thread evicts the cold records by tdb_htrie_evict() once the records
+ * data exceeds the high watermark. The TTL mode also expires the records by
+ * the time kept in the records.
+ */
+class EvictBenchmark {
+public:
+	enum Mode { NONE, CLOCK, TTL };
+
+private:
+	static const size_t DB_SZ = TDB_EXT_SZ * 32;
+	static const size_t KEYS = 1 << 18;
+	static const size_t OPS = 1 << 20;
+	// The records take 1KB data chunks, which are reused from the data
+	// cache of the 1KB chunks after the eviction.
+	static const size_t VAL_SZ = 1024 - sizeof(TdbVRec) - Key::SIZE
+				     - sizeof(uint64_t);
+	// Percents of the database size for the records data.
+	static const size_t HIGH_WM = 75;
+	static const size_t LOW_WM = 70;
+	static const unsigned int SWEEP_N = 256;
+	static const uint64_t TTL_NS = 20 * 1000 * 1000;
+
+	struct Rec {
+		Key		key;
+		uint64_t	expires;
+		char		val[VAL_SZ];
+	} __attribute__((packed));
+
+	TdbHdr *dbh_;
+	Mode mode_;
+	Zipf zipf_;
+	std::atomic<bool> stop_;
+	std::atomic<uint64_t> hits_, lookups_, inserts_, fails_;
+
+	static bool
+	expired(void *rec, void *now)
+	{
+		return ((Rec *)((TdbVRec *)rec)->data)->expires
+		       < *(uint64_t *)now;
+	}
+
+	bool
+	lookup(const Key &key, unsigned long k, uint64_t now)
+	{
+		TdbHtrieBucket *b = tdb_htrie_lookup(dbh_, k);
+		bool hit = false;
+		TdbVRec *r;
+		int i = 0;
+
+		if (!b)
+			return false;
+		while ((r = (TdbVRec *)tdb_htrie_bscan_for_rec(dbh_, b, k, &i))) {
+			Rec *rec = (Rec *)r->data;
+
+			if (rec->key == key
+			    && (mode_ != TTL || rec->expires >= now))
+			{
+				hit = true;
+				break;
 			}
-			i++;
+			++i;
 		}
 		tdb_htrie_put_bucket(dbh_);
-		return NULL;
+
+		return hit;
+	}
+
+	bool
+	insert(const Rec &rec, unsigned long k)
+	{
+		size_t len = sizeof(rec), copied;
+		TdbRec *head = tdb_htrie_insert_begin(dbh_, k, &rec, &len);
+		TdbVRec *r = (TdbVRec *)head;
+
+		if (!head)
+			return false;
+		for (copied = len; copied < sizeof(rec); copied += r->len) {
+			if (!(r = tdb_htrie_extend_rec(dbh_, r,
+						       sizeof(rec) - copied)))
+			{
+				tdb_htrie_insert_abort(dbh_, head);
+				return false;
+			}
+			memcpy(r->data, (char *)&rec + copied, r->len);
+		}
+
+		return tdb_htrie_insert_commit(dbh_, k, head);
+	}
+
+	void
+	workload(int thr_id)
+	{
+		std::mt19937_64 rng(thr_id);
+		uint64_t hits = 0, inserts = 0, fails = 0;
+		Rec rec;
+
+		memset(rec.val, (thr_id + 1) & 0x7f, sizeof(rec.val));
+		for (auto i = 0; i < OPS; ++i) {
+			uint64_t now = bench_now_ns();
+
+			rec.key = Key(zipf_(rng) * 0x9e3779b97f4a7c15UL);
+			unsigned long k = HTrie::hash(rec.key.k_, Key::SIZE);
+			if (lookup(rec.key, k, now)) {
+				++hits;
+				continue;
+			}
+			rec.expires = now + TTL_NS;
+			++inserts;
+			fails += !insert(rec, k);
+		}
+		hits_ += hits;
+		lookups_ += OPS;
+		inserts_ += inserts;
+		fails_ += fails;
+	}
+
+	/*
+	 * The sweeper works on its own CPU, next to the workload ones. The
+	 * evicted records are reclaimed with the sweeper tombstones batches,
+	 * so the records data statistics lag by two batches only.
+	 */
+	void
+	sweeper()
+	{
+		TdbHtrieCursor hand, cur;
+		TdbHtrieStat st;
+
+		__thr_id = TEST_THREADS_N;
+		tdb_htrie_cursor_init(&hand);
+		tdb_htrie_cursor_init(&cur);
+
+		while (!stop_.load(std::memory_order_relaxed)) {
+			uint64_t now = bench_now_ns();
+			int n = 0;
+
+			tdb_htrie_stat(dbh_, &st);
+			if (st.data > DB_SZ * HIGH_WM / 100) {
+				do {
+					n = tdb_htrie_evict(dbh_, &hand, SWEEP_N,
+							    mode_ == TTL
+							    ? expired : NULL,
+							    &now);
+					tdb_htrie_stat(dbh_, &st);
+				} while (n > 0
+					 && st.data > DB_SZ * LOW_WM / 100);
+			} else if (mode_ == TTL) {
+				n = tdb_htrie_expire(dbh_, &cur, SWEEP_N, expired,
+						     &now);
+			}
+			if (n <= 0)
+				std::this_thread::sleep_for(
+					std::chrono::microseconds(100));
+		}
+	}
+
+public:
+	EvictBenchmark(Mode mode)
+		: mode_(mode), zipf_(KEYS), stop_(false), hits_(0),
+		  lookups_(0), inserts_(0), fails_(0)
+	{
+		// One more CPU for the sweeper.
+		__thr_set_threads_n(TEST_THREADS_N + 1);
+		__thr_reset_cpuids();
+		dbh_ = tdb_htrie_init(mapfile_node_ptr(0), DB_SZ, 8, 0, 0, 0,
+				      0);
+		assert(dbh_);
+	}
+
+	~EvictBenchmark()
+	{
+		tdb_htrie_exit(dbh_);
+		__thr_set_threads_n(TEST_THREADS_N);
+	}
+
+	void
+	run()
+	{
+		static const char *modes[] = { "no eviction", "CLOCK eviction",
+					       "CLOCK eviction and TTL" };
+		std::array<unsigned int, TEST_THREADS_N> dur;
+		TdbHtrieStat st;
+
+		std::cout << "\nTempesaDB Burst Hash Trie cache (" << modes[mode_]
+			  << ", " << DB_SZ / 1024 / 1024 << "MB for "
+			  << KEYS * sizeof(Rec) / 1024 / 1024 << "MB of keys):"
+			  << std::endl;
+
+		std::thread sweeper;
+		if (mode_ != NONE)
+			sweeper = std::thread([this]() { this->sweeper(); });
+
+		std::cout << "threads statistics: ";
+		exec_threads([this](int thr_id) { workload(thr_id); }, dur,
+			     std::string("HTrie cache ") + modes[mode_], OPS);
+		std::cout << std::endl;
+
+		stop_ = true;
+		if (sweeper.joinable())
+			sweeper.join();
+
+		auto avg = std::accumulate(dur.begin(), dur.end(), 0)
+			   / TEST_THREADS_N;
+		tdb_htrie_stat(dbh_, &st);
+		std::cout << std::fixed << std::setprecision(1)
+			  << "  AVG: " << avg << "ms, "
+			  << OPS * TEST_THREADS_N / std::max(avg, 1)
+			  << " ops/ms\n"
+			  << "  hit ratio: " << hits_ * 100.0 / lookups_ << "%\n"
+			  << "  allocation failures: "
+			  << fails_ * 100.0 / std::max<uint64_t>(inserts_, 1)
+			  << "% of " << inserts_ << " inserts\n"
+			  << "  evicted: " << st.evict << ", expired: "
+			  << st.expire << ", records data: "
+			  << st.data / 1024 / 1024 << "MB" << std::endl;
+	}
+};
+
+/**
+ * Longest prefix match for IPv4 addresses, e.g. for blocklists and rate
+ * limiters.
+ */
+struct PfxADT {
+	PfxADT()
+	{
+		__thr_reset_cpuids();
+	}
+
+	virtual
+	~PfxADT()
+	{};
+
+	virtual const char *name() const =0;
+	virtual void insert(uint32_t addr, unsigned int plen,
+			    const Entry *entry) =0;
+	virtual const Entry *lookup(uint32_t addr) =0;
+};
+
+class PfxBenchmark {
+private:
+	static const size_t N = 20000;
+	static const size_t LOOKUPS = N * 50;
+	// Prefix lengths distribution resembling Internet routing tables.
+	static constexpr unsigned int PLENS[] = {
+		24, 24, 24, 24, 24, 23, 22, 21, 20, 16, 19, 18, 17, 8
+	};
+
+	PfxADT &adt_;
+	std::vector<Entry> entries_;
+	Latency lat_;
+
+	static uint32_t
+	addr(size_t i)
+	{
+		return i * 2654435761U;
+	}
+
+	int
+	workload(int thr_id)
+	{
+		int i;
+
+		for (i = 0; i < LOOKUPS; ++i)
+			lat_.measure(thr_id, 0, [&]() {
+				adt_.lookup(addr(i * TEST_THREADS_N + thr_id));
+			});
+
+		return i;
+	}
+
+	void
+	test()
+	{
+		Entry a(1, 'a'), b(2, 'b'), c(3, 'c'), d(4, 'd'), e(5, 'e');
+
+		adt_.insert(0x0a000000, 8, &a);		// 10.0.0.0/8
+		adt_.insert(0x0a010000, 16, &b);	// 10.1.0.0/16
+		adt_.insert(0x0a010200, 24, &c);	// 10.1.2.0/24
+		adt_.insert(0, 0, &d);			// 0.0.0.0/0
+		adt_.insert(0xc0a80180, 25, &e);	// 192.168.1.128/25
+
+		const Entry *_c = adt_.lookup(0x0a010203);
+		const Entry *_b = adt_.lookup(0x0a010303);
+		const Entry *_a = adt_.lookup(0x0a020001);
+		const Entry *_d = adt_.lookup(0x08080808);
+		const Entry *_e = adt_.lookup(0xc0a801c8);
+		const Entry *_d2 = adt_.lookup(0xc0a80101);
+
+		assert(_a && _a->a[0] == 'a');
+		assert(_b && _b->a[0] == 'b');
+		assert(_c && _c->a[0] == 'c');
+		assert(_d && _d->a[0] == 'd');
+		assert(_e && _e->a[0] == 'e');
+		assert(_d2 && _d2->a[0] == 'd');
+	}
+
+public:
+	PfxBenchmark(PfxADT &&adt)
+		: adt_(adt), entries_(N), lat_({ "lookup" })
+	{
+		for (auto i = 0; i < N; ++i)
+			entries_[i] = Entry(i, (char)((i + 1) & 0x7f));
+	}
+
+	/*
+	 * The prefixes table is built in the main thread and the threads run
+	 * the lookups only, just like for a routing table.
+	 */
+	void
+	run()
+	{
+		using namespace std::chrono;
+
+		std::array<unsigned int, TEST_THREADS_N> dur;
+		const auto plens_n = sizeof(PLENS) / sizeof(PLENS[0]);
+
+		std::cout << "\n" << adt_.name() << " (IPv4 longest prefix match):"
+			  << std::endl;
+
+		__thr_set_cpuid();
+		test();
+
+		auto t(steady_clock::now());
+		for (auto i = 0; i < N; ++i)
+			adt_.insert(addr(i), PLENS[i % plens_n], &entries_[i]);
+		auto d = duration_cast<milliseconds>(steady_clock::now() - t);
+		std::cout << "  insert " << N << " prefixes: " << d.count()
+			  << "ms" << std::endl;
+		__thr_reset_cpuids();
+
+		std::cout << "threads statistics: ";
+		exec_threads([this](int thr_id) { workload(thr_id); }, dur,
+			     std::string(adt_.name()) + " LPM", LOOKUPS);
+		std::cout << std::endl;
+
+		std::cout << "  AVG: "
+			  << std::accumulate(dur.begin(), dur.end(), 0) / TEST_THREADS_N
+			  << "ms" << std::endl;
+		lat_.report(adt_.name());
+	}
+};
+
+/**
+ * Radix tree of order 8 with controlled prefix expansion: a prefix is stored
+ * in all the slots of the node resolving the last prefix bits, which are
+ * covered by the prefix. Unlike Radix, the tree isn't concurrent for inserts.
+ */
+class RadixPfx : public PfxADT {
+private:
+	static const size_t SPAWN = 256;
+	static const unsigned int STRIDE = 8;
+	static const unsigned int LEVELS = sizeof(uint32_t);
+
+	struct Node {
+		std::array<Node *, SPAWN>		nodes{};
+		std::array<const Entry *, SPAWN>	pfx{};
+		std::array<unsigned char, SPAWN>	plen{};
+	};
+
+	Node		*root_;
+	const Entry	*def_ = NULL;
+
+	static unsigned char
+	addr_byte(uint32_t addr, unsigned int l)
+	{
+		return addr >> ((LEVELS - 1 - l) * STRIDE);
+	}
+
+	void
+	df_walk_free(Node *n)
+	{
+		for (auto s = 0; s < SPAWN; ++s)
+			if (n->nodes[s])
+				df_walk_free(n->nodes[s]);
+		delete n;
+	}
+
+public:
+	RadixPfx()
+	{
+		root_ = new Node;
+	}
+
+	virtual
+	~RadixPfx()
+	{
+		df_walk_free(root_);
+	}
+
+	virtual const char *
+	name() const
+	{
+		return "Radix tree of order 8";
+	}
+
+	virtual void
+	insert(uint32_t addr, unsigned int plen, const Entry *entry)
+	{
+		Node *n = root_;
+		unsigned int l, last, s, s_n;
+
+		if (!plen) {
+			def_ = entry;
+			return;
+		}
+
+		last = (plen - 1) / STRIDE;
+		for (l = 0; l < last; ++l) {
+			unsigned char i = addr_byte(addr, l);
+			if (!n->nodes[i])
+				n->nodes[i] = new Node;
+			n = n->nodes[i];
+		}
+
+		// Expand the prefix to all the slots covered by it.
+		s_n = 1 << ((last + 1) * STRIDE - plen);
+		s = addr_byte(addr, last) & ~(s_n - 1);
+		for (auto i = s; i < s + s_n; ++i)
+			if (n->plen[i] <= plen) {
+				n->pfx[i] = new Entry(*entry);
+				n->plen[i] = plen;
+			}
+		// Don't care about the replaced entries for now.
+	}
+
+	virtual const Entry *
+	lookup(uint32_t addr)
+	{
+		const Entry *e = def_;
+		Node *n = root_;
+
+		for (auto l = 0; n && l < LEVELS; ++l) {
+			unsigned char i = addr_byte(addr, l);
+			if (n->pfx[i])
+				e = n->pfx[i];
+			n = n->nodes[i];
+		}
+		return e;
+	}
+};
+
+/**
+ * HTrie with the raw keys: the IPv4 address goes to the most significant bits
+ * of a key. The database can't be a forest, so it uses the first NUMA node
+ * memory only.
+ */
+class HTriePfx : public PfxADT {
+private:
+	static const unsigned int IPV4_SHIFT = 32;
+
+	TdbHdr		*dbh_;
+
+public:
+	HTriePfx()
+	{
+		dbh_ = tdb_htrie_init(mapfile_node_ptr(0), mapfile_node_size(),
+				      8, sizeof(Entry), 0, 1,
+				      TDB_F_INPLACE | TDB_F_RAWKEY);
+		assert(dbh_);
+	}
+
+	virtual
+	~HTriePfx()
+	{
+		tdb_htrie_exit(dbh_);
+		mapfile_sync();
+	}
+
+	virtual const char *
+	name() const
+	{
+		return "TempesaDB Burst Hash Trie";
+	}
+
+	virtual void
+	insert(uint32_t addr, unsigned int plen, const Entry *entry)
+	{
+		size_t copied = sizeof(*entry);
+		TdbRec *rec __attribute__((unused));
+
+		rec = tdb_htrie_insert_prefix(dbh_, (uint64_t)addr << IPV4_SHIFT,
+					      plen, entry, &copied);
+		assert(rec && copied == sizeof(*entry));
+	}
+
+	virtual const Entry *
+	lookup(uint32_t addr)
+	{
+		int i = 0;
+		unsigned int plen;
+		uint64_t a = (uint64_t)addr << IPV4_SHIFT;
+		TdbRec *r;
+
+		TdbHtrieBucket *b = tdb_htrie_lookup_prefix(dbh_, a, &plen);
+		if (!b)
+			return NULL;
+
+		r = (TdbRec *)tdb_htrie_bscan_for_rec(dbh_, b,
+						      tdb_htrie_pfx_key(a, plen),
+						      &i);
+		tdb_htrie_put_bucket(dbh_);
+		return r ? (Entry *)r->data : NULL;
 	}
 };
 
+static void
+usage(const char *name)
+{
+	std::cout << "\nUsage: " << name
+		  << " [--numa] [--node <n>] [--huge <2M|1G>]"
+		  << " [--file <path>] [--sweep]"
+		  << " [--ycsb <A-F|R|all>] [--mix <r:u:i:d>] [--dist <d>]"
+		  << " [--latency] [--lat-csv <path>] [--growth]"
+		  << " [--evict] [--hash <name>]\n"
+		  << "  --numa  - place the HTrie memory on all NUMA nodes,"
+		  << " one shard per node\n"
+		  << "  --node  - bind the HTrie memory to the NUMA node\n"
+		  << "  --huge  - use 2MB or 1GB huge pages for the HTrie"
+		  << " memory, the pages must be reserved in the system\n"
+		  << "  --file  - keep the HTrie in the file, the database"
+		  << " is recovered on the next run after a crash\n"
+		  << "  --sweep - run the HTrie benchmark only for all the"
+		  << " numbers of bucket slots\n"
+		  << "  --ycsb  - run only YCSB workload A-F or the read"
+		  << " intensive workload R for all the data structures\n"
+		  << "  --mix   - run only the workload with the read, update,"
+		  << " insert and remove percents\n"
+		  << "  --dist  - keys distribution for the workload:"
+		  << " uniform, zipf or latest\n"
+		  << "  --latency - print the operations latency percentiles\n"
+		  << "  --lat-csv - write the latency percentiles distributions"
+		  << " to the CSV file, implies --latency\n"
+		  << "  --growth  - measure the inserts latency on the hash"
+		  << " tables growth, implies --latency\n"
+		  << "  --evict   - run the HTrie cache with and without"
+		  << " eviction on a full database\n"
+		  << "  --hash    - hash function for the HTrie keys:";
+	for (auto h = tdb_hash_fns; h->name; ++h)
+		std::cout << " " << h->name;
+	std::cout << "\n"
+		  << std::endl;
+}
+
+/*
+ * Run the HTrie benchmark on a new database for each number of bucket slots
+ * to choose the best value for the workload. The benchmark inserts duplicate
+ * keys, so at least 2 slots are required.
+ */
+static void
+sweep_bckt_slots()
+{
+	for (auto s = 2; s <= TDB_HTRIE_BCKT_SLOTS_MAX; ++s) {
+		mapfile_reset();
+		Benchmark(HTrie(s)).run();
+		mapfile_reset();
+		Benchmark(HTrie(s), true).run();
+	}
+}
+
+/*
+ * All the hash tables start from 8 buckets. ebtree doesn't need rehashing
+ * and is measured as the baseline.
+ */
+static void
+run_growth()
+{
+	GrowthBenchmark(TbbUnorderedMap(8)).run();
+	GrowthBenchmark(TbbHashMap(8)).run();
+#ifdef HAVE_BOOST_CFM
+	GrowthBenchmark(BoostFlatMap(8)).run();
+#endif
+	GrowthBenchmark(EbTree()).run();
+	mapfile_reset();
+	GrowthBenchmark(HTrie()).run();
+}
+
+static void
+run_evict()
+{
+	for (auto m : { EvictBenchmark::NONE, EvictBenchmark::CLOCK,
+			EvictBenchmark::TTL }) {
+		mapfile_reset();
+		EvictBenchmark(m).run();
+	}
+}
+
+static void
+run_ycsb(const Workload &wl)
+{
+	YcsbBenchmark(StdMap(), wl).run();
+	YcsbBenchmark(TbbUnorderedMap(), wl).run();
+	YcsbBenchmark(TbbHashMap(), wl).run();
+#ifdef HAVE_BOOST_CFM
+	YcsbBenchmark(BoostFlatMap(), wl).run();
+#endif
+	YcsbBenchmark(EbTree(), wl).run();
+	YcsbBenchmark(Radix(), wl).run();
+	mapfile_reset();
+	YcsbBenchmark(HTrie(), wl).run();
+}
+
+/*
+ * Parse the workload options: @ycsb is a workload identifier or "all",
+ * @mix is the operations percents and @dist overrides the keys distribution.
+ * @return the number of the workloads stored in @wl or -1 on error.
+ */
+static int
+parse_workloads(const char *ycsb, const char *mix, const char *dist,
+		Workload *wl)
+{
+	int n = 0;
+	static const char *dists[] = { "uniform", "zipf", "latest" };
+
+	if (mix) {
+		wl[n] = { 'M', "custom mix", 0, 0, 0, 0, 0, 0, Workload::ZIPF };
+		if (sscanf(mix, "%u:%u:%u:%u", &wl[n].read, &wl[n].update,
+			   &wl[n].insert, &wl[n].remove) != 4
+		    || wl[n].read + wl[n].update + wl[n].insert + wl[n].remove
+		       != 100)
+			return -1;
+		++n;
+	}
+	for (const auto &w : YCSB)
+		if (ycsb && (!strcmp(ycsb, "all")
+			     || (ycsb[0] == w.id && !ycsb[1])))
+			wl[n++] = w;
+	if (ycsb && n == !!mix)
+		return -1;
+
+	if (dist) {
+		auto d = std::find_if(std::begin(dists), std::end(dists),
+				      [dist](const char *d) {
+					      return !strcmp(d, dist);
+				      });
+		if (d == std::end(dists))
+			return -1;
+		for (auto i = 0; i < n; ++i)
+			wl[i].dist = (Workload::Dist)(d - std::begin(dists));
+	}
+
+	return n;
+}
+
 int
-main()
+main(int argc, char *argv[])
 {
+	bool sweep = false, growth = false, evict = false;
+	const char *ycsb = NULL, *mix = NULL, *dist = NULL;
+	Workload wl[std::size(YCSB) + 1];
+	int wl_n;
+
+	for (auto i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--numa")) {
+			if (mapfile_set_nodes(mapfile_numa_nodes())) {
+				std::cerr << "cannot use NUMA nodes" << std::endl;
+				return 1;
+			}
+		} else if (!strcmp(argv[i], "--node") && i + 1 < argc) {
+			if (mapfile_set_node(atoi(argv[++i]))) {
+				std::cerr << "cannot bind to NUMA node "
+					  << argv[i] << std::endl;
+				return 1;
+			}
+		} else if (!strcmp(argv[i], "--huge") && i + 1 < argc) {
+			++i;
+			if (mapfile_set_huge(!strcmp(argv[i], "1G") ? 30
+					     : !strcmp(argv[i], "2M") ? 21 : 0))
+			{
+				std::cerr << "cannot use huge pages " << argv[i]
+					  << std::endl;
+				return 1;
+			}
+		} else if (!strcmp(argv[i], "--file") && i + 1 < argc) {
+			mapfile_set_file(argv[++i]);
+		} else if (!strcmp(argv[i], "--sweep")) {
+			sweep = true;
+		} else if (!strcmp(argv[i], "--ycsb") && i + 1 < argc) {
+			ycsb = argv[++i];
+		} else if (!strcmp(argv[i], "--mix") && i + 1 < argc) {
+			mix = argv[++i];
+		} else if (!strcmp(argv[i], "--dist") && i + 1 < argc) {
+			dist = argv[++i];
+		} else if (!strcmp(argv[i], "--latency")) {
+			Latency::enabled = true;
+		} else if (!strcmp(argv[i], "--growth")) {
+			Latency::enabled = growth = true;
+		} else if (!strcmp(argv[i], "--evict")) {
+			evict = true;
+		} else if (!strcmp(argv[i], "--hash") && i + 1 < argc) {
+			if (!(HTrie::hash = tdb_hash_by_name(argv[++i]))) {
+				usage(argv[0]);
+				return 1;
+			}
+		} else if (!strcmp(argv[i], "--lat-csv") && i + 1 < argc) {
+			Latency::csv.open(argv[++i]);
+			if (!Latency::csv) {
+				std::cerr << "cannot open " << argv[i]
+					  << std::endl;
+				return 1;
+			}
+			Latency::csv << "adt,op,cycles,count,percentile\n";
+			Latency::enabled = true;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if ((wl_n = parse_workloads(ycsb, mix, dist, wl)) < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
 	__thr_set_threads_n(TEST_THREADS_N);
 
+	if (wl_n) {
+		for (auto i = 0; i < wl_n; ++i)
+			run_ycsb(wl[i]);
+		std::cout << std::endl;
+		return 0;
+	}
+	if (sweep) {
+		sweep_bckt_slots();
+		std::cout << std::endl;
+		return 0;
+	}
+	if (growth) {
+		run_growth();
+		std::cout << std::endl;
+		return 0;
+	}
+	if (evict) {
+		run_evict();
+		std::cout << std::endl;
+		return 0;
+	}
+
 	Benchmark(StdMap()).run();
 	Benchmark(TbbUnorderedMap()).run();
+	Benchmark(TbbHashMap()).run();
+#ifdef HAVE_BOOST_CFM
+	Benchmark(BoostFlatMap()).run();
+#endif
+	Benchmark(EbTree()).run();
 	Benchmark(Radix()).run();
 	Benchmark(HTrie()).run();
+	Benchmark(TbbUnorderedMap(), true).run();
+	Benchmark(HTrie(), true).run();
+
+	PfxBenchmark(RadixPfx()).run();
+	// The prefixes are stored in a new raw keys database.
+	mapfile_reset();
+	PfxBenchmark(HTriePfx()).run();
 
 	std::cout << std::endl;
 
@@ -1,8 +1,12 @@
 /**
- *		Dummy fast hash function.
+ *		Fast hash functions for the HTrie keys.
+ *
+ * The HTrie resolves the keys by TDB_HTRIE_BITS starting from the less
+ * significant bits, so a hash function with poor distribution of the bits
+ * makes the buckets burst more.
  *
  * Copyright (C) 2014-2015 Alexander Krizhanovsky (ak@tempesta-tech.com).
- * Copyright (C) 2015-2019 Tempesta Technologies, INC.
+ * Copyright (C) 2015-2025 Tempesta Technologies, INC.
  *
  * This program is free software; you can redistribute it and/or modify it
  * under the terms of the GNU General Public License as published by
@@ -21,6 +25,13 @@
 #ifndef __HASHFN_H__
 #define __HASHFN_H__
 
+#include <immintrin.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Hash function for the HTrie keys. */
+typedef unsigned long (*tdb_hash_t)(const char *data, size_t len);
+
 #define CRCQ(crc, data64) \
 	asm volatile("crc32q %2, %0" : "=r"(crc) : "0"(crc), "r"(data64))
 
@@ -59,4 +70,201 @@ tdb_hash_calc(const char *data, size_t len)
 	return (crc1 << 32) | crc0;
 }
 
+/*
+ * The 64-bit finalizer from MurmurHash3: each output bit depends on all
+ * the input bits.
+ */
+static inline unsigned long
+__tdb_hash_fmix(unsigned long h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdUL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53UL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+/**
+ * tdb_hash_calc() with the finalizer. The CRC streams have 32 bits each and
+ * the second stream is empty for keys shorter than 16 bytes (e.g. IPv4 and
+ * integer keys), so the most significant bits of tdb_hash_calc() are zero
+ * for them.
+ */
+static inline unsigned long
+tdb_hash_crc_mix(const char *data, size_t len)
+{
+	unsigned long crc0 = 0, crc1 = len;
+
+	__tdb_hash_calc(&crc0, &crc1, data, len);
+
+	return __tdb_hash_fmix((crc1 << 32) | crc0);
+}
+
+static inline uint64_t
+__tdb_hash_mum(uint64_t a, uint64_t b)
+{
+	__uint128_t r = (__uint128_t)a * b;
+
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t
+__tdb_hash_r8(const unsigned char *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t
+__tdb_hash_r4(const unsigned char *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/**
+ * wyhash-like function: 16 bytes per a 64x64->128 bit multiplication and
+ * overlapping reads for short keys, so there are no byte loops at all.
+ */
+static inline unsigned long
+tdb_hash_wy(const char *data, size_t len)
+{
+	static const uint64_t S0 = 0xa0761d6478bd642fUL;
+	static const uint64_t S1 = 0xe7037ed1a0b428dbUL;
+	static const uint64_t S2 = 0x8ebc6af09c88c6e3UL;
+	static const uint64_t S3 = 0x589965cc75374cc3UL;
+	const unsigned char *p = (const unsigned char *)data;
+	uint64_t a, b, seed = __tdb_hash_mum(S0, S1);
+	size_t i = len;
+
+	if (len <= 16) {
+		if (len >= 4) {
+			a = (__tdb_hash_r4(p) << 32)
+			    | __tdb_hash_r4(p + ((len >> 3) << 2));
+			b = (__tdb_hash_r4(p + len - 4) << 32)
+			    | __tdb_hash_r4(p + len - 4 - ((len >> 3) << 2));
+		} else if (len) {
+			a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8)
+			    | p[len - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		if (i > 48) {
+			uint64_t seed1 = seed, seed2 = seed;
+
+			do {
+				seed = __tdb_hash_mum(__tdb_hash_r8(p) ^ S1,
+						      __tdb_hash_r8(p + 8)
+						      ^ seed);
+				seed1 = __tdb_hash_mum(__tdb_hash_r8(p + 16)
+						       ^ S2,
+						       __tdb_hash_r8(p + 24)
+						       ^ seed1);
+				seed2 = __tdb_hash_mum(__tdb_hash_r8(p + 32)
+						       ^ S3,
+						       __tdb_hash_r8(p + 40)
+						       ^ seed2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= seed1 ^ seed2;
+		}
+		for ( ; i > 16; i -= 16, p += 16)
+			seed = __tdb_hash_mum(__tdb_hash_r8(p) ^ S1,
+					      __tdb_hash_r8(p + 8) ^ seed);
+		a = __tdb_hash_r8(p + i - 16);
+		b = __tdb_hash_r8(p + i - 8);
+	}
+
+	return __tdb_hash_mum(S1 ^ len, __tdb_hash_mum(a ^ S1, b ^ seed));
+}
+
+/**
+ * AES-NI hash for short keys: 2 AES rounds per 16 bytes of the key, which
+ * are the minimum for the full diffusion of the 128-bit state. With only one
+ * round a difference in a block spreads to 4 bytes of the state, which are
+ * easily cancelled by the next block. The last 2 rounds mix the key length.
+ */
+static inline __attribute__((target("aes,sse4.1"))) unsigned long
+tdb_hash_aes(const char *data, size_t len)
+{
+	size_t i;
+	const unsigned char *p = (const unsigned char *)data;
+	__m128i m, h = _mm_set1_epi64x(0x9e3779b97f4a7c15UL);
+	const __m128i k0 = _mm_set_epi64x(0xa0761d6478bd642fUL,
+					  0xe7037ed1a0b428dbUL);
+	const __m128i k1 = _mm_set_epi64x(0x8ebc6af09c88c6e3UL,
+					  0x589965cc75374cc3UL);
+
+	/*
+	 * Read the short keys and the last block of the long keys with
+	 * overlapping loads, like tdb_hash_wy() does. The key length is mixed
+	 * into the state by the final rounds, so the blocks are still unique
+	 * for the keys. The length in the initial state could be cancelled
+	 * by the difference of the overlapping loads.
+	 */
+	if (len > 16) {
+		for (i = 0; i + 16 < len; i += 16) {
+			m = _mm_loadu_si128((const __m128i *)(p + i));
+			h = _mm_xor_si128(h, m);
+			h = _mm_aesenc_si128(_mm_aesenc_si128(h, k0), k1);
+		}
+		m = _mm_loadu_si128((const __m128i *)(p + len - 16));
+	} else if (len >= 8) {
+		m = _mm_set_epi64x(__tdb_hash_r8(p + len - 8),
+				   __tdb_hash_r8(p));
+	} else if (len >= 4) {
+		m = _mm_set_epi64x(__tdb_hash_r4(p + len - 4),
+				   __tdb_hash_r4(p));
+	} else if (len) {
+		m = _mm_set_epi64x(0, ((uint64_t)p[0] << 16)
+				      | ((uint64_t)p[len >> 1] << 8)
+				      | p[len - 1]);
+	} else {
+		m = _mm_setzero_si128();
+	}
+	h = _mm_xor_si128(h, m);
+	h = _mm_aesenc_si128(_mm_aesenc_si128(h, k0), k1);
+	h = _mm_xor_si128(h, _mm_set_epi64x(len, len));
+	h = _mm_aesenc_si128(_mm_aesenc_si128(h, k0), k1);
+
+	return _mm_cvtsi128_si64(h) ^ _mm_extract_epi64(h, 1);
+}
+
+typedef struct {
+	const char	*name;
+	tdb_hash_t	fn;
+} TdbHashFn;
+
+/* All the hash functions, the first one is the default. */
+static const TdbHashFn tdb_hash_fns[] = {
+	{ "crc",	tdb_hash_calc },
+	{ "crc-mix",	tdb_hash_crc_mix },
+	{ "wy",		tdb_hash_wy },
+	{ "aes",	tdb_hash_aes },
+	{ NULL,		NULL }
+};
+
+/**
+ * @return the hash function by its @name or NULL if there is no such one.
+ */
+static inline tdb_hash_t
+tdb_hash_by_name(const char *name)
+{
+	const TdbHashFn *h;
+
+	for (h = tdb_hash_fns; h->name; ++h)
+		if (!strcmp(h->name, name))
+			return h->fn;
+	return NULL;
+}
+
 #endif /* __HASHFN_H__ */
@@ -0,0 +1,184 @@
+/**
+ *		Tempesta DB
+ *
+ * Order-preserving key compression in the spirit of HOPE ("Order-Preserving
+ * Key Compression for In-Memory Search Trees" by H.Zhang et al., SIGMOD'20)
+ * with the single-char scheme: each byte of a string key is replaced by its
+ * code, the more frequent bytes have the shorter codes.
+ *
+ * The codes are alphabetic, i.e. they follow in the same order as the bytes,
+ * and prefix-free, so the compressed keys follow in the same order as the
+ * string keys and the compressed prefix of a string key is the prefix of the
+ * compressed key. Hu-Tucker codes are optimal alphabetic codes, but we use
+ * simple weight-balanced splitting of the bytes range, which is at most
+ * 2 bits per byte worse than the entropy.
+ *
+ * The compressed key prefix goes to the most significant bits of a raw key
+ * (TDB_F_RAWKEY), so a lookup of all the string keys with a given prefix is
+ * a walk of the HTrie subtree of the prefix, see tdb_htrie_walk_prefix().
+ * The compressed keys of the long strings with the same prefix are the same,
+ * so the less significant bits of the raw keys are taken from the hash of the
+ * whole string key to let the HTrie burst the buckets with such keys.
+ *
+ * Copyright (C) 2025 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include "kernel_mocks.h"
+
+#include "hashfn.h"
+#include "hope.h"
+
+/*
+ * The weights are scaled down to this total, so the codes aren't longer than
+ * log2(TDB_HOPE_W_MAX / w) + 2 bits for a byte of weight w >= 1.
+ */
+#define TDB_HOPE_W_MAX		(1UL << (TDB_HOPE_CODE_MAX - 8))
+
+/*
+ * Assign the codes to the bytes [@lo, @hi) with the weights @w and the common
+ * code prefix @code of @len bits.
+ */
+static int
+__hope_split(TdbHope *h, const unsigned long *w, int lo, int hi,
+	     uint32_t code, unsigned int len)
+{
+	int m;
+	unsigned long total = 0, left = 0;
+
+	if (hi - lo == 1) {
+		if (len > TDB_HOPE_CODE_MAX)
+			return -EINVAL;
+		/* The only byte gets 1-bit code to keep the codes prefix-free. */
+		h->code[lo] = code;
+		h->len[lo] = len ? : 1;
+		return 0;
+	}
+
+	for (m = lo; m < hi; ++m)
+		total += w[m];
+	/* Split the range at the bytes median by the weights. */
+	for (m = lo; m < hi - 1 && (left + w[m]) * 2 <= total; ++m)
+		left += w[m];
+	if (m == lo)
+		++m;
+	else if (m < hi - 1 && total - 2 * left > 2 * (left + w[m]) - total)
+		++m;
+
+	if (__hope_split(h, w, lo, m, code << 1, len + 1))
+		return -EINVAL;
+	return __hope_split(h, w, m, hi, (code << 1) | 1, len + 1);
+}
+
+/**
+ * Build the dictionary @h with the bytes frequencies @freq of the sample keys,
+ * see tdb_hope_sample(). All the bytes, including the bytes missing in the
+ * samples, get the codes.
+ */
+int
+tdb_hope_init(TdbHope *h, const unsigned long *freq)
+{
+	int i;
+	unsigned long w[TDB_HOPE_SYM_N], total = 0, div;
+
+	for (i = 0; i < TDB_HOPE_SYM_N; ++i)
+		total += freq[i];
+	div = total / (TDB_HOPE_W_MAX - TDB_HOPE_SYM_N) + 1;
+	for (i = 0; i < TDB_HOPE_SYM_N; ++i)
+		w[i] = freq[i] / div + 1;
+
+	return __hope_split(h, w, 0, TDB_HOPE_SYM_N, 0, 0);
+}
+
+/**
+ * @return the length in bits of the compressed @key.
+ */
+size_t
+tdb_hope_enc_bits(const TdbHope *h, const char *key, size_t len)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < len; ++i)
+		n += h->len[(unsigned char)key[i]];
+
+	return n;
+}
+
+/*
+ * Compress the string @s to the most significant bits of @out, but not more
+ * than @max bits.
+ * @return the number of the written bits.
+ */
+static unsigned int
+__hope_encode(const TdbHope *h, const char *s, size_t len, unsigned int max,
+	      uint64_t *out)
+{
+	size_t i;
+	unsigned int bits = 0;
+	uint64_t acc = 0;
+
+	for (i = 0; i < len && bits < max; ++i) {
+		unsigned char c = s[i];
+		unsigned int n = h->len[c];
+
+		/* The last code may not fit the key, so it's truncated. */
+		if (bits + n > BITS_PER_LONG) {
+			acc |= (uint64_t)h->code[c] >> (bits + n - BITS_PER_LONG);
+			bits = BITS_PER_LONG;
+			break;
+		}
+		acc |= (uint64_t)h->code[c] << (BITS_PER_LONG - bits - n);
+		bits += n;
+	}
+	if (bits > max) {
+		acc &= ~0UL << (BITS_PER_LONG - max);
+		bits = max;
+	}
+	*out = acc;
+
+	return bits;
+}
+
+/**
+ * @return the raw key for the string key @key: the compressed key prefix in
+ * the TDB_HOPE_PFX_BITS most significant bits and the hash of the string key
+ * in the rest bits.
+ */
+uint64_t
+tdb_hope_key(const TdbHope *h, const char *key, size_t len)
+{
+	uint64_t k;
+
+	__hope_encode(h, key, len, TDB_HOPE_PFX_BITS, &k);
+
+	/*
+	 * tdb_hash_calc() bits come from different parts of the key, so use
+	 * the mixed hash to take the bits depending on the whole key.
+	 */
+	return k | (tdb_hash_crc_mix(key, len)
+		    & ((1UL << (BITS_PER_LONG - TDB_HOPE_PFX_BITS)) - 1));
+}
+
+/**
+ * Compress the prefix @pfx of the string keys to @key.
+ * @return the number of the most significant bits of @key, which are the same
+ * for all the raw keys of the string keys with the prefix, see
+ * tdb_htrie_walk_prefix().
+ */
+unsigned int
+tdb_hope_pfx(const TdbHope *h, const char *pfx, size_t len, uint64_t *key)
+{
+	return __hope_encode(h, pfx, len, TDB_HOPE_PFX_BITS, key);
+}
@@ -0,0 +1,100 @@
+/**
+ *		Tempesta DB
+ *
+ * Order-preserving key compression for string keys in the raw keys HTrie.
+ *
+ * Copyright (C) 2025 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __HOPE_H__
+#define __HOPE_H__
+
+#include "htrie.h"
+
+#define TDB_HOPE_SYM_N		256
+/*
+ * The most significant bits of a key keep the compressed prefix of the
+ * string key and the rest bits are the hash of the whole string key.
+ */
+#define TDB_HOPE_PFX_BITS	48
+#define TDB_HOPE_CODE_MAX	32
+
+/**
+ * Order-preserving dictionary for the string keys bytes, see hope.c.
+ * The dictionary isn't stored in the database, so the same dictionary must
+ * be used for a database opened again.
+ *
+ * @code	- the byte codes aligned to the least significant bit;
+ * @len		- the code lengths in bits;
+ */
+typedef struct {
+	uint32_t	code[TDB_HOPE_SYM_N];
+	uint8_t		len[TDB_HOPE_SYM_N];
+} TdbHope;
+
+/**
+ * Count the bytes of the sample key @key to build a dictionary.
+ */
+static inline void
+tdb_hope_sample(unsigned long *freq, const char *key, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+		++freq[(unsigned char)key[i]];
+}
+
+EXTERN_C int tdb_hope_init(TdbHope *h, const unsigned long *freq);
+EXTERN_C size_t tdb_hope_enc_bits(const TdbHope *h, const char *key,
+				  size_t len);
+EXTERN_C uint64_t tdb_hope_key(const TdbHope *h, const char *key, size_t len);
+EXTERN_C unsigned int tdb_hope_pfx(const TdbHope *h, const char *pfx,
+				   size_t len, uint64_t *key);
+
+/*
+ * The HTrie API for the string keys. The keys are compressed to 64 bits,
+ * so the records with different string keys may have the same key and the
+ * callers must compare the string keys, just like for the hashed keys.
+ */
+static inline TdbRec *
+tdb_hope_insert(TdbHdr *dbh, const TdbHope *h, const char *key, size_t klen,
+		const void *data, size_t *len)
+{
+	return tdb_htrie_insert(dbh, tdb_hope_key(h, key, klen), data, len);
+}
+
+static inline TdbHtrieBucket *
+tdb_hope_lookup(TdbHdr *dbh, const TdbHope *h, const char *key, size_t klen)
+{
+	return tdb_htrie_lookup(dbh, tdb_hope_key(h, key, klen));
+}
+
+/**
+ * Walk the records with the string keys having the prefix @pfx. The shorter
+ * of the compressed prefix and TDB_HOPE_PFX_BITS is used, so @fn may get the
+ * records with other keys for the long prefixes.
+ */
+static inline int
+tdb_hope_walk_prefix(TdbHdr *dbh, const TdbHope *h, const char *pfx,
+		     size_t len, int (*fn)(void *))
+{
+	uint64_t key;
+	unsigned int bits = tdb_hope_pfx(h, pfx, len, &key);
+
+	return tdb_htrie_walk_prefix(dbh, key, bits, fn);
+}
+
+#endif /* __HOPE_H__ */
@@ -59,20 +59,33 @@ typedef struct {
 	uint32_t	shifts[TDB_HTRIE_FANOUT];
 } __attribute__((packed)) TdbHtrieNode;
 
-/*
- * Counter for events, when the same index node references
- * the same bucket twice.
- */
-static atomic_t g_burst_collision_no_mem;
-
 #define TDB_HTRIE_RESOLVED(b)		((b) + TDB_HTRIE_BITS > BITS_PER_LONG)
 /* Resolve al HTrie nodes but the root. Use for. */
 #define __HTRIE_IDX(k, b)		(((k) >> (b)) & TDB_HTRIE_KMASK)
+/* The same for the raw keys resolved from the most significant bits. */
+#define __HTRIE_RAW_IDX(k, b)		(((k) >> (BITS_PER_LONG - TDB_HTRIE_BITS \
+						 - (b))) & TDB_HTRIE_KMASK)
 #define __BCKT_ALIGNED(b)		!((uint64_t)b & (TDB_HTRIE_NODE_SZ - 1))
 
+/* Update the current CPU statistics, see tdb_htrie_info(). */
+#define TDB_HTRIE_STAT_ADD(dbh, name, n)				\
+	(this_cpu_ptr((dbh)->pcpu)->stat.name += (n))
+#define TDB_HTRIE_STAT_INC(dbh, name)	TDB_HTRIE_STAT_ADD(dbh, name, 1)
+
+/*
+ * Scan the buckets with AVX2 if the CPU supports it. This is set on the
+ * database initialization and is the same for all the databases.
+ */
+static bool tdb_htrie_avx2 __read_mostly;
+
 static uint32_t
 tdb_htrie_idx(TdbHdr *dbh, uint64_t key, int bits)
 {
+	if (unlikely(dbh->flags & TDB_F_RAWKEY)) {
+		if (!bits)
+			return key >> (BITS_PER_LONG - dbh->root_bits);
+		return __HTRIE_RAW_IDX(key, bits);
+	}
 	if (!bits)
 		return key & ((1 << dbh->root_bits) - 1);
 	return __HTRIE_IDX(key, bits);
@@ -84,64 +97,81 @@ tdb_htrie_idx_prev(TdbHdr *dbh, uint64_t key, int bits)
 	BUG_ON(bits < dbh->root_bits);
 
 	if (bits > dbh->root_bits)
-		return __HTRIE_IDX(key, bits - TDB_HTRIE_BITS);
-	return key & ((1 << dbh->root_bits) - 1);
+		return tdb_htrie_idx(dbh, key, bits - TDB_HTRIE_BITS);
+	return tdb_htrie_idx(dbh, key, 0);
 }
 
 static size_t
 tdb_hdr_sz(TdbHdr *dbh)
 {
 	return sizeof(TdbHdr)
-	       + sizeof(LfStack) * (dbh->rec_len ? 1 : 4);
+	       + sizeof(LfStack) * (dbh->rec_len ? 1 : TDB_HTRIE_DCACHE_MAX);
 }
 
 static size_t
 tdb_dbsz(TdbHdr *dbh)
 {
-	return dbh->alloc.ext_max * TDB_EXT_SZ;
+	/* @ext_max is the last extent id. */
+	return (READ_ONCE(dbh->alloc.ext_max) + 1) * TDB_EXT_SZ;
 }
 
+/*
+ * The per-CPU data dump is compact for the CPUs online on the database
+ * creation, see tdb_htrie_percpu_data_dump().
+ */
 static size_t
-tdb_htrie_pcpu_sz(void)
+tdb_htrie_pcpu_sz(TdbHdr *dbh)
 {
-	/*
-	 * TODO #2033: this should be converted to online CPUs,
-	 * at least for run-time.
-	 */
-	return sizeof(TdbPerCpu) * NR_CPUS;
+	return sizeof(TdbPerCpu) * dbh->pcpu_n;
 }
 
 static TdbPerCpu *
 tdb_htrie_pcpu(TdbHdr *dbh)
 {
-	return (TdbPerCpu *)((char *)dbh + tdb_htrie_pcpu_sz());
+	return (TdbPerCpu *)((char *)dbh + tdb_hdr_sz(dbh));
 }
 
 static size_t
 tdb_htrie_root_off(TdbHdr *dbh)
 {
-	return TDB_HTRIE_ALIGN(tdb_hdr_sz(dbh) + tdb_htrie_pcpu_sz());
+	return TDB_HTRIE_ALIGN(tdb_hdr_sz(dbh) + tdb_htrie_pcpu_sz(dbh));
+}
+
+static size_t
+tdb_htrie_root_sz(TdbHdr *dbh)
+{
+	return sizeof(TdbHtrieNode) << (dbh->root_bits - TDB_HTRIE_BITS);
 }
 
 /**
  * The root node may be larger than TDB_HTRIE_FANOUT.
+ * The root nodes of all the indexes follow each other.
  */
 static TdbHtrieNode *
-tdb_htrie_root(TdbHdr *dbh)
-{
-	return (TdbHtrieNode *)((char *)dbh + tdb_htrie_root_off(dbh));
-}
-
-static size_t
-tdb_htrie_root_sz(TdbHdr *dbh)
+tdb_htrie_root(TdbHdr *dbh, unsigned int idx)
 {
-	return sizeof(TdbHtrieNode) << (dbh->root_bits - TDB_HTRIE_BITS);
+	return (TdbHtrieNode *)((char *)dbh + tdb_htrie_root_off(dbh)
+				+ tdb_htrie_root_sz(dbh) * idx);
 }
 
 static void
 tdb_htrie_init_bucket(TdbHtrieBucket *b)
 {
 	b->col_map = 0;
+	b->col_ptr._val = 0;
+	b->ref_map = 0;
+}
+
+/**
+ * A bucket slot keeps the record metadata or the whole inplace record.
+ */
+static size_t
+tdb_htrie_bckt_slot_sz(TdbHdr *dbh)
+{
+	if (!tdb_inplace(dbh) || dbh->rec_len <= sizeof(((TdbRec *)0)->data))
+		return sizeof(TdbRec);
+
+	return offsetof(TdbRec, data) + ((dbh->rec_len + 7) & ~7UL);
 }
 
 static size_t
@@ -149,16 +179,18 @@ tdb_htrie_bckt_sz(TdbHdr *dbh)
 {
 	size_t n = sizeof(TdbHtrieBucket);
 
-	n += (TDB_HTRIE_COLL_MAX - TDB_HTRIE_BURST_MIN_BITS)
-	     * (sizeof(TdbRec) + dbh->rec_len * tdb_inplace(dbh));
+	n += dbh->bckt_slots * tdb_htrie_bckt_slot_sz(dbh);
 
 	return TDB_HTRIE_ALIGN(n);
 }
 
+/**
+ * The collision map bits below the bucket slots are used for the burst.
+ */
 static bool
-tdb_htrie_bckt_burst_threshold(uint64_t bit)
+tdb_htrie_bckt_burst_threshold(TdbHdr *dbh, uint64_t bit)
 {
-	return bit < TDB_HTRIE_BURST_MIN_BITS * 2;
+	return bit < (TDB_HTRIE_COLL_MAX - dbh->bckt_slots) * 2;
 }
 
 static void
@@ -167,6 +199,11 @@ tdb_htrie_get_bucket(TdbHdr *dbh, TdbHtrieBucket *bckt)
 	uint64_t bid = (uint64_t)bckt;
 
 	WRITE_ONCE(this_cpu_ptr(dbh->pcpu)->active_bckt, bid);
+	/*
+	 * Reclaimers must see the active bucket before we read the bucket
+	 * collision map, see tdb_htrie_rcl_seal().
+	 */
+	smp_mb();
 }
 
 static uint64_t
@@ -177,6 +214,10 @@ tdb_htrie_alloc_index(TdbHdr *dbh)
 
 	o = tdb_alloc_idx(&dbh->alloc, sizeof(TdbHtrieNode),
 			  &p->i_wcl, &p->flags);
+	if (unlikely(!o)) {
+		++p->stat.alloc_fail;
+		return 0;
+	}
 	BUG_ON(TDB_HTRIE_ALIGN(o) != o);
 
 	bzero_fast(TDB_PTR(dbh, o), sizeof(TdbHtrieNode));
@@ -192,6 +233,60 @@ tdb_htrie_rollback_index(TdbHdr *dbh, uint64_t o)
 	p->i_wcl = o;
 }
 
+/*
+ * Free buckets are linked into the global pool by their offsets in
+ * TDB_HTRIE_NODE_SZ units.
+ */
+#define TDB_HTRIE_BCKT_SHIFT		6
+
+/**
+ * Move the TDB_HTRIE_BCKT_BATCH last freed buckets of the current CPU to the
+ * global pool as one stack entry. The stack entry overlays @next of the first
+ * bucket, so the buckets of the batch are linked by @col_ptr.
+ */
+static void
+__htrie_bckt_pool_put(TdbHdr *dbh, TdbPerCpu *p)
+{
+	int i;
+	TdbHtrieBucket *first = TDB_PTR(dbh, p->free_bckt), *b = first;
+
+	BUILD_BUG_ON(1 << TDB_HTRIE_BCKT_SHIFT != TDB_HTRIE_NODE_SZ);
+
+	for (i = 1; i < TDB_HTRIE_BCKT_BATCH; ++i) {
+		b->col_ptr._val = b->next;
+		b = TDB_PTR(dbh, b->next);
+	}
+	p->free_bckt = b->next;
+	b->col_ptr._val = 0;
+	p->stat.free_bckt -= TDB_HTRIE_BCKT_BATCH;
+
+	lfs_push(&dbh->bckt_pool, (SEntry *)first,
+		 TDB_OFF(dbh, first) >> TDB_HTRIE_BCKT_SHIFT);
+}
+
+/**
+ * Move a batch of free buckets from the global pool to the current CPU,
+ * which has no free buckets.
+ */
+static void
+__htrie_bckt_pool_get(TdbHdr *dbh, TdbPerCpu *p)
+{
+	TdbHtrieBucket *b;
+	SEntry *e = lfs_pop(&dbh->bckt_pool, dbh, TDB_HTRIE_BCKT_SHIFT);
+
+	if (!e)
+		return;
+
+	p->free_bckt = TDB_OFF(dbh, e);
+	for (b = (TdbHtrieBucket *)e; b->col_ptr._val;
+	     b = TDB_PTR(dbh, b->next))
+	{
+		b->next = b->col_ptr._val;
+	}
+	b->next = 0;
+	p->stat.free_bckt += TDB_HTRIE_BCKT_BATCH;
+}
+
 static TdbHtrieBucket *
 tdb_htrie_alloc_bucket(TdbHdr *dbh)
 {
@@ -199,15 +294,20 @@ tdb_htrie_alloc_bucket(TdbHdr *dbh)
 	TdbHtrieBucket *b;
 	TdbPerCpu *p = this_cpu_ptr(dbh->pcpu);
 
-	/* Firstly check the per-cpu reclamation stack. */
+	/* Firstly check the per-cpu reclamation stack and the global pool. */
+	if (!p->free_bckt && !lfs_empty(&dbh->bckt_pool))
+		__htrie_bckt_pool_get(dbh, p);
 	if (p->free_bckt) {
 		b = TDB_PTR(dbh, p->free_bckt);
 		p->free_bckt = b->next;
+		--p->stat.free_bckt;
 	} else {
 		o = tdb_alloc_bckt(&dbh->alloc, tdb_htrie_bckt_sz(dbh),
 				   &p->b_wcl, &p->flags);
-		if (unlikely(!o))
+		if (unlikely(!o)) {
+			++p->stat.alloc_fail;
 			return NULL;
+		}
 		b = TDB_PTR(dbh, o);
 	}
 	BUG_ON(!__BCKT_ALIGNED(b));
@@ -223,11 +323,8 @@ tdb_htrie_alloc_bucket(TdbHdr *dbh)
  * Reclaim the bucket memory.
  * It's guaranteed that there is no users of the bucket.
  *
- * TODO with the current scheme of reclaiming all free buckets to per-cpu list
- * may lead that only one CPU have non-empty list and there is no free global
- * memory, so any other CPU will fail in memory allocations.
- * Need to return free buckets to the global memory after some theshold.
- * Check if we have other similar places of per-CPU data.
+ * The surplus of the per-CPU free buckets goes to the global pool, so a CPU
+ * reclaiming many buckets doesn't starve the other CPUs.
  */
 static void
 tdb_htrie_reclaim_bucket(TdbHdr *dbh, TdbHtrieBucket *b)
@@ -236,38 +333,153 @@ tdb_htrie_reclaim_bucket(TdbHdr *dbh, TdbHtrieBucket *b)
 
 	b->next = p->free_bckt;
 	p->free_bckt = TDB_OFF(dbh, b);
+	++p->stat.free_bckt;
+	++p->stat.rcl;
+
+	if (unlikely(p->stat.free_bckt > TDB_HTRIE_BCKT_FREE_MAX))
+		__htrie_bckt_pool_put(dbh, p);
 }
 
+/*
+ * Freed data chunks are linked into the caches by their offsets in 8-byte
+ * units, which is the minimal data alignment.
+ */
+#define TDB_HTRIE_DCACHE_SHIFT		3
+
+/*
+ * Size classes of the slabs: the first chunks of the small variable-length
+ * records are allocated as the slab objects, so the freed objects are reused
+ * for the records of the same size class. The largest class also reuses the
+ * chunks of the smallest data cache.
+ */
+#define TDB_HTRIE_SLAB_MAX		256
+#define TDB_HTRIE_NEED_SBLKS		(TDB_ALLOC_F_NEED_SBLK(TDB_HTRIE_SLAB_N) \
+					 - TDB_ALLOC_F_NEED_SBLK(0))
+static const unsigned short tdb_htrie_slab_sz[TDB_HTRIE_SLAB_N] = {
+	32, 48, 64, 96, 128, 192, TDB_HTRIE_SLAB_MAX
+};
+
+/**
+ * Data chunks freed by a reclamation batch, linked by @next, to be pushed to
+ * each data cache at once.
+ *
+ * @head	- the last freed chunk;
+ * @tail	- the first freed chunk;
+ */
+typedef struct {
+	SEntry		*head;
+	SEntry		*tail;
+} TdbDChain;
+
+/**
+ * Get a data cache to allocate a chunk of size @sz from.
+ * All the fixed-size records are of the same size, so the are kept in one
+ * cache. The caches of variable-sized records keep chunks of at least 256B,
+ * 512B, 1KB and 2KB correspondingly, so any chunk of a cache fits @sz.
+ */
 static LfStack *
 __htrie_dcache(TdbHdr *dbh, size_t sz)
 {
-	if (TDB_HTRIE_VARLENRECS(dbh))
+	if (!TDB_HTRIE_VARLENRECS(dbh))
 		return &dbh->dcache[0];
 
 	if (sz <= 256)
 		return &dbh->dcache[0];
 	if (sz <= 512)
-		return &dbh->dcache[2];
+		return &dbh->dcache[1];
 	if (sz <= 1024)
-		return &dbh->dcache[3];
+		return &dbh->dcache[2];
 	if (sz <= 2048)
-		return &dbh->dcache[4];
+		return &dbh->dcache[3];
+
+	return NULL;
+}
+
+/**
+ * @return the smallest slab size class for objects of size @sz.
+ */
+static int
+__htrie_slab(size_t sz)
+{
+	int c;
+
+	for (c = 0; sz > tdb_htrie_slab_sz[c]; ++c)
+		;
+
+	return c;
+}
+
+/**
+ * Get a data cache to put a freed chunk of size @sz to.
+ * The first chunks of variable-sized records up to TDB_HTRIE_SLAB_MAX bytes
+ * are the slab objects. The rest chunks of variable-sized records, which are
+ * smaller than 256 bytes, can not be reused.
+ */
+static LfStack *
+__htrie_dcache_free(TdbHdr *dbh, size_t sz, bool first)
+{
+	if (!TDB_HTRIE_VARLENRECS(dbh))
+		return &dbh->dcache[0];
+
+	if (first && sz <= TDB_HTRIE_SLAB_MAX)
+		return &dbh->dcache[TDB_HTRIE_DCACHE_SLAB(__htrie_slab(sz))];
+
+	if (sz >= 2048)
+		return &dbh->dcache[3];
+	if (sz >= 1024)
+		return &dbh->dcache[2];
+	if (sz >= 512)
+		return &dbh->dcache[1];
+	if (sz >= 256)
+		return &dbh->dcache[0];
 
 	return NULL;
 }
 
+/**
+ * Allocate an object of the slab size class @c. The freed objects of the
+ * class are reused first and a new slab block is taken from the extents when
+ * the current slab block of the CPU is exhausted.
+ */
+static uint64_t
+tdb_htrie_alloc_slab(TdbHdr *dbh, int c)
+{
+	uint64_t o;
+	SEntry *obj;
+	TdbPerCpu *p = this_cpu_ptr(dbh->pcpu);
+
+	/* See the FIXME in tdb_htrie_alloc_data() for the dcache pop. */
+	obj = lfs_pop(&dbh->dcache[TDB_HTRIE_DCACHE_SLAB(c)], dbh,
+		      TDB_HTRIE_DCACHE_SHIFT);
+	if (!obj && c == TDB_HTRIE_SLAB_N - 1)
+		obj = lfs_pop(&dbh->dcache[0], dbh, TDB_HTRIE_DCACHE_SHIFT);
+	if (obj)
+		return TDB_OFF(dbh, obj);
+
+	o = tdb_alloc_slab(&dbh->alloc, c, tdb_htrie_slab_sz[c], &p->s_wcl[c],
+			   &p->flags);
+	if (unlikely(!o))
+		++p->stat.alloc_fail;
+
+	return o;
+}
+
 static uint64_t
 tdb_htrie_alloc_data(TdbHdr *dbh, size_t *len, uint32_t align)
 {
 	bool varlen = TDB_HTRIE_VARLENRECS(dbh);
-	uint64_t overhead;
+	uint64_t o, overhead;
+	size_t req = *len;
 	TdbPerCpu *alloc_st = this_cpu_ptr(dbh->pcpu);
 	LfStack *dcache;
 
 	overhead = varlen ? sizeof(TdbVRec) : offsetof(TdbRec, data);
+	if (varlen && !align && *len + overhead <= TDB_HTRIE_SLAB_MAX)
+		return tdb_htrie_alloc_slab(dbh, __htrie_slab(*len + overhead));
 	dcache = __htrie_dcache(dbh, *len + overhead);
 
-	if (dcache && !lfs_empty(dcache)) {
+	/* Freed chunks aren't aligned for the subsequent record chunks. */
+	if (dcache && !align && !lfs_empty(dcache)) {
 		// FIXME: here we return SEntry, essencially an lfs_stack node,
 		// which can be referenced by another thread (consider 2 threads
 		// enter lfs_pop() and one of them is working with curr, while
@@ -275,161 +487,657 @@ tdb_htrie_alloc_data(TdbHdr *dbh, size_t *len, uint32_t align)
 		// data over the in-use stack node.
 		// We either need to fix in this code (e.g. extents preserve the
 		// SEntry nodes) or add real reclamation to lfs_stack.
-		SEntry *chunk = lfs_pop(dcache, dbh, 0);
+		SEntry *chunk = lfs_pop(dcache, dbh, TDB_HTRIE_DCACHE_SHIFT);
 		if (chunk)
 			return TDB_OFF(dbh, chunk);
 	}
 
-	return tdb_alloc_data(&dbh->alloc, overhead, len, &alloc_st->flags,
-			      &alloc_st->d_wcl, align, varlen);
+	o = tdb_alloc_data(&dbh->alloc, overhead, len, &alloc_st->flags,
+			   &alloc_st->d_wcl, align, varlen);
+	/*
+	 * A first chunk truncated to the block tail can't be told from a slab
+	 * object on freeing, if it's small, so leave the tail and use a new
+	 * block for the chunk.
+	 */
+	if (varlen && !align && o && *len + overhead <= TDB_HTRIE_SLAB_MAX) {
+		*len = req;
+		o = tdb_alloc_data(&dbh->alloc, overhead, len, &alloc_st->flags,
+				   &alloc_st->d_wcl, align, varlen);
+	}
+	if (unlikely(!o))
+		++alloc_st->stat.alloc_fail;
+
+	return o;
 }
 
+/**
+ * Free the data chunk at @addr of @size bytes, @first is true for the first
+ * chunk of a record. The chunks going to the data caches are collected in
+ * the chains @dc, if they aren't NULL, see tdb_htrie_free_data_flush().
+ */
 static void
-tdb_htrie_free_data(TdbHdr *dbh, void *addr, size_t size)
+tdb_htrie_free_data(TdbHdr *dbh, void *addr, size_t size, bool first,
+		    TdbDChain *dc)
 {
-	LfStack *dcache = __htrie_dcache(dbh, size);
+	LfStack *dcache;
 
-	if (dcache) {
-		SEntry *e = (SEntry *)addr;
-		lfs_entry_init(e);
-		lfs_push(dcache, e, 0);
-	} else {
-		BUG_ON(size != TDB_BLK_SZ);
+	if (size == TDB_BLK_SZ) {
+		BUG_ON((uint64_t)addr & ~TDB_BLK_MASK);
 		tdb_free_blk(&dbh->alloc, (uint64_t)addr);
+		return;
+	}
+
+	if ((dcache = __htrie_dcache_free(dbh, size, first))) {
+		SEntry *e = (SEntry *)addr;
+
+		if (!dc) {
+			lfs_entry_init(e);
+			lfs_push(dcache, e,
+				 TDB_OFF(dbh, e) >> TDB_HTRIE_DCACHE_SHIFT);
+			return;
+		}
+		dc += dcache - dbh->dcache;
+		e->next = dc->head
+			  ? TDB_OFF(dbh, dc->head) >> TDB_HTRIE_DCACHE_SHIFT
+			  : LFS_NIL;
+		if (!dc->tail)
+			dc->tail = e;
+		dc->head = e;
 	}
 }
 
 /**
- * Descend the the tree starting at the root.
- *
- * @retrurn byte offset of data (w/o TDB_HTRIE_DBIT bit) on success
- * or 0 if key @key was not found.
- * When function exits @node stores the last index node.
- * @bits - number of bits (from less significant to most significant) from
- * which we should start descending and the stored number of resolved bits.
- *
- * Least significant bits in our hash function have most entropy,
- * so we resolve the key from least significant bits to most significant.
- *
+ * Push the chains of the freed data chunks to the data caches.
  */
-static uint64_t
-tdb_htrie_descend(TdbHdr *dbh, uint64_t key, int *bits, TdbHtrieNode **node)
+static void
+tdb_htrie_free_data_flush(TdbHdr *dbh, TdbDChain *dc)
 {
-	uint64_t o;
-	int bits_inc;
-
-	if (!*bits) {
-		*node = tdb_htrie_root(dbh);
-		o = (*node)->shifts[key & ((1 << dbh->root_bits) - 1)];
-		bits_inc = dbh->root_bits;
-	} else {
-		BUG_ON(!*node);
-		o = (*node)->shifts[__HTRIE_IDX(key, *bits)];
-		bits_inc = TDB_HTRIE_BITS;
-	}
+	int i;
+
+	for (i = 0; i < TDB_HTRIE_DCACHE_MAX; ++i)
+		if (dc[i].head)
+			lfs_push_chain(&dbh->dcache[i],
+				       TDB_OFF(dbh, dc[i].head)
+				       >> TDB_HTRIE_DCACHE_SHIFT,
+				       dc[i].tail);
+}
 
-	while (o) {
-		BUG_ON(o && (TDB_I2O(o & ~TDB_HTRIE_DBIT)
-			     < tdb_hdr_sz(dbh) + sizeof(TdbExt)
-			     || TDB_I2O(o & ~TDB_HTRIE_DBIT) > tdb_dbsz(dbh)));
+/**
+ * The size of a data chunk with @len bytes of a record data.
+ */
+static size_t
+tdb_htrie_chunk_sz(TdbHdr *dbh, size_t len)
+{
+	if (!TDB_HTRIE_VARLENRECS(dbh))
+		return offsetof(TdbRec, data) + dbh->rec_len;
 
-		*bits += bits_inc;
+	return (sizeof(TdbVRec) + len + 7) & ~7UL;
+}
 
-		if (o & TDB_HTRIE_DBIT) {
-			/* We're at a data pointer - resolve it. */
-			o ^= TDB_HTRIE_DBIT;
-			BUG_ON(!o);
-			return TDB_I2O(o);
-		}
+/**
+ * Free all the data referenced by a record metadata at offset @off.
+ * @return the number of the freed bytes.
+ */
+static size_t
+tdb_htrie_free_rec_data(TdbHdr *dbh, uint64_t off, TdbDChain *dc)
+{
+	TdbVRec *vr;
+	uint32_t next;
+	size_t sz, n = 0;
+
+	if (!TDB_HTRIE_VARLENRECS(dbh)) {
+		sz = tdb_htrie_chunk_sz(dbh, dbh->rec_len);
+		tdb_htrie_free_data(dbh, TDB_PTR(dbh, off), sz, true, dc);
+		return sz;
+	}
 
-		*node = TDB_PTR(dbh, TDB_I2O(o));
-		bits_inc = TDB_HTRIE_BITS;
-		BUG_ON(TDB_HTRIE_RESOLVED(*bits));
-		o = (*node)->shifts[__HTRIE_IDX(key, *bits)];
+	for (vr = TDB_PTR(dbh, off); ; vr = TDB_PTR(dbh, TDB_D2O(next))) {
+		next = vr->chunk_next;
+		sz = tdb_htrie_chunk_sz(dbh, vr->len);
+		tdb_htrie_free_data(dbh, vr, sz, vr == TDB_PTR(dbh, off), dc);
+		n += sz;
+		if (!next)
+			break;
 	}
 
-	return 0; /* cannot descend deeper */
+	return n;
 }
 
 /**
- * Descend the index trie to lookup a bucket and return it with reclaim
- * protection.
- *
- * 1. get a bucket pointer from the last index node
- * 2. store the pointer in the per-CPU active_bckt
- * 3. check that the index pointer didn't change since we stored it
- *    (it's OK if the bucket has remove in progress bit set)
- * 4. tdb_htrie_put_bucket() must be called after tdb_htrie_descend()
+ * The number of bytes of the data referenced by a record metadata at @off.
  */
-static TdbHtrieBucket *
-tdb_htrie_descend_get_bckt(TdbHdr *dbh, uint64_t key, int *bits,
-			   TdbHtrieNode **node)
+static size_t
+tdb_htrie_rec_data_sz(TdbHdr *dbh, uint64_t off)
 {
-	TdbHtrieBucket *bckt;
-	uint64_t o;
+	TdbVRec *vr;
+	size_t n = 0;
 
-	o = tdb_htrie_descend(dbh, key, bits, node);
-	if (!o)
-		return NULL;
+	if (!TDB_HTRIE_VARLENRECS(dbh))
+		return tdb_htrie_chunk_sz(dbh, dbh->rec_len);
 
-	bckt = TDB_PTR(dbh, o);
-	tdb_htrie_get_bucket(dbh, bckt);
+	for (vr = TDB_PTR(dbh, off); ; vr = TDB_PTR(dbh, TDB_D2O(vr->chunk_next)))
+	{
+		n += tdb_htrie_chunk_sz(dbh, vr->len);
+		if (!vr->chunk_next)
+			break;
+	}
 
-	return bckt;
+	return n;
 }
 
-/**
- * Lookup an entry with the @key.
+/*
+ * Copy-on-write snapshots, see tdb_htrie_snapshot_begin().
  *
- * The HTrie may contain collisions for the same key (actually not only
- * collosions, but also full duplicates, e.g. a full stale web cache entry plus
- * to a new populating-in-progress entry)), so it returns a bucket handler and
- * it's the caller responsibility to call tdb_htrie_put_bucket() when it's done
- * with the bucket (a collision chain).
+ * The snapshot generation goes in steps of TDB_HTRIE_SNAP_GEN, so the less
+ * significant bits keep the snapshot state. A map entry, which owns a bucket
+ * copy, is marked with TDB_HTRIE_SNAP_COPY since the index nodes replacing
+ * a bucket share the bucket view.
+ */
+#define TDB_HTRIE_SNAP_ACTIVE		0x1
+#define TDB_HTRIE_SNAP_BROKEN		0x2
+#define TDB_HTRIE_SNAP_GEN		0x4
+#define TDB_HTRIE_SNAP_COPY		(1U << 31)
+
+/**
+ * Data of the records reclaimed while a snapshot is active, kept in bucket
+ * size blocks linked by @next, see tdb_htrie_snap_defer().
  *
- * TODO rework for TDB_F_INPLACE and metadata layer.
+ * @next	- offset of the next block or zero
+ * @n		- the number of records in the block
+ * @off		- offsets of the records data
  */
-TdbHtrieBucket *
-tdb_htrie_lookup(TdbHdr *dbh, uint64_t key)
-{
-	int bits = 0;
-	TdbHtrieBucket *bckt;
-	TdbHtrieNode *node;
+typedef struct {
+	uint64_t		next;
+	uint64_t		n;
+	uint64_t		off[0];
+} TdbHtrieDefer;
 
-	return tdb_htrie_descend_get_bckt(dbh, key, &bits, &node);
+/**
+ * The snapshot can't keep the database image any more, i.e. the snapshot map
+ * is full or there is no memory to copy a bucket, so it's dropped: the updates
+ * don't copy the buckets any more, but the memory is still kept until
+ * the snapshot ends.
+ */
+static void
+tdb_htrie_snap_break(TdbHdr *dbh, uint64_t gen)
+{
+	if (cmpxchg(&dbh->snap_gen, gen, gen | TDB_HTRIE_SNAP_BROKEN) == gen)
+		T_WARN("the snapshot of db %p is broken: too many updates"
+		       " or no memory for the bucket copies\n", dbh);
 }
 
-static void *
-tdb_htrie_create_rec(TdbHdr *dbh, uint64_t off, uint64_t key,
-		     const void *data, size_t len)
+/**
+ * Let tdb_htrie_snapshot_begin() know that the current CPU sees the snapshot,
+ * so it won't update the index without copying any more and the snapshot
+ * doesn't need to wait while the CPU leaves its reader session. A CPU, which
+ * waits for other CPUs in a reader session, must call the function, since
+ * the other CPUs may wait for the snapshot.
+ *
+ * The function may be called out of a reader session, so it doesn't access
+ * the snapshot, which may be freed by tdb_htrie_snapshot_end().
+ */
+static void
+tdb_htrie_snap_seen(TdbHdr *dbh)
 {
-	char *ptr = TDB_PTR(dbh, off);
-	void *r = (TdbRec *)ptr;
-
-	/* Invalid usage. */
-	BUG_ON(!data && !tdb_inplace(dbh));
-
-	if (TDB_HTRIE_VARLENRECS(dbh)) {
-		TdbVRec *vr = (TdbVRec *)ptr;
+	uint64_t gen = READ_ONCE(dbh->snap_gen) & ~TDB_HTRIE_SNAP_BROKEN;
+	TdbPerCpu *p = this_cpu_ptr(dbh->pcpu);
 
-		vr->chunk_next = 0;
-		vr->len = len;
+	if (likely(!(gen & TDB_HTRIE_SNAP_ACTIVE))
+	    || READ_ONCE(p->snap_gen) == gen)
+		return;
 
-		ptr += sizeof(TdbVRec);
-	} else {
-		TdbRec *fr = (TdbRec *)ptr;
+	WRITE_ONCE(p->snap_gen, gen);
+	smp_mb();
+}
 
-		BUG_ON(len != dbh->rec_len);
+/**
+ * Get the active snapshot for an update of the index in a reader session.
+ * A CPU, which finds the snapshot not ready yet, waits while the CPUs, which
+ * don't see the snapshot, leave their reader sessions.
+ */
+static TdbSnap *
+tdb_htrie_snap(TdbHdr *dbh)
+{
+	TdbSnap *s = READ_ONCE(dbh->snap);
 
-		fr->key = key;
+	if (likely(!s))
+		return NULL;
 
-		ptr = fr->data;
+	/* The snapshot generation may be not set yet. */
+	while (unlikely(!READ_ONCE(s->ready))) {
+		tdb_htrie_snap_seen(dbh);
+		cpu_relax();
 	}
+	if (READ_ONCE(dbh->snap_gen) & TDB_HTRIE_SNAP_BROKEN)
+		return NULL;
 
-	if (data)
-		memcpy_fast(ptr, data, len);
+	return s;
+}
 
-	return r;
+static unsigned int
+__htrie_snap_hash(TdbSnap *s, uint32_t key)
+{
+	return (key * 0x61c88647U) >> (32 - s->bits); /* GOLDEN_RATIO_32 */
+}
+
+/**
+ * Find the view of a bucket or an index node with index @key.
+ *
+ * @return the index of the bucket copy, zero for an empty view or -ENOENT
+ * if the bucket isn't changed since the snapshot beginning.
+ */
+static long
+__htrie_snap_lookup(TdbSnap *s, uint32_t key)
+{
+	unsigned int n, mask = (1U << s->bits) - 1;
+	unsigned int i = __htrie_snap_hash(s, key);
+	uint64_t e;
+
+	for (n = 0; n <= mask; ++n, i = (i + 1) & mask) {
+		if (!(e = READ_ONCE(s->map[i])))
+			break;
+		if (e >> 32 == key)
+			return (uint32_t)e & ~TDB_HTRIE_SNAP_COPY;
+	}
+
+	return -ENOENT;
+}
+
+/**
+ * Map a bucket or an index node with index @key to the view @val unless it
+ * already has a view. The entries are never removed, so the CPUs just race
+ * for the first empty entry.
+ *
+ * @return the mapped view with TDB_HTRIE_SNAP_COPY or -ENOSPC.
+ */
+static long
+__htrie_snap_map(TdbSnap *s, uint32_t key, uint32_t val)
+{
+	unsigned int n, mask = (1U << s->bits) - 1;
+	unsigned int i = __htrie_snap_hash(s, key);
+	uint64_t e, x = (uint64_t)key << 32 | val;
+
+	for (n = 0; n <= mask; ++n, i = (i + 1) & mask) {
+		if (!(e = READ_ONCE(s->map[i]))) {
+			if (atomic_read(&s->used) >= s->max)
+				break;
+			if (!(e = cmpxchg(&s->map[i], 0, x))) {
+				atomic_inc(&s->used);
+				return val;
+			}
+		}
+		if (e >> 32 == key)
+			return (uint32_t)e;
+	}
+
+	return -ENOSPC;
+}
+
+/**
+ * Copy bucket @b, which is going to be updated, for the snapshot @s unless
+ * the bucket already has a view. The copy is mapped before the update, so
+ * the snapshot walker, which doesn't find the bucket in the map after it
+ * read the bucket, has read the bucket as it was on the snapshot beginning.
+ *
+ * The bucket can't be updated by the other CPUs until it's mapped, so all
+ * the concurrent copies are the same.
+ *
+ * @return the view of the bucket or a negative value if the snapshot is
+ * broken.
+ */
+static long
+__htrie_snap_cow(TdbHdr *dbh, TdbSnap *s, TdbHtrieBucket *b)
+{
+	uint32_t key = TDB_O2I(TDB_OFF(dbh, b)), val;
+	TdbHtrieBucket *c;
+	long v;
+
+	if ((v = __htrie_snap_lookup(s, key)) >= 0)
+		return v;
+
+	if (!(c = tdb_htrie_alloc_bucket(dbh)))
+		goto broken;
+	memcpy_fast(c, b, tdb_htrie_bckt_sz(dbh));
+
+	val = TDB_O2I(TDB_OFF(dbh, c)) | TDB_HTRIE_SNAP_COPY;
+	if ((v = __htrie_snap_map(s, key, val)) == val) {
+		TDB_HTRIE_STAT_INC(dbh, cow);
+		return val & ~TDB_HTRIE_SNAP_COPY;
+	}
+
+	/* Nobody saw the copy, so we can reuse it immediately. */
+	tdb_htrie_reclaim_bucket(dbh, c);
+	if (v >= 0)
+		return v & ~TDB_HTRIE_SNAP_COPY;
+broken:
+	tdb_htrie_snap_break(dbh, s->gen);
+
+	return -ENOMEM;
+}
+
+/**
+ * Copy bucket @b for the active snapshot before an update of the bucket.
+ */
+static void
+tdb_htrie_snap_cow(TdbHdr *dbh, TdbHtrieBucket *b)
+{
+	TdbSnap *s = tdb_htrie_snap(dbh);
+
+	if (unlikely(s))
+		__htrie_snap_cow(dbh, s, b);
+}
+
+/**
+ * Map a new index node or bucket at offset @o, which is going to be linked
+ * with the index instead of bucket @b or an empty slot if @b is NULL, to the
+ * view of @b. The snapshot walker finds the view by the new link, so it never
+ * descends into the subtrees created since the snapshot beginning.
+ */
+static void
+tdb_htrie_snap_link(TdbHdr *dbh, uint64_t o, TdbHtrieBucket *b)
+{
+	TdbSnap *s = tdb_htrie_snap(dbh);
+	long v = 0;
+
+	if (likely(!s))
+		return;
+	if (b && (v = __htrie_snap_cow(dbh, s, b)) < 0)
+		return;
+	if (__htrie_snap_map(s, TDB_O2I(o), v) < 0)
+		tdb_htrie_snap_break(dbh, s->gen);
+}
+
+/**
+ * Free the data of the records kept for a snapshot, which has ended.
+ */
+static void
+tdb_htrie_snap_defer_free(TdbHdr *dbh, TdbRcl *rcl)
+{
+	TdbDChain dc[TDB_HTRIE_DCACHE_MAX] = {};
+
+	while (rcl->defer) {
+		TdbHtrieDefer *d = TDB_PTR(dbh, rcl->defer);
+		int i;
+
+		for (i = 0; i < d->n; ++i)
+			TDB_HTRIE_STAT_ADD(dbh, data,
+					   -tdb_htrie_free_rec_data(dbh,
+								    d->off[i],
+								    dc));
+		rcl->defer = d->next;
+		tdb_htrie_reclaim_bucket(dbh, (TdbHtrieBucket *)d);
+	}
+
+	tdb_htrie_free_data_flush(dbh, dc);
+}
+
+/**
+ * Keep the data at @off of a reclaimed record while a snapshot is active,
+ * since the snapshot walker may still visit the record. The data of the
+ * records removed before the snapshot beginning are also kept, so the
+ * reclamation doesn't need to synchronize with the snapshot beginning.
+ *
+ * @return false if the data must be freed right now.
+ */
+static bool
+tdb_htrie_snap_defer(TdbHdr *dbh, TdbRcl *rcl, uint64_t off)
+{
+	uint64_t gen = READ_ONCE(dbh->snap_gen) & ~TDB_HTRIE_SNAP_BROKEN;
+	size_t max = (tdb_htrie_bckt_sz(dbh) - sizeof(TdbHtrieDefer))
+		     / sizeof(uint64_t);
+	TdbHtrieDefer *d = NULL;
+
+	if (likely(!(gen & TDB_HTRIE_SNAP_ACTIVE)))
+		return false;
+
+	if (rcl->defer && rcl->defer_gen != gen)
+		tdb_htrie_snap_defer_free(dbh, rcl);
+	if (rcl->defer)
+		d = TDB_PTR(dbh, rcl->defer);
+	if (!d || d->n == max) {
+		if (!(d = (TdbHtrieDefer *)tdb_htrie_alloc_bucket(dbh))) {
+			tdb_htrie_snap_break(dbh, gen);
+			return false;
+		}
+		d->next = rcl->defer;
+		d->n = 0;
+		rcl->defer = TDB_OFF(dbh, d);
+		rcl->defer_gen = gen;
+	}
+	d->off[d->n++] = off;
+
+	return true;
+}
+
+/**
+ * Descend the the tree starting at the root.
+ *
+ * @retrurn byte offset of data (w/o TDB_HTRIE_DBIT bit) on success
+ * or 0 if key @key was not found.
+ * When function exits @node stores the last index node.
+ * @bits - number of bits (from less significant to most significant) from
+ * which we should start descending and the stored number of resolved bits.
+ * @node must be the root node of the index if @bits is zero.
+ *
+ * Least significant bits in our hash function have most entropy,
+ * so we resolve the key from least significant bits to most significant.
+ * The raw keys (TDB_F_RAWKEY) are resolved in the opposite direction.
+ *
+ */
+static uint64_t
+tdb_htrie_descend(TdbHdr *dbh, uint64_t key, int *bits, TdbHtrieNode **node)
+{
+	uint64_t o;
+	int bits_inc;
+
+	BUG_ON(!*node);
+
+	o = (*node)->shifts[tdb_htrie_idx(dbh, key, *bits)];
+	bits_inc = *bits ? TDB_HTRIE_BITS : dbh->root_bits;
+
+	while (o) {
+		BUG_ON(o && (TDB_I2O(o & ~TDB_HTRIE_DBIT)
+			     < tdb_hdr_sz(dbh) + sizeof(TdbExt)
+			     || TDB_I2O(o & ~TDB_HTRIE_DBIT) > tdb_dbsz(dbh)));
+
+		*bits += bits_inc;
+
+		if (o & TDB_HTRIE_DBIT) {
+			/* We're at a data pointer - resolve it. */
+			o ^= TDB_HTRIE_DBIT;
+			BUG_ON(!o);
+			return TDB_I2O(o);
+		}
+
+		*node = TDB_PTR(dbh, TDB_I2O(o));
+		bits_inc = TDB_HTRIE_BITS;
+		BUG_ON(TDB_HTRIE_RESOLVED(*bits));
+		o = (*node)->shifts[tdb_htrie_idx(dbh, key, *bits)];
+	}
+
+	return 0; /* cannot descend deeper */
+}
+
+/**
+ * Descend the index trie to lookup a bucket and return it with reclaim
+ * protection.
+ *
+ * 1. get a bucket pointer from the last index node
+ * 2. store the pointer in the per-CPU active_bckt
+ * 3. check that the index pointer didn't change since we stored it
+ *    (it's OK if the bucket has remove in progress bit set)
+ * 4. tdb_htrie_put_bucket() must be called after tdb_htrie_descend()
+ */
+static TdbHtrieBucket *
+tdb_htrie_descend_get_bckt(TdbHdr *dbh, uint64_t key, int *bits,
+			   TdbHtrieNode **node)
+{
+	TdbHtrieBucket *bckt;
+	uint64_t o;
+
+	/*
+	 * Enter the reader session before the descent: the bucket can be
+	 * retired by a burst just after we read its offset from the index.
+	 */
+	tdb_htrie_get_bucket(dbh, (TdbHtrieBucket *)*node);
+
+	o = tdb_htrie_descend(dbh, key, bits, node);
+	TDB_HTRIE_STAT_INC(dbh, lookup);
+	TDB_HTRIE_STAT_ADD(dbh, depth, *bits);
+	if (!o) {
+		tdb_htrie_put_bucket(dbh);
+		return NULL;
+	}
+
+	bckt = TDB_PTR(dbh, o);
+	tdb_htrie_get_bucket(dbh, bckt);
+
+	return bckt;
+}
+
+/**
+ * Lookup an entry with the @key.
+ *
+ * The HTrie may contain collisions for the same key (actually not only
+ * collosions, but also full duplicates, e.g. a full stale web cache entry plus
+ * to a new populating-in-progress entry)), so it returns a bucket handler and
+ * it's the caller responsibility to call tdb_htrie_put_bucket() when it's done
+ * with the bucket (a collision chain).
+ *
+ * TODO rework for TDB_F_INPLACE and metadata layer.
+ */
+TdbHtrieBucket *
+tdb_htrie_lookup(TdbHdr *dbh, uint64_t key)
+{
+	return tdb_htrie_lookup_idx(dbh, 0, key);
+}
+
+/**
+ * Lookup an entry with the @key in the index @idx. The buckets of all the
+ * indexes reference the same records, so tdb_htrie_bscan_for_rec() returns
+ * the same record for the keys of the record in the different indexes.
+ */
+TdbHtrieBucket *
+tdb_htrie_lookup_idx(TdbHdr *dbh, unsigned int idx, uint64_t key)
+{
+	int bits = 0;
+	TdbHtrieNode *node = tdb_htrie_root(dbh, idx);
+
+	BUG_ON(idx >= dbh->idx_n);
+
+	return tdb_htrie_descend_get_bckt(dbh, key, &bits, &node);
+}
+
+/**
+ * Lookup buckets for @n keys @keys at once and store them in @out (NULL for
+ * keys which aren't in the index) in the same order.
+ *
+ * The descents for all the keys are done in lockstep: on each step we
+ * prefetch the next index nodes or buckets for all the keys before we read
+ * any of them, so the memory accesses for different keys go in parallel.
+ *
+ * All the found buckets are observed in the same reader session, so the
+ * caller must call tdb_htrie_put_bucket() once after processing all of them
+ * if the function found anything.
+ *
+ * @return the number of found buckets.
+ */
+int
+tdb_htrie_lookup_batch(TdbHdr *dbh, const uint64_t *keys, int n,
+		       TdbHtrieBucket **out)
+{
+	int i, k, m, next, found = 0;
+	int bits[TDB_HTRIE_LOOKUP_BATCH];
+	uint32_t o[TDB_HTRIE_LOOKUP_BATCH];
+	TdbHtrieNode *node, *root = tdb_htrie_root(dbh, 0);
+
+	tdb_htrie_get_bucket(dbh, (TdbHtrieBucket *)root);
+
+	for (k = 0; k < n; k += TDB_HTRIE_LOOKUP_BATCH) {
+		m = n - k < TDB_HTRIE_LOOKUP_BATCH
+		    ? n - k : TDB_HTRIE_LOOKUP_BATCH;
+
+		for (i = 0; i < m; ++i)
+			prefetch(&root->shifts[tdb_htrie_idx(dbh, keys[k + i],
+							     0)]);
+		for (i = 0; i < m; ++i) {
+			o[i] = root->shifts[tdb_htrie_idx(dbh, keys[k + i], 0)];
+			bits[i] = dbh->root_bits;
+			if (o[i])
+				prefetch(TDB_PTR(dbh, TDB_I2O(o[i]
+							      & ~TDB_HTRIE_DBIT)));
+		}
+
+		do {
+			next = 0;
+			for (i = 0; i < m; ++i) {
+				if (!o[i] || (o[i] & TDB_HTRIE_DBIT))
+					continue;
+				BUG_ON(TDB_HTRIE_RESOLVED(bits[i]));
+
+				node = TDB_PTR(dbh, TDB_I2O(o[i]));
+				o[i] = node->shifts[tdb_htrie_idx(dbh,
+								  keys[k + i],
+								  bits[i])];
+				bits[i] += TDB_HTRIE_BITS;
+				if (!o[i])
+					continue;
+				prefetch(TDB_PTR(dbh, TDB_I2O(o[i]
+							      & ~TDB_HTRIE_DBIT)));
+				next += !(o[i] & TDB_HTRIE_DBIT);
+			}
+		} while (next);
+
+		for (i = 0; i < m; ++i) {
+			if (!(o[i] & TDB_HTRIE_DBIT)) {
+				out[k + i] = NULL;
+				continue;
+			}
+			out[k + i] = TDB_PTR(dbh, TDB_I2O(o[i]
+							  ^ TDB_HTRIE_DBIT));
+			BUG_ON(!__BCKT_ALIGNED(out[k + i]));
+			++found;
+		}
+	}
+
+	TDB_HTRIE_STAT_ADD(dbh, lookup, n);
+	if (!found)
+		tdb_htrie_put_bucket(dbh);
+
+	return found;
+}
+
+static void *
+tdb_htrie_create_rec(TdbHdr *dbh, uint64_t off, uint64_t key,
+		     const void *data, size_t len)
+{
+	char *ptr = TDB_PTR(dbh, off);
+	void *r = (TdbRec *)ptr;
+
+	/* Invalid usage. */
+	BUG_ON(!data && !tdb_inplace(dbh));
+
+	if (TDB_HTRIE_VARLENRECS(dbh)) {
+		TdbVRec *vr = (TdbVRec *)ptr;
+
+		vr->chunk_next = 0;
+		vr->len = len;
+
+		ptr += sizeof(TdbVRec);
+	} else {
+		TdbRec *fr = (TdbRec *)ptr;
+
+		BUG_ON(len != dbh->rec_len);
+
+		fr->key = key;
+
+		ptr = fr->data;
+	}
+
+	if (data)
+		memcpy_fast(ptr, data, len);
+
+	return r;
 }
 
 /**
@@ -437,10 +1145,9 @@ tdb_htrie_create_rec(TdbHdr *dbh, uint64_t off, uint64_t key,
  * A caller is appreciated to pass the last record chunk by @rec.
  *
  * The function is called to extend just added new record, so it's not expected
- * that it can be called concurrently for the same record.
- * FIXME: with the statement above, it seems we must mark the record as in progress
- * to not to allow other threads to update it (consider cuncurrent insertion of the
- * same cache entry). It seems the retry loop isn't needed in the function.
+ * that it can be called concurrently for the same record. The record should
+ * be created by tdb_htrie_insert_begin() to be invisible for other CPUs until
+ * all the chunks are added.
  */
 TdbVRec *
 tdb_htrie_extend_rec(TdbHdr *dbh, TdbVRec *rec, size_t size)
@@ -454,6 +1161,7 @@ tdb_htrie_extend_rec(TdbHdr *dbh, TdbVRec *rec, size_t size)
 	if (!(o = tdb_htrie_alloc_data(dbh, &size, TDB_LARGE_ALLOC_ALIGN)))
 		return NULL;
 
+	TDB_HTRIE_STAT_ADD(dbh, data, tdb_htrie_chunk_sz(dbh, size));
 	chunk = TDB_PTR(dbh, o);
 	chunk->chunk_next = 0;
 	chunk->len = size;
@@ -469,9 +1177,20 @@ retry:
 }
 
 static TdbRec *
-__htrie_bckt_rec(TdbHtrieBucket *b, int slot)
+__htrie_bckt_rec(TdbHdr *dbh, TdbHtrieBucket *b, int slot)
 {
-	return (TdbRec *)(b + 1) + slot;
+	return (TdbRec *)((char *)(b + 1) + slot * tdb_htrie_bckt_slot_sz(dbh));
+}
+
+/**
+ * Get a record by its metadata in a bucket slot.
+ */
+static void *
+tdb_htrie_rec_ptr(TdbHdr *dbh, TdbRec *r)
+{
+	if (tdb_inplace(dbh))
+		return r;
+	return TDB_PTR(dbh, r->off);
 }
 
 static int
@@ -489,65 +1208,126 @@ __htrie_bckt_slot2bit(int slot)
 	return (TDB_HTRIE_COLL_MAX - 1 - slot) * 2;
 }
 
-static uint32_t
-__htrie_bckt_slot2fix_bit(int slot)
+/**
+ * Get the slot state from the bucket collision map @map.
+ */
+static unsigned int
+__htrie_bckt_slot_state(uint64_t map, int slot)
+{
+	return (map >> __htrie_bckt_slot2bit(slot)) & 3;
+}
+
+static bool
+__htrie_bckt_slot_live(TdbHtrieBucket *b, int slot)
+{
+	return __htrie_bckt_slot_state(READ_ONCE(b->col_map), slot)
+	       == TDB_HTRIE_SLOT_REC;
+}
+
+/**
+ * Mark the record in slot @slot as recently used for the eviction sweeps.
+ * Hot records are found with the bit already set, so they pay just a read
+ * of the bucket header cache line and no locked operations.
+ */
+static void
+__htrie_bckt_ref(TdbHtrieBucket *b, int slot)
+{
+	if (!(READ_ONCE(b->ref_map) & (1UL << slot)))
+		set_bit(slot, (unsigned long *)&b->ref_map);
+}
+
+/*
+ * The less significant bits of all the slots in the bucket collision map.
+ * The rest of the map bits are used for the bucket burst.
+ */
+static uint64_t
+__htrie_bckt_slots_mask(TdbHdr *dbh)
+{
+	return 0x5555555555555555UL
+	       << (2 * (TDB_HTRIE_COLL_MAX - dbh->bckt_slots));
+}
+
+/**
+ * Returns non-zero if the collision map @map has slots being written.
+ */
+static uint64_t
+__htrie_bckt_writes(TdbHdr *dbh, uint64_t map)
 {
-	return __htrie_bckt_slot2bit(slot) + 1;
+	return map & (map >> 1) & __htrie_bckt_slots_mask(dbh);
 }
 
 /**
- * Fix a record in the bucket collision map by setting the second bit.
+ * Returns non-zero if the collision map @map has tombstones.
+ */
+static uint64_t
+__htrie_bckt_tombstones(TdbHdr *dbh, uint64_t map)
+{
+	return map & ~(map >> 1) & __htrie_bckt_slots_mask(dbh);
+}
+
+/**
+ * Fix a record in the bucket collision map by clearing the second bit.
  * The bucket collision map is organized as 32 bit pairs, which are set as:
  *
  *   1. both bits the pair are zero, i.e. the slot is empty
  *
- *   2. set the less significant bit with __htrie_bckt_acquire_empty_slot() -
- *      acquire the slot, but the data in the bucket is still undefined
+ *   2. set both the bits with __htrie_bckt_acquire_empty_slot() - acquire
+ *      the slot, but the data in the bucket is still undefined
  *
  *   3. write the data in the slot
  *
- *   4. set the most significant bit the pair, fixing the record.
+ *   4. clear the less significant bit the pair, fixing the record.
  *
- * If the less significant bit is empty, then there is no record. If bot of the
- * bitst are set, then the record can be accessed. If only the less significant
- * bit is set, then just wait a little bit (spin).
- * TODO process the flag on lookup
+ * Readers access only the records with the most significant bit set and the
+ * less significant bit clear. Removal moves a record to the tombstone state
+ * (only the less significant bit is set), see tdb_htrie_remove().
  */
 static void
 __htrie_bckt_fix_rec(TdbHtrieBucket *b, int slot)
 {
-	unsigned int bit = __htrie_bckt_slot2fix_bit(slot);
+	unsigned int bit = __htrie_bckt_slot2bit(slot);
 
 	BUG_ON(bit >= BITS_PER_LONG);
-	BUG_ON(!(bit & 1));
+	BUG_ON(bit & 1);
 
-	set_bit(bit, &b->col_map);
+	sync_clear_bit(bit, &b->col_map);
 }
 
 /**
  * Returns the acquired slot index.
  */
 static int
-__htrie_bckt_acquire_empty_slot(TdbHtrieBucket *b)
+__htrie_bckt_acquire_empty_slot(TdbHdr *dbh, TdbHtrieBucket *b)
 {
-	static const uint64_t mask = 0xaaaaaaaaaaaaaaaaUL;
-	uint64_t bm, b_free;
+	static const uint64_t mask = 0x5555555555555555UL;
+	uint64_t map, bm, b_free;
 
 	/*
-	 * Try to acquire the empty slot and
-	 * repeat if the bit is already acquired.
+	 * A slot is empty only if both the bits are clear: tombstones can not
+	 * be reused until they're reclaimed. A frozen bucket must be bursted
+	 * before any insertions. Try to acquire the empty slot,
+	 * moving it to the write in progress state, and repeat if the bucket
+	 * was concurrently updated. An active snapshot gets the bucket copy
+	 * before the update.
 	 */
 	do {
-		bm = ~(b->col_map | mask);
+		map = READ_ONCE(b->col_map);
+		if (map & (1UL << TDB_HTRIE_BCKT_BURST))
+			return -1;
+		bm = ~(map | (map >> 1)) & mask;
 		if (unlikely(!bm))
 			return -1;
 
 		b_free = fls64(bm);
 		BUG_ON(b_free & 1);
 
-		if (tdb_htrie_bckt_burst_threshold(b_free))
+		if (tdb_htrie_bckt_burst_threshold(dbh, b_free))
 			return -1;
-	} while (sync_test_and_set_bit(b_free, &b->col_map));
+		tdb_htrie_snap_cow(dbh, b);
+		if (cmpxchg(&b->col_map, map, map | (3UL << b_free)) == map)
+			break;
+		TDB_HTRIE_STAT_INC(dbh, retry);
+	} while (true);
 
 	return __htrie_bckt_bit2slot(b_free);
 }
@@ -559,7 +1339,7 @@ static void
 __htrie_bckt_write_rec(TdbHdr *dbh, TdbHtrieBucket *b, uint64_t key,
 		       const void *data, size_t len, int slot, TdbRec **rec)
 {
-	TdbRec *r = __htrie_bckt_rec(b, slot);
+	TdbRec *r = __htrie_bckt_rec(dbh, b, slot);
 
 	if (tdb_inplace(dbh)) {
 		uint64_t o = TDB_OFF(dbh, r);
@@ -575,7 +1355,7 @@ static int
 __htrie_bckt_new_rec(TdbHdr *dbh, TdbHtrieBucket *b, uint64_t key,
 		     const void *data, size_t len, TdbRec **rec)
 {
-	int slot = __htrie_bckt_acquire_empty_slot(b);
+	int slot = __htrie_bckt_acquire_empty_slot(dbh, b);
 
 	if (slot < 0)
 		return slot;
@@ -586,31 +1366,6 @@ __htrie_bckt_new_rec(TdbHdr *dbh, TdbHtrieBucket *b, uint64_t key,
 	return 0;
 }
 
-/**
- * Copy @rec to bucket @b. A new slot in @b will be allocated.
- * Contact: there is only one user of @b and it has enough space.
- */
-static int
-__htrie_bckt_copy_metadata(TdbHdr *dbh, TdbHtrieBucket *b, TdbRec *rec)
-{
-	int slot = __htrie_bckt_acquire_empty_slot(b);
-	if (slot < 0)
-		return slot;
-
-	if (tdb_inplace(dbh)) {
-		uint64_t o = TDB_OFF(dbh, __htrie_bckt_rec(b, slot));
-		tdb_htrie_create_rec(dbh, o, rec->key, rec->data, dbh->rec_len);
-	} else {
-		TdbRec *meta = __htrie_bckt_rec(b, slot);
-		meta->key = rec->key;
-		meta->off = rec->off;
-	}
-
-	__htrie_bckt_fix_rec(b, slot);
-
-	return 0;
-}
-
 /**
  * Create a new bucket with the record metadata or already inserted record
  * in case of inplace database.
@@ -619,8 +1374,7 @@ static int
 __htrie_insert_new_bckt(TdbHdr *dbh, uint64_t key, int bits, TdbHtrieNode *node,
 			const void *data, size_t *len, TdbRec **rec)
 {
-	uint64_t o;
-	int i, b_link;
+	int i, r, b_link;
 	TdbHtrieBucket *bckt;
 
 	if (!(bckt = tdb_htrie_alloc_bucket(dbh)))
@@ -629,11 +1383,20 @@ __htrie_insert_new_bckt(TdbHdr *dbh, uint64_t key, int bits, TdbHtrieNode *node,
 	__htrie_bckt_write_rec(dbh, bckt, key, data, *len, 0, rec);
 
 	/* Just allocated and unreferenced bucket with no other users. */
-	bckt->col_map = 3UL << __htrie_bckt_slot2bit(0);
+	bckt->col_map = (uint64_t)TDB_HTRIE_SLOT_REC << __htrie_bckt_slot2bit(0);
+
+	/*
+	 * The snapshots are synchronized with the index updates by the reader
+	 * sessions, so link the bucket in a session.
+	 */
+	tdb_htrie_get_bucket(dbh, (TdbHtrieBucket *)node);
+	tdb_htrie_snap_link(dbh, TDB_OFF(dbh, bckt), NULL);
 
 	b_link = TDB_O2I(TDB_OFF(dbh, bckt)) | TDB_HTRIE_DBIT;
 	i = tdb_htrie_idx(dbh, key, bits);
-	if (atomic_cmpxchg((atomic_t *)&node->shifts[i], 0, b_link) == 0)
+	r = atomic_cmpxchg((atomic_t *)&node->shifts[i], 0, b_link);
+	tdb_htrie_put_bucket(dbh);
+	if (!r)
 		return 0;
 
 	/* Somebody already created the new index branch. */
@@ -642,221 +1405,435 @@ __htrie_insert_new_bckt(TdbHdr *dbh, uint64_t key, int bits, TdbHtrieNode *node,
 	return -EAGAIN;
 }
 
-// TODO handle partially created & partially removed records
-static int
-__htrie_bckt_reinsert_records(TdbHdr *dbh, TdbHtrieBucket *b, uint64_t map,
-			  int bits, TdbHtrieNode *in, uint64_t *new_map,
-			  bool no_mem_fail)
+/**
+ * Take a snapshot of the readers generations of all the CPUs.
+ * A CPU, which doesn't observe any bucket at the moment, can not reference
+ * any of the tombstones, so we don't need to wait for it.
+ *
+ * The tombstones are set by atomic operations, so if we don't see an active
+ * bucket of a CPU, then the CPU will see the tombstones, see
+ * tdb_htrie_get_bucket().
+ */
+static void
+tdb_htrie_rcl_seal(TdbHdr *dbh, TdbRclBatch *rb)
 {
-	int s, i, ret;
-	TdbRec *r;
-	TdbHtrieBucket *b_new;
+	int cpu;
 
-	/*
-	 * The function is called on burst only, so the bucket is presumably
-	 * full and all the slots are occuped.
-	 *
-	 * TODO check safety against removal.
-	 */
-	for (s = 0; s < TDB_HTRIE_BCKT_SLOTS_N; ++s) {
-		uint64_t slt_bits = 3UL << __htrie_bckt_slot2bit(s);
+	for_each_online_cpu(cpu) {
+		TdbPerCpu *p = per_cpu_ptr(dbh->pcpu, cpu);
+
+		rb->gen[cpu] = READ_ONCE(p->gen);
+		if (!READ_ONCE(p->active_bckt))
+			rb->gen[cpu] = TDB_HTRIE_RCL_QUIESCENT;
+	}
+}
 
-		// FIXME we should see full `map` here, but this doesn't happen
-		BUG_ON(!(map & slt_bits));
+/**
+ * Check whether all the CPUs passed through the generations of the batch,
+ * i.e. no CPU can reference any of the tombstones in the batch, and spin
+ * waiting for the CPUs if @wait is true.
+ *
+ * The current CPU can not observe the tombstones in the middle of the call.
+ */
+static bool
+tdb_htrie_rcl_quiescent(TdbHdr *dbh, TdbRclBatch *rb, bool wait)
+{
+	int cpu;
 
-		r = __htrie_bckt_rec(b, s);
-		i = tdb_htrie_idx(dbh, r->key, bits);
+	for_each_online_cpu(cpu) {
+		TdbPerCpu *p = per_cpu_ptr(dbh->pcpu, cpu);
 
-		if (unlikely(in->shifts[i])) {
-			/*
-			 * Collision: copy the record if the index references
-			 * to a new bucket or just leave everything as is.
-			 * The new buckets are inaccessible for other CPUs and
-			 * the bursting bucket has no more than maximum allowed
-			 * slots used, so we always have space for instertion.
-			 */
-			uint64_t o = in->shifts[i] & ~TDB_HTRIE_DBIT;
-			b_new = TDB_PTR(dbh, TDB_I2O(o));
-			if (b_new != b) {
-				ret = __htrie_bckt_copy_metadata(dbh, b_new, r);
-				BUG_ON(ret < 0);
-				T_DBG3("burst copy: rec %#lx is copied to bucket"
-				       " ptr=%p\n", r->key, b_new);
-			} else {
-				*new_map |= slt_bits;
-				T_DBG3("burst copy: rec %#lx remains in bucket"
-				       " ptr=%p\n", r->key, b);
+		if (p == this_cpu_ptr(dbh->pcpu)
+		    || rb->gen[cpu] == TDB_HTRIE_RCL_QUIESCENT)
+			continue;
+		if (READ_ONCE(p->gen) == rb->gen[cpu]) {
+			if (!wait)
+				return false;
+			TDB_HTRIE_STAT_INC(dbh, gen_wait);
+			while (READ_ONCE(p->gen) == rb->gen[cpu]) {
+				tdb_htrie_snap_seen(dbh);
+				cpu_relax();
 			}
+		}
+		rb->gen[cpu] = TDB_HTRIE_RCL_QUIESCENT;
+	}
+
+	return true;
+}
+
+/**
+ * A bursted bucket can be reused only when all its tombstones are reclaimed,
+ * so keep the bucket in the zombies list until that. The snapshots map
+ * the buckets by their offsets, so the bucket also can't be reused until
+ * the active snapshot ends.
+ */
+static void
+tdb_htrie_rcl_free_bckt(TdbHdr *dbh, TdbRcl *rcl, TdbHtrieBucket *b)
+{
+	if (__htrie_bckt_tombstones(dbh, READ_ONCE(b->col_map))
+	    || (READ_ONCE(dbh->snap_gen) & TDB_HTRIE_SNAP_ACTIVE))
+	{
+		b->col_ptr._val = rcl->zombie;
+		rcl->zombie = TDB_OFF(dbh, b);
+		return;
+	}
+
+	T_DBG2("reclaim bursted bucket ptr=%p\n", b);
+	tdb_htrie_reclaim_bucket(dbh, b);
+}
+
+/**
+ * Reclaim the bursted buckets, which have had tombstones on the last check.
+ */
+static void
+tdb_htrie_rcl_zombies(TdbHdr *dbh, TdbRcl *rcl)
+{
+	uint64_t *o = &rcl->zombie;
+
+	if (READ_ONCE(dbh->snap_gen) & TDB_HTRIE_SNAP_ACTIVE)
+		return;
+
+	while (*o) {
+		TdbHtrieBucket *b = TDB_PTR(dbh, *o);
+
+		if (__htrie_bckt_tombstones(dbh, READ_ONCE(b->col_map))) {
+			o = (uint64_t *)&b->col_ptr._val;
 			continue;
 		}
+		*o = b->col_ptr._val;
+		tdb_htrie_reclaim_bucket(dbh, b);
+	}
+}
+
+/**
+ * Free the data of all the tombstones in the batch and make the slots empty.
+ * Nobody else can change the tombstones state, so it's safe to just clear
+ * the less significant bit of each slot.
+ *
+ * The slot is cleared before the data is freed, so a crash in between leaks
+ * the data instead of freeing it twice on the recovery. The freed data chunks
+ * are pushed to the data caches with one CAS per cache for the whole batch.
+ * The data is kept while a snapshot is active.
+ */
+static void
+tdb_htrie_rcl_free(TdbHdr *dbh, TdbRcl *rcl, TdbRclBatch *rb)
+{
+	int i;
+	TdbDChain dc[TDB_HTRIE_DCACHE_MAX] = {};
 
-		if (unlikely(!*new_map)) {
-			/* The first record remains in the same bucket. */
-			*new_map |= slt_bits;
-			in->shifts[i] = TDB_O2I(TDB_OFF(dbh, b)) | TDB_HTRIE_DBIT;
-			T_DBG3("burst copy: rec %#lx remains in bucket ptr=%p\n",
-			       r->key, b);
+	for (i = 0; i < rb->n; ++i) {
+		TdbHtrieBucket *b = TDB_PTR(dbh, rb->bckt[i]);
+		int slot = rb->slot[i];
+		uint64_t off;
+
+		if (slot == TDB_HTRIE_RCL_BCKT) {
+			tdb_htrie_rcl_free_bckt(dbh, rcl, b);
 			continue;
 		}
+		slot &= ~TDB_HTRIE_RCL_IDX;
+		BUG_ON(__htrie_bckt_slot_state(READ_ONCE(b->col_map), slot)
+		       != TDB_HTRIE_SLOT_REMOVED);
+
+		off = __htrie_bckt_rec(dbh, b, slot)->off;
+		/* A new record in the slot starts without the reference. */
+		if (READ_ONCE(b->ref_map) & (1UL << slot))
+			sync_clear_bit(slot, &b->ref_map);
+		sync_clear_bit(__htrie_bckt_slot2bit(slot), &b->col_map);
+		TDB_HTRIE_STAT_INC(dbh, rcl);
+		if (!tdb_inplace(dbh) && !(rb->slot[i] & TDB_HTRIE_RCL_IDX)
+		    && !tdb_htrie_snap_defer(dbh, rcl, off))
+			TDB_HTRIE_STAT_ADD(dbh, data,
+					   -tdb_htrie_free_rec_data(dbh, off,
+								    dc));
+	}
+	rb->n = 0;
 
-		/*
-		 * We going to use at least 2 slots in the new
-		 * index node, i.e. the key part creates new
-		 * branches and we burst the node.
-		 */
-		if ((b_new = tdb_htrie_alloc_bucket(dbh))) {
-			__htrie_bckt_copy_metadata(dbh, b_new, r);
-			T_DBG3("burst copy: rec %#lx is copied to bucket ptr=%p\n",
-			       r->key, b_new);
-		} else {
-			if (!no_mem_fail)
-				return -ENOMEM;
-			/*
-			 * We can not allocate a new bucket and the index is
-			 * already fixed, so just link the index slot to the same
-			 * bucket and hope that on the next bucket overflow we
-			 * have memory for burst.
-			 */
-			b_new = b;
-			atomic_inc(&g_burst_collision_no_mem);
-			T_DBG3("burst copy: failed bucket alloc, bucket ptr=%p"
-			       " is double linked for rec %#lx\n", b, r->key);
+	tdb_htrie_free_data_flush(dbh, dc);
+}
+
+/**
+ * Reclaim the sealed batch and seal the open one.
+ * If @wait is false and there are still CPUs, which can reference the sealed
+ * tombstones, nothing is done.
+ */
+static bool
+__htrie_rcl_flush(TdbHdr *dbh, TdbRcl *rcl, bool wait)
+{
+	TdbRclBatch *rb = &rcl->b[!rcl->open];
+
+	if (rb->n) {
+		if (!tdb_htrie_rcl_quiescent(dbh, rb, wait))
+			return false;
+		tdb_htrie_rcl_free(dbh, rcl, rb);
+	}
+	if (rcl->zombie)
+		tdb_htrie_rcl_zombies(dbh, rcl);
+	if (rcl->defer && rcl->defer_gen != (READ_ONCE(dbh->snap_gen)
+					     & ~TDB_HTRIE_SNAP_BROKEN))
+		tdb_htrie_snap_defer_free(dbh, rcl);
+
+	rcl->open = !rcl->open;
+	tdb_htrie_rcl_seal(dbh, &rcl->b[!rcl->open]);
+
+	return true;
+}
+
+/**
+ * Add a tombstone in slot @slot of bucket @b to the current CPU batch or
+ * retire the whole bucket @b if @slot is TDB_HTRIE_RCL_BCKT.
+ * If the batch is full, then we have to reclaim the previous batch before
+ * sealing the current one. Typically all the CPUs already have left the
+ * buckets from the previous batch, so we spin only under extremely high
+ * removal rates.
+ */
+static void
+tdb_htrie_rcl_add(TdbHdr *dbh, TdbHtrieBucket *b, unsigned int slot)
+{
+	TdbRcl *rcl = this_cpu_ptr(dbh->rcl);
+	TdbRclBatch *rb = &rcl->b[rcl->open];
+
+	if (rb->n == TDB_HTRIE_RCL_BATCH) {
+		__htrie_rcl_flush(dbh, rcl, true);
+		rb = &rcl->b[rcl->open];
+	}
+
+	rb->bckt[rb->n] = TDB_OFF(dbh, b);
+	rb->slot[rb->n] = slot;
+	++rb->n;
+}
+
+/**
+ * Reclaim all the tombstones of the current CPU. The function spins waiting
+ * for all the CPUs to leave the buckets containing the tombstones, so it
+ * shouldn't be called when there are CPUs observing a bucket for a long time.
+ */
+void
+tdb_htrie_reclaim(TdbHdr *dbh)
+{
+	TdbRcl *rcl = this_cpu_ptr(dbh->rcl);
+
+	__htrie_rcl_flush(dbh, rcl, true);
+	__htrie_rcl_flush(dbh, rcl, true);
+}
+
+/**
+ * Get a bucket referenced by slot @i of the new index node @in or allocate
+ * a new one. Several CPUs may concurrently burst the same bucket, so only one
+ * of the new buckets is linked with the index node.
+ */
+static TdbHtrieBucket *
+__htrie_burst_child(TdbHdr *dbh, TdbHtrieNode *in, int i)
+{
+	uint32_t o, b_link;
+	TdbHtrieBucket *b;
+
+	if ((o = READ_ONCE(in->shifts[i])))
+		return TDB_PTR(dbh, TDB_I2O(o & ~TDB_HTRIE_DBIT));
+
+	if (!(b = tdb_htrie_alloc_bucket(dbh)))
+		return NULL;
+	/* The bucket is new, so don't copy it for a snapshot. */
+	tdb_htrie_snap_link(dbh, TDB_OFF(dbh, b), NULL);
+
+	b_link = TDB_O2I(TDB_OFF(dbh, b)) | TDB_HTRIE_DBIT;
+	o = atomic_cmpxchg((atomic_t *)&in->shifts[i], 0, b_link);
+	if (!o)
+		return b;
+
+	/* Nobody saw the bucket, so we can reuse it immediately. */
+	tdb_htrie_reclaim_bucket(dbh, b);
+
+	return TDB_PTR(dbh, TDB_I2O(o & ~TDB_HTRIE_DBIT));
+}
+
+/**
+ * All the CPUs bursting bucket @b must place a record from slot @s into the
+ * same slot of the new bucket, so the slot is defined by the number of
+ * records going to the new bucket from the preceding slots of @b.
+ */
+static int
+__htrie_burst_slot(TdbHdr *dbh, TdbHtrieBucket *b, uint64_t map, int s,
+		   int bits)
+{
+	int j, n = 0;
+	uint32_t i = tdb_htrie_idx(dbh, __htrie_bckt_rec(dbh, b, s)->key, bits);
+
+	for (j = 0; j < s; ++j)
+		if (__htrie_bckt_slot_state(map, j) == TDB_HTRIE_SLOT_REC
+		    && tdb_htrie_idx(dbh, __htrie_bckt_rec(dbh, b, j)->key,
+				     bits) == i)
+			++n;
+
+	return n;
+}
+
+/**
+ * Move a record from slot @s of the frozen bucket @b to a bucket of the new
+ * index node @in. Only the record metadata, i.e. the key and the data offset,
+ * is moved and the data stays in place, but inplace records have to be copied
+ * since they live in the buckets.
+ *
+ * Each of the bursting CPUs tries to acquire the destination slot in the new
+ * bucket, so only one of them writes the record and marks the source slot as
+ * moved. The others spin while the slot is written. The new buckets aren't
+ * visible for inserters until the burst is finished and a moved record can't
+ * be reclaimed while there is a bursting CPU observing the bucket @b, so the
+ * destination slot can't be reused until all the CPUs see the moved mark.
+ */
+static int
+__htrie_burst_move_rec(TdbHdr *dbh, TdbHtrieBucket *b, uint64_t map, int s,
+		       int bits, TdbHtrieNode *in)
+{
+	int ns;
+	uint64_t nmap, ns_bits;
+	TdbRec *r = __htrie_bckt_rec(dbh, b, s), *rec;
+	TdbHtrieBucket *nb;
+
+	if (READ_ONCE(b->col_map) & (1UL << TDB_HTRIE_BCKT_MOVED(s)))
+		return 0;
+
+	nb = __htrie_burst_child(dbh, in, tdb_htrie_idx(dbh, r->key, bits));
+	if (!nb)
+		return -ENOMEM;
+	ns = __htrie_burst_slot(dbh, b, map, s, bits);
+	ns_bits = 3UL << __htrie_bckt_slot2bit(ns);
+
+	while (!(READ_ONCE(b->col_map) & (1UL << TDB_HTRIE_BCKT_MOVED(s)))) {
+		nmap = READ_ONCE(nb->col_map);
+		if ((nmap & ns_bits)
+		    || cmpxchg(&nb->col_map, nmap, nmap | ns_bits) != nmap)
+		{
+			cpu_relax();
+			continue;
 		}
-		in->shifts[i] = TDB_O2I(TDB_OFF(dbh, b_new)) | TDB_HTRIE_DBIT;
+
+		rec = tdb_inplace(dbh) ? NULL : TDB_PTR(dbh, r->off);
+		__htrie_bckt_write_rec(dbh, nb, r->key, r->data, dbh->rec_len,
+				       ns, &rec);
+		sync_test_and_set_bit(TDB_HTRIE_BCKT_MOVED(s), &b->col_map);
+		__htrie_bckt_fix_rec(nb, ns);
+
+		T_DBG3("burst: rec %#lx is moved from bucket ptr=%p to"
+		       " ptr=%p (slot %d)\n", r->key, b, nb, ns);
 	}
 
 	return 0;
 }
 
+/**
+ * Burst bucket @b referenced by index node @node with a new index node.
+ *
+ * Any CPU, which finds the bucket full or frozen for a burst, calls the
+ * function, so all the bursting CPUs make the same progress:
+ *
+ * 1. freeze the bucket, so no new records can be inserted and no records can
+ *    be removed from it;
+ *
+ * 2. link a new index node with the bucket burst pointer;
+ *
+ * 3. wait for the records, which are being written, to be fixed;
+ *
+ * 4. move all the records to new buckets of the new index node.
+ *    The tombstones aren't moved and reclaimed in the bucket @b;
+ *
+ * 5. link the new index node with @node instead of the bucket @b and retire
+ *    the bucket.
+ *
+ * Readers still can observe the bucket @b with all the records until it's
+ * reclaimed. The failed burst, e.g. due to memory allocation failure, can be
+ * continued by another CPU.
+ */
 static int
-tdb_htrie_bckt_burst(TdbHdr *dbh, TdbHtrieBucket *b, uint64_t old_off,
-		     uint64_t key, int bits, TdbHtrieNode **node)
+tdb_htrie_bckt_burst(TdbHdr *dbh, TdbHtrieBucket *b, uint64_t key, int bits,
+		     TdbHtrieNode *node)
 {
-	int i, ret;
-	uint32_t o;
+	int s, i, r;
+	uint32_t o, b_link;
+	uint64_t io, map;
 	TdbHtrieNode *in;
-	uint64_t io, map = b->col_map, new_map = 0, curr_map;
-	lf_uint32_t lf_io = {};
 
 	T_DBG2("burst bucket ptr=%p on key=%lx bits=%u\n", b, key, bits);
+	TDB_HTRIE_STAT_INC(dbh, burst);
 
-	if (!(io = tdb_htrie_alloc_index(dbh)))
-		return -ENOMEM;
-	in = TDB_PTR(dbh, io);
+	tdb_htrie_snap_cow(dbh, b);
+	sync_test_and_set_bit(TDB_HTRIE_BCKT_BURST, &b->col_map);
 
-	/*
-	 * Link the bucket burst pointer to the new index node.
-	 * All readers continue to read the bucket only.
-	 * Updaters can use the bucket burst pointer to retrieve the new index
-	 * and insert new records.
-	 * More bucket bursts can happen in the new tree referenced by the
-	 * bucket burst pointer - that's OK, the whole subtrie will be relinked
-	 * when we reinsert all the records from the current bucket or fail.
-	 *
-	 * TODO check accuracy of i/o and node pointers
-	 * TODO use remove|burst bit
-	 */
-	atomic_set(&lf_io.val, TDB_O2I(io));
-	o = cmpxchg(&b->col_ptr, 0, lf_io._val);
-	if (o != 0) {
-		/*
-		 * Another CPU is bursting the bucket, so free the index node
-		 * and return an index node referenced by the bucket burst
-		 * pointer.
-		 * We never free a referenced index nodes, so once we got the
-		 * index node offset it's safe to retrieve it.
-		 */
-		tdb_htrie_rollback_index(dbh, io);
-		*node = TDB_PTR(dbh, o);
-		return -EAGAIN;
+	if (!(o = atomic_read(&b->col_ptr.val))) {
+		if (!(io = tdb_htrie_alloc_index(dbh)))
+			return -ENOMEM;
+		o = atomic_cmpxchg(&b->col_ptr.val, 0, TDB_O2I(io));
+		if (o) {
+			/*
+			 * Another CPU is bursting the bucket.
+			 * We never free a referenced index nodes, so once we
+			 * got the index node offset it's safe to retrieve it.
+			 */
+			tdb_htrie_rollback_index(dbh, io);
+		} else {
+			o = TDB_O2I(io);
+		}
 	}
+	in = TDB_PTR(dbh, TDB_I2O(o));
+
+	do {
+		map = READ_ONCE(b->col_map);
+		if (!__htrie_bckt_writes(dbh, map))
+			break;
+		cpu_relax();
+	} while (true);
 
-	if (__htrie_bckt_reinsert_records(dbh, b, map, bits, in, &new_map, false)) {
-		// FIXME what to do here?
-		goto err_free_mem;
+	for (s = 0; s < dbh->bckt_slots; ++s) {
+		if (__htrie_bckt_slot_state(map, s) != TDB_HTRIE_SLOT_REC)
+			continue;
+		if ((r = __htrie_burst_move_rec(dbh, b, map, s, bits, in)))
+			return r;
 	}
 
 	/*
-	 * We have built a new subtrie with root in @in/@io and now we can link
+	 * We have built a new subtrie with root in @in and now we can link
 	 * it with @node to make it visible for readers as well and unlink the
-	 * bucket @b, which can be removed later.
+	 * bucket @b. Only one CPU wins the race and retires the bucket.
+	 * An active snapshot still sees the bucket by the new link.
 	 */
-	BUG_ON((*node)->shifts[i] != o);
+	tdb_htrie_snap_link(dbh, TDB_I2O(o), b);
 	i = tdb_htrie_idx_prev(dbh, key, bits);
-	atomic_set((atomic_t *)&(*node)->shifts[i], TDB_O2I(io));
-
-	*node = in;
-
-	/*
-	 * Free the reinserted bucket @b.
-	 * The trie has no more references to the bucket, but other CPUs still
-	 * may reference it, so -WHAT? TODO
-	 * TODO check for (new) 01 (partially removed records) before reclaiming
-	 * the bucket; reclaim all data if necessary.
-	 */
+	b_link = TDB_O2I(TDB_OFF(dbh, b)) | TDB_HTRIE_DBIT;
+	if ((uint32_t)atomic_cmpxchg((atomic_t *)&node->shifts[i], b_link, o)
+	    == b_link)
+		tdb_htrie_rcl_add(dbh, b, TDB_HTRIE_RCL_BCKT);
 
 	return 0;
-
-err_free_mem:
-	/*
-	 * TODO Free all new buckets and the index node.
-	 * Nobody references the buckets, so we can normally free them.
-	 */
-	for (i = 0; i < TDB_HTRIE_FANOUT; ++i)
-		if (in->shifts[i]) {
-			uint64_t o = TDB_I2O(in->shifts[i] & ~TDB_HTRIE_DBIT);
-			TdbHtrieBucket *bi = TDB_PTR(dbh, o);
-			if (bi != b)
-				tdb_htrie_reclaim_bucket(dbh, bi);
-		}
-	tdb_htrie_rollback_index(dbh, io);
-	return ret;
 }
 
 /**
- * Insert a new entry.
- * Allows duplicate key entries.
- *
- * @len returns number of copied data on success.
- *
- * @return address of the inserted record or NULL on failure.
- * Keep in mind that in case of inplace database you can use the return value
- * just to check success/failure and can not use the address because it can
- * change any time.
+ * Link a new record into the index: write a small in-place record of fixed
+ * size or a metadata for a large record @rec whose data was already written.
  */
-TdbRec *
-tdb_htrie_insert(TdbHdr *dbh, uint64_t key, const void *data, size_t *len)
+static TdbRec *
+__htrie_insert(TdbHdr *dbh, unsigned int idx, uint64_t key, const void *data,
+	       size_t len, TdbRec *rec)
 {
-	int r, bits = 0;
-	uint64_t d_o, o, b_free;
-	TdbRec *rec = NULL;
+	int r, bits, rcl_n = 0;
 	TdbHtrieBucket *bckt;
-	TdbHtrieNode *node = NULL;
-
-	/* TODO #910 #1350: for now we don't allow empty records. */
-	BUG_ON (!*len);
-
-	if (!tdb_inplace(dbh)) {
-		if (!(d_o = tdb_htrie_alloc_data(dbh, len, 0)))
-			goto err;
-		rec = tdb_htrie_create_rec(dbh, d_o, key, data, *len);
-	}
+	TdbHtrieNode *node;
 
 retry:
-	/*
-	 * Continue the trie retrieval from @bits and @node if we jumped here
-	 * after a bucket burst.
-	 */
+	bits = 0;
+	node = tdb_htrie_root(dbh, idx);
 	while (true) {
 		if ((bckt = tdb_htrie_descend_get_bckt(dbh, key, &bits, &node)))
 			break;
 		/* The index doesn't have the key. */
-		r = __htrie_insert_new_bckt(dbh, key, bits, node, data, len, &rec);
-		if (likely(!r))
+		r = __htrie_insert_new_bckt(dbh, key, bits, node, data, &len,
+					    &rec);
+		if (likely(!r)) {
+			TDB_HTRIE_STAT_INC(dbh, insert);
 			return rec;
+		}
 		if (r == -ENOMEM)
-			goto err_data_free;
+			goto err;
 		/* r == -EAGAIN, retry. */
+		TDB_HTRIE_STAT_INC(dbh, retry);
 	}
 	BUG_ON(!bckt);
 
@@ -864,132 +1841,471 @@ retry:
 	 * Insert the record into a new or existing bucket. In the second case
 	 * HTrie collision happened and the index references a metadata block.
 	 * At this point arbitrary new intermediate index nodes could appear.
-	 *
-	 * Write a small in-place record of fixed size or a metadata for a large
-	 * variable-size record whose data was already written.
 	 */
-insert_rec_into_bckt:
-	if (!__htrie_bckt_new_rec(dbh, bckt, key, data, *len, &rec)) {
+	if (!__htrie_bckt_new_rec(dbh, bckt, key, data, len, &rec)) {
 		tdb_htrie_put_bucket(dbh);
+		TDB_HTRIE_STAT_INC(dbh, insert);
 		return rec;
 	}
 
-	/* The metadata/inplace data block is full, burst it. */
-
-	if (unlikely(TDB_HTRIE_RESOLVED(bits)))
-		goto no_space;
+	/*
+	 * Frequent updates of the same key fill the bucket with tombstones,
+	 * so try to reclaim them instead of new bursts, which can't separate
+	 * the records with the same key. The bucket tombstones may be in the
+	 * open batch, so we need two flushes to reclaim them.
+	 */
+	if (__htrie_bckt_tombstones(dbh, READ_ONCE(bckt->col_map))
+	    && rcl_n++ < 2
+	    && __htrie_rcl_flush(dbh, this_cpu_ptr(dbh->rcl), false))
+	{
+		tdb_htrie_put_bucket(dbh);
+		TDB_HTRIE_STAT_INC(dbh, retry);
+		goto retry;
+	}
 
 	/*
-	 * There is no room in the bucket - burst it
-	 * We should never see collision chains at this point.
+	 * The metadata/inplace data block is full or is being bursted by
+	 * another CPU, burst it.
 	 */
+	if (unlikely(TDB_HTRIE_RESOLVED(bits)))
+		goto no_space;
+	/* We should never see collision chains at this point. */
 	BUG_ON(bits < TDB_HTRIE_BITS);
 
-	r = tdb_htrie_bckt_burst(dbh, bckt, o, key, bits, &node);
-	if (r == -EAGAIN) {
-		/*
-		 * The index has been changed.
-		 * Burst always creates a new level (index node).
-		 */
-		bits += TDB_HTRIE_BITS;
-		if (unlikely(TDB_HTRIE_RESOLVED(bits)))
-			goto no_space;
-		goto retry;
-	}
-	if (unlikely(r == -ENOMEM))
-		goto err_data_free;
+	if (unlikely(tdb_htrie_bckt_burst(dbh, bckt, key, bits, node)))
+		goto err;
 
 	/*
-	 * Insert the new record into the current bucket or one of a newly
-	 * created during the burst.
+	 * Insert the new record into one of the buckets created during the
+	 * burst or even a newer one if the index has been changed again.
 	 */
-	o = node->shifts[__HTRIE_IDX(key, bits - TDB_HTRIE_BITS)] ^ TDB_HTRIE_DBIT;
-	bckt = TDB_PTR(dbh, TDB_I2O(o));
-	goto insert_rec_into_bckt;
-
-err_data_free:
-	if (!tdb_inplace(dbh))
-		tdb_htrie_free_data(dbh, TDB_PTR(dbh, d_o), *len);
-	*len = 0;
-err:
-	tdb_htrie_put_bucket(dbh);
+	TDB_HTRIE_STAT_INC(dbh, retry);
+	goto retry;
 
-	return NULL;
 no_space:
 	T_ERR("All bits of key %#lx and the collision bucket is full"
 	      " - there is no space to insert a new record\n", key);
-	goto err_data_free;
+err:
+	tdb_htrie_put_bucket(dbh);
+
+	return NULL;
 }
 
 /**
- * Iterate over all records in a bucket (collision chain).
- * May return TdbRec or TdbVRec depeding on the database type.
+ * Start insertion of a new entry, which can be larger than one data chunk.
+ * The record is invisible for other CPUs until tdb_htrie_insert_commit(),
+ * so it can be extended by tdb_htrie_extend_rec() without any concurrency.
+ * Use tdb_htrie_insert_abort() to drop the record instead.
  *
- * @i must be initialized, typically to 0, by the caller.
+ * @len returns number of copied data on success.
  *
- * @return @i as index of returned record, so increment the index beween the
- * calls to iterate over the bucket.
+ * @return address of the new record or NULL on failure.
  */
-void *
-tdb_htrie_bscan_for_rec(TdbHdr *dbh, TdbHtrieBucket *b, uint64_t key, int *i)
+TdbRec *
+tdb_htrie_insert_begin(TdbHdr *dbh, uint64_t key, const void *data,
+		       size_t *len)
 {
-	TdbRec *r;
+	uint64_t d_o;
 
-	for ( ; *i < TDB_HTRIE_BCKT_SLOTS_N; ++*i) {
-		// FIXME spin if the bucket record is incomplete
-		if (!(b->col_map & (1UL << __htrie_bckt_slot2bit(*i))))
-			continue;
-		r = __htrie_bckt_rec(b, *i);
-		if (r->key == key) {
-			if (tdb_inplace(dbh))
-				return r;
-			return TDB_PTR(dbh, r->off);
-		}
+	/* Inplace records are always written in one shot. */
+	BUG_ON(tdb_inplace(dbh));
+	/* TODO #910 #1350: for now we don't allow empty records. */
+	BUG_ON(!*len);
+
+	if (!(d_o = tdb_htrie_alloc_data(dbh, len, 0))) {
+		*len = 0;
+		return NULL;
 	}
+	TDB_HTRIE_STAT_ADD(dbh, data, tdb_htrie_chunk_sz(dbh, *len));
 
-	return NULL;
+	return tdb_htrie_create_rec(dbh, d_o, key, data, *len);
 }
 
-static int
-tdb_htrie_bucket_walk(TdbHdr *dbh, TdbHtrieBucket *b, int (*fn)(void *))
+/**
+ * Make the record @rec, started by tdb_htrie_insert_begin(), visible for
+ * all the CPUs. The record is linked into the index with one atomic update
+ * of a bucket, so readers either see the whole record or don't see it at all.
+ *
+ * @return @rec on success. The record is freed on failure and NULL is
+ * returned.
+ */
+TdbRec *
+tdb_htrie_insert_commit(TdbHdr *dbh, uint64_t key, TdbRec *rec)
 {
-	int i, res;
-	TdbRec *r;
-
-	for (i = 0; i < TDB_HTRIE_BCKT_SLOTS_N; ++i) {
-		// FIXME spin if the bucket record is incomplete
-		if (!(b->col_map & (1UL << __htrie_bckt_slot2bit(i))))
-			continue;
-		r = __htrie_bckt_rec(b, i);
+	if (likely(__htrie_insert(dbh, 0, key, NULL, 0, rec)))
+		return rec;
 
-		if (tdb_inplace(dbh)) {
-			if (unlikely(res = fn(r->data)))
-				return res;
-		} else {
-			TdbVRec *vr = TDB_PTR(dbh, r->off);
-			if (unlikely(res = fn(vr->data)))
-				return res;
-		}
-	}
+	tdb_htrie_insert_abort(dbh, rec);
 
-	return 0;
+	return NULL;
 }
 
-static int
-tdb_htrie_node_visit(TdbHdr *dbh, TdbHtrieNode *node, int (*fn)(void *))
+/**
+ * Free a record started by tdb_htrie_insert_begin() and never committed.
+ */
+void
+tdb_htrie_insert_abort(TdbHdr *dbh, TdbRec *rec)
+{
+	TDB_HTRIE_STAT_ADD(dbh, data,
+			   -tdb_htrie_free_rec_data(dbh, TDB_OFF(dbh, rec),
+						    NULL));
+}
+
+/**
+ * Insert a new entry.
+ * Allows duplicate key entries.
+ *
+ * @len returns number of copied data on success. Large records, which
+ * don't fit one data chunk, must be inserted with tdb_htrie_insert_begin()
+ * to not to expose partial records.
+ *
+ * @return address of the inserted record or NULL on failure.
+ * Keep in mind that in case of inplace database you can use the return value
+ * just to check success/failure and can not use the address because it can
+ * change any time.
+ */
+TdbRec *
+tdb_htrie_insert(TdbHdr *dbh, uint64_t key, const void *data, size_t *len)
 {
-	int bits, res, fanout;
+	TdbRec *rec;
 
-	fanout = (node == tdb_htrie_root(dbh))
-		 ? (1 << dbh->root_bits)
-		 : TDB_HTRIE_FANOUT;
+	/* TODO #910 #1350: for now we don't allow empty records. */
+	BUG_ON (!*len);
 
-	for (bits = 0; bits < fanout; ++bits) {
-		uint64_t o;
+	if (tdb_inplace(dbh)) {
+		if (!(rec = __htrie_insert(dbh, 0, key, data, *len, NULL)))
+			*len = 0;
+		return rec;
+	}
+
+	if (!(rec = tdb_htrie_insert_begin(dbh, key, data, len)))
+		return NULL;
+	if (!(rec = tdb_htrie_insert_commit(dbh, key, rec)))
+		*len = 0;
+
+	return rec;
+}
+
+/**
+ * Insert a new entry for the prefix of @plen bits of the address @addr into
+ * a raw keys database. Just like tdb_htrie_insert().
+ */
+TdbRec *
+tdb_htrie_insert_prefix(TdbHdr *dbh, uint64_t addr, unsigned int plen,
+			const void *data, size_t *len)
+{
+	BUG_ON(!(dbh->flags & TDB_F_RAWKEY) || plen > TDB_HTRIE_PFX_MAX);
+
+	/*
+	 * The locked instruction is a full barrier, so a lookup observing
+	 * the record observes the prefix length as well. The prefix lengths
+	 * are never removed, a stale one costs just a lookup.
+	 */
+	set_bit(plen, (unsigned long *)&dbh->pfx_lens);
+
+	return tdb_htrie_insert(dbh, tdb_htrie_pfx_key(addr, plen), data, len);
+}
+
+/**
+ * The vectorized version of tdb_htrie_bscan_for_rec(): compare the keys of
+ * all the bucket slots with @key at once, 4 slots per a gather from the
+ * slots, and check the slot states for the matched keys only.
+ *
+ * The collision map is read before the keys, just like the scalar scan
+ * checks a slot state before reading the slot key, so a record being written
+ * is never matched by a partially written key.
+ *
+ * In the kernel the function must be called with the saved FPU context, as
+ * the Tempesta softirqs do.
+ */
+static __attribute__((target("avx2"))) void *
+__htrie_bscan_avx2(TdbHdr *dbh, TdbHtrieBucket *b, uint64_t key, int *i)
+{
+	int s;
+	unsigned int match = 0;
+	long long sz = tdb_htrie_bckt_slot_sz(dbh);
+	uint64_t map = READ_ONCE(b->col_map);
+	const long long *keys = (const long long *)(b + 1);
+	__m256i vkey = _mm256_set1_epi64x(key);
+	__m256i off = _mm256_set_epi64x(3 * sz, 2 * sz, sz, 0);
+	__m256i step = _mm256_set1_epi64x(4 * sz);
+
+	barrier();
+
+	for (s = 0; s < dbh->bckt_slots; s += 4) {
+		__m256i k, lanes;
+
+		/* Don't read beyond the last slot. */
+		lanes = _mm256_cmpgt_epi64(_mm256_set1_epi64x(dbh->bckt_slots
+							      - s),
+					   _mm256_set_epi64x(3, 2, 1, 0));
+		k = _mm256_mask_i64gather_epi64(_mm256_setzero_si256(), keys,
+						off, lanes, 1);
+		k = _mm256_and_si256(_mm256_cmpeq_epi64(k, vkey), lanes);
+		match |= _mm256_movemask_pd(_mm256_castsi256_pd(k)) << s;
+		off = _mm256_add_epi64(off, step);
+	}
+
+	for (match &= ~0U << *i; match; match &= match - 1) {
+		s = __builtin_ctz(match);
+		if (__htrie_bckt_slot_state(map, s) == TDB_HTRIE_SLOT_REC) {
+			*i = s;
+			return tdb_htrie_rec_ptr(dbh, __htrie_bckt_rec(dbh, b, s));
+		}
+	}
+	*i = dbh->bckt_slots;
+
+	return NULL;
+}
+
+static void *
+__htrie_bscan(TdbHdr *dbh, TdbHtrieBucket *b, uint64_t key, int *i)
+{
+	TdbRec *r;
+
+	/*
+	 * Skip the slots being written: large records are linked into a bucket
+	 * only on commit, so only the record metadata is written in the slot
+	 * and there is no sense to wait for it.
+	 */
+	for ( ; *i < dbh->bckt_slots; ++*i) {
+		if (!__htrie_bckt_slot_live(b, *i))
+			continue;
+		r = __htrie_bckt_rec(dbh, b, *i);
+		if (r->key == key)
+			return tdb_htrie_rec_ptr(dbh, r);
+	}
+
+	return NULL;
+}
+
+/**
+ * Iterate over all records in a bucket (collision chain).
+ * May return TdbRec or TdbVRec depeding on the database type.
+ * The returned record is marked as referenced for tdb_htrie_evict().
+ *
+ * @i must be initialized, typically to 0, by the caller.
+ *
+ * @return @i as index of returned record, so increment the index beween the
+ * calls to iterate over the bucket.
+ */
+void *
+tdb_htrie_bscan_for_rec(TdbHdr *dbh, TdbHtrieBucket *b, uint64_t key, int *i)
+{
+	void *r;
+
+	if (tdb_htrie_avx2)
+		r = __htrie_bscan_avx2(dbh, b, key, i);
+	else
+		r = __htrie_bscan(dbh, b, key, i);
+	if (r)
+		__htrie_bckt_ref(b, *i);
+
+	return r;
+}
+
+/**
+ * Fill @iov with the data chunks of the variable-length record @rec, so the
+ * caller can transmit the record straight from the HTrie memory, e.g. by
+ * writev(2) or as skb fragments, without copying it to a response buffer.
+ * Empty chunks are skipped.
+ *
+ * The record must be found in a bucket observed by the CPU, see
+ * tdb_htrie_lookup(): reclamation of the removed records waits until all the
+ * CPUs observing the bucket change their generations, so the chunks stay
+ * valid until tdb_htrie_put_bucket(). The CPU observes only one bucket, so
+ * don't look up other buckets until the data is sent.
+ *
+ * @return the number of the record chunks, up to @n of them are written to
+ * @iov, so the vector is incomplete if the return value is larger than @n;
+ * @len is the total record length.
+ */
+int
+tdb_htrie_rec_iov(TdbHdr *dbh, TdbVRec *rec, struct kvec *iov, int n,
+		  size_t *len)
+{
+	int i = 0;
+	uint32_t next;
+
+	/* Fixed-size records are always in one piece. */
+	BUG_ON(!TDB_HTRIE_VARLENRECS(dbh));
+
+	for (*len = 0; rec; rec = next ? TDB_PTR(dbh, TDB_D2O(next)) : NULL) {
+		/* A writer may append chunks to a not committed record. */
+		next = READ_ONCE(rec->chunk_next);
+		if (!rec->len)
+			continue;
+		if (i < n) {
+			iov[i].iov_base = rec->data;
+			iov[i].iov_len = rec->len;
+		}
+		*len += rec->len;
+		++i;
+	}
+
+	return i;
+}
+
+/**
+ * Look up the record with the @key, use @eq_cb and @data, as for
+ * tdb_htrie_remove(), to choose one of the duplicates or NULL for the first
+ * one, and fill @iov with its chunks by tdb_htrie_rec_iov().
+ *
+ * The record is protected from reclamation until the caller calls
+ * tdb_htrie_put_bucket(), which it must do if the record is found.
+ *
+ * @return the number of the record chunks, see tdb_htrie_rec_iov(),
+ * or -ENOENT if there is no such record.
+ */
+int
+tdb_htrie_read_iov(TdbHdr *dbh, uint64_t key, bool (*eq_cb)(void *, void *),
+		   void *data, struct kvec *iov, int n, size_t *len)
+{
+	TdbHtrieBucket *b;
+	TdbVRec *r;
+	int i = 0;
+
+	if (!(b = tdb_htrie_lookup(dbh, key)))
+		return -ENOENT;
+
+	for ( ; (r = tdb_htrie_bscan_for_rec(dbh, b, key, &i)); ++i)
+		if (!eq_cb || eq_cb(r, data))
+			return tdb_htrie_rec_iov(dbh, r, iov, n, len);
+
+	tdb_htrie_put_bucket(dbh);
+
+	return -ENOENT;
+}
+
+/**
+ * Lookup the longest prefix of the address @addr in a raw keys database.
+ * The prefixes must be inserted with tdb_htrie_insert_prefix().
+ *
+ * A prefix key shares the trie path with the address for all the index nodes
+ * resolving the prefix bits only. So we descend by the address once, remember
+ * the path, and look up the prefixes from the longest to the shortest ones
+ * starting from the deepest path node common with the prefix.
+ *
+ * @return the bucket with the longest prefix and the prefix length in @plen
+ * or NULL if no prefix matches the address. Use tdb_htrie_bscan_for_rec()
+ * with the tdb_htrie_pfx_key(@addr, *@plen) key to get the prefix records
+ * and call tdb_htrie_put_bucket() after that.
+ */
+TdbHtrieBucket *
+tdb_htrie_lookup_prefix(TdbHdr *dbh, uint64_t addr, unsigned int *plen)
+{
+	int d, l, n = 0, bits = 0;
+	int path_bits[BITS_PER_LONG / TDB_HTRIE_BITS + 1];
+	uint64_t o, key, lens = READ_ONCE(dbh->pfx_lens);
+	TdbHtrieBucket *b;
+	TdbHtrieNode *path[BITS_PER_LONG / TDB_HTRIE_BITS + 1];
+	TdbHtrieNode *node = tdb_htrie_root(dbh, 0);
+
+	BUG_ON(!(dbh->flags & TDB_F_RAWKEY));
 
+	tdb_htrie_get_bucket(dbh, (TdbHtrieBucket *)node);
+
+	while (true) {
+		path[n] = node;
+		path_bits[n++] = bits;
+		o = node->shifts[tdb_htrie_idx(dbh, addr, bits)];
+		if (!o || (o & TDB_HTRIE_DBIT))
+			break;
+		bits += bits ? TDB_HTRIE_BITS : dbh->root_bits;
 		BUG_ON(TDB_HTRIE_RESOLVED(bits));
+		node = TDB_PTR(dbh, TDB_I2O(o));
+	}
 
-		o = node->shifts[bits];
+	for ( ; lens; lens &= ~(1UL << l)) {
+		int i = 0;
+
+		l = fls64(lens);
+		key = tdb_htrie_pfx_key(addr, l);
+		for (d = n - 1; path_bits[d] > l; --d)
+			;
+		bits = path_bits[d];
+		node = path[d];
+		if (!(o = tdb_htrie_descend(dbh, key, &bits, &node)))
+			continue;
+
+		b = TDB_PTR(dbh, o);
+		tdb_htrie_get_bucket(dbh, b);
+		if (tdb_htrie_bscan_for_rec(dbh, b, key, &i)) {
+			*plen = l;
+			return b;
+		}
+	}
+
+	tdb_htrie_put_bucket(dbh);
+
+	return NULL;
+}
+
+/*
+ * Only the records with the @pfx_bits most significant bits of @pfx are
+ * visited, the prefix is empty for the full walk.
+ */
+static bool
+tdb_htrie_walk_pfx_match(uint64_t key, uint64_t pfx, unsigned int pfx_bits)
+{
+	return !pfx_bits || !((key ^ pfx) >> (BITS_PER_LONG - pfx_bits));
+}
+
+static int
+tdb_htrie_rec_visit(TdbHdr *dbh, TdbRec *r, int (*fn)(void *))
+{
+	if (tdb_inplace(dbh))
+		return fn(r->data);
+
+	return fn(((TdbVRec *)TDB_PTR(dbh, r->off))->data);
+}
+
+static int
+tdb_htrie_bucket_walk(TdbHdr *dbh, TdbHtrieBucket *b, uint64_t pfx,
+		      unsigned int pfx_bits, int (*fn)(void *))
+{
+	int i, res;
+	TdbRec *r;
+
+	for (i = 0; i < dbh->bckt_slots; ++i) {
+		/* Skip incomplete records, see tdb_htrie_bscan_for_rec(). */
+		if (!__htrie_bckt_slot_live(b, i))
+			continue;
+		r = __htrie_bckt_rec(dbh, b, i);
+		if (!tdb_htrie_walk_pfx_match(r->key, pfx, pfx_bits))
+			continue;
+
+		if (unlikely(res = tdb_htrie_rec_visit(dbh, r, fn)))
+			return res;
+	}
+
+	return 0;
+}
+
+/*
+ * Visit the subtree of @node, which resolves the key bits after @bits.
+ * Only the slots of the node matching the prefix bits resolved by the node
+ * are visited, so the walk descends directly to the prefix subtree.
+ */
+static int
+tdb_htrie_node_visit(TdbHdr *dbh, TdbHtrieNode *node, int bits, uint64_t pfx,
+		     unsigned int pfx_bits, int (*fn)(void *))
+{
+	int i, res, width, lo = 0, hi;
+
+	BUG_ON(TDB_HTRIE_RESOLVED(bits));
+
+	width = bits ? TDB_HTRIE_BITS : dbh->root_bits;
+	hi = 1 << width;
+	if (pfx_bits > bits) {
+		int n = pfx_bits - bits < width ? pfx_bits - bits : width;
+
+		lo = tdb_htrie_idx(dbh, pfx, bits) & ~((1 << (width - n)) - 1);
+		hi = lo + (1 << (width - n));
+	}
+
+	for (i = lo; i < hi; ++i) {
+		uint64_t o = node->shifts[i];
 
 		if (likely(!o))
 			continue;
@@ -1006,7 +2322,7 @@ tdb_htrie_node_visit(TdbHdr *dbh, TdbHtrieNode *node, int (*fn)(void *))
 			BUG_ON(!o);
 
 			b = (TdbHtrieBucket *)TDB_PTR(dbh, TDB_I2O(o));
-			res = tdb_htrie_bucket_walk(dbh, b, fn);
+			res = tdb_htrie_bucket_walk(dbh, b, pfx, pfx_bits, fn);
 			if (unlikely(res))
 				return res;
 		} else {
@@ -1015,7 +2331,8 @@ tdb_htrie_node_visit(TdbHdr *dbh, TdbHtrieNode *node, int (*fn)(void *))
 			 * The function has the deepest nesting 16.
 			 */
 			res = tdb_htrie_node_visit(dbh, TDB_PTR(dbh,
-						   TDB_I2O(o)), fn);
+						   TDB_I2O(o)), bits + width,
+						   pfx, pfx_bits, fn);
 			if (unlikely(res))
 				return res;
 		}
@@ -1024,22 +2341,604 @@ tdb_htrie_node_visit(TdbHdr *dbh, TdbHtrieNode *node, int (*fn)(void *))
 	return 0;
 }
 
+/**
+ * Call @fn for all the records of the primary index until @fn returns
+ * non-zero. @fn must not call the HTrie lookups since the walk is done in
+ * one reader session.
+ *
+ * @return the last @fn result.
+ */
 int
 tdb_htrie_walk(TdbHdr *dbh, int (*fn)(void *))
 {
-	TdbHtrieNode *node = tdb_htrie_root(dbh);
+	return tdb_htrie_walk_prefix(dbh, 0, 0, fn);
+}
+
+/**
+ * The same as tdb_htrie_walk(), but in a raw keys database (TDB_F_RAWKEY)
+ * visit only the records with the @pfx_bits most significant bits of the
+ * key the same as in @pfx. The raw keys are resolved from the most
+ * significant bits, so the walk visits only the index subtree of the prefix
+ * and the records follow in the order of the keys up to the buckets, i.e.
+ * the records of a bucket aren't sorted.
+ */
+int
+tdb_htrie_walk_prefix(TdbHdr *dbh, uint64_t pfx, unsigned int pfx_bits,
+		      int (*fn)(void *))
+{
+	int r;
+	TdbHtrieNode *node = tdb_htrie_root(dbh, 0);
+
+	if (WARN_ON_ONCE(pfx_bits && !(dbh->flags & TDB_F_RAWKEY))
+	    || pfx_bits > BITS_PER_LONG)
+		return -EINVAL;
+
+	tdb_htrie_get_bucket(dbh, (TdbHtrieBucket *)node);
+
+	r = tdb_htrie_node_visit(dbh, node, 0, pfx, pfx_bits, fn);
+
+	tdb_htrie_put_bucket(dbh);
 
-	return tdb_htrie_node_visit(dbh, node, fn);
+	return r;
+}
+
+/*
+ * Visit the subtree of @node as it was on the beginning of the snapshot @s.
+ * The index nodes are never freed and the buckets aren't reused while the
+ * snapshot is active, so the walk doesn't enter the reader sessions and
+ * doesn't delay the reclamation. A live bucket is copied to the walker buffer
+ * and the copy is used only if the bucket still has no view after that.
+ */
+static int
+tdb_htrie_snap_node_visit(TdbHdr *dbh, TdbSnap *s, TdbHtrieNode *node,
+			  int bits, int (*fn)(void *))
+{
+	int i, res, width;
+
+	BUG_ON(TDB_HTRIE_RESOLVED(bits));
+
+	width = bits ? TDB_HTRIE_BITS : dbh->root_bits;
+	for (i = 0; i < 1 << width; ++i) {
+		uint32_t o = READ_ONCE(node->shifts[i]);
+		TdbHtrieBucket *b;
+		long v;
+
+		if (likely(!o))
+			continue;
+		if (READ_ONCE(dbh->snap_gen) & TDB_HTRIE_SNAP_BROKEN)
+			return -ENOMEM;
+
+		BUG_ON(TDB_I2O(o & ~TDB_HTRIE_DBIT)
+		       < tdb_hdr_sz(dbh) + sizeof(TdbExt)
+		       || TDB_I2O(o & ~TDB_HTRIE_DBIT) > tdb_dbsz(dbh));
+
+		/* The view is mapped before the link, tdb_htrie_snap_link(). */
+		smp_rmb();
+		v = __htrie_snap_lookup(s, o & ~TDB_HTRIE_DBIT);
+		if (v < 0 && !(o & TDB_HTRIE_DBIT)) {
+			TdbHtrieNode *n = TDB_PTR(dbh, TDB_I2O(o));
+
+			res = tdb_htrie_snap_node_visit(dbh, s, n, bits + width,
+							fn);
+			if (unlikely(res))
+				return res;
+			continue;
+		}
+
+		if (v < 0) {
+			o ^= TDB_HTRIE_DBIT;
+			memcpy_fast(s->buf, TDB_PTR(dbh, TDB_I2O(o)),
+				    tdb_htrie_bckt_sz(dbh));
+			/* The copy is mapped before the bucket update. */
+			smp_rmb();
+			v = __htrie_snap_lookup(s, o);
+		}
+		if (!v)
+			continue;
+		b = v < 0 ? s->buf : TDB_PTR(dbh, TDB_I2O(v));
+
+		if (unlikely(res = tdb_htrie_bucket_walk(dbh, b, 0, 0, fn)))
+			return res;
+	}
+
+	return 0;
 }
 
 /**
- * Remvoe all entries with the key and shrink the trie.
+ * Begin a copy-on-write snapshot of the database, so a background thread can
+ * write out a consistent image of the database while other CPUs update it.
+ * There is only one active snapshot of a database at a time.
+ *
+ * Each bucket is copied before its first update since the snapshot beginning.
+ * The new buckets and index nodes are mapped to the views of the buckets they
+ * replace, so the snapshot walk doesn't see them. The records data isn't
+ * copied: the data of the removed records is freed after the snapshot, so
+ * the records must not be changed in place.
+ *
+ * The CPUs, which entered their reader sessions before the snapshot, may
+ * update the buckets without copying, so the snapshot is ready when all such
+ * CPUs leave the sessions. The CPUs, which need to update a bucket in the
+ * meantime, wait for the snapshot at most for one reader session.
+ *
+ * @n is the maximum number of buckets and index nodes updated or created
+ * while the snapshot is active. The snapshot is broken if more objects are
+ * updated or there is no memory for the bucket copies: the updates go on
+ * without copying and tdb_htrie_snapshot_walk() and tdb_htrie_snapshot_end()
+ * return -ENOMEM. The walk of a broken snapshot may visit the records, whose
+ * data is already freed, so the walk results must be dropped.
+ */
+int
+tdb_htrie_snapshot_begin(TdbHdr *dbh, size_t n)
+{
+	TdbSnap *s;
+	unsigned int bits = 1;
+	int cpu;
+
+	if (!n || n > 1U << 30)
+		return -EINVAL;
+	while (1UL << bits < n * 2)
+		++bits;
+
+	s = kvzalloc(sizeof(*s) + (sizeof(*s->map) << bits)
+		     + tdb_htrie_bckt_sz(dbh), GFP_KERNEL);
+	if (!s)
+		return -ENOMEM;
+	s->bits = bits;
+	s->max = n;
+	s->buf = &s->map[1UL << bits];
+	s->gen = (READ_ONCE(dbh->snap_gen) & ~(TDB_HTRIE_SNAP_GEN - 1))
+		 + TDB_HTRIE_SNAP_GEN + TDB_HTRIE_SNAP_ACTIVE;
+
+	if (cmpxchg(&dbh->snap, NULL, s)) {
+		kvfree(s);
+		return -EBUSY;
+	}
+	WRITE_ONCE(dbh->snap_gen, s->gen);
+	/* Read the sessions after the CPUs can see the snapshot. */
+	smp_mb();
+
+	for_each_online_cpu(cpu) {
+		TdbPerCpu *p = per_cpu_ptr(dbh->pcpu, cpu);
+		uint64_t gen = READ_ONCE(p->gen);
+
+		if (p == this_cpu_ptr(dbh->pcpu) || !READ_ONCE(p->active_bckt))
+			continue;
+		while (READ_ONCE(p->gen) == gen
+		       && READ_ONCE(p->snap_gen) != s->gen)
+			cpu_relax();
+	}
+
+	/* All the updates without copying are done. */
+	smp_mb();
+	WRITE_ONCE(s->ready, true);
+
+	return 0;
+}
+
+/**
+ * Call @fn for all the records of the primary index, which were in the index
+ * on the beginning of the active snapshot, until @fn returns non-zero.
+ * The index is walked without the reader sessions and the data of inplace
+ * records is valid only in the @fn call, so @fn may take a long time, e.g.
+ * to write the data out. The walk must not run concurrently with
+ * tdb_htrie_snapshot_end().
+ *
+ * @return the last @fn result, -EINVAL if there is no active snapshot or
+ * -ENOMEM if the snapshot is broken.
+ */
+int
+tdb_htrie_snapshot_walk(TdbHdr *dbh, int (*fn)(void *))
+{
+	TdbSnap *s = READ_ONCE(dbh->snap);
+	int r;
+
+	if (!s || !READ_ONCE(s->ready))
+		return -EINVAL;
+
+	r = tdb_htrie_snap_node_visit(dbh, s, tdb_htrie_root(dbh, 0), 0, fn);
+
+	if (READ_ONCE(dbh->snap_gen) & TDB_HTRIE_SNAP_BROKEN)
+		return -ENOMEM;
+
+	return r;
+}
+
+/**
+ * End the active snapshot and free the bucket copies. The bursted buckets and
+ * the data of the removed records, kept for the snapshot, are freed by the
+ * next reclamation batches of the CPUs.
+ *
+ * @return -ENOMEM if the snapshot was broken, -EINVAL if there is no active
+ * snapshot and zero otherwise.
+ */
+int
+tdb_htrie_snapshot_end(TdbHdr *dbh)
+{
+	TdbSnap *s = READ_ONCE(dbh->snap);
+	uint64_t gen;
+	unsigned int i;
+	int cpu;
+
+	if (!s)
+		return -EINVAL;
+
+	WRITE_ONCE(dbh->snap, NULL);
+	do {
+		gen = READ_ONCE(dbh->snap_gen);
+	} while (cmpxchg(&dbh->snap_gen, gen,
+			 gen & ~(TDB_HTRIE_SNAP_GEN - 1)) != gen);
+	/* Read the sessions after the CPUs can see the snapshot end. */
+	smp_mb();
+
+	/*
+	 * Wait for the CPUs, which might see the snapshot, to leave their
+	 * reader sessions before the snapshot is freed.
+	 */
+	for_each_online_cpu(cpu) {
+		TdbPerCpu *p = per_cpu_ptr(dbh->pcpu, cpu);
+		uint64_t g = READ_ONCE(p->gen);
+
+		if (p == this_cpu_ptr(dbh->pcpu) || !READ_ONCE(p->active_bckt))
+			continue;
+		TDB_HTRIE_STAT_INC(dbh, gen_wait);
+		while (READ_ONCE(p->gen) == g)
+			cpu_relax();
+	}
+
+	for (i = 0; i < 1U << s->bits; ++i) {
+		uint32_t v = s->map[i];
+
+		if (v & TDB_HTRIE_SNAP_COPY)
+			tdb_htrie_reclaim_bucket(dbh, TDB_PTR(dbh,
+					TDB_I2O(v & ~TDB_HTRIE_SNAP_COPY)));
+	}
+	kvfree(s);
+
+	return gen & TDB_HTRIE_SNAP_BROKEN ? -ENOMEM : 0;
+}
+
+/**
+ * Move a live record in slot @slot of bucket @b to the tombstone state.
+ * @return -ENOENT if the record was already removed and -EAGAIN if the bucket
+ * is being bursted.
+ */
+static int
+__htrie_bckt_tombstone(TdbHdr *dbh, TdbHtrieBucket *b, int slot)
+{
+	uint64_t map, bits = 3UL << __htrie_bckt_slot2bit(slot);
+
+	do {
+		map = READ_ONCE(b->col_map);
+		if (map & (1UL << TDB_HTRIE_BCKT_BURST))
+			return -EAGAIN;
+		if (__htrie_bckt_slot_state(map, slot) != TDB_HTRIE_SLOT_REC)
+			return -ENOENT;
+		tdb_htrie_snap_cow(dbh, b);
+	} while (cmpxchg(&b->col_map, map, map ^ bits) != map);
+
+	return 0;
+}
+
+/**
+ * An eviction sweep, see tdb_htrie_evict().
+ *
+ * @expired	- the records expiration callback or NULL;
+ * @data	- the second argument of @expired;
+ * @clock	- evict the records not referenced since the previous sweep;
+ * @n		- the number of the evicted records;
+ */
+typedef struct {
+	bool			(*expired)(void *, void *);
+	void			*data;
+	bool			clock;
+	int			n;
+} TdbHtrieSweep;
+
+/**
+ * Evict the live record in slot @slot of bucket @b if it's expired or, for
+ * the CLOCK sweep, if it wasn't referenced since the previous sweep. Otherwise
+ * the reference is cleared, so the record gets the second chance.
+ *
+ * The sweep observes the index for many records, so it can't wait for other
+ * CPUs on a full tombstones batch: a CPU bursting a bucket may wait for the
+ * sweeping CPU in its turn.
+ *
+ * @return -EBUSY if the sweep must be stopped to reclaim the tombstones.
+ */
+static int
+tdb_htrie_sweep_rec(TdbHdr *dbh, TdbHtrieBucket *b, int slot,
+		    TdbHtrieSweep *sw)
+{
+	TdbRec *r = __htrie_bckt_rec(dbh, b, slot);
+	TdbRcl *rcl = this_cpu_ptr(dbh->rcl);
+	bool expired = sw->expired
+		       && sw->expired(tdb_htrie_rec_ptr(dbh, r), sw->data);
+
+	if (!expired) {
+		if (!sw->clock)
+			return 0;
+		if (READ_ONCE(b->ref_map) & (1UL << slot)) {
+			sync_clear_bit(slot, &b->ref_map);
+			return 0;
+		}
+	}
+
+	if (rcl->b[rcl->open].n == TDB_HTRIE_RCL_BATCH
+	    && !__htrie_rcl_flush(dbh, rcl, false))
+		return -EBUSY;
+	/*
+	 * The bucket may be bursted concurrently, then the record is visited
+	 * again in the new bucket on the next sweep.
+	 */
+	if (__htrie_bckt_tombstone(dbh, b, slot))
+		return 0;
+	tdb_htrie_rcl_add(dbh, b, slot);
+	if (expired)
+		TDB_HTRIE_STAT_INC(dbh, expire);
+	else
+		TDB_HTRIE_STAT_INC(dbh, evict);
+	++sw->n;
+
+	return 0;
+}
+
+/**
+ * Walk at most @n records from the position @cur and call @fn for each of
+ * them or sweep them with @sw if it isn't NULL.
+ */
+static int
+__htrie_walk_next(TdbHdr *dbh, TdbHtrieCursor *cur, unsigned int n,
+		  int (*fn)(void *), TdbHtrieSweep *sw)
+{
+	TdbHtrieNode *nodes[TDB_HTRIE_DEPTH_MAX];
+	int l = 0, resume = cur->depth, visited = 0, res;
+	unsigned int width;
+
+	if (WARN_ON_ONCE(!n))
+		return -EINVAL;
+	if (cur->end)
+		return 0;
+
+	nodes[0] = tdb_htrie_root(dbh, 0);
+	tdb_htrie_get_bucket(dbh, (TdbHtrieBucket *)nodes[0]);
+
+	while (visited < n) {
+		TdbHtrieBucket *b;
+		uint64_t o;
+
+		width = l ? TDB_HTRIE_BITS : dbh->root_bits;
+		if (cur->path[l] >= 1U << width) {
+			/* The node is visited, go to the next slot of the parent. */
+			if (!l) {
+				cur->end = true;
+				break;
+			}
+			++cur->path[--l];
+			cur->slot = 0;
+			resume = -1;
+			continue;
+		}
+
+		o = READ_ONCE(nodes[l]->shifts[cur->path[l]]);
+		if (!o) {
+			++cur->path[l];
+			cur->slot = 0;
+			resume = -1;
+			continue;
+		}
+		BUG_ON(TDB_I2O(o & ~TDB_HTRIE_DBIT)
+		       < tdb_hdr_sz(dbh) + sizeof(TdbExt)
+		       || TDB_I2O(o & ~TDB_HTRIE_DBIT) > tdb_dbsz(dbh));
+
+		if (!(o & TDB_HTRIE_DBIT)) {
+			/*
+			 * Follow the saved path or start a new node, also if
+			 * the bucket of the saved position was bursted.
+			 */
+			BUG_ON(l + 1 >= TDB_HTRIE_DEPTH_MAX);
+			nodes[++l] = TDB_PTR(dbh, TDB_I2O(o));
+			if (l > resume) {
+				cur->path[l] = 0;
+				cur->slot = 0;
+			}
+			continue;
+		}
+
+		b = (TdbHtrieBucket *)TDB_PTR(dbh, TDB_I2O(o ^ TDB_HTRIE_DBIT));
+		if (l < resume)
+			/* The saved path doesn't exist any more. */
+			cur->slot = 0;
+		resume = -1;
+		for ( ; cur->slot < dbh->bckt_slots && visited < n; ++cur->slot) {
+			if (!__htrie_bckt_slot_live(b, cur->slot))
+				continue;
+			if (sw) {
+				/* Stay at the record for the next sweep. */
+				if (tdb_htrie_sweep_rec(dbh, b, cur->slot, sw)) {
+					n = visited;
+					break;
+				}
+				++visited;
+				continue;
+			}
+			res = tdb_htrie_rec_visit(dbh, __htrie_bckt_rec(dbh, b,
+								       cur->slot),
+						  fn);
+			if (unlikely(res)) {
+				cur->end = true;
+				tdb_htrie_put_bucket(dbh);
+				return res;
+			}
+			++visited;
+		}
+		if (cur->slot == dbh->bckt_slots) {
+			++cur->path[l];
+			cur->slot = 0;
+		}
+	}
+	cur->depth = l;
+
+	tdb_htrie_put_bucket(dbh);
+
+	return visited;
+}
+
+/**
+ * Incremental walk: call @fn for at most @n records of the primary index
+ * starting from the position @cur, initialized by tdb_htrie_cursor_init(),
+ * and save the next position in @cur. Each call is one reader session, so
+ * the index can be changed between the calls.
+ *
+ * The cursor keeps the slots path from the root, so a bucket bursted between
+ * the calls is replaced by an index node on the path and the walk continues
+ * from the first slot of the node. The records, which are in the index for
+ * the whole walk, are visited at least once, but the records of a bucket
+ * bursted in the middle of the walk may be visited twice.
+ *
+ * @return the number of the visited records, zero if the walk is finished,
+ * or the negative @fn result, which stops the walk.
+ */
+int
+tdb_htrie_walk_next(TdbHdr *dbh, TdbHtrieCursor *cur, unsigned int n,
+		    int (*fn)(void *))
+{
+	return __htrie_walk_next(dbh, cur, n, fn, NULL);
+}
+
+static int
+__htrie_sweep(TdbHdr *dbh, TdbHtrieCursor *cur, unsigned int n,
+	      TdbHtrieSweep *sw)
+{
+	int r;
+
+	/* Use tdb_htrie_remove_keys() to not to leave dangling references. */
+	if (WARN_ON_ONCE(dbh->idx_n > 1))
+		return -EINVAL;
+
+	r = __htrie_walk_next(dbh, cur, n, NULL, sw);
+	if (r < 0)
+		return r;
+	/* Go round the index. */
+	if (cur->end)
+		tdb_htrie_cursor_init(cur);
+
+	return sw->n;
+}
+
+/**
+ * CLOCK eviction, the approximate LRU: look through at most @n records of
+ * the primary index from the clock hand @hand, initialized by
+ * tdb_htrie_cursor_init(), and evict the records, which weren't looked up
+ * by tdb_htrie_bscan_for_rec() since the previous pass of the hand. The hand
+ * goes round the index, so the sweeps are just called by a background thread
+ * until there is enough free space, e.g. by the records data statistics of
+ * tdb_htrie_stat(), to keep the free space for new records instead of failing
+ * their allocations on a full database.
+ *
+ * The records, for which @expired returns true, are evicted regardless of
+ * the references, see tdb_htrie_expire(). @expired is called with @data as
+ * the second argument just like the tdb_htrie_remove() callback and may be
+ * NULL.
+ *
+ * The evicted records are removed as by tdb_htrie_remove(), so their memory
+ * is reclaimed with the next tombstones batches of the CPU or by
+ * tdb_htrie_reclaim(). A sweep stops early, if the CPU batches are full and
+ * other CPUs still observe the tombstones, so call tdb_htrie_reclaim()
+ * between the sweeps under high eviction rates.
+ *
+ * @return the number of the evicted records or a negative error code.
+ */
+int
+tdb_htrie_evict(TdbHdr *dbh, TdbHtrieCursor *hand, unsigned int n,
+		bool (*expired)(void *, void *), void *data)
+{
+	TdbHtrieSweep sw = { expired, data, true, 0 };
+
+	return __htrie_sweep(dbh, hand, n, &sw);
+}
+
+/**
+ * TTL expiration: the same as tdb_htrie_evict(), but evict only the records,
+ * for which @expired returns true. The record references aren't changed, so
+ * the expiration sweeps can go along with the eviction ones without breaking
+ * the CLOCK. HTrie records have no timestamps, so @expired checks an expiration
+ * time kept in the record data.
+ *
+ * @return the number of the expired records or a negative error code.
+ */
+int
+tdb_htrie_expire(TdbHdr *dbh, TdbHtrieCursor *cur, unsigned int n,
+		 bool (*expired)(void *, void *), void *data)
+{
+	TdbHtrieSweep sw = { expired, data, false, 0 };
+
+	if (WARN_ON_ONCE(!expired))
+		return -EINVAL;
+
+	return __htrie_sweep(dbh, cur, n, &sw);
+}
+
+/**
+ * Remove the entries with the key @key from the index @idx. If @off isn't
+ * zero, then only the entry referencing the record at @off is removed.
+ */
+static int
+__htrie_remove(TdbHdr *dbh, unsigned int idx, uint64_t key,
+	       bool (*eq_cb)(void *, void *), void *data, uint64_t off)
+{
+	int bits, i, n = 0, ret;
+	TdbRec *r;
+	TdbHtrieBucket *b;
+	TdbHtrieNode *node;
+
+retry:
+	bits = 0;
+	node = tdb_htrie_root(dbh, idx);
+	b = tdb_htrie_descend_get_bckt(dbh, key, &bits, &node);
+	if (!b)
+		return n;
+	BUG_ON(!__BCKT_ALIGNED(b));
+
+	for (i = 0; i < dbh->bckt_slots; ++i) {
+		if (!__htrie_bckt_slot_live(b, i))
+			continue;
+		r = __htrie_bckt_rec(dbh, b, i);
+		if (r->key != key || (off && r->off != off))
+			continue;
+		if (eq_cb && !eq_cb(tdb_htrie_rec_ptr(dbh, r), data))
+			continue;
+		ret = __htrie_bckt_tombstone(dbh, b, i);
+		if (ret == -ENOENT)
+			continue;
+		if (ret == -EAGAIN) {
+			ret = tdb_htrie_bckt_burst(dbh, b, key, bits, node);
+			if (unlikely(ret)) {
+				tdb_htrie_put_bucket(dbh);
+				return ret;
+			}
+			TDB_HTRIE_STAT_INC(dbh, retry);
+			goto retry;
+		}
+
+		tdb_htrie_rcl_add(dbh, b, idx ? i | TDB_HTRIE_RCL_IDX : i);
+		++n;
+	}
+
+	tdb_htrie_put_bucket(dbh);
+
+	return n;
+}
+
+/**
+ * Remove all entries with the key.
  *
  * Since the HTrie index uses hash values key collisions are possible, so
- * @eq_cb and @data are used by a caller to resolve collisions.
+ * @eq_cb and @data are used by a caller to resolve collisions: @eq_cb is
+ * called for each record with the key and @data as the second argument and
+ * only the records, for which the callback returns true, are removed.
+ * All the records with the key are removed if @eq_cb is NULL.
  *
- * We never remove the index blocks. However, the buckets can be up to 1 page
- * size, so we reclaim them.
+ * We never remove the index blocks and buckets, only the records are removed.
  *
  * Removal firstly looks up the key, so it doesn't retrieve a bucket burst
  * pointer as well as write-in-progress records (i.e. it's impossible to remove
@@ -1047,140 +2946,163 @@ tdb_htrie_walk(TdbHdr *dbh, int (*fn)(void *))
  *
  * Concurrent removal algorithm:
  *
- * (invariant) current bucket is considered read-only
  * (invariant) any CPU can observe not more than 1 bucket and 1 record at any
  *	       given point of time.
  *
- * 1. mark a record with 01 (remove in progress) in the bucket collision map.
- *    Lookup ignores the record state as the data is guaranteed to not to be
- *    freed until there is at least one dbh->pcpu->active_bckt pointing to the
- *    bucket.
- * 2. allocate a new bucket
- * 3. CMPXCHG on col_ptr for the old bucket to the pointer for the new one
- *    plus R-bit
- * 4. if != 0, then another CPU is going to reclaim it along with all removed
- *    data and our job is done; just reclaim the new bucket
- * 5. __htrie_bckt_reinsert_records() reinserts live records
- * 6. re-link the new bucket with CMPXCHG
- * 7. check all TdbPerCpu->active_bckt and reclaim bucket and data immediately
- *    if there are no users
- * 8. add the bucket to reclamation list of the last observed user of the bucket
- *    (it's not important which one). A bitmap of all users is added to the list
- *    to optimize scanning on the next step.
- * 9. Once a CPU need to allocate a bucket or data it checks the reclamation
- *    list and reclaim data if the list isn't empty. The reclamation procedure
- *    must check all the CPUs from the bitmap that nobody use the bucket.
+ * 1. mark a record with 01 (tombstone) in the bucket collision map.
+ *    Lookups skip the tombstones, but the data is guaranteed to not to be
+ *    freed until there is at least one CPU, which could see the record before
+ *    it was removed.
+ * 2. add the tombstone to the per-CPU batch of tombstones. Readers don't
+ *    care about the tombstones, so there is no any work on other CPUs.
+ * 3. once the batch is full, the previous batch is reclaimed. Each batch keeps
+ *    the readers generations of all the CPUs taken when it was sealed, so we
+ *    reclaim the tombstones data and make empty slots from the tombstones only
+ *    when all the CPUs passed the generations. That's one scan of the per-CPU
+ *    data per TDB_HTRIE_RCL_BATCH removed records instead of waiting for all
+ *    the CPUs on each removal.
+ *
+ * Records can't be removed from a bucket being bursted, so we help to finish
+ * the burst and continue with the new bucket.
+ *
+ * @return the number of removed records or a negative error code.
  */
 int
-tdb_htrie_remove(TdbHdr *dbh, uint64_t key, bool (*eq_cb)(void *), void *data)
+tdb_htrie_remove(TdbHdr *dbh, uint64_t key, bool (*eq_cb)(void *, void *),
+		 void *data)
 {
-	uint64_t o, new_off;
-	int bits = 0, i, dr = 0;
-	TdbRec *r, *data_reclaim[TDB_HTRIE_BCKT_SLOTS_N];
-	TdbHtrieBucket *b, *b_new;
-	TdbHtrieNode *node;
+	/* Use tdb_htrie_remove_keys() to not to leave dangling references. */
+	BUG_ON(dbh->idx_n > 1);
 
-	/*
-	 * FIXME allocate a new bucket even if we remove a last entry from a
-	 * bucket.
-	 *
-	 * TODO if there is no space, then we can't remove records. The end.
-	 * Probably, in this case we should block all CPUs on TDB operations
-	 * and evict records in-place.
-	 */
-	if (!(b_new = tdb_htrie_alloc_bucket(dbh)))
-		return -ENOMEM;
-	new_off = TDB_OFF(dbh, b_new);
+	return __htrie_remove(dbh, 0, key, eq_cb, data, 0);
+}
 
-retry:
-	b = tdb_htrie_descend_get_bckt(dbh, key, &bits, &node);
-	if (!b)
-		goto err_free;
-	BUG_ON(!__BCKT_ALIGNED(b));
+/**
+ * Remove all the entries with the primary key @keys[0] from all the indexes
+ * of the database, @keys are the keys of the entries in the indexes.
+ * See tdb_htrie_remove() for @eq_cb and @data.
+ *
+ * The records are removed from the secondary indexes before the primary one,
+ * so the record data, owned by the primary index, is reclaimed only when all
+ * the CPUs observing the record through any of the indexes leave it.
+ *
+ * @return the number of removed records or a negative error code.
+ */
+int
+tdb_htrie_remove_keys(TdbHdr *dbh, const uint64_t *keys,
+		      bool (*eq_cb)(void *, void *), void *data)
+{
+	int bits = 0, i, m = 0, n = 0, ret;
+	uint64_t off[TDB_HTRIE_BCKT_SLOTS_MAX];
+	unsigned int idx;
+	TdbRec *r;
+	TdbHtrieBucket *b;
+	TdbHtrieNode *node = tdb_htrie_root(dbh, 0);
 
 	/*
-	 * Unlink all data (remove).
-	 * Inserters (bursting function in particular) rely on the fact that
-	 * records are never freed and the collision map never gets zero bits,
-	 * so we need to copy the bucket node.
+	 * Collect the records to remove: we can observe only one bucket at
+	 * a time, so we can't keep the primary index bucket while we remove
+	 * the records from the secondary indexes.
 	 */
-	for (dr = 0, i = 0; i < TDB_HTRIE_BCKT_SLOTS_N; ++i) {
-		// FIXME spin if the bucket record is incomplete?
-		if (!(b->col_map & (1UL << __htrie_bckt_slot2bit(i))))
+	if (!(b = tdb_htrie_descend_get_bckt(dbh, keys[0], &bits, &node)))
+		return 0;
+	for (i = 0; i < dbh->bckt_slots; ++i) {
+		if (!__htrie_bckt_slot_live(b, i))
 			continue;
-		r = __htrie_bckt_rec(b, i);
-
-		if (r->key == key)
-			data_reclaim[dr++] = r;
-		else
-			// FIXME what if it fails?
-			__htrie_bckt_copy_metadata(dbh, b_new, r);
+		r = __htrie_bckt_rec(dbh, b, i);
+		if (r->key != keys[0])
+			continue;
+		if (eq_cb && !eq_cb(tdb_htrie_rec_ptr(dbh, r), data))
+			continue;
+		off[m++] = r->off;
 	}
+	tdb_htrie_put_bucket(dbh);
 
-	// FIXME empty bucket may appear.
-	i = tdb_htrie_idx_prev(dbh, key, bits);
-	if (atomic_cmpxchg((atomic_t *)&node->shifts[i], o, new_off) != o) {
-		tdb_htrie_init_bucket(b_new);
-		goto retry;
+	for (i = 0; i < m; ++i) {
+		for (idx = 1; idx < dbh->idx_n; ++idx) {
+			ret = __htrie_remove(dbh, idx, keys[idx], NULL, NULL,
+					     off[i]);
+			if (unlikely(ret < 0))
+				return ret;
+		}
+		ret = __htrie_remove(dbh, 0, keys[0], NULL, NULL, off[i]);
+		if (unlikely(ret < 0))
+			return ret;
+		/* The record could be concurrently removed. */
+		n += ret;
 	}
 
-	/*
-	 * Index to the new bucket referencing subset of the data of the original
-	 * bucket is published.
-	 *
-	 * [FIXME the comment] Increment the generation and wait while all
-	 * observers see genrations higher that the current one.
-	 *
-	 * TODO instead of spinning in tdb_htrie_synchronize_generation():
-	 * 1. rewrite the pointer to the bucket from an index node
-	 * 2. scan all dbh->pcpu->active_bckt
-	 * 3. ???
-	 *
-	 * Can/should we employ hazard pointers instead?
-	 */
+	return n;
+}
 
+/**
+ * Commit the record @rec into all the indexes of the database, @keys are the
+ * record keys in the indexes, the primary key goes first. The record is
+ * linked into the primary index firstly, so the secondary indexes never
+ * reference a record, which isn't in the primary index.
+ *
+ * @return @rec on success. The record is removed on failure and NULL is
+ * returned.
+ */
+TdbRec *
+tdb_htrie_insert_commit_keys(TdbHdr *dbh, const uint64_t *keys, TdbRec *rec)
+{
+	unsigned int i;
+
+	if (!tdb_htrie_insert_commit(dbh, keys[0], rec))
+		return NULL;
+
+	for (i = 1; i < dbh->idx_n; ++i)
+		if (unlikely(!__htrie_insert(dbh, i, keys[i], NULL, 0, rec)))
+			goto err;
+
+	return rec;
+err:
 	/*
-	 * Now all the CPU have observed our index changes and we can
-	 * reclaim the memory.
+	 * Other CPUs might already see the record through the indexes,
+	 * so the record is freed after it's removed from all the indexes.
 	 */
-	tdb_htrie_reclaim_bucket(dbh, b);
-	if (tdb_inplace(dbh))
-		return 0;
-	for (i = 0; i < dr; ++i) {
-		r = data_reclaim[i];
-		if (TDB_HTRIE_VARLENRECS(dbh)) {
-			TdbVRec *vr = (TdbVRec *)TDB_PTR(dbh, r->off);
-			while (1) {
-				o = vr->chunk_next;
-				tdb_htrie_free_data(dbh, vr, vr->len);
-				if (!o)
-					break;
-				vr = (TdbVRec *)TDB_PTR(dbh, o);
-			}
-		} else {
-			tdb_htrie_free_data(dbh, TDB_PTR(dbh, r->off),
-					    dbh->rec_len);
-		}
-	}
-	return 0;
-err_free:
-	tdb_htrie_reclaim_bucket(dbh, b_new);
-	return 0;
+	T_ERR("cannot insert key %#lx into index %u\n", keys[i], i);
+	while (--i)
+		__htrie_remove(dbh, i, keys[i], NULL, NULL, TDB_OFF(dbh, rec));
+	__htrie_remove(dbh, 0, keys[0], NULL, NULL, TDB_OFF(dbh, rec));
+
+	return NULL;
+}
+
+/**
+ * Insert a new entry into all the indexes of the database with the keys
+ * @keys, the primary key goes first. Just like tdb_htrie_insert(), but the
+ * inplace records can't be referenced by the secondary indexes.
+ */
+TdbRec *
+tdb_htrie_insert_keys(TdbHdr *dbh, const uint64_t *keys, const void *data,
+		      size_t *len)
+{
+	TdbRec *rec;
+
+	if (!(rec = tdb_htrie_insert_begin(dbh, keys[0], data, len)))
+		return NULL;
+	if (!(rec = tdb_htrie_insert_commit_keys(dbh, keys, rec)))
+		*len = 0;
+
+	return rec;
 }
 
 /**
  * Initialize a TDB table headers:
  *
- * +--------+------------------+---------------------------------------------------
- * | TdbHdr | dcache (LfStack) | per-cpu data | alignment | root node | TdbAlloc...
- * +--------+------------------+---------------------------------------------------
+ * +--------+------------------+------------------------------------------------------
+ * | TdbHdr | dcache (LfStack) | per-cpu data | alignment | root nodes | TdbAlloc...
+ * +--------+------------------+------------------------------------------------------
  *
  * - dcache is a variable-sized array inside TdbHdr data structure
  * - per-cpu data (TdbPerCpu) is just a persistent dump of a Linux per-CPU data
- *   (TODO #516: we don't have any durability providing recovery after crash yet).
+ *   done on a clean shutdown only, see tdb_htrie_recover() for the crash case.
  *   While we don't support hot-plug CPUs we expect that the number of CPUs may
  *   change after restart, so we use NR_CPUS to dump the data.
- * - the HTrie root node is aligned from the header data
+ * - the HTrie root node is aligned from the header data, the root nodes of
+ *   the secondary indexes, if any, follow the primary index root node
  * - probably it could make sense to place the TdbAlloc data (see comment in
  *   alloc.c for the internal layout) before the root node to improve spacoal
  *   nodes locality for faster tree traversals, but the current design isolates
@@ -1188,17 +3110,13 @@ err_free:
  */
 static int
 tdb_init_mapping(TdbHdr *dbh, size_t db_sz, size_t root_bits, uint32_t rec_len,
-		 uint32_t flags)
+		 unsigned int bckt_slots, unsigned int idx_n, uint32_t flags)
 {
-	int b;
+	int b, i;
 	TdbAlloc *a = &dbh->alloc;
 
 	if (db_sz > TDB_MAX_SHARD_SZ) {
-		/*
-		 * TODO #400 initialize NUMA-aware shards consisting an
-		 * HTrie forest. There should be separate instances of TdbAlloc
-		 * for each 128GB chunk.
-		 */
+		/* Use an HTrie forest, see tdb_htrie_forest_init(). */
 		T_ERR("too large database size (%lu)", db_sz);
 		return -E2BIG;
 	}
@@ -1212,26 +3130,44 @@ tdb_init_mapping(TdbHdr *dbh, size_t db_sz, size_t root_bits, uint32_t rec_len,
 		      " %lu provided\n", TDB_HTRIE_BITS, root_bits);
 		return -EINVAL;
 	}
+	if (bckt_slots > TDB_HTRIE_BCKT_SLOTS_MAX) {
+		T_ERR("too many bucket slots (%u)\n", bckt_slots);
+		return -EINVAL;
+	}
+	if (idx_n > TDB_HTRIE_IDX_MAX) {
+		T_ERR("too many indexes (%u)\n", idx_n);
+		return -EINVAL;
+	}
+	/* Inplace records are moved on bursts, so they can't be shared. */
+	if (idx_n > 1 && (flags & TDB_F_INPLACE)) {
+		T_ERR("Secondary indexes are possible for stable records only\n");
+		return -EINVAL;
+	}
 
 	dbh->magic = TDB_MAGIC;
 	dbh->flags = flags;
 	dbh->rec_len = rec_len;
 	dbh->root_bits = root_bits;
+	dbh->bckt_slots = bckt_slots ? : TDB_HTRIE_BCKT_SLOTS_N;
+	dbh->idx_n = idx_n ? : 1;
+	dbh->pcpu_n = num_online_cpus();
+	lfs_init(&dbh->bckt_pool);
 	lfs_init(&dbh->dcache[0]);
 	if (TDB_HTRIE_VARLENRECS(dbh)) {
 		/*
-		 * Caches for the data chunks of: 256B, 512B, 1KB, 2KB.
+		 * Caches for the data chunks of: 256B, 512B, 1KB, 2KB and
+		 * the slab objects caches.
 		 * 4KB chunks (blocks) are returned to the block allocator.
 		 */
-		lfs_init(&dbh->dcache[1]);
-		lfs_init(&dbh->dcache[2]);
-		lfs_init(&dbh->dcache[3]);
+		for (i = 1; i < TDB_HTRIE_DCACHE_MAX; ++i)
+			lfs_init(&dbh->dcache[i]);
 	}
 
-	memset(tdb_htrie_pcpu(dbh), 0, tdb_htrie_pcpu_sz());
-	memset(tdb_htrie_root(dbh), 0, tdb_htrie_root_sz(dbh));
+	memset(tdb_htrie_pcpu(dbh), 0, tdb_htrie_pcpu_sz(dbh));
+	memset(tdb_htrie_root(dbh, 0), 0, tdb_htrie_root_sz(dbh) * dbh->idx_n);
 
-	tdb_alloc_init(a, tdb_htrie_root_off(dbh) + tdb_htrie_root_sz(dbh), db_sz);
+	tdb_alloc_init(a, tdb_htrie_root_off(dbh)
+			  + tdb_htrie_root_sz(dbh) * dbh->idx_n, db_sz);
 
 	if (tdb_inplace(dbh)) {
 		if (!rec_len) {
@@ -1255,7 +3191,9 @@ __htrie_percpu_data_init(TdbHdr *dbh, TdbPerCpu *p)
 {
 	TdbAlloc *a = &dbh->alloc;
 
-	p->flags = 0;
+	/* Only the used slab size classes take the blocks. */
+	p->flags = TDB_HTRIE_NEED_SBLKS;
+	memset(p->s_wcl, 0, sizeof(p->s_wcl));
 	/*
 	 * Preallocate the blocks to avoid contention on the global
 	 * allocator on start.
@@ -1275,6 +3213,72 @@ __htrie_percpu_data_init(TdbHdr *dbh, TdbPerCpu *p)
 	}
 	BUG_ON(!p->i_wcl || !p->b_wcl);
 	p->free_bckt = 0;
+	p->stat.free_bckt = 0;
+}
+
+static void
+__htrie_stat_add(TdbHtrieStat *to, const TdbHtrieStat *s)
+{
+	to->insert += READ_ONCE(s->insert);
+	to->lookup += READ_ONCE(s->lookup);
+	to->depth += READ_ONCE(s->depth);
+	to->burst += READ_ONCE(s->burst);
+	to->retry += READ_ONCE(s->retry);
+	to->gen_wait += READ_ONCE(s->gen_wait);
+	to->rcl += READ_ONCE(s->rcl);
+	to->alloc_fail += READ_ONCE(s->alloc_fail);
+	to->free_bckt += READ_ONCE(s->free_bckt);
+	to->evict += READ_ONCE(s->evict);
+	to->expire += READ_ONCE(s->expire);
+	to->cow += READ_ONCE(s->cow);
+	to->data += READ_ONCE(s->data);
+}
+
+/*
+ * The CPUs, which aren't online on the database opening, e.g. added later
+ * by CPU hotplug, get the index, bucket and data blocks on the first
+ * allocation, so they don't take any database space until they use it.
+ */
+static void
+__htrie_percpu_data_lazy(TdbPerCpu *p)
+{
+	p->flags = TDB_ALLOC_F_NEED_IBLK | TDB_ALLOC_F_NEED_BBLK
+		   | TDB_ALLOC_F_NEED_DBLK | TDB_HTRIE_NEED_SBLKS;
+	p->i_wcl = 0;
+	p->b_wcl = 0;
+	p->d_wcl = 0;
+	memset(p->s_wcl, 0, sizeof(p->s_wcl));
+	p->free_bckt = 0;
+	p->stat.free_bckt = 0;
+}
+
+static bool
+__htrie_percpu_data_used(TdbPerCpu *p)
+{
+	int c;
+
+	for (c = 0; c < TDB_HTRIE_SLAB_N; ++c)
+		if (p->s_wcl[c])
+			return true;
+
+	return p->i_wcl || p->b_wcl || p->d_wcl || p->free_bckt;
+}
+
+/*
+ * Move the free buckets and the statistics of @from to @to. The allocation
+ * blocks of @from can't be merged, so the rest of their space is lost.
+ */
+static void
+__htrie_percpu_data_merge(TdbHdr *dbh, TdbPerCpu *to, TdbPerCpu *from)
+{
+	uint64_t *o = &to->free_bckt;
+
+	while (*o)
+		o = &((TdbHtrieBucket *)TDB_PTR(dbh, *o))->next;
+	*o = from->free_bckt;
+	from->free_bckt = 0;
+
+	__htrie_stat_add(&to->stat, &from->stat);
 }
 
 static void
@@ -1282,9 +3286,13 @@ tdb_htrie_percpu_data_init(TdbHdr *dbh)
 {
 	int cpu;
 
-	for_each_online_cpu(cpu) {
+	for_each_possible_cpu(cpu) {
 		TdbPerCpu *p = per_cpu_ptr(dbh->pcpu, cpu);
 
+		if (!cpu_online(cpu)) {
+			__htrie_percpu_data_lazy(p);
+			continue;
+		}
 		__htrie_percpu_data_init(dbh, p);
 
 		T_DBG("cpu/%d arenas: index %#lx, bucket %#lx, data %#lx\n",
@@ -1292,81 +3300,731 @@ tdb_htrie_percpu_data_init(TdbHdr *dbh)
 	}
 }
 
+/**
+ * Dump the per-CPU data of all the CPUs, which have used the database, to
+ * the @pcpu_n dump slots. The set of online CPUs may change between the
+ * database openings, so the slots aren't bound to the CPU IDs. If more CPUs
+ * were used than the slots, then the free buckets and the statistics of the
+ * rest CPUs are merged with the dumped data.
+ */
 static void
 tdb_htrie_percpu_data_dump(TdbHdr *dbh)
 {
 	int cpu;
+	unsigned int k = 0;
 	TdbPerCpu *to_p = tdb_htrie_pcpu(dbh);
 
-	for_each_online_cpu(cpu) {
+	for_each_possible_cpu(cpu) {
 		TdbPerCpu *p = per_cpu_ptr(dbh->pcpu, cpu);
 
-		memcpy(to_p, p, sizeof(*to_p));
-
-		++to_p;
+		if (!__htrie_percpu_data_used(p))
+			continue;
+		if (k < dbh->pcpu_n)
+			memcpy(&to_p[k], p, sizeof(*to_p));
+		else
+			__htrie_percpu_data_merge(dbh, &to_p[k % dbh->pcpu_n],
+						  p);
+		++k;
+	}
+	for ( ; k < dbh->pcpu_n; ++k) {
+		memset(&to_p[k], 0, sizeof(*to_p));
+		__htrie_percpu_data_lazy(&to_p[k]);
 	}
 }
 
 /**
- * TODO initialize per-CPU data for new CPUs added during a maintanence restart.
+ * Read the per-CPU data dump for the online CPUs. The CPUs, which don't have
+ * a dump slot, are initialized lazily. If there are less online CPUs than the
+ * slots, then the free buckets of the rest slots are merged into the first
+ * online CPU.
  */
 static void
 tdb_htrie_percpu_data_read(TdbHdr *dbh)
 {
 	int cpu;
-	TdbPerCpu *from_p = tdb_htrie_pcpu(dbh);
+	unsigned int k = 0;
+	TdbPerCpu *from_p = tdb_htrie_pcpu(dbh), *first = NULL;
 
-	for_each_online_cpu(cpu) {
+	for_each_possible_cpu(cpu) {
 		TdbPerCpu *p = per_cpu_ptr(dbh->pcpu, cpu);
 
-		memcpy(p, from_p, sizeof(*p));
+		if (!cpu_online(cpu) || k == dbh->pcpu_n) {
+			__htrie_percpu_data_lazy(p);
+			continue;
+		}
+		memcpy(p, &from_p[k++], sizeof(*p));
+		if (!first)
+			first = p;
+	}
+	BUG_ON(!first);
+	for ( ; k < dbh->pcpu_n; ++k)
+		__htrie_percpu_data_merge(dbh, first, &from_p[k]);
+}
+
+/**
+ * Roll back the burst of a bucket, which wasn't linked with the parent index
+ * node before a crash: all the records are still in the bucket, so just drop
+ * the new buckets of the burst index node @in. The index node itself can't be
+ * freed and is lost.
+ */
+static void
+tdb_htrie_recover_burst(TdbHdr *dbh, TdbHtrieNode *in)
+{
+	int i;
+
+	for (i = 0; i < TDB_HTRIE_FANOUT; ++i) {
+		uint32_t o = in->shifts[i];
+
+		if (!o)
+			continue;
+		BUG_ON(!(o & TDB_HTRIE_DBIT));
+		tdb_htrie_reclaim_bucket(dbh, TDB_PTR(dbh,
+					 TDB_I2O(o & ~TDB_HTRIE_DBIT)));
+	}
+}
+
+/**
+ * Bring bucket @b to a consistent state: the tombstones are reclaimed and
+ * the slots with records, which were being written on the crash, are made
+ * empty. The data of the partially written records is lost. The tombstones
+ * data is freed only if the bucket belongs to the primary index, i.e. @owner
+ * is true, and the data of the live records is counted in the statistics.
+ */
+static void
+tdb_htrie_recover_bckt(TdbHdr *dbh, TdbHtrieBucket *b, bool owner)
+{
+	int s;
+	uint64_t map = b->col_map;
+
+	if (map & (1UL << TDB_HTRIE_BCKT_BURST)) {
+		if (b->col_ptr._val)
+			tdb_htrie_recover_burst(dbh, TDB_PTR(dbh,
+						TDB_I2O(b->col_ptr._val)));
+		b->col_ptr._val = 0;
+		map &= ~((1UL << TDB_HTRIE_BCKT_MOVED(dbh->bckt_slots))
+			 - 1);
+	}
+
+	for (s = 0; s < dbh->bckt_slots; ++s) {
+		switch (__htrie_bckt_slot_state(map, s)) {
+		case TDB_HTRIE_SLOT_REC:
+			if (!tdb_inplace(dbh) && owner)
+				TDB_HTRIE_STAT_ADD(dbh, data,
+					tdb_htrie_rec_data_sz(dbh,
+						__htrie_bckt_rec(dbh, b, s)->off));
+			break;
+		case TDB_HTRIE_SLOT_REMOVED:
+			if (!tdb_inplace(dbh) && owner)
+				tdb_htrie_free_rec_data(dbh,
+						__htrie_bckt_rec(dbh, b, s)->off,
+						NULL);
+			/* fall through */
+		case TDB_HTRIE_SLOT_WRITE:
+			T_DBG2("recover slot %d of bucket ptr=%p\n", s, b);
+			map &= ~(3UL << __htrie_bckt_slot2bit(s));
+		}
+	}
+
+	b->col_map = map;
+}
+
+static void
+tdb_htrie_recover_node(TdbHdr *dbh, TdbHtrieNode *node, int fanout,
+		       bool owner)
+{
+	int i;
+
+	for (i = 0; i < fanout; ++i) {
+		uint32_t o = node->shifts[i];
 
-		++from_p;
+		if (!o)
+			continue;
+		if (o & TDB_HTRIE_DBIT)
+			tdb_htrie_recover_bckt(dbh, TDB_PTR(dbh,
+					       TDB_I2O(o & ~TDB_HTRIE_DBIT)),
+					       owner);
+		else
+			/* The recursion depth is limited by the key bits. */
+			tdb_htrie_recover_node(dbh, TDB_PTR(dbh, TDB_I2O(o)),
+					       TDB_HTRIE_FANOUT, owner);
 	}
 }
 
 /**
- * TODO #516 create multiple indexes of the same structure, but different keys.
+ * Recover the database, which wasn't properly closed. The per-CPU data dump
+ * is stale, so the per-CPU allocation blocks and free buckets lists are
+ * built from scratch and the space of the blocks used before the crash is
+ * lost. Only the tree is scanned, so the buckets retired before the crash
+ * are lost as well.
+ *
+ * There are no users of the database, so plain memory accesses are used.
+ */
+static void
+tdb_htrie_recover(TdbHdr *dbh)
+{
+	unsigned int idx;
+
+	T_LOG("recover the database at %p after a crash\n", dbh);
+
+	/* The free buckets are collected from the tree to the per-CPU lists. */
+	lfs_init(&dbh->bckt_pool);
+	tdb_htrie_percpu_data_init(dbh);
+	for (idx = 0; idx < dbh->idx_n; ++idx)
+		tdb_htrie_recover_node(dbh, tdb_htrie_root(dbh, idx),
+				       1 << dbh->root_bits, !idx);
+}
+
+/**
+ * @bckt_slots is the number of slots in the database buckets or zero for
+ * the default TDB_HTRIE_BCKT_SLOTS_N. The parameters of an existing database
+ * are kept on the database opening.
  *
- * TODO #400 dtatbabase shards should be addressed by a good hash function.
- * Range queries must be run over all the shards.
+ * @idx_n is the number of the database indexes, zero means just the primary
+ * index. The secondary indexes are the tries of the same structure, but with
+ * different keys, referencing the same records, see tdb_htrie_insert_keys().
  */
 TdbHdr *
 tdb_htrie_init(void *p, size_t db_sz, size_t root_bits, uint32_t rec_len,
-	       uint32_t flags)
+	       unsigned int bckt_slots, unsigned int idx_n, uint32_t flags)
 {
 	TdbHdr *dbh = (TdbHdr *)p;
 
 	BUILD_BUG_ON(TDB_HTRIE_COLL_MAX > BITS_PER_LONG - 1);
+	BUILD_BUG_ON(TDB_HTRIE_BCKT_MOVED(TDB_HTRIE_BCKT_SLOTS_MAX)
+		     > 2 * (TDB_HTRIE_COLL_MAX - TDB_HTRIE_BCKT_SLOTS_MAX));
 	BUILD_BUG_ON(sizeof(TdbHtrieNode) != TDB_HTRIE_ALIGN(sizeof(TdbHtrieNode)));
 
+	tdb_htrie_avx2 = boot_cpu_has(X86_FEATURE_AVX2);
+
 	/* Set per-CPU pointers. */
 	dbh->pcpu = alloc_percpu(TdbPerCpu);
 	if (!dbh->pcpu) {
 		T_ERR("cannot allocate per-cpu data\n");
 		return NULL;
 	}
+	dbh->rcl = alloc_percpu(TdbRcl);
+	if (!dbh->rcl) {
+		T_ERR("cannot allocate per-cpu reclamation data\n");
+		free_percpu(dbh->pcpu);
+		return NULL;
+	}
 
 	if (dbh->magic != TDB_MAGIC) {
-		if (tdb_init_mapping(dbh, db_sz, root_bits, rec_len, flags)) {
+		if (tdb_init_mapping(dbh, db_sz, root_bits, rec_len,
+				     bckt_slots, idx_n, flags))
+		{
 			T_ERR("cannot init db mapping\n");
+			free_percpu(dbh->rcl);
 			free_percpu(dbh->pcpu);
 			return NULL;
 		}
 		tdb_htrie_percpu_data_init(dbh);
 	} else {
-		tdb_htrie_percpu_data_read(dbh);
+		/*
+		 * The growth callback is set in runtime, so it's stale for
+		 * the database opened again, see tdb_htrie_set_grow().
+		 */
+		dbh->alloc.grow = NULL;
+		if (dbh->flags & TDB_F_DIRTY)
+			tdb_htrie_recover(dbh);
+		else
+			tdb_htrie_percpu_data_read(dbh);
 	}
+	/* A snapshot doesn't survive the database close or a crash. */
+	dbh->snap = NULL;
+	dbh->snap_gen &= ~(TDB_HTRIE_SNAP_GEN - 1);
+	/* The flag is cleared on the clean shutdown by tdb_htrie_exit(). */
+	dbh->flags |= TDB_F_DIRTY;
 
 	T_DBG("db mapping at %p, htrie root %p, rec_len=%u\n",
-	      dbh, tdb_htrie_root(dbh), dbh->rec_len);
+	      dbh, tdb_htrie_root(dbh, 0), dbh->rec_len);
+
+	return dbh;
+}
+
+/**
+ * Sum up the per-CPU statistics of the database to @st.
+ */
+void
+tdb_htrie_stat(TdbHdr *dbh, TdbHtrieStat *st)
+{
+	int cpu;
+
+	memset(st, 0, sizeof(*st));
+
+	/* The CPUs, which went offline, keep their counters. */
+	for_each_possible_cpu(cpu) {
+		TdbPerCpu *p = per_cpu_ptr(dbh->pcpu, cpu);
+
+		__htrie_stat_add(st, &p->stat);
+	}
+}
+
+/**
+ * Print the database parameters and statistics to @buf of @len bytes.
+ * The counters are read without synchronization, so they're approximate
+ * under concurrent updates.
+ *
+ * @return the number of printed bytes.
+ */
+int
+tdb_htrie_info(TdbHdr *dbh, char *buf, size_t len)
+{
+	TdbHtrieStat st;
+	unsigned long depth10;
+	int n;
+
+	tdb_htrie_stat(dbh, &st);
+	/* The average descent depth with one decimal digit. */
+	depth10 = st.lookup ? st.depth * 10 / st.lookup : 0;
+
+	n = snprintf(buf, len,
+		     "root bits:\t\t%u\n"
+		     "bucket slots:\t\t%u\n"
+		     "size:\t\t\t%luMB of %luMB\n"
+		     "inserts:\t\t%lu\n"
+		     "lookups:\t\t%lu\n"
+		     "average depth:\t\t%lu.%lu bits\n"
+		     "bursts:\t\t\t%lu\n"
+		     "retries:\t\t%lu\n"
+		     "generation waits:\t%lu\n"
+		     "reclaimed:\t\t%lu\n"
+		     "allocation failures:\t%lu\n"
+		     "free buckets:\t\t%lu\n"
+		     "evicted:\t\t%lu\n"
+		     "expired:\t\t%lu\n"
+		     "copied on write:\t%lu\n"
+		     "records data:\t\t%ldKB\n",
+		     dbh->root_bits, dbh->bckt_slots,
+		     tdb_dbsz(dbh) >> 20,
+		     ((size_t)READ_ONCE(dbh->alloc.ext_lim) + 1) * TDB_EXT_SZ >> 20,
+		     st.insert, st.lookup, depth10 / 10, depth10 % 10,
+		     st.burst, st.retry, st.gen_wait, st.rcl, st.alloc_fail,
+		     st.free_bckt, st.evict, st.expire, st.cow, st.data >> 10);
+
+	return n < len ? n : len;
+}
+
+/**
+ * The layout analysis reads a database, which may be broken, e.g. an image of
+ * a crashed database, so each reference is checked to be inside the database
+ * after the headers.
+ */
+static bool
+__htrie_layout_ref_ok(TdbHdr *dbh, uint64_t o, size_t sz)
+{
+	return o >= tdb_htrie_root_off(dbh) && o + sz <= tdb_dbsz(dbh);
+}
+
+/**
+ * The number of bytes of the data referenced by record metadata @r, the same
+ * as tdb_htrie_rec_data_sz(), but for a possibly broken chain of the data
+ * chunks.
+ */
+static size_t
+__htrie_layout_data_sz(TdbHdr *dbh, TdbRec *r, TdbHtrieLayout *l)
+{
+	TdbVRec *vr;
+	size_t n = 0;
+	uint64_t off = READ_ONCE(r->off);
+
+	if (!TDB_HTRIE_VARLENRECS(dbh))
+		return tdb_htrie_chunk_sz(dbh, dbh->rec_len);
+
+	/*
+	 * The chunks are 8-byte aligned and each chunk takes at least 8 bytes,
+	 * so a chain loop is also caught.
+	 */
+	while (!(off & 7) && __htrie_layout_ref_ok(dbh, off, sizeof(*vr))
+	       && n < tdb_dbsz(dbh))
+	{
+		vr = TDB_PTR(dbh, off);
+		n += tdb_htrie_chunk_sz(dbh, READ_ONCE(vr->len));
+		if (!(off = TDB_D2O((uint64_t)READ_ONCE(vr->chunk_next))))
+			return n;
+	}
+	++l->bad;
+
+	return n;
+}
+
+static uint64_t
+__htrie_layout_bckt(TdbHdr *dbh, TdbHtrieBucket *b, int lvl, bool owner,
+		    TdbHtrieLayout *l)
+{
+	int s, used = 0;
+	uint64_t n = 0, map = READ_ONCE(b->col_map);
+
+	if (map & (1UL << TDB_HTRIE_BCKT_BURST))
+		++l->frozen;
+
+	for (s = 0; s < dbh->bckt_slots; ++s) {
+		unsigned int st = __htrie_bckt_slot_state(map, s);
+
+		++l->slots[st];
+		if (st == TDB_HTRIE_SLOT_EMPTY)
+			continue;
+		++used;
+		if (st != TDB_HTRIE_SLOT_REC)
+			continue;
+		++n;
+		if (owner && !tdb_inplace(dbh))
+			l->data += __htrie_layout_data_sz(dbh,
+						__htrie_bckt_rec(dbh, b, s), l);
+	}
+	++l->bckts[lvl];
+	++l->fill[used];
+	l->recs[lvl] += n;
+
+	return n;
+}
+
+/**
+ * Collect the layout of the index subtree of @node on level @lvl.
+ * @return the number of live records in the subtree.
+ */
+static uint64_t
+__htrie_layout_node(TdbHdr *dbh, TdbHtrieNode *node, int fanout, int lvl,
+		    bool owner, TdbHtrieLayout *l)
+{
+	int i;
+	uint64_t n, recs = 0;
+	/* The deepest index node resolves the most significant key bits. */
+	int lvl_max = (BITS_PER_LONG - dbh->root_bits) / TDB_HTRIE_BITS;
+
+	for (i = 0; i < fanout; ++i) {
+		uint32_t o = READ_ONCE(node->shifts[i]);
+
+		if (!o)
+			continue;
+		if (lvl)
+			++l->node_slots;
+
+		if (o & TDB_HTRIE_DBIT) {
+			o ^= TDB_HTRIE_DBIT;
+			if (!__htrie_layout_ref_ok(dbh, TDB_I2O(o),
+						   tdb_htrie_bckt_sz(dbh)))
+			{
+				++l->bad;
+				continue;
+			}
+			n = __htrie_layout_bckt(dbh, TDB_PTR(dbh, TDB_I2O(o)),
+						lvl, owner, l);
+			l->root_bckts += !lvl;
+		} else {
+			if (lvl == lvl_max
+			    || !__htrie_layout_ref_ok(dbh, TDB_I2O(o),
+						      sizeof(TdbHtrieNode)))
+			{
+				++l->bad;
+				continue;
+			}
+			++l->nodes[lvl + 1];
+			/* The recursion depth is limited by the key bits. */
+			n = __htrie_layout_node(dbh, TDB_PTR(dbh, TDB_I2O(o)),
+						TDB_HTRIE_FANOUT, lvl + 1,
+						owner, l);
+			l->root_nodes += !lvl;
+		}
+
+		if (!lvl) {
+			if (n > l->root_max)
+				l->root_max = n;
+			l->root_sq += n * n;
+		}
+		recs += n;
+	}
+
+	return recs;
+}
+
+/**
+ * @return the number of free buckets in the list linked by @next from the
+ * bucket at offset @o.
+ */
+static uint64_t
+__htrie_layout_bckt_list(TdbHdr *dbh, uint64_t o, TdbHtrieLayout *l)
+{
+	uint64_t n = 0, max = tdb_dbsz(dbh) / tdb_htrie_bckt_sz(dbh);
+
+	for ( ; o; o = READ_ONCE(((TdbHtrieBucket *)TDB_PTR(dbh, o))->next)) {
+		if (n == max
+		    || !__htrie_layout_ref_ok(dbh, o, tdb_htrie_bckt_sz(dbh)))
+		{
+			++l->bad;
+			break;
+		}
+		++n;
+	}
+
+	return n;
+}
+
+/**
+ * @return the number of entries in stack @s, which keeps the entries offsets
+ * shifted by @shift bits.
+ */
+static uint64_t
+__htrie_layout_stack(TdbHdr *dbh, LfStack *s, int shift, TdbHtrieLayout *l)
+{
+	uint64_t o, n = 0, max = tdb_dbsz(dbh) >> shift;
+	int id = atomic_read(&s->val);
+
+	for ( ; id != LFS_NIL; ++n) {
+		o = (uint64_t)(uint32_t)id << shift;
+		if (n == max || !__htrie_layout_ref_ok(dbh, o, sizeof(SEntry)))
+		{
+			++l->bad;
+			break;
+		}
+		id = READ_ONCE(((SEntry *)TDB_PTR(dbh, o))->next);
+	}
+
+	return n;
+}
+
+static void
+__htrie_layout_pcpu(TdbHdr *dbh, TdbPerCpu *p, TdbHtrieLayout *l)
+{
+	l->pcpu_free[l->pcpu_n++] =
+		__htrie_layout_bckt_list(dbh, READ_ONCE(p->free_bckt), l);
+	__htrie_stat_add(&l->stat, &p->stat);
+}
+
+/**
+ * Collect the layout of index @idx and of the shared database structures,
+ * except the per-CPU data, to @l.
+ */
+static int
+__htrie_layout(TdbHdr *dbh, unsigned int idx, TdbHtrieLayout *l)
+{
+	int c;
+
+	if (idx >= dbh->idx_n)
+		return -EINVAL;
+
+	memset(l, 0, sizeof(*l));
+	l->bckt_sz = tdb_htrie_bckt_sz(dbh);
+	__htrie_layout_node(dbh, tdb_htrie_root(dbh, idx), 1 << dbh->root_bits,
+			    0, !idx, l);
+
+	l->pool = __htrie_layout_stack(dbh, &dbh->bckt_pool,
+				       TDB_HTRIE_BCKT_SHIFT, l)
+		  * TDB_HTRIE_BCKT_BATCH;
+	for (c = 0; c < (dbh->rec_len ? 1 : TDB_HTRIE_DCACHE_MAX); ++c)
+		l->dcache[c] = __htrie_layout_stack(dbh, &dbh->dcache[c],
+						    TDB_HTRIE_DCACHE_SHIFT, l);
+	tdb_alloc_usage(&dbh->alloc, &l->alloc);
+
+	return 0;
+}
+
+/**
+ * Collect the layout of index @idx of an opened database to @l, e.g. to choose
+ * the root bits and the database size for the table. The whole index is
+ * walked, so this is a heavy operation. The database is read without
+ * synchronization, so the layout is approximate under concurrent updates.
+ *
+ * The free buckets lists are reported for each CPU, which has used the
+ * database.
+ */
+int
+tdb_htrie_layout(TdbHdr *dbh, unsigned int idx, TdbHtrieLayout *l)
+{
+	int r, cpu;
+
+	if ((r = __htrie_layout(dbh, idx, l)))
+		return r;
+
+	for_each_possible_cpu(cpu) {
+		TdbPerCpu *p = per_cpu_ptr(dbh->pcpu, cpu);
+
+		if (!__htrie_percpu_data_used(p)) {
+			__htrie_stat_add(&l->stat, &p->stat);
+			continue;
+		}
+		/* Keep the CPU IDs for the lists. */
+		while (l->pcpu_n < cpu)
+			l->pcpu_free[l->pcpu_n++] = 0;
+		__htrie_layout_pcpu(dbh, p, l);
+	}
+
+	return 0;
+}
+
+/**
+ * Check that @p of @size bytes is an image of a database, e.g. a database
+ * file or a dump of the mapped database memory, which can be analyzed with
+ * tdb_htrie_layout_image(). The image is only read, so it can be mapped
+ * read-only at any address.
+ *
+ * @return the database header or NULL if the image is broken.
+ */
+TdbHdr *
+tdb_htrie_image(void *p, size_t size)
+{
+	TdbHdr *dbh = (TdbHdr *)p;
+
+	if (size < sizeof(*dbh) || dbh->magic != TDB_MAGIC)
+		return NULL;
+	if (dbh->root_bits < TDB_HTRIE_BITS || dbh->root_bits >= BITS_PER_LONG
+	    || (dbh->root_bits & (TDB_HTRIE_BITS - 1))
+	    || !dbh->bckt_slots || dbh->bckt_slots > TDB_HTRIE_BCKT_SLOTS_MAX
+	    || !dbh->idx_n || dbh->idx_n > TDB_HTRIE_IDX_MAX
+	    || dbh->pcpu_n > NR_CPUS)
+		return NULL;
+	if (tdb_dbsz(dbh) > size || tdb_dbsz(dbh) > TDB_MAX_SHARD_SZ
+	    || tdb_htrie_root_off(dbh) + tdb_htrie_root_sz(dbh) * dbh->idx_n
+	       > tdb_dbsz(dbh))
+		return NULL;
 
 	return dbh;
 }
 
+/**
+ * The same as tdb_htrie_layout(), but for a database image, checked by
+ * tdb_htrie_image(). The free buckets lists are taken from the per-CPU data
+ * dump slots, which are valid only if the database was properly closed.
+ */
+int
+tdb_htrie_layout_image(TdbHdr *dbh, unsigned int idx, TdbHtrieLayout *l)
+{
+	int r;
+	unsigned int k;
+
+	if ((r = __htrie_layout(dbh, idx, l)))
+		return r;
+
+	if (dbh->flags & TDB_F_DIRTY)
+		return 0;
+	for (k = 0; k < dbh->pcpu_n; ++k)
+		__htrie_layout_pcpu(dbh, &tdb_htrie_pcpu(dbh)[k], l);
+
+	return 0;
+}
+
+/**
+ * Recycle the completely free extents of the database, e.g. after removal
+ * of many large records, see tdb_alloc_compact().
+ * @return the number of bytes in the recycled extents.
+ */
+size_t
+tdb_htrie_compact(TdbHdr *dbh)
+{
+	return (size_t)tdb_alloc_compact(&dbh->alloc) * TDB_EXT_SZ;
+}
+
+/**
+ * Let the database grow online up to @max_sz bytes. The address space up to
+ * @max_sz must be reserved for the database and @grow must make the memory
+ * at @addr of @len bytes available for the database to be called, when the
+ * database runs out of space. Must be called each time the database is opened.
+ */
+int
+tdb_htrie_set_grow(TdbHdr *dbh, size_t max_sz,
+		   int (*grow)(void *addr, size_t len))
+{
+	if (max_sz > TDB_MAX_SHARD_SZ) {
+		T_ERR("too large database size limit (%lu)\n", max_sz);
+		return -E2BIG;
+	}
+
+	return tdb_alloc_set_grow(&dbh->alloc, max_sz, grow);
+}
+
 void
 tdb_htrie_exit(TdbHdr *dbh)
 {
+	int cpu;
+
+	if (dbh->snap)
+		tdb_htrie_snapshot_end(dbh);
+
+	/*
+	 * There are no users of the database, so just free all tombstones,
+	 * also of the CPUs, which went offline.
+	 */
+	for_each_possible_cpu(cpu) {
+		TdbRcl *rcl = per_cpu_ptr(dbh->rcl, cpu);
+
+		tdb_htrie_rcl_free(dbh, rcl, &rcl->b[0]);
+		tdb_htrie_rcl_free(dbh, rcl, &rcl->b[1]);
+	}
+	/* All the tombstones are reclaimed, so free the bursted buckets. */
+	for_each_possible_cpu(cpu) {
+		TdbRcl *rcl = per_cpu_ptr(dbh->rcl, cpu);
+
+		tdb_htrie_rcl_zombies(dbh, rcl);
+		tdb_htrie_snap_defer_free(dbh, rcl);
+	}
+	free_percpu(dbh->rcl);
+
 	tdb_htrie_percpu_data_dump(dbh);
 	free_percpu(dbh->pcpu);
+
+	/* The database is consistent and the per-CPU data dump is valid. */
+	smp_mb();
+	dbh->flags &= ~TDB_F_DIRTY;
+}
+
+/**
+ * Initialize an HTrie forest of @n shards mapped at addresses @p of
+ * @shard_sz bytes each. Each shard is a separate database with its own
+ * allocator, so a shard memory can be bound to a NUMA node and the shard
+ * never allocates memory from other nodes.
+ *
+ * Range queries must be run over all the shards. The shards are chosen by
+ * the primary key, so the forest databases have no secondary indexes.
+ */
+int
+tdb_htrie_forest_init(TdbHtrieForest *f, void **p, unsigned int n,
+		      size_t shard_sz, size_t root_bits, uint32_t rec_len,
+		      unsigned int bckt_slots, uint32_t flags)
+{
+	unsigned int i;
+
+	if (!n || n > TDB_HTRIE_SHARDS_MAX) {
+		T_ERR("bad number of HTrie shards (%u)\n", n);
+		return -EINVAL;
+	}
+	/* The prefixes of the same address must be in the same shard. */
+	if (flags & TDB_F_RAWKEY) {
+		T_ERR("HTrie forest can't shard raw keys\n");
+		return -EINVAL;
+	}
+
+	for (i = 0; i < n; ++i) {
+		f->shards[i] = tdb_htrie_init(p[i], shard_sz, root_bits,
+					      rec_len, bckt_slots, 1, flags);
+		if (!f->shards[i]) {
+			T_ERR("cannot init HTrie shard %u\n", i);
+			goto err;
+		}
+		/* The same database must be reopened with the same geometry. */
+		if (f->shards[i]->rec_len != rec_len
+		    || f->shards[i]->root_bits != root_bits
+		    || (bckt_slots && f->shards[i]->bckt_slots != bckt_slots))
+		{
+			T_ERR("HTrie shard %u has different format\n", i);
+			tdb_htrie_exit(f->shards[i]);
+			goto err;
+		}
+	}
+	f->n = n;
+
+	return 0;
+err:
+	while (i--)
+		tdb_htrie_exit(f->shards[i]);
+	return -EINVAL;
+}
+
+void
+tdb_htrie_forest_exit(TdbHtrieForest *f)
+{
+	unsigned int i;
+
+	for (i = 0; i < f->n; ++i)
+		tdb_htrie_exit(f->shards[i]);
+	f->n = 0;
 }
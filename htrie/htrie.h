@@ -41,14 +41,18 @@
  * Header for collision bursting bucket.
  *
  * @col_map	- bitmap of filled record places in the bucket.
- *		  Each slot takes 2 bits:
+ *		  Each slot takes 2 bits (the most significant bit first):
  *		    00 - slot is empty
  *		    10 - regular occuped slot
- *		    01 - record removal in progress
+ *		    01 - record removal in progress (tombstone)
  *		    11 - record write in progress
+ *		  The less significant bits, not used by the slots, are used
+ *		  for the bucket burst.
  * @next	- offset of the next bucket in the free list or zero
  * @col_ptr	- pointer to a new index node to burst the bucket and resolve
  *		  contention on the bucket inserts.
+ * @ref_map	- reference bits of the slots, set by the lookups and cleared
+ *		  by the eviction sweeps, see tdb_htrie_evict().
  */
 typedef struct {
 	union {
@@ -56,24 +60,179 @@ typedef struct {
 		uint64_t	next;
 	};
 	lf_uint32_t		col_ptr;
+	uint64_t		ref_map;
 } __attribute__((packed)) TdbHtrieBucket;
 
-/* The maximum number of collisions per bucket before burst. */
+/* Bucket slot states, see @col_map description above. */
+#define TDB_HTRIE_SLOT_EMPTY		0
+#define TDB_HTRIE_SLOT_REMOVED		1
+#define TDB_HTRIE_SLOT_REC		2
+#define TDB_HTRIE_SLOT_WRITE		3
+
+/*
+ * The number of keys whose descents are done in lockstep by
+ * tdb_htrie_lookup_batch().
+ */
+#define TDB_HTRIE_LOOKUP_BATCH		32
+
+/* The number of slot bit pairs in a bucket collision map. */
 #define TDB_HTRIE_COLL_MAX		(BITS_PER_LONG / 2)
 /*
- * The minimum free slots before bucket burst.
- * 32 bits are available at the moment.
- * TODO this should depend on the record size, so should be configurable
- * for the database instance. Benchmark this.
+ * The number of (meta-)data records stored per a bucket, i.e. a bucket is
+ * bursted when all the slots are occupied. This also defines how many
+ * duplicate keys (for each value) the Htrie can handle.
+ *
+ * The number of slots is configurable for a database instance, e.g. smaller
+ * buckets are better for large inplace records. The burst bits for all the
+ * slots must fit the collision map bits, not used by the slots, so 21 slots
+ * is the maximum. Use the benchmark sweep mode to choose the value.
+ */
+#define TDB_HTRIE_BCKT_SLOTS_N		16
+#define TDB_HTRIE_BCKT_SLOTS_MAX	((TDB_HTRIE_COLL_MAX * 2 - 1) / 3)
+/*
+ * Collision map bits for the bucket burst: the bucket is frozen for inserts
+ * and removals and slot @s is already moved to a new bucket.
+ */
+#define TDB_HTRIE_BCKT_BURST		0
+#define TDB_HTRIE_BCKT_MOVED(s)		(1 + (s))
+
+/*
+ * The maximum number of indexes of a database: the primary index owning
+ * the data and the secondary indexes over the same data with different keys.
+ */
+#define TDB_HTRIE_IDX_MAX		8
+
+/* The maximum number of HTrie shards in a forest. */
+#define TDB_HTRIE_SHARDS_MAX		64
+
+/**
+ * HTrie forest: independent HTrie shards, typically one per NUMA node, each
+ * with its own memory allocator.
+ *
+ * @n		- number of the shards
+ * @shards	- HTrie headers of the shards
+ */
+typedef struct {
+	unsigned int		n;
+	TdbHdr			*shards[TDB_HTRIE_SHARDS_MAX];
+} TdbHtrieForest;
+
+/**
+ * Get a shard for the @key.
+ *
+ * The HTrie index is built on the less significant bits of the keys, so the
+ * shards are addressed by the most significant bits of a good hash of the
+ * key. The number of shards doesn't have to be a power of 2.
  */
-#define TDB_HTRIE_BURST_MIN_BITS	16
+static inline TdbHdr *
+tdb_htrie_shard(TdbHtrieForest *f, uint64_t key)
+{
+	uint64_t h = key * 0x61c8864680b583ebUL; /* GOLDEN_RATIO_64 */
+
+	return f->shards[((unsigned __int128)h * f->n) >> 64];
+}
+
 /*
- * The maximum number of (meta-)data records stored per a bucket.
- * This also defines how many duplicate keys (for each value)
- * the Htrie can handle.
+ * The maximum depth of the index: the root and 4-bit nodes for the rest of
+ * the 64-bit keys for the smallest root.
  */
-#define TDB_HTRIE_BCKT_SLOTS_N		(TDB_HTRIE_COLL_MAX		\
-					 - TDB_HTRIE_BURST_MIN_BITS)
+#define TDB_HTRIE_DEPTH_MAX		(BITS_PER_LONG / TDB_HTRIE_BITS)
+
+/**
+ * Position of an incremental walk, see tdb_htrie_walk_next(). The cursor
+ * doesn't keep any pointers, so the index can be changed between the walk
+ * calls.
+ *
+ * @depth	- the index level of the current position;
+ * @slot	- the next bucket slot to visit;
+ * @end		- the walk is finished;
+ * @path	- the node slots on the index levels from the root down to
+ *		  the current position;
+ */
+typedef struct {
+	unsigned int		depth;
+	unsigned int		slot;
+	bool			end;
+	uint32_t		path[TDB_HTRIE_DEPTH_MAX];
+} TdbHtrieCursor;
+
+static inline void
+tdb_htrie_cursor_init(TdbHtrieCursor *cur)
+{
+	memset(cur, 0, sizeof(*cur));
+}
+
+/**
+ * Layout of a database index, see tdb_htrie_layout(). The index levels are
+ * counted from the root, so the buckets referenced by the root are on level 0
+ * and the index nodes referenced by the root are on level 1.
+ *
+ * @nodes	- index nodes on each level, the root isn't counted;
+ * @node_slots	- used slots of all the index nodes except the root;
+ * @bckts	- buckets on each level;
+ * @recs	- live records in the buckets on each level;
+ * @fill	- buckets by the number of occupied, i.e. non-empty, slots;
+ * @slots	- bucket slots in each state, TDB_HTRIE_SLOT_*;
+ * @frozen	- buckets frozen for a burst, so there is a burst in progress
+ *		  or a crash during a burst;
+ * @root_bckts	- root slots referencing buckets;
+ * @root_nodes	- root slots referencing index nodes;
+ * @root_max	- the maximum number of records under a root slot;
+ * @root_sq	- sum of squares of the numbers of records under all the root
+ *		  slots to estimate the keys distribution;
+ * @bckt_sz	- bytes of a bucket;
+ * @data	- bytes of the records data, inplace records aren't counted;
+ * @bad		- references out of the database or beyond the index depth
+ *		  and broken free lists;
+ * @pcpu_n	- the number of entries in @pcpu_free, zero if the per-CPU
+ *		  data isn't available, i.e. for an image of a database, which
+ *		  wasn't properly closed;
+ * @pcpu_free	- free buckets in each per-CPU list;
+ * @pool	- free buckets in the global pool;
+ * @dcache	- freed data chunks in each data cache;
+ * @stat	- the operations statistics summed up for all the CPUs;
+ * @alloc	- the extents and blocks utilization;
+ */
+typedef struct {
+	uint64_t		nodes[TDB_HTRIE_DEPTH_MAX];
+	uint64_t		node_slots;
+	uint64_t		bckts[TDB_HTRIE_DEPTH_MAX];
+	uint64_t		recs[TDB_HTRIE_DEPTH_MAX];
+	uint64_t		fill[TDB_HTRIE_BCKT_SLOTS_MAX + 1];
+	uint64_t		slots[4];
+	uint64_t		frozen;
+	uint64_t		root_bckts;
+	uint64_t		root_nodes;
+	uint64_t		root_max;
+	uint64_t		root_sq;
+	uint64_t		bckt_sz;
+	uint64_t		data;
+	uint64_t		bad;
+	unsigned int		pcpu_n;
+	uint64_t		pcpu_free[NR_CPUS];
+	uint64_t		pool;
+	uint64_t		dcache[TDB_HTRIE_DCACHE_MAX];
+	TdbHtrieStat		stat;
+	TdbAllocUsage		alloc;
+} TdbHtrieLayout;
+
+/*
+ * Prefix keys for the raw keys databases (TDB_F_RAWKEY): the address goes in
+ * the most significant bits, e.g. an IPv4 address takes the 32 most
+ * significant bits and an IPv6 address is represented by its 64-bit routing
+ * prefix, and the prefix length is stored in the least significant bits.
+ */
+#define TDB_HTRIE_PFX_LEN_BITS		6
+#define TDB_HTRIE_PFX_MAX		(BITS_PER_LONG - TDB_HTRIE_PFX_LEN_BITS)
+
+/**
+ * Get a key for the prefix of @plen bits of the address @addr.
+ */
+static inline uint64_t
+tdb_htrie_pfx_key(uint64_t addr, unsigned int plen)
+{
+	return (plen ? addr & (~0UL << (BITS_PER_LONG - plen)) : 0) | plen;
+}
 
 /**
  * Use this to let all freed HTrie data to be reclaimed, e.g.
@@ -85,7 +244,11 @@ typedef struct {
 static inline void
 tdb_htrie_put_bucket(TdbHdr *dbh)
 {
-	WRITE_ONCE(this_cpu_ptr(dbh->pcpu)->active_bckt, 0);
+	TdbPerCpu *p = this_cpu_ptr(dbh->pcpu);
+
+	WRITE_ONCE(p->active_bckt, 0);
+	/* Let reclaimers know that we left the bucket. */
+	WRITE_ONCE(p->gen, p->gen + 1);
 }
 
 /**
@@ -102,13 +265,70 @@ tdb_htrie_put_bucket(TdbHdr *dbh)
 EXTERN_C TdbVRec *tdb_htrie_extend_rec(TdbHdr *dbh, TdbVRec *rec, size_t size);
 EXTERN_C TdbRec *tdb_htrie_insert(TdbHdr *dbh, uint64_t key,
 				  const void *data, size_t *len);
+EXTERN_C TdbRec *tdb_htrie_insert_begin(TdbHdr *dbh, uint64_t key,
+					const void *data, size_t *len);
+EXTERN_C TdbRec *tdb_htrie_insert_commit(TdbHdr *dbh, uint64_t key,
+					 TdbRec *rec);
+EXTERN_C TdbRec *tdb_htrie_insert_commit_keys(TdbHdr *dbh,
+					      const uint64_t *keys,
+					      TdbRec *rec);
+EXTERN_C TdbRec *tdb_htrie_insert_keys(TdbHdr *dbh, const uint64_t *keys,
+				       const void *data, size_t *len);
+EXTERN_C TdbRec *tdb_htrie_insert_prefix(TdbHdr *dbh, uint64_t addr,
+					 unsigned int plen, const void *data,
+					 size_t *len);
+EXTERN_C void tdb_htrie_insert_abort(TdbHdr *dbh, TdbRec *rec);
 EXTERN_C TdbHtrieBucket *tdb_htrie_lookup(TdbHdr *dbh, uint64_t key);
+EXTERN_C TdbHtrieBucket *tdb_htrie_lookup_idx(TdbHdr *dbh, unsigned int idx,
+					      uint64_t key);
+EXTERN_C int tdb_htrie_lookup_batch(TdbHdr *dbh, const uint64_t *keys, int n,
+				    TdbHtrieBucket **out);
+EXTERN_C TdbHtrieBucket *tdb_htrie_lookup_prefix(TdbHdr *dbh, uint64_t addr,
+						 unsigned int *plen);
 EXTERN_C int tdb_htrie_remove(TdbHdr *dbh, uint64_t key,
-			      bool (*eq_cb)(void *), void *data);
+			      bool (*eq_cb)(void *, void *), void *data);
+EXTERN_C int tdb_htrie_remove_keys(TdbHdr *dbh, const uint64_t *keys,
+				   bool (*eq_cb)(void *, void *), void *data);
+EXTERN_C void tdb_htrie_reclaim(TdbHdr *dbh);
+EXTERN_C int tdb_htrie_walk(TdbHdr *dbh, int (*fn)(void *));
+EXTERN_C int tdb_htrie_walk_prefix(TdbHdr *dbh, uint64_t pfx,
+				   unsigned int pfx_bits, int (*fn)(void *));
+EXTERN_C int tdb_htrie_snapshot_begin(TdbHdr *dbh, size_t n);
+EXTERN_C int tdb_htrie_snapshot_walk(TdbHdr *dbh, int (*fn)(void *));
+EXTERN_C int tdb_htrie_snapshot_end(TdbHdr *dbh);
+EXTERN_C int tdb_htrie_walk_next(TdbHdr *dbh, TdbHtrieCursor *cur,
+				 unsigned int n, int (*fn)(void *));
+EXTERN_C int tdb_htrie_evict(TdbHdr *dbh, TdbHtrieCursor *hand,
+			     unsigned int n, bool (*expired)(void *, void *),
+			     void *data);
+EXTERN_C int tdb_htrie_expire(TdbHdr *dbh, TdbHtrieCursor *cur,
+			      unsigned int n, bool (*expired)(void *, void *),
+			      void *data);
 EXTERN_C void *tdb_htrie_bscan_for_rec(TdbHdr *dbh, TdbHtrieBucket *b,
 				       uint64_t key, int *i);
+EXTERN_C int tdb_htrie_rec_iov(TdbHdr *dbh, TdbVRec *rec, struct kvec *iov,
+			      int n, size_t *len);
+EXTERN_C int tdb_htrie_read_iov(TdbHdr *dbh, uint64_t key,
+				bool (*eq_cb)(void *, void *), void *data,
+				struct kvec *iov, int n, size_t *len);
 EXTERN_C TdbHdr *tdb_htrie_init(void *p, size_t db_size, size_t root_bits,
-				uint32_t rec_len, uint32_t flags);
+				uint32_t rec_len, unsigned int bckt_slots,
+				unsigned int idx_n, uint32_t flags);
+EXTERN_C void tdb_htrie_stat(TdbHdr *dbh, TdbHtrieStat *st);
+EXTERN_C int tdb_htrie_info(TdbHdr *dbh, char *buf, size_t len);
+EXTERN_C int tdb_htrie_layout(TdbHdr *dbh, unsigned int idx,
+			      TdbHtrieLayout *l);
+EXTERN_C TdbHdr *tdb_htrie_image(void *p, size_t size);
+EXTERN_C int tdb_htrie_layout_image(TdbHdr *dbh, unsigned int idx,
+				    TdbHtrieLayout *l);
+EXTERN_C size_t tdb_htrie_compact(TdbHdr *dbh);
+EXTERN_C int tdb_htrie_set_grow(TdbHdr *dbh, size_t max_sz,
+				int (*grow)(void *addr, size_t len));
 EXTERN_C void tdb_htrie_exit(TdbHdr *dbh);
+EXTERN_C int tdb_htrie_forest_init(TdbHtrieForest *f, void **p, unsigned int n,
+				   size_t shard_sz, size_t root_bits,
+				   uint32_t rec_len, unsigned int bckt_slots,
+				   uint32_t flags);
+EXTERN_C void tdb_htrie_forest_exit(TdbHtrieForest *f);
 
 #endif /* __HTRIE_H__ */
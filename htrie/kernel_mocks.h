@@ -41,10 +41,18 @@
 
 #define likely(x)		__builtin_expect(!!(x), 1)
 #define unlikely(x)		__builtin_expect(!!(x), 0)
+#define prefetch(x)		__builtin_prefetch(x)
 
 #define barrier()		asm volatile("" ::: "memory")
+#define smp_mb()		asm volatile("lock; addl $0,-4(%%rsp)"	\
+				     ::: "memory", "cc")
+#define smp_rmb()		barrier()
 
 #define ____cacheline_aligned	__attribute__((__aligned__(L1_CACHE_BYTES)))
+#define __read_mostly
+
+#define X86_FEATURE_AVX2	"avx2"
+#define boot_cpu_has(f)		__builtin_cpu_supports(f)
 
 #define BUILD_BUG_ON(c)		assert(!(c))
 #define BUG_ON(c)		assert(!(c))
@@ -78,6 +86,13 @@ do {									\
 #define pr_debug(fmt, ...)	fprintf(stdout, fmt, ##__VA_ARGS__)
 #define net_warn_ratelimited(fmt, ...) fprintf(stdout, fmt, ##__VA_ARGS__)
 #define net_err_ratelimited(fmt, ...) fprintf(stdout, fmt, ##__VA_ARGS__)
+#define net_info_ratelimited(fmt, ...) fprintf(stdout, fmt, ##__VA_ARGS__)
+
+/* The same layout as struct iovec, so the vectors can be passed to writev(2). */
+struct kvec {
+	void		*iov_base;
+	size_t		iov_len;
+};
 
 /* Tempesta FW routines. */
 #define memcpy_fast(a, b, n)	memcpy(a, b, n)
@@ -99,6 +114,8 @@ do {									\
         *(volatile typeof(x) *)&(x) = (val);				\
 } while (0)
 
+#define READ_ONCE(x)		(*(const volatile typeof(x) *)&(x))
+
 typedef struct {
 	int counter;
 } atomic_t;
@@ -134,6 +151,12 @@ atomic_inc(atomic_t *v)
 	__atomic_add_fetch(&v->counter, 1, __ATOMIC_SEQ_CST);
 }
 
+static inline void
+atomic_dec(atomic_t *v)
+{
+	__atomic_sub_fetch(&v->counter, 1, __ATOMIC_SEQ_CST);
+}
+
 static inline long
 atomic_fetch_inc(atomic_t *v)
 {
@@ -175,8 +198,10 @@ __cmpxchg(volatile void *ptr, unsigned long old, unsigned long new_p, int size)
 	return old;
 }
 
+/* The kernel cmpxchg() also swaps pointers. */
 #define cmpxchg(ptr, old, new_p)					\
-	__cmpxchg(ptr, old, new_p, sizeof(*(ptr)))
+	__cmpxchg(ptr, (unsigned long)(old), (unsigned long)(new_p),	\
+		  sizeof(*(ptr)))
 
 #define __X86_CASE_B    1
 #define __X86_CASE_W    2
@@ -303,7 +328,14 @@ atomic64_inc_return(atomic64_t *v)
 #define __percpu
 #define alloc_percpu(s)			calloc(NR_CPUS, sizeof(s))
 #define free_percpu(p)			free(p)
+
+#define GFP_KERNEL			0
+#define kvzalloc(s, gfp)		calloc(1, s)
+#define kvfree(p)			free(p)
 #define for_each_online_cpu(c)		for (c = 0; c < __thr_max; ++c)
+#define for_each_possible_cpu(c)	for (c = 0; c < NR_CPUS; ++c)
+#define cpu_online(c)			((c) < __thr_max)
+#define num_online_cpus()		__thr_max
 #define per_cpu_ptr(a, c)		&(a)[c]
 #define this_cpu_ptr(a)			(&(a)[__thr_id])
 
@@ -0,0 +1,284 @@
+/**
+ *		Tempesta DB
+ *
+ * Offline analyzer of the HTrie database layout: the index depth, the buckets
+ * fill, the slots states, the extents and blocks utilization and the free
+ * lists of a database file or a dump of the database memory. The output is
+ * used to choose the root bits and the database size of a table and to find
+ * bad keys distributions.
+ *
+ * The image is mapped read-only, so the tool can run against a database file,
+ * which is currently mapped by a running process, e.g. `lfds_bench --file`.
+ * In this case the database is dirty and the per-CPU data isn't available.
+ *
+ * Copyright (C) 2025 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+
+#include "htrie.h"
+
+/* The bucket slot states, TDB_HTRIE_SLOT_*. */
+static const char *slot_states[] = {
+	"empty", "tombstones", "records", "writes"
+};
+
+static double
+percent(uint64_t n, uint64_t total)
+{
+	return total ? n * 100. / total : 0;
+}
+
+/*
+ * The root resolves the keys without the index nodes descents, so the best
+ * root has about a bucket per root slot. The root bits are a multiple of
+ * TDB_HTRIE_BITS.
+ */
+static unsigned int
+root_bits_hint(const TdbHdr *dbh, uint64_t recs)
+{
+	unsigned int bits = TDB_HTRIE_BITS;
+
+	while (bits + TDB_HTRIE_BITS < BITS_PER_LONG
+	       && (recs >> bits) > dbh->bckt_slots / 2)
+		bits += TDB_HTRIE_BITS;
+
+	return bits;
+}
+
+static void
+print_levels(const TdbHdr *dbh, const TdbHtrieLayout &l, uint64_t recs)
+{
+	std::cout << "  levels (resolved bits: index nodes, buckets, records):"
+		  << std::endl;
+	for (auto i = 0; i < TDB_HTRIE_DEPTH_MAX; ++i) {
+		if (!l.nodes[i] && !l.bckts[i] && i)
+			continue;
+		std::cout << "    " << std::setw(2) << i << " ("
+			  << std::setw(2) << dbh->root_bits + i * TDB_HTRIE_BITS
+			  << "):\t" << std::setw(10) << l.nodes[i]
+			  << std::setw(12) << l.bckts[i]
+			  << std::setw(14) << l.recs[i] << std::fixed
+			  << std::setprecision(1) << std::setw(7)
+			  << percent(l.recs[i], recs) << "%" << std::endl;
+	}
+}
+
+static void
+print_buckets(const TdbHdr *dbh, const TdbHtrieLayout &l, uint64_t bckts)
+{
+	uint64_t slots = bckts * dbh->bckt_slots;
+
+	std::cout << "  bucket fill (occupied slots: buckets):" << std::endl;
+	for (auto s = 0U; s <= dbh->bckt_slots; ++s)
+		if (l.fill[s])
+			std::cout << "    " << std::setw(2) << s << ":\t"
+				  << std::setw(12) << l.fill[s] << std::fixed
+				  << std::setprecision(1) << std::setw(7)
+				  << percent(l.fill[s], bckts) << "%"
+				  << std::endl;
+
+	std::cout << "  slot states:\t";
+	for (auto s = 0; s < 4; ++s)
+		std::cout << " " << slot_states[s] << " " << l.slots[s]
+			  << " (" << std::setprecision(1)
+			  << percent(l.slots[s], slots) << "%)";
+	std::cout << "\n  frozen buckets:\t" << l.frozen << std::endl;
+}
+
+/*
+ * The records under the root slots are Poisson distributed for a good hash,
+ * so the variance to mean ratio (the index of dispersion) is about 1. Larger
+ * values mean that the keys are clustered under some root slots.
+ */
+static void
+print_root(const TdbHdr *dbh, const TdbHtrieLayout &l, uint64_t recs)
+{
+	double n = 1UL << dbh->root_bits, mean = recs / n;
+	double var = l.root_sq / n - mean * mean;
+
+	std::cout << "  root slots:\t\t" << (uint64_t)n << ", empty "
+		  << (uint64_t)n - l.root_bckts - l.root_nodes << ", buckets "
+		  << l.root_bckts << ", index nodes " << l.root_nodes
+		  << "\n  records per root slot: mean " << std::setprecision(2)
+		  << mean << ", max " << l.root_max << ", dispersion "
+		  << (mean ? var / mean : 0) << std::endl;
+}
+
+static void
+print_space(const TdbHdr *dbh, const TdbHtrieLayout &l, uint64_t bckts,
+	    uint64_t recs)
+{
+	const TdbAllocUsage &u = l.alloc;
+	uint64_t nodes = std::accumulate(l.nodes, l.nodes + TDB_HTRIE_DEPTH_MAX,
+					 0UL);
+	uint64_t used = (u.blk_n - u.blk_free) * TDB_BLK_SZ;
+
+	std::cout << "  index nodes:\t\t" << nodes << " ("
+		  << nodes * TDB_HTRIE_NODE_SZ / 1024 << "KB), fanout "
+		  << std::setprecision(1)
+		  << (nodes ? (double)l.node_slots / nodes : 0) << " of "
+		  << (1 << TDB_HTRIE_BITS) << "\n  buckets:\t\t" << bckts
+		  << " ("
+		  << bckts * l.bckt_sz / 1024 << "KB)"
+		  << "\n  records data:\t\t" << l.data / 1024 << "KB"
+		  << "\n  extents:\t\t" << u.ext_used << " used of " << u.ext_n
+		  << ", " << u.ext_free << " in the free stack, "
+		  << u.ext_empty << " in the empty stack\n  blocks:\t\t"
+		  << u.blk_n - u.blk_free << " used of " << u.blk_n << " ("
+		  << percent(u.blk_n - u.blk_free, u.blk_n) << "%), "
+		  << used / (1024 * 1024) << "MB, "
+		  << (recs ? used / recs : 0) << " bytes per record"
+		  << "\n  extents by used blocks:";
+	for (auto i = 0; i < TDB_ALLOC_USAGE_N; ++i)
+		if (u.usage[i])
+			std::cout << " " << i * 10
+				  << (i < TDB_ALLOC_USAGE_N - 1 ? "%+ " : "%: ")
+				  << u.usage[i];
+	std::cout << std::endl;
+}
+
+static void
+print_free(const TdbHdr *dbh, const TdbHtrieLayout &l)
+{
+	std::cout << "  free buckets:\t\tglobal pool " << l.pool;
+	if (!l.pcpu_n)
+		std::cout << ", per-CPU lists aren't available for a dirty"
+			     " database";
+	for (auto c = 0U; c < l.pcpu_n; ++c)
+		std::cout << (c ? ", " : ", per-CPU ") << l.pcpu_free[c];
+	std::cout << "\n  data caches:\t\t";
+	for (auto c = 0; c < (dbh->rec_len ? 1 : TDB_HTRIE_DCACHE_MAX); ++c)
+		std::cout << (c ? ", " : "") << l.dcache[c];
+	std::cout << std::endl;
+
+	if (l.pcpu_n)
+		std::cout << "  inserts:\t\t" << l.stat.insert
+			  << "\n  bursts:\t\t" << l.stat.burst
+			  << "\n  retries:\t\t" << l.stat.retry
+			  << "\n  allocation failures:\t" << l.stat.alloc_fail
+			  << std::endl;
+}
+
+static int
+print_index(TdbHdr *dbh, unsigned int idx)
+{
+	TdbHtrieLayout l;
+	uint64_t recs, bckts;
+
+	if (tdb_htrie_layout_image(dbh, idx, &l))
+		return -1;
+	recs = std::accumulate(l.recs, l.recs + TDB_HTRIE_DEPTH_MAX, 0UL);
+	bckts = std::accumulate(l.bckts, l.bckts + TDB_HTRIE_DEPTH_MAX, 0UL);
+
+	std::cout << "\n index " << idx << ":\n  records:\t\t" << recs
+		  << std::endl;
+	print_levels(dbh, l, recs);
+	print_buckets(dbh, l, bckts);
+	print_root(dbh, l, recs);
+	// The shared database structures are the same for all the indexes.
+	if (!idx) {
+		print_space(dbh, l, bckts, recs);
+		print_free(dbh, l);
+	}
+	std::cout << "  suggested root bits:\t" << root_bits_hint(dbh, recs)
+		  << std::endl;
+	if (l.bad || l.alloc.bad)
+		std::cout << "  broken references:\t" << l.bad + l.alloc.bad
+			  << std::endl;
+
+	return 0;
+}
+
+static void
+usage(const char *prog)
+{
+	std::cout << "\nUsage: " << prog << " <file_path>\n"
+		  << "  file_path  - a database file or a dump of the database"
+		     " memory,\n"
+		  << "               all the shards of an HTrie forest are"
+		     " analyzed\n" << std::endl;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int fd;
+	void *p;
+	struct stat sb;
+	size_t off = 0;
+	unsigned int shard = 0;
+
+	if (argc != 2) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if ((fd = open(argv[1], O_RDONLY)) < 0 || fstat(fd, &sb)) {
+		perror("cannot open the database image");
+		return 1;
+	}
+	p = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		perror("cannot map the database image");
+		return 1;
+	}
+
+	// The forest shards follow each other, see mapfile_node_ptr().
+	while (off < (size_t)sb.st_size) {
+		TdbHdr *dbh = tdb_htrie_image((char *)p + off,
+					      sb.st_size - off);
+
+		if (!dbh) {
+			if (!shard)
+				std::cerr << "not a database image: "
+					  << argv[1] << std::endl;
+			break;
+		}
+		std::cout << "shard " << shard << " at 0x" << std::hex << off
+			  << std::dec << ": " << (dbh->flags & TDB_F_DIRTY
+						  ? "dirty" : "clean")
+			  << ", root bits " << dbh->root_bits << ", "
+			  << dbh->bckt_slots << " bucket slots, record length "
+			  << dbh->rec_len << ", flags 0x" << std::hex
+			  << (dbh->flags & ~TDB_F_DIRTY) << std::dec << ", "
+			  << ((size_t)dbh->alloc.ext_max + 1) * TDB_EXT_SZ
+			     / (1024 * 1024) << "MB of "
+			  << ((size_t)dbh->alloc.ext_lim + 1) * TDB_EXT_SZ
+			     / (1024 * 1024) << "MB" << std::endl;
+
+		for (auto idx = 0U; idx < dbh->idx_n; ++idx)
+			print_index(dbh, idx);
+		std::cout << std::endl;
+
+		off += ((size_t)dbh->alloc.ext_lim + 1) * TDB_EXT_SZ;
+		++shard;
+	}
+
+	munmap(p, sb.st_size);
+
+	return shard ? 0 : 1;
+}
@@ -3,7 +3,8 @@
  *
  * Lock-free MPMC intrusive stack working with memory offsets instead of pointers.
  * The implementation relies on the x86-64 strong memory ordering.
- * The maximum allowed offset is 2^31.
+ * The maximum allowed offset is 2^31 for LfStack, while LfStack64 works with
+ * any offsets of aligned entries.
  *
  * Copyright (C) 2022 Tempesta Technologies, Inc.
  *
@@ -64,9 +65,8 @@ typedef struct {
 /**
  * We use 64-bit double CAS over @next and @val, so we can't operate with long
  * offsets or full pointers and have to deal with offsets/IDs with some
- * multiplication to retrieve node addresses.
- *
- * TODO rework it to normal 64 adressess with 7 bit generation
+ * multiplication to retrieve node addresses. Use LfStack64 for the entries
+ * aligned on LFS64_ALIGN.
  */
 typedef lf_uint32_t LfStack;
 
@@ -94,7 +94,8 @@ lfs_init(LfStack *stack)
 }
 
 /**
- * Push @entry having offset/id @off from the head to the @stack.
+ * Push the chain of entries, linked by @next, from the entry having offset/id
+ * @off to @last, from the head to the @stack with one CAS.
  * This is the caller responsibility to keep offsets or IDs consistent
  * among pop and push operations.
  *
@@ -103,19 +104,28 @@ lfs_init(LfStack *stack)
  * @return true if the stack was empty before the push.
  */
 static inline bool
-lfs_push(LfStack *stack, SEntry *entry, int off)
+lfs_push_chain(LfStack *stack, int off, SEntry *last)
 {
 	int old_head = atomic_read(&stack->val);
 
-	entry->next = old_head;
+	last->next = old_head;
 	while (atomic_cmpxchg(&stack->val, old_head, off) != old_head) {
 		old_head = atomic_read(&stack->val);
-		entry->next = old_head;
+		last->next = old_head;
 	}
 
 	return old_head == LFS_NIL;
 }
 
+/**
+ * Push @entry having offset/id @off from the head to the @stack.
+ */
+static inline bool
+lfs_push(LfStack *stack, SEntry *entry, int off)
+{
+	return lfs_push_chain(stack, off, entry);
+}
+
 /**
  * @stack - the stack head
  * @base - the base address to compute offset from
@@ -131,7 +141,7 @@ lfs_pop(LfStack *stack, void *base, int mul)
 	uint64_t head;
 
 	atomic64_set(&curr._trx, atomic64_read(&stack->_trx));
-	if (unlikely(atomic_read(&curr.val)) == LFS_NIL)
+	if (unlikely(atomic_read(&curr.val) == LFS_NIL))
 		return NULL;
 
 	head = atomic_read(&curr.val);
@@ -143,7 +153,7 @@ lfs_pop(LfStack *stack, void *base, int mul)
 
 	while (atomic64_cmpxchg(&stack->_trx, curr._val, upd._val) != curr._val) {
 		atomic64_set(&curr._trx, atomic64_read(&stack->_trx));
-		if (unlikely(atomic_read(&curr.val)) == LFS_NIL)
+		if (unlikely(atomic_read(&curr.val) == LFS_NIL))
 			return NULL;
 
 		head = atomic_read(&curr.val);
@@ -158,4 +168,107 @@ lfs_pop(LfStack *stack, void *base, int mul)
 	return e;
 }
 
+/*
+ * ------------------------------------------------------------------------
+ *	Lock-free stack with 64-bit tagged offsets
+ * ------------------------------------------------------------------------
+ */
+/*
+ * The entries must be aligned on LFS64_ALIGN, so the least significant bits
+ * of the head offset keep the head generation and a plain 64-bit CAS avoids
+ * the ABA problem for offsets of any size. The generation is changed on each
+ * pop, so a pop fails if the head was popped and pushed back meantime, unless
+ * LFS64_ALIGN pops were done during the pop.
+ */
+#define LFS64_GEN_BITS		7
+#define LFS64_ALIGN		(1UL << LFS64_GEN_BITS)
+#define LFS64_GEN_MASK		(LFS64_ALIGN - 1)
+/* Bottom of the stack, has no generation bits. */
+#define LFS64_NIL		(~LFS64_GEN_MASK)
+
+/**
+ * @head	- byte offset of the top entry and the generation.
+ */
+typedef struct {
+	atomic64_t		head;
+} __attribute__((packed)) LfStack64;
+
+/**
+ * @next	- byte offset of the next entry or LFS64_NIL.
+ */
+typedef struct {
+	uint64_t		next;
+} SEntry64;
+
+static inline bool
+lfs64_empty(LfStack64 *stack)
+{
+	return (atomic64_read(&stack->head) & ~LFS64_GEN_MASK) == LFS64_NIL;
+}
+
+static inline void
+lfs64_entry_init(SEntry64 *e)
+{
+	e->next = LFS64_NIL;
+}
+
+static inline void
+lfs64_init(LfStack64 *stack)
+{
+	atomic64_set(&stack->head, LFS64_NIL);
+}
+
+/**
+ * Push @entry to the @stack. The stack keeps the offset of @entry from @base,
+ * which must be the same for all the pop and push operations.
+ *
+ * @return true if the stack was empty before the push.
+ */
+static inline bool
+lfs64_push(LfStack64 *stack, void *base, SEntry64 *entry)
+{
+	long off = (char *)entry - (char *)base, head, old;
+
+	BUG_ON(off & LFS64_GEN_MASK);
+
+	head = atomic64_read(&stack->head);
+	for ( ; ; head = old) {
+		entry->next = head & ~LFS64_GEN_MASK;
+		old = atomic64_cmpxchg(&stack->head, head,
+				       off | (head & LFS64_GEN_MASK));
+		if (old == head)
+			break;
+	}
+
+	return (head & ~LFS64_GEN_MASK) == LFS64_NIL;
+}
+
+/**
+ * @return an entry on success and NULL if the stack is empty.
+ */
+static inline SEntry64 *
+lfs64_pop(LfStack64 *stack, void *base)
+{
+	SEntry64 *e;
+	long head, old, upd;
+
+	head = atomic64_read(&stack->head);
+	for ( ; ; head = old) {
+		if (unlikely((head & ~LFS64_GEN_MASK) == LFS64_NIL))
+			return NULL;
+
+		e = (SEntry64 *)((char *)base + (head & ~LFS64_GEN_MASK));
+		/* ABA: the generation is changed if the head is reinserted. */
+		upd = READ_ONCE(e->next) | ((head + 1) & LFS64_GEN_MASK);
+
+		old = atomic64_cmpxchg(&stack->head, head, upd);
+		if (old == head)
+			break;
+	}
+
+	lfs64_entry_init(e);
+
+	return e;
+}
+
 #endif /* __LFSTACK_H__ */
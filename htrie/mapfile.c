@@ -3,6 +3,12 @@
  *
  * This module provides a simple anonymous mmap()'ed area to replace a real file
  * for the benchmark. The mmap()'ed area is destroyed on the program exit.
+ * Optionally the area can be backed by a real file to keep the database
+ * between the program runs.
+ *
+ * The anonymous area can use 2MB or 1GB huge pages, so the index walk doesn't
+ * pay a TLB miss and a page walk per index level. The file should be placed
+ * on a hugetlbfs mount for the same.
  *
  * Copyright (C) 2016-2022 Tempesta Technologies, Inc.
  *
@@ -20,10 +26,15 @@
  * this program; if not, write to the Free Software Foundation, Inc., 59
  * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
 
 #include "alloc.h"
 #include "mapfile.h"
@@ -40,6 +51,55 @@
 #endif
 
 static char *mem = NULL;
+/* Number of NUMA nodes to place the area pieces on. */
+static unsigned int nodes = 1;
+/* The database file or NULL for the anonymous mapping. */
+static const char *fname = NULL;
+/* Huge pages size shift for the anonymous mapping or zero for normal pages. */
+static unsigned int huge_shift = 0;
+/* NUMA node to bind the area to or -1 to use the default memory policy. */
+static int bind_node = -1;
+
+/*
+ * The area pieces for the NUMA nodes must be aligned on the extents and on
+ * the huge pages to be bound to the nodes.
+ */
+static size_t
+mapfile_align(void)
+{
+	return huge_shift > TDB_EXT_BITS ? 1UL << huge_shift : TDB_EXT_SZ;
+}
+
+/**
+ * Map the database file, the file is created or extended if it's smaller
+ * than the area. The file is mapped at the same address on each run.
+ */
+static char *
+mapfile_file_map(void)
+{
+	char *p;
+	struct stat sb;
+	int fd = open(fname, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+
+	if (fd < 0) {
+		perror("Dummy allocator: cannot open the database file");
+		return MAP_FAILED;
+	}
+	if (fstat(fd, &sb) || (sb.st_size < ALLOC_SZ
+			       && ftruncate(fd, ALLOC_SZ)))
+	{
+		perror("Dummy allocator: cannot extend the database file");
+		close(fd);
+		return MAP_FAILED;
+	}
+
+	p = (char *)mmap(TDB_MAP_ADDR, ALLOC_SZ, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+	/* The mapping keeps the file referenced. */
+	close(fd);
+
+	return p;
+}
 
 size_t
 mapfile_size(void)
@@ -50,19 +110,51 @@ mapfile_size(void)
 void *
 mapfile_raw_ptr(void)
 {
-	int r;
+	int r, flags = MAP_SHARED | MAP_ANONYMOUS;
+	bool bind = nodes > 1 || bind_node >= 0;
 
 	if (mem)
 		return mem;
 
-	mem = (char *)mmap(TDB_MAP_ADDR, ALLOC_SZ, PROT_READ | PROT_WRITE,
-			   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (huge_shift)
+		flags |= MAP_HUGETLB | (huge_shift << MAP_HUGE_SHIFT);
+
+	if (fname) {
+		mem = mapfile_file_map();
+	} else {
+		/*
+		 * The huge pages mapping is aligned on the huge page boundary,
+		 * which is also extent-aligned, if the address isn't.
+		 */
+		mem = (char *)mmap(TDB_MAP_ADDR, ALLOC_SZ,
+				   PROT_READ | PROT_WRITE, flags, -1, 0);
+	}
 	if (mem == MAP_FAILED) {
 		perror("Dummy allocator: cannot allocate memory");
 		mem = NULL;
 		return NULL;
 	}
 
+	/* Bind the pieces to the nodes before the memory is faulted in. */
+	if (bind)
+		for (unsigned int n = 0; n < nodes; ++n) {
+			unsigned long mask = 1UL << (nodes > 1 ? n : bind_node);
+
+			r = syscall(SYS_mbind, mem + mapfile_node_size() * n,
+				    mapfile_node_size(), MPOL_BIND, &mask,
+				    sizeof(mask) * 8, 0);
+			if (r) {
+				perror("Dummy allocator: cannot bind memory");
+				munmap(mem, ALLOC_SZ);
+				mem = NULL;
+				return NULL;
+			}
+		}
+
+	/*
+	 * Fault in all the pages after the binding, so the benchmarks don't
+	 * take the page faults.
+	 */
 	r = mlock(mem, ALLOC_SZ);
 	if (r) {
 		fprintf(stderr, "Dummy allocator: cannot lock memory."
@@ -73,3 +165,144 @@ mapfile_raw_ptr(void)
 
 	return mem;
 }
+
+/**
+ * Get the number of online NUMA nodes. The nodes are expected to be numbered
+ * sequentially.
+ */
+unsigned int
+mapfile_numa_nodes(void)
+{
+	unsigned int first, last = 0;
+	FILE *f = fopen("/sys/devices/system/node/online", "r");
+
+	if (!f)
+		return 1;
+	/* Take the last node from the list like "0-1,3". */
+	while (fscanf(f, "%u", &first) == 1) {
+		last = first;
+		if (fscanf(f, "-%u", &last) != 1)
+			last = first;
+		if (fgetc(f) != ',')
+			break;
+	}
+	fclose(f);
+
+	return last + 1;
+}
+
+/**
+ * Split the area into @n extent-aligned pieces, each bound to its own NUMA
+ * node. Must be called before the area is mapped.
+ */
+int
+mapfile_set_nodes(unsigned int n)
+{
+	if (mem || !n || n > sizeof(unsigned long) * 8
+	    || (n > 1 && bind_node >= 0))
+		return -1;
+	nodes = n;
+
+	return 0;
+}
+
+unsigned int
+mapfile_nodes(void)
+{
+	return nodes;
+}
+
+size_t
+mapfile_node_size(void)
+{
+	return ALLOC_SZ / nodes & ~(mapfile_align() - 1);
+}
+
+/**
+ * Get the area piece bound to NUMA node @node.
+ */
+void *
+mapfile_node_ptr(unsigned int node)
+{
+	if (node >= nodes || !mapfile_raw_ptr())
+		return NULL;
+
+	return mem + mapfile_node_size() * node;
+}
+
+/**
+ * Drop the area, so the next mapfile_raw_ptr() maps a new empty area,
+ * e.g. to run a benchmark on a new database.
+ */
+void
+mapfile_reset(void)
+{
+	if (!mem)
+		return;
+
+	munmap(mem, ALLOC_SZ);
+	mem = NULL;
+	if (fname && truncate(fname, 0))
+		perror("Dummy allocator: cannot truncate the database file");
+}
+
+/**
+ * Use file @path to back the area. Must be called before the area is mapped.
+ */
+int
+mapfile_set_file(const char *path)
+{
+	if (mem || !path || huge_shift)
+		return -1;
+	fname = path;
+
+	return 0;
+}
+
+/**
+ * Bind the whole area to NUMA node @node, the area must not be split on the
+ * nodes. Must be called before the area is mapped.
+ */
+int
+mapfile_set_node(int node)
+{
+	if (mem || nodes > 1 || node < 0 || node >= sizeof(unsigned long) * 8)
+		return -1;
+	bind_node = node;
+
+	return 0;
+}
+
+/**
+ * Use huge pages of size 1 << @shift bytes, only 2MB and 1GB pages are
+ * supported, for the anonymous area. The huge pages must be reserved in
+ * the system, e.g. with /proc/sys/vm/nr_hugepages for 2MB pages. Must be
+ * called before the area is mapped.
+ */
+int
+mapfile_set_huge(unsigned int shift)
+{
+	if (mem || fname || (shift != 21 && shift != 30))
+		return -1;
+	huge_shift = shift;
+
+	return 0;
+}
+
+/**
+ * Write the database file changes to the disk. Call it after the database is
+ * properly closed to make the clean shutdown durable.
+ */
+int
+mapfile_sync(void)
+{
+	if (!mem || !fname)
+		return 0;
+
+	if (msync(mem, ALLOC_SZ, MS_SYNC)) {
+		perror("Dummy allocator: cannot sync the database file");
+		return -1;
+	}
+
+	return 0;
+}
@@ -22,5 +22,15 @@
 
 EXTERN_C void *mapfile_raw_ptr(void);
 EXTERN_C size_t mapfile_size(void);
+EXTERN_C unsigned int mapfile_numa_nodes(void);
+EXTERN_C int mapfile_set_nodes(unsigned int n);
+EXTERN_C unsigned int mapfile_nodes(void);
+EXTERN_C void *mapfile_node_ptr(unsigned int node);
+EXTERN_C size_t mapfile_node_size(void);
+EXTERN_C int mapfile_set_file(const char *path);
+EXTERN_C int mapfile_set_node(int node);
+EXTERN_C int mapfile_set_huge(unsigned int shift);
+EXTERN_C int mapfile_sync(void);
+EXTERN_C void mapfile_reset(void);
 
 #endif /* __MAPFILE_H__ */
@@ -66,6 +66,70 @@
  * memory accesses is needed. Works for small data records only.
  */
 #define TDB_F_INPLACE		0x01
+/*
+ * The keys aren't hashed, but are raw values like IP addresses. The index
+ * resolves the keys from the most significant bits, so the keys with the same
+ * prefix share the trie path, see tdb_htrie_lookup_prefix().
+ */
+#define TDB_F_RAWKEY		0x02
+/*
+ * The database is in use, i.e. it wasn't properly closed if the flag is found
+ * on the database opening, so it must be recovered after a crash.
+ */
+#define TDB_F_DIRTY		0x8000
+
+/**
+ * Per-CPU statistics of the HTrie operations, see tdb_htrie_info().
+ * Only the owning CPU updates the counters, so they're updated without atomic
+ * operations and are summed up for all the CPUs on read only.
+ *
+ * @insert	- inserted records
+ * @lookup	- index descents of the lookups, inserts and removals
+ * @depth	- the total number of key bits resolved by the descents
+ * @burst	- bucket bursts, including the help to other bursting CPUs
+ * @retry	- retried inserts and removals, e.g. due to a concurrent burst,
+ *		  and failed CAS on a bucket slot
+ * @gen_wait	- waits for other CPUs to leave the buckets on reclamation
+ * @rcl		- reclaimed tombstones and bursted buckets
+ * @alloc_fail	- memory allocation failures
+ * @free_bckt	- the number of buckets in the per-CPU free stack
+ * @evict	- records evicted by the CLOCK sweeps, see tdb_htrie_evict()
+ * @expire	- expired records removed by the sweeps
+ * @cow		- buckets copied on write for the snapshots, see
+ *		  tdb_htrie_snapshot_begin()
+ * @data	- bytes of the records data allocated by the CPU minus the bytes
+ *		  freed by the CPU, so only the sum for all the CPUs makes
+ *		  sense. Inplace records aren't counted.
+ */
+typedef struct {
+	uint64_t		insert;
+	uint64_t		lookup;
+	uint64_t		depth;
+	uint64_t		burst;
+	uint64_t		retry;
+	uint64_t		gen_wait;
+	uint64_t		rcl;
+	uint64_t		alloc_fail;
+	uint64_t		free_bckt;
+	uint64_t		evict;
+	uint64_t		expire;
+	uint64_t		cow;
+	int64_t			data;
+} TdbHtrieStat;
+
+/*
+ * The number of the slab size classes for small variable-length records,
+ * see tdb_htrie_alloc_slab().
+ */
+#define TDB_HTRIE_SLAB_N	7
+/*
+ * Data caches of a variable-length records database: the caches of freed
+ * data chunks of at least 256B, 512B, 1KB and 2KB, followed by the caches of
+ * freed slab objects for each size class.
+ */
+#define TDB_HTRIE_DCACHE_N	4
+#define TDB_HTRIE_DCACHE_SLAB(c)	(TDB_HTRIE_DCACHE_N + (c))
+#define TDB_HTRIE_DCACHE_MAX	TDB_HTRIE_DCACHE_SLAB(TDB_HTRIE_SLAB_N)
 
 /**
  * Per-CPU dynamically allocated data for TDB handler.
@@ -77,21 +141,118 @@
  * @b_wcl	- the next offset to write by in the current bucket block
  * @d_wcl	- the next offset to write by in the current data block,
  *		  maybe in a separate extent
+ * @s_wcl	- the next offset to write by in the current slab block of
+ *		  each size class
  * @active_bckt - a bucket, currently observed by the CPU
+ * @gen		- readers generation, incremented each time the CPU leaves
+ *		  @active_bckt
+ * @snap_gen	- generation of the snapshot, for which the CPU waits in its
+ *		  reader session, see tdb_htrie_snapshot_begin()
  * @free_bckt	- the newest of freed buckets (the stack head)
+ * @stat	- the operations statistics
  *
  * The variables are initialized in runtime, so we lose some free space on
- * system restart.
+ * system restart. The data is dumped to the database on a clean shutdown only,
+ * so it's reinitialized on the recovery after a crash.
  */
 typedef struct {
 	uint64_t		flags;
 	uint64_t		i_wcl;
 	uint64_t		b_wcl;
 	uint64_t		d_wcl;
+	uint64_t		s_wcl[TDB_HTRIE_SLAB_N];
 	uint64_t		active_bckt;
+	uint64_t		gen;
+	uint64_t		snap_gen;
 	uint64_t		free_bckt;
+	TdbHtrieStat		stat;
 } TdbPerCpu;
 
+/*
+ * The number of tombstones reclaimed at once. The readers generations scan
+ * is done once per batch, so larger batches make removal cheaper by the cost
+ * of memory kept by not yet reclaimed records.
+ */
+#define TDB_HTRIE_RCL_BATCH	32
+/*
+ * A CPU keeps up to TDB_HTRIE_BCKT_FREE_MAX free buckets and moves the surplus
+ * by batches of TDB_HTRIE_BCKT_BATCH buckets to the global pool, so the CPUs
+ * removing more than inserting don't hoard the buckets.
+ */
+#define TDB_HTRIE_BCKT_BATCH	32
+#define TDB_HTRIE_BCKT_FREE_MAX	(TDB_HTRIE_BCKT_BATCH * 2)
+/* The CPU generation doesn't matter for a batch reclamation. */
+#define TDB_HTRIE_RCL_QUIESCENT	(~0UL)
+/* The batch entry is a whole bucket retired after a burst. */
+#define TDB_HTRIE_RCL_BCKT		(~0U)
+/* The tombstone is in a secondary index, so it doesn't own the data. */
+#define TDB_HTRIE_RCL_IDX		0x100
+
+/**
+ * A batch of tombstones, i.e. removed, but not yet reclaimed, bucket slots.
+ *
+ * @n		- number of tombstones in the batch
+ * @slot	- slot indexes of the tombstones
+ * @bckt	- byte offsets of the buckets containing the tombstones
+ * @gen		- readers generations of all the CPUs, taken when the batch
+ *		  is sealed
+ */
+typedef struct {
+	unsigned int		n;
+	uint32_t		slot[TDB_HTRIE_RCL_BATCH];
+	uint64_t		bckt[TDB_HTRIE_RCL_BATCH];
+	uint64_t		gen[NR_CPUS];
+} TdbRclBatch;
+
+/**
+ * Per-CPU tombstones reclamation workflow: the new tombstones are collected
+ * in the open batch. When it's full, the sealed one is reclaimed (once all the
+ * CPUs passed through its generations) and the open batch becomes sealed.
+ * The data isn't persistent: all the tombstones are reclaimed on the database
+ * shutdown.
+ *
+ * @b		- the open and the sealed batches
+ * @open	- index of the open batch in @b
+ * @zombie	- list of the retired buckets, which still have tombstones
+ *		  or were retired while a snapshot is active
+ * @defer	- list of blocks with the data of the records reclaimed while
+ *		  a snapshot is active, the data is freed after the snapshot
+ * @defer_gen	- the snapshot generation of @defer
+ */
+typedef struct {
+	TdbRclBatch		b[2];
+	unsigned int		open;
+	uint64_t		zombie;
+	uint64_t		defer;
+	uint64_t		defer_gen;
+} TdbRcl;
+
+/**
+ * Copy-on-write snapshot of a database, see tdb_htrie_snapshot_begin().
+ * Just like the reclamation data, a snapshot isn't persistent.
+ *
+ * @gen		- the snapshot generation
+ * @ready	- all the CPUs copy the buckets before updates
+ * @bits	- @map has 2^@bits entries
+ * @max		- the maximum number of the used @map entries
+ * @used	- the number of the used @map entries
+ * @buf		- the walker copy of a live bucket
+ * @map		- open addressing map of the buckets and index nodes linked
+ *		  or changed since the snapshot beginning to their views:
+ *		  the index of a bucket or an index node is in the upper half
+ *		  of an entry and the index of the bucket copy, or zero for
+ *		  an empty view, is in the lower half
+ */
+typedef struct {
+	uint64_t		gen;
+	bool			ready;
+	unsigned int		bits;
+	unsigned int		max;
+	atomic_t		used;
+	void			*buf;
+	uint64_t		map[0];
+} TdbSnap;
+
 /**
  * Tempesta DB file descriptor.
  *
@@ -101,19 +262,44 @@ typedef struct {
  * @alloc	- allocator control block, must be first for proper address
  *		  computations on the extent/block layer
  * @pcpu	- pointer to per-cpu dynamic data for the TDB handler
+ * @rcl		- pointer to per-cpu tombstones reclamation data
+ * @snap	- the active snapshot or NULL
  * @magic	- magic constant for basic consistency checking
+ * @flags	- the database flags, TDB_F_*
  * @root_bits	- number of key bits resolved by the root node
  * @rec_len	- small fixed-size records length or zero for
  *		  large variable-length records
- * @dcache	- the cache of freed data blocks
+ * @bckt_slots	- number of slots in a bucket
+ * @idx_n	- number of indexes, i.e. the primary index and the secondary
+ *		  ones, referencing the same data
+ * @pfx_lens	- bitmap of the prefix lengths ever inserted into a raw keys
+ *		  database
+ * @pcpu_n	- number of the per-CPU data dump slots, i.e. the number of
+ *		  online CPUs on the database creation
+ * @snap_gen	- generation of the last snapshot with the state flags in
+ *		  the less significant bits
+ * @bckt_pool	- the global pool of free buckets batches
+ * @dcache	- the caches of freed data chunks, one for fixed-size records
+ *		  and TDB_HTRIE_DCACHE_MAX for variable-length records
+ *
+ * The stacks heads are aligned for the double CAS, which would otherwise
+ * take a bus lock on a cache line boundary.
  */
 typedef struct {
 	TdbAlloc		alloc;
 	TdbPerCpu __percpu	*pcpu;
+	TdbRcl __percpu		*rcl;
+	TdbSnap			*snap;
 	uint64_t		magic;
 	uint16_t		flags;
 	uint16_t		root_bits;
 	uint32_t		rec_len;
+	uint32_t		bckt_slots;
+	uint32_t		idx_n;
+	uint64_t		pfx_lens;
+	uint32_t		pcpu_n;
+	uint64_t		snap_gen __attribute__((aligned(8)));
+	LfStack			bckt_pool __attribute__((aligned(8)));
 	LfStack			dcache[0];
 } __attribute__((packed)) TdbHdr;
 
@@ -38,15 +38,20 @@
 #include <algorithm>
 #include <cassert>
 #include <functional>
+#include <iomanip>
 #include <iostream>
+#include <map>
 #include <mutex>
 #include <ranges>
+#include <set>
 #include <sstream>
+#include <string>
 #include <string_view>
 #include <thread>
 #include <vector>
 
 #include "hashfn.h"
+#include "hope.h"
 #include "htrie.h"
 
 class Except : public std::exception {
@@ -184,44 +189,143 @@ test_hash_calc_dummy(const char *data, size_t len)
 	return h;
 }
 
+/*
+ * Count the buckets bursts in the HTrie with the @root_bits root and
+ * TDB_HTRIE_BCKT_SLOTS_N slots per a bucket for the keys in [@lo, @hi),
+ * resolved by @bits. The keys must be sorted by their reversed bits, so the
+ * keys with the same less significant bits, i.e. in the same bucket, follow
+ * each other. @depth is the maximum number of the resolved bits.
+ */
+static size_t
+hash_bursts(const std::vector<uint64_t> &keys, size_t lo, size_t hi,
+	    unsigned int bits, unsigned int root_bits, unsigned int &depth)
+{
+	size_t n = 0;
+	unsigned int b = bits ? TDB_HTRIE_BITS : root_bits;
+
+	if (hi - lo <= TDB_HTRIE_BCKT_SLOTS_N || bits >= 64) {
+		depth = std::max(depth, bits);
+		return 0;
+	}
+	// The bucket is bursted to a new index node, but the root.
+	if (bits)
+		++n;
+
+	const uint64_t mask = (1UL << b) - 1;
+	for (size_t i = lo, j; i < hi; i = j) {
+		for (j = i + 1; j < hi; ++j)
+			if (((keys[j] >> bits) & mask) != ((keys[i] >> bits) & mask))
+				break;
+		n += hash_bursts(keys, i, j, bits + b, root_bits, depth);
+	}
+
+	return n;
+}
+
 /**
- * Benchmark for SSE 4.2 and trivial C hash function.
- *
- * TODO benchmark the hash functions quality with AND and OR by all hash values.
+ * Print the quality of the hash function @fn for @keys: the bits stuck to
+ * zero or one, the full collisions, and the buckets bursts in the HTrie.
+ * @return the number of stuck bits plus the collisions.
  */
-void
-t_htrie_hash_calc_benchmark(void)
+static unsigned int
+hash_quality(const char *name, tdb_hash_t fn,
+	     const std::vector<std::string> &keys)
 {
-	static const size_t N = 10000;
-	int r __attribute__((unused)), i, acc = 0;
+	static const unsigned int ROOT_BITS = 8;
+	static const int N = 100;
+	int r __attribute__((unused));
+	unsigned int depth = 0, stuck, coll = 0;
+	unsigned long and_h = ~0UL, or_h = 0, acc = 0;
+	std::vector<uint64_t> h(keys.size());
 	struct timeval tv0, tv1;
 
-	std::cout << "Dummy hash function benchmark:" << std::endl;
-
 	r = gettimeofday(&tv0, NULL);
 	assert(!r);
-	for (i = 0; i < N; ++i)
-		for (auto u = urls; u->key; ++u)
-			acc += tdb_hash_calc(u->key, u->klen);
+	for (auto i = 0; i < N; ++i)
+		for (const auto &k : keys)
+			acc += fn(k.data(), k.size());
 	r = gettimeofday(&tv1, NULL);
 	assert(!r);
-	std::cout << "  tdb hash: time=" << tv_to_ms(&tv1) - tv_to_ms(&tv0)
-		  << "ms ignore_val=" << acc << std::endl;
 
-	r = gettimeofday(&tv0, NULL);
-	assert(!r);
-	for (i = 0; i < N; ++i)
-		for (auto u = urls; u->key; ++u)
-			acc += test_hash_calc_dummy(u->key, u->klen);
-	r = gettimeofday(&tv1, NULL);
-	assert(!r);
-	std::cout << "  dummy hash: time=" << tv_to_ms(&tv1) - tv_to_ms(&tv0)
-		  << "ms ignore_val=" << acc << std::endl;
+	for (size_t i = 0; i < keys.size(); ++i) {
+		h[i] = fn(keys[i].data(), keys[i].size());
+		and_h &= h[i];
+		or_h |= h[i];
+	}
+	stuck = __builtin_popcountl(and_h) + __builtin_popcountl(~or_h);
+
+	// The less significant bit, which differs in the keys, is zero in the
+	// smaller key.
+	std::sort(h.begin(), h.end(), [](uint64_t a, uint64_t b) {
+		uint64_t d = a ^ b;
+		return d && !(a & d & -d);
+	});
+	for (size_t i = 1; i < h.size(); ++i)
+		coll += h[i] == h[i - 1];
+
+	size_t bursts = hash_bursts(h, 0, h.size(), 0, ROOT_BITS, depth);
+
+	std::cout << "    " << std::left << std::setw(8) << name << std::right
+		  << std::setw(8) << tv_to_ms(&tv1) - tv_to_ms(&tv0) << "ms"
+		  << std::setw(8) << stuck << std::setw(8) << coll
+		  << std::setw(8) << bursts << std::setw(8) << depth
+		  << "  ignore_val=" << (acc & 0xff) << std::endl;
+
+	return stuck + coll;
+}
+
+/**
+ * Throughput and quality of the hash functions on URL-like and IP address
+ * keys. The HTrie resolves the keys by the less significant bits first, so
+ * the first resolved nibbles define the buckets bursts rate.
+ */
+void
+t_htrie_hash_calc_benchmark(void)
+{
+	static const size_t N = 100000;
+	static const char *paths[] = {
+		"/", "/blog/", "/static/img/logo-", "/store.php?nfid=",
+		"/exec/obidos/redirect?link_code=ur2&camp=1789&tag=",
+		"/tempesta-tech/tempesta/commit/"
+	};
+	std::vector<std::string> url_keys, ip4_keys, ip6_keys;
+
+	for (size_t i = 0; i < N; ++i) {
+		std::string u(paths[i % std::size(paths)]);
+		uint32_t a = 0x0a000000 + i;
+		unsigned char a6[16] = { 0x20, 0x01, 0x0d, 0xb8 };
+
+		url_keys.push_back(u + std::to_string(i) + ".html");
+		ip4_keys.emplace_back((const char *)&a, sizeof(a));
+		memcpy(a6 + 12, &a, sizeof(a));
+		ip6_keys.emplace_back((const char *)a6, sizeof(a6));
+	}
+
+	for (const auto &[set, keys] : {
+		std::pair{"URLs", &url_keys},
+		std::pair{"IPv4 addresses", &ip4_keys},
+		std::pair{"IPv6 addresses", &ip6_keys}
+	     })
+	{
+		std::cout << "Hash functions on " << N << " " << set << ":\n"
+			  << "    name        time   stuck  collis  bursts"
+			  << "   depth" << std::endl;
+
+		for (auto h = tdb_hash_fns; h->name; ++h) {
+			unsigned int bad __attribute__((unused));
+
+			bad = hash_quality(h->name, h->fn, *keys);
+			// Only the default function may have stuck bits.
+			assert(h == tdb_hash_fns || !bad);
+		}
+		hash_quality("dummy", test_hash_calc_dummy, *keys);
+	}
 }
 
 class Tester {
 protected:
 	static const auto LOOP_N = TDB_HTRIE_BCKT_SLOTS_N / TEST_THREADS_N;
+	static const auto DB_FSZ = TDB_EXT_SZ * 1024;
 
 	static thread_local int it_; // test data iterator
 	std::atomic<size_t> data_stored_ = 0;
@@ -237,12 +341,20 @@ private:
  	*/
 	static const auto MAP_ADDR1 = 0x600000000000UL + TDB_EXT_SZ;
 	static const auto MAP_ADDR2 = 0x600000000000UL + TDB_EXT_SZ * 3;
-	static const auto DB_FSZ = TDB_EXT_SZ * 1024;
 
 	void *p_ = nullptr;
-	size_t size_, rec_sz_, flags_, root_bits_;
+	size_t size_, rec_sz_, flags_, root_bits_, bckt_slots_;
 	int fd_ = -1;
 
+	// The whole file is already mapped and locked.
+	static int
+	db_grow(void *addr, size_t len) noexcept
+	{
+		dbg << "grow the db at " << addr << " by " << std::dec
+		     << len / 1024 / 1024 << "MB" << std::endl;
+		return 0;
+	}
+
 	std::string
 	test_name(const char *tname)
 	{
@@ -255,6 +367,8 @@ private:
 			ss << "variable length records";
 		if (flags_)
 			ss << " with flags 0x" << std::hex << flags_;
+		if (bckt_slots_)
+			ss << ", " << std::dec << bckt_slots_ << " bucket slots";
 		ss << ", root bits 0x" << std::hex << root_bits_ << ")";
 		return ss.str();
 	}
@@ -367,9 +481,15 @@ public:
 			  << std::endl;
 	}
 
+	/*
+	 * The database of @init_sz bytes grows online up to the file size if
+	 * @init_sz is smaller than the file. The database has @idx_n indexes.
+	 */
 	Tester(const char *fname, const char *tname, int addr_id, size_t rec_sz,
-	       size_t root_bits, unsigned long flags)
-		: rec_sz_(rec_sz), flags_(flags), root_bits_(root_bits)
+	       size_t root_bits, unsigned long flags, unsigned int bckt_slots = 0,
+	       size_t init_sz = DB_FSZ, unsigned int idx_n = 1)
+		: rec_sz_(rec_sz), flags_(flags), root_bits_(root_bits),
+		  bckt_slots_(bckt_slots)
 	{
 		std::cout << "\n============>> TEST: " << test_name(tname) << "...\n"
 			  << std::endl;
@@ -385,8 +505,32 @@ public:
 			throw Except("bad address id for db mapping");
 		}
 
-		dbh_ = tdb_htrie_init(p_, DB_FSZ, root_bits, rec_sz, flags);
+		dbh_ = tdb_htrie_init(p_, init_sz, root_bits, rec_sz, bckt_slots,
+				      idx_n, flags);
 		assert(dbh_);
+		if (init_sz < DB_FSZ
+		    && tdb_htrie_set_grow(dbh_, DB_FSZ, db_grow))
+			throw Except("cannot set the db growth");
+	}
+
+	size_t
+	db_size() const noexcept
+	{
+		return (dbh_->alloc.ext_max + 1) * TDB_EXT_SZ;
+	}
+
+	// Print the database statistics and return the counters.
+	TdbHtrieStat
+	htrie_stat() const noexcept
+	{
+		char buf[1024];
+		TdbHtrieStat st;
+
+		tdb_htrie_info(dbh_, buf, sizeof(buf));
+		std::cout << buf;
+		tdb_htrie_stat(dbh_, &st);
+
+		return st;
 	}
 
 	void
@@ -394,6 +538,10 @@ public:
 	{
 		int r __attribute__((unused));
 		struct timeval tv0, tv1;
+		// Each loop inserts duplicates of all the keys, so all the
+		// duplicates must fit a bucket.
+		auto loops = std::min<size_t>(LOOP_N, dbh_->bckt_slots
+						      / TEST_THREADS_N);
 
 		r = gettimeofday(&tv0, NULL);
 		assert(!r);
@@ -404,7 +552,7 @@ public:
 				// Set thread ID for percpu interfaces.
 				__thr_set_cpuid();
 
-				for (auto i = 0; i < LOOP_N; ++i)
+				for (auto i = 0; i < loops; ++i)
 					workload();
 			});
 		std::ranges::for_each(thrs, std::mem_fn(&std::thread::join));
@@ -427,6 +575,18 @@ public:
 			lookup_rec(i);
 	}
 
+	/*
+	 * Simulate a process crash: the database isn't closed, so it has to be
+	 * recovered on the next opening.
+	 */
+	void
+	crash() noexcept
+	{
+		free_percpu(dbh_->rcl);
+		free_percpu(dbh_->pcpu);
+		dbh_ = nullptr;
+	}
+
 	virtual ~Tester()
 	{
 		if (dbh_)
@@ -441,6 +601,19 @@ thread_local int Tester::it_ = 0;
 
 class TestFixSzRecBase : public Tester {
 private:
+	// The keys inserted by a new CPU.
+	static const unsigned int NEW_CPU_KEY = 0x40000000U;
+
+	// The records data visited by the current walk.
+	static thread_local std::set<unsigned int> *walked_;
+
+	static int
+	walk_cb(void *data)
+	{
+		walked_->insert(*(unsigned int *)data);
+		return 0;
+	}
+
 	unsigned int *
 	next_int()
 	{
@@ -496,20 +669,353 @@ private:
 		tdb_htrie_put_bucket(dbh_);
 	}
 
+	bool
+	rec_exists(unsigned int k)
+	{
+		int i = 0;
+		void *r = NULL;
+
+		TdbHtrieBucket *b = tdb_htrie_lookup(dbh_, k);
+		if (b) {
+			r = tdb_htrie_bscan_for_rec(dbh_, b, k, &i);
+			tdb_htrie_put_bucket(dbh_);
+		}
+		return r;
+	}
+
 public:
 	TestFixSzRecBase(const char *fname, const char *tname, int addr_id,
-			 size_t root_bits, unsigned long flags)
-		: Tester(fname, tname, addr_id, sizeof(int), root_bits, flags)
+			 size_t root_bits, unsigned long flags,
+			 unsigned int bckt_slots = 0, unsigned int idx_n = 1)
+		: Tester(fname, tname, addr_id, sizeof(int), root_bits, flags,
+			 bckt_slots, DB_FSZ, idx_n)
 	{}
 
+	/*
+	 * Batched lookups must return the same buckets as the single key ones.
+	 */
+	void
+	lookup_recs_batch()
+	{
+		static const auto BATCH = TDB_HTRIE_LOOKUP_BATCH + 7;
+		uint64_t keys[BATCH];
+		TdbHtrieBucket *out[BATCH];
+
+		__thr_set_cpuid();
+
+		for (auto i = 0; i < DATA_N; i += BATCH) {
+			int n = std::min(BATCH, DATA_N - i);
+
+			for (auto j = 0; j < n; ++j)
+				keys[j] = ints[i + j];
+			int found = tdb_htrie_lookup_batch(dbh_, keys, n, out);
+			assert(found == n);
+
+			for (auto j = 0; j < n; ++j) {
+				int s = 0;
+				assert(out[j]);
+				assert(tdb_htrie_bscan_for_rec(dbh_, out[j],
+							       keys[j], &s));
+			}
+			tdb_htrie_put_bucket(dbh_);
+		}
+	}
+
+	/*
+	 * Remove each second record of the stored database and check that
+	 * the removed records are not visible anymore, while the rest of
+	 * the records are still available after the tombstones reclamation.
+	 */
+	void
+	remove_recs()
+	{
+		__thr_set_cpuid();
+
+		for (auto i = 0; i < DATA_N; i += 2) {
+			int n __attribute__((unused));
+
+			n = tdb_htrie_remove(dbh_, ints[i], NULL, NULL);
+			assert(n > 0);
+			assert(!rec_exists(ints[i]));
+		}
+
+		tdb_htrie_reclaim(dbh_);
+
+		for (auto i = 0; i < DATA_N; ++i)
+			assert(rec_exists(ints[i]) == (i & 1));
+	}
+
+	/*
+	 * Walk the records by small slices and insert new records, bursting
+	 * the buckets, between the slices. All the records stored before
+	 * the walk must be visited.
+	 */
+	void
+	walk_recs()
+	{
+		static const auto SLICE = 7;
+		std::set<unsigned int> found;
+		TdbHtrieCursor cur;
+		int n, i = 0;
+
+		__thr_set_cpuid();
+
+		walked_ = &found;
+		tdb_htrie_cursor_init(&cur);
+		while ((n = tdb_htrie_walk_next(dbh_, &cur, SLICE, walk_cb)) > 0)
+		{
+			unsigned int k = ints[i++ % DATA_N] ^ 0x80000000U;
+			unsigned int data = k + 1;
+			size_t copied = sizeof(data);
+			TdbRec *rec __attribute__((unused));
+
+			assert(n <= SLICE);
+			rec = tdb_htrie_insert(dbh_, k, &data, &copied);
+			assert(rec && copied == sizeof(data));
+		}
+		assert(!n && i);
+
+		for (auto i = 1; i < DATA_N; i += 2)
+			assert(found.contains(ints[i] + 1));
+	}
+
+	/*
+	 * There are more online CPUs than on the database creation, so a new
+	 * CPU doesn't have the per-CPU data dump and allocates the blocks on
+	 * the first insertion.
+	 */
+	void
+	insert_on_new_cpu()
+	{
+		// Take the IDs of the CPUs having the per-CPU data dumps.
+		for (auto i = 0; i < TEST_THREADS_N; ++i)
+			__thr_set_cpuid();
+
+		std::thread([&]() {
+			__thr_set_cpuid();
+
+			for (auto i = 0; i < DATA_N; ++i) {
+				unsigned int k = ints[i] ^ NEW_CPU_KEY;
+				unsigned int data = k + 1;
+				size_t copied = sizeof(data);
+				TdbRec *rec __attribute__((unused));
+
+				rec = tdb_htrie_insert(dbh_, k, &data, &copied);
+				assert(rec && copied == sizeof(data));
+			}
+			for (auto i = 0; i < DATA_N; ++i)
+				assert(rec_exists(ints[i] ^ NEW_CPU_KEY));
+		}).join();
+	}
+
+	/*
+	 * The records inserted by insert_on_new_cpu() must be available with
+	 * less online CPUs.
+	 */
+	void
+	check_new_cpu_recs()
+	{
+		__thr_set_cpuid();
+
+		for (auto i = 0; i < DATA_N; ++i) {
+			assert(rec_exists(ints[i] ^ NEW_CPU_KEY));
+			assert(rec_exists(ints[i]) == (i & 1));
+		}
+	}
+
+	/*
+	 * Update the same record many times: the tombstones must not make
+	 * the bucket full.
+	 */
+	void
+	update_rec()
+	{
+		unsigned int k = ints[1], data = k + 1;
+
+		__thr_set_cpuid();
+
+		for (auto i = 0; i < DATA_N; ++i) {
+			size_t copied = sizeof(data);
+			TdbRec *rec __attribute__((unused));
+			int n __attribute__((unused));
+
+			n = tdb_htrie_remove(dbh_, k, NULL, NULL);
+			assert(n > 0);
+			rec = tdb_htrie_insert(dbh_, k, &data, &copied);
+			assert(rec && copied == sizeof(data));
+		}
+
+		for (auto i = 0; i < DATA_N; ++i)
+			lookup_rec(i);
+	}
+
+	/*
+	 * Remove each second record and crash before the tombstones are
+	 * reclaimed, so the recovery must reclaim them.
+	 */
+	void
+	remove_recs_crash()
+	{
+		__thr_set_cpuid();
+
+		for (auto i = 0; i < DATA_N; i += 2) {
+			int n __attribute__((unused));
+
+			n = tdb_htrie_remove(dbh_, ints[i], NULL, NULL);
+			assert(n > 0);
+		}
+
+		crash();
+	}
+
+	/*
+	 * Check the database recovered after remove_recs_crash() and make sure
+	 * that the recovered per-CPU data is good to insert the removed records
+	 * back.
+	 */
+	void
+	check_recovered_db()
+	{
+		__thr_set_cpuid();
+
+		for (auto i = 0; i < DATA_N; ++i)
+			assert(rec_exists(ints[i]) == (i & 1));
+
+		for (auto i = 0; i < DATA_N; i += 2) {
+			unsigned int data = ints[i] + 1;
+			size_t copied = sizeof(data);
+			TdbRec *rec __attribute__((unused));
+
+			rec = tdb_htrie_insert(dbh_, ints[i], &data, &copied);
+			assert(rec && copied == sizeof(data));
+		}
+
+		for (auto i = 0; i < DATA_N; ++i)
+			lookup_rec(i);
+	}
+
+	/*
+	 * Insert new records, bursting the buckets, and remove each second
+	 * record of the stored database while a snapshot is active. The
+	 * snapshot walk must visit exactly the records stored before the
+	 * snapshot, while the live index has the updates.
+	 */
+	void
+	snapshot_recs()
+	{
+		static const unsigned int SNAP_KEY = 0x20000000U;
+		std::set<unsigned int> found, snap;
+		TdbHtrieStat st;
+		int r __attribute__((unused));
+
+		__thr_set_cpuid();
+
+		walked_ = &found;
+		tdb_htrie_walk(dbh_, walk_cb);
+		r = tdb_htrie_snapshot_begin(dbh_, DATA_N * 16);
+		assert(!r && tdb_htrie_snapshot_begin(dbh_, 1) == -EBUSY);
+
+		for (auto i = 0; i < DATA_N; ++i) {
+			unsigned int k = ints[i] ^ SNAP_KEY;
+			unsigned int data = k + 1;
+			size_t copied = sizeof(data);
+			TdbRec *rec __attribute__((unused));
+
+			rec = tdb_htrie_insert(dbh_, k, &data, &copied);
+			assert(rec && copied == sizeof(data));
+		}
+		for (auto i = 0; i < DATA_N; i += 2) {
+			r = tdb_htrie_remove(dbh_, ints[i], NULL, NULL);
+			assert(r > 0);
+		}
+		tdb_htrie_reclaim(dbh_);
+
+		walked_ = &snap;
+		r = tdb_htrie_snapshot_walk(dbh_, walk_cb);
+		assert(!r && snap == found);
+		tdb_htrie_stat(dbh_, &st);
+		assert(st.cow && st.burst);
+
+		r = tdb_htrie_snapshot_end(dbh_);
+		assert(!r && tdb_htrie_snapshot_walk(dbh_, walk_cb) == -EINVAL);
+		tdb_htrie_reclaim(dbh_);
+
+		for (auto i = 0; i < DATA_N; ++i) {
+			assert(rec_exists(ints[i]) == (i & 1));
+			assert(rec_exists(ints[i] ^ SNAP_KEY));
+		}
+	}
+
+	/*
+	 * The layout of the opened database must match the records and the
+	 * free buckets of the database and must be the same for the database
+	 * image, also after the database is closed.
+	 */
+	void
+	check_layout()
+	{
+		static size_t walked_n;
+		TdbHtrieLayout l, li;
+		TdbHtrieStat st;
+		TdbHdr *dbh;
+		uint64_t recs = 0, bckts = 0, fill = 0, free_n = 0;
+		int r __attribute__((unused));
+
+		__thr_set_cpuid();
+
+		r = tdb_htrie_layout(dbh_, 0, &l);
+		assert(!r);
+		for (auto i = 0; i < TDB_HTRIE_DEPTH_MAX; ++i) {
+			recs += l.recs[i];
+			bckts += l.bckts[i];
+		}
+		for (auto s = 0U; s <= dbh_->bckt_slots; ++s)
+			fill += l.fill[s];
+		for (auto c = 0U; c < l.pcpu_n; ++c)
+			free_n += l.pcpu_free[c];
+		walked_n = 0;
+		tdb_htrie_walk(dbh_, [](void *) { ++walked_n; return 0; });
+		tdb_htrie_stat(dbh_, &st);
+
+		assert(recs == walked_n && recs == l.slots[TDB_HTRIE_SLOT_REC]);
+		assert(fill == bckts && l.root_max <= recs && !l.bad);
+		// The small buckets of the database must be bursted.
+		assert(l.nodes[1] && l.bckts[1] && recs > l.recs[0]);
+		assert(free_n == st.free_bckt && l.stat.burst == st.burst);
+		assert(l.alloc.ext_used && l.alloc.blk_free < l.alloc.blk_n
+		       && !l.alloc.bad);
+
+		// The opened database is dirty, so there are no per-CPU data.
+		dbh = tdb_htrie_image(dbh_, DB_FSZ);
+		assert(dbh == dbh_);
+		r = tdb_htrie_layout_image(dbh, 0, &li);
+		assert(!r && !li.pcpu_n && !li.bad);
+		assert(!memcmp(li.recs, l.recs, sizeof(l.recs))
+		       && !memcmp(li.fill, l.fill, sizeof(l.fill))
+		       && li.pool == l.pool);
+
+		tdb_htrie_exit(dbh_);
+		dbh_ = nullptr;
+		r = tdb_htrie_layout_image(dbh, 0, &li);
+		assert(!r && li.pcpu_n == dbh->pcpu_n && !li.bad);
+		for (auto c = 0U; c < li.pcpu_n; ++c)
+			free_n -= li.pcpu_free[c];
+		assert(!free_n && li.stat.free_bckt == st.free_bckt
+		       && li.stat.insert == st.insert);
+		assert(tdb_htrie_layout_image(dbh, 1, &li) == -EINVAL);
+	}
+
 	virtual ~TestFixSzRecBase() {}
 };
 
+thread_local std::set<unsigned int> *TestFixSzRecBase::walked_ = nullptr;
+
 class TestFixSzRec : public TestFixSzRecBase {
 public:
 	TestFixSzRec(const char *fname, const char *tname, int addr_id,
-		     size_t root_bits)
-		: TestFixSzRecBase(fname, tname, addr_id, root_bits, TDB_F_INPLACE)
+		     size_t root_bits, unsigned int bckt_slots = 0)
+		: TestFixSzRecBase(fname, tname, addr_id, root_bits, TDB_F_INPLACE,
+				   bckt_slots)
 	{}
 
 	virtual ~TestFixSzRec() {}
@@ -525,6 +1031,353 @@ public:
 	virtual ~TestFixSzRecStablePtrs() {}
 };
 
+/*
+ * Stable records referenced by the primary index with the integer keys and
+ * by the secondary index with the inverted integer keys.
+ */
+class TestFixSzRecIdx : public TestFixSzRecBase {
+private:
+	static void
+	rec_keys(unsigned int i, uint64_t *keys) noexcept
+	{
+		keys[0] = i;
+		keys[1] = ~i;
+	}
+
+	virtual void
+	insert_rec(int tid)
+	{
+		unsigned int i = ints[it_];
+		unsigned int data = i + 1;
+		size_t copied = sizeof(i);
+		uint64_t keys[2];
+		TdbRec *rec __attribute__((unused));
+
+		if (++it_ == DATA_N)
+			it_ = 0;
+
+		rec_keys(i, keys);
+		rec = tdb_htrie_insert_keys(dbh_, keys, &data, &copied);
+		assert(rec && copied == sizeof(i));
+
+		dbg << std::dec << tid << ": inserted int 0x" << std::hex << i
+		    << " into both indexes by addr 0x" << rec << std::endl
+		    << std::flush;
+	}
+
+	/*
+	 * Find the record @rec with the @key in the index @idx or any record
+	 * with the key if @rec is NULL.
+	 */
+	TdbRec *
+	idx_lookup(unsigned int idx, uint64_t key, TdbRec *rec = NULL)
+	{
+		int i = 0;
+		TdbRec *r;
+
+		TdbHtrieBucket *b = tdb_htrie_lookup_idx(dbh_, idx, key);
+		if (!b)
+			return NULL;
+		r = (TdbRec *)tdb_htrie_bscan_for_rec(dbh_, b, key, &i);
+		while (r && rec && r != rec)
+			r = (TdbRec *)tdb_htrie_bscan_for_rec(dbh_, b, key, &++i);
+		tdb_htrie_put_bucket(dbh_);
+
+		return r;
+	}
+
+public:
+	TestFixSzRecIdx(const char *fname, const char *tname, int addr_id,
+			size_t root_bits)
+		: TestFixSzRecBase(fname, tname, addr_id, root_bits, 0, 0, 2)
+	{}
+
+	/*
+	 * Both the indexes must return the same records. Remove each second
+	 * record from both the indexes at once.
+	 */
+	void
+	check_indexes()
+	{
+		uint64_t keys[2];
+
+		__thr_set_cpuid();
+
+		for (auto i = 0; i < DATA_N; ++i) {
+			TdbRec *r __attribute__((unused));
+
+			rec_keys(ints[i], keys);
+			// The index buckets may keep the duplicates in
+			// different order.
+			r = idx_lookup(1, keys[1]);
+			assert(r && idx_lookup(0, keys[0], r) == r);
+			assert(*(unsigned int *)r->data == ints[i] + 1);
+		}
+
+		for (auto i = 0; i < DATA_N; i += 2) {
+			int n __attribute__((unused));
+
+			rec_keys(ints[i], keys);
+			n = tdb_htrie_remove_keys(dbh_, keys, NULL, NULL);
+			assert(n > 0);
+			assert(!idx_lookup(0, keys[0]) && !idx_lookup(1, keys[1]));
+		}
+
+		tdb_htrie_reclaim(dbh_);
+
+		for (auto i = 0; i < DATA_N; ++i) {
+			rec_keys(ints[i], keys);
+			assert(!!idx_lookup(0, keys[0]) == (i & 1));
+			assert(!!idx_lookup(1, keys[1]) == (i & 1));
+		}
+	}
+
+	virtual ~TestFixSzRecIdx() {}
+};
+
+/*
+ * IPv4 prefixes with the address in the most significant bits of raw keys.
+ * The prefix lengths go from 0 to 32, so any address matches some prefix.
+ */
+class TestPfx : public Tester {
+private:
+	static const auto IPV4_BITS = 32;
+
+	// Prefix keys to the test data indexes to check the lookup results.
+	std::map<uint64_t, unsigned int> pfx_;
+
+	static uint64_t
+	addr(unsigned int i)
+	{
+		// Spread the random data over all the address bits.
+		return (uint64_t)(ints[i] * 2654435761U) << IPV4_BITS;
+	}
+
+	virtual void
+	insert_rec(int i)
+	{
+		unsigned int plen = i % (IPV4_BITS + 1);
+		uint64_t k = tdb_htrie_pfx_key(addr(i), plen);
+		size_t copied = sizeof(i);
+		TdbRec *rec __attribute__((unused));
+
+		// Insert unique prefixes only.
+		if (!pfx_.emplace(k, i).second)
+			return;
+
+		rec = tdb_htrie_insert_prefix(dbh_, addr(i), plen, &i, &copied);
+		assert(rec && copied == sizeof(i));
+
+		dbg << "inserted prefix 0x" << std::hex << addr(i) << "/"
+		    << std::dec << plen << std::endl << std::flush;
+	}
+
+	virtual void
+	lookup_rec(int i)
+	{
+		// Change the address bits after the prefix of the next record.
+		uint64_t a = addr(i) ^ (1UL << (BITS_PER_LONG - 1 - i % IPV4_BITS));
+		unsigned int plen = IPV4_BITS + 1;
+		TdbHtrieBucket *b;
+		TdbRec *r;
+		int s = 0;
+
+		auto it = pfx_.end();
+		while (it == pfx_.end() && plen)
+			it = pfx_.find(tdb_htrie_pfx_key(a, --plen));
+		assert(it != pfx_.end());
+
+		b = tdb_htrie_lookup_prefix(dbh_, a, &plen);
+		assert(b && it->first == tdb_htrie_pfx_key(a, plen));
+		r = (TdbRec *)tdb_htrie_bscan_for_rec(dbh_, b, it->first, &s);
+		assert(r && *(unsigned int *)r->data == it->second);
+		tdb_htrie_put_bucket(dbh_);
+	}
+
+public:
+	TestPfx(const char *fname, const char *tname, int addr_id,
+		size_t root_bits)
+		: Tester(fname, tname, addr_id, sizeof(int), root_bits,
+			 TDB_F_INPLACE | TDB_F_RAWKEY)
+	{}
+
+	/*
+	 * Each lookup must find the longest of the inserted prefixes,
+	 * which isn't necessary the prefix inserted for the address.
+	 */
+	void
+	check_prefixes()
+	{
+		__thr_set_cpuid();
+
+		for (auto i = 0; i < DATA_N; ++i)
+			insert_rec(i);
+		for (auto i = 0; i < DATA_N; ++i)
+			lookup_rec(i);
+	}
+
+	virtual ~TestPfx() {}
+};
+
+/*
+ * URLs with order-preserving compressed keys in the most significant bits
+ * of raw keys, so the URLs with the same prefix are in the same subtree.
+ */
+class TestHope : public Tester {
+private:
+	std::vector<std::string> keys_;
+	TdbHope hope_;
+
+	// The records found by the current prefix walk.
+	static thread_local std::vector<unsigned int> *found_;
+
+	static int
+	walk_cb(void *data)
+	{
+		found_->push_back(*(unsigned int *)data);
+		return 0;
+	}
+
+	virtual void
+	insert_rec(int i)
+	{
+		const std::string &s = keys_[i];
+		size_t copied = sizeof(i);
+		TdbRec *rec __attribute__((unused));
+
+		rec = tdb_hope_insert(dbh_, &hope_, s.data(), s.size(), &i,
+				      &copied);
+		assert(rec && copied == sizeof(i));
+	}
+
+	virtual void
+	lookup_rec(int i)
+	{
+		const std::string &s = keys_[i];
+		uint64_t k = tdb_hope_key(&hope_, s.data(), s.size());
+		bool data_found = false;
+		TdbHtrieBucket *b;
+		TdbRec *r;
+		int n = 0;
+
+		b = tdb_hope_lookup(dbh_, &hope_, s.data(), s.size());
+		assert(b);
+		// Different URLs may have the same key.
+		r = (TdbRec *)tdb_htrie_bscan_for_rec(dbh_, b, k, &n);
+		for ( ; r; r = (TdbRec *)tdb_htrie_bscan_for_rec(dbh_, b, k, &++n))
+			if (*(int *)r->data == i)
+				data_found = true;
+		assert(data_found);
+		tdb_htrie_put_bucket(dbh_);
+	}
+
+	void
+	check_prefix(const std::string &pfx)
+	{
+		std::vector<unsigned int> found, expected;
+		uint64_t pk;
+		unsigned int bits = tdb_hope_pfx(&hope_, pfx.data(), pfx.size(),
+						 &pk);
+		int r __attribute__((unused));
+
+		for (auto i = 0; i < (int)keys_.size(); ++i)
+			if (keys_[i].starts_with(pfx))
+				expected.push_back(i);
+
+		found_ = &found;
+		r = tdb_hope_walk_prefix(dbh_, &hope_, pfx.data(), pfx.size(),
+					 walk_cb);
+		assert(!r);
+		std::ranges::sort(found);
+
+		dbg << "prefix '" << pfx << "' (" << std::dec << bits
+		    << " bits): " << found.size() << " records, "
+		    << expected.size() << " expected" << std::endl;
+
+		if (bits < TDB_HOPE_PFX_BITS) {
+			// The compressed prefix fits the key, the walk is exact.
+			assert(found == expected);
+			return;
+		}
+		// Long prefixes are truncated, so the walk may visit more URLs.
+		assert(std::ranges::includes(found, expected));
+		for (auto i : found) {
+			uint64_t k __attribute__((unused));
+
+			k = tdb_hope_key(&hope_, keys_[i].data(), keys_[i].size());
+			assert(!((k ^ pk) >> (BITS_PER_LONG - TDB_HOPE_PFX_BITS)));
+		}
+	}
+
+public:
+	TestHope(const char *fname, const char *tname, int addr_id,
+		 size_t root_bits)
+		: Tester(fname, tname, addr_id, sizeof(int), root_bits,
+			 TDB_F_INPLACE | TDB_F_RAWKEY)
+	{
+		static const char *paths[] = {
+			"/", "/blog/", "/blog/nginx-", "/static/img/logo-",
+			"/static/js/", "/store.php?nfid=",
+			"/tempesta-tech/tempesta/commit/"
+		};
+		unsigned long freq[TDB_HOPE_SYM_N] = {};
+		size_t bytes = 0, bits = 0;
+		int r __attribute__((unused));
+
+		for (auto i = 0; i < DATA_N; ++i)
+			keys_.push_back(paths[i % std::size(paths)]
+					+ std::to_string(i) + ".html");
+
+		// Build the dictionary from a half of the keys only.
+		for (size_t i = 0; i < keys_.size(); i += 2)
+			tdb_hope_sample(freq, keys_[i].data(), keys_[i].size());
+		r = tdb_hope_init(&hope_, freq);
+		assert(!r);
+
+		for (const auto &s : keys_) {
+			bytes += s.size();
+			bits += tdb_hope_enc_bits(&hope_, s.data(), s.size());
+		}
+		std::cout << "HOPE compression: " << std::fixed
+			  << std::setprecision(2) << (double)bits / bytes
+			  << " bits per char" << std::endl;
+	}
+
+	void
+	check_hope()
+	{
+		__thr_set_cpuid();
+
+		// The compressed keys follow in the order of the URLs.
+		std::vector<std::string> sorted(keys_);
+		std::ranges::sort(sorted);
+		for (size_t i = 1; i < sorted.size(); ++i) {
+			const std::string &a = sorted[i - 1], &b = sorted[i];
+			uint64_t ka = tdb_hope_key(&hope_, a.data(), a.size());
+			uint64_t kb = tdb_hope_key(&hope_, b.data(), b.size());
+
+			assert(ka >> (BITS_PER_LONG - TDB_HOPE_PFX_BITS)
+			       <= kb >> (BITS_PER_LONG - TDB_HOPE_PFX_BITS));
+		}
+
+		for (auto i = 0; i < (int)keys_.size(); ++i)
+			insert_rec(i);
+		for (auto i = 0; i < (int)keys_.size(); ++i)
+			lookup_rec(i);
+
+		for (const char *pfx : {
+			"", "/", "/b", "/blog/", "/blog/nginx-", "/blog/nginx-1",
+			"/static/", "/static/img/logo-9", "/store.php?nfid=3",
+			"/tempesta-tech/tempesta/commit/", "/x"
+		     })
+			check_prefix(pfx);
+	}
+
+	virtual ~TestHope() {}
+};
+
+thread_local std::vector<unsigned int> *TestHope::found_ = nullptr;
+
 class TestVarSzRec : public Tester {
 private:
 	TestUrl *
@@ -547,10 +1400,11 @@ private:
 
 		print_bin_url(tid, "insert", u);
 
-		TdbVRec *rec = (TdbVRec *)tdb_htrie_insert(dbh_, k, u->body,
-							   &to_copy);
-		assert((u->blen && rec) || (!u->blen && !rec));
+		// Large records must not be visible until fully written.
+		TdbRec *head = tdb_htrie_insert_begin(dbh_, k, u->body, &to_copy);
+		assert((u->blen && head) || (!u->blen && !head));
 
+		TdbVRec *rec = (TdbVRec *)head;
 		for (auto copied = to_copy; copied != u->blen; copied += rec->len)
 		{
 			rec = tdb_htrie_extend_rec(dbh_, rec, u->blen - copied);
@@ -558,6 +1412,9 @@ private:
 			memcpy((char *)(rec + 1), u->body + copied, rec->len);
 		}
 
+		head = tdb_htrie_insert_commit(dbh_, k, head);
+		assert(head);
+
 		data_stored_ += u->blen;
 	}
 
@@ -593,14 +1450,229 @@ private:
 			r = (TdbVRec *)tdb_htrie_bscan_for_rec(dbh_, b, k, &++ri);
 		} while (r);
 		assert(data_found);
+
+		tdb_htrie_put_bucket(dbh_);
 	}
 
 public:
 	TestVarSzRec(const char *fname, const char *tname, int addr_id,
-		     size_t root_bits)
-		: Tester(fname, tname, addr_id, 0, root_bits, 0)
+		     size_t root_bits, size_t init_sz = DB_FSZ)
+		: Tester(fname, tname, addr_id, 0, root_bits, 0, 0, init_sz)
 	{}
 
+	/*
+	 * Insert small records, remove and insert them again: the first round
+	 * records are the slab objects, which must be reused by the second
+	 * round records of the same sizes.
+	 */
+	void
+	small_recs()
+	{
+		static const auto N = 1000;
+		static const auto SMALL_KEY = 0x50000000UL;
+		uint64_t s_wcl0[TDB_HTRIE_SLAB_N], s_wcl[TDB_HTRIE_SLAB_N];
+		char buf[256];
+		TdbPerCpu *p;
+
+		__thr_set_cpuid();
+		p = this_cpu_ptr(dbh_->pcpu);
+		memcpy(s_wcl0, p->s_wcl, sizeof(s_wcl0));
+
+		for (auto round = 0; round < 2; ++round) {
+			for (auto i = 0; i < N; ++i) {
+				size_t len = 1 + i % (sizeof(buf) - 16);
+
+				memset(buf, i, len);
+				auto r = tdb_htrie_insert(dbh_, SMALL_KEY + i,
+							  buf, &len);
+				assert(r && len == 1 + i % (sizeof(buf) - 16));
+			}
+			if (!round) {
+				memcpy(s_wcl, p->s_wcl, sizeof(s_wcl));
+				assert(memcmp(s_wcl0, s_wcl, sizeof(s_wcl)));
+				for (auto i = 0; i < N; ++i) {
+					int n __attribute__((unused));
+
+					n = tdb_htrie_remove(dbh_, SMALL_KEY + i,
+							     NULL, NULL);
+					assert(n == 1);
+				}
+				tdb_htrie_reclaim(dbh_);
+			}
+		}
+		assert(!memcmp(s_wcl, p->s_wcl, sizeof(s_wcl)));
+
+		for (auto i = 0; i < N; ++i) {
+			int ri = 0;
+			TdbHtrieBucket *b = tdb_htrie_lookup(dbh_, SMALL_KEY + i);
+			assert(b);
+			auto r = (TdbVRec *)tdb_htrie_bscan_for_rec(dbh_, b,
+								   SMALL_KEY + i,
+								   &ri);
+			assert(r && r->len == 1 + i % (sizeof(buf) - 16)
+			       && !r->chunk_next);
+			memset(buf, i, r->len);
+			assert(!memcmp(r->data, buf, r->len));
+			tdb_htrie_put_bucket(dbh_);
+		}
+	}
+
+	/*
+	 * Read a multi-chunk record into a scatter-gather vector and check
+	 * that the vector covers exactly the record data.
+	 */
+	void
+	zero_copy()
+	{
+		static const auto KEY = 0x60000000UL;
+		static const size_t LEN = TDB_BLK_SZ * 3 + 100;
+		static const int IOV_N = 64;
+		std::vector<char> body(LEN), out;
+		struct kvec iov[IOV_N];
+		size_t to_copy = LEN, len;
+		int n;
+
+		__thr_set_cpuid();
+		for (size_t i = 0; i < LEN; ++i)
+			body[i] = 'a' + i % 23;
+
+		TdbRec *head = tdb_htrie_insert_begin(dbh_, KEY, body.data(),
+						      &to_copy);
+		assert(head);
+		TdbVRec *rec = (TdbVRec *)head;
+		for (auto copied = to_copy; copied != LEN; copied += rec->len) {
+			rec = tdb_htrie_extend_rec(dbh_, rec, LEN - copied);
+			assert(rec);
+			memcpy(rec->data, body.data() + copied, rec->len);
+		}
+		head = tdb_htrie_insert_commit(dbh_, KEY, head);
+		assert(head);
+
+		// A short vector gets the first chunks and the chunks number.
+		n = tdb_htrie_read_iov(dbh_, KEY, NULL, NULL, iov, 1, &len);
+		assert(n > 1 && len == LEN);
+		assert(iov[0].iov_len < LEN
+		       && !memcmp(iov[0].iov_base, body.data(),
+				  iov[0].iov_len));
+		tdb_htrie_put_bucket(dbh_);
+
+		n = tdb_htrie_read_iov(dbh_, KEY, NULL, NULL, iov, IOV_N, &len);
+		assert(n > 1 && n <= IOV_N && len == LEN);
+		for (auto i = 0; i < n; ++i)
+			out.insert(out.end(), (char *)iov[i].iov_base,
+				   (char *)iov[i].iov_base + iov[i].iov_len);
+		tdb_htrie_put_bucket(dbh_);
+		assert(out == body);
+
+		n = tdb_htrie_read_iov(dbh_, KEY,
+				       [](void *, void *) { return false; },
+				       NULL, iov, IOV_N, &len);
+		assert(n == -ENOENT);
+		n = tdb_htrie_read_iov(dbh_, KEY + 1, NULL, NULL, iov, IOV_N,
+				       &len);
+		assert(n == -ENOENT);
+	}
+
+	/*
+	 * Expire the marked records, then let the CLOCK sweeps evict the
+	 * records, which aren't looked up between the sweeps. All the evicted
+	 * data must be accounted as freed after the reclamation.
+	 */
+	void
+	evict()
+	{
+		static const auto KEY = 0x70000000UL;
+		static const auto N = 200;
+		static const size_t LEN = 100;
+		auto expired = [](void *rec, void *) {
+			return ((TdbVRec *)rec)->data[0] == 'x';
+		};
+		auto found = [this](int i) {
+			int ri = 0;
+			bool r;
+			TdbHtrieBucket *b = tdb_htrie_lookup(dbh_, KEY + i);
+
+			if (!b)
+				return false;
+			r = tdb_htrie_bscan_for_rec(dbh_, b, KEY + i, &ri);
+			tdb_htrie_put_bucket(dbh_);
+			return r;
+		};
+		char buf[LEN];
+		TdbHtrieCursor hand;
+		TdbHtrieStat st0, st;
+		int n;
+
+		__thr_set_cpuid();
+		tdb_htrie_stat(dbh_, &st0);
+
+		// Every 4th record has expired.
+		for (auto i = 0; i < N; ++i) {
+			size_t len = LEN;
+
+			memset(buf, i % 4 ? 'a' : 'x', LEN);
+			auto r = tdb_htrie_insert(dbh_, KEY + i, buf, &len);
+			assert(r && len == LEN);
+		}
+		tdb_htrie_stat(dbh_, &st);
+		assert(st.data - st0.data
+		       == N * ((sizeof(TdbVRec) + LEN + 7) & ~7UL));
+
+		tdb_htrie_cursor_init(&hand);
+		n = tdb_htrie_expire(dbh_, &hand, UINT_MAX, expired, NULL);
+		assert(n == N / 4 && !hand.end);
+
+		// The odd records are hot, the cold ones are evicted.
+		for (auto i = 1; i < N; i += 2)
+			assert(found(i));
+		n = tdb_htrie_evict(dbh_, &hand, UINT_MAX, NULL, NULL);
+		assert(n == N / 4);
+		for (auto i = 0; i < N; ++i)
+			assert(found(i) == (i & 1));
+
+		// The hot records get the second chance only.
+		n = tdb_htrie_evict(dbh_, &hand, UINT_MAX, NULL, NULL);
+		assert(!n);
+		n = tdb_htrie_evict(dbh_, &hand, UINT_MAX, NULL, NULL);
+		assert(n == N / 2);
+
+		tdb_htrie_reclaim(dbh_);
+		st = htrie_stat();
+		assert(st.data == st0.data);
+		assert(st.expire - st0.expire == N / 4);
+		assert(st.evict - st0.evict == N / 4 * 3);
+	}
+
+	/*
+	 * Allocate all the blocks of a new extent and free them: the extent
+	 * must be recycled as an empty one.
+	 */
+	void
+	compact()
+	{
+		TdbAlloc *a = &dbh_->alloc;
+		std::vector<uint64_t> blks;
+		uint64_t st = 0, o;
+		size_t eid;
+
+		__thr_set_cpuid();
+
+		o = tdb_alloc_blk(a, TDB_EXT_BAD, true, &st);
+		assert(o);
+		eid = o >> TDB_EXT_BITS;
+		do {
+			blks.push_back(o);
+			o = tdb_alloc_blk(a, eid, false, &st);
+			assert(o);
+		} while (o >> TDB_EXT_BITS == eid);
+		blks.push_back(o);
+
+		for (auto b : blks)
+			tdb_free_blk(a, (uint64_t)TDB_PTR(dbh_, b));
+
+		assert(tdb_htrie_compact(dbh_) >= TDB_EXT_SZ);
+	}
+
 	virtual ~TestVarSzRec()
 	{
 		if (data_stored_)
@@ -690,6 +1762,73 @@ t_htrie_run_tests(const char *fname)
 		info << "ERROR: fixed size records read db: " << e.what()
 		     << std::endl;
 	}
+	try {
+		TestFixSzRec(fname, "fix-size batch r/o", 2, 8)
+			.lookup_recs_batch();
+	}
+	catch (Except &e) {
+		info << "ERROR: fixed size records batch read db: " << e.what()
+		     << std::endl;
+	}
+	try {
+		TestFixSzRec(fname, "fix-size update", 2, 8).update_rec();
+	}
+	catch (Except &e) {
+		info << "ERROR: fixed size records update: " << e.what()
+		     << std::endl;
+	}
+	try {
+		TestFixSzRec(fname, "fix-size remove", 2, 8).remove_recs();
+	}
+	catch (Except &e) {
+		info << "ERROR: fixed size records removal: " << e.what()
+		     << std::endl;
+	}
+	try {
+		TestFixSzRec(fname, "fix-size incremental walk", 2, 8)
+			.walk_recs();
+	}
+	catch (Except &e) {
+		info << "ERROR: fixed size records walk: " << e.what()
+		     << std::endl;
+	}
+	try {
+		// CPUs are added and removed between the database openings.
+		__thr_set_threads_n(TEST_THREADS_N + 1);
+		TestFixSzRec(fname, "fix-size cpu added", 2, 8)
+			.insert_on_new_cpu();
+		__thr_set_threads_n(1);
+		TestFixSzRec(fname, "fix-size cpus removed", 2, 8)
+			.check_new_cpu_recs();
+	}
+	catch (Except &e) {
+		info << "ERROR: fixed size records on new cpus: " << e.what()
+		     << std::endl;
+	}
+	__thr_set_threads_n(TEST_THREADS_N);
+	try {
+		// Small buckets are bursted much more frequently.
+		{
+			TestFixSzRec t(fname, "fix-size small buckets r/w", 1,
+				       8, 4);
+			t.run();
+			// The small buckets must be bursted.
+			auto st = t.htrie_stat();
+			assert(st.insert && st.lookup >= st.insert
+			       && st.burst);
+			// The surplus of free buckets is in the global pool.
+			assert(st.free_bckt <= TDB_HTRIE_BCKT_FREE_MAX
+					       * TEST_THREADS_N);
+		}
+		TestFixSzRec(fname, "fix-size small buckets r/o", 2, 8)
+			.check_stored_db();
+		TestFixSzRec(fname, "fix-size small buckets layout", 2, 8)
+			.check_layout();
+	}
+	catch (Except &e) {
+		info << "ERROR: fixed size records in small buckets: "
+		     << e.what() << std::endl;
+	}
 
 	try {
 		// Even small records are stored in data segments and buckets
@@ -708,6 +1847,53 @@ t_htrie_run_tests(const char *fname)
 		info << "ERROR: fixed size stable ptr records read db: "
 		     << e.what() << std::endl;
 	}
+	try {
+		// Crash on removal and recover the database on the next run.
+		TestFixSzRecStablePtrs(fname, "fix-size stable crash", 2, 8)
+			.remove_recs_crash();
+		TestFixSzRecStablePtrs(fname, "fix-size stable recovery", 2, 8)
+			.check_recovered_db();
+	}
+	catch (Except &e) {
+		info << "ERROR: fixed size stable ptr records recovery: "
+		     << e.what() << std::endl;
+	}
+	try {
+		// A background dump doesn't see the concurrent updates.
+		TestFixSzRecStablePtrs(fname, "fix-size stable snapshot", 2, 8)
+			.snapshot_recs();
+	}
+	catch (Except &e) {
+		info << "ERROR: fixed size stable ptr records snapshot: "
+		     << e.what() << std::endl;
+	}
+	try {
+		// The same records are accessible by different keys.
+		TestFixSzRecIdx(fname, "fix-size secondary index r/w", 1, 8).run();
+		TestFixSzRecIdx(fname, "fix-size secondary index remove", 2, 8)
+			.check_indexes();
+	}
+	catch (Except &e) {
+		info << "ERROR: fixed size records secondary index: "
+		     << e.what() << std::endl;
+	}
+
+	try {
+		// The raw keys are resolved from the most significant bits.
+		TestPfx(fname, "ipv4 longest prefix match", 1, 8)
+			.check_prefixes();
+	}
+	catch (Except &e) {
+		info << "ERROR: ipv4 prefixes: " << e.what() << std::endl;
+	}
+	try {
+		// The string keys are compressed to the raw keys.
+		TestHope(fname, "compressed url prefixes", 1, 8).check_hope();
+	}
+	catch (Except &e) {
+		info << "ERROR: compressed url prefixes: " << e.what()
+		     << std::endl;
+	}
 
 	try {
 		// A database for non-inplace large records must be created
@@ -725,6 +1911,47 @@ t_htrie_run_tests(const char *fname)
 		info << "ERROR: variable size records read db: " << e.what()
 		     << std::endl;
 	}
+	try {
+		TestVarSzRec(fname, "var-size small records", 1, 12)
+			.small_recs();
+	}
+	catch (Except &e) {
+		info << "ERROR: variable size small records: " << e.what()
+		     << std::endl;
+	}
+	try {
+		// The database starts from a few extents and grows on demand.
+		TestVarSzRec t(fname, "var-size grow r/w", 1, 12,
+			       TDB_EXT_SZ * 8);
+		t.run();
+		assert(t.db_size() > TDB_EXT_SZ * 8);
+	}
+	catch (Except &e) {
+		info << "ERROR: variable size records growth: " << e.what()
+		     << std::endl;
+	}
+	try {
+		TestVarSzRec(fname, "var-size compaction", 2, 12).compact();
+	}
+	catch (Except &e) {
+		info << "ERROR: variable size records compaction: " << e.what()
+		     << std::endl;
+	}
+	try {
+		TestVarSzRec(fname, "var-size zero-copy read", 1, 12)
+			.zero_copy();
+	}
+	catch (Except &e) {
+		info << "ERROR: variable size records zero-copy read: "
+		     << e.what() << std::endl;
+	}
+	try {
+		TestVarSzRec(fname, "var-size eviction", 1, 12).evict();
+	}
+	catch (Except &e) {
+		info << "ERROR: variable size records eviction: " << e.what()
+		     << std::endl;
+	}
 }
 
 int
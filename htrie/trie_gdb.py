@@ -43,7 +43,8 @@ import gdb
 
 TDB_HTRIE_DBIT          = 1 << 31
 TDB_HTRIE_COLL_MAX      = int(64 / 2)
-TDB_HTRIE_BCKT_SLOTS_N  = TDB_HTRIE_COLL_MAX - 16
+TDB_HTRIE_SLOT_REC      = 2
+TDB_F_INPLACE           = 0x01
 
 
 def htrie_addr(base, o):
@@ -52,18 +53,32 @@ def htrie_addr(base, o):
 def htrie_bckt_slot2bit(slot):
     return (TDB_HTRIE_COLL_MAX - 1 - slot) * 2;
 
+def htrie_bckt_slot_state(col_map, slot):
+    return (col_map >> htrie_bckt_slot2bit(slot)) & 3
+
 def htrie_node_type():
     return gdb.lookup_type('TdbHtrieNode').pointer()
 
+def htrie_bckt_geometry(base):
+    # Get the number of bucket slots and the slot size from the db header,
+    # see tdb_htrie_bckt_slot_sz() in htrie.c.
+    hdr = gdb.Value(base).cast(gdb.lookup_type('TdbHdr').pointer())
+    rec_sz = gdb.lookup_type('TdbRec').sizeof
+    rec_len = int(hdr["rec_len"])
+    if int(hdr["flags"]) & TDB_F_INPLACE and rec_len > 8:
+        rec_sz = 8 + ((rec_len + 7) & ~7)
+    return int(hdr["bckt_slots"]), rec_sz
+
 
-def htrie_dump_bucket(bckt_addr):
+def htrie_dump_bucket(base, bckt_addr):
     bckt_t = gdb.lookup_type('TdbHtrieBucket')
     rec_t = gdb.lookup_type('TdbRec')
     bckt = gdb.Value(bckt_addr).cast(bckt_t.pointer())
+    slots, rec_sz = htrie_bckt_geometry(base)
     print('map:{:16x}|'.format(int(bckt["col_map"])), end='')
-    for i in range(TDB_HTRIE_BCKT_SLOTS_N):
-        if bckt["col_map"] & (1 << htrie_bckt_slot2bit(i)):
-            rec_addr = bckt_addr + bckt_t.sizeof + i * rec_t.sizeof
+    for i in range(slots):
+        if htrie_bckt_slot_state(int(bckt["col_map"]), i) == TDB_HTRIE_SLOT_REC:
+            rec_addr = bckt_addr + bckt_t.sizeof + i * rec_sz
             rec = gdb.Value(rec_addr).cast(rec_t.pointer())
             print('{:x},{:x};'.format(int(rec["key"]), int(rec["off"])), end='')
     print("")
@@ -78,7 +93,7 @@ def htrie_walk(lvl, base, node, bits):
             o = o ^ TDB_HTRIE_DBIT
             bckt = htrie_addr(base, o)
             print('{}({:3}){:8x} -> bckt|{:8x}|'.format(ident, i, o, bckt), end='')
-            htrie_dump_bucket(bckt)
+            htrie_dump_bucket(base, bckt)
         else:
             print('{}({:3}){:8x}'.format(ident, i, o), end='')
             if o:
@@ -0,0 +1,440 @@
+/**
+ * Corpus-driven benchmark: whole HTTP/1.1 requests are parsed end to end, so
+ * the data doesn't fit L1 and the branch predictor can't learn the input.
+ *
+ * The corpus is either loaded from a file of raw requests captures, each
+ * request is terminated by an empty line (request bodies aren't supported),
+ * or generated with Zipfian distributions of the header names, the number of
+ * headers, the URI and the header value lengths. The requests are split to
+ * lines on loading, so the parsers are called for each line of a request
+ * without copying the request data.
+ *
+ * For each parser the benchmark reports CPU cycles per byte, branch misses
+ * rate (if the performance counters are accessible) and median and 99th
+ * percentile of the CPU cycles per request.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#include "http.h"
+
+/* Number of passes over the corpus for each parser. */
+#define PASSES		10
+
+typedef struct {
+	unsigned char	*data;
+	unsigned int	len;
+	unsigned int	n_lines;
+	/* Offsets of the lines, the last one is the request end. */
+	unsigned int	*lines;
+} Request;
+
+typedef struct {
+	const char	*name;
+	int		(*req)(ngx_http_request_t *r, unsigned char *buf,
+			       int len);
+	int		(*hdr)(ngx_http_request_t *r, unsigned char *buf,
+			       int len);
+} Parser;
+
+/*
+ * The parsers without a request line parser are used with the Nginx one.
+ */
+static const Parser parsers[] = {
+	{ "ngx",	ngx_request_line,	ngx_header_line },
+	{ "ngx_big",	ngx_request_line,	ngx_big_header_line },
+	{ "hsm",	ngx_request_line,	hsm_header_line },
+	{ "hsm_gen",	ngx_request_line,	hsm_gen_header_line },
+	{ "tbl",	ngx_request_line,	tbl_header_line },
+	{ "goto",	goto_request_line,	goto_header_line },
+	{ "goto_opt",	goto_opt_request_line,	goto_opt_header_line },
+};
+
+static Request *reqs;
+static unsigned int n_reqs;
+static size_t corpus_bytes;
+
+static uint64_t rnd_state = 0x2545f4914f6cdd1dUL;
+
+static uint64_t
+rnd(void)
+{
+	/* xorshift64* */
+	rnd_state ^= rnd_state >> 12;
+	rnd_state ^= rnd_state << 25;
+	rnd_state ^= rnd_state >> 27;
+
+	return rnd_state * 0x2545f4914f6cdd1dUL;
+}
+
+/*
+ * Zipfian distribution with s = 1 over ranks [0, n), the CDF is built
+ * on the first call for each distribution.
+ */
+typedef struct {
+	unsigned int	n;
+	double		*cdf;
+} Zipf;
+
+static unsigned int
+zipf(Zipf *z)
+{
+	double u;
+	unsigned int lo = 0, hi = z->n - 1;
+
+	if (!z->cdf) {
+		double sum = 0;
+
+		if (!(z->cdf = malloc(z->n * sizeof(double)))) {
+			perror("cannot allocate Zipf CDF");
+			exit(1);
+		}
+		for (unsigned int i = 0; i < z->n; ++i)
+			z->cdf[i] = sum += 1.0 / (i + 1);
+		for (unsigned int i = 0; i < z->n; ++i)
+			z->cdf[i] /= sum;
+	}
+
+	u = (double)(rnd() >> 11) / (double)(1UL << 53);
+	while (lo < hi) {
+		unsigned int m = (lo + hi) / 2;
+
+		if (z->cdf[m] < u)
+			lo = m + 1;
+		else
+			hi = m;
+	}
+
+	return lo;
+}
+
+static void
+add_request(unsigned char *data, unsigned int len)
+{
+	Request *req;
+	unsigned int n = 0;
+
+	if (!(n_reqs & (n_reqs - 1))) {
+		reqs = realloc(reqs, (n_reqs ? n_reqs * 2 : 1) * sizeof(*reqs));
+		if (!reqs) {
+			perror("cannot allocate requests");
+			exit(1);
+		}
+	}
+	req = &reqs[n_reqs++];
+	req->data = data;
+	req->len = len;
+
+	for (unsigned int i = 0; i < len; ++i)
+		n += data[i] == '\n';
+	if (!(req->lines = malloc((n + 1) * sizeof(unsigned int)))) {
+		perror("cannot allocate request lines");
+		exit(1);
+	}
+	req->lines[0] = 0;
+	req->n_lines = 0;
+	for (unsigned int i = 0; i < len; ++i)
+		if (data[i] == '\n')
+			req->lines[++req->n_lines] = i + 1;
+	corpus_bytes += len;
+}
+
+/**
+ * Load raw requests from file @path. A request is terminated by an empty
+ * line, either "\r\n" or "\n".
+ */
+static int
+corpus_load(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	unsigned char *buf, *p, *end, *req;
+	long sz;
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	fseek(f, 0, SEEK_END);
+	sz = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (sz <= 0 || !(buf = malloc(sz))) {
+		fprintf(stderr, "cannot load %s\n", path);
+		fclose(f);
+		return -1;
+	}
+	if (fread(buf, 1, sz, f) != (size_t)sz) {
+		perror(path);
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+
+	for (p = req = buf, end = buf + sz; p < end; ) {
+		unsigned char *eol = memchr(p, '\n', end - p);
+
+		if (!eol)
+			break;
+		/* Skip empty lines between the requests. */
+		if (p == req && (eol == p || (eol == p + 1 && *p == '\r'))) {
+			p = req = eol + 1;
+			continue;
+		}
+		if (eol == p || (eol == p + 1 && *p == '\r')) {
+			add_request(req, eol + 1 - req);
+			req = eol + 1;
+		}
+		p = eol + 1;
+	}
+	if (!n_reqs) {
+		fprintf(stderr, "no requests in %s\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+static const char *hdr_names[] = {
+	"Host", "User-Agent", "Accept", "Accept-Encoding", "Accept-Language",
+	"Connection", "Cookie", "Referer", "Cache-Control",
+	"Upgrade-Insecure-Requests", "If-None-Match", "If-Modified-Since",
+	"Content-Type", "Content-Length", "Origin", "Pragma", "Authorization",
+	"X-Requested-With", "X-Forwarded-For", "Accept-Charset", "Range",
+	"Sec-Fetch-Site", "Sec-Fetch-Mode", "Sec-Fetch-Dest", "DNT", "TE",
+	"X-Real-IP", "Forwarded", "Via", "Expect", "If-Match", "Keep-Alive",
+	"Max-Forwards", "X-Csrf-Token", "X-Request-Id", "Early-Data",
+};
+
+static const char *methods[] = {
+	"GET", "POST", "HEAD", "PUT", "OPTIONS", "DELETE", "PATCH", "COPY",
+};
+
+static const char uri_chars[] =
+	"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
+	"-._~/";
+static const char val_chars[] =
+	"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
+	"-._~/;=,*+()\"' ";
+
+static unsigned char *
+gen_str(unsigned char *p, const char *set, size_t set_n, unsigned int n)
+{
+	for (unsigned int i = 0; i < n; ++i)
+		*p++ = set[rnd() % set_n];
+
+	return p;
+}
+
+/**
+ * Generate @n requests with Zipfian distributions of the methods, the header
+ * names, the headers number and the URI and header values lengths.
+ */
+static int
+corpus_gen(unsigned int n)
+{
+	/* A request is limited by 32 headers with 256 bytes values. */
+	unsigned char buf[512 + 32 * 320], *p, *req;
+	Zipf z_meth = { sizeof(methods) / sizeof(methods[0]) };
+	Zipf z_hdr = { sizeof(hdr_names) / sizeof(hdr_names[0]) };
+	Zipf z_hdr_n = { 32 }, z_uri = { 128 }, z_val = { 256 };
+
+	for (unsigned int i = 0; i < n; ++i) {
+		unsigned int hn = 1 + zipf(&z_hdr_n);
+
+		p = buf;
+		p += sprintf((char *)p, "%s /", methods[zipf(&z_meth)]);
+		p = gen_str(p, uri_chars, sizeof(uri_chars) - 1, zipf(&z_uri));
+		p += sprintf((char *)p, " HTTP/1.%d\r\n", rnd() % 8 ? 1 : 0);
+
+		for (unsigned int h = 0; h < hn; ++h) {
+			p += sprintf((char *)p, "%s: ",
+				     hdr_names[zipf(&z_hdr)]);
+			/* The value must not start or end with a space. */
+			*p++ = 'v';
+			p = gen_str(p, val_chars, sizeof(val_chars) - 1,
+				    zipf(&z_val));
+			*p++ = 'v';
+			*p++ = '\r';
+			*p++ = '\n';
+		}
+		*p++ = '\r';
+		*p++ = '\n';
+
+		if (!(req = malloc(p - buf))) {
+			perror("cannot allocate a request");
+			return -1;
+		}
+		memcpy(req, buf, p - buf);
+		add_request(req, p - buf);
+	}
+
+	return 0;
+}
+
+static int
+perf_open(uint64_t config, int group)
+{
+	struct perf_event_attr pe;
+
+	memset(&pe, 0, sizeof(pe));
+	pe.type = PERF_TYPE_HARDWARE;
+	pe.size = sizeof(pe);
+	pe.config = config;
+	pe.disabled = group < 0;
+	pe.exclude_kernel = 1;
+	pe.exclude_hv = 1;
+	pe.read_format = PERF_FORMAT_GROUP;
+
+	return syscall(SYS_perf_event_open, &pe, 0, -1, group, 0);
+}
+
+static int
+cycles_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static unsigned long
+parse_request(const Parser *ps, const Request *req)
+{
+	ngx_http_request_t r;
+	unsigned long err = 0;
+
+	memset(&r, 0, sizeof(r));
+	err += !!ps->req(&r, req->data, req->lines[1]);
+	for (unsigned int l = 1; l < req->n_lines; ++l) {
+		r.state = 0;
+		r.__state = NULL;
+		r.header_name_end = NULL;
+		err += !!ps->hdr(&r, req->data + req->lines[l],
+				 req->lines[l + 1] - req->lines[l]);
+	}
+
+	return err;
+}
+
+static void
+bench(const Parser *ps, uint64_t *cycles, int fd_br)
+{
+	unsigned long err = 0;
+	uint64_t total = 0, cnt[3] = { 0 };
+
+	/* Count the parsing errors and warm up the caches. */
+	for (unsigned int i = 0; i < n_reqs; ++i)
+		err += parse_request(ps, &reqs[i]);
+
+	if (fd_br >= 0) {
+		ioctl(fd_br, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(fd_br, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+	for (int pass = 0; pass < PASSES; ++pass)
+		for (unsigned int i = 0; i < n_reqs; ++i) {
+			uint64_t t0 = __rdtsc();
+
+			parse_request(ps, &reqs[i]);
+			cycles[pass * n_reqs + i] = __rdtsc() - t0;
+			total += cycles[pass * n_reqs + i];
+		}
+	if (fd_br >= 0) {
+		ioctl(fd_br, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+		if (read(fd_br, cnt, sizeof(cnt)) != sizeof(cnt))
+			cnt[1] = 0;
+	}
+
+	qsort(cycles, PASSES * n_reqs, sizeof(*cycles), cycles_cmp);
+	printf("\t%-10s %7.2f cycles/B", ps->name,
+	       (double)total / (corpus_bytes * PASSES));
+	if (cnt[1])
+		printf("  %5.2f%% br-miss", 100.0 * cnt[2] / cnt[1]);
+	else
+		printf("  br-miss n/a");
+	printf("  p50 %6lu  p99 %7lu cycles/req",
+	       cycles[PASSES * n_reqs / 2], cycles[PASSES * n_reqs * 99 / 100]);
+	if (err)
+		printf("  (%lu errors)", err);
+	printf("\n");
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-c <requests file> | -g <requests number>]\n"
+			"\tno options - run the micro-benchmark\n", prog);
+}
+
+int
+corpus_benchmark(int argc, char *argv[])
+{
+	uint64_t *cycles;
+	int fd_br, fd_miss = -1;
+
+	if (argc != 3 || argv[1][0] != '-' || argv[1][2]) {
+		usage(argv[0]);
+		return 1;
+	}
+	switch (argv[1][1]) {
+	case 'c':
+		if (corpus_load(argv[2]))
+			return 1;
+		break;
+	case 'g':
+		if (atoi(argv[2]) <= 0 || corpus_gen(atoi(argv[2])))
+			return 1;
+		break;
+	default:
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* Shuffle the requests to not train the branch predictor. */
+	for (unsigned int i = n_reqs - 1; i > 0; --i) {
+		unsigned int j = rnd() % (i + 1);
+		Request t = reqs[i];
+
+		reqs[i] = reqs[j];
+		reqs[j] = t;
+	}
+
+	if (!(cycles = malloc(PASSES * n_reqs * sizeof(*cycles)))) {
+		perror("cannot allocate the statistics");
+		return 1;
+	}
+	fd_br = perf_open(PERF_COUNT_HW_BRANCH_INSTRUCTIONS, -1);
+	if (fd_br >= 0) {
+		fd_miss = perf_open(PERF_COUNT_HW_BRANCH_MISSES, fd_br);
+		if (fd_miss < 0) {
+			close(fd_br);
+			fd_br = -1;
+		}
+	}
+
+	printf("Corpus: %u requests, %zu bytes, %.1f bytes/request\n",
+	       n_reqs, corpus_bytes, (double)corpus_bytes / n_reqs);
+	for (unsigned int i = 0; i < sizeof(parsers) / sizeof(parsers[0]); ++i)
+		bench(&parsers[i], cycles, fd_br);
+
+	return 0;
+}
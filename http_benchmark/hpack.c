@@ -0,0 +1,893 @@
+/**
+ * Benchmark of the HTTP/2 HPACK (RFC 7541) decoder against the HTTP/1 header
+ * parsers on the same header set.
+ *
+ * The Huffman decoder is a finite state machine with the internal nodes of
+ * the code tree as the states. The 4-bit transitions emit at most one symbol
+ * since the shortest code is 5 bits and the table takes 16KB, the byte
+ * transitions emit up to two symbols and take 256KB, but make half of the
+ * dependent loads. The tables are built at start from the canonical code, so
+ * only the symbols of each code length are listed. The dynamic table is a ring of the entries
+ * descriptors with the names and the values copied to an arena which is
+ * compacted when its tail is exhausted.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include "../bench.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "http.h"
+
+#define N		(500 * 1000)
+
+/* The default SETTINGS_HEADER_TABLE_SIZE. */
+#define HPACK_TBL_SIZE		4096
+/* The entry size overhead, RFC 7541 4.1. */
+#define HPACK_ENT_OVERHEAD	32
+#define HPACK_ENT_MAX		(HPACK_TBL_SIZE / HPACK_ENT_OVERHEAD)
+#define HPACK_ARENA		(2 * HPACK_TBL_SIZE)
+#define HPACK_STATIC_N		61
+
+#define HPACK_HDR_MAX		32
+#define HPACK_OUT_MAX		8192
+
+typedef struct {
+	const unsigned char	*name;
+	const unsigned char	*value;
+	unsigned int		nlen;
+	unsigned int		vlen;
+} HPackHdr;
+
+typedef struct {
+	unsigned int	off;
+	unsigned int	nlen;
+	unsigned int	vlen;
+} HPackEnt;
+
+/*
+ * The entries are ent[first] (the oldest one) .. ent[first + n - 1] modulo
+ * HPACK_ENT_MAX and their data lies contiguously in buf[ent[first].off, tail).
+ */
+typedef struct {
+	unsigned int	size;
+	unsigned int	max_size;
+	unsigned int	first;
+	unsigned int	n;
+	unsigned int	tail;
+	HPackEnt	ent[HPACK_ENT_MAX];
+	unsigned char	buf[HPACK_ARENA];
+} HPackTbl;
+
+/* RFC 7541 Appendix A. */
+static const HPackHdr hpack_static[HPACK_STATIC_N + 1] = {
+#define S(n, v)	{ (const unsigned char *)n, (const unsigned char *)v,	\
+		  sizeof(n) - 1, sizeof(v) - 1 }
+	{ NULL },
+	S(":authority", ""),
+	S(":method", "GET"),
+	S(":method", "POST"),
+	S(":path", "/"),
+	S(":path", "/index.html"),
+	S(":scheme", "http"),
+	S(":scheme", "https"),
+	S(":status", "200"),
+	S(":status", "204"),
+	S(":status", "206"),
+	S(":status", "304"),
+	S(":status", "400"),
+	S(":status", "404"),
+	S(":status", "500"),
+	S("accept-charset", ""),
+	S("accept-encoding", "gzip, deflate"),
+	S("accept-language", ""),
+	S("accept-ranges", ""),
+	S("accept", ""),
+	S("access-control-allow-origin", ""),
+	S("age", ""),
+	S("allow", ""),
+	S("authorization", ""),
+	S("cache-control", ""),
+	S("content-disposition", ""),
+	S("content-encoding", ""),
+	S("content-language", ""),
+	S("content-length", ""),
+	S("content-location", ""),
+	S("content-range", ""),
+	S("content-type", ""),
+	S("cookie", ""),
+	S("date", ""),
+	S("etag", ""),
+	S("expect", ""),
+	S("expires", ""),
+	S("from", ""),
+	S("host", ""),
+	S("if-match", ""),
+	S("if-modified-since", ""),
+	S("if-none-match", ""),
+	S("if-range", ""),
+	S("if-unmodified-since", ""),
+	S("last-modified", ""),
+	S("link", ""),
+	S("location", ""),
+	S("max-forwards", ""),
+	S("proxy-authenticate", ""),
+	S("proxy-authorization", ""),
+	S("range", ""),
+	S("referer", ""),
+	S("refresh", ""),
+	S("retry-after", ""),
+	S("server", ""),
+	S("set-cookie", ""),
+	S("strict-transport-security", ""),
+	S("transfer-encoding", ""),
+	S("user-agent", ""),
+	S("vary", ""),
+	S("via", ""),
+	S("www-authenticate", ""),
+#undef S
+};
+
+/*
+ * RFC 7541 Appendix B. The code is canonical: the codes of the same length
+ * are consecutive numbers assigned in the symbols order, so the code is
+ * defined by the number of codes of each length and the symbols sorted by
+ * the code lengths. Symbol 256 is EOS.
+ */
+#define HUFF_LEN_MAX	30
+#define HUFF_EOS	256
+
+static const unsigned char huff_cnt[HUFF_LEN_MAX + 1] = {
+	[5] = 10, [6] = 26, [7] = 32, [8] = 6, [10] = 5, [11] = 3, [12] = 2,
+	[13] = 6, [14] = 2, [15] = 3, [19] = 3, [20] = 8, [21] = 13, [22] = 26,
+	[23] = 29, [24] = 12, [25] = 4, [26] = 15, [27] = 19, [28] = 29,
+	[30] = 4
+};
+
+static const unsigned short huff_syms[HUFF_EOS + 1] = {
+	/* 5 bits */
+	'0', '1', '2', 'a', 'c', 'e', 'i', 'o', 's', 't',
+	/* 6 bits */
+	' ', '%', '-', '.', '/', '3', '4', '5', '6', '7', '8', '9', '=', 'A',
+	'_', 'b', 'd', 'f', 'g', 'h', 'l', 'm', 'n', 'p', 'r', 'u',
+	/* 7 bits */
+	':', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N',
+	'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'Y', 'j', 'k', 'q', 'v',
+	'w', 'x', 'y', 'z',
+	/* 8 bits */
+	'&', '*', ',', ';', 'X', 'Z',
+	/* 10 - 15 bits */
+	'!', '"', '(', ')', '?',
+	'\'', '+', '|',
+	'#', '>',
+	0, '$', '@', '[', ']', '~',
+	'^', '}',
+	'<', '`', '{',
+	/* 19 - 30 bits */
+	'\\', 195, 208,
+	128, 130, 131, 162, 184, 194, 224, 226,
+	153, 161, 167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230,
+	129, 132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170, 173,
+	178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232, 233,
+	1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155,
+	157, 158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231,
+	239,
+	9, 142, 144, 145, 148, 159, 171, 206, 215, 225, 236, 237,
+	199, 207, 234, 235,
+	192, 193, 200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243,
+	255,
+	203, 204, 211, 212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248,
+	250, 251, 252, 253, 254,
+	2, 3, 4, 5, 6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20, 21, 23, 24,
+	25, 26, 27, 28, 29, 30, 31, 127, 220, 249,
+	10, 13, 22, HUFF_EOS
+};
+
+/* The codes by the symbols for the encoder. */
+static unsigned int huff_code[HUFF_EOS + 1];
+static unsigned char huff_len[HUFF_EOS + 1];
+
+/*
+ * The transition emits @sym, the state after the transition is a valid end
+ * of the string (the bits after the last symbol are at most 7 ones - a prefix
+ * of EOS), or the transition decodes EOS which is an error.
+ */
+#define HUFF_SYM	0x01
+#define HUFF_ACCEPT	0x02
+#define HUFF_FAIL	0x04
+/* The number of the symbols emitted by a byte transition. */
+#define HUFF_NSYM_SHIFT	3
+
+typedef struct {
+	unsigned char	state;
+	unsigned char	flags;
+	unsigned char	sym;
+	/* 4 bytes for the index scaling. */
+	unsigned char	pad;
+} HuffTrans4;
+
+typedef struct {
+	unsigned char	state;
+	unsigned char	flags;
+	unsigned char	sym[2];
+} HuffTrans8;
+
+/* 257 leaves of the full binary tree give 256 internal nodes. */
+static HuffTrans4 huff_fsm4[256][16];
+static HuffTrans8 huff_fsm8[256][256];
+
+static void
+huff_init(void)
+{
+	/* The children: an internal node or 256 + symbol for a leaf. */
+	static unsigned short tree[256][2];
+	static unsigned char accept[256];
+	unsigned int code = 0, nodes = 1, s = 0;
+
+	for (unsigned int l = 1; l <= HUFF_LEN_MAX; ++l) {
+		code <<= 1;
+		for (unsigned int i = 0; i < huff_cnt[l]; ++i, ++code, ++s) {
+			unsigned int sym = huff_syms[s], node = 0;
+
+			huff_code[sym] = code;
+			huff_len[sym] = l;
+			for (int b = l - 1; b > 0; --b) {
+				unsigned int bit = (code >> b) & 1;
+
+				if (!tree[node][bit]) {
+					assert(nodes < 256);
+					tree[node][bit] = nodes++;
+				}
+				node = tree[node][bit];
+			}
+			tree[node][code & 1] = 256 + sym;
+		}
+	}
+	assert(s == HUFF_EOS + 1 && nodes == 256);
+
+	/* Up to 7 bits of EOS prefix are the padding. */
+	accept[0] = 1;
+	for (unsigned int i = 0, node = 0; i < 7; ++i) {
+		node = tree[node][1];
+		accept[node] = 1;
+	}
+
+	for (unsigned int st = 0; st < 256; ++st)
+		for (unsigned int x = 0; x < 16; ++x) {
+			HuffTrans4 *t = &huff_fsm4[st][x];
+			unsigned int node = st;
+
+			for (int b = 3; b >= 0; --b) {
+				node = tree[node][(x >> b) & 1];
+				if (node < 256)
+					continue;
+				if (node - 256 == HUFF_EOS) {
+					t->flags |= HUFF_FAIL;
+				} else {
+					t->flags |= HUFF_SYM;
+					t->sym = node - 256;
+				}
+				node = 0;
+			}
+			t->state = node;
+			if (accept[node])
+				t->flags |= HUFF_ACCEPT;
+		}
+
+	/* A byte transition is two 4-bit transitions. */
+	for (unsigned int st = 0; st < 256; ++st)
+		for (unsigned int x = 0; x < 256; ++x) {
+			const HuffTrans4 *a = &huff_fsm4[st][x >> 4];
+			const HuffTrans4 *b = &huff_fsm4[a->state][x & 0xf];
+			HuffTrans8 *t = &huff_fsm8[st][x];
+			unsigned int n = 0;
+
+			if (a->flags & HUFF_SYM)
+				t->sym[n++] = a->sym;
+			if (b->flags & HUFF_SYM)
+				t->sym[n++] = b->sym;
+			t->state = b->state;
+			t->flags = (n << HUFF_NSYM_SHIFT)
+				   | ((a->flags | b->flags) & HUFF_FAIL)
+				   | (b->flags & HUFF_ACCEPT);
+		}
+}
+
+/**
+ * Decode Huffman string @s of @n bytes to @dst which must have room for
+ * n * 8 / 5 + 1 bytes. Returns the decoded length or -1 on a bad string.
+ */
+static long
+huff_decode4(const unsigned char *s, size_t n, unsigned char *dst)
+{
+	unsigned char *d = dst;
+	unsigned int st = 0, flags = HUFF_ACCEPT, fail = 0;
+
+	for (size_t i = 0; i < n; ++i) {
+		const HuffTrans4 *t = &huff_fsm4[st][s[i] >> 4];
+
+		/* @sym is zero if nothing is emitted, so write it always. */
+		*d = t->sym;
+		d += t->flags & HUFF_SYM;
+		fail |= t->flags;
+		t = &huff_fsm4[t->state][s[i] & 0xf];
+		*d = t->sym;
+		d += t->flags & HUFF_SYM;
+		fail |= t->flags;
+		st = t->state;
+		flags = t->flags;
+	}
+	if ((fail & HUFF_FAIL) || !(flags & HUFF_ACCEPT))
+		return -1;
+
+	return d - dst;
+}
+
+/* The same as huff_decode4() by the bytes, @dst needs one more byte. */
+static long
+huff_decode8(const unsigned char *s, size_t n, unsigned char *dst)
+{
+	unsigned char *d = dst;
+	unsigned int st = 0, flags = HUFF_ACCEPT, fail = 0;
+
+	for (size_t i = 0; i < n; ++i) {
+		const HuffTrans8 *t = &huff_fsm8[st][s[i]];
+
+		d[0] = t->sym[0];
+		d[1] = t->sym[1];
+		d += t->flags >> HUFF_NSYM_SHIFT;
+		fail |= t->flags;
+		st = t->state;
+		flags = t->flags;
+	}
+	if ((fail & HUFF_FAIL) || !(flags & HUFF_ACCEPT))
+		return -1;
+
+	return d - dst;
+}
+
+static size_t
+huff_encode(const unsigned char *s, size_t n, unsigned char *dst)
+{
+	unsigned char *d = dst;
+	uint64_t bits = 0;
+	unsigned int nb = 0;
+
+	for (size_t i = 0; i < n; ++i) {
+		bits = (bits << huff_len[s[i]]) | huff_code[s[i]];
+		for (nb += huff_len[s[i]]; nb >= 8; nb -= 8)
+			*d++ = (unsigned char)(bits >> (nb - 8));
+	}
+	if (nb)
+		*d++ = (unsigned char)((bits << (8 - nb)) | (0xff >> nb));
+
+	return d - dst;
+}
+
+static void
+hpack_tbl_init(HPackTbl *t)
+{
+	memset(t, 0, sizeof(*t));
+	t->max_size = HPACK_TBL_SIZE;
+}
+
+static void
+hpack_tbl_evict(HPackTbl *t, unsigned int max_size)
+{
+	while (t->n && t->size > max_size) {
+		const HPackEnt *e = &t->ent[t->first];
+
+		t->size -= e->nlen + e->vlen + HPACK_ENT_OVERHEAD;
+		t->first = (t->first + 1) % HPACK_ENT_MAX;
+		--t->n;
+	}
+	if (!t->n)
+		t->tail = 0;
+}
+
+/*
+ * Add an entry to the dynamic table. The name and the value must not point
+ * to the table arena since the eviction and the compaction move the data.
+ */
+static void
+hpack_tbl_add(HPackTbl *t, const HPackHdr *h)
+{
+	unsigned int need = h->nlen + h->vlen + HPACK_ENT_OVERHEAD;
+	HPackEnt *e;
+
+	/* A too large entry just empties the table, RFC 7541 4.4. */
+	if (need > t->max_size) {
+		hpack_tbl_evict(t, 0);
+		return;
+	}
+	hpack_tbl_evict(t, t->max_size - need);
+
+	if (t->tail + h->nlen + h->vlen > HPACK_ARENA) {
+		unsigned int start = t->ent[t->first].off;
+
+		memmove(t->buf, t->buf + start, t->tail - start);
+		for (unsigned int i = 0; i < t->n; ++i)
+			t->ent[(t->first + i) % HPACK_ENT_MAX].off -= start;
+		t->tail -= start;
+	}
+
+	e = &t->ent[(t->first + t->n) % HPACK_ENT_MAX];
+	e->off = t->tail;
+	e->nlen = h->nlen;
+	e->vlen = h->vlen;
+	memcpy(t->buf + t->tail, h->name, h->nlen);
+	memcpy(t->buf + t->tail + h->nlen, h->value, h->vlen);
+	t->tail += h->nlen + h->vlen;
+	t->size += need;
+	++t->n;
+}
+
+static int
+hpack_int(const unsigned char **p, const unsigned char *end,
+	  unsigned int prefix, unsigned int *v)
+{
+	unsigned int m = (1U << prefix) - 1, x = *(*p)++ & m, b, shift = 0;
+
+	if (likely(x < m)) {
+		*v = x;
+		return 0;
+	}
+	do {
+		if (*p == end || shift > 21)
+			return -1;
+		b = *(*p)++;
+		x += (b & 0x7f) << shift;
+		shift += 7;
+	} while (b & 0x80);
+	*v = x;
+
+	return 0;
+}
+
+/*
+ * Decode a string literal. A raw string is referenced in the input, Huffman
+ * string is decoded to @out.
+ */
+static int
+hpack_str(const unsigned char **p, const unsigned char *end,
+	  unsigned char **out, const unsigned char *out_end,
+	  const unsigned char **s, unsigned int *len)
+{
+	int huff = **p & 0x80;
+	unsigned int n;
+	long r;
+
+	if (hpack_int(p, end, 7, &n) || n > end - *p)
+		return -1;
+	if (!huff) {
+		*s = *p;
+		*len = n;
+		*p += n;
+		return 0;
+	}
+	if (n * 8 / 5 + 2 > out_end - *out
+	    || (r = huff_decode8(*p, n, *out)) < 0)
+		return -1;
+	*s = *out;
+	*len = r;
+	*out += r;
+	*p += n;
+
+	return 0;
+}
+
+/*
+ * Look up the index space. The dynamic table entries are copied to @out since
+ * the insertions later in the block can move them.
+ */
+static int
+hpack_index(HPackTbl *t, unsigned int idx, int name_only, HPackHdr *h,
+	    unsigned char **out, const unsigned char *out_end)
+{
+	const HPackEnt *e;
+	const unsigned char *s;
+
+	if (idx <= HPACK_STATIC_N) {
+		if (!idx)
+			return -1;
+		*h = hpack_static[idx];
+		return 0;
+	}
+	if ((idx -= HPACK_STATIC_N) > t->n)
+		return -1;
+
+	e = &t->ent[(t->first + t->n - idx) % HPACK_ENT_MAX];
+	s = t->buf + e->off;
+	h->nlen = e->nlen;
+	h->vlen = name_only ? 0 : e->vlen;
+	if (h->nlen + h->vlen > out_end - *out)
+		return -1;
+	memcpy(*out, s, h->nlen + h->vlen);
+	h->name = *out;
+	h->value = *out + h->nlen;
+	*out += h->nlen + h->vlen;
+
+	return 0;
+}
+
+/**
+ * Decode header block @p of @len bytes to @hdrs, the decoded strings are
+ * stored in @out. Returns the number of the headers or -1 on an error.
+ */
+static int
+hpack_decode(HPackTbl *t, const unsigned char *p, size_t len, HPackHdr *hdrs,
+	     unsigned int max_hdrs, unsigned char *out, size_t out_len)
+{
+	const unsigned char *end = p + len, *out_end = out + out_len;
+	unsigned int n = 0, idx;
+
+	while (p < end) {
+		HPackHdr *h = &hdrs[n];
+		unsigned char c = *p;
+		int incr = 0;
+
+		if (c & 0x80) {
+			/* Indexed header field. */
+			if (n == max_hdrs || hpack_int(&p, end, 7, &idx)
+			    || hpack_index(t, idx, 0, h, &out, out_end))
+				return -1;
+			++n;
+			continue;
+		}
+		if ((c & 0xe0) == 0x20) {
+			/* Dynamic table size update. */
+			if (hpack_int(&p, end, 5, &idx) || idx > HPACK_TBL_SIZE)
+				return -1;
+			t->max_size = idx;
+			hpack_tbl_evict(t, idx);
+			continue;
+		}
+
+		/* Literal header field with, without or never indexing. */
+		if (n == max_hdrs)
+			return -1;
+		incr = c & 0x40;
+		if (hpack_int(&p, end, incr ? 6 : 4, &idx))
+			return -1;
+		if (idx) {
+			if (hpack_index(t, idx, 1, h, &out, out_end))
+				return -1;
+		} else if (p == end
+			   || hpack_str(&p, end, &out, out_end, &h->name,
+					&h->nlen))
+		{
+			return -1;
+		}
+		if (p == end
+		    || hpack_str(&p, end, &out, out_end, &h->value, &h->vlen))
+			return -1;
+		if (incr)
+			hpack_tbl_add(t, h);
+		++n;
+	}
+
+	return n;
+}
+
+static unsigned char *
+hpack_enc_int(unsigned char *d, unsigned char first, unsigned int prefix,
+	      unsigned int v)
+{
+	unsigned int m = (1U << prefix) - 1;
+
+	if (v < m) {
+		*d++ = first | v;
+		return d;
+	}
+	*d++ = first | m;
+	for (v -= m; v >= 0x80; v >>= 7)
+		*d++ = (v & 0x7f) | 0x80;
+	*d++ = v;
+
+	return d;
+}
+
+static unsigned char *
+hpack_enc_str(unsigned char *d, const unsigned char *s, unsigned int n,
+	      int huff)
+{
+	unsigned char tmp[HPACK_OUT_MAX];
+
+	if (!huff) {
+		d = hpack_enc_int(d, 0, 7, n);
+		memcpy(d, s, n);
+		return d + n;
+	}
+	n = huff_encode(s, n, tmp);
+	d = hpack_enc_int(d, 0x80, 7, n);
+	memcpy(d, tmp, n);
+
+	return d + n;
+}
+
+/* The encodings of the benchmark header blocks. */
+enum {
+	ENC_INDEXED,
+	ENC_LITERAL,
+	ENC_INCR,
+};
+
+/*
+ * Encode a literal with the static table name index if the name is there,
+ * or an indexed field with @idx for ENC_INDEXED.
+ */
+static unsigned char *
+hpack_enc_hdr(unsigned char *d, const HPackHdr *h, int enc, int huff,
+	      unsigned int idx)
+{
+	unsigned int name_idx = 0;
+
+	if (enc == ENC_INDEXED)
+		return hpack_enc_int(d, 0x80, 7, idx);
+
+	for (unsigned int i = 1; i <= HPACK_STATIC_N; ++i)
+		if (hpack_static[i].nlen == h->nlen
+		    && !memcmp(hpack_static[i].name, h->name, h->nlen))
+		{
+			name_idx = i;
+			break;
+		}
+	d = enc == ENC_INCR ? hpack_enc_int(d, 0x40, 6, name_idx)
+			    : hpack_enc_int(d, 0, 4, name_idx);
+	if (!name_idx)
+		d = hpack_enc_str(d, h->name, h->nlen, huff);
+
+	return hpack_enc_str(d, h->value, h->vlen, huff);
+}
+
+/* The header set of http_benchmark.c. */
+static const char *hdr_lines[] = {
+	"Host: github.com\r\n",
+	"Connection: keep-alive\r\n",
+	"Cache-Control: max-age=0\r\n",
+	"Upgrade-Insecure-Requests: 1\n",
+	"Accept-Encoding: gzip,deflate,sdch\r\n",
+	"Accept-Language: zh-CN,zh;q=0.8,en;q=0.6\r\n",
+	"Accept-Charset: gb18030,utf-8;q=0.7,*;q=0.3\r\n",
+	"If-None-Match: 7f9c6a2baf61233cedd62ffa906b604f\r\n",
+	"User-Agent: Mozilla/5.0 (Windows NT 6.1; WOW64) AppleWebKit/535.11 (KHTML, like Gecko) Chrome/17.0.963.56 Safari/535.11\r\n",
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n",
+};
+
+#define HDR_N	(sizeof(hdr_lines) / sizeof(hdr_lines[0]))
+
+/* The lower case names of the header set, Host becomes :authority. */
+static unsigned char hdr_names[HDR_N][64];
+static size_t hdr_len[HDR_N];
+static HPackHdr hdr_set[HDR_N];
+
+static void
+hdr_set_init(void)
+{
+	for (unsigned int i = 0; i < HDR_N; ++i) {
+		const char *s = hdr_lines[i], *c = strchr(s, ':'), *v;
+		HPackHdr *h = &hdr_set[i];
+
+		if (!strncmp(s, "Host:", 5)) {
+			memcpy(hdr_names[i], ":authority", 10);
+			h->nlen = 10;
+		} else {
+			for (h->nlen = 0; s + h->nlen < c; ++h->nlen)
+				hdr_names[i][h->nlen] = tolower(s[h->nlen]);
+		}
+		h->name = hdr_names[i];
+		for (v = c + 1; *v == ' '; ++v)
+			;
+		h->value = (const unsigned char *)v;
+		h->vlen = strcspn(v, "\r\n");
+		hdr_len[i] = strlen(s);
+	}
+}
+
+static size_t
+unhex(const char *hex, unsigned char *d)
+{
+	size_t n = 0;
+
+	for ( ; *hex; hex += 2)
+		sscanf(hex, "%2hhx", &d[n++]);
+
+	return n;
+}
+
+static void
+check_hdr(const HPackHdr *h, const char *name, const char *value)
+{
+	assert(h->nlen == strlen(name) && !memcmp(h->name, name, h->nlen));
+	assert(h->vlen == strlen(value) && !memcmp(h->value, value, h->vlen));
+}
+
+/* RFC 7541 C.4: the requests with Huffman coding on one connection. */
+static void
+check_rfc(void)
+{
+	static HPackTbl t;
+	unsigned char in[256], out[HPACK_OUT_MAX];
+	HPackHdr h[HPACK_HDR_MAX];
+	size_t n;
+
+	hpack_tbl_init(&t);
+
+	n = unhex("828684418cf1e3c2e5f23a6ba0ab90f4ff", in);
+	assert(hpack_decode(&t, in, n, h, HPACK_HDR_MAX, out, sizeof(out)) == 4);
+	check_hdr(&h[0], ":method", "GET");
+	check_hdr(&h[1], ":scheme", "http");
+	check_hdr(&h[2], ":path", "/");
+	check_hdr(&h[3], ":authority", "www.example.com");
+	assert(t.n == 1 && t.size == 57);
+
+	n = unhex("828684be5886a8eb10649cbf", in);
+	assert(hpack_decode(&t, in, n, h, HPACK_HDR_MAX, out, sizeof(out)) == 5);
+	check_hdr(&h[3], ":authority", "www.example.com");
+	check_hdr(&h[4], "cache-control", "no-cache");
+	assert(t.n == 2 && t.size == 110);
+
+	n = unhex("828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf", in);
+	assert(hpack_decode(&t, in, n, h, HPACK_HDR_MAX, out, sizeof(out)) == 5);
+	check_hdr(&h[1], ":scheme", "https");
+	check_hdr(&h[2], ":path", "/index.html");
+	check_hdr(&h[3], ":authority", "www.example.com");
+	check_hdr(&h[4], "custom-key", "custom-value");
+	assert(t.n == 3 && t.size == 164);
+
+	/* The table size update evicting all but the newest entry. */
+	n = unhex("3f1bbe", in);
+	assert(hpack_decode(&t, in, n, h, HPACK_HDR_MAX, out, sizeof(out)) == 1);
+	check_hdr(&h[0], "custom-key", "custom-value");
+	assert(t.n == 1 && t.size == 54);
+	assert(hpack_decode(&t, in + 2, 1, h, HPACK_HDR_MAX, out,
+			    sizeof(out)) == 1);
+	in[2] = 0xbf;
+	assert(hpack_decode(&t, in + 2, 1, h, HPACK_HDR_MAX, out,
+			    sizeof(out)) == -1);
+}
+
+static void
+check_huff(long (*decode)(const unsigned char *, size_t, unsigned char *))
+{
+	unsigned char s[256], enc[1024], dec[2048];
+	size_t n;
+
+	/* All the symbols and the longest codes. */
+	for (unsigned int i = 0; i < 256; ++i)
+		s[i] = 255 - i;
+	n = huff_encode(s, 256, enc);
+	assert(decode(enc, n, dec) == 256 && !memcmp(s, dec, 256));
+
+	/* Zero padding, more than 7 bits of padding and EOS. */
+	assert(decode((const unsigned char *)"\x00", 1, dec) == -1);
+	assert(decode((const unsigned char *)"\x07\xff", 2, dec) == -1);
+	assert(decode((const unsigned char *)"\xff\xff\xff\xff", 4, dec) == -1);
+	assert(decode((const unsigned char *)"\x3f", 1, dec) == 1
+	       && dec[0] == 'o');
+}
+
+/* The per operation times are per header. */
+#define test(name, code)						\
+do {									\
+	volatile long res = 0;						\
+									\
+	BENCH_RUN(name, (unsigned long)N * HDR_N, {			\
+		for (int i = 0; i < N; ++i)				\
+			res += code;					\
+	});								\
+} while (0)
+
+static int
+h1_headers(int (*fn)(ngx_http_request_t *, unsigned char *, int))
+{
+	static ngx_http_request_t r;
+	int res = 0;
+
+	for (unsigned int j = 0; j < HDR_N; ++j) {
+		r.state = 0;
+		r.__state = NULL;
+		res += fn(&r, (unsigned char *)hdr_lines[j], hdr_len[j]);
+	}
+
+	return res;
+}
+
+/* The Huffman coded values of the header set. */
+static unsigned char huff_vals[HDR_N][256];
+static size_t huff_vals_len[HDR_N];
+
+static long
+huff_values(long (*decode)(const unsigned char *, size_t, unsigned char *))
+{
+	static unsigned char dec[512];
+	long res = 0;
+
+	for (unsigned int j = 0; j < HDR_N; ++j)
+		res += decode(huff_vals[j], huff_vals_len[j], dec);
+
+	return res;
+}
+
+void
+hpack_benchmark(void)
+{
+	static HPackTbl t;
+	static unsigned char out[HPACK_OUT_MAX];
+	static unsigned char blk[4][HPACK_OUT_MAX];
+	static const int blk_enc[4][2] = {
+		{ ENC_LITERAL, 0 }, { ENC_LITERAL, 1 },
+		{ ENC_INCR, 1 }, { ENC_INDEXED, 0 }
+	};
+	size_t blk_len[4];
+	HPackHdr h[HPACK_HDR_MAX];
+
+	huff_init();
+	check_huff(huff_decode4);
+	check_huff(huff_decode8);
+	check_rfc();
+
+	hdr_set_init();
+	for (int b = 0; b < 4; ++b) {
+		unsigned char *d = blk[b];
+
+		for (unsigned int i = 0; i < HDR_N; ++i)
+			d = hpack_enc_hdr(d, &hdr_set[i], blk_enc[b][0],
+					  blk_enc[b][1],
+					  HPACK_STATIC_N + HDR_N - i);
+		blk_len[b] = d - blk[b];
+	}
+	for (unsigned int i = 0; i < HDR_N; ++i)
+		huff_vals_len[i] = huff_encode(hdr_set[i].value, hdr_set[i].vlen,
+					       huff_vals[i]);
+
+	/*
+	 * The incremental indexing block puts the header set to the dynamic
+	 * table for the indexed block.
+	 */
+	hpack_tbl_init(&t);
+	for (int b = 0; b < 4; ++b) {
+		assert(hpack_decode(&t, blk[b], blk_len[b], h, HPACK_HDR_MAX, out,
+				    sizeof(out)) == HDR_N);
+		for (unsigned int i = 0; i < HDR_N; ++i)
+			assert(h[i].nlen == hdr_set[i].nlen
+			       && h[i].vlen == hdr_set[i].vlen
+			       && !memcmp(h[i].name, hdr_set[i].name, h[i].nlen)
+			       && !memcmp(h[i].value, hdr_set[i].value,
+					  h[i].vlen));
+	}
+
+	printf("\nHPACK decoder vs HTTP/1 parsers on the same headers:\n");
+	test("tbl_header_line", h1_headers(tbl_header_line));
+	test("goto_header_line", h1_headers(goto_header_line));
+	test("goto_opt_header_line", h1_headers(goto_opt_header_line));
+	test("huff_decode4 (values)", huff_values(huff_decode4));
+	test("huff_decode8 (values)", huff_values(huff_decode8));
+	printf("\tblocks: raw %zuB, huffman %zuB, indexed %zuB\n",
+	       blk_len[0], blk_len[1], blk_len[3]);
+	test("hpack_literal_raw", hpack_decode(&t, blk[0], blk_len[0], h,
+					       HPACK_HDR_MAX, out, sizeof(out)));
+	test("hpack_literal_huff", hpack_decode(&t, blk[1], blk_len[1], h,
+						HPACK_HDR_MAX, out, sizeof(out)));
+	test("hpack_indexed", hpack_decode(&t, blk[3], blk_len[3], h,
+					   HPACK_HDR_MAX, out, sizeof(out)));
+	/* The header set is re-added to the table and evicts the old one. */
+	test("hpack_incr_huff", hpack_decode(&t, blk[2], blk_len[2], h,
+					     HPACK_HDR_MAX, out, sizeof(out)));
+}
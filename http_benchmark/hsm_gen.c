@@ -0,0 +1,793 @@
+/**
+ * Generator of the HTTP Hybrid State Machine tables.
+ *
+ * The generator compiles a grammar description into the alphabet translation
+ * table and the packed XTrans transitions table (see http_hsm.h) and prints
+ * them as a C header. The grammar is a list of states, each state is followed
+ * by its transitions:
+ *
+ *	# comment
+ *	prefix	hg
+ *
+ *	state start action
+ *		h H		-> host
+ *		A-Z a-z 0-9 - _	-> name
+ *		\r		-> header_almost_done
+ *	state host action
+ *		"ost:"		-> space_before_value else name
+ *	state done final
+ *
+ * A transition is a list of characters and character ranges, the escapes
+ * \r, \n, \t, \s (space), \\, \" and \xHH are allowed. A character listed in
+ * several transitions of a state moves to the state of the first one, the
+ * characters which aren't listed lead to the error state <prefix>_BAD.
+ * A quoted string is a sequence of characters (case insensitive) which must
+ * follow the current character, the state with a sequence can't have other
+ * transitions.
+ *
+ * The first state is the start state. The final states are placed after all
+ * other states, so <PREFIX>_FINAL is the first of them and a parser can
+ * stop on st >= <PREFIX>_FINAL. A state marked by "action" has the ACTION
+ * flag, so the parser runs an action on the move to the state.
+ *
+ * The characters with the same transitions in all the states are merged into
+ * one alphabet code, code 0 is for the characters which are invalid in all
+ * the states. The codes are ordered to minimize the number of ranges in the
+ * states, so most of the states fit 16 bytes of XTrans and the whole table
+ * stays in a few cache lines. The representation is chosen per state:
+ * CTL_SEQ for a sequence, CTL_BITMAP for more than one range leading to the
+ * only state, CTL_RANGE for up to 4 ranges and SLOW_PATH with a full row in
+ * a separate table otherwise.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "http_hsm.h"
+
+#define MAX_STATES	254
+#define MAX_RULES	32
+#define NAME_LEN	64
+#define BAD		-1
+
+typedef struct {
+	unsigned char	set[256];
+	char		seq[XT_SEQ_MAX + 1];
+	char		st_name[NAME_LEN];
+	char		fail_name[NAME_LEN];
+	int		st;
+	int		fail;
+} Rule;
+
+typedef struct {
+	char		name[NAME_LEN];
+	int		action;
+	int		final;
+	int		n_rules;
+	Rule		rules[MAX_RULES];
+	/* Target state for each character or BAD. */
+	int		trans[256];
+	/* Index in the generated table. */
+	int		idx;
+	int		slow_row;
+} State;
+
+static const char *fname;
+static int line_n;
+static char prefix[NAME_LEN] = "hsm";
+static State states[MAX_STATES];
+static int n_states;
+
+/* Alphabet code of each character and the representative character. */
+static int code[256];
+static int cls_char[256];
+static int n_codes;
+/* Order of the classes, i.e. the alphabet codes of the classes. */
+static int order[256];
+
+static void
+die(const char *fmt, ...)
+{
+	va_list ap;
+
+	if (line_n)
+		fprintf(stderr, "%s:%d: ", fname, line_n);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+	exit(1);
+}
+
+static int
+find_state(const char *name)
+{
+	for (int i = 0; i < n_states; ++i)
+		if (!strcmp(states[i].name, name))
+			return i;
+	die("unknown state '%s'", name);
+	return BAD;
+}
+
+static int
+parse_char(char **s)
+{
+	char *p = *s;
+	int c;
+
+	if (*p != '\\') {
+		*s = p + 1;
+		return (unsigned char)*p;
+	}
+	switch (*++p) {
+	case 'r':
+		c = '\r';
+		break;
+	case 'n':
+		c = '\n';
+		break;
+	case 't':
+		c = '\t';
+		break;
+	case 's':
+		c = ' ';
+		break;
+	case '\\':
+	case '"':
+		c = *p;
+		break;
+	case 'x':
+		if (!isxdigit(p[1]) || !isxdigit(p[2]))
+			die("bad escape \\x%.2s", p + 1);
+		c = (int)strtol((char[]){p[1], p[2], 0}, NULL, 16);
+		p += 2;
+		break;
+	default:
+		die("bad escape \\%c", *p);
+	}
+	*s = p + 1;
+
+	return c;
+}
+
+static char *
+next_token(char **s)
+{
+	char *p = *s, *t;
+
+	while (isspace(*p))
+		++p;
+	if (!*p)
+		return NULL;
+	t = p;
+	if (*p == '"') {
+		for (++p; *p && *p != '"'; ++p)
+			if (*p == '\\' && p[1])
+				++p;
+		if (!*p)
+			die("unterminated sequence");
+		++p;
+	} else {
+		while (*p && !isspace(*p))
+			++p;
+	}
+	if (*p)
+		*p++ = 0;
+	*s = p;
+
+	return t;
+}
+
+static void
+parse_rule(State *st, char *line)
+{
+	Rule *r;
+	char *t;
+	int to = 0;
+
+	if (st->n_rules == MAX_RULES)
+		die("too many transitions");
+	r = &st->rules[st->n_rules++];
+
+	while ((t = next_token(&line))) {
+		if (to == 1) {
+			snprintf(r->st_name, NAME_LEN, "%s", t);
+			to = 2;
+		} else if (to == 2) {
+			if (strcmp(t, "else") || !(t = next_token(&line)))
+				die("'else <state>' expected");
+			snprintf(r->fail_name, NAME_LEN, "%s", t);
+			to = 3;
+		} else if (to == 3) {
+			die("unexpected '%s'", t);
+		} else if (!strcmp(t, "->")) {
+			to = 1;
+		} else if (*t == '"') {
+			int n = 0;
+
+			t[strlen(t) - 1] = 0;
+			for (++t; *t; ++n) {
+				if (n == XT_SEQ_MAX)
+					die("sequences are limited by %d"
+					    " characters", XT_SEQ_MAX);
+				r->seq[n] = (char)parse_char(&t);
+			}
+			if (!n)
+				die("empty sequence");
+		} else {
+			int c0 = parse_char(&t), c1 = c0;
+
+			if (*t == '-' && t[1]) {
+				++t;
+				c1 = parse_char(&t);
+			}
+			if (*t || c1 < c0)
+				die("bad character range");
+			for (int c = c0; c <= c1; ++c)
+				r->set[c] = 1;
+		}
+	}
+	if (to < 2)
+		die("'-> <state>' expected");
+	if (*r->seq && (to != 3 || st->n_rules > 1))
+		die("a sequence must be the only transition with 'else'");
+	if (!*r->seq && to == 3)
+		die("'else' is allowed for sequences only");
+}
+
+static void
+parse(FILE *f)
+{
+	char buf[1024];
+	State *st = NULL;
+
+	while (fgets(buf, sizeof(buf), f)) {
+		char *p = buf, *t;
+
+		++line_n;
+		while (isspace(*p))
+			++p;
+		if (!*p || *p == '#')
+			continue;
+
+		if (!strncmp(p, "prefix", 6) && isspace(p[6])) {
+			p += 6;
+			if (!(t = next_token(&p)))
+				die("prefix expected");
+			snprintf(prefix, NAME_LEN, "%s", t);
+		} else if (!strncmp(p, "state", 5) && isspace(p[5])) {
+			p += 5;
+			if (n_states == MAX_STATES)
+				die("too many states");
+			st = &states[n_states++];
+			if (!(t = next_token(&p)))
+				die("state name expected");
+			snprintf(st->name, NAME_LEN, "%s", t);
+			while ((t = next_token(&p))) {
+				if (!strcmp(t, "action"))
+					st->action = 1;
+				else if (!strcmp(t, "final"))
+					st->final = 1;
+				else
+					die("unknown state flag '%s'", t);
+			}
+		} else {
+			if (!st)
+				die("transition out of a state");
+			parse_rule(st, p);
+		}
+	}
+	line_n = 0;
+
+	if (!n_states)
+		die("no states");
+	if (states[0].final)
+		die("the start state can't be final");
+}
+
+static int
+is_seq(const State *st)
+{
+	return st->n_rules && *st->rules[0].seq;
+}
+
+static int
+seq_match(int c, char s)
+{
+	return tolower(c) == tolower((unsigned char)s);
+}
+
+/*
+ * Resolve the transitions for each character and merge the characters with
+ * the same transitions into the alphabet codes.
+ */
+static void
+build_alphabet(void)
+{
+	for (int s = 0; s < n_states; ++s) {
+		State *st = &states[s];
+
+		for (int c = 0; c < 256; ++c)
+			st->trans[c] = BAD;
+		for (int i = 0; i < st->n_rules; ++i) {
+			Rule *r = &st->rules[i];
+
+			r->st = find_state(r->st_name);
+			if (*r->seq) {
+				r->fail = find_state(r->fail_name);
+				if (r->fail == s)
+					die("state '%s' fails to itself",
+					    st->name);
+				continue;
+			}
+			for (int c = 0; c < 256; ++c)
+				if (r->set[c] && st->trans[c] == BAD)
+					st->trans[c] = r->st;
+		}
+	}
+
+	n_codes = 1;
+	for (int c = 0; c < 256; ++c) {
+		int valid = 0, k;
+
+		for (int s = 0; s < n_states && !valid; ++s) {
+			const State *st = &states[s];
+
+			if (st->trans[c] != BAD)
+				valid = 1;
+			else if (is_seq(st))
+				for (const char *q = st->rules[0].seq; *q; ++q)
+					valid |= seq_match(c, *q);
+		}
+		if (!valid) {
+			code[c] = 0;
+			continue;
+		}
+
+		for (k = 1; k < n_codes; ++k) {
+			int b = cls_char[k], same = 1;
+
+			for (int s = 0; s < n_states && same; ++s) {
+				const State *st = &states[s];
+
+				if (st->trans[c] != st->trans[b])
+					same = 0;
+				else if (is_seq(st))
+					for (const char *q = st->rules[0].seq;
+					     *q; ++q)
+						if (seq_match(c, *q)
+						    != seq_match(b, *q))
+							same = 0;
+			}
+			if (same)
+				break;
+		}
+		if (k == n_codes) {
+			if (n_codes == 256)
+				die("too many alphabet codes");
+			cls_char[n_codes++] = c;
+		}
+		code[c] = k;
+	}
+	if (n_codes == 1)
+		die("empty alphabet");
+}
+
+/* Target state of class @k in state @s. */
+static int
+cls_trans(int s, int k)
+{
+	return states[s].trans[cls_char[k]];
+}
+
+/*
+ * Number of the ranges of consecutive codes leading to the same state in
+ * state @s for the current classes order.
+ */
+static int
+state_ranges(int s)
+{
+	int n = 0, prev = BAD;
+
+	for (int i = 1; i < n_codes; ++i) {
+		int t = cls_trans(s, order[i]);
+
+		if (t != BAD && t != prev)
+			++n;
+		prev = t;
+	}
+
+	return n;
+}
+
+static int
+state_targets(int s)
+{
+	int n = 0;
+	unsigned char seen[MAX_STATES] = { 0 };
+
+	for (int i = 1; i < n_codes; ++i) {
+		int t = cls_trans(s, i);
+
+		if (t != BAD && !seen[t]) {
+			seen[t] = 1;
+			++n;
+		}
+	}
+
+	return n;
+}
+
+/*
+ * The states not fitting XTrans cost much more than the number of the
+ * ranges, which define the number of comparisons in CTL_RANGE states.
+ */
+static int
+order_cost(void)
+{
+	int cost = 0;
+
+	for (int s = 0; s < n_states; ++s) {
+		int n;
+
+		if (is_seq(&states[s]))
+			continue;
+		n = state_ranges(s);
+		cost += n;
+		if (n > 4 && (state_targets(s) > 1 || n_codes > XT_BITMAP_MAX))
+			cost += 1000;
+	}
+
+	return cost;
+}
+
+static int
+cls_cmp(const void *a, const void *b)
+{
+	int ka = *(const int *)a, kb = *(const int *)b;
+
+	for (int s = 0; s < n_states; ++s) {
+		int ta = cls_trans(s, ka), tb = cls_trans(s, kb);
+
+		if (ta != tb)
+			return ta < tb ? -1 : 1;
+	}
+
+	return ka - kb;
+}
+
+/*
+ * Sort the classes by their transitions to group the classes leading to the
+ * same states and improve the order by moving the classes while it reduces
+ * the cost.
+ */
+static void
+order_alphabet(void)
+{
+	int cost, improved = 1;
+	int remap[256];
+
+	for (int i = 0; i < n_codes; ++i)
+		order[i] = i;
+	qsort(order + 1, n_codes - 1, sizeof(order[0]), cls_cmp);
+	cost = order_cost();
+
+	while (improved) {
+		improved = 0;
+		for (int i = 1; i < n_codes; ++i)
+			for (int j = 1; j < n_codes; ++j) {
+				int k = order[i], c;
+
+				if (i == j)
+					continue;
+				/* Move class from position i to position j. */
+				if (i < j)
+					memmove(&order[i], &order[i + 1],
+						(j - i) * sizeof(int));
+				else
+					memmove(&order[j + 1], &order[j],
+						(i - j) * sizeof(int));
+				order[j] = k;
+				c = order_cost();
+				if (c < cost) {
+					cost = c;
+					improved = 1;
+					continue;
+				}
+				/* Move it back. */
+				if (i < j)
+					memmove(&order[i + 1], &order[i],
+						(j - i) * sizeof(int));
+				else
+					memmove(&order[j], &order[j + 1],
+						(i - j) * sizeof(int));
+				order[i] = k;
+			}
+	}
+
+	/* Renumber the codes and the classes in the chosen order. */
+	{
+		int chars[256];
+
+		for (int i = 0; i < n_codes; ++i) {
+			remap[order[i]] = i;
+			chars[i] = cls_char[order[i]];
+		}
+		for (int c = 0; c < 256; ++c)
+			code[c] = remap[code[c]];
+		memcpy(cls_char, chars, sizeof(chars));
+		for (int i = 0; i < n_codes; ++i)
+			order[i] = i;
+	}
+}
+
+static const char *
+st_name(int s)
+{
+	static char buf[4][NAME_LEN * 2];
+	static int n;
+	char *b = buf[n++ & 3];
+
+	if (s == BAD)
+		snprintf(b, sizeof(buf[0]), "%s_BAD", prefix);
+	else
+		snprintf(b, sizeof(buf[0]), "%s_%s", prefix, states[s].name);
+
+	return b;
+}
+
+static void
+print_char(int c)
+{
+	if (c == ' ')
+		printf("\\s");
+	else if (isgraph(c) && c != '\\')
+		putchar(c);
+	else
+		printf("\\x%02x", c);
+}
+
+static void
+print_ctl(const State *st, const char *ctl)
+{
+	printf("\t\t\t.ctl = %s%s%s,\n", ctl,
+	       st->slow_row >= 0 ? " | SLOW_PATH" : "",
+	       st->action ? " | ACTION" : "");
+}
+
+typedef struct {
+	int	cb;
+	int	sub;
+	int	st;
+} Range;
+
+static int
+rng_cmp_self;
+
+/* The self loop goes first as the most probable, then the wider ranges. */
+static int
+rng_cmp(const void *a, const void *b)
+{
+	const Range *ra = a, *rb = b;
+
+	if ((ra->st == rng_cmp_self) != (rb->st == rng_cmp_self))
+		return ra->st == rng_cmp_self ? -1 : 1;
+	if (ra->sub != rb->sub)
+		return rb->sub - ra->sub;
+
+	return ra->cb - rb->cb;
+}
+
+static void
+print_state(int s)
+{
+	State *st = &states[s];
+	Range r[256];
+	int n = 0, prev = BAD;
+
+	if (is_seq(st)) {
+		const Rule *rl = &st->rules[0];
+
+		printf("\t{ // %s: sequence \"", st->name);
+		for (const char *q = rl->seq; *q; ++q)
+			print_char((unsigned char)*q);
+		printf("\"\n");
+		printf("\t\t.s = {\n");
+		print_ctl(st, "CTL_SEQ");
+		printf("\t\t\t.len = %zu,\n", strlen(rl->seq));
+		printf("\t\t\t.st = %s,\n", st_name(rl->st));
+		printf("\t\t\t.fail = %s,\n", st_name(rl->fail));
+		printf("\t\t\t.c = {");
+		for (int i = 0; rl->seq[i]; ++i)
+			printf("%s%d", i ? ", " : "",
+			       code[(unsigned char)rl->seq[i]]);
+		printf("}\n\t\t},\n\t},\n");
+		return;
+	}
+
+	for (int k = 1; k < n_codes; ++k) {
+		int t = cls_trans(s, k);
+
+		if (t != BAD) {
+			if (t == prev) {
+				r[n - 1].sub++;
+			} else {
+				r[n].cb = k;
+				r[n].sub = 0;
+				r[n].st = t;
+				++n;
+			}
+		}
+		prev = t;
+	}
+
+	if (st->slow_row >= 0) {
+		printf("\t{ // %s: %d ranges, row %d of %s_am_slow\n",
+		       st->name, n, st->slow_row, prefix);
+		printf("\t\t.x = {\n");
+		print_ctl(st, "CTL_RANGE");
+		printf("\t\t\t.len = %d,\n", st->slow_row);
+		printf("\t\t},\n\t},\n");
+	} else if (n > 1 && state_targets(s) == 1 && n_codes <= XT_BITMAP_MAX) {
+		unsigned char bm[XT_BITMAP_MAX / 8] = { 0 };
+
+		for (int k = 1; k < n_codes; ++k)
+			if (cls_trans(s, k) != BAD)
+				bm[k / 8] |= 1 << (k % 8);
+		printf("\t{ // %s: bitmap\n", st->name);
+		printf("\t\t.b = {\n");
+		print_ctl(st, "CTL_BITMAP");
+		printf("\t\t\t.st = %s,\n", st_name(r[0].st));
+		printf("\t\t\t.bm = {");
+		for (int i = 0; i <= (n_codes - 1) / 8; ++i)
+			printf("%s0x%02x", i ? ", " : "", bm[i]);
+		printf("}\n\t\t},\n\t},\n");
+	} else {
+		rng_cmp_self = s;
+		qsort(r, n, sizeof(r[0]), rng_cmp);
+		printf("\t{ // %s: %d range%s\n", st->name, n,
+		       n == 1 ? "" : "s");
+		printf("\t\t.x = {\n");
+		print_ctl(st, "CTL_RANGE");
+		printf("\t\t\t.len = %d,\n", n);
+		if (n) {
+			printf("\t\t\t.r = {\n");
+			for (int i = 0; i < n; ++i)
+				printf("\t\t\t\t{.cb = %d, .sub = %d,"
+				       " .st = %s},\n",
+				       r[i].cb, r[i].sub, st_name(r[i].st));
+			printf("\t\t\t},\n");
+		}
+		printf("\t\t},\n\t},\n");
+	}
+}
+
+static void
+print_tables(void)
+{
+	int idx[MAX_STATES], n = 0, n_slow = 0;
+	char up[NAME_LEN];
+
+	for (int i = 0; prefix[i]; ++i)
+		up[i] = (char)toupper(prefix[i]), up[i + 1] = 0;
+
+	/* The final states go after all the other states. */
+	for (int s = 0; s < n_states; ++s)
+		if (!states[s].final)
+			idx[n++] = s;
+	for (int s = 0; s < n_states; ++s)
+		if (states[s].final)
+			idx[n++] = s;
+	for (int i = 0; i < n_states; ++i) {
+		State *st = &states[idx[i]];
+
+		st->idx = i;
+		st->slow_row = -1;
+		if (!is_seq(st) && state_ranges(idx[i]) > 4
+		    && (state_targets(idx[i]) > 1
+			|| n_codes > XT_BITMAP_MAX))
+			st->slow_row = n_slow++;
+	}
+
+	printf("/*\n * Generated by hsm_gen from %s, do not edit.\n */\n",
+	       fname);
+	printf("enum {\n");
+	for (int i = 0; i < n_states; ++i)
+		printf("\t%s,\n", st_name(idx[i]));
+	printf("\t%s\n};\n\n", st_name(BAD));
+	for (int i = 0; i < n_states; ++i)
+		if (states[idx[i]].final) {
+			printf("#define %s_FINAL\t%s\n", up, st_name(idx[i]));
+			break;
+		}
+	printf("#define %s_ALPHABET\t%d\n\n", up, n_codes);
+
+	printf("/*\n * Alphabet codes of the characters:\n");
+	for (int k = 1; k < n_codes; ++k) {
+		printf(" *\t%d:\t", k);
+		for (int c = 0, w = 0; c < 256; ++c)
+			if (code[c] == k) {
+				if (w++ == 24) {
+					printf("...");
+					break;
+				}
+				print_char(c);
+				putchar(' ');
+			}
+		printf("\n");
+	}
+	printf(" */\n");
+	printf("static const unsigned char %s_tbl[] __attribute__((aligned(64)))"
+	       " = {\n", prefix);
+	for (int c = 0; c < 256; ++c)
+		printf("%s%d%s", c % 16 ? " " : "\t", code[c],
+		       c == 255 ? "\n" : (c % 16 == 15 ? ",\n" : ","));
+	printf("};\n\n");
+
+	printf("static const XTrans %s_am_tbl[] __attribute__((aligned(64)))"
+	       " = {\n", prefix);
+	for (int i = 0; i < n_states; ++i)
+		print_state(idx[i]);
+	/* Empty bitmap, so the parser can read the state flags. */
+	printf("\t{ // BAD: no transitions\n\t\t.b = {\n");
+	printf("\t\t\t.ctl = CTL_BITMAP,\n\t\t\t.st = %s,\n", st_name(BAD));
+	printf("\t\t},\n\t},\n};\n\n");
+
+	printf("static const unsigned char %s_am_slow[][%s_ALPHABET] = {\n",
+	       prefix, up);
+	if (!n_slow)
+		printf("\t{ 0 } /* no slow states, never used */\n");
+	for (int i = 0; i < n_states; ++i) {
+		int s = idx[i];
+
+		if (states[s].slow_row < 0)
+			continue;
+		printf("\t{ // %s\n\t  ", states[s].name);
+		for (int k = 0; k < n_codes; ++k)
+			printf("%s%s", st_name(k ? cls_trans(s, k) : BAD),
+			       k == n_codes - 1 ? "\n"
+			       : (k % 4 == 3 ? ",\n\t  " : ", "));
+		printf("\t},\n");
+	}
+	printf("};\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	FILE *f;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <grammar>\n", argv[0]);
+		return 1;
+	}
+	fname = argv[1];
+	if (!(f = fopen(fname, "r"))) {
+		perror(fname);
+		return 1;
+	}
+	parse(f);
+	fclose(f);
+
+	build_alphabet();
+	order_alphabet();
+	print_tables();
+
+	return 0;
+}
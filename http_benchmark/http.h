@@ -1,16 +1,35 @@
 /*
  * Copy of Nginx code. Distributed under Nginx license.
  */
+#include <stddef.h>
+#include <sys/uio.h>
+
 #define NGX_HTTP_LC_HEADER_LEN             32
 
+/* Token positions as offsets from the message start. */
+typedef struct {
+	size_t header_name_start, header_name_end, header_start, header_end;
+	size_t request_start, request_end, uri_start, uri_end;
+	size_t schema_start, schema_end, port_end, args_start;
+	size_t host_start, host_end;
+	/* The reason phrase of a response. */
+	size_t status_start, status_end;
+} ngx_http_off_t;
+
 typedef struct {
 	int upstream, state;
 	void *__state;
+	size_t chunk_off;
+	/* Remaining bytes of the current chunk of a chunked body. */
+	size_t chunk_size;
+	ngx_http_off_t off;
 	unsigned char *header_name_start, *header_name_end, *header_start, *header_end;
 	unsigned char *request_start, *request_end, *method_end, *uri_start, *uri_end;
 	unsigned char *schema_start, *schema_end, *port_end, *args_start;
 	unsigned char *host_start, *host_end;
-	int method, http_minor, http_major;
+	int method, http_minor, http_major, status;
+	/* Well-known header id, see http_phash.txt. */
+	int header_id;
 } ngx_http_request_t;
 
 #define DECLARE_PARSE(prefix)						\
@@ -19,14 +38,51 @@ int prefix ## _header_line(ngx_http_request_t *r, unsigned char *buf, int len)
 DECLARE_PARSE(ngx);
 DECLARE_PARSE(ngx_big);
 DECLARE_PARSE(hsm);
+DECLARE_PARSE(hsm_gen);
 DECLARE_PARSE(tbl);
 DECLARE_PARSE(tbl_big);
 DECLARE_PARSE(goto);
 DECLARE_PARSE(goto_big);
+DECLARE_PARSE(goto_opt);
+DECLARE_PARSE(goto_stream);
 
 int ngx_request_line(ngx_http_request_t *r, unsigned char *buf, int len);
 int goto_request_line(ngx_http_request_t *r, unsigned char *buf, int len);
 int goto_opt_request_line(ngx_http_request_t *r, unsigned char *buf, int len);
+int goto_stream_request_line(ngx_http_request_t *r, unsigned char *buf,
+			     int len);
+int goto_status_line(ngx_http_request_t *r, unsigned char *buf, int len);
+
+/* Upper bound of the payload runs spliced from a chunk of @len bytes. */
+#define CHUNKED_IOV_MAX(len)	((len) / 4 + 1)
+
+int goto_chunked(ngx_http_request_t *r, unsigned char *buf, int len,
+		 unsigned char *out, struct iovec *iov, int *n);
+int goto_chunked_bytes(ngx_http_request_t *r, unsigned char *buf, int len,
+		       unsigned char *out, int *n);
+
+int corpus_benchmark(int argc, char *argv[]);
+void phash_benchmark(void);
+void hpack_benchmark(void);
+
+/* More data is required to finish parsing. */
+#define NGX_AGAIN                          -2
+
+/* The vector matchers from fast_str/strspn.c. */
+void tfw_init_vconstants(void);
+extern size_t (*tfw_match_uri_best)(const char *str, size_t len);
+extern size_t (*tfw_match_ctext_vchar_best)(const char *str, size_t len);
+size_t tfw_memchreol(char *s, size_t n);
+
+/* The structural index of a header block, see tfw_hdr_index(). */
+typedef struct {
+	unsigned int	colon;
+	unsigned int	eol;
+} TfwHdrIdx;
+
+size_t tfw_hdr_index(const char *s, size_t len, TfwHdrIdx *idx, size_t max);
+int goto_idx_header_line(ngx_http_request_t *r, unsigned char *buf, int len,
+			 int colon);
 
 #define NGX_HTTP_UNKNOWN                   0x0001
 #define NGX_HTTP_GET                       0x0002
@@ -16,9 +16,13 @@
  * this program; if not, write to the Free Software Foundation, Inc., 59
  * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
+#include "../bench.h"
+
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
-#include <sys/time.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "http.h"
 
@@ -59,38 +63,536 @@ requests[10] = {
 	STR("POST /api/2/thread/404435440?1340553000964 HTTP/1.1\r\n"),
 	STR("PROPFIND /foo/a/b/c/d/e/f/g/h/i/j/k/l/m/n/o/p/q HTTP/1.1\r\n"),
 	STR("GET http://pipelined-host-C.co.uk/s/o/m/e/p/a/g/e.abc/hjkhasdfdaf$#ffse4wds HTTP/1.1\n"),
-};
+},
 
-static inline unsigned long
-tv_to_ms(const struct timeval *tv)
-{
-	return ((unsigned long)tv->tv_sec * 1000000 + tv->tv_usec) / 1000;
-}
+responses[10] = {
+	STR("HTTP/1.1 200 OK\r\n"),
+	STR("HTTP/1.1 404 Not Found\r\n"),
+	STR("HTTP/1.0 304 Not Modified\r\n"),
+	STR("HTTP/1.1 301 Moved Permanently\r\n"),
+	STR("HTTP/1.1 500 Internal Server Error\r\n"),
+	STR("HTTP/1.1 204 \r\n"),
+	STR("HTTP/1.1 200\n"),
+	STR("HTTP/1.1 503 Service Temporarily Unavailable\r\n"),
+	STR("HTTP/1.1 206 Partial Content\r\n"),
+	STR("HTTP/10.1 302 Found\n"),
+},
+
+resp_headers[10] = {
+	STR("Server: nginx/1.18.0 (Ubuntu)\r\n"),
+	STR("Date: Tue, 15 Nov 1994 08:12:31 GMT\r\n"),
+	STR("Content-Type: text/html; charset=utf-8\r\n"),
+	STR("Transfer-Encoding: chunked\r\n"),
+	STR("Connection: keep-alive\r\n"),
+	STR("Cache-Control: private, max-age=0, must-revalidate\r\n"),
+	STR("ETag: W/\"5e15153d-120f\"\r\n"),
+	STR("Set-Cookie: sessionid=38afes7a8; HttpOnly; Path=/; Secure; SameSite=Lax; Expires=Wed, 21 Oct 2015 07:28:00 GMT\r\n"),
+	STR("Vary: Accept-Encoding\n"),
+	STR("Strict-Transport-Security: max-age=31536000; includeSubDomains\r\n"),
+};
 
 static ngx_http_request_t r;
 
 #define test(data, fn)							\
 do {									\
-	struct timeval tv0, tv1;					\
-									\
-	gettimeofday(&tv0, NULL);					\
+	BENCH_RUN(#fn, (unsigned long)N * (sizeof(data)/sizeof(data[0])), { \
+		for (int i = 0; i < N; ++i)				\
+			for (int j = 0; j < sizeof(data)/sizeof(data[0]); ++j) { \
+				r.state = 0;				\
+				r.__state = NULL;			\
+				fn(&r, (unsigned char *)data[j].str + OFF, \
+				   data[j].len);			\
+			}						\
+	});								\
+} while (0)
+
+/*
+ * Check that parser @fn produces the same results as the reference parser
+ * @ref, the FSM states are the labels of the different functions.
+ */
+#define check(data, fn, ref)						\
+do {									\
+	ngx_http_request_t r0, r1;					\
 									\
-	for (int i = 0; i < N; ++i)					\
-		for (int j = 0; j < sizeof(data)/sizeof(data[0]); ++j) { \
-			r.state = 0;					\
-			r.__state = NULL;				\
-			fn(&r, (unsigned char *)data[j].str + OFF,	\
+	for (int j = 0; j < sizeof(data)/sizeof(data[0]); ++j) {	\
+		int ret0, ret1;						\
+		memset(&r0, 0, sizeof(r0));				\
+		memset(&r1, 0, sizeof(r1));				\
+		ret0 = fn(&r0, (unsigned char *)data[j].str + OFF,	\
+			  data[j].len);					\
+		ret1 = ref(&r1, (unsigned char *)data[j].str + OFF,	\
 			   data[j].len);				\
+		r0.__state = r1.__state = NULL;				\
+		/* The header ids are checked by phash_benchmark(). */	\
+		r0.header_id = r1.header_id = 0;			\
+		assert(ret0 == ret1 && !memcmp(&r0, &r1, sizeof(r0)));	\
+	}								\
+} while (0)
+
+/*
+ * Token positions of reference parser @r as offsets from message @msg start.
+ */
+static void
+ptr_to_off(const ngx_http_request_t *r, const char *msg, ngx_http_off_t *off)
+{
+#define OFF_OF(f)	off->f = r->f ? (size_t)((char *)r->f - msg) : 0
+	/* The reason phrase is set by the response parsers only. */
+	memset(off, 0, sizeof(*off));
+	OFF_OF(header_name_start);
+	OFF_OF(header_name_end);
+	OFF_OF(header_start);
+	OFF_OF(header_end);
+	OFF_OF(request_start);
+	OFF_OF(request_end);
+	OFF_OF(uri_start);
+	OFF_OF(uri_end);
+	OFF_OF(schema_start);
+	OFF_OF(schema_end);
+	OFF_OF(port_end);
+	OFF_OF(args_start);
+	OFF_OF(host_start);
+	OFF_OF(host_end);
+#undef OFF_OF
+}
+
+/*
+ * Check that resumable parser @fn produces the same results for each message
+ * split into two chunks at each position as reference parser @ref for the
+ * whole message. The chunks are copied to separate buffers, so the parser
+ * can't access data of another chunk.
+ */
+#define check_stream(data, fn, ref)					\
+do {									\
+	ngx_http_request_t r0, r1;					\
+	ngx_http_off_t off;						\
+	unsigned char b0[256], b1[256];				\
+									\
+	for (int j = 0; j < sizeof(data)/sizeof(data[0]); ++j) {	\
+		const char *msg = data[j].str + OFF;			\
+		size_t len = data[j].len;				\
+		int ret;						\
+									\
+		assert(len <= sizeof(b0));				\
+		memset(&r1, 0, sizeof(r1));				\
+		ret = ref(&r1, (unsigned char *)msg, len);		\
+		ptr_to_off(&r1, msg, &off);				\
+									\
+		for (size_t k = 1; k <= len; ++k) {			\
+			memset(&r0, 0, sizeof(r0));			\
+			memcpy(b0, msg, k);				\
+			memcpy(b1, msg + k, len - k);			\
+			if (k < len)					\
+				assert(fn(&r0, b0, k) == NGX_AGAIN);	\
+			assert(fn(&r0, k < len ? b1 : b0,		\
+				  k < len ? len - k : k) == ret);	\
+			assert(!memcmp(&r0.off, &off, sizeof(off)));	\
+			assert(r0.method == r1.method			\
+			       && r0.http_major == r1.http_major	\
+			       && r0.http_minor == r1.http_minor	\
+			       && r0.state == r1.state);		\
 		}							\
+	}								\
+} while (0)
+
+/*
+ * Check that the status lines split into two chunks at each position are
+ * parsed to the same results as the whole lines.
+ */
+static void
+check_status(void)
+{
+	ngx_http_request_t r0, r1;
+	unsigned char b0[256], b1[256];
+	const char *bad[] = {
+		"HTTP/1.1 0200 OK\r\n", "HTTP/1.1 2000 OK\r\n",
+		"HTTP/1.1 20 OK\r\n", "HTTP/1.1 099 OK\r\n",
+		"HTTP/1.0 0200 OK\r\n", "HTTP/1.1 20x OK\r\n"
+	};
+
+	for (int i = 0; i < sizeof(bad)/sizeof(bad[0]); ++i) {
+		memset(&r0, 0, sizeof(r0));
+		assert(goto_status_line(&r0, (unsigned char *)bad[i],
+					strlen(bad[i])) == 1);
+	}
+
+	for (int j = 0; j < sizeof(responses)/sizeof(responses[0]); ++j) {
+		const char *msg = responses[j].str + OFF;
+		size_t len = responses[j].len;
+
+		assert(len <= sizeof(b0));
+		memset(&r1, 0, sizeof(r1));
+		assert(!goto_status_line(&r1, (unsigned char *)msg, len));
+		assert(r1.status == atoi(strchr(msg, ' ') + 1));
+		for (size_t k = 1; k < len; ++k) {
+			memset(&r0, 0, sizeof(r0));
+			memcpy(b0, msg, k);
+			memcpy(b1, msg + k, len - k);
+			assert(goto_status_line(&r0, b0, k) == NGX_AGAIN);
+			assert(!goto_status_line(&r0, b1, len - k));
+			assert(r0.status == r1.status
+			       && r0.http_major == r1.http_major
+			       && r0.http_minor == r1.http_minor
+			       && r0.off.status_start == r1.off.status_start
+			       && r0.off.status_end == r1.off.status_end);
+		}
+	}
+	memset(&r0, 0, sizeof(r0));
+	assert(!goto_status_line(&r0, (unsigned char *)responses[3].str + OFF,
+				 responses[3].len)
+	       && r0.http_major == 1 && r0.http_minor == 1 && r0.status == 301
+	       && !memcmp(responses[3].str + OFF + r0.off.status_start,
+			  "Moved Permanently",
+			  r0.off.status_end - r0.off.status_start));
+}
+
+/*
+ * Parse each message split into two chunks at each position, @N / 50
+ * iterations since there are tens of splits for each message.
+ */
+#define test_split(data, fn)						\
+do {									\
+	unsigned long splits = 0;					\
+	char name[64];							\
 									\
-	gettimeofday(&tv1, NULL);					\
+	for (int j = 0; j < sizeof(data)/sizeof(data[0]); ++j)		\
+		splits += data[j].len - 1;				\
+	snprintf(name, sizeof(name), #fn " (%lu splits)", splits);	\
 									\
-	printf("\t" #fn ":\t%lums\n", tv_to_ms(&tv1) - tv_to_ms(&tv0));	\
+	BENCH_RUN(name, N / 50 * splits, {				\
+		for (int i = 0; i < N / 50; ++i)			\
+			for (int j = 0; j < sizeof(data)/sizeof(data[0]); ++j) { \
+				unsigned char *msg = (unsigned char *)data[j].str \
+						     + OFF;		\
+				for (int k = 1; k < data[j].len; ++k) {	\
+					r.state = 0;			\
+					r.__state = NULL;		\
+					r.chunk_off = 0;		\
+					fn(&r, msg, k);			\
+					fn(&r, msg + k, data[j].len - k); \
+				}					\
+			}						\
+	});								\
 } while (0)
 
+/*
+ * ------------------------------------------------------------------------
+ *	Header blocks by the structural index
+ * ------------------------------------------------------------------------
+ */
+#define HDR_LINES	(sizeof(headers)/sizeof(headers[0]) + 1)
+
+static unsigned char hdr_blk[1024];
+static size_t hdr_blk_len;
+static TfwHdrIdx hdr_idx[HDR_LINES];
+
+/*
+ * Check that the indexed header block is parsed to the same results as
+ * each of the headers by goto_opt_header_line().
+ */
+static void
+check_idx(void)
+{
+	ngx_http_request_t r0, r1;
+	size_t off = 0;
+
+	for (int j = 0; j < sizeof(headers)/sizeof(headers[0]); ++j) {
+		memcpy(hdr_blk + hdr_blk_len, headers[j].str + OFF,
+		       headers[j].len);
+		hdr_blk_len += headers[j].len;
+	}
+	memcpy(hdr_blk + hdr_blk_len, "\r\n", 2);
+	hdr_blk_len += 2;
+
+	/* Any incomplete line is left for the next block. */
+	assert(tfw_hdr_index((char *)hdr_blk, hdr_blk_len - 1, hdr_idx,
+			     HDR_LINES) == HDR_LINES - 1);
+	assert(tfw_hdr_index((char *)hdr_blk, hdr_blk_len, hdr_idx, 3) == 3);
+	assert(tfw_hdr_index((char *)hdr_blk, hdr_blk_len, hdr_idx,
+			     HDR_LINES) == HDR_LINES);
+	for (int j = 0; j < HDR_LINES; ++j) {
+		size_t len = hdr_idx[j].eol + 1 - off;
+
+		memset(&r0, 0, sizeof(r0));
+		memset(&r1, 0, sizeof(r1));
+		assert(!goto_idx_header_line(&r0, hdr_blk + off, len,
+					     hdr_idx[j].colon - off));
+		assert(!goto_opt_header_line(&r1, hdr_blk + off, len));
+		r0.__state = r1.__state = NULL;
+		assert(!memcmp(&r0, &r1, sizeof(r0)));
+		off = hdr_idx[j].eol + 1;
+	}
+	assert(off == hdr_blk_len);
+}
+
+static void
+idx_benchmark(void)
+{
+	volatile size_t res = 0;
+
+	printf("\nHeader block line ends and structural index (per line):\n");
+	BENCH_RUN("tfw_memchreol()", (unsigned long)N * HDR_LINES, {
+		for (int i = 0; i < N; ++i) {
+			unsigned char *p = hdr_blk, *end = hdr_blk + hdr_blk_len;
+
+			while (p < end) {
+				p += tfw_memchreol((char *)p, end - p);
+				p += 1 + (*p == '\r' && p[1] == '\n');
+				++res;
+			}
+		}
+	});
+	BENCH_RUN("memchr()", (unsigned long)N * HDR_LINES, {
+		for (int i = 0; i < N; ++i) {
+			unsigned char *p = hdr_blk, *end = hdr_blk + hdr_blk_len;
+
+			while (p < end) {
+				p = (unsigned char *)memchr(p, '\n', end - p) + 1;
+				++res;
+			}
+		}
+	});
+	BENCH_RUN("tfw_hdr_index()", (unsigned long)N * HDR_LINES, {
+		for (int i = 0; i < N; ++i)
+			res += tfw_hdr_index((char *)hdr_blk, hdr_blk_len,
+					     hdr_idx, HDR_LINES);
+	});
+
+	BENCH_RUN("memchr() + goto_opt_header_line()",
+		  (unsigned long)N * HDR_LINES, {
+		for (int i = 0; i < N; ++i) {
+			unsigned char *p = hdr_blk, *end = hdr_blk + hdr_blk_len;
+
+			while (p < end) {
+				unsigned char *eol = memchr(p, '\n', end - p);
+
+				r.__state = NULL;
+				res += goto_opt_header_line(&r, p, eol + 1 - p);
+				p = eol + 1;
+			}
+		}
+	});
+	BENCH_RUN("tfw_hdr_index() + goto_idx_header_line()",
+		  (unsigned long)N * HDR_LINES, {
+		for (int i = 0; i < N; ++i) {
+			size_t n = tfw_hdr_index((char *)hdr_blk, hdr_blk_len,
+						 hdr_idx, HDR_LINES);
+			unsigned int off = 0;
+
+			for (size_t j = 0; j < n; ++j) {
+				res += goto_idx_header_line(&r, hdr_blk + off,
+							    hdr_idx[j].eol + 1
+							    - off,
+							    hdr_idx[j].colon
+							    - off);
+				off = hdr_idx[j].eol + 1;
+			}
+		}
+	});
+}
+
+/*
+ * ------------------------------------------------------------------------
+ *	Chunked transfer coding
+ * ------------------------------------------------------------------------
+ */
+#define BODY_SZ		(64 * 1024)
+/* The bodies are received by TCP segments. */
+#define SEG_SZ		1460
+#define BODIES_N	(N / 2500)
+
+enum {
+	DEC_BYTES,
+	DEC_COPY,
+	DEC_SPLICE,
+};
+
+static unsigned char body[BODY_SZ], body_out[BODY_SZ];
+static struct iovec body_iov[CHUNKED_IOV_MAX(BODY_SZ)];
+
+/*
+ * Encodes @body by chunks of @chunk bytes, with the extensions if @ext,
+ * and a trailer field.
+ */
+static size_t
+chunked_encode(unsigned char *enc, size_t chunk, int ext)
+{
+	unsigned char *p = enc;
+
+	for (size_t off = 0; off < BODY_SZ; off += chunk) {
+		size_t n = BODY_SZ - off < chunk ? BODY_SZ - off : chunk;
+
+		p += sprintf((char *)p, "%zX%s\r\n", n,
+			     ext ? ";name=\"quoted value\"; ext" : "");
+		memcpy(p, body + off, n);
+		p += n;
+		*p++ = '\r';
+		*p++ = '\n';
+	}
+	p += sprintf((char *)p, "0\r\nExpires: Wed, 21 Oct 2015 07:28:00 GMT"
+		     "\r\n\r\n");
+
+	return p - enc;
+}
+
+/*
+ * Decodes chunked body @enc of @len bytes by @seg bytes segments.
+ * @return the decoded body length.
+ */
+static size_t
+chunked_decode(int dec, unsigned char *enc, size_t len, size_t seg)
+{
+	ngx_http_request_t rc;
+	size_t out_len = 0;
+	int ret = NGX_AGAIN, n;
+
+	rc.__state = NULL;
+	rc.chunk_off = 0;
+	for (size_t off = 0; off < len && ret == NGX_AGAIN; off += seg) {
+		int sz = len - off < seg ? len - off : seg;
+
+		switch (dec) {
+		case DEC_BYTES:
+			ret = goto_chunked_bytes(&rc, enc + off, sz,
+						 body_out + out_len, &n);
+			out_len += n;
+			break;
+		case DEC_COPY:
+			ret = goto_chunked(&rc, enc + off, sz,
+					   body_out + out_len, NULL, &n);
+			out_len += n;
+			break;
+		case DEC_SPLICE:
+			ret = goto_chunked(&rc, enc + off, sz, NULL, body_iov,
+					   &n);
+			for (int i = 0; i < n; ++i)
+				out_len += body_iov[i].iov_len;
+			break;
+		}
+	}
+	assert(!ret && rc.chunk_off == len);
+
+	return out_len;
+}
+
+static void
+check_chunked(unsigned char *enc, size_t len)
+{
+	static const size_t segs[] = { 1, 2, 3, 5, 31, 33, SEG_SZ, BODY_SZ * 2 };
+
+	for (int i = 0; i < sizeof(segs)/sizeof(segs[0]); ++i) {
+		size_t seg = segs[i];
+
+		for (int dec = DEC_BYTES; dec <= DEC_COPY; ++dec) {
+			memset(body_out, 0, sizeof(body_out));
+			assert(chunked_decode(dec, enc, len, seg) == BODY_SZ);
+			assert(!memcmp(body_out, body, BODY_SZ));
+		}
+
+		/* Gather the runs of each segment to check the splicing. */
+		ngx_http_request_t rc = { 0 };
+		size_t out_len = 0;
+		int ret = NGX_AGAIN, n;
+
+		for (size_t off = 0; off < len && ret == NGX_AGAIN; off += seg) {
+			int sz = len - off < seg ? len - off : seg;
+
+			ret = goto_chunked(&rc, enc + off, sz, NULL, body_iov,
+					   &n);
+			assert(n <= CHUNKED_IOV_MAX(sz));
+			for (int k = 0; k < n; ++k) {
+				assert(out_len + body_iov[k].iov_len <= BODY_SZ
+				       && (unsigned char *)body_iov[k].iov_base
+					  >= enc + off
+				       && (unsigned char *)body_iov[k].iov_base
+					  + body_iov[k].iov_len <= enc + off + sz);
+				assert(!memcmp(body + out_len,
+					       body_iov[k].iov_base,
+					       body_iov[k].iov_len));
+				out_len += body_iov[k].iov_len;
+			}
+		}
+		assert(!ret && out_len == BODY_SZ);
+	}
+}
+
+static void
+chunked_benchmark(void)
+{
+	static const struct {
+		const char	*name;
+		size_t		chunk;
+		int		ext;
+	} encs[] = {
+		{ "256B chunks, extensions", 256, 1 },
+		{ "4KB chunks", 4096, 0 },
+		{ "16KB chunks", 16384, 0 },
+	};
+	static const char *decs[] = {
+		"goto_chunked_bytes", "goto_chunked (copy)",
+		"goto_chunked (splice)"
+	};
+	static unsigned char enc[BODY_SZ * 2];
+	uint64_t x = 0x2545f4914f6cdd1dUL;
+	const char *bad[] = {
+		"G\r\n", "10000000000000000\r\n", "1\r\nab",
+		"1\r\na\r\r", "0\r\n\r\r", "1 \r\na\r\n0\r\n\rx"
+	};
+
+	/* The payload contains the line ends and the hex digits. */
+	for (int i = 0; i < BODY_SZ; ++i) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		body[i] = "0123456789abcdef\r\n;"[x % 19];
+	}
+
+	for (int i = 0; i < sizeof(bad)/sizeof(bad[0]); ++i) {
+		ngx_http_request_t rc = { 0 };
+		int n;
+
+		assert(goto_chunked(&rc, (unsigned char *)bad[i], strlen(bad[i]),
+				    body_out, NULL, &n) == 1);
+	}
+	for (int i = 0; i < sizeof(encs)/sizeof(encs[0]); ++i)
+		check_chunked(enc, chunked_encode(enc, encs[i].chunk,
+						  encs[i].ext));
+
+	printf("\nChunked body decoding, %dKB bodies by %dB segments"
+	       " (per decoded byte):\n", BODY_SZ / 1024, SEG_SZ);
+	for (int i = 0; i < sizeof(encs)/sizeof(encs[0]); ++i) {
+		size_t len = chunked_encode(enc, encs[i].chunk, encs[i].ext);
+
+		for (int dec = DEC_BYTES; dec <= DEC_SPLICE; ++dec) {
+			char name[64];
+			volatile size_t res = 0;
+
+			snprintf(name, sizeof(name), "%s, %s", decs[dec],
+				 encs[i].name);
+			BENCH_RUN(name, (unsigned long)BODIES_N * BODY_SZ, {
+				for (int j = 0; j < BODIES_N; ++j)
+					res += chunked_decode(dec, enc, len,
+							      SEG_SZ);
+			});
+		}
+	}
+}
+
 int
-main()
+main(int argc, char *argv[])
 {
+	tfw_init_vconstants();
+	if (argc > 1)
+		return corpus_benchmark(argc, argv);
+
+	check(requests, goto_opt_request_line, goto_request_line);
+	check(headers, goto_opt_header_line, goto_header_line);
+	check(headers, hsm_gen_header_line, tbl_header_line);
+	check_stream(requests, goto_stream_request_line, goto_request_line);
+	check_stream(headers, goto_stream_header_line, goto_header_line);
+	check_stream(resp_headers, goto_stream_header_line, goto_header_line);
+	check_status();
+	check_idx();
+
 	printf("Nginx HTTP parser:\n");
 	test(requests, ngx_request_line);
 	test(headers, ngx_header_line);
@@ -105,11 +607,44 @@ main()
 	test(headers, tbl_header_line);
 	test(headers, tbl_big_header_line);
 #endif
+	printf("\nHybrid State Machine generated from the grammar:\n");
+	test(headers, tbl_header_line);
+	test(headers, hsm_header_line);
+	test(headers, hsm_gen_header_line);
+
 	printf("\nGoto-driven Automaton:\n");
 	test(requests, goto_request_line);
 	test(headers, goto_header_line);
 	test(headers, goto_big_header_line);
 
+	printf("\nGoto-driven Automaton with vector skipping:\n");
+	test(requests, goto_opt_request_line);
+	test(headers, goto_opt_header_line);
+
+	idx_benchmark();
+
+	/*
+	 * The non-resumable parsers are the baseline only: they lose the
+	 * token positions and the current character at the chunk end.
+	 */
+	printf("\nResumable goto-driven Automaton on split messages:\n");
+	test_split(requests, goto_request_line);
+	test_split(requests, goto_stream_request_line);
+	test_split(headers, goto_header_line);
+	test_split(headers, goto_stream_header_line);
+
+	printf("\nResponse status line and headers:\n");
+	test(responses, goto_status_line);
+	test(resp_headers, goto_header_line);
+	test(resp_headers, goto_opt_header_line);
+	test(resp_headers, goto_stream_header_line);
+	test_split(responses, goto_status_line);
+
+	chunked_benchmark();
+
+	phash_benchmark();
+	hpack_benchmark();
+
 	printf("\n[req: http/%d.%d: %d %p %p %p %p %p %p]\n\n",
 		r.http_major, r.http_minor,
 		r.state, r.header_name_start,
@@ -22,10 +22,13 @@
  * this program; if not, write to the Free Software Foundation, Inc., 59
  * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
+#include <immintrin.h>
 #include <stdint.h>
 #include <string.h>
 
 #include "http.h"
+#include "http_phash.h"
+#include "http_phash_tbl.h"
 
 #define FSM_START(from)							\
 do {									\
@@ -1093,3 +1096,1943 @@ done:
 	return 0;
 }
 
+/*
+ * ------------------------------------------------------------------------
+ *	Goto-driven automaton with vector skipping of long tokens
+ * ------------------------------------------------------------------------
+ */
+/*
+ * Skip @n characters, which the current state @st would loop on, at once
+ * and process the next character by the state.
+ */
+#define SKIP_n(st, n)							\
+do {									\
+	p += (n);							\
+	c = *p;								\
+	if (unlikely(p == buf + len))					\
+		EXIT(st);						\
+} while (0)
+
+/**
+ * goto_header_line() skipping header values by vector matching.
+ */
+int
+goto_opt_header_line(ngx_http_request_t *r, unsigned char *buf, int len)
+{
+	unsigned char	  c, *p = buf;
+	size_t		  n;
+
+	// init
+	c = *p;
+	FSM_START(sw_start);
+
+	/* first char */
+	STATE(sw_start) {
+		r->header_name_start = p;
+		r->header_id = HDR_RAW;
+
+		switch (c) {
+		case '\r':
+			r->header_end = p;
+			MOVE(sw_start, sw_header_almost_done);
+		case '\n':
+			r->header_end = p;
+			goto done;
+		}
+		if (c == '\0')
+			return 1;
+		MOVE(sw_start, sw_name);
+	}
+
+	/* header name */
+	STATE(sw_name) {
+		switch (c) {
+		case '_':
+			break;
+		case ':': {
+			/* The name is in L1, so the lookup is almost free. */
+			const PHashEnt *e = phash_lookup(&hdr_phash,
+						r->header_name_start,
+						p - r->header_name_start,
+						buf + len - r->header_name_start);
+			if (e)
+				r->header_id = e->id;
+			r->header_name_end = p;
+			MOVE(sw_name, sw_space_before_value);
+		}
+		case '\r':
+			r->header_name_end = p;
+			r->header_start = p;
+			r->header_end = p;
+			MOVE(sw_name, sw_almost_done);
+		case '\n':
+			r->header_name_end = p;
+			r->header_start = p;
+			r->header_end = p;
+			goto done;
+		}
+		if (c == '\0')
+			return 1;
+		MOVE(sw_name, sw_name);
+	}
+
+	/* space* before header value */
+	STATE(sw_space_before_value) {
+		switch (c) {
+		case ' ':
+			MOVE(sw_space_before_value, sw_space_before_value);
+		case '\r':
+			r->header_start = p;
+			r->header_end = p;
+			MOVE(sw_space_before_value, sw_almost_done);
+		case '\n':
+			r->header_start = p;
+			r->header_end = p;
+			goto done;
+		case '\0':
+			return 1;
+		}
+		r->header_start = p;
+		MOVE(sw_space_before_value, sw_value);
+	}
+
+	/* header value */
+	STATE(sw_value) {
+		n = tfw_match_ctext_vchar_best((const char *)p, __data_remain(p));
+		/* Leave the trailing spaces to the FSM to find the value end. */
+		while (n && p[n - 1] == ' ')
+			--n;
+		SKIP_n(sw_value, n);
+		switch (c) {
+		case ' ':
+			r->header_end = p;
+			MOVE(sw_value, sw_space_after_value);
+		case '\r':
+			r->header_end = p;
+			MOVE(sw_value, sw_almost_done);
+		case '\n':
+			r->header_end = p;
+			goto done;
+		case '\0':
+			return 1;
+		}
+		MOVE(sw_value, sw_value);
+	}
+
+	/* space* before end of header line */
+	STATE(sw_space_after_value) {
+		switch (c) {
+		case ' ':
+			MOVE(sw_space_after_value, sw_space_after_value);
+		case '\r':
+			MOVE(sw_space_after_value, sw_almost_done);
+		case '\n':
+			goto done;
+		case '\0':
+			return 1;
+		}
+		MOVE(sw_space_after_value, sw_value);
+	}
+
+	/* end of header line */
+	STATE(sw_almost_done) {
+		switch (c) {
+		case '\n':
+			goto done;
+		case '\r':
+			MOVE(sw_almost_done, sw_almost_done);
+		default:
+			return 1;
+		}
+	}
+
+	/* end of header */
+	STATE(sw_header_almost_done) {
+		if (c == '\n')
+			goto done;
+		return 1;
+	}
+
+done:
+	return 0;
+}
+
+/**
+ * goto_request_line() skipping URIs by vector matching. Only URIs after
+ * "?", "%" or "#" are skipped: the other URI states stop at each "/" and
+ * "." and the short runs between them are faster to process byte by byte.
+ */
+int
+goto_opt_request_line(ngx_http_request_t *r, unsigned char *buf, int len)
+{
+	unsigned char c, ch, *p = buf;
+	size_t n;
+
+	// init
+	c = *p;
+	FSM_START(sw_start);
+
+	STATE(sw_start) {
+		r->request_start = p;
+
+		/* OPTIMIZATION: static branch prediction */
+		if (unlikely(c == '\r' || c == '\n'))
+			MOVE(sw_start, sw_start);
+		/* OPTIMIZATION: fall through */
+	}
+
+	STATE(sw_method) {
+		/*
+		 * OPTIMIZATION: usually we have enough data for the longest
+		 * method with the following space, so find the method end
+		 * and look it up in the perfect hash table for the fast path
+		 * and fail to 1-character FSM for slow path.
+		 */
+		if (likely(__data_available(p, 10))) {
+			const PHashEnt *e;
+
+			n = phash_meth_len(p);
+			if (unlikely(!(e = phash_lookup(&meth_phash, p, n, 10))))
+				return 1;
+			r->method = e->id;
+#if UNALIGNED
+			goto done;
+#else
+			MOVE_n(sw_method, sw_spaces_before_uri, n + 1);
+#endif
+		}
+		/* Slow path: step char-by-char. */
+		barrier();
+		switch (c) {
+		case 'G':
+			MOVE(sw_method, Req_MethG);
+		case 'H':
+			MOVE(sw_method, Req_MethH);
+		case 'P':
+			MOVE(sw_method, Req_MethP);
+		case 'C':
+			MOVE(sw_method, Req_MethC);
+		case 'D':
+			MOVE(sw_method, Req_MethD);
+		case 'L':
+			MOVE(sw_method, Req_MethL);
+		case 'M':
+			MOVE(sw_method, Req_MethM);
+		case 'O':
+			MOVE(sw_method, Req_MethO);
+		case 'T':
+			MOVE(sw_method, Req_MethT);
+		case 'U':
+			MOVE(sw_method, Req_MethU);
+		}
+		return 1;
+	}
+
+	/* space* before URI */
+	STATE(sw_spaces_before_uri) {
+		if (likely(c == '/')) {
+			r->uri_start = p;
+			MOVE(sw_spaces_before_uri, sw_after_slash_in_uri);
+		}
+		if (likely(c == ' '))
+			MOVE(sw_spaces_before_uri, sw_spaces_before_uri);
+		ch = (unsigned char) (c | 0x20);
+		if (ch < 'a' || ch > 'z')
+			return 1;
+                r->schema_start = p;
+		MOVE(sw_spaces_before_uri, sw_schema);
+	}
+
+	STATE(sw_schema) {
+		ch = (unsigned char) (c | 0x20);
+		if (ch >= 'a' && ch <= 'z')
+			MOVE(sw_schema, sw_schema);
+
+		if (likely(c == ':')) {
+			r->schema_end = p;
+			MOVE(sw_schema, sw_schema_slash);
+		}
+		return 1;
+	}
+
+	STATE(sw_schema_slash) {
+		if (likely(c == '/'))
+			MOVE(sw_schema_slash, sw_schema_slash_slash);
+		return 1;
+	}
+
+	STATE(sw_schema_slash_slash) {
+		if (likely(c == '/'))
+			MOVE(sw_schema_slash_slash, sw_host_start);
+		return 1;
+	}
+
+	STATE(sw_host_start) {
+		r->host_start = p;
+		if (c == '[')
+			MOVE(sw_host_start, sw_host_ip_literal);
+	}
+
+	/* fall through */
+
+	STATE(sw_host) {
+		ch = (unsigned char) (c | 0x20);
+		if (ch >= 'a' && ch <= 'z')
+			MOVE(sw_host, sw_host);
+		if ((c >= '0' && c <= '9') || c == '.' || c == '-')
+			MOVE(sw_host, sw_host);
+	}
+
+	/* fall through */
+
+	STATE(sw_host_end) {
+		r->host_end = p;
+
+		switch (c) {
+		case ':':
+			MOVE(sw_host_end, sw_port);
+		case '/':
+			r->uri_start = p;
+			MOVE(sw_host_end, sw_after_slash_in_uri);
+		case ' ':
+			r->uri_start = r->schema_end + 1;
+			r->uri_end = r->schema_end + 2;
+			MOVE(sw_host_end, sw_host_http_09);
+		default:
+			return 1;
+		}
+	}
+
+	STATE(sw_host_ip_literal) {
+		if (c >= '0' && c <= '9')
+			MOVE(sw_host_ip_literal, sw_host_ip_literal);
+
+		ch = (unsigned char) (c | 0x20);
+		if (ch >= 'a' && ch <= 'z')
+			MOVE(sw_host_ip_literal, sw_host_ip_literal);
+
+		switch (c) {
+		case ':':
+			MOVE(sw_host_ip_literal, sw_host_ip_literal);
+		case ']':
+			MOVE(sw_host_ip_literal, sw_host_end);
+		case '-':
+		case '.':
+		case '_':
+		case '~':
+		case '!':
+		case '$':
+		case '&':
+		case '\'':
+		case '(':
+		case ')':
+		case '*':
+		case '+':
+		case ',':
+		case ';':
+		case '=':
+			MOVE(sw_host_ip_literal, sw_host_ip_literal);
+		default:
+			return 1;
+		}
+	}
+
+	STATE(sw_port) {
+		if (c >= '0' && c <= '9')
+			MOVE(sw_port, sw_port);
+
+		switch (c) {
+		case '/':
+			r->port_end = p;
+			r->uri_start = p;
+			MOVE(sw_port, sw_after_slash_in_uri);
+		case ' ':
+			r->port_end = p;
+			r->uri_start = r->schema_end + 1;
+			r->uri_end = r->schema_end + 2;
+			MOVE(sw_port, sw_host_http_09);
+		default:
+			return 1;
+		}
+	}
+
+	/* space+ after "http://host[:port] " */
+	STATE(sw_host_http_09) {
+		switch (c) {
+		case ' ':
+			MOVE(sw_host_http_09, sw_host_http_09);
+		case CR:
+			r->http_minor = 9;
+			MOVE(sw_host_http_09, sw_almost_done);
+		case LF:
+			r->http_minor = 9;
+			goto done;
+		case 'H':
+			MOVE(sw_host_http_09, sw_http_H);
+		default:
+			return 1;
+		}
+	}
+
+	/* check "/.", "//", "%", and "\" (Win32) in URI */
+	STATE(sw_after_slash_in_uri) {
+		if (usual[c >> 5] & (1 << (c & 0x1f)))
+			MOVE(sw_after_slash_in_uri, sw_check_uri);
+		switch (c) {
+		case ' ':
+			r->uri_end = p;
+			MOVE(sw_after_slash_in_uri, sw_check_uri_http_09);
+		case CR:
+			r->uri_end = p;
+			r->http_minor = 9;
+			MOVE(sw_after_slash_in_uri, sw_almost_done);
+		case LF:
+			r->uri_end = p;
+			r->http_minor = 9;
+			goto done;
+		case '?':
+			r->args_start = p + 1;
+		case '#':
+		case '.':
+		case '%':
+		case '/':
+			MOVE(sw_after_slash_in_uri, sw_uri);
+		case '+':
+			MOVE(sw_after_slash_in_uri, sw_after_slash_in_uri);
+		case '\0':
+			return 1;
+		default:
+			MOVE(sw_after_slash_in_uri, sw_check_uri);
+		}
+	}
+
+	/* check "/", "%" and "\" (Win32) in URI */
+	STATE(sw_check_uri) {
+		if (usual[c >> 5] & (1 << (c & 0x1f)))
+			MOVE(sw_check_uri, sw_check_uri);
+		switch (c) {
+		case '/':
+			MOVE(sw_check_uri, sw_after_slash_in_uri);
+		case '.':
+			MOVE(sw_check_uri, sw_check_uri);
+		case ' ':
+			r->uri_end = p;
+			MOVE(sw_check_uri, sw_check_uri_http_09);
+		case CR:
+			r->uri_end = p;
+			r->http_minor = 9;
+			MOVE(sw_check_uri, sw_almost_done);
+		case LF:
+			r->uri_end = p;
+			r->http_minor = 9;
+			goto done;
+		case '%':
+			MOVE(sw_check_uri, sw_uri);
+		case '?':
+			r->args_start = p + 1;
+		case '#':
+			MOVE(sw_check_uri, sw_uri);
+		case '+':
+			MOVE(sw_check_uri, sw_check_uri);
+		case '\0':
+			return 1;
+		}
+		MOVE(sw_check_uri, sw_check_uri);
+	}
+
+	/* space+ after URI */
+	STATE(sw_check_uri_http_09) {
+		switch (c) {
+		/* OPTIMIZATION: move the most frequent path to begin. */
+		case 'H':
+			MOVE(sw_check_uri_http_09, sw_http_H);
+		case ' ':
+			MOVE(sw_check_uri_http_09, sw_check_uri_http_09);
+		case CR:
+			r->http_minor = 9;
+			MOVE(sw_check_uri_http_09, sw_almost_done);
+		case LF:
+			r->http_minor = 9;
+			goto done;
+		default:
+			MOVE(sw_check_uri_http_09, sw_check_uri);
+		}
+	}
+
+	/* URI */
+	STATE(sw_uri) {
+		n = tfw_match_uri_best((const char *)p, __data_remain(p));
+		SKIP_n(sw_uri, n);
+		if (usual[c >> 5] & (1 << (c & 0x1f)))
+			MOVE(sw_uri, sw_uri);
+		switch (c) {
+		case ' ':
+			r->uri_end = p;
+			MOVE(sw_uri, sw_http_09);
+		case CR:
+			r->uri_end = p;
+			r->http_minor = 9;
+			MOVE(sw_uri, sw_almost_done);
+		case LF:
+			r->uri_end = p;
+			r->http_minor = 9;
+			goto done;
+		case '#':
+			MOVE(sw_uri, sw_uri);
+		case '\0':
+			return 1;
+		}
+		MOVE(sw_uri, sw_uri);
+	}
+
+	/* space+ after URI */
+	STATE(sw_http_09) {
+		switch (c) {
+		case ' ':
+			MOVE(sw_http_09, sw_http_09);
+		case CR:
+			r->http_minor = 9;
+			MOVE(sw_http_09, sw_almost_done);
+		case LF:
+			r->http_minor = 9;
+			goto done;
+		case 'H':
+			MOVE(sw_http_09, sw_http_H);
+		default:
+			MOVE(sw_http_09, sw_uri);
+		}
+	}
+
+	/* OPTIMIZATION: read "HTTP/" at once. */
+	STATE(sw_http_H) {
+		if (unlikely(!ngx_str4cmp(p, 'T', 'T', 'P', '/')))
+			return 1;
+		MOVE_n(sw_http_H, sw_first_major_digit, 4);
+	}
+
+	/* first digit of major HTTP version */
+	STATE(sw_first_major_digit) {
+		if (c < '1' || c > '9')
+			return 1;
+		r->http_major = c - '0';
+		MOVE(sw_first_major_digit, sw_major_digit);
+	}
+
+	/* major HTTP version or dot */
+	STATE(sw_major_digit) {
+		if (c == '.')
+			MOVE(sw_major_digit, sw_first_minor_digit);
+		if (c < '0' || c > '9')
+			return 1;
+		r->http_major = r->http_major * 10 + c - '0';
+		MOVE(sw_major_digit, sw_major_digit);
+	}
+
+	/* first digit of minor HTTP version */
+	STATE(sw_first_minor_digit) {
+		if (c < '0' || c > '9')
+			return 1;
+		r->http_minor = c - '0';
+		MOVE(sw_first_minor_digit, sw_minor_digit);
+	}
+
+	/* minor HTTP version or end of request line */
+	STATE(sw_minor_digit) {
+		if (c == CR)
+			MOVE(sw_minor_digit, sw_almost_done);
+		if (c == LF)
+			goto done;
+		if (c == ' ')
+			MOVE(sw_minor_digit, sw_spaces_after_digit);
+		if (c < '0' || c > '9')
+			return 1;
+		r->http_minor = r->http_minor * 10 + c - '0';
+		MOVE(sw_minor_digit, sw_minor_digit);
+	}
+
+	STATE(sw_spaces_after_digit) {
+		switch (c) {
+		case ' ':
+			MOVE(sw_spaces_after_digit, sw_spaces_after_digit);
+		case CR:
+			MOVE(sw_spaces_after_digit, sw_almost_done);
+		case LF:
+			goto done;
+		default:
+			return 1;
+		}
+	}
+
+	/* end of request line */
+	STATE(sw_almost_done) {
+		r->request_end = p - 1;
+		switch (c) {
+		case LF:
+			goto done;
+		default:
+			return 1;
+		}
+	}
+	/* ----------------    Improbable states    ---------------- */
+	/* HTTP Method processing. */
+	/* GET */
+	METH_MOVE(Req_MethG, 'E', Req_MethGe);
+	METH_MOVE_finish(Req_MethGe, 'T', NGX_HTTP_GET);
+	/* P* */
+	STATE(Req_MethP) {
+		switch (c)
+		{
+		case 'O':
+			MOVE(Req_MethP, Req_MethPo);
+		case 'A':
+			MOVE(Req_MethP, Req_MethPa);
+		case 'R':
+			MOVE(Req_MethP, Req_MethPr);
+		case 'U':
+			MOVE(Req_MethP, Req_MethPu);
+		}
+		return 1;
+	}
+	/* POST */
+	METH_MOVE(Req_MethPo, 'S', Req_MethPos);
+	METH_MOVE_finish(Req_MethPos, 'T', NGX_HTTP_POST);
+	/* PATCH */
+	METH_MOVE(Req_MethPa, 'T', Req_MethPat);
+	METH_MOVE(Req_MethPat, 'C', Req_MethPatc);
+	METH_MOVE_finish(Req_MethPatc, 'H', NGX_HTTP_PATCH);
+	/* PROP* */
+	METH_MOVE(Req_MethPr, 'O', Req_MethPro);
+	METH_MOVE(Req_MethPro, 'P', Req_MethProp);
+	STATE(Req_MethProp) {
+		switch (c)
+		{
+		case 'F':
+			MOVE(Req_MethProp, Req_MethPropf);
+		case 'P':
+			MOVE(Req_MethProp, Req_MethPropp);
+		}
+		return 1;
+	}
+	/* PROPFIND */
+	METH_MOVE(Req_MethPropf, 'I', Req_MethPropfi);
+	METH_MOVE(Req_MethPropfi, 'N', Req_MethPropfin);
+	METH_MOVE_finish(Req_MethPropfin, 'D', NGX_HTTP_PROPFIND);
+	/* PROPPATCH */
+	METH_MOVE(Req_MethPropp, 'A', Req_MethProppa);
+	METH_MOVE(Req_MethProppa, 'T', Req_MethProppat);
+	METH_MOVE(Req_MethProppat, 'C', Req_MethProppatc);
+	METH_MOVE_finish(Req_MethProppatc, 'H', NGX_HTTP_PROPPATCH);
+	/* PUT */
+	METH_MOVE_finish(Req_MethPu, 'T', NGX_HTTP_PUT);
+	/* HEAD */
+	METH_MOVE(Req_MethH, 'E', Req_MethHe);
+	METH_MOVE(Req_MethHe, 'A', Req_MethHea);
+	METH_MOVE_finish(Req_MethHea, 'D', NGX_HTTP_HEAD);
+	/* COPY */
+	METH_MOVE(Req_MethC, 'O', Req_MethCo);
+	METH_MOVE(Req_MethCo, 'P', Req_MethCop);
+	METH_MOVE_finish(Req_MethCop, 'Y', NGX_HTTP_COPY);
+	/* DELETE */
+	METH_MOVE(Req_MethD, 'E', Req_MethDe);
+	METH_MOVE(Req_MethDe, 'L', Req_MethDel);
+	METH_MOVE(Req_MethDel, 'E', Req_MethDele);
+	METH_MOVE(Req_MethDele, 'T', Req_MethDelet);
+	METH_MOVE_finish(Req_MethDelet, 'E', NGX_HTTP_DELETE);
+	/* LOCK */
+	METH_MOVE(Req_MethL, 'O', Req_MethLo);
+	METH_MOVE(Req_MethLo, 'C', Req_MethLoc);
+	METH_MOVE_finish(Req_MethLoc, 'K', NGX_HTTP_LOCK);
+	/* M* */
+	STATE(Req_MethM) {
+		switch (c) {
+		case 'K':
+			MOVE(Req_MethM, Req_MethMk);
+		case 'O':
+			MOVE(Req_MethM, Req_MethMo);
+		}
+		return 1;
+	}
+	/* MKCOL */
+	METH_MOVE(Req_MethMk, 'C', Req_MethMkc);
+	METH_MOVE(Req_MethMkc, 'O', Req_MethMkco);
+	METH_MOVE_finish(Req_MethMkco, 'L', NGX_HTTP_MKCOL);
+	/* MOVE */
+	METH_MOVE(Req_MethMo, 'V', Req_MethMov);
+	METH_MOVE_finish(Req_MethMov, 'E', NGX_HTTP_MOVE);
+	/* OPTIONS */
+	METH_MOVE(Req_MethO, 'P', Req_MethOp);
+	METH_MOVE(Req_MethOp, 'T', Req_MethOpt);
+	METH_MOVE(Req_MethOpt, 'I', Req_MethOpti);
+	METH_MOVE(Req_MethOpti, 'O', Req_MethOptio);
+	METH_MOVE(Req_MethOptio, 'N', Req_MethOption);
+	METH_MOVE_finish(Req_MethOption, 'S', NGX_HTTP_OPTIONS);
+	/* TRACE */
+	METH_MOVE(Req_MethT, 'R', Req_MethTr);
+	METH_MOVE(Req_MethTr, 'A', Req_MethTra);
+	METH_MOVE(Req_MethTra, 'C', Req_MethTrac);
+	METH_MOVE_finish(Req_MethTrac, 'E', NGX_HTTP_TRACE);
+	/* UNLOCK */
+	METH_MOVE(Req_MethU, 'N', Req_MethUn);
+	METH_MOVE(Req_MethUn, 'L', Req_MethUnl);
+	METH_MOVE(Req_MethUnl, 'O', Req_MethUnlo);
+	METH_MOVE(Req_MethUnlo, 'C', Req_MethUnloc);
+	METH_MOVE_finish(Req_MethUnloc, 'K', NGX_HTTP_UNLOCK);
+
+done:
+	return 0;
+}
+
+/*
+ * ------------------------------------------------------------------------
+ *	Resumable goto-driven automaton for messages split into chunks
+ * ------------------------------------------------------------------------
+ */
+/*
+ * The parsers below are called for each chunk of a message one by one with
+ * no copying. The FSM state is saved in r->__state at the end of a chunk and
+ * the next chunk is processed from the saved state. The token positions are
+ * saved in r->off as offsets from the message start and r->chunk_off is the
+ * offset of the current chunk. The parsers are reset by zero r->__state and
+ * r->chunk_off.
+ */
+#define POS(p)		(r->chunk_off + (size_t)((p) - buf))
+
+#undef EXIT
+#define EXIT(st)							\
+do {									\
+	r->__state = &&st;						\
+	r->chunk_off += len;						\
+	return NGX_AGAIN;						\
+} while (0)
+
+/*
+ * Save the next state instead of the current one if the chunk ends: the
+ * current character is already processed.
+ */
+#undef MOVE_n
+#define MOVE_n(from, to, n)						\
+do {									\
+	p += n;								\
+	if (unlikely(p == buf + len))					\
+		EXIT(to);						\
+	c = *p;								\
+	goto to;							\
+} while (0)
+
+/**
+ * Resumable goto_header_line().
+ */
+int
+goto_stream_header_line(ngx_http_request_t *r, unsigned char *buf, int len)
+{
+	unsigned char	  c, *p = buf;
+
+	if (unlikely(!len))
+		return NGX_AGAIN;
+	c = *p;
+	FSM_START(sw_start);
+
+	/* first char */
+	STATE(sw_start) {
+		r->off.header_name_start = POS(p);
+
+		switch (c) {
+		case '\r':
+			r->off.header_end = POS(p);
+			MOVE(sw_start, sw_header_almost_done);
+		case '\n':
+			r->off.header_end = POS(p);
+			goto done;
+		}
+		if (c == '\0')
+			return 1;
+		MOVE(sw_start, sw_name);
+	}
+
+	/* header name */
+	STATE(sw_name) {
+		switch (c) {
+		case '_':
+			break;
+		case ':':
+			r->off.header_name_end = POS(p);
+			MOVE(sw_name, sw_space_before_value);
+		case '\r':
+			r->off.header_name_end = POS(p);
+			r->off.header_start = POS(p);
+			r->off.header_end = POS(p);
+			MOVE(sw_name, sw_almost_done);
+		case '\n':
+			r->off.header_name_end = POS(p);
+			r->off.header_start = POS(p);
+			r->off.header_end = POS(p);
+			goto done;
+		}
+		if (c == '\0')
+			return 1;
+		MOVE(sw_name, sw_name);
+	}
+
+	/* space* before header value */
+	STATE(sw_space_before_value) {
+		switch (c) {
+		case ' ':
+			MOVE(sw_space_before_value, sw_space_before_value);
+		case '\r':
+			r->off.header_start = POS(p);
+			r->off.header_end = POS(p);
+			MOVE(sw_space_before_value, sw_almost_done);
+		case '\n':
+			r->off.header_start = POS(p);
+			r->off.header_end = POS(p);
+			goto done;
+		case '\0':
+			return 1;
+		}
+		r->off.header_start = POS(p);
+		MOVE(sw_space_before_value, sw_value);
+	}
+
+	/* header value */
+	STATE(sw_value) {
+		switch (c) {
+		case ' ':
+			r->off.header_end = POS(p);
+			MOVE(sw_value, sw_space_after_value);
+		case '\r':
+			r->off.header_end = POS(p);
+			MOVE(sw_value, sw_almost_done);
+		case '\n':
+			r->off.header_end = POS(p);
+			goto done;
+		case '\0':
+			return 1;
+		}
+		MOVE(sw_value, sw_value);
+	}
+
+	/* space* before end of header line */
+	STATE(sw_space_after_value) {
+		switch (c) {
+		case ' ':
+			MOVE(sw_space_after_value, sw_space_after_value);
+		case '\r':
+			MOVE(sw_space_after_value, sw_almost_done);
+		case '\n':
+			goto done;
+		case '\0':
+			return 1;
+		}
+		MOVE(sw_space_after_value, sw_value);
+	}
+
+	/* end of header line */
+	STATE(sw_almost_done) {
+		switch (c) {
+		case '\n':
+			goto done;
+		case '\r':
+			MOVE(sw_almost_done, sw_almost_done);
+		default:
+			return 1;
+		}
+	}
+
+	/* end of header */
+	STATE(sw_header_almost_done) {
+		if (c == '\n')
+			goto done;
+		return 1;
+	}
+
+done:
+	return 0;
+}
+
+/**
+ * Resumable goto_request_line().
+ */
+int
+goto_stream_request_line(ngx_http_request_t *r, unsigned char *buf, int len)
+{
+	unsigned char c, ch, *p = buf;
+
+	if (unlikely(!len))
+		return NGX_AGAIN;
+	c = *p;
+	FSM_START(sw_start);
+
+	STATE(sw_start) {
+		r->off.request_start = POS(p);
+
+		/* OPTIMIZATION: static branch prediction */
+		if (unlikely(c == '\r' || c == '\n'))
+			MOVE(sw_start, sw_start);
+		/* OPTIMIZATION: fall through */
+	}
+
+#define MATCH(num, str)							\
+{									\
+	r->method = num;						\
+	n = sizeof(str) - 1;						\
+	goto match_meth;						\
+}
+
+	/*
+	 * sw_method is never a resume point: MOVE_n() here saves the target
+	 * state, so the method FSM resumes at the Req_Meth* states.
+	 */
+	barrier();
+	{
+		/*
+		 * OPTIMIZATIONS:
+		 * 1. Move most frequent methods forward and do not use
+		 *    switch to make compiler not to merge it with the switch
+		 *    at the below;
+		 * 2. usually we have enough data (smalest HTTP/1.1 reqeust is
+		 *    "GET / HTTP/1.1\n\n"), so handle the case for fast
+		 *    path and fail to 1-character FSM for slow path.
+		 */
+		if (likely(__data_available(p, 9))) {
+			int n = 0;
+			if (likely(P(p) == TFW_CHAR4_INT('G', 'E', 'T', ' ')))
+				MATCH(NGX_HTTP_GET, "GET ");
+			if (likely(P(p) ==  TFW_CHAR4_INT('P', 'O', 'S', 'T')))
+				MATCH(NGX_HTTP_POST, "POST");
+			barrier();
+
+			/* Process less frequent methods in the large switch. */
+			switch (P(p)) {
+			/* OPTIMIZATION: observe the data only once. */
+			case TFW_CHAR4_INT('P', 'U', 'T', ' '):
+				MATCH(NGX_HTTP_PUT, "PUT ");
+			case TFW_CHAR4_INT('P', 'A', 'T', 'C'):
+				if (likely((*(p + 4) == 'H')))
+					MATCH(NGX_HTTP_PATCH, "PATCH");
+				break;
+			case TFW_CHAR4_INT('P', 'R', 'O', 'P'):
+				if (P(p + 4)
+				    == TFW_CHAR4_INT('F', 'I', 'N', 'D'))
+				{
+					MATCH(NGX_HTTP_PROPFIND, "PROPFIND");
+				}
+				if (P(p + 4)
+				    == TFW_CHAR4_INT('P', 'A', 'T', 'C')
+				    && (*(p + 8) == 'H'))
+				{
+					MATCH(NGX_HTTP_PROPPATCH, "PROPPATCH");
+				}
+				break;
+			case TFW_CHAR4_INT('C', 'O', 'P', 'Y'):
+				MATCH(NGX_HTTP_COPY, "COPY");
+			case TFW_CHAR4_INT('D', 'E', 'L', 'E'):
+				if (likely(*(p + 4) == 'T' && *(p + 5) == 'E'))
+					MATCH(NGX_HTTP_DELETE, "DELETE");
+				break;
+			case TFW_CHAR4_INT('H', 'E', 'A', 'D'):
+				MATCH(NGX_HTTP_HEAD, "HEAD");
+			case TFW_CHAR4_INT('L', 'O', 'C', 'K'):
+				MATCH(NGX_HTTP_LOCK, "LOCK");
+			case TFW_CHAR4_INT('M', 'O', 'V', 'E'):
+				MATCH(NGX_HTTP_MOVE, "MOVE");
+			case TFW_CHAR4_INT('M', 'K', 'C', 'O'):
+				if (likely(*(p + 4) == 'L'))
+					MATCH(NGX_HTTP_MKCOL, "MKCOL");
+				break;
+			case TFW_CHAR4_INT('O', 'P', 'T', 'I'):
+				if (likely(P(p + 4)
+					   == TFW_CHAR4_INT('O', 'N', 'S', ' ')))
+				{
+					MATCH(NGX_HTTP_OPTIONS, "OPTIONS");
+				}
+				break;
+			case TFW_CHAR4_INT('T', 'R', 'A', 'C'):
+				if (likely(*(p + 4) == 'E'))
+					MATCH(NGX_HTTP_TRACE, "TRACE");
+				break;
+			case TFW_CHAR4_INT('U', 'N', 'L', 'O'):
+				if (likely(*(p + 4) == 'C' && *(p + 5) == 'K'))
+					MATCH(NGX_HTTP_UNLOCK, "UNLOCK");
+				break;
+			}
+			return 1;
+match_meth:
+			MOVE_n(sw_method, sw_spaces_before_uri, n);
+		}
+		/* Slow path: step char-by-char. */
+		barrier();
+		switch (c) {
+		case 'G':
+			MOVE(sw_method, Req_MethG);
+		case 'H':
+			MOVE(sw_method, Req_MethH);
+		case 'P':
+			MOVE(sw_method, Req_MethP);
+		case 'C':
+			MOVE(sw_method, Req_MethC);
+		case 'D':
+			MOVE(sw_method, Req_MethD);
+		case 'L':
+			MOVE(sw_method, Req_MethL);
+		case 'M':
+			MOVE(sw_method, Req_MethM);
+		case 'O':
+			MOVE(sw_method, Req_MethO);
+		case 'T':
+			MOVE(sw_method, Req_MethT);
+		case 'U':
+			MOVE(sw_method, Req_MethU);
+		}
+		return 1;
+	}
+
+	/* space* before URI */
+	STATE(sw_spaces_before_uri) {
+		if (likely(c == '/')) {
+			r->off.uri_start = POS(p);
+			MOVE(sw_spaces_before_uri, sw_after_slash_in_uri);
+		}
+		if (likely(c == ' '))
+			MOVE(sw_spaces_before_uri, sw_spaces_before_uri);
+		ch = (unsigned char) (c | 0x20);
+		if (ch < 'a' || ch > 'z')
+			return 1;
+                r->off.schema_start = POS(p);
+		MOVE(sw_spaces_before_uri, sw_schema);
+	}
+
+	STATE(sw_schema) {
+		ch = (unsigned char) (c | 0x20);
+		if (ch >= 'a' && ch <= 'z')
+			MOVE(sw_schema, sw_schema);
+
+		if (likely(c == ':')) {
+			r->off.schema_end = POS(p);
+			MOVE(sw_schema, sw_schema_slash);
+		}
+		return 1;
+	}
+
+	STATE(sw_schema_slash) {
+		if (likely(c == '/'))
+			MOVE(sw_schema_slash, sw_schema_slash_slash);
+		return 1;
+	}
+
+	STATE(sw_schema_slash_slash) {
+		if (likely(c == '/'))
+			MOVE(sw_schema_slash_slash, sw_host_start);
+		return 1;
+	}
+
+	STATE(sw_host_start) {
+		r->off.host_start = POS(p);
+		if (c == '[')
+			MOVE(sw_host_start, sw_host_ip_literal);
+	}
+
+	/* fall through */
+
+	STATE(sw_host) {
+		ch = (unsigned char) (c | 0x20);
+		if (ch >= 'a' && ch <= 'z')
+			MOVE(sw_host, sw_host);
+		if ((c >= '0' && c <= '9') || c == '.' || c == '-')
+			MOVE(sw_host, sw_host);
+	}
+
+	/* fall through */
+
+	STATE(sw_host_end) {
+		r->off.host_end = POS(p);
+
+		switch (c) {
+		case ':':
+			MOVE(sw_host_end, sw_port);
+		case '/':
+			r->off.uri_start = POS(p);
+			MOVE(sw_host_end, sw_after_slash_in_uri);
+		case ' ':
+			r->off.uri_start = r->off.schema_end + 1;
+			r->off.uri_end = r->off.schema_end + 2;
+			MOVE(sw_host_end, sw_host_http_09);
+		default:
+			return 1;
+		}
+	}
+
+	STATE(sw_host_ip_literal) {
+		if (c >= '0' && c <= '9')
+			MOVE(sw_host_ip_literal, sw_host_ip_literal);
+
+		ch = (unsigned char) (c | 0x20);
+		if (ch >= 'a' && ch <= 'z')
+			MOVE(sw_host_ip_literal, sw_host_ip_literal);
+
+		switch (c) {
+		case ':':
+			MOVE(sw_host_ip_literal, sw_host_ip_literal);
+		case ']':
+			MOVE(sw_host_ip_literal, sw_host_end);
+		case '-':
+		case '.':
+		case '_':
+		case '~':
+		case '!':
+		case '$':
+		case '&':
+		case '\'':
+		case '(':
+		case ')':
+		case '*':
+		case '+':
+		case ',':
+		case ';':
+		case '=':
+			MOVE(sw_host_ip_literal, sw_host_ip_literal);
+		default:
+			return 1;
+		}
+	}
+
+	STATE(sw_port) {
+		if (c >= '0' && c <= '9')
+			MOVE(sw_port, sw_port);
+
+		switch (c) {
+		case '/':
+			r->off.port_end = POS(p);
+			r->off.uri_start = POS(p);
+			MOVE(sw_port, sw_after_slash_in_uri);
+		case ' ':
+			r->off.port_end = POS(p);
+			r->off.uri_start = r->off.schema_end + 1;
+			r->off.uri_end = r->off.schema_end + 2;
+			MOVE(sw_port, sw_host_http_09);
+		default:
+			return 1;
+		}
+	}
+
+	/* space+ after "http://host[:port] " */
+	STATE(sw_host_http_09) {
+		switch (c) {
+		case ' ':
+			MOVE(sw_host_http_09, sw_host_http_09);
+		case CR:
+			r->http_minor = 9;
+			MOVE(sw_host_http_09, sw_almost_done);
+		case LF:
+			r->http_minor = 9;
+			goto done;
+		case 'H':
+			MOVE(sw_host_http_09, sw_http_H);
+		default:
+			return 1;
+		}
+	}
+
+	/* check "/.", "//", "%", and "\" (Win32) in URI */
+	STATE(sw_after_slash_in_uri) {
+		if (usual[c >> 5] & (1 << (c & 0x1f)))
+			MOVE(sw_after_slash_in_uri, sw_check_uri);
+		switch (c) {
+		case ' ':
+			r->off.uri_end = POS(p);
+			MOVE(sw_after_slash_in_uri, sw_check_uri_http_09);
+		case CR:
+			r->off.uri_end = POS(p);
+			r->http_minor = 9;
+			MOVE(sw_after_slash_in_uri, sw_almost_done);
+		case LF:
+			r->off.uri_end = POS(p);
+			r->http_minor = 9;
+			goto done;
+		case '?':
+			r->off.args_start = POS(p) + 1;
+		case '#':
+		case '.':
+		case '%':
+		case '/':
+			MOVE(sw_after_slash_in_uri, sw_uri);
+		case '+':
+			MOVE(sw_after_slash_in_uri, sw_after_slash_in_uri);
+		case '\0':
+			return 1;
+		default:
+			MOVE(sw_after_slash_in_uri, sw_check_uri);
+		}
+	}
+
+	/* check "/", "%" and "\" (Win32) in URI */
+	STATE(sw_check_uri) {
+		if (usual[c >> 5] & (1 << (c & 0x1f)))
+			MOVE(sw_check_uri, sw_check_uri);
+		switch (c) {
+		case '/':
+			MOVE(sw_check_uri, sw_after_slash_in_uri);
+		case '.':
+			MOVE(sw_check_uri, sw_check_uri);
+		case ' ':
+			r->off.uri_end = POS(p);
+			MOVE(sw_check_uri, sw_check_uri_http_09);
+		case CR:
+			r->off.uri_end = POS(p);
+			r->http_minor = 9;
+			MOVE(sw_check_uri, sw_almost_done);
+		case LF:
+			r->off.uri_end = POS(p);
+			r->http_minor = 9;
+			goto done;
+		case '%':
+			MOVE(sw_check_uri, sw_uri);
+		case '?':
+			r->off.args_start = POS(p) + 1;
+		case '#':
+			MOVE(sw_check_uri, sw_uri);
+		case '+':
+			MOVE(sw_check_uri, sw_check_uri);
+		case '\0':
+			return 1;
+		}
+		MOVE(sw_check_uri, sw_check_uri);
+	}
+
+	/* space+ after URI */
+	STATE(sw_check_uri_http_09) {
+		switch (c) {
+		/* OPTIMIZATION: move the most frequent path to begin. */
+		case 'H':
+			MOVE(sw_check_uri_http_09, sw_http_H);
+		case ' ':
+			MOVE(sw_check_uri_http_09, sw_check_uri_http_09);
+		case CR:
+			r->http_minor = 9;
+			MOVE(sw_check_uri_http_09, sw_almost_done);
+		case LF:
+			r->http_minor = 9;
+			goto done;
+		default:
+			MOVE(sw_check_uri_http_09, sw_check_uri);
+		}
+	}
+
+	/* URI */
+	STATE(sw_uri) {
+		if (usual[c >> 5] & (1 << (c & 0x1f)))
+			MOVE(sw_uri, sw_uri);
+		switch (c) {
+		case ' ':
+			r->off.uri_end = POS(p);
+			MOVE(sw_uri, sw_http_09);
+		case CR:
+			r->off.uri_end = POS(p);
+			r->http_minor = 9;
+			MOVE(sw_uri, sw_almost_done);
+		case LF:
+			r->off.uri_end = POS(p);
+			r->http_minor = 9;
+			goto done;
+		case '#':
+			MOVE(sw_uri, sw_uri);
+		case '\0':
+			return 1;
+		}
+		MOVE(sw_uri, sw_uri);
+	}
+
+	/* space+ after URI */
+	STATE(sw_http_09) {
+		switch (c) {
+		case ' ':
+			MOVE(sw_http_09, sw_http_09);
+		case CR:
+			r->http_minor = 9;
+			MOVE(sw_http_09, sw_almost_done);
+		case LF:
+			r->http_minor = 9;
+			goto done;
+		case 'H':
+			MOVE(sw_http_09, sw_http_H);
+		default:
+			MOVE(sw_http_09, sw_uri);
+		}
+	}
+
+	/*
+	 * OPTIMIZATION: read "HTTP/" at once if the chunk contains it,
+	 * otherwise go byte by byte.
+	 */
+	STATE(sw_http_H) {
+		if (likely(__data_available(p, 4))) {
+			if (unlikely(!ngx_str4cmp(p, 'T', 'T', 'P', '/')))
+				return 1;
+			MOVE_n(sw_http_H, sw_first_major_digit, 4);
+		}
+		if (unlikely(c != 'T'))
+			return 1;
+		MOVE(sw_http_H, sw_http_HT);
+	}
+
+	/* first digit of major HTTP version */
+	STATE(sw_first_major_digit) {
+		if (c < '1' || c > '9')
+			return 1;
+		r->http_major = c - '0';
+		MOVE(sw_first_major_digit, sw_major_digit);
+	}
+
+	/* major HTTP version or dot */
+	STATE(sw_major_digit) {
+		if (c == '.')
+			MOVE(sw_major_digit, sw_first_minor_digit);
+		if (c < '0' || c > '9')
+			return 1;
+		r->http_major = r->http_major * 10 + c - '0';
+		MOVE(sw_major_digit, sw_major_digit);
+	}
+
+	/* first digit of minor HTTP version */
+	STATE(sw_first_minor_digit) {
+		if (c < '0' || c > '9')
+			return 1;
+		r->http_minor = c - '0';
+		MOVE(sw_first_minor_digit, sw_minor_digit);
+	}
+
+	/* minor HTTP version or end of request line */
+	STATE(sw_minor_digit) {
+		if (c == CR)
+			MOVE(sw_minor_digit, sw_almost_done);
+		if (c == LF)
+			goto done;
+		if (c == ' ')
+			MOVE(sw_minor_digit, sw_spaces_after_digit);
+		if (c < '0' || c > '9')
+			return 1;
+		r->http_minor = r->http_minor * 10 + c - '0';
+		MOVE(sw_minor_digit, sw_minor_digit);
+	}
+
+	STATE(sw_spaces_after_digit) {
+		switch (c) {
+		case ' ':
+			MOVE(sw_spaces_after_digit, sw_spaces_after_digit);
+		case CR:
+			MOVE(sw_spaces_after_digit, sw_almost_done);
+		case LF:
+			goto done;
+		default:
+			return 1;
+		}
+	}
+
+	/* end of request line */
+	STATE(sw_almost_done) {
+		r->off.request_end = POS(p) - 1;
+		switch (c) {
+		case LF:
+			goto done;
+		default:
+			return 1;
+		}
+	}
+	/* ----------------    Improbable states    ---------------- */
+	/* HTTP version for the split "HTTP/". */
+	METH_MOVE(sw_http_HT, 'T', sw_http_HTT);
+	METH_MOVE(sw_http_HTT, 'P', sw_http_HTTP);
+	METH_MOVE(sw_http_HTTP, '/', sw_first_major_digit);
+	/* HTTP Method processing. */
+	/* GET */
+	METH_MOVE(Req_MethG, 'E', Req_MethGe);
+	METH_MOVE_finish(Req_MethGe, 'T', NGX_HTTP_GET);
+	/* P* */
+	STATE(Req_MethP) {
+		switch (c)
+		{
+		case 'O':
+			MOVE(Req_MethP, Req_MethPo);
+		case 'A':
+			MOVE(Req_MethP, Req_MethPa);
+		case 'R':
+			MOVE(Req_MethP, Req_MethPr);
+		case 'U':
+			MOVE(Req_MethP, Req_MethPu);
+		}
+		return 1;
+	}
+	/* POST */
+	METH_MOVE(Req_MethPo, 'S', Req_MethPos);
+	METH_MOVE_finish(Req_MethPos, 'T', NGX_HTTP_POST);
+	/* PATCH */
+	METH_MOVE(Req_MethPa, 'T', Req_MethPat);
+	METH_MOVE(Req_MethPat, 'C', Req_MethPatc);
+	METH_MOVE_finish(Req_MethPatc, 'H', NGX_HTTP_PATCH);
+	/* PROP* */
+	METH_MOVE(Req_MethPr, 'O', Req_MethPro);
+	METH_MOVE(Req_MethPro, 'P', Req_MethProp);
+	STATE(Req_MethProp) {
+		switch (c)
+		{
+		case 'F':
+			MOVE(Req_MethProp, Req_MethPropf);
+		case 'P':
+			MOVE(Req_MethProp, Req_MethPropp);
+		}
+		return 1;
+	}
+	/* PROPFIND */
+	METH_MOVE(Req_MethPropf, 'I', Req_MethPropfi);
+	METH_MOVE(Req_MethPropfi, 'N', Req_MethPropfin);
+	METH_MOVE_finish(Req_MethPropfin, 'D', NGX_HTTP_PROPFIND);
+	/* PROPPATCH */
+	METH_MOVE(Req_MethPropp, 'A', Req_MethProppa);
+	METH_MOVE(Req_MethProppa, 'T', Req_MethProppat);
+	METH_MOVE(Req_MethProppat, 'C', Req_MethProppatc);
+	METH_MOVE_finish(Req_MethProppatc, 'H', NGX_HTTP_PROPPATCH);
+	/* PUT */
+	METH_MOVE_finish(Req_MethPu, 'T', NGX_HTTP_PUT);
+	/* HEAD */
+	METH_MOVE(Req_MethH, 'E', Req_MethHe);
+	METH_MOVE(Req_MethHe, 'A', Req_MethHea);
+	METH_MOVE_finish(Req_MethHea, 'D', NGX_HTTP_HEAD);
+	/* COPY */
+	METH_MOVE(Req_MethC, 'O', Req_MethCo);
+	METH_MOVE(Req_MethCo, 'P', Req_MethCop);
+	METH_MOVE_finish(Req_MethCop, 'Y', NGX_HTTP_COPY);
+	/* DELETE */
+	METH_MOVE(Req_MethD, 'E', Req_MethDe);
+	METH_MOVE(Req_MethDe, 'L', Req_MethDel);
+	METH_MOVE(Req_MethDel, 'E', Req_MethDele);
+	METH_MOVE(Req_MethDele, 'T', Req_MethDelet);
+	METH_MOVE_finish(Req_MethDelet, 'E', NGX_HTTP_DELETE);
+	/* LOCK */
+	METH_MOVE(Req_MethL, 'O', Req_MethLo);
+	METH_MOVE(Req_MethLo, 'C', Req_MethLoc);
+	METH_MOVE_finish(Req_MethLoc, 'K', NGX_HTTP_LOCK);
+	/* M* */
+	STATE(Req_MethM) {
+		switch (c) {
+		case 'K':
+			MOVE(Req_MethM, Req_MethMk);
+		case 'O':
+			MOVE(Req_MethM, Req_MethMo);
+		}
+		return 1;
+	}
+	/* MKCOL */
+	METH_MOVE(Req_MethMk, 'C', Req_MethMkc);
+	METH_MOVE(Req_MethMkc, 'O', Req_MethMkco);
+	METH_MOVE_finish(Req_MethMkco, 'L', NGX_HTTP_MKCOL);
+	/* MOVE */
+	METH_MOVE(Req_MethMo, 'V', Req_MethMov);
+	METH_MOVE_finish(Req_MethMov, 'E', NGX_HTTP_MOVE);
+	/* OPTIONS */
+	METH_MOVE(Req_MethO, 'P', Req_MethOp);
+	METH_MOVE(Req_MethOp, 'T', Req_MethOpt);
+	METH_MOVE(Req_MethOpt, 'I', Req_MethOpti);
+	METH_MOVE(Req_MethOpti, 'O', Req_MethOptio);
+	METH_MOVE(Req_MethOptio, 'N', Req_MethOption);
+	METH_MOVE_finish(Req_MethOption, 'S', NGX_HTTP_OPTIONS);
+	/* TRACE */
+	METH_MOVE(Req_MethT, 'R', Req_MethTr);
+	METH_MOVE(Req_MethTr, 'A', Req_MethTra);
+	METH_MOVE(Req_MethTra, 'C', Req_MethTrac);
+	METH_MOVE_finish(Req_MethTrac, 'E', NGX_HTTP_TRACE);
+	/* UNLOCK */
+	METH_MOVE(Req_MethU, 'N', Req_MethUn);
+	METH_MOVE(Req_MethUn, 'L', Req_MethUnl);
+	METH_MOVE(Req_MethUnl, 'O', Req_MethUnlo);
+	METH_MOVE(Req_MethUnlo, 'C', Req_MethUnloc);
+	METH_MOVE_finish(Req_MethUnloc, 'K', NGX_HTTP_UNLOCK);
+
+done:
+	return 0;
+}
+
+
+/*
+ * ------------------------------------------------------------------------
+ *	Resumable goto-driven automaton for responses
+ * ------------------------------------------------------------------------
+ */
+/**
+ * Resumable status line parser. The headers of a response have the same
+ * grammar as of a request, so they're parsed by goto_stream_header_line().
+ * The method-like states check the version characters.
+ */
+int
+goto_status_line(ngx_http_request_t *r, unsigned char *buf, int len)
+{
+	unsigned char	  c, *p = buf;
+	size_t		  n;
+
+	if (unlikely(!len))
+		return NGX_AGAIN;
+	c = *p;
+	FSM_START(sw_start);
+
+	STATE(sw_start) {
+		/* OPTIMIZATION: the only version of the most responses. */
+		if (likely(__data_available(p, 9))
+		    && *(unsigned long *)p == TFW_CHAR8_INT('H', 'T', 'T', 'P',
+							    '/', '1', '.', '1')
+		    && p[8] == ' ')
+		{
+			r->http_major = 1;
+			r->http_minor = 1;
+			r->status = 0;
+			MOVE_n(sw_start, sw_status, 9);
+		}
+		if (likely(c == 'H'))
+			MOVE(sw_start, Resp_H);
+		return 1;
+	}
+
+	METH_MOVE(Resp_H, 'T', Resp_HT);
+	METH_MOVE(Resp_HT, 'T', Resp_HTT);
+	METH_MOVE(Resp_HTT, 'P', Resp_HTTP);
+	METH_MOVE(Resp_HTTP, '/', sw_major_first);
+
+	STATE(sw_major_first) {
+		if (unlikely(c < '1' || c > '9'))
+			return 1;
+		r->http_major = c - '0';
+		MOVE(sw_major_first, sw_major);
+	}
+
+	STATE(sw_major) {
+		if (c == '.')
+			MOVE(sw_major, sw_minor_first);
+		if (unlikely(c < '0' || c > '9' || r->http_major > 9))
+			return 1;
+		r->http_major = r->http_major * 10 + c - '0';
+		MOVE(sw_major, sw_major);
+	}
+
+	STATE(sw_minor_first) {
+		if (unlikely(c < '0' || c > '9'))
+			return 1;
+		r->http_minor = c - '0';
+		MOVE(sw_minor_first, sw_minor);
+	}
+
+	STATE(sw_minor) {
+		if (c == ' ') {
+			r->status = 0;
+			MOVE(sw_minor, sw_status);
+		}
+		if (unlikely(c < '0' || c > '9' || r->http_minor > 9))
+			return 1;
+		r->http_minor = r->http_minor * 10 + c - '0';
+		MOVE(sw_minor, sw_minor);
+	}
+
+	/*
+	 * Exactly 3 digits by a state per digit, so the leading zeros are
+	 * rejected. The empty reason phrase may go without a space.
+	 */
+	STATE(sw_status) {
+		if (unlikely(c < '1' || c > '9'))
+			return 1;
+		r->status = c - '0';
+		MOVE(sw_status, sw_status_2);
+	}
+
+	STATE(sw_status_2) {
+		if (unlikely(c < '0' || c > '9'))
+			return 1;
+		r->status = r->status * 10 + c - '0';
+		MOVE(sw_status_2, sw_status_3);
+	}
+
+	STATE(sw_status_3) {
+		if (unlikely(c < '0' || c > '9'))
+			return 1;
+		r->status = r->status * 10 + c - '0';
+		MOVE(sw_status_3, sw_status_end);
+	}
+
+	STATE(sw_status_end) {
+		switch (c) {
+		case ' ':
+			MOVE(sw_status_end, sw_space_after_status);
+		case '\r':
+			r->off.status_start = r->off.status_end = POS(p);
+			MOVE(sw_status_end, sw_almost_done);
+		case '\n':
+			r->off.status_start = r->off.status_end = POS(p);
+			goto done;
+		}
+		return 1;
+	}
+
+	STATE(sw_space_after_status) {
+		r->off.status_start = POS(p);
+		/* OPTIMIZATION: fall through */
+	}
+
+	/* reason phrase */
+	STATE(sw_reason) {
+		n = tfw_match_ctext_vchar_best((const char *)p, __data_remain(p));
+		SKIP_n(sw_reason, n);
+		switch (c) {
+		case '\r':
+			r->off.status_end = POS(p);
+			MOVE(sw_reason, sw_almost_done);
+		case '\n':
+			r->off.status_end = POS(p);
+			goto done;
+		}
+		return 1;
+	}
+
+	STATE(sw_almost_done) {
+		if (likely(c == '\n'))
+			goto done;
+		return 1;
+	}
+
+done:
+	return 0;
+}
+
+/*
+ * Offset of the first LF in @s of @len bytes or @len if there is no LF.
+ */
+static inline size_t
+lf_search(const unsigned char *s, size_t len)
+{
+	size_t i = 0;
+
+#ifdef __AVX2__
+	const __m256i lf = _mm256_set1_epi8('\n');
+
+	for ( ; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+		unsigned int m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, lf));
+
+		if (m)
+			return i + __builtin_ctz(m);
+	}
+#endif
+	for ( ; i < len; ++i)
+		if (s[i] == '\n')
+			return i;
+
+	return len;
+}
+
+static inline int
+hex_digit(unsigned char c)
+{
+	if ((unsigned char)(c - '0') < 10)
+		return c - '0';
+	c |= 0x20;
+	if ((unsigned char)(c - 'a') < 6)
+		return c - 'a' + 10;
+
+	return -1;
+}
+
+/*
+ * The chunk size is limited to 60 bits to check the overflow before the
+ * shift only.
+ */
+#define CHUNK_SIZE_ADD(r, d)						\
+do {									\
+	if (unlikely((r)->chunk_size >> 60))				\
+		return 1;						\
+	(r)->chunk_size = ((r)->chunk_size << 4) | (d);			\
+} while (0)
+
+/**
+ * Resumable chunked transfer coding decoder, RFC 7230 4.1. The chunk data is
+ * never scanned: a payload run is the rest of the current chunk in @buf,
+ * which is copied to @out at once or, if @out is NULL, is spliced, i.e. the
+ * pointer to the run in @buf is saved to @iov with no copying. The chunk
+ * extensions and the trailer fields are skipped by the vector LF search.
+ * A bare LF is accepted as a line end as by Nginx.
+ *
+ * @n is the number of the copied bytes or of the saved runs in the call,
+ * @iov must have room for CHUNKED_IOV_MAX(@len) runs. The decoder is reset
+ * by zero r->__state and r->chunk_off, at the end of the body r->chunk_off
+ * is the body length.
+ *
+ * @return 0 at the end of the body, NGX_AGAIN if the body continues in the
+ * next chunk and 1 on an error.
+ */
+int
+goto_chunked(ngx_http_request_t *r, unsigned char *buf, int len,
+	     unsigned char *out, struct iovec *iov, int *n)
+{
+	unsigned char	  c, *p = buf;
+	size_t		  k;
+	int		  d;
+
+	*n = 0;
+	if (unlikely(!len))
+		return NGX_AGAIN;
+	c = *p;
+	FSM_START(sw_size_first);
+
+	STATE(sw_size_first) {
+		if (unlikely((d = hex_digit(c)) < 0))
+			return 1;
+		r->chunk_size = d;
+		MOVE(sw_size_first, sw_size);
+	}
+
+	STATE(sw_size) {
+		if ((d = hex_digit(c)) >= 0) {
+			CHUNK_SIZE_ADD(r, d);
+			MOVE(sw_size, sw_size);
+		}
+		switch (c) {
+		case '\r':
+			MOVE(sw_size, sw_size_lf);
+		case '\n':
+			goto sw_size_lf;
+		case ';':
+		case ' ':
+		case '\t':
+			goto sw_ext;
+		}
+		return 1;
+	}
+
+	/* chunk extensions and BWS up to the end of the size line */
+	STATE(sw_ext) {
+		k = lf_search(p, __data_remain(p));
+		SKIP_n(sw_ext, k);
+		/* OPTIMIZATION: fall through */
+	}
+
+	STATE(sw_size_lf) {
+		if (unlikely(c != '\n'))
+			return 1;
+		if (unlikely(!r->chunk_size))
+			MOVE(sw_size_lf, sw_trailer);
+		MOVE(sw_size_lf, sw_data);
+	}
+
+	STATE(sw_data) {
+		k = __data_remain(p);
+		if (k > r->chunk_size)
+			k = r->chunk_size;
+		if (out) {
+			memcpy(out + *n, p, k);
+			*n += k;
+		} else {
+			iov[*n].iov_base = p;
+			iov[*n].iov_len = k;
+			++*n;
+		}
+		r->chunk_size -= k;
+		p += k;
+		if (unlikely(p == buf + len)) {
+			if (r->chunk_size)
+				EXIT(sw_data);
+			EXIT(sw_data_cr);
+		}
+		c = *p;
+		/* OPTIMIZATION: fall through */
+	}
+
+	STATE(sw_data_cr) {
+		switch (c) {
+		case '\r':
+			MOVE(sw_data_cr, sw_data_lf);
+		case '\n':
+			MOVE(sw_data_cr, sw_size_first);
+		}
+		return 1;
+	}
+
+	STATE(sw_data_lf) {
+		if (unlikely(c != '\n'))
+			return 1;
+		MOVE(sw_data_lf, sw_size_first);
+	}
+
+	/* trailer field or the empty line at the body end */
+	STATE(sw_trailer) {
+		switch (c) {
+		case '\r':
+			MOVE(sw_trailer, sw_last_lf);
+		case '\n':
+			goto done;
+		}
+		/* OPTIMIZATION: fall through */
+	}
+
+	STATE(sw_trailer_line) {
+		k = lf_search(p, __data_remain(p));
+		SKIP_n(sw_trailer_line, k);
+		MOVE(sw_trailer_line, sw_trailer);
+	}
+
+	STATE(sw_last_lf) {
+		if (likely(c == '\n'))
+			goto done;
+		return 1;
+	}
+
+done:
+	r->chunk_off += p + 1 - buf;
+	return 0;
+}
+
+/**
+ * The byte loop version of goto_chunked() as the baseline: the FSM copies
+ * the payload to @out and looks for the line ends by bytes.
+ */
+int
+goto_chunked_bytes(ngx_http_request_t *r, unsigned char *buf, int len,
+		   unsigned char *out, int *n)
+{
+	unsigned char	  c, *p = buf;
+	int		  d;
+
+	*n = 0;
+	if (unlikely(!len))
+		return NGX_AGAIN;
+	c = *p;
+	FSM_START(sw_size_first);
+
+	STATE(sw_size_first) {
+		if (unlikely((d = hex_digit(c)) < 0))
+			return 1;
+		r->chunk_size = d;
+		MOVE(sw_size_first, sw_size);
+	}
+
+	STATE(sw_size) {
+		if ((d = hex_digit(c)) >= 0) {
+			CHUNK_SIZE_ADD(r, d);
+			MOVE(sw_size, sw_size);
+		}
+		switch (c) {
+		case '\r':
+			MOVE(sw_size, sw_size_lf);
+		case '\n':
+			goto sw_size_lf;
+		case ';':
+		case ' ':
+		case '\t':
+			goto sw_ext;
+		}
+		return 1;
+	}
+
+	STATE(sw_ext) {
+		if (c == '\n')
+			goto sw_size_lf;
+		MOVE(sw_ext, sw_ext);
+	}
+
+	STATE(sw_size_lf) {
+		if (unlikely(c != '\n'))
+			return 1;
+		if (unlikely(!r->chunk_size))
+			MOVE(sw_size_lf, sw_trailer);
+		MOVE(sw_size_lf, sw_data);
+	}
+
+	STATE(sw_data) {
+		out[(*n)++] = c;
+		if (--r->chunk_size)
+			MOVE(sw_data, sw_data);
+		MOVE(sw_data, sw_data_cr);
+	}
+
+	STATE(sw_data_cr) {
+		switch (c) {
+		case '\r':
+			MOVE(sw_data_cr, sw_data_lf);
+		case '\n':
+			MOVE(sw_data_cr, sw_size_first);
+		}
+		return 1;
+	}
+
+	STATE(sw_data_lf) {
+		if (unlikely(c != '\n'))
+			return 1;
+		MOVE(sw_data_lf, sw_size_first);
+	}
+
+	STATE(sw_trailer) {
+		switch (c) {
+		case '\r':
+			MOVE(sw_trailer, sw_last_lf);
+		case '\n':
+			goto done;
+		}
+		/* OPTIMIZATION: fall through */
+	}
+
+	STATE(sw_trailer_line) {
+		if (c == '\n')
+			MOVE(sw_trailer_line, sw_trailer);
+		MOVE(sw_trailer_line, sw_trailer_line);
+	}
+
+	STATE(sw_last_lf) {
+		if (likely(c == '\n'))
+			goto done;
+		return 1;
+	}
+
+done:
+	r->chunk_off += p + 1 - buf;
+	return 0;
+}
+
+/*
+ * ------------------------------------------------------------------------
+ *	Header lines by the structural index
+ * ------------------------------------------------------------------------
+ */
+/**
+ * goto_opt_header_line() for a line indexed by tfw_hdr_index(): @len includes
+ * the LF and @colon is the index colon offset, so there is no FSM, the name
+ * and the value are only validated by the vector matcher.
+ */
+int
+goto_idx_header_line(ngx_http_request_t *r, unsigned char *buf, int len,
+		     int colon)
+{
+	unsigned char *p = buf + colon + 1, *eol = buf + len - 1;
+
+	if (eol > buf && eol[-1] == '\r')
+		--eol;
+	r->header_name_start = buf;
+	r->header_id = HDR_RAW;
+	if (unlikely(eol == buf)) {
+		r->header_end = buf;
+		return 0;
+	}
+	if (unlikely(tfw_match_ctext_vchar_best((const char *)buf,
+						eol - buf) != eol - buf))
+		return 1;
+	if (unlikely(colon == len - 1)) {
+		r->header_name_end = r->header_start = r->header_end = eol;
+		return 0;
+	}
+
+	if (colon) {
+		const PHashEnt *e = phash_lookup(&hdr_phash, buf, colon, len);
+		if (e)
+			r->header_id = e->id;
+	}
+	r->header_name_end = buf + colon;
+	while (p < eol && *p == ' ')
+		++p;
+	r->header_start = p;
+	while (eol > p && eol[-1] == ' ')
+		--eol;
+	r->header_end = eol;
+
+	return 0;
+}
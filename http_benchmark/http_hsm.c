@@ -16,6 +16,7 @@
 #include <ctype.h>
 
 #include "http.h"
+#include "http_hsm.h"
 #include "http_s_tbl.h"
 
 /*
@@ -67,31 +68,6 @@ typedef enum {
 	Req_MAX = Req_BAD
 } HpsHttpReqSt;
 
-#define CTL_BITMAP	0x0
-#define CTL_PREFIX	0x1
-#define CTL_RANGE	0x2
-#define CTL_SEQ		0x3
-#define CTL_MASK	0x3
-
-#define SLOW_PATH	0x4
-/* Only edge-triggered actions are alowed. */
-#define ACTION		0x8
-
-#define ANY_CHAR	0x80
-
-typedef union {
-	struct {
-		unsigned char	ctl;
-		unsigned char	len;
-		struct {
-			unsigned char cb;
-			unsigned char sub;
-			unsigned char st;
-		} __attribute__((packed)) r[4];
-	} x;
-	unsigned long l[2];
-} __attribute__((packed)) XTrans;
-
 #define CTL_INIT(v)		.x.ctl = v
 #define LEN_INIT(v)		.x.len = v
 #define RNG_R_INIT(c, s, t)	{.cb = c, .sub = s, .st = t}
@@ -0,0 +1,75 @@
+/**
+ * Packed transitions of HTTP Hybrid State Machine.
+ *
+ * Each state is described by 16 bytes, so 4 states share a cache line. The
+ * state control byte @ctl defines how the rest of the state is interpreted:
+ *
+ * CTL_RANGE	- up to 4 ranges of the alphabet codes [cb, cb + sub] each one
+ * 		  leading to state @st, the unused ranges are zeroed;
+ * CTL_BITMAP	- all the codes are leading to the only state @st, the codes
+ * 		  are defined by bitmap @bm;
+ * CTL_SEQ	- @len codes of @c must follow the current position to move to
+ * 		  state @st, otherwise the automaton moves to state @fail
+ * 		  without consuming the current character and the actions;
+ * SLOW_PATH	- the state transitions are in a full row @len of a separate
+ * 		  table, used if the state doesn't fit the 16 bytes.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __HTTP_HSM_H__
+#define __HTTP_HSM_H__
+
+#define CTL_BITMAP	0x0
+#define CTL_PREFIX	0x1
+#define CTL_RANGE	0x2
+#define CTL_SEQ		0x3
+#define CTL_MASK	0x3
+
+#define SLOW_PATH	0x4
+/* Only edge-triggered actions are alowed. */
+#define ACTION		0x8
+
+#define ANY_CHAR	0x80
+
+/* Maximum alphabet power for CTL_BITMAP and sequence length for CTL_SEQ. */
+#define XT_BITMAP_MAX	112
+#define XT_SEQ_MAX	12
+
+typedef union {
+	struct {
+		unsigned char	ctl;
+		unsigned char	len;
+		struct {
+			unsigned char cb;
+			unsigned char sub;
+			unsigned char st;
+		} __attribute__((packed)) r[4];
+	} x;
+	struct {
+		unsigned char	ctl;
+		unsigned char	st;
+		unsigned char	bm[XT_BITMAP_MAX / 8];
+	} b;
+	struct {
+		unsigned char	ctl;
+		unsigned char	len;
+		unsigned char	st;
+		unsigned char	fail;
+		unsigned char	c[XT_SEQ_MAX];
+	} s;
+	unsigned long l[2];
+} __attribute__((packed)) XTrans;
+
+#endif /* __HTTP_HSM_H__ */
@@ -0,0 +1,124 @@
+/**
+ * HTTP Hybrid State Machine with the tables generated by hsm_gen from the
+ * grammar in http_hdr.hsm.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <ctype.h>
+
+#include "http.h"
+#include "http_hsm.h"
+#include "http_hdr_hsm.h"
+
+#define RNG_MATCH(t, i, c)						\
+	((unsigned char)((c) - (t)->x.r[i].cb) <= (t)->x.r[i].sub)
+
+static inline int
+seq_match(const XTrans *t, const unsigned char *p, const unsigned char *end)
+{
+	if (unlikely(end - p < t->s.len))
+		return 0;
+	for (int i = 0; i < t->s.len; ++i)
+		if (hg_tbl[p[i]] != t->s.c[i])
+			return 0;
+	return 1;
+}
+
+int
+hsm_gen_header_line(ngx_http_request_t *r, unsigned char *buf, int len)
+{
+	unsigned char st, *p, *end = buf + len;
+
+	for (p = buf, st = hg_start; p < end && st < HG_FINAL; ) {
+		const XTrans *t = &hg_am_tbl[st];
+		unsigned char s = st, c = hg_tbl[*p];
+
+		if (unlikely(!c))
+			break;
+
+		/*
+		 * OPTIMIZATION: the self loop is the first range, so stay in
+		 * the state while the characters match it.
+		 */
+		if (likely((t->x.ctl & (CTL_MASK | SLOW_PATH)) == CTL_RANGE
+			   && t->x.r[0].st == s))
+		{
+			while (RNG_MATCH(t, 0, c)) {
+				if (unlikely(++p == end))
+					goto done;
+				c = hg_tbl[*p];
+			}
+			if (unlikely(!c))
+				break;
+		}
+
+		switch (t->x.ctl & (CTL_MASK | SLOW_PATH)) {
+		case CTL_RANGE:
+			/* The unused ranges are zeroed and match code 0 only. */
+			if (likely(RNG_MATCH(t, 0, c)))
+				st = t->x.r[0].st;
+			else if (RNG_MATCH(t, 1, c))
+				st = t->x.r[1].st;
+			else if (RNG_MATCH(t, 2, c))
+				st = t->x.r[2].st;
+			else if (RNG_MATCH(t, 3, c))
+				st = t->x.r[3].st;
+			else
+				st = hg_BAD;
+			break;
+		case CTL_BITMAP:
+			st = t->b.bm[c >> 3] & (1 << (c & 7)) ? t->b.st : hg_BAD;
+			break;
+		case CTL_SEQ:
+			if (unlikely(!seq_match(t, p, end))) {
+				/* Move without the character and the actions. */
+				st = t->s.fail;
+				continue;
+			}
+			p += t->s.len - 1;
+			st = t->s.st;
+			break;
+		default:
+			st = hg_am_slow[t->x.len][c];
+		}
+
+		// Actions.
+		if (unlikely(st != s && (hg_am_tbl[st].x.ctl & ACTION))) {
+			switch (st) {
+			case hg_h:
+			case hg_name:
+				r->header_name_start = p;
+				break;
+			case hg_space_before_value:
+			case hg_done:
+				if (unlikely(!r->header_name_end))
+					r->header_name_end = p;
+				r->header_end = p;
+				break;
+			case hg_value:
+				r->header_start = p;
+				break;
+			}
+		}
+		++p;
+	}
+done:
+	// Chop spaces at the end of header value.
+	while (unlikely(r->header_end > r->header_start
+			&& isspace(r->header_end[-1])))
+		r->header_end--;
+
+	return st == hg_BAD ? 1 : 0;
+}
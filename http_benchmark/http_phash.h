@@ -0,0 +1,135 @@
+/**
+ * Perfect hash lookups for the HTTP methods and the well-known header names.
+ *
+ * A key is represented by its first and last 8 bytes and its length, so the
+ * hash is one multiplication and a key up to 16 bytes is verified by two
+ * words comparisons. Case insensitive tables keep the keys in lower case and
+ * the words are converted with OR 0x20, which is correct for the HTTP token
+ * characters. The tables with the seeds giving no collisions are generated by
+ * phash_gen.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __HTTP_PHASH_H__
+#define __HTTP_PHASH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define PHASH_LC	0x2020202020202020UL
+
+typedef struct {
+	uint64_t	w0;
+	uint64_t	w1;
+	const char	*name;
+	unsigned int	len;
+	int		id;
+} PHashEnt;
+
+typedef struct {
+	const PHashEnt	*tbl;
+	uint64_t	seed;
+	unsigned int	shift;
+	uint64_t	lc;
+} PHash;
+
+static inline uint64_t
+phash_mask(size_t n)
+{
+	return n >= 8 ? ~0UL : (1UL << (n * 8)) - 1;
+}
+
+/*
+ * Load the first word of key @s of length @n, @avail bytes can be read
+ * from @s.
+ */
+static inline uint64_t
+phash_w0(const unsigned char *s, size_t n, size_t avail, uint64_t lc)
+{
+	uint64_t w = 0;
+
+	if (__builtin_expect(avail >= 8, 1))
+		memcpy(&w, s, 8);
+	else
+		memcpy(&w, s, n < 8 ? n : 8);
+
+	return (w | lc) & phash_mask(n);
+}
+
+/* The last word of the key, zero for the keys fitting the first word. */
+static inline uint64_t
+phash_w1(const unsigned char *s, size_t n, uint64_t lc)
+{
+	uint64_t w;
+
+	if (n <= 8)
+		return 0;
+	memcpy(&w, s + n - 8, 8);
+
+	return w | lc;
+}
+
+static inline unsigned int
+phash(uint64_t w0, uint64_t w1, size_t n, uint64_t seed, unsigned int shift)
+{
+	uint64_t x = w0 ^ ((w1 << 29) | (w1 >> 35)) ^ n;
+
+	return (unsigned int)((x * seed) >> shift);
+}
+
+/**
+ * Look up key @s of length @n in perfect hash table @ph, @avail bytes can
+ * be read from @s. Returns NULL if the key isn't in the table.
+ */
+static inline const PHashEnt *
+phash_lookup(const PHash *ph, const unsigned char *s, size_t n, size_t avail)
+{
+	uint64_t w0 = phash_w0(s, n, avail, ph->lc);
+	uint64_t w1 = phash_w1(s, n, ph->lc);
+	const PHashEnt *e = &ph->tbl[phash(w0, w1, n, ph->seed, ph->shift)];
+
+	if (e->len != n || e->w0 != w0 || e->w1 != w1)
+		return NULL;
+	/* Long keys: compare the middle which isn't covered by the words. */
+	if (__builtin_expect(n > 16, 0))
+		for (size_t i = 8; i < n - 8; ++i)
+			if ((s[i] | (unsigned char)ph->lc)
+			    != (unsigned char)e->name[i])
+				return NULL;
+
+	return e;
+}
+
+/**
+ * Length of the HTTP method at @p, i.e. the position of the first space in
+ * the first 10 bytes, or zero if there is no space. The longest method is
+ * 9 bytes, so 10 bytes must be available.
+ */
+static inline size_t
+phash_meth_len(const unsigned char *p)
+{
+	uint64_t x, m;
+
+	memcpy(&x, p, 8);
+	x ^= 0x2020202020202020UL;
+	m = (x - 0x0101010101010101UL) & ~x & 0x8080808080808080UL;
+	if (__builtin_expect(m != 0, 1))
+		return __builtin_ctzl(m) >> 3;
+
+	return p[8] == ' ' ? 8 : (p[9] == ' ' ? 9 : 0);
+}
+
+#endif /* __HTTP_PHASH_H__ */
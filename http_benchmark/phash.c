@@ -0,0 +1,227 @@
+/**
+ * Benchmark of the perfect hash lookups of the HTTP methods and the header
+ * names against the comparison chains.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include "../bench.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "http.h"
+#include "http_phash.h"
+#include "http_phash_tbl.h"
+
+#define N	(1000 * 1000)
+
+#define TFW_CHAR4_INT(a, b, c, d)					\
+	 ((d << 24) | (c << 16) | (b << 8) | a)
+
+/* The request lines have at least 10 bytes for the methods lookups. */
+static const char *meths[] = {
+	"GET / HTTP/1.1\r\n",
+	"GET /index.html HTTP/1.1\r\n",
+	"POST /script HTTP/1.1\r\n",
+	"GET /a HTTP/1.1\r\n",
+	"HEAD / HTTP/1.1\r\n",
+	"PUT /f HTTP/1.1\r\n",
+	"OPTIONS /f HTTP/1.1\r\n",
+	"DELETE /f HTTP/1.1\r\n",
+	"PATCH /f HTTP/1.1\r\n",
+	"PROPFIND /f HTTP/1.1\r\n",
+	"PROPPATCH /f HTTP/1.1\r\n",
+	"COPY /f HTTP/1.1\r\n",
+	"POSTX / HTTP/1.1\r\n",
+};
+
+static const char *hdrs[] = {
+	"Host: github.com\r\n",
+	"Connection: keep-alive\r\n",
+	"Cache-Control: max-age=0\r\n",
+	"Upgrade-Insecure-Requests: 1\r\n",
+	"Accept-Encoding: gzip,deflate,sdch\r\n",
+	"Accept-Language: zh-CN,zh;q=0.8,en;q=0.6\r\n",
+	"accept-charset: gb18030,utf-8;q=0.7,*;q=0.3\r\n",
+	"If-None-Match: 7f9c6a2baf61233cedd62ffa906b604f\r\n",
+	"User-Agent: Mozilla/5.0\r\n",
+	"Accept: text/html\r\n",
+	"X-Custom-Header: 1\r\n",
+	"Upgrade-Insecure-Request: 1\r\n",
+	"Hosts: a\r\n",
+	"TE: trailers\r\n",
+};
+
+/* The methods recognition by the comparisons from goto_request_line(). */
+static int
+meth_lookup_chain(const unsigned char *p)
+{
+	uint32_t w = *(uint32_t *)p;
+
+	if (likely(w == TFW_CHAR4_INT('G', 'E', 'T', ' ')))
+		return NGX_HTTP_GET;
+	if (likely(w == TFW_CHAR4_INT('P', 'O', 'S', 'T')))
+		return p[4] == ' ' ? NGX_HTTP_POST : 0;
+	barrier();
+
+	switch (w) {
+	case TFW_CHAR4_INT('P', 'U', 'T', ' '):
+		return NGX_HTTP_PUT;
+	case TFW_CHAR4_INT('P', 'A', 'T', 'C'):
+		if (likely(p[4] == 'H' && p[5] == ' '))
+			return NGX_HTTP_PATCH;
+		break;
+	case TFW_CHAR4_INT('P', 'R', 'O', 'P'):
+		if (*(uint32_t *)(p + 4) == TFW_CHAR4_INT('F', 'I', 'N', 'D')
+		    && p[8] == ' ')
+			return NGX_HTTP_PROPFIND;
+		if (*(uint32_t *)(p + 4) == TFW_CHAR4_INT('P', 'A', 'T', 'C')
+		    && p[8] == 'H' && p[9] == ' ')
+			return NGX_HTTP_PROPPATCH;
+		break;
+	case TFW_CHAR4_INT('C', 'O', 'P', 'Y'):
+		return p[4] == ' ' ? NGX_HTTP_COPY : 0;
+	case TFW_CHAR4_INT('D', 'E', 'L', 'E'):
+		if (likely(p[4] == 'T' && p[5] == 'E' && p[6] == ' '))
+			return NGX_HTTP_DELETE;
+		break;
+	case TFW_CHAR4_INT('H', 'E', 'A', 'D'):
+		return p[4] == ' ' ? NGX_HTTP_HEAD : 0;
+	case TFW_CHAR4_INT('L', 'O', 'C', 'K'):
+		return p[4] == ' ' ? NGX_HTTP_LOCK : 0;
+	case TFW_CHAR4_INT('M', 'O', 'V', 'E'):
+		return p[4] == ' ' ? NGX_HTTP_MOVE : 0;
+	case TFW_CHAR4_INT('M', 'K', 'C', 'O'):
+		if (likely(p[4] == 'L' && p[5] == ' '))
+			return NGX_HTTP_MKCOL;
+		break;
+	case TFW_CHAR4_INT('O', 'P', 'T', 'I'):
+		if (likely(*(uint32_t *)(p + 4)
+			   == TFW_CHAR4_INT('O', 'N', 'S', ' ')))
+			return NGX_HTTP_OPTIONS;
+		break;
+	case TFW_CHAR4_INT('T', 'R', 'A', 'C'):
+		if (likely(p[4] == 'E' && p[5] == ' '))
+			return NGX_HTTP_TRACE;
+		break;
+	case TFW_CHAR4_INT('U', 'N', 'L', 'O'):
+		if (likely(p[4] == 'C' && p[5] == 'K' && p[6] == ' '))
+			return NGX_HTTP_UNLOCK;
+		break;
+	}
+
+	return 0;
+}
+
+static int
+meth_lookup_phash(const unsigned char *p)
+{
+	const PHashEnt *e = phash_lookup(&meth_phash, p, phash_meth_len(p), 10);
+
+	return e ? e->id : 0;
+}
+
+/* The header names in the order of http_phash.txt. */
+static const struct {
+	const char	*name;
+	size_t		len;
+} hdr_names[] = {
+#define H(s)	{ s, sizeof(s) - 1 }
+	H("Host"), H("User-Agent"), H("Accept"), H("Accept-Charset"),
+	H("Accept-Encoding"), H("Accept-Language"), H("Authorization"),
+	H("Cache-Control"), H("Connection"), H("Content-Length"),
+	H("Content-Type"), H("Cookie"), H("Date"), H("DNT"), H("Expect"),
+	H("Forwarded"), H("If-Match"), H("If-Modified-Since"),
+	H("If-None-Match"), H("If-Range"), H("If-Unmodified-Since"),
+	H("Keep-Alive"), H("Max-Forwards"), H("Origin"), H("Pragma"),
+	H("Range"), H("Referer"), H("TE"), H("Transfer-Encoding"),
+	H("Upgrade"), H("Upgrade-Insecure-Requests"), H("Via"),
+	H("X-Forwarded-For"), H("X-Real-IP"), H("X-Requested-With"),
+#undef H
+};
+
+/* A separate lookup of a header name by the comparisons. */
+static int
+hdr_lookup_chain(const unsigned char *name, size_t len)
+{
+	for (unsigned int i = 0; i < sizeof(hdr_names) / sizeof(hdr_names[0]);
+	     ++i)
+		if (len == hdr_names[i].len
+		    && !strncasecmp((const char *)name, hdr_names[i].name, len))
+			return HDR_RAW + 1 + i;
+
+	return HDR_RAW;
+}
+
+static int
+hdr_lookup_phash(const unsigned char *name, size_t len, size_t avail)
+{
+	const PHashEnt *e = phash_lookup(&hdr_phash, name, len, avail);
+
+	return e ? e->id : HDR_RAW;
+}
+
+#define test(name, data, code)						\
+do {									\
+	volatile int res = 0;						\
+									\
+	BENCH_RUN(name, (unsigned long)N * (sizeof(data)/sizeof(data[0])), { \
+		for (int i = 0; i < N; ++i)				\
+			for (int j = 0; j < sizeof(data)/sizeof(data[0]); ++j) { \
+				const unsigned char *s =		\
+					(const unsigned char *)data[j];	\
+				res += code;				\
+			}						\
+	});								\
+} while (0)
+
+void
+phash_benchmark(void)
+{
+	size_t name_len[sizeof(hdrs) / sizeof(hdrs[0])];
+	size_t line_len[sizeof(hdrs) / sizeof(hdrs[0])];
+
+	/* Check the lookups and the ids set by the goto_opt parsers. */
+	for (int j = 0; j < sizeof(meths) / sizeof(meths[0]); ++j) {
+		const unsigned char *s = (const unsigned char *)meths[j];
+		ngx_http_request_t r;
+
+		memset(&r, 0, sizeof(r));
+		assert(meth_lookup_chain(s) == meth_lookup_phash(s));
+		assert(goto_opt_request_line(&r, (unsigned char *)s,
+					     strlen(meths[j])) == !meth_lookup_chain(s)
+		       && r.method == meth_lookup_chain(s));
+	}
+	for (int j = 0; j < sizeof(hdrs) / sizeof(hdrs[0]); ++j) {
+		const unsigned char *s = (const unsigned char *)hdrs[j];
+		ngx_http_request_t r;
+
+		name_len[j] = strchr(hdrs[j], ':') - hdrs[j];
+		line_len[j] = strlen(hdrs[j]);
+		memset(&r, 0, sizeof(r));
+		goto_opt_header_line(&r, (unsigned char *)s, line_len[j]);
+		assert(r.header_id == hdr_lookup_chain(s, name_len[j])
+		       && r.header_id == hdr_lookup_phash(s, name_len[j],
+						   line_len[j]));
+	}
+
+	printf("\nMethods and header names lookups:\n");
+	test("meth_lookup_chain", meths, meth_lookup_chain(s));
+	test("meth_lookup_phash", meths, meth_lookup_phash(s));
+	test("hdr_lookup_chain", hdrs, hdr_lookup_chain(s, name_len[j]));
+	test("hdr_lookup_phash", hdrs, hdr_lookup_phash(s, name_len[j], line_len[j]));
+}
@@ -0,0 +1,275 @@
+/**
+ * Generator of the perfect hash tables for http_phash.h.
+ *
+ * The input is a list of tables, each table is followed by its keys:
+ *
+ *	# comment
+ *	table meth
+ *		GET		NGX_HTTP_GET
+ *	table hdr nocase enum HDR
+ *		Host
+ *
+ * A key is followed by its id, or the ids are generated as an enum if the
+ * table has "enum <PREFIX>": <PREFIX>_RAW is zero for the unknown keys and
+ * each key gets <PREFIX>_<KEY> with the key converted to upper case and
+ * '-' to '_'. The keys of "nocase" tables are matched case insensitively.
+ *
+ * For each table the generator searches for the smallest table size and for
+ * a seed which put all the keys to different slots.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "http_phash.h"
+
+#define MAX_KEYS	256
+#define KEY_LEN		64
+/* Seeds to try for each table size. */
+#define SEED_TRIES	(1 << 20)
+
+typedef struct {
+	char		key[KEY_LEN];
+	char		id[KEY_LEN];
+	uint64_t	w0;
+	uint64_t	w1;
+	size_t		len;
+} Key;
+
+typedef struct {
+	char		name[KEY_LEN];
+	char		prefix[KEY_LEN];
+	int		nocase;
+	unsigned int	n;
+	Key		keys[MAX_KEYS];
+} Table;
+
+static const char *fname;
+static int line_n;
+
+static uint64_t rnd_state = 0x9e3779b97f4a7c15UL;
+
+static uint64_t
+rnd(void)
+{
+	rnd_state ^= rnd_state >> 12;
+	rnd_state ^= rnd_state << 25;
+	rnd_state ^= rnd_state >> 27;
+
+	return rnd_state * 0x2545f4914f6cdd1dUL;
+}
+
+static void
+die(const char *msg, const char *arg)
+{
+	fprintf(stderr, "%s:%d: %s%s\n", fname, line_n, msg, arg ? arg : "");
+	exit(1);
+}
+
+/*
+ * Find a seed which maps all the keys to different slots of a table of
+ * 1 << @bits entries.
+ */
+static int
+find_seed(Table *t, unsigned int bits, uint64_t *seed)
+{
+	unsigned char *used = malloc(1U << bits);
+
+	if (!used)
+		die("cannot allocate memory", NULL);
+	for (int i = 0; i < SEED_TRIES; ++i) {
+		unsigned int k;
+
+		*seed = rnd() | 1;
+		memset(used, 0, 1U << bits);
+		for (k = 0; k < t->n; ++k) {
+			const Key *key = &t->keys[k];
+			unsigned int h = phash(key->w0, key->w1, key->len,
+					       *seed, 64 - bits);
+
+			if (used[h])
+				break;
+			used[h] = 1;
+		}
+		if (k == t->n) {
+			free(used);
+			return 0;
+		}
+	}
+	free(used);
+
+	return -1;
+}
+
+static void
+print_table(Table *t)
+{
+	unsigned int bits = 1;
+	uint64_t seed, lc = t->nocase ? PHASH_LC : 0;
+	const Key **slots;
+
+	for (unsigned int k = 0; k < t->n; ++k) {
+		Key *key = &t->keys[k];
+		const unsigned char *s = (const unsigned char *)key->key;
+
+		key->len = strlen(key->key);
+		key->w0 = phash_w0(s, key->len, key->len, lc);
+		key->w1 = phash_w1(s, key->len, lc);
+	}
+	while ((1U << bits) < t->n)
+		++bits;
+	for ( ; find_seed(t, bits, &seed); ++bits)
+		if (bits == 16)
+			die("cannot find a perfect hash for table ", t->name);
+
+	if (*t->prefix) {
+		printf("enum {\n\t%s_RAW,\n", t->prefix);
+		for (unsigned int k = 0; k < t->n; ++k)
+			printf("\t%s,\n", t->keys[k].id);
+		printf("\t%s_MAX\n};\n\n", t->prefix);
+	}
+
+	if (!(slots = calloc(1U << bits, sizeof(*slots))))
+		die("cannot allocate memory", NULL);
+	for (unsigned int k = 0; k < t->n; ++k) {
+		const Key *key = &t->keys[k];
+
+		slots[phash(key->w0, key->w1, key->len, seed, 64 - bits)] = key;
+	}
+
+	printf("static const PHashEnt %s_phash_tbl[%u] = {\n",
+	       t->name, 1U << bits);
+	for (unsigned int i = 0; i < 1U << bits; ++i) {
+		const Key *key = slots[i];
+		char name[KEY_LEN];
+
+		if (!key)
+			continue;
+		for (size_t j = 0; j <= key->len; ++j)
+			name[j] = t->nocase ? (char)tolower(key->key[j])
+					    : key->key[j];
+		printf("\t[%u] = {\n\t\t.w0 = 0x%016lxUL,\n"
+		       "\t\t.w1 = 0x%016lxUL,\n"
+		       "\t\t.name = \"%s\",\n\t\t.len = %zu,\n"
+		       "\t\t.id = %s\n\t},\n",
+		       i, key->w0, key->w1, name, key->len, key->id);
+	}
+	printf("};\n\n");
+	printf("static const PHash %s_phash = {\n\t.tbl = %s_phash_tbl,\n"
+	       "\t.seed = 0x%016lxUL,\n\t.shift = %u,\n\t.lc = 0x%016lxUL\n"
+	       "};\n\n", t->name, t->name, seed, 64 - bits, lc);
+	free(slots);
+}
+
+static char *
+next_token(char **s)
+{
+	char *p = *s, *t;
+
+	while (isspace(*p))
+		++p;
+	if (!*p)
+		return NULL;
+	for (t = p; *p && !isspace(*p); ++p)
+		;
+	if (*p)
+		*p++ = 0;
+	*s = p;
+
+	return t;
+}
+
+int
+main(int argc, char *argv[])
+{
+	static Table t;
+	char buf[256];
+	FILE *f;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <keys file>\n", argv[0]);
+		return 1;
+	}
+	fname = argv[1];
+	if (!(f = fopen(fname, "r"))) {
+		perror(fname);
+		return 1;
+	}
+
+	printf("/*\n * Generated by phash_gen from %s, do not edit.\n */\n",
+	       fname);
+	while (fgets(buf, sizeof(buf), f)) {
+		char *p = buf, *tok;
+
+		++line_n;
+		if (!(tok = next_token(&p)) || *tok == '#')
+			continue;
+
+		if (!strcmp(tok, "table")) {
+			if (*t.name)
+				print_table(&t);
+			memset(&t, 0, sizeof(t));
+			if (!(tok = next_token(&p)))
+				die("table name expected", NULL);
+			snprintf(t.name, KEY_LEN, "%s", tok);
+			while ((tok = next_token(&p))) {
+				if (!strcmp(tok, "nocase")) {
+					t.nocase = 1;
+				} else if (!strcmp(tok, "enum")
+					   && (tok = next_token(&p)))
+				{
+					snprintf(t.prefix, KEY_LEN, "%s", tok);
+				} else {
+					die("bad table option ", tok);
+				}
+			}
+			continue;
+		}
+
+		if (!*t.name)
+			die("key out of a table", NULL);
+		if (t.n == MAX_KEYS)
+			die("too many keys", NULL);
+		if (strlen(tok) >= KEY_LEN)
+			die("too long key ", tok);
+		snprintf(t.keys[t.n].key, KEY_LEN, "%s", tok);
+		if (*t.prefix) {
+			char *id = t.keys[t.n].id;
+			int n = snprintf(id, KEY_LEN, "%s_", t.prefix);
+
+			for (char *c = tok; *c && n < KEY_LEN - 1; ++c)
+				id[n++] = *c == '-' ? '_' : (char)toupper(*c);
+			id[n] = 0;
+		} else {
+			if (!(tok = next_token(&p)))
+				die("key id expected for ", t.keys[t.n].key);
+			snprintf(t.keys[t.n].id, KEY_LEN, "%s", tok);
+		}
+		for (unsigned int k = 0; k < t.n; ++k)
+			if (t.nocase ? !strcasecmp(t.keys[k].key, t.keys[t.n].key)
+				     : !strcmp(t.keys[k].key, t.keys[t.n].key))
+				die("duplicate key ", t.keys[k].key);
+		++t.n;
+	}
+	fclose(f);
+	if (*t.name)
+		print_table(&t);
+
+	return 0;
+}
@@ -0,0 +1,235 @@
+/*
+ * Cost of unaligned loads and stores of 2, 4, 8, 16 and 32 bytes at each
+ * offset within a cache line, crossing a cache line and crossing a page,
+ * for memcpy(), __attribute__((packed)) structures and SIMD unaligned
+ * loads and stores (the widths less than 16 bytes use the low part of an
+ * SSE register). This is the cost of the packed wire formats parsing.
+ *
+ * The accesses of each measurement go to the same address and are
+ * independent, so the numbers are the throughput in TSC cycles per access,
+ * including about a quarter of a cycle of the loop overhead. TSC ticks at
+ * the nominal frequency, so pin the CPU frequency for the comparable results
+ * from different machines.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#define _POSIX_C_SOURCE 200112L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <immintrin.h>
+
+#ifndef __AVX__
+#error "32-byte accesses require AVX, compile with -march=native on AVX CPU"
+#endif
+
+#define Iterations	(256 * 1024)
+#define CL		64
+#define PAGE		4096
+
+static inline unsigned long long
+rdtsc(void)
+{
+	unsigned int lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+
+	return ((unsigned long long)hi << 32) | lo;
+}
+
+/* Don't let the compiler to drop the loaded values or hoist the accesses. */
+#define use_r(v)	__asm__ __volatile__("" : : "r"(v))
+#define use_x(v)	__asm__ __volatile__("" : : "x"(v))
+#define hide(p)		__asm__ __volatile__("" : "+r"(p))
+
+#define ld_memcpy(T, v, p)	memcpy(&(v), (p), sizeof(T))
+#define st_memcpy(T, v, p)	memcpy((p), &(v), sizeof(T))
+
+#define PACKED(T)	struct { T v; } __attribute__((packed))
+#define ld_packed(T, v, p)	(v) = ((const PACKED(T) *)(p))->v
+#define st_packed(T, v, p)	((PACKED(T) *)(p))->v = (v)
+
+/* Eight accesses per loop iteration to amortize the loop overhead. */
+#define X8(op)	op; op; op; op; op; op; op; op
+
+#define DEFINE_BENCH(strat, w, T, ld, st, use)				\
+static double								\
+bench_ld_##strat##_##w(unsigned char *p)				\
+{									\
+	unsigned long long t0, t1;					\
+	T v;								\
+									\
+	t0 = rdtsc();							\
+	for (int i = 0; i < Iterations; ++i) {				\
+		X8(hide(p); ld(T, v, p); use(v));			\
+	}								\
+	t1 = rdtsc();							\
+									\
+	return (double)(t1 - t0) / (Iterations * 8);			\
+}									\
+									\
+static double								\
+bench_st_##strat##_##w(unsigned char *p)				\
+{									\
+	unsigned long long t0, t1;					\
+	T v;								\
+									\
+	memset(&v, 0xa5, sizeof(v));					\
+	t0 = rdtsc();							\
+	for (int i = 0; i < Iterations; ++i) {				\
+		X8(hide(p); st(T, v, p));				\
+	}								\
+	t1 = rdtsc();							\
+									\
+	return (double)(t1 - t0) / (Iterations * 8);			\
+}
+
+DEFINE_BENCH(memcpy, 2, uint16_t, ld_memcpy, st_memcpy, use_r)
+DEFINE_BENCH(memcpy, 4, uint32_t, ld_memcpy, st_memcpy, use_r)
+DEFINE_BENCH(memcpy, 8, uint64_t, ld_memcpy, st_memcpy, use_r)
+DEFINE_BENCH(memcpy, 16, __m128i, ld_memcpy, st_memcpy, use_x)
+DEFINE_BENCH(memcpy, 32, __m256i, ld_memcpy, st_memcpy, use_x)
+
+DEFINE_BENCH(packed, 2, uint16_t, ld_packed, st_packed, use_r)
+DEFINE_BENCH(packed, 4, uint32_t, ld_packed, st_packed, use_r)
+DEFINE_BENCH(packed, 8, uint64_t, ld_packed, st_packed, use_r)
+DEFINE_BENCH(packed, 16, __m128i, ld_packed, st_packed, use_x)
+DEFINE_BENCH(packed, 32, __m256i, ld_packed, st_packed, use_x)
+
+#define ld_simd_2(T, v, p)	(v) = _mm_loadu_si16(p)
+#define st_simd_2(T, v, p)	_mm_storeu_si16((p), (v))
+#define ld_simd_4(T, v, p)	(v) = _mm_loadu_si32(p)
+#define st_simd_4(T, v, p)	_mm_storeu_si32((p), (v))
+#define ld_simd_8(T, v, p)	(v) = _mm_loadu_si64(p)
+#define st_simd_8(T, v, p)	_mm_storeu_si64((p), (v))
+#define ld_simd_16(T, v, p)	(v) = _mm_loadu_si128((const __m128i *)(p))
+#define st_simd_16(T, v, p)	_mm_storeu_si128((__m128i *)(p), (v))
+#define ld_simd_32(T, v, p)	(v) = _mm256_loadu_si256((const __m256i *)(p))
+#define st_simd_32(T, v, p)	_mm256_storeu_si256((__m256i *)(p), (v))
+
+DEFINE_BENCH(simd, 2, __m128i, ld_simd_2, st_simd_2, use_x)
+DEFINE_BENCH(simd, 4, __m128i, ld_simd_4, st_simd_4, use_x)
+DEFINE_BENCH(simd, 8, __m128i, ld_simd_8, st_simd_8, use_x)
+DEFINE_BENCH(simd, 16, __m128i, ld_simd_16, st_simd_16, use_x)
+DEFINE_BENCH(simd, 32, __m256i, ld_simd_32, st_simd_32, use_x)
+
+#define WIDTHS	5
+
+static const int widths[WIDTHS] = { 2, 4, 8, 16, 32 };
+
+static const struct {
+	const char	*name;
+	double		(*ld[WIDTHS])(unsigned char *);
+	double		(*st[WIDTHS])(unsigned char *);
+} strategies[] = {
+#define STRATEGY(s)							\
+	{ #s,								\
+	  { bench_ld_##s##_2, bench_ld_##s##_4, bench_ld_##s##_8,	\
+	    bench_ld_##s##_16, bench_ld_##s##_32 },			\
+	  { bench_st_##s##_2, bench_st_##s##_4, bench_st_##s##_8,	\
+	    bench_st_##s##_16, bench_st_##s##_32 } }
+	STRATEGY(memcpy),
+	STRATEGY(packed),
+	STRATEGY(simd),
+#undef STRATEGY
+};
+
+static void
+print_cpu(void)
+{
+	char line[256];
+	FILE *f = fopen("/proc/cpuinfo", "r");
+
+	if (!f)
+		return;
+	while (fgets(line, sizeof(line), f))
+		if (!strncmp(line, "model name", 10)) {
+			printf("%s", line);
+			break;
+		}
+	fclose(f);
+}
+
+/* The minimum of several runs filters out the interrupts and preemption. */
+static double
+measure(double (*fn)(unsigned char *), unsigned char *p)
+{
+	double r, min = fn(p);
+
+	for (int i = 1; i < 3; ++i)
+		if ((r = fn(p)) < min)
+			min = r;
+
+	return min;
+}
+
+/*
+ * Prints the matrix of offsets within a cache line by the access widths.
+ * '*' marks the cache line split accesses, the last row is the page split.
+ */
+static void
+print_matrix(unsigned char *buf, const char *op, int s, int store)
+{
+	unsigned char *cl = buf + PAGE;
+
+	printf("\n%s %s, cycles per access:\noffset", strategies[s].name, op);
+	for (int w = 0; w < WIDTHS; ++w)
+		printf("\t%7d", widths[w]);
+	printf("\n");
+
+	for (int off = 0; off < CL; ++off) {
+		printf("%6d", off);
+		for (int w = 0; w < WIDTHS; ++w) {
+			double (*fn)(unsigned char *) = store
+						? strategies[s].st[w]
+						: strategies[s].ld[w];
+			printf("\t%6.2f%c", measure(fn, cl + off),
+			       off + widths[w] > CL ? '*' : ' ');
+		}
+		printf("\n");
+	}
+
+	printf("  page");
+	for (int w = 0; w < WIDTHS; ++w) {
+		double (*fn)(unsigned char *) = store ? strategies[s].st[w]
+						      : strategies[s].ld[w];
+		printf("\t%6.2f ", measure(fn, buf + PAGE - widths[w] / 2));
+	}
+	printf("\n");
+}
+
+int
+main(void)
+{
+	unsigned char *buf;
+
+	if (posix_memalign((void **)&buf, PAGE, 2 * PAGE)) {
+		fprintf(stderr, "cannot allocate memory\n");
+		return 1;
+	}
+	memset(buf, 0, 2 * PAGE);
+
+	print_cpu();
+	for (int s = 0; s < sizeof(strategies) / sizeof(*strategies); ++s) {
+		print_matrix(buf, "loads", s, 0);
+		print_matrix(buf, "stores", s, 1);
+	}
+
+	free(buf);
+
+	return 0;
+}
@@ -0,0 +1,177 @@
+/**
+ * Benchmark for FPU sections: the SIMD memcpy(), memcmp() and memset() with
+ * FPU state save and restore on each call against the same operations run
+ * in one FPU section.
+ *
+ * Copyright (C) 2018 Alexander Krizhanovsky (ak@tempesta-tech.com).
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include "kstring.h"
+
+#define N	1024
+#define OPS	16
+volatile unsigned char a[N * 2] ____cacheline_aligned;
+volatile unsigned char b[N * 2] ____cacheline_aligned;
+volatile unsigned char c[N * 2] ____cacheline_aligned;
+volatile int len, r = 0;
+static KStrOp ops[OPS];
+static int iter = 10000000;
+module_param(iter, int, 0);
+
+/*
+ * A typical sequence of the operations on a message: copy some data, compare
+ * it with a key and zero a descriptor.
+ */
+#define PER_CALL_OPS(cp, cmp, set)					\
+	cp((void *)a, (void *)b, len);					\
+	r |= cmp((void *)a, (void *)b, len);				\
+	set((void *)c, 0, len);						\
+	cp((void *)c, (void *)a, len)
+
+static void
+init_ops(size_t n)
+{
+	int i;
+
+	for (i = 0; i < OPS; i += 4) {
+		ops[i] = (KStrOp){ KSTR_MEMCPY, (void *)a, (void *)b, n };
+		ops[i + 1] = (KStrOp){ KSTR_MEMCMP, (void *)a, (void *)b, n };
+		ops[i + 2] = (KStrOp){ KSTR_MEMSET, (void *)c, NULL, n };
+		ops[i + 3] = (KStrOp){ KSTR_MEMCPY, (void *)c, (void *)a, n };
+	}
+}
+
+#define mc_benchmark(name, n)						\
+do {									\
+	len = n;							\
+	init_ops(n);							\
+	pr_info("-------- %s --------\n", name);			\
+	__mc_benchmark("per-call", ({					\
+		PER_CALL_OPS(memcpy_avx_safe, memcmp_avx_safe,		\
+			     memset_avx_safe);				\
+		PER_CALL_OPS(memcpy_avx_safe, memcmp_avx_safe,		\
+			     memset_avx_safe);				\
+		PER_CALL_OPS(memcpy_avx_safe, memcmp_avx_safe,		\
+			     memset_avx_safe);				\
+		PER_CALL_OPS(memcpy_avx_safe, memcmp_avx_safe,		\
+			     memset_avx_safe);				\
+	}));								\
+	__mc_benchmark("section ", ({					\
+		kstr_fpu_begin();					\
+		PER_CALL_OPS(__memcpy_avx, __memcmp_avx, __memset_avx);	\
+		PER_CALL_OPS(__memcpy_avx, __memcmp_avx, __memset_avx);	\
+		PER_CALL_OPS(__memcpy_avx, __memcmp_avx, __memset_avx);	\
+		PER_CALL_OPS(__memcpy_avx, __memcmp_avx, __memset_avx);	\
+		kstr_fpu_end();						\
+	}));								\
+	__mc_benchmark("batch   ", ({					\
+		r |= kstr_batch(ops, OPS);				\
+	}));								\
+} while (0)
+
+static void
+init_arrays(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(a); ++i) {
+		a[i] = 0;
+		b[i] = (i & 0xff) ? : 0xa;
+		c[i] = (i & 0xff) ? : 0xa;
+	}
+}
+
+static void
+__mc_test(size_t off, size_t n)
+{
+	unsigned int i;
+	KStrOp t[] = {
+		{ KSTR_MEMCPY, (void *)&a[off], (void *)&b[off], n },
+		{ KSTR_MEMCMP, (void *)&a[off], (void *)&b[off], n },
+		{ KSTR_MEMSET, (void *)&c[off], NULL, n, 0x5a },
+		{ KSTR_MEMCMP, (void *)&a[off], (void *)&c[off], n + 1 },
+	};
+
+	init_arrays();
+
+	if (kstr_batch(t, 4) != 1 || t[1].r || t[3].r != 1)
+		pr_err("FAIL test/cmp %lu/%lu: r=%d/%d\n", off, n,
+		       t[1].r, t[3].r);
+
+	for (i = 0; i < sizeof(a); ++i) {
+		int in = i >= off && i < off + n;
+		unsigned char v = (i & 0xff) ? : 0xa;
+
+		if ((in && (a[i] != v || c[i] != 0x5a))
+		    || (!in && (a[i] || c[i] != v)))
+		{
+			pr_err("FAIL test %lu/%lu(last=%lu)"
+			       " at %d(%.2x): %.2x/%.2x\n",
+			       off, n, off + n, i, i,
+			       (unsigned char)a[i], (unsigned char)c[i]);
+			break;
+		}
+	}
+}
+
+static void
+mc_test(void)
+{
+	__mc_test(0, 0);
+	__mc_test(0, 1);
+	__mc_test(1, 1);
+	__mc_test(3, 7);
+	__mc_test(1, 8);
+	__mc_test(2, 13);
+	__mc_test(3, 17);
+	__mc_test(16, 30);
+	__mc_test(11, 32);
+	__mc_test(29, 49);
+	__mc_test(1, 63);
+	__mc_test(47, 64);
+	__mc_test(50, 79);
+	__mc_test(29, 127);
+	__mc_test(7, 128);
+	__mc_test(8, 250);
+	__mc_test(11, 383);
+}
+
+int
+kbatch_init(void)
+{
+	pr_info("START: batch of %d operations, iter=%d\n", OPS, iter);
+
+	mc_test();
+	init_arrays();
+
+	mc_benchmark("8", 8);
+	mc_benchmark("20", 20);
+	mc_benchmark("64", 64);
+	mc_benchmark("120", 120);
+	mc_benchmark("256", 256);
+	mc_benchmark("512", 512);
+	mc_benchmark("1500", 1500);
+
+	return -r - 1; /* don't leave the module in the kernel */
+}
+module_init(kbatch_init);
+
+void
+kbatch_exit(void)
+{
+	pr_info("kbatch unloaded\n");
+}
+module_exit(kbatch_exit);
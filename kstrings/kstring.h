@@ -2,6 +2,12 @@
  * SIMD Linux kernel analog of glibc's string.h plus several benchnark testing
  * routines and dummy functions.
  *
+ * The AVX routines can run only with saved FPU state. Save and restore of the
+ * FPU state are expensive, so the library provides FPU sections: the double
+ * underscored routines must be called inside kstr_fpu_begin() and
+ * kstr_fpu_end(), which can bracket any number of the calls, or run a batch
+ * of the operations in one section with kstr_batch().
+ *
  * Copyright (C) 2018 Alexander Krizhanovsky (ak@tempesta-tech.com).
  *
  * This program is free software; you can redistribute it and/or modify it
@@ -25,6 +31,7 @@
 #pragma GCC target("mmx", "sse4.2", "avx2")
 #include <asm/bitops.h>
 #include <asm/fpu/api.h>
+#include <linux/timex.h>
 #include <x86intrin.h>
 
 MODULE_LICENSE("GPL");
@@ -40,8 +47,6 @@ MODULE_LICENSE("GPL");
 #define pr_err	printf
 #define likely(e)	__builtin_expect((e), 1)
 #define unlikely(e)	__builtin_expect((e), 0)
-#define __kernel_fpu_begin_bh()
-#define __kernel_fpu_end_bh()
 #define preempt_enable()
 #define preempt_disable()
 #define local_bh_enable()
@@ -62,12 +67,734 @@ us_jiffies(void)
 	return ((unsigned long)t.tv_sec * 1000000 + t.tv_usec) / 1000;
 }
 #define jiffies	us_jiffies()
+#define get_cycles()	__rdtsc()
+#define noinline	__attribute__((__noinline__))
+#ifndef __always_inline
+#define __always_inline	inline __attribute__((__always_inline__))
+#endif
+#define barrier()	asm volatile("" : : : "memory")
+
+/*
+ * There is no FPU state to save for the user space, so emulate the kernel
+ * save and restore of the extended state to get comparable results.
+ * Save x87, SSE, AVX and AVX-512 states only: the kernel doesn't save AMX
+ * tiles for tasks which don't use them.
+ */
+static unsigned char __fpu_state[4096] __attribute__((__aligned__(64)));
+
+static inline void
+__kernel_fpu_begin_bh(void)
+{
+	asm volatile("xsave64 %0" : "=m"(__fpu_state) : "a"(0xff), "d"(0)
+		     : "memory");
+}
+
+static inline void
+__kernel_fpu_end_bh(void)
+{
+	asm volatile("xrstor64 %0" : : "m"(__fpu_state), "a"(0xff), "d"(0)
+		     : "memory");
+}
 #endif
 #ifdef in_serving_softirq
 #undef in_serving_softirq
 #endif
 #define in_serving_softirq()	(1)
 
+/*
+ * Copy and set larger data with non-temporal stores. Such data doesn't fit
+ * L2 cache anyway, so it's useless to keep it in the cache at the cost of
+ * eviction of all the hot data.
+ */
+#define KSTR_NT_THRESHOLD	(256 * 1024)
+
+static inline void
+kstr_fpu_begin(void)
+{
+	__kernel_fpu_begin_bh();
+}
+
+static inline void
+kstr_fpu_end(void)
+{
+	__kernel_fpu_end_bh();
+}
+
+static inline void
+__memcpy_avx_t(void *dst, const void *src, size_t n)
+{
+	__m256i *s256 = (__m256i *)src;
+	__m256i *d256 = (__m256i *)dst;
+	__m256i *end256 = (__m256i *)((unsigned char *)src + (n & ~0x1f));
+	__m128i *d128, *s128;
+	unsigned char *s, *d;
+
+	/*
+	 * Use unaligned load & store.
+	 * Use unlikely() to fall to th short data processing faster.
+	 */
+	for ( ; unlikely(s256 + 4 <= end256); ) {
+		__m256i v0 = _mm256_lddqu_si256(s256++);
+		__m256i v1 = _mm256_lddqu_si256(s256++);
+		__m256i v2 = _mm256_lddqu_si256(s256++);
+		__m256i v3 = _mm256_lddqu_si256(s256++);
+		_mm256_storeu_si256(d256++, v0);
+		_mm256_storeu_si256(d256++, v1);
+		_mm256_storeu_si256(d256++, v2);
+		_mm256_storeu_si256(d256++, v3);
+	}
+	if (unlikely(n & 0x40)) {
+		__m256i v0 = _mm256_lddqu_si256(s256++);
+		__m256i v1 = _mm256_lddqu_si256(s256++);
+		_mm256_storeu_si256(d256++, v0);
+		_mm256_storeu_si256(d256++, v1);
+	}
+	if (unlikely(n & 0x20)) {
+		__m256i v0 = _mm256_lddqu_si256(s256++);
+		_mm256_storeu_si256(d256++, v0);
+	}
+
+	s128 = (__m128i *)s256;
+	d128 = (__m128i *)d256;
+	if (unlikely(n & 0x10)) {
+		__m128i v0 = _mm_lddqu_si128(s128++);
+		_mm_storeu_si128(d128++, v0);
+	}
+
+	s = (unsigned char *)s128;
+	d = (unsigned char *)d128;
+	if (unlikely(n & 0x8)) {
+		*(long *)d = *(long *)s;
+		s += 8;
+		d += 8;
+	}
+	if (unlikely(n & 0x4)) {
+		*(int *)d = *(int *)s;
+		s += 4;
+		d += 4;
+	}
+	if (unlikely(n & 0x2)) {
+		*(short *)d = *(short *)s;
+		s += 2;
+		d += 2;
+	}
+	if (unlikely(n & 0x1))
+		*d = *s;
+}
+
+static inline int
+__memcmp16(const void *a, const void *b)
+{
+	__m128i v0 = _mm_lddqu_si128(a);
+	__m128i v1 = _mm_lddqu_si128(b);
+	__m128i eq = _mm_cmpeq_epi16(v0, v1);
+	unsigned int r = _mm_movemask_epi8(eq);
+
+	return r != 0xffffU;
+}
+
+static inline int
+__memcmp32(const void *a, const void *b)
+{
+	__m256i v0 = _mm256_lddqu_si256(a);
+	__m256i v1 = _mm256_lddqu_si256(b);
+	__m256i eq = _mm256_cmpeq_epi32(v0, v1);
+	unsigned int r = _mm256_movemask_epi8(eq);
+
+	return r != ~0U;
+}
+
+static inline int
+__memcmp64(const void *a, const void *b)
+{
+	int r = __memcmp32(a, b);
+	if (r)
+		return r;
+	return __memcmp32((const char *)a + 32, (const char *)b + 32);
+}
+
+static inline int
+__memcmp128(const void *a, const void *b)
+{
+	int r = __memcmp32(a, b);
+	if (r)
+		return r;
+	r = __memcmp32((const char *)a + 32, (const char *)b + 32);
+	if (r)
+		return r;
+	r = __memcmp32((const char *)a + 64, (const char *)b + 64);
+	if (r)
+		return r;
+	return __memcmp32((const char *)a + 96, (const char *)b + 96);
+}
+
+/**
+ * Non-optimistic memory comparison which expects non-matching byte at any
+ * position. Returns 0 if @a and @b equal and non-zero otherwise.
+ */
+static inline int
+__memcmp_avx(const void *a, const void *b, size_t n)
+{
+	int r;
+	const char *s0 = (const char *)a, *s1 = (const char *)b;
+	const char *end = (const char *)a + n;
+
+	/*
+	 * Use unaligned load & store.
+	 * Use unlikely() to fall to th short data processing faster.
+	 */
+	for ( ; unlikely(s0 + 128 <= end); s0 += 128, s1 += 128)
+		if ((r = __memcmp128(s0, s1)))
+			return r;
+	if (unlikely(n & 0x40)) {
+		if ((r = __memcmp64(s0, s1)))
+			return r;
+		s0 += 64;
+		s1 += 64;
+	}
+	if (unlikely(n & 0x20)) {
+		if ((r = __memcmp32(s0, s1)))
+			return r;
+		s0 += 32;
+		s1 += 32;
+	}
+	if (unlikely(n & 0x10)) {
+		if ((r = __memcmp16(s0, s1)))
+			return r;
+		s0 += 16;
+		s1 += 16;
+	}
+	if (unlikely(n & 0x8)) {
+		if (*(const long *)s0 != *(const long *)s1)
+			return 1;
+		s0 += 8;
+		s1 += 8;
+	}
+	if (unlikely(n & 0x4)) {
+		if (*(const int *)s0 != *(const int *)s1)
+			return 1;
+		s0 += 4;
+		s1 += 4;
+	}
+	if (unlikely(n & 0x2)) {
+		if (*(const short *)s0 != *(const short *)s1)
+			return 1;
+		s0 += 2;
+		s1 += 2;
+	}
+	if (unlikely(n & 0x1))
+		return *s0 != *s1;
+
+	return 0;
+}
+
+static inline void
+__memset_avx_t(void *s, int c, size_t n)
+{
+	__m256i *s256 = (__m256i *)s;
+	__m256i *end256 = (__m256i *)((unsigned char *)s + (n & ~0x7f));
+	__m128i *s128;
+	__m256i v256 = _mm256_set1_epi8(c);
+	__m128i v128 = _mm256_castsi256_si128(v256);
+	unsigned long v = 0x0101010101010101UL * (unsigned char)c;
+	unsigned char *p;
+
+	/*
+	 * Use unaligned store.
+	 * Use unlikely() to fall to th short data processing faster.
+	 */
+	for ( ; unlikely(s256 < end256); s256 += 4) {
+		_mm256_storeu_si256(s256, v256);
+		_mm256_storeu_si256(s256 + 1, v256);
+		_mm256_storeu_si256(s256 + 2, v256);
+		_mm256_storeu_si256(s256 + 3, v256);
+	}
+	if (unlikely(n & 0x40)) {
+		_mm256_storeu_si256(s256, v256);
+		_mm256_storeu_si256(s256 + 1, v256);
+		s256 += 2;
+	}
+	if (unlikely(n & 0x20))
+		_mm256_storeu_si256(s256++, v256);
+
+	s128 = (__m128i *)s256;
+	if (unlikely(n & 0x10))
+		_mm_storeu_si128(s128++, v128);
+
+	p = (unsigned char *)s128;
+	if (unlikely(n & 0x8)) {
+		*(long *)p = v;
+		p += 8;
+	}
+	if (unlikely(n & 0x4)) {
+		*(int *)p = v;
+		p += 4;
+	}
+	if (unlikely(n & 0x2)) {
+		*(short *)p = v;
+		p += 2;
+	}
+	if (unlikely(n & 0x1))
+		*p = v;
+}
+
+/**
+ * Copy with non-temporal stores bypassing the cache. The destination is
+ * aligned for the stores by one unaligned store of the first 32 bytes, the
+ * tail is copied with the usual stores. The call overhead is nothing in
+ * comparison with the copy, so don't bloat the callers.
+ */
+static noinline void
+__memcpy_avx_nt(void *dst, const void *src, size_t n)
+{
+	const unsigned char *s = (const unsigned char *)src;
+	unsigned char *d = (unsigned char *)dst;
+	size_t off;
+
+	if (unlikely(n < 256)) {
+		__memcpy_avx_t(dst, src, n);
+		return;
+	}
+
+	_mm256_storeu_si256((__m256i *)d, _mm256_lddqu_si256((__m256i *)s));
+	off = 32 - ((unsigned long)d & 0x1f);
+	s += off;
+	d += off;
+	n -= off;
+
+	for ( ; likely(n >= 128); s += 128, d += 128, n -= 128) {
+		__m256i v0 = _mm256_lddqu_si256((__m256i *)s);
+		__m256i v1 = _mm256_lddqu_si256((__m256i *)s + 1);
+		__m256i v2 = _mm256_lddqu_si256((__m256i *)s + 2);
+		__m256i v3 = _mm256_lddqu_si256((__m256i *)s + 3);
+		_mm256_stream_si256((__m256i *)d, v0);
+		_mm256_stream_si256((__m256i *)d + 1, v1);
+		_mm256_stream_si256((__m256i *)d + 2, v2);
+		_mm256_stream_si256((__m256i *)d + 3, v3);
+	}
+	/* Order the weakly-ordered stores before any following stores. */
+	_mm_sfence();
+
+	__memcpy_avx_t(d, s, n);
+}
+
+static noinline void
+__memset_avx_nt(void *s, int c, size_t n)
+{
+	unsigned char *p = (unsigned char *)s;
+	__m256i v = _mm256_set1_epi8(c);
+	size_t off;
+
+	if (unlikely(n < 256)) {
+		__memset_avx_t(s, c, n);
+		return;
+	}
+
+	_mm256_storeu_si256((__m256i *)p, v);
+	off = 32 - ((unsigned long)p & 0x1f);
+	p += off;
+	n -= off;
+
+	for ( ; likely(n >= 128); p += 128, n -= 128) {
+		_mm256_stream_si256((__m256i *)p, v);
+		_mm256_stream_si256((__m256i *)p + 1, v);
+		_mm256_stream_si256((__m256i *)p + 2, v);
+		_mm256_stream_si256((__m256i *)p + 3, v);
+	}
+	_mm_sfence();
+
+	__memset_avx_t(p, c, n);
+}
+
+static inline void
+__memcpy_avx(void *dst, const void *src, size_t n)
+{
+	if (unlikely(n >= KSTR_NT_THRESHOLD))
+		__memcpy_avx_nt(dst, src, n);
+	else
+		__memcpy_avx_t(dst, src, n);
+}
+
+static inline void
+__memset_avx(void *s, int c, size_t n)
+{
+	if (unlikely(n >= KSTR_NT_THRESHOLD))
+		__memset_avx_nt(s, c, n);
+	else
+		__memset_avx_t(s, c, n);
+}
+
+/*
+ * Copy the first and the last @w bytes of @n, 2 * @w >= @n >= @w, so the
+ * copies may overlap.
+ */
+#define __MEMCPY_2X(w, t)						\
+static __always_inline void						\
+__memcpy_2x##w(void *dst, const void *src, size_t n)			\
+{									\
+	t v0 = *(const t *)src;						\
+	t v1 = *(const t *)((const char *)src + n - w);			\
+	*(t *)dst = v0;							\
+	*(t *)((char *)dst + n - w) = v1;				\
+}
+
+__MEMCPY_2X(1, unsigned char)
+__MEMCPY_2X(2, short)
+__MEMCPY_2X(4, int)
+__MEMCPY_2X(8, long)
+
+static __always_inline void
+__memcpy_2x16(void *dst, const void *src, size_t n)
+{
+	__m128i v0 = _mm_lddqu_si128((const __m128i *)src);
+	__m128i v1 = _mm_lddqu_si128((const __m128i *)((const char *)src
+							+ n - 16));
+	_mm_storeu_si128((__m128i *)dst, v0);
+	_mm_storeu_si128((__m128i *)((char *)dst + n - 16), v1);
+}
+
+static __always_inline void
+__memcpy_2x32(void *dst, const void *src, size_t n)
+{
+	__m256i v0 = _mm256_lddqu_si256((const __m256i *)src);
+	__m256i v1 = _mm256_lddqu_si256((const __m256i *)((const char *)src
+							   + n - 32));
+	_mm256_storeu_si256((__m256i *)dst, v0);
+	_mm256_storeu_si256((__m256i *)((char *)dst + n - 32), v1);
+}
+
+/**
+ * Copy up to 64 bytes with at most two overlapping loads and stores. If @n is
+ * a compile-time constant, then the code is straight-line.
+ */
+static __always_inline void
+__memcpy_small(void *dst, const void *src, size_t n)
+{
+	if (n >= 32)
+		__memcpy_2x32(dst, src, n);
+	else if (n >= 16)
+		__memcpy_2x16(dst, src, n);
+	else if (n >= 8)
+		__memcpy_2x8(dst, src, n);
+	else if (n >= 4)
+		__memcpy_2x4(dst, src, n);
+	else if (n >= 2)
+		__memcpy_2x2(dst, src, n);
+	else if (n)
+		__memcpy_2x1(dst, src, n);
+}
+
+/**
+ * The same as __memcpy_small(), but for sizes known at run time only: one
+ * indirect jump through the table instead of the chain of comparisons.
+ */
+static inline void
+__memcpy_small_jt(void *dst, const void *src, size_t n)
+{
+	switch (n) {
+	case 0:
+		break;
+	case 1:
+		__memcpy_2x1(dst, src, n);
+		break;
+	case 2 ... 3:
+		__memcpy_2x2(dst, src, n);
+		break;
+	case 4 ... 7:
+		__memcpy_2x4(dst, src, n);
+		break;
+	case 8 ... 15:
+		__memcpy_2x8(dst, src, n);
+		break;
+	case 16 ... 31:
+		__memcpy_2x16(dst, src, n);
+		break;
+	case 32 ... 64:
+		__memcpy_2x32(dst, src, n);
+		break;
+	}
+}
+
+/**
+ * Compare up to 64 bytes for equality with at most two overlapping loads of
+ * each operand. Returns 0 if @a and @b equal and non-zero otherwise.
+ */
+static __always_inline int
+__memcmp_small(const void *a, const void *b, size_t n)
+{
+	const char *s0 = (const char *)a, *s1 = (const char *)b;
+
+	if (n >= 32) {
+		__m256i v0 = _mm256_xor_si256(
+			_mm256_lddqu_si256((const __m256i *)s0),
+			_mm256_lddqu_si256((const __m256i *)s1));
+		__m256i v1 = _mm256_xor_si256(
+			_mm256_lddqu_si256((const __m256i *)(s0 + n - 32)),
+			_mm256_lddqu_si256((const __m256i *)(s1 + n - 32)));
+		v0 = _mm256_or_si256(v0, v1);
+		return !_mm256_testz_si256(v0, v0);
+	}
+	if (n >= 16) {
+		__m128i v0 = _mm_xor_si128(
+			_mm_lddqu_si128((const __m128i *)s0),
+			_mm_lddqu_si128((const __m128i *)s1));
+		__m128i v1 = _mm_xor_si128(
+			_mm_lddqu_si128((const __m128i *)(s0 + n - 16)),
+			_mm_lddqu_si128((const __m128i *)(s1 + n - 16)));
+		v0 = _mm_or_si128(v0, v1);
+		return !_mm_testz_si128(v0, v0);
+	}
+	if (n >= 8)
+		return !!((*(const long *)s0 ^ *(const long *)s1)
+			  | (*(const long *)(s0 + n - 8)
+			     ^ *(const long *)(s1 + n - 8)));
+	if (n >= 4)
+		return !!((*(const int *)s0 ^ *(const int *)s1)
+			  | (*(const int *)(s0 + n - 4)
+			     ^ *(const int *)(s1 + n - 4)));
+	if (n >= 2)
+		return !!((*(const short *)s0 ^ *(const short *)s1)
+			  | (*(const short *)(s0 + n - 2)
+			     ^ *(const short *)(s1 + n - 2)));
+	if (n)
+		return *s0 != *s1;
+
+	return 0;
+}
+
+/**
+ * Equality-only comparison: OR the XOR-ed vectors of the operands and test
+ * the accumulated vector once per 128 bytes, so there is no branch per vector
+ * and no search for the different byte. The last vectors overlap with the
+ * previous ones, so @n must be larger than 64.
+ */
+static inline int
+__memcmp_eq_avx(const void *a, const void *b, size_t n)
+{
+	const char *s0 = (const char *)a, *s1 = (const char *)b;
+	const char *end = s0 + n;
+	__m256i acc = _mm256_setzero_si256();
+
+	for ( ; s0 + 128 <= end; s0 += 128, s1 += 128) {
+		__m256i v0 = _mm256_xor_si256(
+			_mm256_lddqu_si256((const __m256i *)s0),
+			_mm256_lddqu_si256((const __m256i *)s1));
+		__m256i v1 = _mm256_xor_si256(
+			_mm256_lddqu_si256((const __m256i *)(s0 + 32)),
+			_mm256_lddqu_si256((const __m256i *)(s1 + 32)));
+		__m256i v2 = _mm256_xor_si256(
+			_mm256_lddqu_si256((const __m256i *)(s0 + 64)),
+			_mm256_lddqu_si256((const __m256i *)(s1 + 64)));
+		__m256i v3 = _mm256_xor_si256(
+			_mm256_lddqu_si256((const __m256i *)(s0 + 96)),
+			_mm256_lddqu_si256((const __m256i *)(s1 + 96)));
+		acc = _mm256_or_si256(_mm256_or_si256(v0, v1),
+				      _mm256_or_si256(v2, v3));
+		if (!_mm256_testz_si256(acc, acc))
+			return 1;
+	}
+	for ( ; s0 + 32 < end; s0 += 32, s1 += 32)
+		acc = _mm256_or_si256(acc, _mm256_xor_si256(
+			_mm256_lddqu_si256((const __m256i *)s0),
+			_mm256_lddqu_si256((const __m256i *)s1)));
+	s1 += end - 32 - s0;
+	s0 = end - 32;
+	acc = _mm256_or_si256(acc, _mm256_xor_si256(
+		_mm256_lddqu_si256((const __m256i *)s0),
+		_mm256_lddqu_si256((const __m256i *)s1)));
+
+	return !_mm256_testz_si256(acc, acc);
+}
+
+/**
+ * Returns 0 if @a and @b equal and non-zero otherwise.
+ */
+static __always_inline int
+__memcmp_eq(const void *a, const void *b, size_t n)
+{
+	if (n <= 64)
+		return __memcmp_small(a, b, n);
+	return __memcmp_eq_avx(a, b, n);
+}
+
+/*
+ * Size dispatching front ends for the FPU sections: compile-time constant
+ * and short sizes don't go to the loops at all.
+ */
+static __always_inline void
+__memcpy_fast(void *dst, const void *src, size_t n)
+{
+	if (__builtin_constant_p(n) && n <= 64)
+		__memcpy_small(dst, src, n);
+	else if (n <= 64)
+		__memcpy_small_jt(dst, src, n);
+	else
+		__memcpy_avx(dst, src, n);
+}
+
+static __always_inline int
+__memcmp_fast(const void *a, const void *b, size_t n)
+{
+	if (n <= 64)
+		return __memcmp_small(a, b, n);
+	return __memcmp_avx(a, b, n);
+}
+
+/*
+ * We can't use SIMD without FPU state saving, which is expensive so
+ * just fall back to the plain routines out of the softirq context,
+ * where the FPU state is saved once per softirq shot.
+ */
+static inline void
+memcpy_avx(void *dst, const void *src, size_t n)
+{
+	if (unlikely(!in_serving_softirq())) {
+		memcpy(dst, src, n);
+		return;
+	}
+	__memcpy_avx(dst, src, n);
+}
+
+static inline int
+memcmp_avx(const void *a, const void *b, size_t n)
+{
+	if (unlikely(!in_serving_softirq()))
+		return !!memcmp(a, b, n);
+	return __memcmp_avx(a, b, n);
+}
+
+static inline void
+memset_avx(void *s, int c, size_t n)
+{
+	if (unlikely(!in_serving_softirq())) {
+		memset(s, c, n);
+		return;
+	}
+	__memset_avx(s, c, n);
+}
+
+static __always_inline void
+memcpy_fast(void *dst, const void *src, size_t n)
+{
+	if (unlikely(!in_serving_softirq())) {
+		memcpy(dst, src, n);
+		return;
+	}
+	__memcpy_fast(dst, src, n);
+}
+
+static __always_inline int
+memcmp_fast(const void *a, const void *b, size_t n)
+{
+	if (unlikely(!in_serving_softirq()))
+		return !!memcmp(a, b, n);
+	return __memcmp_fast(a, b, n);
+}
+
+static __always_inline int
+memcmp_eq(const void *a, const void *b, size_t n)
+{
+	if (unlikely(!in_serving_softirq()))
+		return !!memcmp(a, b, n);
+	return __memcmp_eq(a, b, n);
+}
+
+static inline void
+bzero_avx(void *s, size_t n)
+{
+	memset_avx(s, 0, n);
+}
+
+/*
+ * The routines saving FPU state on each call in any context. About 10 times
+ * slower than the routines above for short data, use FPU sections to amortize
+ * the cost.
+ */
+static inline void
+memcpy_avx_safe(void *dst, const void *src, size_t n)
+{
+	kstr_fpu_begin();
+	__memcpy_avx(dst, src, n);
+	kstr_fpu_end();
+}
+
+static inline int
+memcmp_avx_safe(const void *a, const void *b, size_t n)
+{
+	int r;
+
+	kstr_fpu_begin();
+	r = __memcmp_avx(a, b, n);
+	kstr_fpu_end();
+
+	return r;
+}
+
+static inline void
+memset_avx_safe(void *s, int c, size_t n)
+{
+	kstr_fpu_begin();
+	__memset_avx(s, c, n);
+	kstr_fpu_end();
+}
+
+enum {
+	KSTR_MEMCPY,
+	KSTR_MEMCMP,
+	KSTR_MEMSET,
+};
+
+/**
+ * An operation of kstr_batch().
+ *
+ * @op	- KSTR_MEMCPY, KSTR_MEMCMP or KSTR_MEMSET;
+ * @dst	- destination for memcpy and memset or the first memcmp operand;
+ * @src	- source for memcpy or the second memcmp operand;
+ * @n	- number of bytes to process;
+ * @c	- memset byte value;
+ * @r	- memcmp result, 0 if the operands equal and non-zero otherwise;
+ */
+typedef struct {
+	int		op;
+	void		*dst;
+	const void	*src;
+	size_t		n;
+	int		c;
+	int		r;
+} KStrOp;
+
+/**
+ * Run @n operations from @ops in one FPU section.
+ * Returns non-zero if any of the memcmp operations found different data.
+ */
+static inline int
+kstr_batch(KStrOp *ops, unsigned int n)
+{
+	unsigned int i;
+	int r = 0;
+
+	kstr_fpu_begin();
+	for (i = 0; i < n; ++i) {
+		KStrOp *o = &ops[i];
+
+		switch (o->op) {
+		case KSTR_MEMCPY:
+			__memcpy_fast(o->dst, o->src, o->n);
+			break;
+		case KSTR_MEMCMP:
+			o->r = __memcmp_fast(o->dst, o->src, o->n);
+			r |= o->r;
+			break;
+		case KSTR_MEMSET:
+			__memset_avx(o->dst, o->c, o->n);
+			break;
+		}
+	}
+	kstr_fpu_end();
+
+	return r;
+}
+
 static inline void
 avoid_rcu_stall(void)
 {
@@ -91,3 +818,52 @@ do {									\
 	avoid_rcu_stall();						\
 	pr_info(name ":    %ld\n", t1 - t0);				\
 } while (0)
+
+/* Hot data of a workload running after large memory copies or sets. */
+#define HOT_SZ		(128 * 1024)
+#define HOT_LINES	(HOT_SZ / 64)
+#define BW_BYTES	(1L << 30)
+
+/*
+ * Read each cache line of @hot once in a scattered order, so the hardware
+ * prefetcher doesn't hide the misses.
+ */
+static inline void
+hot_walk(volatile unsigned char *hot)
+{
+	unsigned int i;
+
+	for (i = 0; i < HOT_LINES; ++i)
+		(void)hot[((i * 1031) & (HOT_LINES - 1)) * 64];
+}
+
+/**
+ * Measure bandwidth of @code processing @n bytes and cache pollution from
+ * it: the average time in cycles of the walk over @hot data, fitting L2
+ * cache, right after @code.
+ */
+#define	__bw_benchmark(name, n, hot, code)				\
+do {									\
+	int i, it = BW_BYTES / (n);					\
+	long t1, t0;							\
+	unsigned long c, hot_c = 0;					\
+	local_bh_disable();						\
+	preempt_disable();						\
+	t0 = jiffies;							\
+	for (i = 0; i < it; ++i) {					\
+		code;							\
+	}								\
+	t1 = jiffies;							\
+	for (i = 0; i < it; ++i) {					\
+		hot_walk(hot);						\
+		code;							\
+		c = get_cycles();					\
+		hot_walk(hot);						\
+		hot_c += get_cycles() - c;				\
+	}								\
+	preempt_enable();						\
+	local_bh_enable();						\
+	avoid_rcu_stall();						\
+	pr_info(name ":    %ld ms, %ld MB/s, hot walk %lu cycles\n",	\
+		t1 - t0, BW_BYTES / 1000 / (t1 - t0 ? : 1), hot_c / it);\
+} while (0)
@@ -30,119 +30,6 @@ volatile int len, r = 0;
 static int iter = 10000000;
 module_param(iter, int, 0);
 
-static inline int
-__memcmp16(const void *a, const void *b)
-{
-	__m128i v0 = _mm_lddqu_si128(a);
-	__m128i v1 = _mm_lddqu_si128(b);
-	__m128i eq = _mm_cmpeq_epi16(v0, v1);
-	unsigned int r = _mm_movemask_epi8(eq);
-
-	return r != 0xffffU;
-}
-
-static inline int
-__memcmp32(const void *a, const void *b)
-{
-	__m256i v0 = _mm256_lddqu_si256(a);
-	__m256i v1 = _mm256_lddqu_si256(b);
-	__m256i eq = _mm256_cmpeq_epi32(v0, v1);
-	unsigned int r = _mm256_movemask_epi8(eq);
-
-	return r != ~0U;
-}
-
-static inline int
-__memcmp64(const void *a, const void *b)
-{
-	int r = __memcmp32(a, b);
-	if (r)
-		return r;
-	return __memcmp32((const char *)a + 32, (const char *)b + 32);
-}
-
-static inline int
-__memcmp128(const void *a, const void *b)
-{
-	int r = __memcmp32(a, b);
-	if (r)
-		return r;
-	r = __memcmp32((const char *)a + 32, (const char *)b + 32);
-	if (r)
-		return r;
-	r = __memcmp32((const char *)a + 64, (const char *)b + 64);
-	if (r)
-		return r;
-	return __memcmp32((const char *)a + 96, (const char *)b + 96);
-}
-
-/**
- * Non-optimistic memory comparison which expects non-matching byte at any
- * position. Returns 0 if @a and @b equal and non-zero otherwise.
- */
-static inline int
-memcmp_avx(const void *a, const void *b, size_t n)
-{
-	int r;
-	const char *s0 = (const char *)a, *s1 = (const char *)b;
-	const char *end = (const char *)a + n;
-
-	/*
-	 * We can't use SIMD without FPU state saving, which is expensivem so
-	 * just fall back to plain memcmp().
-	 */
-	if (unlikely(!in_serving_softirq()))
-		return !!memcmp(a, b, n);
-
-	/*
-	 * Use unaligned load & store.
-	 * Use unlikely() to fall to th short data processing faster.
-	 */
-	for ( ; unlikely(s0 + 128 <= end); s0 += 128, s1 += 128)
-		if ((r = __memcmp128(s0, s1)))
-			return r;
-	if (unlikely(n & 0x40)) {
-		if ((r = __memcmp64(s0, s1)))
-			return r;
-		s0 += 64;
-		s1 += 64;
-	}
-	if (unlikely(n & 0x20)) {
-		if ((r = __memcmp32(s0, s1)))
-			return r;
-		s0 += 32;
-		s1 += 32;
-	}
-	if (unlikely(n & 0x10)) {
-		if ((r = __memcmp16(s0, s1)))
-			return r;
-		s0 += 16;
-		s1 += 16;
-	}
-	if (unlikely(n & 0x8)) {
-		if (*(const long *)s0 != *(const long *)s1)
-			return 1;
-		s0 += 8;
-		s1 += 8;
-	}
-	if (unlikely(n & 0x4)) {
-		if (*(const int *)s0 != *(const int *)s1)
-			return 1;
-		s0 += 4;
-		s1 += 4;
-	}
-	if (unlikely(n & 0x2)) {
-		if (*(const short *)s0 != *(const short *)s1)
-			return 1;
-		s0 += 2;
-		s1 += 2;
-	}
-	if (unlikely(n & 0x1))
-		return *s0 != *s1;
-
-	return 0;
-}
-
 #define mc_benchmark(name, fn, n)					\
 len = n;								\
 __mc_benchmark(name, ({							\
@@ -165,6 +52,40 @@ __mc_benchmark(name, ({							\
 	r |= fn((void *)a, (void *)b, len) | fn((void *)a, (void *)b, len);\
 }))
 
+#define mc_benchmark_const(name, fn, n)					\
+__mc_benchmark(name, ({							\
+	r |= fn((void *)a, (void *)b, n) | fn((void *)a, (void *)b, n);	\
+	barrier();							\
+	r |= fn((void *)a, (void *)b, n) | fn((void *)a, (void *)b, n);	\
+	barrier();							\
+	r |= fn((void *)a, (void *)b, n) | fn((void *)a, (void *)b, n);	\
+	barrier();							\
+	r |= fn((void *)a, (void *)b, n) | fn((void *)a, (void *)b, n);	\
+	barrier();							\
+	r |= fn((void *)a, (void *)b, n) | fn((void *)a, (void *)b, n);	\
+	barrier();							\
+	r |= fn((void *)a, (void *)b, n) | fn((void *)a, (void *)b, n);	\
+	barrier();							\
+	r |= fn((void *)a, (void *)b, n) | fn((void *)a, (void *)b, n);	\
+	barrier();							\
+	r |= fn((void *)a, (void *)b, n) | fn((void *)a, (void *)b, n);	\
+	barrier();							\
+}))
+
+/* Run @bench for each size bucket of the short comparisons. */
+#define mc_benchmark_small(bench, fn)					\
+do {									\
+	bench("1       ", fn, 1);					\
+	bench("3       ", fn, 3);					\
+	bench("7       ", fn, 7);					\
+	bench("8       ", fn, 8);					\
+	bench("15      ", fn, 15);					\
+	bench("20      ", fn, 20);					\
+	bench("32      ", fn, 32);					\
+	bench("48      ", fn, 48);					\
+	bench("64      ", fn, 64);					\
+} while (0)
+
 static void
 init_arrays(void)
 {
@@ -177,26 +98,45 @@ init_arrays(void)
 }
 
 static void
-__mc_test(size_t off, size_t n)
+__mc_test_fn(int (*fn)(const void *, const void *, size_t), const char *name,
+	     size_t off, size_t n)
 {
 	int r0, r1;
 
 	init_arrays();
 
 	/* Test for equal. */
-	r0 = memcmp_avx((const void *)&a[off], (const void *)&b[off], n);
+	r0 = fn((const void *)&a[off], (const void *)&b[off], n);
 	r1 = !!memcmp((const void *)&a[off], (const void *)&b[off], n);
 	if (r0 != r1)
-		pr_err("FAIL test/eq %lu/%lu: memcmp_avx=%d memcmp=%d\n",
-			off, n, r0, r1);
+		pr_err("FAIL test/eq %lu/%lu: %s=%d memcmp=%d\n",
+			off, n, name, r0, r1);
+
+	/* Test for different first byte. */
+	if (n) {
+		++a[off];
+		r0 = fn((const void *)&a[off], (const void *)&b[off], n);
+		if (r0 != 1)
+			pr_err("FAIL test/neq0 %lu/%lu: %s=%d\n",
+			       off, n, name, r0);
+		--a[off];
+	}
 
 	/* Test for different data. */
 	++a[off + n++];
-	r0 = memcmp_avx((const void *)&a[off], (const void *)&b[off], n);
+	r0 = fn((const void *)&a[off], (const void *)&b[off], n);
 	r1 = !!memcmp((const void *)&a[off], (const void *)&b[off], n);
 	if (r0 != r1)
-		pr_err("FAIL test/neq %lu/%lu: memcmp_avx=%d memcmp=%d\n",
-			off, n, r0, r1);
+		pr_err("FAIL test/neq %lu/%lu: %s=%d memcmp=%d\n",
+			off, n, name, r0, r1);
+}
+
+static void
+__mc_test(size_t off, size_t n)
+{
+	__mc_test_fn(memcmp_avx, "memcmp_avx", off, n);
+	__mc_test_fn(memcmp_fast, "memcmp_fast", off, n);
+	__mc_test_fn(memcmp_eq, "memcmp_eq", off, n);
 }
 
 static void
@@ -299,6 +239,42 @@ kmemcmp_init(void)
 	mc_benchmark("850     ", memcmp_avx, 850);
 	mc_benchmark8("1500    ", memcmp_avx, 1500);
 
+	pr_info("-------- memcmp_eq() --------\n");
+	__mc_benchmark("ua      ", ({
+		r |= memcmp_eq((void *)a, (void *)b, N);
+		r |= memcmp_eq((void *)(&a[i & 0x1]), (void *)(&b[i & 0x1]), N - 1);
+		r |= memcmp_eq((void *)(&a[i & 0x3]), (void *)(&b[i & 0x3]), N - 3);
+		r |= memcmp_eq((void *)(&a[i & 0x7]), (void *)(&b[i & 0x7]), N - 7);
+		r |= memcmp_eq((void *)(&a[i & 0xf]), (void *)(&b[i & 0xf]), N - 15);
+		r |= memcmp_eq((void *)(&a[i & 0x1f]), (void *)(&b[i & 0x1f]), N - 31);
+		r |= memcmp_eq((void *)(&a[i & 0x3f]), (void *)(&b[i & 0x3f]), N - 63);
+		r |= memcmp_eq((void *)(&a[i & 0x7f]), (void *)(&b[i & 0x7f]), N - 127);
+	}));
+	mc_benchmark("8       ", memcmp_eq, 8);
+	mc_benchmark("20      ", memcmp_eq, 20);
+	mc_benchmark("64      ", memcmp_eq, 64);
+	mc_benchmark("120     ", memcmp_eq, 120);
+	mc_benchmark("256     ", memcmp_eq, 256);
+	mc_benchmark("320     ", memcmp_eq, 320);
+	mc_benchmark("512     ", memcmp_eq, 512);
+	mc_benchmark("850     ", memcmp_eq, 850);
+	mc_benchmark8("1500    ", memcmp_eq, 1500);
+
+	pr_info("-------- small memcmp() --------\n");
+	mc_benchmark_small(mc_benchmark, memcmp);
+	pr_info("-------- small memcmp_AVX() --------\n");
+	mc_benchmark_small(mc_benchmark, memcmp_avx);
+	pr_info("-------- small memcmp_fast() --------\n");
+	mc_benchmark_small(mc_benchmark, memcmp_fast);
+	pr_info("-------- small memcmp_eq() --------\n");
+	mc_benchmark_small(mc_benchmark, memcmp_eq);
+	pr_info("-------- small memcmp() constant --------\n");
+	mc_benchmark_small(mc_benchmark_const, memcmp);
+	pr_info("-------- small memcmp_AVX() constant --------\n");
+	mc_benchmark_small(mc_benchmark_const, memcmp_avx);
+	pr_info("-------- small memcmp_fast() constant --------\n");
+	mc_benchmark_small(mc_benchmark_const, memcmp_fast);
+
 	return -r - 1; /* don't leave the module in the kernel */
 }
 module_init(kmemcmp_init);
@@ -24,83 +24,16 @@
 #include "kstring.h"
 
 #define N	1024
+#define BIG_N	(4 * 1024 * 1024)
 volatile unsigned char in[N * 2] ____cacheline_aligned;
 volatile unsigned char out[N * 2] ____cacheline_aligned;
 volatile int len;
+volatile unsigned char hot[HOT_SZ] ____cacheline_aligned;
+volatile unsigned char big_in[BIG_N] ____cacheline_aligned;
+volatile unsigned char big_out[BIG_N] ____cacheline_aligned;
 static int iter = 10000000;
 module_param(iter, int, 0);
 
-static inline void
-memcpy_avx(void *dst, void *src, size_t n)
-{
-	__m256i *s256 = (__m256i *)src;
-	__m256i *d256 = (__m256i *)dst;
-	__m256i *end256 = (__m256i *)((unsigned char *)src + (n & ~0x1f));
-	__m128i *d128, *s128;
-	unsigned char *s, *d;
-
-	/*
-	 * We can't use SIMD without FPU state saving, which is expensive so
-	 * just fall back to plain memcpy().
-	 */
-	if (unlikely(!in_serving_softirq())) {
-		memcpy(dst, src, n);
-		return;
-	}
-
-	/*
-	 * Use unaligned load & store.
-	 * Use unlikely() to fall to th short data processing faster.
-	 */
-	for ( ; unlikely(s256 + 4 <= end256); ) {
-		__m256i v0 = _mm256_lddqu_si256(s256++);
-		__m256i v1 = _mm256_lddqu_si256(s256++);
-		__m256i v2 = _mm256_lddqu_si256(s256++);
-		__m256i v3 = _mm256_lddqu_si256(s256++);
-		_mm256_storeu_si256(d256++, v0);
-		_mm256_storeu_si256(d256++, v1);
-		_mm256_storeu_si256(d256++, v2);
-		_mm256_storeu_si256(d256++, v3);
-	}
-	if (unlikely(n & 0x40)) {
-		__m256i v0 = _mm256_lddqu_si256(s256++);
-		__m256i v1 = _mm256_lddqu_si256(s256++);
-		_mm256_storeu_si256(d256++, v0);
-		_mm256_storeu_si256(d256++, v1);
-	}
-	if (unlikely(n & 0x20)) {
-		__m256i v0 = _mm256_lddqu_si256(s256++);
-		_mm256_storeu_si256(d256++, v0);
-	}
-
-	s128 = (__m128i *)s256;
-	d128 = (__m128i *)d256;
-	if (unlikely(n & 0x10)) {
-		__m128i v0 = _mm_lddqu_si128(s128++);
-		_mm_storeu_si128(d128++, v0);
-	}
-
-	s = (unsigned char *)s128;
-	d = (unsigned char *)d128;
-	if (unlikely(n & 0x8)) {
-		*(long *)d = *(long *)s;
-		s += 8;
-		d += 8;
-	}
-	if (unlikely(n & 0x4)) {
-		*(int *)d = *(int *)s;
-		s += 4;
-		d += 4;
-	}
-	if (unlikely(n & 0x2)) {
-		*(short *)d = *(short *)s;
-		s += 2;
-		d += 2;
-	}
-	if (unlikely(n & 0x1))
-		*d = *s;
-}
-
 static inline void
 memcpy_avx_opta(void *dst, void *src, size_t n)
 {
@@ -178,21 +111,6 @@ memcpy_avx_opta(void *dst, void *src, size_t n)
 		*d = *s;
 }
 
-/**
- * About 10 times slower than memcpy_avx(), i.e. save/restore FPU state is
- * quite expensive - we're right that do this once per softirq shot.
- * The second consequence is that AVX, as well as other SIMD-based,
- * implementations for memcpy() and the family have no sense in general
- * for the kernel.
- */
-static inline void
-memcpy_avx_safe(void *dst, void *src, size_t n)
-{
-	__kernel_fpu_begin_bh();
-	memcpy_avx(dst, src, n);
-	__kernel_fpu_end_bh();
-}
-
 static inline void
 memcpy_avx_a(void *dst, void *src, size_t n)
 {
@@ -314,8 +232,49 @@ __mc_benchmark(name, ({							\
 	fn((void *)&in[19], (void *)&out[23], len);			\
 }))
 
+/*
+ * The compiler generates code for the static sizes, don't allow it to merge
+ * the same copies.
+ */
+#define mc_benchmark_const(name, fn, n)					\
+__mc_benchmark(name, ({							\
+	fn((void *)in, (void *)out, n); barrier();			\
+	fn((void *)in, (void *)out, n); barrier();			\
+	fn((void *)in, (void *)out, n); barrier();			\
+	fn((void *)in, (void *)out, n); barrier();			\
+	fn((void *)in, (void *)out, n); barrier();			\
+	fn((void *)in, (void *)out, n); barrier();			\
+	fn((void *)in, (void *)out, n); barrier();			\
+	fn((void *)in, (void *)out, n); barrier();			\
+	fn((void *)in, (void *)out, n); barrier();			\
+	fn((void *)in, (void *)out, n); barrier();			\
+	fn((void *)in, (void *)out, n); barrier();			\
+	fn((void *)in, (void *)out, n); barrier();			\
+	fn((void *)in, (void *)out, n); barrier();			\
+	fn((void *)in, (void *)out, n); barrier();			\
+	fn((void *)in, (void *)out, n); barrier();			\
+	fn((void *)in, (void *)out, n); barrier();			\
+}))
+
+/* Run @bench for each size bucket of the small copies. */
+#define mc_benchmark_small(bench, fn)					\
+do {									\
+	bench("1       ", fn, 1);					\
+	bench("3       ", fn, 3);					\
+	bench("7       ", fn, 7);					\
+	bench("8       ", fn, 8);					\
+	bench("15      ", fn, 15);					\
+	bench("20      ", fn, 20);					\
+	bench("32      ", fn, 32);					\
+	bench("48      ", fn, 48);					\
+	bench("64      ", fn, 64);					\
+} while (0)
+
+#define bw_benchmark(name, fn, n)					\
+	__bw_benchmark(name, n, hot, fn((void *)big_in, (void *)big_out, n))
+
 static void
-__mc_test(size_t off, size_t n)
+__mc_test_fn(void (*fn)(void *, const void *, size_t), size_t off, size_t n)
 {
 	unsigned int i;
 
@@ -323,7 +282,7 @@ __mc_test(size_t off, size_t n)
 	for (i = 0; i < sizeof(out); ++i)
 		out[i] = (i & 0xff) ? : 0xa;
 
-	memcpy_avx((void *)&in[off], (void *)&out[off], n);
+	fn((void *)&in[off], (void *)&out[off], n);
 
 	for (i = 0; i < sizeof(in); ++i)
 		if ((i >= off && i < off + n && in[i] != ((i & 0xff) ? : 0xa))
@@ -334,6 +293,42 @@ __mc_test(size_t off, size_t n)
 			       i, i, &in[i], (unsigned char)(in[i]));
 }
 
+static void
+__mc_test(size_t off, size_t n)
+{
+	__mc_test_fn(memcpy_avx, off, n);
+	__mc_test_fn(memcpy_fast, off, n);
+	kstr_fpu_begin();
+	__mc_test_fn(__memcpy_avx_nt, off, n);
+	kstr_fpu_end();
+}
+
+#define __mc_test_const(n)						\
+do {									\
+	unsigned char d0[64] = { 0 }, d1[64] = { 0 };			\
+	__memcpy_small(d0, (void *)&out[n], n);				\
+	memcpy(d1, (void *)&out[n], n);					\
+	if (memcmp(d0, d1, sizeof(d0)))					\
+		pr_err("FAIL test/const %d\n", n);			\
+} while (0)
+
+static void
+mc_test_const(void)
+{
+	__mc_test_const(1);
+	__mc_test_const(2);
+	__mc_test_const(3);
+	__mc_test_const(5);
+	__mc_test_const(8);
+	__mc_test_const(13);
+	__mc_test_const(16);
+	__mc_test_const(17);
+	__mc_test_const(31);
+	__mc_test_const(32);
+	__mc_test_const(33);
+	__mc_test_const(64);
+}
+
 static void
 mc_test(void)
 {
@@ -381,6 +376,9 @@ mc_test(void)
 	__mc_test(7, 128);
 	__mc_test(8, 250);
 	__mc_test(11, 383);
+	__mc_test(5, 1000);
+	__mc_test(31, 1500);
+	mc_test_const();
 }
 
 int
@@ -508,6 +506,37 @@ kmemcpy_init(void)
 	mc_benchmark_ua("850     ", memcpy_avx_opta, 850);
 	mc_benchmark8_ua("1500    ", memcpy_avx_opta, 1500);
 
+	pr_info("-------- small memcpy() --------\n");
+	mc_benchmark_small(mc_benchmark, memcpy);
+	pr_info("-------- small memcpy_AVX() --------\n");
+	mc_benchmark_small(mc_benchmark, memcpy_avx);
+	pr_info("-------- small memcpy_fast() --------\n");
+	mc_benchmark_small(mc_benchmark, memcpy_fast);
+	pr_info("-------- small memcpy() constant --------\n");
+	mc_benchmark_small(mc_benchmark_const, memcpy);
+	pr_info("-------- small memcpy_AVX() constant --------\n");
+	mc_benchmark_small(mc_benchmark_const, memcpy_avx);
+	pr_info("-------- small memcpy_fast() constant --------\n");
+	mc_benchmark_small(mc_benchmark_const, memcpy_fast);
+
+	pr_info("-------- large memcpy() --------\n");
+	bw_benchmark("64K     ", memcpy, 64 * 1024);
+	bw_benchmark("256K    ", memcpy, 256 * 1024);
+	bw_benchmark("1M      ", memcpy, 1024 * 1024);
+	bw_benchmark("4M      ", memcpy, 4 * 1024 * 1024);
+
+	pr_info("-------- large memcpy_AVX() --------\n");
+	bw_benchmark("64K     ", __memcpy_avx_t, 64 * 1024);
+	bw_benchmark("256K    ", __memcpy_avx_t, 256 * 1024);
+	bw_benchmark("1M      ", __memcpy_avx_t, 1024 * 1024);
+	bw_benchmark("4M      ", __memcpy_avx_t, 4 * 1024 * 1024);
+
+	pr_info("-------- large memcpy_AVX() non-temporal --------\n");
+	bw_benchmark("64K     ", __memcpy_avx_nt, 64 * 1024);
+	bw_benchmark("256K    ", __memcpy_avx_nt, 256 * 1024);
+	bw_benchmark("1M      ", __memcpy_avx_nt, 1024 * 1024);
+	bw_benchmark("4M      ", __memcpy_avx_nt, 4 * 1024 * 1024);
+
 	return -1; /* don't leave the module in the kernel */
 }
 module_init(kmemcpy_init);
@@ -26,69 +26,14 @@
 #endif
 
 #define N	1024
+#define BIG_N	(4 * 1024 * 1024)
 volatile unsigned char in[N * 2] ____cacheline_aligned;
 volatile int len;
+volatile unsigned char hot[HOT_SZ] ____cacheline_aligned;
+volatile unsigned char big[BIG_N] ____cacheline_aligned;
 static int iter = 10000000;
 module_param(iter, int, 0);
 
-static inline void
-bzero_avx(void *s, size_t n)
-{
-	__m256i *s256 = (__m256i *)s;
-	__m256i *end256 = (__m256i *)((unsigned char *)s + (n & ~0x7f));
-	__m128i *s128;
-	__m256i z256 = _mm256_setzero_si256();
-	__m128i z128 = _mm_setzero_si128();
-	unsigned char *c;
-
-	/*
-	 * We can't use SIMD without FPU state saving, which is expensive so
-	 * just fall back to plain bzero().
-	 */
-	if (unlikely(!in_serving_softirq())) {
-		memset(s, 0, n);
-		return;
-	}
-
-	/*
-	 * Use unaligned store.
-	 * Use unlikely() to fall to th short data processing faster.
-	 */
-	for ( ; unlikely(s256 < end256); s256 += 4) {
-		_mm256_storeu_si256(s256, z256);
-		_mm256_storeu_si256(s256 + 1, z256);
-		_mm256_storeu_si256(s256 + 2, z256);
-		_mm256_storeu_si256(s256 + 3, z256);
-	}
-	if (unlikely(n & 0x40)) {
-		_mm256_storeu_si256(s256, z256);
-		_mm256_storeu_si256(s256 + 1, z256);
-		s256 += 2;
-	}
-	if (unlikely(n & 0x20))
-		_mm256_storeu_si256(s256++, z256);
-
-	s128 = (__m128i *)s256;
-	if (unlikely(n & 0x10))
-		_mm_storeu_si128(s128++, z128);
-
-	c = (unsigned char *)s128;
-	if (unlikely(n & 0x8)) {
-		*(long *)c = 0;
-		c += 8;
-	}
-	if (unlikely(n & 0x4)) {
-		*(int *)c = 0;
-		c += 4;
-	}
-	if (unlikely(n & 0x2)) {
-		*(short *)c = 0;
-		c += 2;
-	}
-	if (unlikely(n & 0x1))
-		*c = 0;
-}
-
 #define mc_benchmark(name, fn, n)					\
 len = n;								\
 __mc_benchmark(name, ({							\
@@ -111,15 +56,26 @@ __mc_benchmark(name, ({							\
 	fn((void *)in, len); fn((void *)in, len);			\
 }))
 
+#define bw_benchmark(name, fn, n)					\
+	__bw_benchmark(name, n, hot, fn((void *)big, 0, n))
+
 static void
-__mc_test(size_t off, size_t n)
+__bzero_avx_nt(void *s, size_t n)
+{
+	kstr_fpu_begin();
+	__memset_avx_nt(s, 0, n);
+	kstr_fpu_end();
+}
+
+static void
+__mc_test_fn(void (*fn)(void *, size_t), size_t off, size_t n)
 {
 	unsigned int i;
 
 	for (i = 0; i < sizeof(in); ++i)
 		in[i] = (i & 0xff) ? : 0xa;
 
-	bzero_avx((void *)&in[off], n);
+	fn((void *)&in[off], n);
 
 	for (i = 0; i < sizeof(in); ++i)
 		if ((i >= off && i < off + n && in[i])
@@ -130,6 +86,13 @@ __mc_test(size_t off, size_t n)
 			       i, i, &in[i], (unsigned char)(in[i]));
 }
 
+static void
+__mc_test(size_t off, size_t n)
+{
+	__mc_test_fn(bzero_avx, off, n);
+	__mc_test_fn(__bzero_avx_nt, off, n);
+}
+
 static void
 mc_test(void)
 {
@@ -177,6 +140,8 @@ mc_test(void)
 	__mc_test(7, 128);
 	__mc_test(8, 250);
 	__mc_test(11, 383);
+	__mc_test(5, 1000);
+	__mc_test(31, 1500);
 }
 
 int
@@ -229,6 +194,24 @@ kmemset_init(void)
 	mc_benchmark("850     ", bzero_avx, 850);
 	mc_benchmark8("1500    ", bzero_avx, 1500);
 
+	pr_info("-------- large memset() --------\n");
+	bw_benchmark("64K     ", memset, 64 * 1024);
+	bw_benchmark("256K    ", memset, 256 * 1024);
+	bw_benchmark("1M      ", memset, 1024 * 1024);
+	bw_benchmark("4M      ", memset, 4 * 1024 * 1024);
+
+	pr_info("-------- large memset_AVX() --------\n");
+	bw_benchmark("64K     ", __memset_avx_t, 64 * 1024);
+	bw_benchmark("256K    ", __memset_avx_t, 256 * 1024);
+	bw_benchmark("1M      ", __memset_avx_t, 1024 * 1024);
+	bw_benchmark("4M      ", __memset_avx_t, 4 * 1024 * 1024);
+
+	pr_info("-------- large memset_AVX() non-temporal --------\n");
+	bw_benchmark("64K     ", __memset_avx_nt, 64 * 1024);
+	bw_benchmark("256K    ", __memset_avx_nt, 256 * 1024);
+	bw_benchmark("1M      ", __memset_avx_nt, 1024 * 1024);
+	bw_benchmark("4M      ", __memset_avx_nt, 4 * 1024 * 1024);
+
 	return -1; /* don't leave the module in the kernel */
 }
 module_init(kmemset_init);
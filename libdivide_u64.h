@@ -0,0 +1,234 @@
+/**
+ * Unsigned 64-bit division by a divisor known at init time, e.g. from the
+ * configuration: WFQ stream weights, the number of hash shards and so on.
+ * The division code borrowed from libdivide
+ * https://github.com/ridiculousfish/libdivide
+ *
+ * There is no sense for a compile-time specialization: the compiler
+ * already replaces the division by a constant with the same multiplication
+ * and shifts.
+ *
+ * The code is distributed under libdivide license.
+ */
+#ifndef __LIBDIVIDE_U64_H__
+#define __LIBDIVIDE_U64_H__
+
+#include <assert.h>
+#include <stdint.h>
+
+#define LIBDIVIDE_ADD_MARKER		0x40
+#define LIBDIVIDE_64_SHIFT_MASK		0x3F
+
+struct libdivide_u64_t {
+	uint64_t magic;
+	uint8_t more;
+};
+
+// The branchfree divisor can't be 1.
+struct libdivide_u64_branchfree_t {
+	uint64_t magic;
+	uint8_t more;
+};
+
+static inline uint32_t libdivide_mullhi_u32(uint32_t x, uint32_t y)
+{
+	uint64_t xl = x, yl = y;
+	uint64_t rl = xl * yl;
+	return (uint32_t)(rl >> 32);
+}
+
+static inline uint64_t libdivide_mullhi_u64(uint64_t x, uint64_t y)
+{
+#if defined(__SIZEOF_INT128__)
+	// we go here, not sure about kernel
+	__uint128_t xl = x, yl = y;
+	__uint128_t rl = xl * yl;
+	return (uint64_t)(rl >> 64);
+#else
+	// full 128 bits are x0 * y0 + (x0 * y1 << 32) + (x1 * y0 << 32) + (x1 * y1 << 64)
+	uint32_t mask = 0xFFFFFFFF;
+	uint32_t x0 = (uint32_t)(x & mask);
+	uint32_t x1 = (uint32_t)(x >> 32);
+	uint32_t y0 = (uint32_t)(y & mask);
+	uint32_t y1 = (uint32_t)(y >> 32);
+	uint32_t x0y0_hi = libdivide_mullhi_u32(x0, y0);
+	uint64_t x0y1 = x0 * (uint64_t)y1;
+	uint64_t x1y0 = x1 * (uint64_t)y0;
+	uint64_t x1y1 = x1 * (uint64_t)y1;
+	uint64_t temp = x1y0 + x0y0_hi;
+	uint64_t temp_lo = temp & mask;
+	uint64_t temp_hi = temp >> 32;
+
+	return x1y1 + temp_hi + ((temp_lo + x0y1) >> 32);
+#endif
+}
+
+static inline uint64_t
+libdivide_u64_do(uint64_t numer, const struct libdivide_u64_t *denom)
+{
+	uint8_t more = denom->more;
+
+	// Code from libdivide_u64_gen
+
+	if (!denom->magic) {
+		return numer >> more;
+	}
+	else {
+		uint64_t q = libdivide_mullhi_u64(denom->magic, numer);
+		if (more & LIBDIVIDE_ADD_MARKER) {
+			uint64_t t = ((numer - q) >> 1) + q;
+			return t >> (more & LIBDIVIDE_64_SHIFT_MASK);
+		}
+		else {
+			 // All upper bits are 0,
+			 // don't need to mask them off.
+			return q >> more;
+		}
+	}
+}
+
+// libdivide_128_div_64_to_64: divides a 128-bit uint {u1, u0} by a 64-bit
+// uint {v}. The result must fit in 64 bits.
+// Returns the quotient directly and the remainder in *r
+static inline uint64_t
+libdivide_128_div_64_to_64(uint64_t u1, uint64_t u0, uint64_t v, uint64_t *r)
+{
+	uint64_t result;
+#if defined(LIBDIVIDE_X86_64) && \
+	defined(LIBDIVIDE_GCC_STYLE_ASM)
+	__asm__("divq %[v]"
+			: "=a"(result), "=d"(*r)
+			: [v] "r"(v), "a"(u0), "d"(u1)
+			);
+#elif defined(__SIZEOF_INT128__)
+	__uint128_t n = ((__uint128_t)u1 << 64) | u0;
+	result = (uint64_t)(n / v);
+	*r = (uint64_t)(n - result * (__uint128_t)v);
+#else
+#error slow platform
+#endif
+	return result;
+}
+
+static inline struct libdivide_u64_t
+libdivide_internal_u64_gen(uint64_t d, int branchfree)
+{
+	assert(d);
+
+	struct libdivide_u64_t result;
+	uint32_t floor_log_2_d = 63 - __builtin_clzll(d); // we have similar in kernel
+
+	// Power of 2
+	if ((d & (d - 1)) == 0) {
+		// The branchfree algorithm always makes the shift by 1 before
+		// the final shift.
+		result.magic = 0;
+		result.more = (uint8_t)(floor_log_2_d - !!branchfree);
+	} else {
+		uint64_t proposed_m, rem;
+		uint8_t more;
+		// (1 << (64 + floor_log_2_d)) / d
+		proposed_m = libdivide_128_div_64_to_64(1ULL << floor_log_2_d, 0, d, &rem);
+
+		assert(rem > 0 && rem < d);
+		const uint64_t e = d - rem;
+
+		// This power works if e < 2**floor_log_2_d.
+		if (!branchfree && e < (1ULL << floor_log_2_d)) {
+			// This power works
+			more = floor_log_2_d;
+		} else {
+			// We have to use the general 65-bit algorithm.  We need to compute
+			// (2**power) / d. However, we already have (2**(power-1))/d and
+			// its remainder. By doubling both, and then correcting the
+			// remainder, we can compute the larger division.
+			// don't care about overflow here - in fact, we expect it
+			proposed_m += proposed_m;
+			const uint64_t twice_rem = rem + rem;
+			if (twice_rem >= d || twice_rem < rem) proposed_m += 1;
+				more = floor_log_2_d | LIBDIVIDE_ADD_MARKER;
+		}
+		result.magic = 1 + proposed_m;
+		result.more = more;
+		// result.more's shift should in general be ceil_log_2_d. But if we
+		// used the smaller power, we subtract one from the shift because we're
+		// using the smaller power. If we're using the larger power, we
+		// subtract one from the shift because it's taken care of by the add
+		// indicator. So floor_log_2_d happens to be correct in both cases,
+		// which is why we do it outside of the if statement.
+	}
+	return result;
+}
+
+static inline struct libdivide_u64_t
+libdivide_u64_gen(uint64_t d)
+{
+	return libdivide_internal_u64_gen(d, 0);
+}
+
+static inline struct libdivide_u64_branchfree_t
+libdivide_u64_branchfree_gen(uint64_t d)
+{
+	assert(d != 1);
+
+	struct libdivide_u64_t tmp = libdivide_internal_u64_gen(d, 1);
+	struct libdivide_u64_branchfree_t ret = {
+		tmp.magic, (uint8_t)(tmp.more & LIBDIVIDE_64_SHIFT_MASK)
+	};
+
+	return ret;
+}
+
+static inline uint64_t
+libdivide_u64_branchfree_do(uint64_t numer,
+			    const struct libdivide_u64_branchfree_t *denom)
+{
+	uint64_t q = libdivide_mullhi_u64(denom->magic, numer);
+	uint64_t t = ((numer - q) >> 1) + q;
+
+	return t >> denom->more;
+}
+
+#ifdef __cplusplus
+/**
+ * The divisor object for C++ code.
+ */
+class LibdivideU64 {
+public:
+	explicit LibdivideU64(uint64_t d = 1)
+		: d_(d), den_(libdivide_u64_gen(d))
+	{}
+
+	uint64_t
+	div(uint64_t n) const
+	{
+		return libdivide_u64_do(n, &den_);
+	}
+
+	uint64_t
+	mod(uint64_t n) const
+	{
+		return n - div(n) * d_;
+	}
+
+	uint64_t divisor() const { return d_; }
+
+private:
+	uint64_t		d_;
+	libdivide_u64_t		den_;
+};
+
+static inline uint64_t
+operator/(uint64_t n, const LibdivideU64 &d)
+{
+	return d.div(n);
+}
+
+static inline uint64_t
+operator%(uint64_t n, const LibdivideU64 &d)
+{
+	return d.mod(n);
+}
+#endif
+
+#endif /* __LIBDIVIDE_U64_H__ */
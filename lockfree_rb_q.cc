@@ -3,12 +3,15 @@
  * performance and verification tests.
  *
  * Build with (g++ version must be >= 4.5.0):
- * $ g++ -Wall -std=c++0x -Wl,--no-as-needed -O2 -D DCACHE1_LINESIZE=`getconf LEVEL1_DCACHE_LINESIZE` lockfree_rb_q.cc -lpthread
+ * $ g++ -Wall -std=c++0x -Wl,--no-as-needed -O2 -D DCACHE1_LINESIZE=`getconf LEVEL1_DCACHE_LINESIZE` lockfree_rb_q.cc -lpthread -lm
  *
  * I verified the program with g++ 4.5.3, 4.6.1, 4.6.3 and 4.8.1.
  *
  * Use -std=c++11 instead of -std=c++0x for g++ 4.8.
  *
+ * Run with --latency to print only the end-to-end latency percentiles table
+ * for the queues, the threads numbers and the CPU placements.
+ *
  * Copyright (C) 2012-2013 Alexander Krizhanovsky (ak@tempesta-tech.com).
  *
  * This program is free software; you can redistribute it and/or modify it
@@ -36,21 +39,38 @@
 #endif
 #define ____cacheline_aligned	__attribute__((aligned(DCACHE1_LINESIZE)))
 
-#include <sys/time.h>
+#include <linux/futex.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <limits.h>
 #include <malloc.h>
 #include <string.h>
 #include <unistd.h>
 #include <immintrin.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <condition_variable>
 #include <mutex>
+#include <new>
 #include <thread>
+#include <vector>
+
+#include "bench.h"
 
 #define QUEUE_SIZE	(32 * 1024)
+#define BYTE_QUEUE_SIZE	(4 * 1024 * 1024)
 
 /*
  * ------------------------------------------------------------------------
@@ -101,6 +121,40 @@ public:
 		return x;
 	}
 
+	/*
+	 * Batch versions of push() and pop(). Waiters may wait for different
+	 * numbers of slots, so all of them are woken up.
+	 */
+	void
+	push_n(T **x, size_t n)
+	{
+		std::unique_lock<std::mutex> lock(mtx_);
+
+		cond_overflow_.wait(lock, [this, n]() {
+					return tail_ + Q_SIZE >= head_ + n;
+				});
+
+		for (size_t i = 0; i < n; ++i)
+			ptr_array_[head_++ & Q_MASK] = x[i];
+
+		cond_empty_.notify_all();
+	}
+
+	void
+	pop_n(T **x, size_t n)
+	{
+		std::unique_lock<std::mutex> lock(mtx_);
+
+		cond_empty_.wait(lock, [this, n]() {
+					return tail_ + n <= head_;
+				});
+
+		for (size_t i = 0; i < n; ++i)
+			x[i] = ptr_array_[tail_++ & Q_MASK];
+
+		cond_overflow_.notify_all();
+	}
+
 private:
 	unsigned long		head_, tail_;
 	std::condition_variable	cond_empty_;
@@ -135,6 +189,24 @@ public:
 		return x;
 	}
 
+	/*
+	 * Boost queue has no bulk operations, so the batches still cost
+	 * a CAS per item.
+	 */
+	void
+	push_n(T **x, size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+			push(x[i]);
+	}
+
+	void
+	pop_n(T **x, size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+			x[i] = pop();
+	}
+
 private:
 	boost::lockfree::queue<T *, boost::lockfree::capacity<Q_SIZE>> q_;
 };
@@ -179,21 +251,222 @@ set_thr_id(size_t id)
 	__thr_id = id;
 }
 
+/**
+ * Compact set of the active producers or consumers of a queue.
+ *
+ * The threads take the lowest free IDs, so the scans of the thread positions
+ * visit only the live threads in a few bitmap words.
+ */
+class ThrSet {
+	static const size_t MAX = 256;
+	static const size_t BITS = sizeof(unsigned long) * 8;
+
+public:
+	ThrSet(size_t n, bool all)
+		: n_(n)
+	{
+		assert(n <= MAX);
+		::memset(mask_, 0, sizeof(mask_));
+		if (all)
+			for (size_t i = 0; i < n; ++i)
+				mask_[i / BITS] |= 1UL << (i % BITS);
+	}
+
+	/**
+	 * @return the lowest free ID or -1 if all the @n_ IDs are in use.
+	 */
+	long
+	add()
+	{
+		for (size_t w = 0; w * BITS < n_; ) {
+			unsigned long m = *(volatile unsigned long *)&mask_[w];
+			if (!~m) {
+				++w;
+				continue;
+			}
+			size_t id = w * BITS + __builtin_ctzl(~m);
+			if (id >= n_)
+				break;
+			if (__sync_bool_compare_and_swap(&mask_[w], m,
+							 m | (1UL << (id % BITS))))
+				return id;
+		}
+		return -1;
+	}
+
+	void
+	del(size_t id)
+	{
+		assert(id < n_);
+		__sync_fetch_and_and(&mask_[id / BITS], ~(1UL << (id % BITS)));
+	}
+
+	template<class F>
+	void
+	for_each(F &&f) const
+	{
+		for (size_t w = 0; w * BITS < n_; ++w)
+			for (unsigned long m = *(volatile unsigned long *)&mask_[w];
+			     m; m &= m - 1)
+				f(w * BITS + __builtin_ctzl(m));
+	}
+
+private:
+	const size_t	n_;
+	unsigned long	mask_[MAX / BITS];
+};
+
+/*
+ * Wait strategies for consumers of an empty LockFreeQueue.
+ *
+ * wait() is called on each iteration @iter of the consumer waiting loop and
+ * @can_park() tells whether the consumer may sleep, i.e. no producer has
+ * reserved the awaited slot yet. Producers call wake() after each push.
+ */
+
+/**
+ * Busy spinning: the lowest wakeup latency by the cost of a whole core.
+ */
+struct BusyWait {
+	template<class F>
+	void
+	wait(unsigned long iter, F &&can_park)
+	{}
+
+	void
+	wake()
+	{}
+};
+
+/**
+ * Spinning with PAUSE instruction to save power and don't steal the execution
+ * resources from the SMT sibling.
+ */
+struct PauseWait {
+	template<class F>
+	void
+	wait(unsigned long iter, F &&can_park)
+	{
+		_mm_pause();
+	}
+
+	void
+	wake()
+	{}
+};
+
+/**
+ * Spin for a while and then park the consumer on a futex.
+ *
+ * A producer reserving the awaited slot increments the queue head by a locked
+ * instruction and reads @parked_ after it, while a consumer increments
+ * @parked_ by a locked instruction and checks the head after it. So either
+ * the consumer sees the reservation and keeps spinning since the producer is
+ * about to publish the slot, or the producer sees the parked consumer and wakes
+ * it up after the publishing. If there are no parked consumers, the wakeup
+ * costs only a read of a rarely modified cache line.
+ */
+class FutexWait {
+	static const unsigned long SPIN_N = 1024;
+
+public:
+	FutexWait()
+		: seq_(0), parked_(0)
+	{}
+
+	template<class F>
+	void
+	wait(unsigned long iter, F &&can_park)
+	{
+		if (iter < SPIN_N) {
+			_mm_pause();
+			return;
+		}
+
+		int seq = *(volatile int *)&seq_;
+		__sync_fetch_and_add(&parked_, 1);
+		if (can_park())
+			syscall(SYS_futex, &seq_, FUTEX_WAIT_PRIVATE, seq,
+				NULL, NULL, 0);
+		__sync_fetch_and_sub(&parked_, 1);
+	}
+
+	void
+	wake()
+	{
+		if (__builtin_expect(!*(volatile int *)&parked_, 1))
+			return;
+		__sync_fetch_and_add(&seq_, 1);
+		syscall(SYS_futex, &seq_, FUTEX_WAKE_PRIVATE, INT_MAX,
+			NULL, NULL, 0);
+	}
+
+private:
+	int	seq_ ____cacheline_aligned;
+	int	parked_;
+};
+
+/*
+ * Slots of LockFreeQueue.
+ *
+ * PtrSlot stores a pointer to a message, so the message must be allocated and
+ * the consumer pays a pointer chase for it.
+ *
+ * ValSlot stores a small message in-place in a cache line cell, so there are
+ * no allocations and the consumers read the ring sequentially. Different
+ * cells are different cache lines, so the concurrent producers and consumers
+ * of the neighbour slots don't false share.
+ */
+template<class T>
+struct PtrSlot {
+	typedef T *value_type;
+
+	T	*v;
+};
+
+template<class T>
+struct ValSlot {
+	static_assert(sizeof(T) <= DCACHE1_LINESIZE,
+		      "the message doesn't fit a cache line cell");
+
+	typedef T value_type;
+
+	T	v ____cacheline_aligned;
+};
+
+/*
+ * The consumers wait for an empty queue using the @Wait strategy, the producers
+ * always spin on a full queue. The queue stores the items of
+ * Slot::value_type type.
+ */
 template<class T,
 	decltype(thr_id) ThrId = thr_id,
-	unsigned long Q_SIZE = QUEUE_SIZE>
+	unsigned long Q_SIZE = QUEUE_SIZE,
+	class Wait = PauseWait,
+	class Slot = PtrSlot<T>>
 class LockFreeQueue {
 private:
 	static const unsigned long Q_MASK = Q_SIZE - 1;
 
+	typedef typename Slot::value_type V;
+
 	struct ThrPos {
 		unsigned long head, tail;
 	};
 
 public:
-	LockFreeQueue(size_t n_producers, size_t n_consumers)
+	/*
+	 * The queue is for up to @n_producers producers and @n_consumers
+	 * consumers. If @dynamic is false, then all of them are active and
+	 * set their IDs by set_thr_id(). Otherwise the threads register
+	 * and unregister on the fly.
+	 */
+	LockFreeQueue(size_t n_producers, size_t n_consumers,
+		      bool dynamic = false)
 		: n_producers_(n_producers),
 		n_consumers_(n_consumers),
+		producers_(n_producers, !dynamic),
+		consumers_(n_consumers, !dynamic),
 		head_(0),
 		tail_(0),
 		last_head_(0),
@@ -205,14 +478,14 @@ public:
 		// Set per thread tail and head to ULONG_MAX.
 		::memset((void *)thr_p_, 0xFF, sizeof(ThrPos) * n);
 
-		ptr_array_ = (T **)::memalign(getpagesize(),
-				Q_SIZE * sizeof(void *));
-		assert(ptr_array_);
+		slots_ = (Slot *)::memalign(getpagesize(),
+				Q_SIZE * sizeof(Slot));
+		assert(slots_);
 	}
 
 	~LockFreeQueue()
 	{
-		::free(ptr_array_);
+		::free(slots_);
 		::free(thr_p_);
 	}
 
@@ -223,8 +496,50 @@ public:
 		return thr_p_[ThrId()];
 	}
 
+	/**
+	 * Register the current thread as a producer with the lowest free
+	 * producer ID. The ID is set by set_thr_id(), so a thread can be
+	 * registered with only one queue at a time if the queue uses the
+	 * default thr_id().
+	 * @return the ID or -1 if there are too many producers.
+	 */
+	long
+	register_producer()
+	{
+		long id = producers_.add();
+		if (id >= 0)
+			set_thr_id(id);
+		return id;
+	}
+
+	void
+	unregister_producer()
+	{
+		assert(thr_pos().head == ULONG_MAX);
+		producers_.del(ThrId());
+	}
+
+	/**
+	 * The same as register_producer(), but for consumers.
+	 */
+	long
+	register_consumer()
+	{
+		long id = consumers_.add();
+		if (id >= 0)
+			set_thr_id(id);
+		return id;
+	}
+
+	void
+	unregister_consumer()
+	{
+		assert(thr_pos().tail == ULONG_MAX);
+		consumers_.del(ThrId());
+	}
+
 	void
-	push(T *ptr)
+	push(const V &ptr)
 	{
 		ThrPos& tp = thr_pos();
 		/*
@@ -253,32 +568,21 @@ public:
 		 */
 		while (__builtin_expect(tp.head >= last_tail_ + Q_SIZE, 0))
 		{
-			auto min = tail_;
-
-			// Update the last_tail_.
-			for (size_t i = 0; i < n_consumers_; ++i) {
-				auto tmp_t = thr_p_[i].tail;
-
-				// Force compiler to use tmp_h exactly once.
-				asm volatile("" ::: "memory");
-
-				if (tmp_t < min)
-					min = tmp_t;
-			}
-			last_tail_ = min;
+			last_tail_ = min_tail();
 
 			if (tp.head < last_tail_ + Q_SIZE)
 				break;
 			_mm_pause();
 		}
 
-		ptr_array_[tp.head & Q_MASK] = ptr;
+		slots_[tp.head & Q_MASK].v = ptr;
 
 		// Allow consumers eat the item.
 		tp.head = ULONG_MAX;
+		wait_.wake();
 	}
 
-	T *
+	V
 	pop()
 	{
 		assert(ThrId() < std::max(n_consumers_, n_producers_));
@@ -294,46 +598,184 @@ public:
 		tp.tail = __sync_fetch_and_add(&tail_, 1);
 
 		/*
-		 * tid'th place in ptr_array_ is reserved by the thread -
+		 * tid'th place in slots_ is reserved by the thread -
 		 * this place shall never be rewritten by push() and
 		 * last_tail_ at push() is a guarantee.
 		 * last_head_ guaraties that no any consumer eats the item
 		 * before producer reserved the position writes to it.
 		 */
-		while (__builtin_expect(tp.tail >= last_head_, 0))
+		for (unsigned long iter = 0;
+		     __builtin_expect(tp.tail >= last_head_, 0); ++iter)
 		{
-			auto min = head_;
+			last_head_ = min_head();
 
-			// Update the last_head_.
-			for (size_t i = 0; i < n_producers_; ++i) {
-				auto tmp_h = thr_p_[i].head;
+			if (tp.tail < last_head_)
+				break;
+			wait_.wait(iter, [this, &tp]() {
+				return *(volatile unsigned long *)&head_
+				       <= tp.tail;
+			});
+		}
 
-				// Force compiler to use tmp_h exactly once.
-				asm volatile("" ::: "memory");
+		V ret = slots_[tp.tail & Q_MASK].v;
+		// Allow producers rewrite the slot.
+		tp.tail = ULONG_MAX;
+		return ret;
+	}
 
-				if (tmp_h < min)
-					min = tmp_h;
+	/**
+	 * Non-blocking pop(): take the tail by CAS only if the item is already
+	 * pushed, so the tail is never reserved for an empty slot.
+	 * @return false if the queue is empty.
+	 */
+	bool
+	try_pop(V &v)
+	{
+		ThrPos& tp = thr_pos();
+		unsigned long t;
+
+		for ( ; ; ) {
+			/*
+			 * If the tail moves on before our position is visible
+			 * to the producers, then the slot may be rewritten,
+			 * but the CAS fails.
+			 */
+			t = tp.tail = *(volatile unsigned long *)&tail_;
+			if (t >= last_head_) {
+				last_head_ = min_head();
+				if (t >= last_head_) {
+					tp.tail = ULONG_MAX;
+					return false;
+				}
 			}
-			last_head_ = min;
+			if (__sync_bool_compare_and_swap(&tail_, t, t + 1))
+				break;
+		}
 
-			if (tp.tail < last_head_)
+		v = slots_[t & Q_MASK].v;
+		tp.tail = ULONG_MAX;
+		return true;
+	}
+
+	/**
+	 * Push @n items from @ptrs at once.
+	 *
+	 * The same as push(), but reserves @n contiguous slots by one atomic
+	 * operation. The thread head is the first reserved slot, so consumers
+	 * don't pass it until all the slots are written.
+	 */
+	void
+	push_n(const V *ptrs, size_t n)
+	{
+		assert(n && n <= Q_SIZE);
+		ThrPos& tp = thr_pos();
+
+		tp.head = head_;
+		tp.head = __sync_fetch_and_add(&head_, n);
+
+		// Wait until the last reserved slot is consumed.
+		while (__builtin_expect(tp.head + n > last_tail_ + Q_SIZE, 0))
+		{
+			last_tail_ = min_tail();
+
+			if (tp.head + n <= last_tail_ + Q_SIZE)
 				break;
 			_mm_pause();
 		}
 
-		T *ret = ptr_array_[tp.tail & Q_MASK];
-		// Allow producers rewrite the slot.
+		for (size_t i = 0; i < n; ++i)
+			slots_[(tp.head + i) & Q_MASK].v = ptrs[i];
+
+		tp.head = ULONG_MAX;
+		wait_.wake();
+	}
+
+	/**
+	 * Pop @n items to @ptrs at once, see push_n().
+	 * The caller must know that at least @n items will be pushed.
+	 */
+	void
+	pop_n(V *ptrs, size_t n)
+	{
+		assert(n && n <= Q_SIZE);
+		ThrPos& tp = thr_pos();
+
+		tp.tail = tail_;
+		tp.tail = __sync_fetch_and_add(&tail_, n);
+
+		// Wait until all the producers write the reserved slots.
+		for (unsigned long iter = 0;
+		     __builtin_expect(tp.tail + n > last_head_, 0); ++iter)
+		{
+			last_head_ = min_head();
+
+			if (tp.tail + n <= last_head_)
+				break;
+			wait_.wait(iter, [this, &tp, n]() {
+				return *(volatile unsigned long *)&head_
+				       < tp.tail + n;
+			});
+		}
+
+		for (size_t i = 0; i < n; ++i)
+			ptrs[i] = slots_[(tp.tail + i) & Q_MASK].v;
+
 		tp.tail = ULONG_MAX;
-		return ret;
 	}
 
 private:
+	/*
+	 * The lowest positions of the active consumers and producers.
+	 * A thread position is ULONG_MAX out of push() and pop(), so idle
+	 * threads don't hold back the ring. A newly registered thread can be
+	 * missed, but its position isn't lower than the tail or head read
+	 * before the scan.
+	 */
+	unsigned long
+	min_tail() const
+	{
+		auto min = tail_;
+
+		consumers_.for_each([this, &min](size_t i) {
+			auto tmp_t = thr_p_[i].tail;
+
+			// Force compiler to use tmp_t exactly once.
+			asm volatile("" ::: "memory");
+
+			if (tmp_t < min)
+				min = tmp_t;
+		});
+
+		return min;
+	}
+
+	unsigned long
+	min_head() const
+	{
+		auto min = head_;
+
+		producers_.for_each([this, &min](size_t i) {
+			auto tmp_h = thr_p_[i].head;
+
+			// Force compiler to use tmp_h exactly once.
+			asm volatile("" ::: "memory");
+
+			if (tmp_h < min)
+				min = tmp_h;
+		});
+
+		return min;
+	}
+
 	/*
 	 * The most hot members are cacheline aligned to avoid
 	 * False Sharing.
 	 */
 
 	const size_t n_producers_, n_consumers_;
+	// active producers and consumers
+	ThrSet		producers_ ____cacheline_aligned;
+	ThrSet		consumers_ ____cacheline_aligned;
 	// currently free position (next to insert)
 	unsigned long	head_ ____cacheline_aligned;
 	// current tail, next to pop
@@ -343,94 +785,789 @@ private:
 	// last not-processed consumer's pointer
 	unsigned long	last_tail_ ____cacheline_aligned;
 	ThrPos		*thr_p_;
-	T		**ptr_array_;
+	Slot		*slots_;
+	Wait		wait_;
 };
 
-
 /*
  * ------------------------------------------------------------------------
- *	Tests for naive and lock-free queues
+ * Sharded queue of LANES LockFreeQueue lanes.
+ *
+ * Producer i pushes to lane i % LANES, so each lane head is contended only
+ * by a group of the producers. A consumer pops from its home lane and steals
+ * from the other lanes when the home lane is empty. The items of a producer
+ * are popped in the FIFO order the same way as for a single LockFreeQueue,
+ * but there is no order among the lanes.
+ *
+ * With the relaxed FIFO ordering a consumer starts each pop from the next
+ * lane, so the lanes are drained evenly and an item can be overtaken by only
+ * a bounded number of the items pushed later to the other lanes.
  * ------------------------------------------------------------------------
  */
-static const auto N = QUEUE_SIZE * 1024;
-static const auto CONSUMERS = 2;
-static const auto PRODUCERS = 2;
-
-typedef unsigned char	q_type;
-
-static const q_type X_EMPTY = 0; // the address skipped by producers
-static const q_type X_MISSED = 255; // the address skipped by consumers
-q_type x[N * PRODUCERS];
-std::atomic<int> n(0);
-
-template<class Q>
-struct Worker {
-	Worker(Q *q, size_t id = 0)
-		: q_(q),
-		thr_id_(id)
-	{}
-
-	Q *q_;
-	size_t thr_id_;
-};
+template<class T,
+	size_t LANES = 4,
+	decltype(thr_id) ThrId = thr_id,
+	unsigned long Q_SIZE = QUEUE_SIZE>
+class ShardedQueue {
+private:
+	typedef LockFreeQueue<T, ThrId, Q_SIZE> Lane;
 
-template<class Q>
-struct Producer : public Worker<Q> {
-	Producer(Q *q, size_t id)
-		: Worker<Q>(q, id)
-	{}
+	struct Cursor {
+		size_t lane;
+	} ____cacheline_aligned;
 
-	void operator()()
+public:
+	ShardedQueue(size_t n_producers, size_t n_consumers,
+		     bool relaxed_fifo = false)
+		: n_consumers_(n_consumers),
+		relaxed_fifo_(relaxed_fifo)
 	{
-		set_thr_id(Worker<Q>::thr_id_);
-
-		for (auto i = thr_id(); i < N * PRODUCERS; i += PRODUCERS) {
-			x[i] = X_MISSED;
-			Worker<Q>::q_->push(x + i);
+		for (size_t i = 0; i < LANES; ++i) {
+			void *p = ::memalign(DCACHE1_LINESIZE, sizeof(Lane));
+			assert(p);
+			lanes_[i] = new (p) Lane(n_producers, n_consumers);
 		}
+		cur_ = (Cursor *)::memalign(DCACHE1_LINESIZE,
+					    sizeof(Cursor) * n_consumers);
+		assert(cur_);
+		for (size_t i = 0; i < n_consumers; ++i)
+			cur_[i].lane = i % LANES;
 	}
-};
-
-template<class Q>
-struct Consumer : public Worker<Q> {
-	Consumer(Q *q, size_t id)
-		: Worker<Q>(q, id)
-	{}
 
-	void operator()()
+	~ShardedQueue()
 	{
-		set_thr_id(Worker<Q>::thr_id_);
-
-		while (n.fetch_add(1) < N * PRODUCERS) {
-			q_type *v = Worker<Q>::q_->pop();
-			assert(v);
-			assert(*v == X_MISSED);
-			*v = (q_type)(thr_id() + 1); // don't write zero
+		for (size_t i = 0; i < LANES; ++i) {
+			lanes_[i]->~Lane();
+			::free(lanes_[i]);
 		}
+		::free(cur_);
 	}
-};
 
-static inline unsigned long
-tv_to_ms(const struct timeval &tv)
-{
-	return ((unsigned long)tv.tv_sec * 1000000 + tv.tv_usec) / 1000;
-}
+	void
+	push(T *x)
+	{
+		lanes_[ThrId() % LANES]->push(x);
+	}
+
+	T *
+	pop()
+	{
+		assert(ThrId() < n_consumers_);
+		Cursor &c = cur_[ThrId()];
+		T *x;
+
+		for ( ; ; ) {
+			for (size_t i = 0; i < LANES; ++i) {
+				size_t l = (c.lane + i) % LANES;
+				if (!lanes_[l]->try_pop(x))
+					continue;
+				if (relaxed_fifo_)
+					c.lane = (l + 1) % LANES;
+				return x;
+			}
+			_mm_pause();
+		}
+	}
+
+private:
+	const size_t	n_consumers_;
+	const bool	relaxed_fifo_;
+	Lane		*lanes_[LANES];
+	Cursor		*cur_;
+};
+
+/*
+ * ------------------------------------------------------------------------
+ * Lock-free N-producers M-consumers byte ring-buffer queue for variable-length
+ * records.
+ *
+ * The producers reserve contiguous bytes for a record by one atomic operation
+ * like LockFreeQueue does for the slots. The ring is mapped twice in a row, so
+ * the records wrapping around the ring end are contiguous in memory.
+ *
+ * A record is published by a non-zero length in its header and consumers
+ * don't know a record size before it's published, so they take the records
+ * by CAS on the tail. A consumer zeroes the consumed record before the
+ * producers may reuse the bytes, so the not yet published headers are always
+ * zero.
+ * ------------------------------------------------------------------------
+ */
+template<decltype(thr_id) ThrId = thr_id,
+	unsigned long B_SIZE = BYTE_QUEUE_SIZE,
+	class Wait = PauseWait>
+class LockFreeByteQueue {
+private:
+	static const unsigned long B_MASK = B_SIZE - 1;
+
+	struct RecHdr {
+		unsigned long len;
+	};
+
+public:
+	// The largest record payload.
+	static const size_t REC_MAX = B_SIZE / 4;
+
+	LockFreeByteQueue(size_t n_producers, size_t n_consumers)
+		: n_consumers_(n_consumers),
+		head_(0),
+		tail_(0),
+		last_tail_(0)
+	{
+		auto n = std::max(n_consumers, n_producers);
+		thr_tail_ = (unsigned long *)::memalign(getpagesize(),
+					sizeof(unsigned long) * n);
+		assert(thr_tail_);
+		::memset((void *)thr_tail_, 0xFF, sizeof(unsigned long) * n);
+
+		int fd = ::memfd_create("lockfree_rb_q", 0);
+		assert(fd >= 0);
+		if (::ftruncate(fd, B_SIZE))
+			assert(0);
+		ring_ = (char *)::mmap(NULL, B_SIZE * 2, PROT_NONE,
+				       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		assert(ring_ != MAP_FAILED);
+		for (auto i = 0; i < 2; ++i) {
+			void *p = ::mmap(ring_ + B_SIZE * i, B_SIZE,
+					 PROT_READ | PROT_WRITE,
+					 MAP_SHARED | MAP_FIXED, fd, 0);
+			assert(p != MAP_FAILED);
+		}
+		::close(fd);
+	}
+
+	~LockFreeByteQueue()
+	{
+		::munmap(ring_, B_SIZE * 2);
+		::free(thr_tail_);
+	}
+
+	/**
+	 * Copy @len bytes of @data to a new record.
+	 */
+	void
+	push(const void *data, size_t len)
+	{
+		assert(len && len <= REC_MAX);
+		size_t rec = rec_size(len);
+
+		unsigned long h = __sync_fetch_and_add(&head_, rec);
+
+		// Wait until the reserved bytes are consumed, see push().
+		while (__builtin_expect(h + rec > last_tail_ + B_SIZE, 0))
+		{
+			auto min = tail_;
+
+			for (size_t i = 0; i < n_consumers_; ++i) {
+				auto tmp_t = thr_tail_[i];
+
+				asm volatile("" ::: "memory");
+
+				if (tmp_t < min)
+					min = tmp_t;
+			}
+			last_tail_ = min;
+
+			if (h + rec <= last_tail_ + B_SIZE)
+				break;
+			_mm_pause();
+		}
+
+		RecHdr *r = (RecHdr *)(ring_ + (h & B_MASK));
+		::memcpy(r + 1, data, len);
+
+		// Stores are not reordered with other stores on x86.
+		asm volatile("" ::: "memory");
+		*(volatile unsigned long *)&r->len = len;
+
+		wait_.wake();
+	}
+
+	/**
+	 * Pop a record and call @f(data, len) for the record in the ring.
+	 * @return the record length.
+	 */
+	template<class F>
+	size_t
+	pop(F &&f)
+	{
+		assert(ThrId() < n_consumers_);
+		unsigned long &tp = thr_tail_[ThrId()];
+
+		for (unsigned long iter = 0; ; ++iter) {
+			/*
+			 * If the tail moves on after we read it, then the record
+			 * can be rewritten and we read a garbage header, but
+			 * the CAS fails.
+			 */
+			unsigned long t = tp = *(volatile unsigned long *)&tail_;
+			RecHdr *r = (RecHdr *)(ring_ + (t & B_MASK));
+			unsigned long len = *(volatile unsigned long *)&r->len;
+
+			if (!len) {
+				wait_.wait(iter, [this, t]() {
+					return *(volatile unsigned long *)&head_
+					       <= t;
+				});
+				continue;
+			}
+			size_t rec = rec_size(len);
+			if (len > REC_MAX
+			    || !__sync_bool_compare_and_swap(&tail_, t, t + rec))
+				continue;
+
+			f((const char *)(r + 1), len);
+
+			::memset(r, 0, rec);
+			asm volatile("" ::: "memory");
+			// Allow producers rewrite the record.
+			tp = ULONG_MAX;
+
+			return len;
+		}
+	}
+
+private:
+	static size_t
+	rec_size(size_t len)
+	{
+		return (sizeof(RecHdr) + len + sizeof(RecHdr) - 1)
+		       & ~(sizeof(RecHdr) - 1);
+	}
+
+	const size_t n_consumers_;
+	// next byte to reserve by a producer
+	unsigned long	head_ ____cacheline_aligned;
+	// the first not consumed record
+	unsigned long	tail_ ____cacheline_aligned;
+	// last not-processed consumer's record
+	unsigned long	last_tail_ ____cacheline_aligned;
+	unsigned long	*thr_tail_;
+	char		*ring_;
+	Wait		wait_;
+};
+
+/*
+ * ------------------------------------------------------------------------
+ * LockFreeQueue for processes: the whole queue, i.e. the control block, the
+ * threads positions, the slots and an arena for the messages, lives in one
+ * memfd mapping, optionally on huge pages. The mapping address differs among
+ * the processes, so the slots store offsets from the mapping start instead
+ * of pointers. A process attaches the queue by the memfd descriptor, e.g.
+ * inherited on fork() or received over a Unix socket, and registers its
+ * producers and consumers like the dynamic LockFreeQueue threads.
+ *
+ * A peer process can die in the middle of push() or pop() and freeze its
+ * position, which holds back the whole ring, so the threads waiting for the
+ * ring for too long check the owners of the blocking positions by kill(0) and
+ * release the positions and IDs of the dead processes. A slot stores the
+ * position it was written for, so a consumer recognizes a position reserved
+ * by a dead producer, but never written, and returns NIL for it. The message
+ * being popped by a dead consumer is lost. A zombie process isn't recognized
+ * as dead, so the parents must wait for their children.
+ *
+ * The waiting threads spin: FutexWait parks the consumers on a private futex,
+ * which doesn't work between processes.
+ * ------------------------------------------------------------------------
+ */
+template<decltype(thr_id) ThrId = thr_id,
+	unsigned long Q_SIZE = QUEUE_SIZE>
+class ShmQueue {
+private:
+	static const unsigned long Q_MASK = Q_SIZE - 1;
+	static const unsigned long MAGIC = 0x51484d53UL | (Q_SIZE << 32);
+	static const size_t THR_MAX = 256;
+	static const size_t HUGE_PAGE_SZ = 2 * 1024 * 1024;
+	// Pause iterations between the checks of the blocking peers.
+	static const unsigned long REAP_SPIN = 16 * 1024;
+
+	struct ThrPos {
+		unsigned long head, tail;
+	};
+
+	/*
+	 * @pos is written after @off, so the slot is valid only if @pos is
+	 * the position of the reader.
+	 */
+	struct Slot {
+		unsigned long off, pos;
+	};
+
+	struct Hdr {
+		Hdr(size_t n_producers, size_t n_consumers)
+			: producers(n_producers, false),
+			consumers(n_consumers, false)
+		{}
+
+		unsigned long	magic;
+		unsigned long	arena_off;
+		unsigned long	arena_sz;
+		// positions released by the dead processes
+		unsigned long	reaped;
+		ThrSet		producers ____cacheline_aligned;
+		ThrSet		consumers ____cacheline_aligned;
+		pid_t		prod_pid[THR_MAX];
+		pid_t		cons_pid[THR_MAX];
+		unsigned long	head ____cacheline_aligned;
+		unsigned long	tail ____cacheline_aligned;
+		unsigned long	last_head ____cacheline_aligned;
+		unsigned long	last_tail ____cacheline_aligned;
+		ThrPos		thr_p[THR_MAX] ____cacheline_aligned;
+	};
+
+public:
+	// The offset returned by pop() for a message lost by a dead producer.
+	static const unsigned long NIL = ULONG_MAX;
+
+	/*
+	 * Create a queue for up to @n_producers producers and @n_consumers
+	 * consumers with @arena_sz bytes for the messages. Regular pages are
+	 * used if @huge is true, but the system has no free huge pages.
+	 */
+	ShmQueue(size_t n_producers, size_t n_consumers, size_t arena_sz,
+		 bool huge = false)
+		: fd_(-1)
+	{
+		assert(n_producers <= THR_MAX && n_consumers <= THR_MAX);
+		unsigned long slots = page_align(sizeof(Hdr));
+		unsigned long arena = slots + Q_SIZE * sizeof(Slot);
+		size_t sz = arena + arena_sz;
+
+		huge_ = huge && create((sz + HUGE_PAGE_SZ - 1)
+				       & ~(HUGE_PAGE_SZ - 1), MFD_HUGETLB);
+		if (!huge_ && !create(page_align(sz), 0))
+			assert(0);
+
+		h_ = new (base_) Hdr(n_producers, n_consumers);
+		h_->arena_off = arena;
+		h_->arena_sz = sz_ - arena;
+		h_->reaped = 0;
+		h_->head = h_->tail = h_->last_head = h_->last_tail = 0;
+		::memset((void *)h_->prod_pid, 0, sizeof(h_->prod_pid));
+		::memset((void *)h_->cons_pid, 0, sizeof(h_->cons_pid));
+		::memset((void *)h_->thr_p, 0xFF, sizeof(h_->thr_p));
+		slots_ = (Slot *)(base_ + slots);
+		for (unsigned long i = 0; i < Q_SIZE; ++i)
+			slots_[i].pos = ULONG_MAX;
+
+		// Publish the queue for the attaching processes.
+		asm volatile("" ::: "memory");
+		h_->magic = MAGIC;
+	}
+
+	/*
+	 * Attach the queue by its memfd descriptor @fd, created by another
+	 * ShmQueue with the same Q_SIZE.
+	 */
+	explicit ShmQueue(int fd)
+		: fd_(::dup(fd)),
+		huge_(false)
+	{
+		struct stat st;
+
+		assert(fd_ >= 0);
+		if (::fstat(fd_, &st) || !map(st.st_size))
+			assert(0);
+		h_ = (Hdr *)base_;
+		assert(*(volatile unsigned long *)&h_->magic == MAGIC);
+		slots_ = (Slot *)(base_ + page_align(sizeof(Hdr)));
+	}
+
+	~ShmQueue()
+	{
+		::munmap(base_, sz_);
+		::close(fd_);
+	}
+
+	ShmQueue(const ShmQueue &) = delete;
+	ShmQueue &operator=(const ShmQueue &) = delete;
+
+	int
+	fd() const
+	{
+		return fd_;
+	}
+
+	bool
+	huge() const
+	{
+		return huge_;
+	}
+
+	void *
+	arena() const
+	{
+		return base_ + h_->arena_off;
+	}
+
+	size_t
+	arena_size() const
+	{
+		return h_->arena_sz;
+	}
+
+	unsigned long
+	off(const void *p) const
+	{
+		return (const char *)p - base_;
+	}
+
+	template<class T>
+	T *
+	ptr(unsigned long off) const
+	{
+		return (T *)(base_ + off);
+	}
+
+	unsigned long
+	reaped() const
+	{
+		return *(volatile unsigned long *)&h_->reaped;
+	}
+
+	/**
+	 * Register the current thread as a producer, see
+	 * LockFreeQueue::register_producer(). The IDs of the dead processes
+	 * are reused if there are no free IDs.
+	 */
+	long
+	register_producer()
+	{
+		return do_register(h_->producers, h_->prod_pid, &ThrPos::head);
+	}
+
+	void
+	unregister_producer()
+	{
+		assert(thr_pos().head == ULONG_MAX);
+		h_->prod_pid[ThrId()] = 0;
+		h_->producers.del(ThrId());
+	}
+
+	long
+	register_consumer()
+	{
+		return do_register(h_->consumers, h_->cons_pid, &ThrPos::tail);
+	}
+
+	void
+	unregister_consumer()
+	{
+		assert(thr_pos().tail == ULONG_MAX);
+		h_->cons_pid[ThrId()] = 0;
+		h_->consumers.del(ThrId());
+	}
+
+	/**
+	 * Push offset @off of a message, see LockFreeQueue::push().
+	 */
+	void
+	push(unsigned long off)
+	{
+		ThrPos &tp = thr_pos();
+
+		tp.head = h_->head;
+		tp.head = __sync_fetch_and_add(&h_->head, 1);
+
+		for (unsigned long iter = 1;
+		     __builtin_expect(tp.head >= h_->last_tail + Q_SIZE, 0);
+		     ++iter)
+		{
+			h_->last_tail = min_tail();
+
+			if (tp.head < h_->last_tail + Q_SIZE)
+				break;
+			if (!(iter % REAP_SPIN))
+				reap(h_->consumers, h_->cons_pid, &ThrPos::tail);
+			_mm_pause();
+		}
+
+		Slot &s = slots_[tp.head & Q_MASK];
+		s.off = off;
+		// Stores are not reordered with other stores on x86.
+		asm volatile("" ::: "memory");
+		*(volatile unsigned long *)&s.pos = tp.head;
+
+		tp.head = ULONG_MAX;
+	}
+
+	/**
+	 * Pop a message offset, see LockFreeQueue::pop().
+	 * @return NIL for a message lost by a dead producer.
+	 */
+	unsigned long
+	pop()
+	{
+		ThrPos &tp = thr_pos();
+
+		tp.tail = h_->tail;
+		tp.tail = __sync_fetch_and_add(&h_->tail, 1);
+
+		for (unsigned long iter = 1;
+		     __builtin_expect(tp.tail >= h_->last_head, 0); ++iter)
+		{
+			h_->last_head = min_head();
+
+			if (tp.tail < h_->last_head)
+				break;
+			if (!(iter % REAP_SPIN))
+				reap(h_->producers, h_->prod_pid, &ThrPos::head);
+			_mm_pause();
+		}
+
+		const Slot &s = slots_[tp.tail & Q_MASK];
+		unsigned long pos = *(volatile unsigned long *)&s.pos;
+		// Loads are not reordered with other loads on x86.
+		asm volatile("" ::: "memory");
+		unsigned long off = s.off;
+		bool lost = pos != tp.tail;
+
+		// Allow producers rewrite the slot.
+		tp.tail = ULONG_MAX;
+		return lost ? NIL : off;
+	}
+
+private:
+	static unsigned long
+	page_align(unsigned long n)
+	{
+		return (n + getpagesize() - 1) & ~(getpagesize() - 1UL);
+	}
+
+	bool
+	map(size_t sz)
+	{
+		sz_ = sz;
+		base_ = (char *)::mmap(NULL, sz, PROT_READ | PROT_WRITE,
+				       MAP_SHARED, fd_, 0);
+		return base_ != MAP_FAILED;
+	}
+
+	/*
+	 * Create and map a memfd of @sz bytes. The huge pages are reserved on
+	 * the mapping, so it fails if there are not enough free huge pages.
+	 */
+	bool
+	create(size_t sz, unsigned int flags)
+	{
+		if ((fd_ = ::memfd_create("lockfree_shm_q", flags)) < 0)
+			return false;
+		if (!::ftruncate(fd_, sz) && map(sz))
+			return true;
+		::close(fd_);
+		fd_ = -1;
+		return false;
+	}
+
+	ThrPos &
+	thr_pos() const
+	{
+		assert(ThrId() < THR_MAX);
+		return h_->thr_p[ThrId()];
+	}
+
+	long
+	do_register(ThrSet &set, pid_t *pids, unsigned long ThrPos::*pos)
+	{
+		long id = set.add();
+
+		if (id < 0 && reap(set, pids, pos))
+			id = set.add();
+		if (id < 0)
+			return -1;
+		// The position is released by unregister or the reaping.
+		assert(h_->thr_p[id].*pos == ULONG_MAX);
+		*(volatile pid_t *)&pids[id] = ::getpid();
+		set_thr_id(id);
+		return id;
+	}
+
+	/*
+	 * Release the positions and the IDs of the dead processes in the
+	 * threads set @set with the owners @pids. Only one of the concurrent
+	 * reapers wins the owner CAS. A PID reused by a new process between
+	 * the checks keeps the position frozen.
+	 * @return true if any peer was reaped.
+	 */
+	bool
+	reap(ThrSet &set, pid_t *pids, unsigned long ThrPos::*pos)
+	{
+		pid_t self = ::getpid();
+		bool r = false;
+
+		set.for_each([&](size_t i) {
+			pid_t pid = *(volatile pid_t *)&pids[i];
+
+			if (!pid || pid == self || !::kill(pid, 0)
+			    || errno != ESRCH)
+				return;
+			if (!__sync_bool_compare_and_swap(&pids[i], pid, 0))
+				return;
+			*(volatile unsigned long *)&(h_->thr_p[i].*pos) = ULONG_MAX;
+			set.del(i);
+			__sync_fetch_and_add(&h_->reaped, 1);
+			r = true;
+		});
+
+		return r;
+	}
+
+	/*
+	 * The lowest positions of the active consumers and producers,
+	 * see LockFreeQueue::min_tail().
+	 */
+	unsigned long
+	min_tail() const
+	{
+		auto min = *(volatile unsigned long *)&h_->tail;
+
+		h_->consumers.for_each([this, &min](size_t i) {
+			auto tmp_t = h_->thr_p[i].tail;
+
+			// Force compiler to use tmp_t exactly once.
+			asm volatile("" ::: "memory");
+
+			if (tmp_t < min)
+				min = tmp_t;
+		});
+
+		return min;
+	}
+
+	unsigned long
+	min_head() const
+	{
+		auto min = *(volatile unsigned long *)&h_->head;
+
+		h_->producers.for_each([this, &min](size_t i) {
+			auto tmp_h = h_->thr_p[i].head;
+
+			// Force compiler to use tmp_h exactly once.
+			asm volatile("" ::: "memory");
+
+			if (tmp_h < min)
+				min = tmp_h;
+		});
+
+		return min;
+	}
+
+	int		fd_;
+	bool		huge_;
+	size_t		sz_;
+	char		*base_;
+	Hdr		*h_;
+	Slot		*slots_;
+};
+
+
+/*
+ * ------------------------------------------------------------------------
+ *	Tests for naive and lock-free queues
+ * ------------------------------------------------------------------------
+ */
+static const auto N = QUEUE_SIZE * 1024;
+static const auto CONSUMERS = 2;
+static const auto PRODUCERS = 2;
+/*
+ * Batch sizes for push_n() and pop_n(), N must be a multiple of each of them
+ * to let consumers pop exactly N * PRODUCERS items by the batches.
+ */
+static const size_t BATCH[] = {1, 8, 32, 64};
+static const size_t BATCH_MAX = 64;
+
+typedef unsigned char	q_type;
+
+static const q_type X_EMPTY = 0; // the address skipped by producers
+static const q_type X_MISSED = 255; // the address skipped by consumers
+q_type x[N * PRODUCERS];
+std::atomic<int> n(0);
+
+template<class Q>
+struct Worker {
+	Worker(Q *q, size_t id = 0, size_t batch = 1)
+		: q_(q),
+		thr_id_(id),
+		batch_(batch)
+	{}
+
+	Q *q_;
+	size_t thr_id_;
+	size_t batch_;
+};
+
+template<class Q>
+struct Producer : public Worker<Q> {
+	Producer(Q *q, size_t id, size_t batch)
+		: Worker<Q>(q, id, batch)
+	{}
+
+	void operator()()
+	{
+		q_type *b[BATCH_MAX];
+		size_t bn = 0;
+
+		set_thr_id(Worker<Q>::thr_id_);
+
+		for (auto i = thr_id(); i < N * PRODUCERS; i += PRODUCERS) {
+			x[i] = X_MISSED;
+			if (Worker<Q>::batch_ == 1) {
+				Worker<Q>::q_->push(x + i);
+				continue;
+			}
+			b[bn++] = x + i;
+			if (bn == Worker<Q>::batch_) {
+				Worker<Q>::q_->push_n(b, bn);
+				bn = 0;
+			}
+		}
+		assert(!bn);
+	}
+};
+
+template<class Q>
+struct Consumer : public Worker<Q> {
+	Consumer(Q *q, size_t id, size_t batch)
+		: Worker<Q>(q, id, batch)
+	{}
+
+	void operator()()
+	{
+		q_type *b[BATCH_MAX];
+		const size_t bn = Worker<Q>::batch_;
+
+		set_thr_id(Worker<Q>::thr_id_);
+
+		while (n.fetch_add(bn) < N * PRODUCERS) {
+			if (bn == 1)
+				b[0] = Worker<Q>::q_->pop();
+			else
+				Worker<Q>::q_->pop_n(b, bn);
+			for (size_t i = 0; i < bn; ++i) {
+				q_type *v = b[i];
+				assert(v);
+				assert(*v == X_MISSED);
+				*v = (q_type)(thr_id() + 1); // don't write zero
+			}
+		}
+	}
+};
 
 template<class Q>
 void
-run_test(Q &&q)
+run_test(Q &&q, size_t batch)
 {
 	std::thread thr[PRODUCERS + CONSUMERS];
 
 	n.store(0);
 	::memset(x, X_EMPTY, N * sizeof(q_type) * PRODUCERS);
 
-	struct timeval tv0, tv1;
-	gettimeofday(&tv0, NULL);
+	struct bench_perf perf;
+	bench_perf_begin(&perf);
+	uint64_t t0 = bench_now_ns();
 
 	// Run producers.
 	for (auto i = 0; i < PRODUCERS; ++i)
-		thr[i] = std::thread(Producer<Q>(&q, i));
+		thr[i] = std::thread(Producer<Q>(&q, i, batch));
 
 	::usleep(10 * 1000); // sleep to wait the queue is full
 
@@ -441,14 +1578,18 @@ run_test(Q &&q)
 	 * so we  care only about different IDs for threads of the same type.
 	 */
 	for (auto i = 0; i < CONSUMERS; ++i)
-		thr[PRODUCERS + i] = std::thread(Consumer<Q>(&q, i));
+		thr[PRODUCERS + i] = std::thread(Consumer<Q>(&q, i, batch));
 
 	// Wait for all threads completion.
 	for (auto i = 0; i < PRODUCERS + CONSUMERS; ++i)
 		thr[i].join();
 
-	gettimeofday(&tv1, NULL);
-	std::cout << (tv_to_ms(tv1) - tv_to_ms(tv0)) << "ms" << std::endl;
+	auto ms = std::max((bench_now_ns() - t0) / 1000000, (uint64_t)1);
+	bench_perf_end(&perf);
+	std::cout << "batch " << batch << ": " << ms << "ms, "
+		  << N * PRODUCERS / ms << " items/ms" << std::endl;
+	bench_report(("batch " + std::to_string(batch)).c_str(),
+		     N * PRODUCERS, NULL, 0, &perf);
 
 	// Check data.
 	auto res = 0;
@@ -467,17 +1608,704 @@ run_test(Q &&q)
 	std::cout << (res ? "FAILED" : "Passed") << std::endl;
 }
 
+/*
+ * ------------------------------------------------------------------------
+ *	Wakeup latency and CPU usage of the consumer wait strategies
+ * ------------------------------------------------------------------------
+ */
+static const auto WAKEUP_N = 1000;
+static const auto WAKEUP_DELAY_US = 1000;
+
+struct Msg {
+	std::chrono::steady_clock::time_point	ts;
+};
+
+/**
+ * A producer pushes an item once per WAKEUP_DELAY_US, so the consumer waits
+ * for an empty queue most of the time.
+ */
+template<class Q>
+void
+run_wakeup_test(const char *name)
+{
+	using namespace std::chrono;
+
+	static Msg msg[WAKEUP_N];
+	Q q(1, 1);
+	unsigned long lat = 0, lat_max = 0;
+	nanoseconds cpu;
+
+	auto t0 = steady_clock::now();
+
+	std::thread cons([&]() {
+		struct timespec c0, c1;
+
+		set_thr_id(0);
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &c0);
+		for (auto i = 0; i < WAKEUP_N; ++i) {
+			Msg *m = q.pop();
+			unsigned long d = duration_cast<nanoseconds>(
+						steady_clock::now() - m->ts)
+					  .count();
+			lat += d;
+			lat_max = std::max(lat_max, d);
+		}
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &c1);
+		cpu = seconds(c1.tv_sec - c0.tv_sec)
+		      + nanoseconds(c1.tv_nsec - c0.tv_nsec);
+	});
+
+	set_thr_id(0);
+	for (auto i = 0; i < WAKEUP_N; ++i) {
+		::usleep(WAKEUP_DELAY_US);
+		msg[i].ts = steady_clock::now();
+		q.push(msg + i);
+	}
+	cons.join();
+
+	auto wall = steady_clock::now() - t0;
+	std::cout << name << ": avg " << lat / WAKEUP_N / 1000 << "us, max "
+		  << lat_max / 1000 << "us, consumer CPU "
+		  << cpu * 100 / wall << "%" << std::endl;
+}
+
+/*
+ * ------------------------------------------------------------------------
+ *	Messages throughput of the pointer, by-value and byte queues
+ * ------------------------------------------------------------------------
+ */
+static const auto MSG_N = N / 32;
+
+struct Packet {
+	unsigned long	seq;
+	char		data[40];
+};
+
+/**
+ * Each of the @p producers calls @push(seq) for its @msg_n sequence numbers
+ * and the @c consumers call @pop() returning the popped sequence number.
+ */
+template<class Push, class Pop>
+void
+run_msg_test(const char *name, Push &&push, Pop &&pop,
+	     size_t p = PRODUCERS, size_t c = CONSUMERS,
+	     unsigned long msg_n = MSG_N)
+{
+	std::vector<std::thread> thr;
+	std::atomic<unsigned long> sum(0);
+	const unsigned long total = msg_n * p;
+
+	n.store(0);
+
+	struct bench_perf perf;
+	bench_perf_begin(&perf);
+	uint64_t t0 = bench_now_ns();
+
+	for (size_t i = 0; i < p; ++i)
+		thr.emplace_back([&push, i, msg_n]() {
+			set_thr_id(i);
+			for (unsigned long s = i * msg_n; s < (i + 1) * msg_n;
+			     ++s)
+				push(s);
+		});
+	for (size_t i = 0; i < c; ++i)
+		thr.emplace_back([&pop, &sum, i, total]() {
+			unsigned long s = 0;
+
+			set_thr_id(i);
+			while ((unsigned long)n.fetch_add(1) < total)
+				s += pop();
+			sum += s;
+		});
+
+	for (auto &t : thr)
+		t.join();
+
+	auto ms = std::max((bench_now_ns() - t0) / 1000000, (uint64_t)1);
+	bench_perf_end(&perf);
+	std::cout << name << ": " << ms << "ms, " << total / ms << " msgs/ms, "
+		  << (sum == total * (total - 1) / 2 ? "Passed" : "FAILED")
+		  << std::endl;
+	bench_report(name, total, NULL, 0, &perf);
+}
+
+/**
+ * Producers and consumers register and unregister in waves like the threads
+ * of a thread pool scaling up and down, so the thread IDs are reused.
+ */
+static void
+run_dyn_test()
+{
+	static const auto WAVES = 4;
+	static const unsigned long M = MSG_N / WAVES;
+
+	LockFreeQueue<Packet, thr_id, QUEUE_SIZE, PauseWait, ValSlot<Packet>>
+		q(WAVES, WAVES, true);
+	std::atomic<unsigned long> sum(0), base(0);
+	unsigned long total = 0;
+
+	struct bench_perf perf;
+	bench_perf_begin(&perf);
+	uint64_t t0 = bench_now_ns();
+
+	for (auto w = 1; w <= WAVES; ++w) {
+		std::thread thr[WAVES * 2];
+
+		n.store(0);
+		for (auto i = 0; i < w; ++i)
+			thr[i] = std::thread([&q, &base]() {
+				long id __attribute__((unused));
+				id = q.register_producer();
+				assert(id >= 0);
+				unsigned long s0 = base.fetch_add(M);
+				for (auto s = s0; s < s0 + M; ++s) {
+					Packet p;
+					p.seq = s;
+					q.push(p);
+				}
+				q.unregister_producer();
+			});
+		for (auto i = 0; i < w; ++i)
+			thr[w + i] = std::thread([&q, &sum, w]() {
+				unsigned long s = 0;
+				long id __attribute__((unused));
+				id = q.register_consumer();
+				assert(id >= 0);
+				while (n.fetch_add(1) < (int)M * w)
+					s += q.pop().seq;
+				q.unregister_consumer();
+				sum += s;
+			});
+		for (auto i = 0; i < w * 2; ++i)
+			thr[i].join();
+		total += M * w;
+	}
+
+	auto ms = std::max((bench_now_ns() - t0) / 1000000, (uint64_t)1);
+	bench_perf_end(&perf);
+	std::cout << "dynamic threads: " << ms << "ms, " << total / ms
+		  << " msgs/ms, "
+		  << (sum == total * (total - 1) / 2 ? "Passed" : "FAILED")
+		  << std::endl;
+	bench_report("dynamic threads", total, NULL, 0, &perf);
+}
+
+/*
+ * ------------------------------------------------------------------------
+ *	Producer and consumer processes over the shared memory queue
+ * ------------------------------------------------------------------------
+ */
+typedef ShmQueue<> ShmQ;
+
+struct ShmRes {
+	std::atomic<unsigned long>	n, sum;
+};
+
+template<class F>
+static pid_t
+fork_peer(F &&f)
+{
+	pid_t pid = ::fork();
+
+	assert(pid >= 0);
+	if (!pid) {
+		f();
+		::_exit(0);
+	}
+	return pid;
+}
+
+/**
+ * The producers are forked with the queue mapping, while the consumers attach
+ * the queue by the inherited descriptor like unrelated processes receiving it
+ * over a Unix socket, so their mappings are at different addresses.
+ */
+static void
+run_shm_test(bool huge)
+{
+	const unsigned long total = MSG_N * PRODUCERS;
+	ShmQ q(PRODUCERS, CONSUMERS, sizeof(ShmRes) + sizeof(Packet) * total,
+	       huge);
+	ShmRes *res = new (q.arena()) ShmRes();
+	Packet *pkts = (Packet *)(res + 1);
+	std::vector<pid_t> pids;
+	std::string name = "processes";
+
+	if (huge)
+		name += q.huge() ? ", huge pages" : ", no free huge pages";
+
+	struct bench_perf perf;
+	bench_perf_begin(&perf);
+	uint64_t t0 = bench_now_ns();
+
+	for (size_t i = 0; i < PRODUCERS; ++i)
+		pids.push_back(fork_peer([&q, pkts, i]() {
+			long id __attribute__((unused));
+			id = q.register_producer();
+			assert(id >= 0);
+			for (unsigned long s = i * MSG_N; s < (i + 1) * MSG_N;
+			     ++s)
+			{
+				pkts[s].seq = s;
+				q.push(q.off(pkts + s));
+			}
+			q.unregister_producer();
+		}));
+	for (size_t i = 0; i < CONSUMERS; ++i)
+		pids.push_back(fork_peer([&q, total]() {
+			ShmQ c(q.fd());
+			ShmRes *r = (ShmRes *)c.arena();
+			unsigned long s = 0;
+			long id __attribute__((unused));
+
+			id = c.register_consumer();
+			assert(id >= 0);
+			while (r->n.fetch_add(1) < total)
+				s += c.ptr<Packet>(c.pop())->seq;
+			r->sum += s;
+			c.unregister_consumer();
+		}));
+	for (auto p : pids)
+		::waitpid(p, NULL, 0);
+
+	auto ms = std::max((bench_now_ns() - t0) / 1000000, (uint64_t)1);
+	bench_perf_end(&perf);
+	std::cout << name << ": " << ms << "ms, " << total / ms << " msgs/ms, "
+		  << (res->sum == total * (total - 1) / 2 ? "Passed" : "FAILED")
+		  << std::endl;
+	bench_report(name.c_str(), total, NULL, 0, &perf);
+}
+
+/*
+ * Let a forked peer reach the waiting loop and kill it there.
+ */
+static void
+kill_peer(pid_t pid)
+{
+	::usleep(10 * 1000);
+	::kill(pid, SIGKILL);
+	::waitpid(pid, NULL, 0);
+}
+
+/**
+ * A consumer is killed in pop() on the empty ring and a producer is killed
+ * in push() on the full ring with a reserved, but not written, position.
+ * The surviving peers must reap both the positions and lose only the message
+ * taken by the dead consumer and the position of the dead producer.
+ */
+static void
+run_shm_recovery_test()
+{
+	// The messages after the one taken by the dead consumer.
+	const unsigned long msg_n = QUEUE_SIZE + 1;
+	ShmQ q(2, 2, sizeof(ShmRes) + sizeof(Packet) * (msg_n + 1));
+	ShmRes *res = new (q.arena()) ShmRes();
+	Packet *pkts = (Packet *)(res + 1);
+	auto push = [&q, pkts](unsigned long s) {
+		pkts[s].seq = s;
+		q.push(q.off(pkts + s));
+	};
+
+	kill_peer(fork_peer([&q]() {
+		q.register_consumer();
+		q.pop();
+	}));
+
+	// Fill the ring, the last push reaps the dead consumer.
+	q.register_producer();
+	for (unsigned long s = 0; s < msg_n; ++s)
+		push(s);
+
+	kill_peer(fork_peer([&q, &push]() {
+		q.register_producer();
+		push(msg_n);
+	}));
+
+	pid_t cons = fork_peer([&q, res, msg_n]() {
+		q.register_consumer();
+		// Popping the dead producer position reaps it.
+		for (unsigned long i = 0; i <= msg_n; ++i) {
+			unsigned long o = q.pop();
+			if (o == ShmQ::NIL)
+				++res->n;
+			else
+				res->sum += q.ptr<Packet>(o)->seq;
+		}
+		q.unregister_consumer();
+	});
+	push(msg_n);
+	q.unregister_producer();
+	::waitpid(cons, NULL, 0);
+
+	bool ok = q.reaped() == 2 && res->n == 1
+		  && res->sum == msg_n * (msg_n + 1) / 2;
+	std::cout << "dead peers recovery: reaped " << q.reaped() << ", lost "
+		  << res->n << " positions, " << (ok ? "Passed" : "FAILED")
+		  << std::endl;
+}
+
+/*
+ * ------------------------------------------------------------------------
+ *	End-to-end latency percentiles for the queues and the CPU topologies
+ * ------------------------------------------------------------------------
+ */
+static const auto LAT_N = 100 * 1000;
+// Cycles between the pushes of a producer to not to measure a full queue.
+static const unsigned long LAT_GAP = 1000;
+
+struct TscItem {
+	unsigned long	tsc;
+};
+
+struct Cpu {
+	int	cpu, core, pkg;
+};
+
+static int
+read_topo(int cpu, const char *name)
+{
+	int v = -1;
+	std::ifstream f("/sys/devices/system/cpu/cpu" + std::to_string(cpu)
+			+ "/topology/" + name);
+	f >> v;
+	return v;
+}
+
+static std::vector<Cpu>
+cpu_topology()
+{
+	std::vector<Cpu> cpus;
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	sched_getaffinity(0, sizeof(set), &set);
+	for (auto c = 0; c < CPU_SETSIZE; ++c)
+		if (CPU_ISSET(c, &set))
+			cpus.push_back({c, read_topo(c, "core_id"),
+					read_topo(c, "physical_package_id")});
+	// Order the CPUs by the packages and the cores, so SMT siblings are
+	// neighbours.
+	std::sort(cpus.begin(), cpus.end(), [](const Cpu &a, const Cpu &b) {
+		return a.pkg != b.pkg ? a.pkg < b.pkg
+		       : a.core != b.core ? a.core < b.core : a.cpu < b.cpu;
+	});
+	return cpus;
+}
+
+/*
+ * The placements of @p producers and @p consumers:
+ *	"none"	 - no pinning;
+ *	"smt"	 - i'th producer and i'th consumer are SMT siblings;
+ *	"core"	 - all the threads on different cores of the same package;
+ *	"socket" - the producers and the consumers on different packages.
+ * @return false if the topology doesn't fit the placement.
+ */
+static const char *PLACEMENTS[] = {"none", "smt", "core", "socket"};
+
+static bool
+place(const std::vector<Cpu> &cpus, const std::string &pl, size_t p, size_t c,
+      std::vector<int> &prod, std::vector<int> &cons)
+{
+	// The first CPU of each core of package @pkg.
+	auto cores = [&cpus](int pkg) {
+		std::vector<int> v;
+		for (size_t i = 0; i < cpus.size(); ++i)
+			if (cpus[i].pkg == pkg
+			    && (!i || cpus[i - 1].core != cpus[i].core
+				|| cpus[i - 1].pkg != pkg))
+				v.push_back(i);
+		return v;
+	};
+
+	prod.assign(p, -1);
+	cons.assign(c, -1);
+	if (pl == "none")
+		return p + c <= std::max(cpus.size(), 2UL);
+
+	auto pkg0 = cores(cpus[0].pkg);
+	if (pl == "smt") {
+		if (p != c || pkg0.size() < p)
+			return false;
+		for (size_t i = 0; i < p; ++i) {
+			size_t s = pkg0[i];
+			if (s + 1 >= cpus.size()
+			    || cpus[s + 1].core != cpus[s].core
+			    || cpus[s + 1].pkg != cpus[s].pkg)
+				return false;
+			prod[i] = cpus[s].cpu;
+			cons[i] = cpus[s + 1].cpu;
+		}
+		return true;
+	}
+	if (pl == "core") {
+		if (pkg0.size() < p + c)
+			return false;
+		for (size_t i = 0; i < p; ++i)
+			prod[i] = cpus[pkg0[i]].cpu;
+		for (size_t i = 0; i < c; ++i)
+			cons[i] = cpus[pkg0[p + i]].cpu;
+		return true;
+	}
+	// Cross-socket placement.
+	auto pkg1 = cores(cpus.back().pkg);
+	if (cpus.back().pkg == cpus[0].pkg || pkg0.size() < p
+	    || pkg1.size() < c)
+		return false;
+	for (size_t i = 0; i < p; ++i)
+		prod[i] = cpus[pkg0[i]].cpu;
+	for (size_t i = 0; i < c; ++i)
+		cons[i] = cpus[pkg1[i]].cpu;
+	return true;
+}
+
+/*
+ * Construct a queue for @p producers and @c consumers in cache line aligned
+ * memory @mem.
+ */
+template<class Q>
+struct QueueFactory {
+	static Q *
+	make(void *mem, size_t p, size_t c)
+	{
+		return new (mem) Q(p, c);
+	}
+};
+
+template<class T, unsigned long Q_SIZE>
+struct QueueFactory<NaiveQueue<T, Q_SIZE>> {
+	static NaiveQueue<T, Q_SIZE> *
+	make(void *mem, size_t p, size_t c)
+	{
+		return new (mem) NaiveQueue<T, Q_SIZE>;
+	}
+};
+
+template<class T, unsigned long Q_SIZE>
+struct QueueFactory<BoostQueue<T, Q_SIZE>> {
+	static BoostQueue<T, Q_SIZE> *
+	make(void *mem, size_t p, size_t c)
+	{
+		return new (mem) BoostQueue<T, Q_SIZE>;
+	}
+};
+
+/**
+ * The producers timestamp each item by TSC at push() and the consumers
+ * compute the latency at pop(). Prints a table row of the latency percentiles
+ * in nanoseconds. TSC must be synchronized among the CPUs (invariant TSC).
+ */
+template<class Q>
+void
+run_lat_test(const char *name, const char *pl, const std::vector<int> &prod,
+	     const std::vector<int> &cons, double tsc_us)
+{
+	const size_t p = prod.size(), c = cons.size();
+	const unsigned long total = LAT_N * p;
+	std::vector<TscItem> items(total);
+	std::vector<std::vector<unsigned long>> lat(c);
+	std::vector<std::thread> thr;
+	std::atomic<unsigned long> cnt(0);
+	void *mem = ::memalign(DCACHE1_LINESIZE, sizeof(Q));
+	assert(mem);
+	Q *q = QueueFactory<Q>::make(mem, p, c);
+
+	for (size_t i = 0; i < c; ++i)
+		thr.emplace_back([&, i]() {
+			auto &l = lat[i];
+
+			bench_pin_cpu(cons[i]);
+			set_thr_id(i);
+			l.reserve(total / c * 2);
+			while (cnt.fetch_add(1) < total) {
+				TscItem *it = q->pop();
+				l.push_back(__rdtsc() - it->tsc);
+			}
+		});
+	for (size_t i = 0; i < p; ++i)
+		thr.emplace_back([&, i]() {
+			bench_pin_cpu(prod[i]);
+			set_thr_id(i);
+			for (auto j = i; j < total; j += p) {
+				unsigned long t = __rdtsc();
+				while (__rdtsc() - t < LAT_GAP)
+					_mm_pause();
+				items[j].tsc = __rdtsc();
+				q->push(&items[j]);
+			}
+		});
+	for (auto &t : thr)
+		t.join();
+	q->~Q();
+	::free(mem);
+
+	std::vector<unsigned long> all;
+	for (auto &l : lat)
+		all.insert(all.end(), l.begin(), l.end());
+	std::sort(all.begin(), all.end());
+
+	auto pct = [&all, tsc_us](double p) {
+		return (unsigned long)(all[(size_t)(p * (all.size() - 1))]
+				       * 1000 / tsc_us);
+	};
+	std::cout << std::left << std::setw(10) << name << std::setw(8) << pl
+		  << std::right << std::setw(3) << p << std::setw(3) << c
+		  << std::setw(9) << pct(0.5) << std::setw(9) << pct(0.9)
+		  << std::setw(9) << pct(0.99) << std::setw(9) << pct(0.999)
+		  << std::setw(10) << pct(1.0) << std::endl;
+}
+
+static void
+run_lat_tests()
+{
+	static const size_t THREADS[] = {1, 2, 4, 8};
+
+	auto cpus = cpu_topology();
+	double tsc_us = bench_tsc_per_ns() * 1000;
+	std::vector<int> prod, cons;
+
+	std::cout << "End-to-end latency, ns:" << std::endl
+		  << std::left << std::setw(10) << "queue" << std::setw(8)
+		  << "place" << std::right << std::setw(3) << "P"
+		  << std::setw(3) << "C" << std::setw(9) << "p50"
+		  << std::setw(9) << "p90" << std::setw(9) << "p99"
+		  << std::setw(9) << "p99.9" << std::setw(10) << "max"
+		  << std::endl;
+	for (auto pl : PLACEMENTS)
+		for (auto n : THREADS) {
+			if (!place(cpus, pl, n, n, prod, cons))
+				break;
+			run_lat_test<LockFreeQueue<TscItem>>("lock-free", pl,
+							      prod, cons,
+							      tsc_us);
+			run_lat_test<NaiveQueue<TscItem>>("naive", pl, prod,
+							  cons, tsc_us);
+			run_lat_test<BoostQueue<TscItem>>("boost", pl, prod,
+							  cons, tsc_us);
+		}
+}
+
+/*
+ * Scaling of the single ring and sharded queues at many threads.
+ */
+static const auto SHARD_THREADS = 16;
+
+template<class Q, class... Args>
+void
+run_shard_test(const char *name, Args... args)
+{
+	Packet *pkts = new Packet[MSG_N / 8 * SHARD_THREADS];
+	Q q(SHARD_THREADS, SHARD_THREADS, args...);
+
+	run_msg_test(name,
+		[&q, pkts](unsigned long s) {
+			pkts[s].seq = s;
+			q.push(pkts + s);
+		},
+		[&q]() {
+			return q.pop()->seq;
+		},
+		SHARD_THREADS, SHARD_THREADS, MSG_N / 8);
+	delete[] pkts;
+}
+
+/*
+ * Run all the tests or only the latency tests with --latency.
+ */
 int
-main()
+main(int argc, char *argv[])
 {
+	static_assert(N % BATCH_MAX == 0, "bad batch size");
+
+	if (argc > 1 && !strcmp(argv[1], "--latency")) {
+		run_lat_tests();
+		return 0;
+	}
+
+	std::cout << "Lock-free queue:" << std::endl;
 	LockFreeQueue<q_type> lf_q(PRODUCERS, CONSUMERS);
-	run_test<LockFreeQueue<q_type>>(std::move(lf_q));
+	for (auto b : BATCH)
+		run_test<LockFreeQueue<q_type>>(std::move(lf_q), b);
 
+	std::cout << "Naive queue:" << std::endl;
 	NaiveQueue<q_type> n_q;
-	run_test<NaiveQueue<q_type>>(std::move(n_q));
+	for (auto b : BATCH)
+		run_test<NaiveQueue<q_type>>(std::move(n_q), b);
 
+	std::cout << "Boost queue:" << std::endl;
 	BoostQueue<q_type> b_q;
-	run_test<BoostQueue<q_type>>(std::move(b_q));
+	for (auto b : BATCH)
+		run_test<BoostQueue<q_type>>(std::move(b_q), b);
+
+	std::cout << "Lock-free queues messages:" << std::endl;
+	{
+		LockFreeQueue<Packet> q(PRODUCERS, CONSUMERS);
+		run_msg_test("pointer slots",
+			[&q](unsigned long s) {
+				Packet *p = new Packet;
+				p->seq = s;
+				q.push(p);
+			},
+			[&q]() {
+				Packet *p = q.pop();
+				unsigned long s = p->seq;
+				delete p;
+				return s;
+			});
+	}
+	{
+		LockFreeQueue<Packet, thr_id, QUEUE_SIZE, PauseWait,
+			      ValSlot<Packet>> q(PRODUCERS, CONSUMERS);
+		run_msg_test("value slots",
+			[&q](unsigned long s) {
+				Packet p;
+				p.seq = s;
+				q.push(p);
+			},
+			[&q]() {
+				return q.pop().seq;
+			});
+	}
+	{
+		LockFreeByteQueue<> q(PRODUCERS, CONSUMERS);
+		run_msg_test("byte ring",
+			[&q](unsigned long s) {
+				Packet p;
+				p.seq = s;
+				// Variable-length records of 8-48 bytes.
+				q.push(&p, sizeof(p.seq) + s % 41);
+			},
+			[&q]() {
+				unsigned long s;
+				q.pop([&s](const char *data, size_t len) {
+					::memcpy(&s, data, sizeof(s));
+				});
+				return s;
+			});
+	}
+
+	run_dyn_test();
+
+	std::cout << "Shared memory queue, " << PRODUCERS << " producer and "
+		  << CONSUMERS << " consumer processes:" << std::endl;
+	run_shm_test(false);
+	run_shm_test(true);
+	run_shm_recovery_test();
+
+	std::cout << "Single ring vs sharded queue, " << SHARD_THREADS
+		  << " producers and consumers:" << std::endl;
+	run_shard_test<LockFreeQueue<Packet>>("single ring");
+	run_shard_test<ShardedQueue<Packet>>("4 lanes");
+	run_shard_test<ShardedQueue<Packet>>("4 lanes relaxed FIFO", true);
+
+	std::cout << "Lock-free queue wakeup latency:" << std::endl;
+	run_wakeup_test<LockFreeQueue<Msg, thr_id, QUEUE_SIZE, BusyWait>>
+		("busy spin");
+	run_wakeup_test<LockFreeQueue<Msg, thr_id, QUEUE_SIZE, PauseWait>>
+		("spin with pause");
+	run_wakeup_test<LockFreeQueue<Msg, thr_id, QUEUE_SIZE, FutexWait>>
+		("spin and futex park");
+
+	run_lat_tests();
 
 	return 0;
 }
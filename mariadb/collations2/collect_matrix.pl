@@ -0,0 +1,162 @@
+#!/usr/bin/perl -w
+#
+# usage: $0 <run number>...
+#
+# collect the sysbench and iostat results of the given runs into one JSON
+# document on stdout: one record per run, workload and thread count
+#
+
+use strict;
+use JSON::PP;
+
+my %desc = get_run_info("DESC");
+my @records;
+
+for my $ii (@ARGV) {
+    my $dir = "res$ii";
+    my %info = get_matrix_info($dir);
+
+    opendir D, $dir or die "cannot opendir '$dir' : $!\n";
+    my @res = sort grep { /^\w+\.\d+\.res$/ } readdir D;
+    closedir D;
+
+    for my $fn (@res) {
+        my ($wl, $thd) = $fn =~ /^(\w+)\.(\d+)\.res$/;
+        my %r = (
+            run         => $ii,
+            description => $desc{$ii},
+            %info,
+            workload    => $wl,
+            threads     => $thd + 0,
+            sysbench    => get_sysbench("$dir/$fn"),
+        );
+        my $io = get_iostat("$dir/iostat.$wl.$thd.txt");
+        $r{iostat} = $io if $io;
+        push @records, \%r;
+    }
+}
+
+print JSON::PP->new->canonical->pretty->encode({ runs => \@records });
+
+exit 0;
+
+
+#
+# the final statistics and the intermediate tps reports
+#
+sub get_sysbench
+{
+    my $fn = shift;
+    my %s;
+    my @tps;
+
+    open F, "<$fn" or die "cannot read from '$fn' : $!\n";
+    while (<F>) {
+        push @tps, $1 + 0       if /^\[ \d+s \].* tps: ([\d.]+)/o;
+        $s{tps} = $1 + 0        if /transactions:.*\((.*) per sec/o;
+        $s{qps} = $1 + 0        if /queries:.*\((.*) per sec/o;
+        $s{errors} = $1 + 0     if /ignored errors:\s+(\d+)/o;
+        $s{lat_min} = $1 + 0    if /min:\s+([\d.]+)/o;
+        $s{lat_avg} = $1 + 0    if /avg:\s+([\d.]+)/o;
+        $s{lat_max} = $1 + 0    if /max:\s+([\d.]+)/o;
+        $s{lat_95} = $1 + 0     if /percentile:\s+([\d.]+)/o;
+    }
+    close F;
+    $s{tps_series} = \@tps;
+
+    return \%s;
+}
+
+
+#
+# per device averages of all the iostat columns, the first report shows the
+# averages since boot and is skipped
+#
+sub get_iostat
+{
+    my $fn = shift;
+    my (@cols, %sum, %n);
+    my $report = 0;
+
+    open F, "<$fn" or return undef;
+    while (<F>) {
+        if (/^Device:?\s/o) {
+            @cols = split;
+            shift @cols;
+            $report++;
+            next;
+        }
+        next if $report < 2 or /^\s*$/o or /^avg-cpu/o or /^\s+[\d.]/o;
+        my ($dev, @v) = split;
+        next unless @v == @cols;
+        $n{$dev}++;
+        $sum{$dev}{$cols[$_]} += $v[$_] for 0 .. $#cols;
+    }
+    close F;
+
+    return undef unless %n;
+
+    my %avg;
+    for my $dev (keys %n) {
+        $avg{$dev}{$_} = 0 + sprintf("%.2f", $sum{$dev}{$_} / $n{$dev})
+            for keys %{$sum{$dev}};
+    }
+
+    return \%avg;
+}
+
+
+#
+# the run parameters written by runmatrix.sh, for the older runs they're
+# taken from server.NN, config.NN and config.sh
+#
+sub get_matrix_info
+{
+    my $dir = shift;
+    my ($ii) = $dir =~ /^res(\d+)$/;
+    my %res;
+
+    if (open F, "<$dir/matrix.info") {
+        while (<F>) {
+            chomp;
+            my ($k, $v) = split /=/, $_, 2;
+            $res{$k} = $k eq "range_size" ? $v + 0 : $v;
+        }
+        close F;
+        return %res;
+    }
+
+    if (open F, "<server.$ii") {
+        chomp($res{server} = <F>);
+        close F;
+    }
+    for my $fn ("config.sh", "config.$ii") {
+        open F, "<$fn" or next;
+        while (<F>) {
+            if (/^CREATE="CHARACTER SET (\w+)(?: COLLATE (\w+))?"/o) {
+                $res{charset} = $1;
+                $res{collation} = $2 // "default";
+            }
+            $res{range_size} = $1 + 0 if /^LUA_ARGS_RUN=.*--range-size=(\d+)/o;
+        }
+        close F;
+    }
+    return %res;
+}
+
+
+sub get_run_info
+{
+    my $descfile = shift;
+    my %res;
+    open F, "<$descfile" or die "cannot read from '$descfile' : $!\n";
+    while (<F>) {
+        chomp;
+        next if /^#/;
+        next if /^\s*$/;
+        my ($n, $d) = split /\s*\.{2,}\s*/o;
+        $res{$n}= $d;
+    }
+    close F;
+    return %res;
+}
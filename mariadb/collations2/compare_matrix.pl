@@ -0,0 +1,78 @@
+#!/usr/bin/perl -w
+#
+# usage: $0 [-t <threshold %>] <results.json> [<baseline results.json> | <baseline server>]
+#
+# compare the throughput of the matrix runs collected by collect_matrix.pl:
+# either the same runs in two results files, e.g. before and after a server
+# upgrade, or all the servers in one file against the baseline server (the
+# first one by default). Exits with 1 if any run is slower than the baseline
+# by more than the threshold, 5% by default.
+#
+
+use strict;
+use Getopt::Std;
+use JSON::PP;
+
+my %opt = (t => 5);
+getopts("t:", \%opt) or die "bad options\n";
+my $fn = shift or die "no results file given!\n";
+my $base = shift;
+
+my @runs = load($fn);
+my (%new, %old);
+
+if (defined $base && -f $base) {
+    $new{key($_, 1)} = $_ for @runs;
+    $old{key($_, 1)} = $_ for load($base);
+} else {
+    $base //= $runs[0]{server};
+    for my $r (@runs) {
+        if ($r->{server} eq $base) {
+            $old{key($r, 0)} = $r;
+        } else {
+            $new{key($r, 0) . "\t" . $r->{server}} = $r;
+        }
+    }
+}
+
+my $regressions = 0;
+printf "%-60s %12s %12s %8s\n", "run", "base tps", "tps", "ratio";
+for my $k (sort keys %new) {
+    my $r = $new{$k};
+    my ($ok) = $k =~ /^([^\t]*(?:\t[^\t]*){4})/o;
+    my $b = $old{$ok} or next;
+    my $ratio = $r->{sysbench}{tps} / $b->{sysbench}{tps};
+    my $bad = $ratio < 1 - $opt{t} / 100;
+
+    $regressions++ if $bad;
+    (my $name = $k) =~ s/\t/ /go;
+    printf "%-60s %12.2f %12.2f %8.3f%s\n", $name, $b->{sysbench}{tps},
+           $r->{sysbench}{tps}, $ratio, $bad ? "  REGRESSION" : "";
+}
+print "$regressions regressions\n";
+
+exit($regressions ? 1 : 0);
+
+
+sub load
+{
+    my $fn = shift;
+    local $/;
+    open F, "<$fn" or die "cannot read from '$fn' : $!\n";
+    my $d = decode_json(<F>);
+    close F;
+    return @{$d->{runs}};
+}
+
+
+#
+# the run parameters without the server, the server is appended for the
+# comparison of two files
+#
+sub key
+{
+    my ($r, $with_server) = @_;
+    my $k = join "\t", map { $r->{$_} // "" }
+                       qw(charset collation range_size workload threads);
+    return $with_server ? $k . "\t" . $r->{server} : $k;
+}
@@ -0,0 +1,37 @@
+#
+# benchmark matrix for runmatrix.sh: every combination of the lists below
+# becomes one numbered run, RUN_BASE is the number of the first run
+#
+
+RUN_BASE=100
+
+#
+# server installations in $INST_DIR, names starting with "mysql-" are MySQL
+#
+SERVERS="mariadb-10.6.3 mysql-5.7.34 mysql-8.0.25"
+
+#
+# charset:collation pairs, "default" is the default collation of the charset
+#
+CHARSETS="latin1:default utf8:default utf8:utf8_general_ci utf8:utf8_unicode_ci
+          utf8mb4:default utf8mb4:utf8mb4_general_ci utf8mb4:utf8mb4_unicode_ci"
+
+THREADS="1 8 16 32 64 128 256"
+RANGE_SIZES="10 100"
+
+#
+# server config template, copied to my.cnf.NN for every run
+#
+MYCNF=my.cnf.01
+
+#
+# warm up the buffer pool and run each workload for WARMUP_TIME seconds
+# before the measured runs, the results of the warm-up run are discarded
+#
+WARMUP=1
+WARMUP_TIME=30
+
+#
+# structured results of the whole matrix
+#
+RESULTS=results.json
@@ -0,0 +1,70 @@
+#!/bin/bash
+#
+# usage: $0 <matrix spec>
+#
+# Expands the matrix spec into the numbered config.NN, my.cnf.NN and server.NN
+# files, runs each of them with runme.sh and collects all the results into one
+# structured file. Runs with an existing resNN directory are skipped by
+# runme.sh, so an interrupted matrix can be resumed by running it again.
+
+set -e
+set -u
+#set -x
+
+. config.sh
+
+SPEC=${1:?"no matrix spec given!"}
+. ./$SPEC
+
+test -e ${MYCNF} || { echo "${MYCNF} does not exist!"; exit 1; }
+
+run=$RUN_BASE
+for server in $SERVERS
+do
+  case $server in
+    mysql-*) is_mysql=1 ;;
+    *)       is_mysql=0 ;;
+  esac
+
+  for cs in $CHARSETS
+  do
+    charset=${cs%%:*}
+    collation=${cs#*:}
+    create="CHARACTER SET $charset"
+    test "$collation" != "default" && create="$create COLLATE $collation"
+
+    for range in $RANGE_SIZES
+    do
+      ii=`printf "%02d" $run`
+      run=$(($run + 1))
+
+      cat > config.$ii <<CUT
+IS_MYSQL=$is_mysql
+CREATE="$create"
+LUA_ARGS_RUN="--rand-type=uniform --range-size=$range"
+THREADS="$THREADS"
+WARMUP=$WARMUP
+WARMUP_TIME=$WARMUP_TIME
+CUT
+      cp $MYCNF my.cnf.$ii
+      echo $server > server.$ii
+      grep -q "^$ii \.\.\. " DESC \
+        || echo "$ii ... $server, $charset $collation collation, range $range" >> DESC
+
+      if [ ! -d res$ii ]
+      then
+        ./runme.sh $(($run - 1))
+        test -d res$ii || { echo "run $ii failed"; exit 1; }
+        cat > res$ii/matrix.info <<CUT
+server=$server
+charset=$charset
+collation=$collation
+range_size=$range
+CUT
+      fi
+    done
+  done
+done
+
+./collect_matrix.pl $(seq -f "%02g" $RUN_BASE $(($run - 1))) > $RESULTS
+echo "results are in $RESULTS"
@@ -0,0 +1,693 @@
+/**
+ * Cost of string comparison in the collations from the collations and
+ * collations2 sysbench runs. The oltp_range workload compares the c column
+ * values in "ORDER BY c" and "DISTINCT c" of each range, so the benchmark
+ * sorts the range size groups of the sysbench c values and compares random
+ * pairs of them, using the strnncollsp() style comparison modeled on
+ * MariaDB's strings/ctype-*.c for each collation, the same comparison with
+ * an AVX2 ASCII fast path modeled on stricmp_avx2() from fast_str/strcasecmp.c
+ * and the weight strings (strnxfrm()) compared by memcmp().
+ *
+ * The weight tables are simplified: Latin-1 letters with diacritics sort as
+ * the base letters, UCA primary weights keep the order of variable characters,
+ * digits and letters, ß and æ expand to two weights. The costs of the table
+ * lookups, UTF-8 decoding, expansions and PAD SPACE handling are the same as
+ * in the server.
+ *
+ * Build with: g++ -O2 -march=native -std=c++11 strnncoll.cc -o strnncoll
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 59
+ * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <immintrin.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#define likely(x)	__builtin_expect(!!(x), 1)
+#define unlikely(x)	__builtin_expect(!!(x), 0)
+
+typedef unsigned char uchar;
+
+static const int N_KEYS = 100000;
+static const int N_PAIRS = 1000000;
+// Maximum weight string length in weights, the longest key and expansions.
+static const size_t XFRM_WEIGHTS = 2 * 128;
+
+/* latin1_swedish_ci sort order. */
+static uint16_t latin1_w[256];
+/* utf8mb3/utf8mb4_general_ci weights for BMP. */
+static uint16_t general_w[0x10000];
+/* UCA primary weights for BMP, 0 for ignorable characters. */
+static uint16_t uca_w[0x10000];
+/* Second weights of the UCA expansions, 0 if there is no expansion. */
+static uint16_t uca_w2[0x10000];
+
+/* Base letters of Latin-1 Supplement 0xc0-0xff, 0 for not letters. */
+static const char latin1_base[] =
+	"AAAAAAACEEEEIIII" "DNOOOOO\0OUUUUYTS"
+	"AAAAAAACEEEEIIII" "DNOOOOO\0OUUUUYTY";
+
+static void
+init_weights()
+{
+	for (int c = 0; c < 256; ++c) {
+		latin1_w[c] = c;
+		if (c >= 'a' && c <= 'z')
+			latin1_w[c] = c - 0x20;
+		else if (c >= 0xc0 && latin1_base[c - 0xc0])
+			latin1_w[c] = latin1_base[c - 0xc0];
+	}
+
+	for (int c = 0; c < 0x10000; ++c)
+		general_w[c] = c < 256 ? latin1_w[c] : c;
+	general_w[0xd7] = general_w[0xf7] = 0xd7;
+
+	/*
+	 * UCA: controls are ignorable, then the variable characters (spaces
+	 * and punctuation), digits and letters.
+	 */
+	for (int c = 0; c < 0x10000; ++c) {
+		if (c < 0x20 || c == 0x7f)
+			uca_w[c] = 0;
+		else if (c == ' ')
+			uca_w[c] = 0x0209;
+		else if (c >= '0' && c <= '9')
+			uca_w[c] = 0x0e29 + c - '0';
+		else if (c >= 'A' && c <= 'Z')
+			uca_w[c] = 0x0e33 + (c - 'A') * 0x20;
+		else if (c >= 'a' && c <= 'z')
+			uca_w[c] = 0x0e33 + (c - 'a') * 0x20;
+		else if (c < 0x80)
+			uca_w[c] = 0x0220 + c;
+		else if (c >= 0xc0 && c < 0x100 && latin1_base[c - 0xc0])
+			uca_w[c] = uca_w[(uchar)latin1_base[c - 0xc0]];
+		else
+			uca_w[c] = 0x2000 + c / 2;
+	}
+	uca_w[0xdf] = uca_w2[0xdf] = uca_w['S'];
+	uca_w[0xe6] = uca_w[0xc6] = uca_w['A'];
+	uca_w2[0xe6] = uca_w2[0xc6] = uca_w['E'];
+}
+
+/*
+ * Weight scanners: next() returns the next weight of the string or -1 at
+ * the end.
+ */
+struct Latin1Scanner {
+	static const int SPACE = ' ';
+	const uchar *s, *end;
+
+	Latin1Scanner(const uchar *s, size_t len) : s(s), end(s + len) {}
+
+	static int ascii_weight(uchar c) { return latin1_w[c]; }
+
+	int
+	next()
+	{
+		return s < end ? latin1_w[*s++] : -1;
+	}
+};
+
+/*
+ * my_mb_wc_utf8mb3/utf8mb4(): @return the code point and advances @s,
+ * invalid sequences are read as one byte 0xfffd.
+ */
+template<bool MB4>
+static inline int
+utf8_decode(const uchar *&s, const uchar *end)
+{
+	uchar c = *s;
+
+	if (c < 0x80) {
+		++s;
+		return c;
+	}
+	if (c >= 0xc2 && c < 0xe0 && s + 2 <= end && (s[1] & 0xc0) == 0x80) {
+		s += 2;
+		return ((c & 0x1f) << 6) | (s[-1] & 0x3f);
+	}
+	if (c >= 0xe0 && c < 0xf0 && s + 3 <= end
+	    && (s[1] & 0xc0) == 0x80 && (s[2] & 0xc0) == 0x80)
+	{
+		s += 3;
+		return ((c & 0x0f) << 12) | ((s[-2] & 0x3f) << 6)
+		       | (s[-1] & 0x3f);
+	}
+	if (MB4 && c >= 0xf0 && c < 0xf5 && s + 4 <= end
+	    && (s[1] & 0xc0) == 0x80 && (s[2] & 0xc0) == 0x80
+	    && (s[3] & 0xc0) == 0x80)
+	{
+		s += 4;
+		return ((c & 0x07) << 18) | ((s[-3] & 0x3f) << 12)
+		       | ((s[-2] & 0x3f) << 6) | (s[-1] & 0x3f);
+	}
+	++s;
+	return 0xfffd;
+}
+
+template<bool MB4>
+struct GeneralScanner {
+	static const int SPACE = ' ';
+	const uchar *s, *end;
+
+	GeneralScanner(const uchar *s, size_t len) : s(s), end(s + len) {}
+
+	static int ascii_weight(uchar c) { return general_w[c]; }
+
+	int
+	next()
+	{
+		if (s >= end)
+			return -1;
+		int wc = utf8_decode<MB4>(s, end);
+		// Supplementary characters sort as the replacement character.
+		return wc < 0x10000 ? general_w[wc] : 0xfffd;
+	}
+};
+
+template<bool MB4>
+struct UcaScanner {
+	static const int SPACE = 0x0209;
+	const uchar *s, *end;
+	int pending;
+
+	UcaScanner(const uchar *s, size_t len)
+		: s(s), end(s + len), pending(0)
+	{}
+
+	static int ascii_weight(uchar c) { return uca_w[c]; }
+
+	int
+	next()
+	{
+		if (pending) {
+			int w = pending;
+			pending = 0;
+			return w;
+		}
+		while (s < end) {
+			int wc = utf8_decode<MB4>(s, end);
+			if (wc >= 0x10000)
+				return 0xfbc0 + (wc >> 15);
+			if (uca_w[wc]) {
+				pending = uca_w2[wc];
+				return uca_w[wc];
+			}
+		}
+		return -1;
+	}
+};
+
+/*
+ * my_strnncollsp_*(): with PAD SPACE the longer string tail is compared with
+ * spaces, with NO PAD (utf8mb4_0900_ai_ci) the longer string is greater.
+ */
+template<class S, bool PadSpace>
+static int
+strnncollsp(const uchar *a, size_t alen, const uchar *b, size_t blen)
+{
+	S sa(a, alen), sb(b, blen);
+	int wa, wb;
+
+	for (;;) {
+		wa = sa.next();
+		wb = sb.next();
+		if (wa < 0 || wb < 0)
+			break;
+		if (wa != wb)
+			return wa - wb;
+	}
+	if (wa < 0 && wb < 0)
+		return 0;
+	if (!PadSpace)
+		return wa < 0 ? -1 : 1;
+
+	S &s = wa < 0 ? sb : sa;
+	int sign = wa < 0 ? -1 : 1;
+	for (int w = wa < 0 ? wb : wa; w >= 0; w = s.next())
+		if (w != S::SPACE)
+			return w > S::SPACE ? sign : -sign;
+
+	return 0;
+}
+
+/*
+ * ASCII fast path for 32 bytes: true if the chunks are printable ASCII
+ * (no ignorable, multi-byte or non-ASCII Latin-1 characters), then @eq gets
+ * the mask of the case insensitive equal bytes. Case folding is the same as
+ * in __stricmp_avx2().
+ */
+static inline bool
+__ascii_ci_avx2(const uchar *s0, const uchar *s1, unsigned int &eq)
+{
+	const __m256i CTL = _mm256_set1_epi8(0x1f);
+	const __m256i DEL = _mm256_set1_epi8(0x7f);
+	const __m256i A = _mm256_set1_epi8(0x40); /* 'A' - 1 */
+	const __m256i Z = _mm256_set1_epi8(0x5b); /* 'Z' + 1 */
+	const __m256i CASE = _mm256_set1_epi8(0x20);
+
+	__m256i v0 = _mm256_lddqu_si256((const __m256i *)s0);
+	__m256i v1 = _mm256_lddqu_si256((const __m256i *)s1);
+
+	// Signed compare: the bytes >= 0x80 are negative.
+	__m256i p = _mm256_and_si256(_mm256_cmpgt_epi8(v0, CTL),
+				     _mm256_cmpgt_epi8(v1, CTL));
+	p = _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v0, DEL),
+						_mm256_cmpeq_epi8(v1, DEL)), p);
+	if (unlikely((unsigned int)_mm256_movemask_epi8(p) != 0xffffffff))
+		return false;
+
+	__m256i lc0 = _mm256_and_si256(_mm256_and_si256(
+					_mm256_cmpgt_epi8(v0, A),
+					_mm256_cmpgt_epi8(Z, v0)), CASE);
+	__m256i lc1 = _mm256_and_si256(_mm256_and_si256(
+					_mm256_cmpgt_epi8(v1, A),
+					_mm256_cmpgt_epi8(Z, v1)), CASE);
+	__m256i vl0 = _mm256_or_si256(v0, lc0);
+	__m256i vl1 = _mm256_or_si256(v1, lc1);
+
+	eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(vl0, vl1));
+
+	return true;
+}
+
+/* The same for 16 bytes with SSE. */
+static inline bool
+__ascii_ci_sse(const uchar *s0, const uchar *s1, unsigned int &eq)
+{
+	const __m128i CTL = _mm_set1_epi8(0x1f);
+	const __m128i DEL = _mm_set1_epi8(0x7f);
+	const __m128i A = _mm_set1_epi8(0x40);
+	const __m128i Z = _mm_set1_epi8(0x5b);
+	const __m128i CASE = _mm_set1_epi8(0x20);
+
+	__m128i v0 = _mm_loadu_si128((const __m128i *)s0);
+	__m128i v1 = _mm_loadu_si128((const __m128i *)s1);
+
+	__m128i p = _mm_and_si128(_mm_cmpgt_epi8(v0, CTL),
+				  _mm_cmpgt_epi8(v1, CTL));
+	p = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi8(v0, DEL),
+					  _mm_cmpeq_epi8(v1, DEL)), p);
+	if (unlikely(_mm_movemask_epi8(p) != 0xffff))
+		return false;
+
+	__m128i lc0 = _mm_and_si128(_mm_and_si128(_mm_cmpgt_epi8(v0, A),
+						  _mm_cmpgt_epi8(Z, v0)), CASE);
+	__m128i lc1 = _mm_and_si128(_mm_and_si128(_mm_cmpgt_epi8(v1, A),
+						  _mm_cmpgt_epi8(Z, v1)), CASE);
+
+	eq = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(v0, lc0),
+					      _mm_or_si128(v1, lc1)))
+	     | 0xffff0000;
+
+	return true;
+}
+
+/*
+ * strnncollsp() with the ASCII fast path: printable ASCII is one byte per
+ * character and one weight, and the case insensitive equal characters have
+ * the same weights in all the collations, so the first different byte
+ * decides. Falls back to the scalar comparison from the chunk start on any
+ * other character, the previous chunks were ASCII, so the start is on a
+ * character boundary.
+ */
+template<class S, bool PadSpace>
+static int
+strnncollsp_avx2(const uchar *a, size_t alen, const uchar *b, size_t blen)
+{
+	size_t n = std::min(alen, blen), i = 0;
+	unsigned int eq;
+
+	/*
+	 * Random keys mostly differ in the first bytes, check them before
+	 * the vector loads like stricmp_avx2() does.
+	 */
+	for ( ; i < std::min<size_t>(n, 8); ++i) {
+		uchar c0 = a[i], c1 = b[i];
+		if (unlikely(c0 < 0x20 || c0 >= 0x7f || c1 < 0x20 || c1 >= 0x7f))
+			goto scalar;
+		int d = S::ascii_weight(c0) - S::ascii_weight(c1);
+		if (d)
+			return d;
+	}
+
+	for ( ; i + 32 <= n; i += 32) {
+		if (!__ascii_ci_avx2(a + i, b + i, eq))
+			goto scalar;
+		if (eq != 0xffffffff)
+			goto diff;
+	}
+	if (i + 16 <= n) {
+		if (!__ascii_ci_sse(a + i, b + i, eq))
+			goto scalar;
+		if (eq != 0xffffffff)
+			goto diff;
+		i += 16;
+	}
+	goto scalar;
+diff:
+	{
+		int k = __builtin_ctz(~eq);
+		int d = S::ascii_weight(a[i + k]) - S::ascii_weight(b[i + k]);
+		if (likely(d))
+			return d;
+	}
+scalar:
+	return strnncollsp<S, PadSpace>(a + i, alen - i, b + i, blen - i);
+}
+
+/*
+ * my_strnxfrm_*(): big-endian 16-bit weights, PAD SPACE collations pad the
+ * result with the space weights to the fixed length.
+ * @return the weight string length in bytes.
+ */
+template<class S, bool PadSpace>
+static size_t
+strnxfrm(uchar *dst, const uchar *src, size_t len)
+{
+	S s(src, len);
+	size_t n = 0;
+	int w;
+
+	while ((w = s.next()) >= 0 && n < XFRM_WEIGHTS) {
+		dst[n * 2] = w >> 8;
+		dst[n * 2 + 1] = w;
+		++n;
+	}
+	if (PadSpace)
+		for ( ; n < XFRM_WEIGHTS; ++n) {
+			dst[n * 2] = S::SPACE >> 8;
+			dst[n * 2 + 1] = S::SPACE & 0xff;
+		}
+
+	return n * 2;
+}
+
+typedef int (*cmp_fn)(const uchar *, size_t, const uchar *, size_t);
+typedef size_t (*xfrm_fn)(uchar *, const uchar *, size_t);
+
+static const struct Collation {
+	const char	*name;
+	bool		latin1;
+	cmp_fn		cmp;
+	cmp_fn		cmp_avx2;
+	xfrm_fn		xfrm;
+} collations[] = {
+#define COLL(name, latin1, S, pad)					\
+	{ name, latin1, strnncollsp<S, pad>, strnncollsp_avx2<S, pad>,	\
+	  strnxfrm<S, pad> }
+	COLL("latin1_swedish_ci", true, Latin1Scanner, true),
+	COLL("utf8mb3_general_ci", false, GeneralScanner<false>, true),
+	COLL("utf8mb4_general_ci", false, GeneralScanner<true>, true),
+	COLL("utf8mb3_unicode_ci", false, UcaScanner<false>, true),
+	COLL("utf8mb4_unicode_ci", false, UcaScanner<true>, true),
+	COLL("utf8mb4_0900_ai_ci", false, UcaScanner<true>, false),
+#undef COLL
+};
+
+/* Each key in UTF-8 and Latin-1 encodings. */
+struct Keys {
+	const char			*name;
+	std::vector<std::string>	utf8;
+	std::vector<std::string>	latin1;
+};
+
+static std::string
+utf8_to_latin1(const std::string &s)
+{
+	std::string r;
+
+	for (size_t i = 0; i < s.size(); ++i) {
+		uchar c = s[i];
+		if (c >= 0xc2 && c < 0xc4 && i + 1 < s.size()) {
+			r += (char)(((c & 0x1f) << 6) | (s[++i] & 0x3f));
+			continue;
+		}
+		r += (char)c;
+	}
+
+	return r;
+}
+
+/*
+ * The c column values from oltp_common.lua: sysbench.rand.string() of
+ * the template with '#' replaced by random digits.
+ */
+static void
+gen_sysbench_c(Keys &k, std::mt19937 &rng)
+{
+	static const char tmpl[] =
+		"###########-###########-###########-"
+		"###########-###########-###########-"
+		"###########-###########-###########-"
+		"###########";
+
+	for (int i = 0; i < N_KEYS; ++i) {
+		std::string s(tmpl);
+		for (auto &c : s)
+			if (c == '#')
+				c = '0' + rng() % 10;
+		k.utf8.push_back(s);
+		k.latin1.push_back(s);
+	}
+}
+
+/*
+ * Mixed case words of names and titles with 2% of Latin-1 letters with
+ * diacritics, to show how often the fast path falls back.
+ */
+static void
+gen_text(Keys &k, std::mt19937 &rng)
+{
+	static const char *syl[] = {
+		"ka", "lo", "mer", "sen", "an", "der", "ström", "gå", "ri",
+		"ch", "te", "bæk", "son", "mü", "ller", "é", "to", "ß", "ne",
+	};
+	static const size_t n_syl = sizeof(syl) / sizeof(*syl);
+
+	for (int i = 0; i < N_KEYS; ++i) {
+		std::string s;
+		int words = 2 + rng() % 4;
+		for (int w = 0; w < words; ++w) {
+			int n = 2 + rng() % 3;
+			if (w)
+				s += ' ';
+			size_t start = s.size();
+			for (int j = 0; j < n; ++j) {
+				const char *p = syl[rng() % 14];
+				// Rare non-ASCII syllables.
+				if (rng() % 50 == 0)
+					p = syl[14 + rng() % (n_syl - 14)];
+				s += p;
+			}
+			if (rng() % 2 && (uchar)s[start] < 0x80)
+				s[start] &= ~0x20;
+		}
+		k.utf8.push_back(s);
+		k.latin1.push_back(utf8_to_latin1(s));
+	}
+}
+
+static inline int
+sign(int x)
+{
+	return (x > 0) - (x < 0);
+}
+
+static const std::vector<std::string> &
+keys_for(const Keys &k, const Collation &c)
+{
+	return c.latin1 ? k.latin1 : k.utf8;
+}
+
+/*
+ * The fast path and the weight strings must give the same order as
+ * the scalar comparison.
+ */
+static void
+check(const Keys &k, const Collation &c, const std::vector<int> &pairs)
+{
+	const std::vector<std::string> &v = keys_for(k, c);
+	static uchar x0[XFRM_WEIGHTS * 2], x1[XFRM_WEIGHTS * 2];
+
+	for (size_t i = 0; i < pairs.size(); i += 2) {
+		const std::string &a = v[pairs[i]], &b = v[pairs[i + 1]];
+		const uchar *pa = (const uchar *)a.data();
+		const uchar *pb = (const uchar *)b.data();
+		int r = sign(c.cmp(pa, a.size(), pb, b.size()));
+		size_t l0 = c.xfrm(x0, pa, a.size());
+		size_t l1 = c.xfrm(x1, pb, b.size());
+		int rx = memcmp(x0, x1, std::min(l0, l1));
+
+		if (!rx)
+			rx = (int)l0 - (int)l1;
+		if (sign(c.cmp_avx2(pa, a.size(), pb, b.size())) != r
+		    || sign(rx) != r)
+		{
+			std::cerr << c.name << ": mismatch for '" << a
+				  << "' and '" << b << "'" << std::endl;
+			exit(1);
+		}
+	}
+}
+
+template<typename F>
+static double
+ns_per(size_t n, F f)
+{
+	auto t0 = std::chrono::steady_clock::now();
+	f();
+	auto t1 = std::chrono::steady_clock::now();
+
+	return std::chrono::duration<double, std::nano>(t1 - t0).count() / n;
+}
+
+static volatile int sink;
+
+static double
+bench_pairs(const std::vector<std::string> &v, const std::vector<int> &pairs,
+	    cmp_fn cmp)
+{
+	return ns_per(pairs.size() / 2, [&] {
+		int r = 0;
+		for (size_t i = 0; i < pairs.size(); i += 2) {
+			const std::string &a = v[pairs[i]], &b = v[pairs[i + 1]];
+			r += cmp((const uchar *)a.data(), a.size(),
+				 (const uchar *)b.data(), b.size()) > 0;
+		}
+		sink = r;
+	});
+}
+
+/*
+ * ORDER BY c of each range: sort the groups of @range consecutive keys.
+ * @return nanoseconds per sorted key.
+ */
+static double
+bench_sort(const std::vector<std::string> &v, int range, cmp_fn cmp)
+{
+	std::vector<const std::string *> g(range);
+
+	return ns_per(v.size() / range * range, [&] {
+		for (size_t i = 0; i + range <= v.size(); i += range) {
+			for (int j = 0; j < range; ++j)
+				g[j] = &v[i + j];
+			std::sort(g.begin(), g.end(),
+				  [cmp](const std::string *a, const std::string *b) {
+					return cmp((const uchar *)a->data(), a->size(),
+						   (const uchar *)b->data(),
+						   b->size()) < 0;
+				  });
+			sink = g[0]->size();
+		}
+	});
+}
+
+/* Filesort style: strnxfrm() every key once, then sort by memcmp(). */
+static double
+bench_sort_xfrm(const std::vector<std::string> &v, int range, xfrm_fn xfrm)
+{
+	std::vector<std::vector<uchar>> x(range,
+					  std::vector<uchar>(XFRM_WEIGHTS * 2));
+	std::vector<size_t> xl(range);
+	std::vector<int> g(range);
+
+	return ns_per(v.size() / range * range, [&] {
+		for (size_t i = 0; i + range <= v.size(); i += range) {
+			for (int j = 0; j < range; ++j) {
+				const std::string &s = v[i + j];
+				xl[j] = xfrm(x[j].data(), (const uchar *)s.data(),
+					     s.size());
+				g[j] = j;
+			}
+			std::sort(g.begin(), g.end(), [&](int a, int b) {
+				int r = memcmp(x[a].data(), x[b].data(),
+					       std::min(xl[a], xl[b]));
+				return r ? r < 0 : xl[a] < xl[b];
+			});
+			sink = g[0];
+		}
+	});
+}
+
+static int
+bin_cmp(const uchar *a, size_t alen, const uchar *b, size_t blen)
+{
+	int r = memcmp(a, b, std::min(alen, blen));
+
+	return r ? r : (int)alen - (int)blen;
+}
+
+int
+main()
+{
+	std::mt19937 rng(1);
+	std::vector<int> pairs(N_PAIRS * 2);
+	Keys sets[2] = { { "sysbench c" }, { "mixed text" } };
+
+	if (!__builtin_cpu_supports("avx2")) {
+		std::cerr << "AVX2 is required" << std::endl;
+		return 1;
+	}
+	init_weights();
+	gen_sysbench_c(sets[0], rng);
+	gen_text(sets[1], rng);
+	for (auto &p : pairs)
+		p = rng() % N_KEYS;
+
+	for (auto &k : sets) {
+		std::cout << "\n" << k.name << " keys, ns per comparison for random"
+			  << " pairs and per key for ORDER BY of ranges:"
+			  << std::endl;
+		printf("%-20s %8s %8s %10s %10s %10s %10s\n", "collation",
+		       "cmp", "cmp_avx2", "range10", "r10_avx2", "range100",
+		       "r100_avx2");
+		printf("%-20s %8.1f %8s %10.1f %10s %10.1f %10s\n", "binary",
+		       bench_pairs(k.utf8, pairs, bin_cmp), "-",
+		       bench_sort(k.utf8, 10, bin_cmp), "-",
+		       bench_sort(k.utf8, 100, bin_cmp), "-");
+		for (auto &c : collations) {
+			const std::vector<std::string> &v = keys_for(k, c);
+
+			check(k, c, pairs);
+			printf("%-20s %8.1f %8.1f %10.1f %10.1f %10.1f %10.1f\n",
+			       c.name, bench_pairs(v, pairs, c.cmp),
+			       bench_pairs(v, pairs, c.cmp_avx2),
+			       bench_sort(v, 10, c.cmp),
+			       bench_sort(v, 10, c.cmp_avx2),
+			       bench_sort(v, 100, c.cmp),
+			       bench_sort(v, 100, c.cmp_avx2));
+		}
+
+		std::cout << "strnxfrm() + memcmp(), ns per key:" << std::endl;
+		for (auto &c : collations) {
+			const std::vector<std::string> &v = keys_for(k, c);
+
+			printf("%-20s %10.1f %10.1f\n", c.name,
+			       bench_sort_xfrm(v, 10, c.xfrm),
+			       bench_sort_xfrm(v, 100, c.xfrm));
+		}
+	}
+
+	return 0;
+}
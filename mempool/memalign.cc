@@ -25,14 +25,21 @@
  * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 #include <assert.h>
+#include <malloc.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include <chrono>
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
+
+#include "../bench.h"
 
 static const size_t PAGE_SIZE = 4096;
 static const size_t N = 100 * 1000;
@@ -43,15 +50,19 @@ benchmark(const char *desc, std::function<void ()> cb)
 {
 	using namespace std::chrono;
 
+	struct bench_perf perf;
+	bench_perf_begin(&perf);
 	// steady_clock has the same resolution as high_resolution_clock
 	auto t(steady_clock::now());
 
 	cb();
 
 	auto dt = steady_clock::now() - t;
+	bench_perf_end(&perf);
 	std::cout << std::setw(30) << std::right << desc << ":    "
 		  << duration_cast<milliseconds>(dt).count()
 		  << "ms" << std::endl;
+	bench_report(desc, 0, NULL, 0, &perf);
 }
 
 #define touch_obj(o)							\
@@ -62,6 +73,252 @@ benchmark(const char *desc, std::function<void ()> cb)
 		*(long *)o = 1;						\
 	}
 
+/*
+ * ------------------------------------------------------------------------
+ *	Aligned slab allocator
+ * ------------------------------------------------------------------------
+ */
+/**
+ * The objects are of power of two size classes from 64 bytes to 2MB carved
+ * from 2MB slabs, so each object is aligned to its size. The slabs are
+ * backed by huge pages: either reserved ones (MAP_HUGETLB) or THP for
+ * an aligned ordinary mapping. The slabs are never unmapped.
+ *
+ * Each thread caches the freed objects of each class, up to 4MB of them and
+ * not more than SLAB_CACHE_SZ objects. An empty cache is refilled with
+ * a half of the cache capacity from the shared depot or from a new slab,
+ * a full cache flushes a half of its objects to the depot. The caches are
+ * returned to the depot by slab_drain() on a thread exit.
+ */
+static const size_t SLAB_SZ = 2 * 1024 * 1024;
+static const unsigned int SLAB_MIN_SHIFT = 6;
+static const unsigned int SLAB_CLASSES = 21 - SLAB_MIN_SHIFT + 1;
+static const unsigned int SLAB_CACHE_SZ = 64;
+
+struct SlabCache {
+	unsigned int	n[SLAB_CLASSES];
+	void		*objs[SLAB_CLASSES][SLAB_CACHE_SZ];
+};
+
+static __thread SlabCache slab_cache;
+static std::mutex slab_lock;
+static std::vector<void *> slab_depot[SLAB_CLASSES];
+
+static inline unsigned int
+slab_class(size_t size, size_t align)
+{
+	size_t n = std::max(std::max(size, align), 1UL << SLAB_MIN_SHIFT);
+
+	return 64 - __builtin_clzl(n - 1) - SLAB_MIN_SHIFT;
+}
+
+static inline unsigned int
+slab_cache_cap(unsigned int c)
+{
+	return std::max(1U, std::min(SLAB_CACHE_SZ,
+				     (4U << 20) >> (c + SLAB_MIN_SHIFT)));
+}
+
+static void *
+slab_map()
+{
+	void *p = mmap(NULL, SLAB_SZ, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED)
+		return p;
+
+	// No reserved huge pages: align a twice bigger mapping.
+	p = mmap(NULL, SLAB_SZ * 2, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	char *a = (char *)(((unsigned long)p + SLAB_SZ - 1) & ~(SLAB_SZ - 1));
+	if (a != p)
+		munmap(p, a - (char *)p);
+	munmap(a + SLAB_SZ, (char *)p + SLAB_SZ - a);
+	madvise(a, SLAB_SZ, MADV_HUGEPAGE);
+
+	return a;
+}
+
+/**
+ * Refill the thread cache of class @c from the depot or a new slab.
+ */
+static bool
+slab_refill(SlabCache *sc, unsigned int c)
+{
+	size_t sz = 1UL << (c + SLAB_MIN_SHIFT);
+	unsigned int want = (slab_cache_cap(c) + 1) / 2;
+	std::vector<void *> &d = slab_depot[c];
+	std::lock_guard<std::mutex> _(slab_lock);
+
+	if (d.empty()) {
+		char *s = (char *)slab_map();
+		if (!s)
+			return false;
+		for (size_t off = SLAB_SZ; off; off -= sz)
+			d.push_back(s + off - sz);
+	}
+	for ( ; want && !d.empty(); --want) {
+		sc->objs[c][sc->n[c]++] = d.back();
+		d.pop_back();
+	}
+
+	return true;
+}
+
+static void
+slab_flush(SlabCache *sc, unsigned int c)
+{
+	unsigned int n = sc->n[c] / 2 + 1;
+	std::lock_guard<std::mutex> _(slab_lock);
+
+	for ( ; n; --n)
+		slab_depot[c].push_back(sc->objs[c][--sc->n[c]]);
+}
+
+/**
+ * Return the thread cache to the depot, called on a thread exit.
+ */
+void
+slab_drain()
+{
+	SlabCache *sc = &slab_cache;
+	std::lock_guard<std::mutex> _(slab_lock);
+
+	for (unsigned int c = 0; c < SLAB_CLASSES; ++c)
+		for ( ; sc->n[c]; --sc->n[c])
+			slab_depot[c].push_back(sc->objs[c][sc->n[c] - 1]);
+}
+
+void *
+slab_alloc(size_t size, size_t align)
+{
+	SlabCache *sc = &slab_cache;
+	unsigned int c = slab_class(size, align);
+
+	if (__builtin_expect(c >= SLAB_CLASSES, 0))
+		return NULL;
+	if (__builtin_expect(!sc->n[c], 0) && !slab_refill(sc, c))
+		return NULL;
+
+	return sc->objs[c][--sc->n[c]];
+}
+
+void
+slab_free(void *p, size_t size, size_t align)
+{
+	SlabCache *sc = &slab_cache;
+	unsigned int c = slab_class(size, align);
+
+	if (__builtin_expect(sc->n[c] == slab_cache_cap(c), 0))
+		slab_flush(sc, c);
+	sc->objs[c][sc->n[c]++] = p;
+}
+
+/*
+ * ------------------------------------------------------------------------
+ *	Multi-threaded benchmark with mixed alignments
+ * ------------------------------------------------------------------------
+ */
+static const size_t N_MT = 100 * 1000;
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+struct Memalign {
+	static constexpr const char *name = "memalign";
+	static void *
+	alloc(size_t size, size_t align)
+	{ return memalign(align, size); }
+	static void dealloc(void *p, size_t, size_t) { free(p); }
+	static void drain() {}
+};
+
+struct PosixMemalign {
+	static constexpr const char *name = "posix_memalign";
+	static void *
+	alloc(size_t size, size_t align)
+	{
+		void *p;
+		return posix_memalign(&p, align, size) ? NULL : p;
+	}
+	static void dealloc(void *p, size_t, size_t) { free(p); }
+	static void drain() {}
+};
+
+struct AlignedAlloc {
+	static constexpr const char *name = "aligned_alloc";
+	static void *
+	alloc(size_t size, size_t align)
+	{ return aligned_alloc(align, size); }
+	static void dealloc(void *p, size_t, size_t) { free(p); }
+	static void drain() {}
+};
+
+struct Slab {
+	static constexpr const char *name = "slab";
+	static void *
+	alloc(size_t size, size_t align)
+	{ return slab_alloc(size, align); }
+	static void
+	dealloc(void *p, size_t size, size_t align)
+	{ slab_free(p, size, align); }
+	static void drain() { slab_drain(); }
+};
+
+/*
+ * Each of N_MT iterations, divided among @n threads, allocates and then
+ * frees 16 network buffers: 8 descriptors of 256 bytes aligned to a cache
+ * line, 7 pages and a page or, in each 64th iteration, a 2MB huge page.
+ */
+template<class A>
+void
+benchmark_mixed(unsigned int n)
+{
+	std::string desc = std::string(A::name) + " (" + std::to_string(n)
+			   + " thr.)";
+
+	benchmark(desc.c_str(), [=]() {
+		std::vector<std::thread> thr;
+
+		for (unsigned int t = 0; t < n; ++t)
+			thr.emplace_back([=]() {
+				void *objs[16];
+				size_t sz[16], al[16];
+				int j, r = 0;
+
+				for (size_t i = t; i < N_MT; i += n) {
+					for (j = 0; j < 16; ++j) {
+						al[j] = j < 8 ? 64 : PAGE_SIZE;
+						if (j == 15 && !(i % 64))
+							al[j] = HUGE_PAGE_SIZE;
+						sz[j] = j < 8 ? 256 : al[j];
+						objs[j] = A::alloc(sz[j], al[j]);
+						r |= !objs[j];
+						touch_obj(objs[j]);
+					}
+					while (--j >= 0)
+						A::dealloc(objs[j], sz[j], al[j]);
+					if (r)
+						break;
+				}
+				// Return the cached objects for the next runs.
+				A::drain();
+			});
+		for (auto &t : thr)
+			t.join();
+	});
+}
+
+template<class A>
+void
+benchmark_mixed_threads()
+{
+	for (unsigned int n = 1; n <= 64; n *= 4)
+		benchmark_mixed<A>(n);
+	std::cout << std::endl;
+}
+
 int
 main()
 {
@@ -91,5 +348,11 @@ main()
 		}
 	});
 
+	std::cout << "\nMixed alignments:" << std::endl;
+	benchmark_mixed_threads<Memalign>();
+	benchmark_mixed_threads<PosixMemalign>();
+	benchmark_mixed_threads<AlignedAlloc>();
+	benchmark_mixed_threads<Slab>();
+
 	return 0;
 }
@@ -18,6 +18,9 @@
  *	tfw_pool w/ free (Mix):		99ms
  *	tfw_pool cr. & destr.:		54ms
  *
+ * Load the module with mcpu=1 to run the pools on all the online CPUs
+ * concurrently instead.
+ *
  * Copyright (C) 2015 Alexander Krizhanovsky (ak@tempesta-tech.com).
  *
  * This program is free software; you can redistribute it and/or modify it
@@ -34,13 +37,24 @@
  * this program; if not, write to the Free Software Foundation, Inc., 59
  * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
+#include <linux/atomic.h>
+#include <linux/bottom_half.h>
+#include <linux/completion.h>
 #include <linux/gfp.h>
 #include <linux/kernel.h>
+#include <linux/kthread.h>
 #include <linux/module.h>
+#include <linux/sched.h>
 #include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/wait.h>
 
 MODULE_LICENSE("GPL");
 
+static bool mcpu;
+module_param(mcpu, bool, 0444);
+MODULE_PARM_DESC(mcpu, "Run the pools on all the online CPUs concurrently");
+
 // sizeof(TfwStr)
 typedef struct {
 	long l[3];
@@ -58,6 +72,8 @@ typedef struct {
 
 #define N		(20 * 1000 * 1000)
 #define N_ALLOC		(100 * 1000)
+/* Number of elements of the growing arrays. */
+#define GROW_N		256
 static void *p_arr[N_ALLOC];
 
 /*
@@ -266,10 +282,11 @@ typedef struct tfw_pool_chunk_t {
  * Memory pool descriptor.
  *
  * @curr	- current chunk to allocate memory from;
- * @free	- current of list of free chunks;
+ * @fl		- free lists of the small size classes, NULL if disabled;
  */
 typedef struct {
 	TfwPoolChunk	*curr;
+	void		**fl;
 } TfwPool;
 
 #define TFW_POOL_CHUNK_SZ(c)	(PAGE_SIZE << (c)->order)
@@ -278,54 +295,232 @@ typedef struct {
 #define TFW_POOL_ALIGN_SZ(n)	(((n) + 7) & ~7UL)
 #define TFW_POOL_HEAD_OFF	(TFW_POOL_ALIGN_SZ(sizeof(TfwPool))	\
 				 + TFW_POOL_ALIGN_SZ(sizeof(TfwPoolChunk)))
-#define TFW_POOL_PGCACHE_SZ	512
+/*
+ * The free lists keep the blocks freed not in the stack order, a size class
+ * for each aligned size up to TFW_POOL_FL_MAX.
+ */
+#define TFW_POOL_FL_MAX		256
+#define TFW_POOL_FL_CLASS(n)	((n) / 8 - 1)
+#define TFW_POOL_FL_SZ		(sizeof(void *)				\
+				 * (TFW_POOL_FL_CLASS(TFW_POOL_FL_MAX) + 1))
+/**
+ * Per-CPU page cache.
+ *
+ * Each CPU keeps freed chunks of the small orders in two magazines per order
+ * like Bonwick's slab allocator: the pages are allocated from and freed to
+ * the loaded magazine, and the previous one is swapped in when the loaded
+ * magazine is empty or full. Only when both of them are empty or full
+ * a magazine is exchanged with the shared depot, so the pages freed on one
+ * CPU are reused on the others.
+ *
+ * The depot lists are lock-free stacks. The magazines are never freed, they
+ * are taken from a static array of each order, so the stack heads keep
+ * the magazine index tagged with a generation to avoid ABA on pop.
+ */
+#define TFW_POOL_PGCACHE_ORDERS	4
+#define TFW_POOL_MAG_SZ		32
+#define TFW_POOL_DEPOT_MAGS	1024
+/* The depot list head: the generation and the magazine index plus one. */
+#define TFW_PG_HEAD_IDX(h)	((unsigned int)(h))
+#define TFW_PG_HEAD(h, i)	((((h) >> 32) + 1) << 32 | (i))
+
+/**
+ * @next	- index plus one of the next magazine in the depot list;
+ * @n		- number of cached chunks;
+ */
+typedef struct {
+	unsigned int	next;
+	unsigned int	n;
+	unsigned long	pages[TFW_POOL_MAG_SZ];
+} TfwPgMag;
+
+/**
+ * @full	- magazines with cached chunks;
+ * @empty	- empty magazines;
+ * @used	- number of magazines taken from @mags;
+ */
+typedef struct {
+	u64		full;
+	u64		empty;
+	atomic_t	used;
+	TfwPgMag	mags[TFW_POOL_DEPOT_MAGS];
+} TfwPgDepot;
+
+typedef struct {
+	TfwPgMag	*loaded[TFW_POOL_PGCACHE_ORDERS];
+	TfwPgMag	*prev[TFW_POOL_PGCACHE_ORDERS];
+} TfwPgCpu;
+
+static TfwPgDepot pg_depot[TFW_POOL_PGCACHE_ORDERS];
+static DEFINE_PER_CPU(TfwPgCpu, pg_cpu);
+
+static void
+tfw_pg_depot_push(TfwPgDepot *d, u64 *head, TfwPgMag *m)
+{
+	u64 h;
+
+	do {
+		h = READ_ONCE(*head);
+		m->next = TFW_PG_HEAD_IDX(h);
+	} while (cmpxchg(head, h, TFW_PG_HEAD(h, m - d->mags + 1)) != h);
+}
+
+static TfwPgMag *
+tfw_pg_depot_pop(TfwPgDepot *d, u64 *head)
+{
+	u64 h;
+	TfwPgMag *m;
 
-static DEFINE_PER_CPU(unsigned int, pg_next);
-static DEFINE_PER_CPU(unsigned long [TFW_POOL_PGCACHE_SZ], pg_cache);
+	do {
+		h = READ_ONCE(*head);
+		if (!TFW_PG_HEAD_IDX(h))
+			return NULL;
+		m = &d->mags[TFW_PG_HEAD_IDX(h) - 1];
+		/* @m->next is stale if @h is, the generation catches that. */
+	} while (cmpxchg(head, h, TFW_PG_HEAD(h, READ_ONCE(m->next))) != h);
+
+	return m;
+}
+
+static TfwPgMag *
+tfw_pg_depot_get_empty(TfwPgDepot *d)
+{
+	TfwPgMag *m = tfw_pg_depot_pop(d, &d->empty);
+	unsigned int i;
+
+	if (m || atomic_read(&d->used) >= TFW_POOL_DEPOT_MAGS)
+		return m;
+	i = atomic_inc_return(&d->used) - 1;
+
+	return i < TFW_POOL_DEPOT_MAGS ? &d->mags[i] : NULL;
+}
+
+/**
+ * Load a magazine with cached chunks, the loaded magazine is empty.
+ */
+static TfwPgMag *
+tfw_pg_mag_load_full(TfwPgCpu *pc, unsigned int order)
+{
+	TfwPgDepot *d = &pg_depot[order];
+	TfwPgMag *m, *prev = pc->prev[order];
+
+	if (!prev || !prev->n) {
+		if (!(m = tfw_pg_depot_pop(d, &d->full)))
+			return NULL;
+		if (prev)
+			tfw_pg_depot_push(d, &d->empty, prev);
+		prev = m;
+	}
+	pc->prev[order] = pc->loaded[order];
+
+	return pc->loaded[order] = prev;
+}
+
+/**
+ * Load a magazine with free space, the loaded magazine is full.
+ */
+static TfwPgMag *
+tfw_pg_mag_load_empty(TfwPgCpu *pc, unsigned int order)
+{
+	TfwPgDepot *d = &pg_depot[order];
+	TfwPgMag *m, *prev = pc->prev[order];
+
+	if (!prev || prev->n == TFW_POOL_MAG_SZ) {
+		if (!(m = tfw_pg_depot_get_empty(d)))
+			return NULL;
+		if (prev)
+			tfw_pg_depot_push(d, &d->full, prev);
+		prev = m;
+	}
+	pc->prev[order] = pc->loaded[order];
 
+	return pc->loaded[order] = prev;
+}
+
+/*
+ * The pools are used in softirq as well as in process context, so softirqs
+ * are disabled rather than only preemption while the per-CPU magazines are
+ * accessed.
+ */
 static unsigned long
 tfw_pool_alloc_pages(unsigned int order)
 {
-	unsigned int *pgn;
+	TfwPgCpu *pc;
+	TfwPgMag *m;
 	unsigned long pg_res;
 
-	preempt_disable();
+	if (unlikely(order >= TFW_POOL_PGCACHE_ORDERS))
+		return __get_free_pages(GFP_ATOMIC, order);
 
-	pgn = this_cpu_ptr(&pg_next);
+	local_bh_disable();
 
-	if (likely(*pgn && !order)) {
-		--*pgn;
-		pg_res = this_cpu_read(pg_cache[*pgn]);
-
-		preempt_enable();
+	pc = this_cpu_ptr(&pg_cpu);
+	m = pc->loaded[order];
+	if (unlikely(!m || !m->n))
+		if (!(m = tfw_pg_mag_load_full(pc, order))) {
+			local_bh_enable();
+			return __get_free_pages(GFP_ATOMIC, order);
+		}
+	pg_res = m->pages[--m->n];
 
-		return pg_res;
-	}
-	preempt_enable();
+	local_bh_enable();
 
-	return __get_free_pages(GFP_ATOMIC, order);
+	return pg_res;
 }
 
 static void
 tfw_pool_free_pages(unsigned long addr, unsigned int order)
 {
-	unsigned int *pgn;
+	TfwPgCpu *pc;
+	TfwPgMag *m;
 
-	preempt_disable();
+	if (unlikely(order >= TFW_POOL_PGCACHE_ORDERS)) {
+		free_pages(addr, order);
+		return;
+	}
 
-	pgn = this_cpu_ptr(&pg_next);
+	local_bh_disable();
 
-	if (likely(*pgn < TFW_POOL_PGCACHE_SZ && !order)) {
-		*this_cpu_ptr(&pg_cache[*pgn]) = addr;
-		++*pgn;
+	pc = this_cpu_ptr(&pg_cpu);
+	m = pc->loaded[order];
+	if (unlikely(!m || m->n == TFW_POOL_MAG_SZ))
+		if (!(m = tfw_pg_mag_load_empty(pc, order))) {
+			local_bh_enable();
+			free_pages(addr, order);
+			return;
+		}
+	m->pages[m->n++] = addr;
 
-		preempt_enable();
+	local_bh_enable();
+}
 
-		return;
-	}
-	preempt_enable();
+/**
+ * Free all the cached pages on the module unloading.
+ */
+static void
+tfw_pool_pgcache_destroy(void)
+{
+	unsigned int o, i;
+	int cpu;
+
+	for (o = 0; o < TFW_POOL_PGCACHE_ORDERS; ++o) {
+		TfwPgDepot *d = &pg_depot[o];
 
-	free_pages(addr, order);
+		for_each_possible_cpu(cpu) {
+			TfwPgCpu *pc = per_cpu_ptr(&pg_cpu, cpu);
+
+			pc->loaded[o] = pc->prev[o] = NULL;
+		}
+		/* Each magazine is either on a CPU or in the depot. */
+		for (i = 0; i < min_t(unsigned int, atomic_read(&d->used),
+				      TFW_POOL_DEPOT_MAGS); ++i)
+		{
+			TfwPgMag *m = &d->mags[i];
+
+			while (m->n)
+				free_pages(m->pages[--m->n], o);
+		}
+	}
 }
 
 static inline TfwPoolChunk *
@@ -353,6 +548,27 @@ __tfw_pool_new(size_t n)
 	c->off = TFW_POOL_ALIGN_SZ((char *)(c + 1) - (char *)p);
 
 	p->curr = c;
+	p->fl = NULL;
+
+	return p;
+}
+
+/**
+ * A pool reusing the small blocks freed not in the stack order, e.g. for
+ * long living connections.
+ */
+TfwPool *
+tfw_pool_new_fl(size_t n)
+{
+	TfwPool *p = __tfw_pool_new(TFW_POOL_ALIGN_SZ(n) + TFW_POOL_FL_SZ);
+	TfwPoolChunk *c;
+
+	if (unlikely(!p))
+		return NULL;
+	c = p->curr;
+	p->fl = (void **)TFW_POOL_CHUNK_END(c);
+	c->off += TFW_POOL_FL_SZ;
+	memset(p->fl, 0, TFW_POOL_FL_SZ);
 
 	return p;
 }
@@ -365,6 +581,13 @@ tfw_pool_alloc(TfwPool *p, size_t n)
 
 	n = TFW_POOL_ALIGN_SZ(n);
 
+	if (unlikely(p->fl) && n <= TFW_POOL_FL_MAX
+	    && (a = p->fl[TFW_POOL_FL_CLASS(n)]))
+	{
+		p->fl[TFW_POOL_FL_CLASS(n)] = *(void **)a;
+		return a;
+	}
+
 	if (unlikely(c->off + n > TFW_POOL_CHUNK_SZ(c))) {
 		unsigned int off = TFW_POOL_ALIGN_SZ(sizeof(*c)) + n;
 		unsigned int order = get_order(off);
@@ -387,6 +610,34 @@ tfw_pool_alloc(TfwPool *p, size_t n)
 	return a;
 }
 
+/**
+ * Grow or shrink the last allocation in place if the chunk has space,
+ * otherwise allocate a new block and copy the data. The old block isn't
+ * freed in the latter case: it isn't the last allocation any more.
+ */
+void *
+tfw_pool_realloc(TfwPool *p, void *ptr, size_t old_n, size_t new_n)
+{
+	TfwPoolChunk *c = p->curr;
+	void *a;
+
+	old_n = TFW_POOL_ALIGN_SZ(old_n);
+	new_n = TFW_POOL_ALIGN_SZ(new_n);
+
+	if ((char *)ptr + old_n == (char *)TFW_POOL_CHUNK_END(c)
+	    && c->off - old_n + new_n <= TFW_POOL_CHUNK_SZ(c))
+	{
+		c->off += new_n - old_n;
+		return ptr;
+	}
+
+	a = tfw_pool_alloc(p, new_n);
+	if (likely(a))
+		memcpy(a, ptr, old_n);
+
+	return a;
+}
+
 void
 tfw_pool_free(TfwPool *p, void *ptr, size_t n)
 {
@@ -394,8 +645,16 @@ tfw_pool_free(TfwPool *p, void *ptr, size_t n)
 
 	n = TFW_POOL_ALIGN_SZ(n);
 	/* Stack-like usage is expected. */
-	if (likely((char *)ptr + n == (char *)TFW_POOL_CHUNK_END(c)))
+	if (likely((char *)ptr + n == (char *)TFW_POOL_CHUNK_END(c))) {
 		c->off -= n;
+	}
+	else {
+		if (p->fl && n <= TFW_POOL_FL_MAX) {
+			*(void **)ptr = p->fl[TFW_POOL_FL_CLASS(n)];
+			p->fl[TFW_POOL_FL_CLASS(n)] = ptr;
+		}
+		return;
+	}
 
 	/* Free empty chunk which doesn't contain the pool header. */
 	if (unlikely(c != tfw_pool_chunk_first(p)
@@ -431,6 +690,167 @@ tfw_pool_destroy(TfwPool *p)
 		*(long *)o = 1;						\
 	}
 
+/*
+ * ------------------------------------------------------------------------
+ *	Multi-CPU mode
+ *	A kthread bound to each online CPU creates and destroys N_MCPU pools
+ *	of 100 objects at the same time with the other CPUs, so the pages and
+ *	the large allocations contend on the buddy allocator and kmalloc.
+ * ------------------------------------------------------------------------
+ */
+#define N_MCPU		(N / 1000)
+#define MCPU_ALLOCS	(N_MCPU * 100UL)
+
+/**
+ * @ms		- time of the CPU run;
+ * @run		- the CPU runs the benchmark thread;
+ */
+typedef struct {
+	unsigned long	ms;
+	bool		run;
+} McpuStat;
+
+static DEFINE_PER_CPU(McpuStat, mcpu_stat);
+static DECLARE_WAIT_QUEUE_HEAD(mcpu_wq);
+static DECLARE_COMPLETION(mcpu_done);
+static atomic_t mcpu_ready, mcpu_running;
+static bool mcpu_go;
+static void (*mcpu_fn)(void);
+
+/* Each 64th pool has a Huge object, each 4th allocation is Big. */
+static void
+mcpu_ngx_pool(void)
+{
+	long i, j;
+
+	for (i = 0; i < N_MCPU; ++i) {
+		ngx_pool_t *np = ngx_create_pool(PAGE_SIZE);
+		touch_obj(np);
+		for (j = 0; j < 100; ++j) {
+			if (unlikely(!(i & 63) && !j)) {
+				Huge *o = (Huge *)ngx_palloc(np, sizeof(*o));
+				touch_obj(o);
+				ngx_pfree(np, o);
+			}
+			else if (unlikely(!(j & 3))) {
+				Big *o = (Big *)ngx_palloc(np, sizeof(*o));
+				touch_obj(o);
+			}
+			else {
+				Small *o = (Small *)ngx_palloc(np, sizeof(*o));
+				touch_obj(o);
+			}
+		}
+		ngx_destroy_pool(np);
+		cond_resched();
+	}
+}
+
+static void
+mcpu_tfw_pool(void)
+{
+	long i, j;
+
+	for (i = 0; i < N_MCPU; ++i) {
+		TfwPool *tp = __tfw_pool_new(0);
+		touch_obj(tp);
+		for (j = 0; j < 100; ++j) {
+			if (unlikely(!(i & 63) && !j)) {
+				Huge *o = (Huge *)tfw_pool_alloc(tp, sizeof(*o));
+				touch_obj(o);
+				tfw_pool_free(tp, o, sizeof(*o));
+			}
+			else if (unlikely(!(j & 3))) {
+				Big *o = (Big *)tfw_pool_alloc(tp, sizeof(*o));
+				touch_obj(o);
+			}
+			else {
+				Small *o = (Small *)tfw_pool_alloc(tp,
+								   sizeof(*o));
+				touch_obj(o);
+			}
+		}
+		tfw_pool_destroy(tp);
+		cond_resched();
+	}
+}
+
+static int
+mcpu_thread(void *data)
+{
+	McpuStat *st = data;
+	unsigned long t0;
+
+	atomic_inc(&mcpu_ready);
+	wait_event(mcpu_wq, READ_ONCE(mcpu_go));
+
+	t0 = jiffies;
+	mcpu_fn();
+	st->ms = jiffies_to_msecs(jiffies - t0);
+
+	if (atomic_dec_and_test(&mcpu_running))
+		complete(&mcpu_done);
+
+	return 0;
+}
+
+/**
+ * Start the threads, release them at once when all of them are ready and
+ * report the per-CPU and the aggregate throughput in allocations per ms.
+ */
+static void
+mcpu_run(const char *name, void (*fn)(void))
+{
+	unsigned long max_ms = 0;
+	int cpu, n = 0;
+
+	mcpu_fn = fn;
+	mcpu_go = false;
+	atomic_set(&mcpu_ready, 0);
+	/* Don't complete until all the threads are created. */
+	atomic_set(&mcpu_running, 1);
+	reinit_completion(&mcpu_done);
+
+	for_each_online_cpu(cpu) {
+		McpuStat *st = per_cpu_ptr(&mcpu_stat, cpu);
+		struct task_struct *t;
+
+		st->run = false;
+		t = kthread_create_on_node(mcpu_thread, st, cpu_to_node(cpu),
+					   "pool_bench/%d", cpu);
+		if (IS_ERR(t)) {
+			printk(KERN_ERR "cannot create thread for CPU%d\n",
+			       cpu);
+			continue;
+		}
+		kthread_bind(t, cpu);
+		st->run = true;
+		++n;
+		atomic_inc(&mcpu_running);
+		wake_up_process(t);
+	}
+
+	while (atomic_read(&mcpu_ready) < n)
+		schedule_timeout_uninterruptible(1);
+	WRITE_ONCE(mcpu_go, true);
+	wake_up_all(&mcpu_wq);
+	if (!atomic_dec_and_test(&mcpu_running))
+		wait_for_completion(&mcpu_done);
+
+	printk(KERN_ERR "%s on %d CPUs:\n", name, n);
+	for_each_online_cpu(cpu) {
+		McpuStat *st = per_cpu_ptr(&mcpu_stat, cpu);
+
+		if (!st->run)
+			continue;
+		printk(KERN_ERR "  CPU%d:  %lums, %lu allocs/ms\n", cpu,
+		       st->ms, MCPU_ALLOCS / max(st->ms, 1UL));
+		max_ms = max(max_ms, st->ms);
+	}
+	printk(KERN_ERR "  total:  %lums, %lu allocs/ms\n", max_ms,
+	       MCPU_ALLOCS * n / max(max_ms, 1UL));
+}
+
 int __init
 pool_benchmark(void)
 {
@@ -441,6 +861,12 @@ pool_benchmark(void)
 	printk(KERN_ERR "object sizes: Small - %lu, Big - %lu Huge - %lu\n",
 	       sizeof(Small), sizeof(Big), sizeof(Huge));
 
+	if (mcpu) {
+		mcpu_run("ngx_pool cr. & destr. (Mix)", mcpu_ngx_pool);
+		mcpu_run("tfw_pool cr. & destr. (Mix)", mcpu_tfw_pool);
+		return 0;
+	}
+
 	t0 = jiffies;
 	for (i = 0; i < N_ALLOC; ++i) {
 		p_arr[i] = (void *)__get_free_pages(GFP_KERNEL, 0);
@@ -590,6 +1016,44 @@ pool_benchmark(void)
 	tfw_pool_destroy(tp);
 	printk(KERN_ERR "tfw_pool w/ free (Mix):  %ldms\n", t1 - t0);
 
+	/*
+	 * The previous Big or Huge object is freed instead of the just
+	 * allocated one, so the freed blocks aren't on the top of the pool.
+	 */
+	for (j = 0; j < 2; ++j) {
+		Huge *h = NULL;
+		Big *b = NULL;
+
+		tp = j ? tfw_pool_new_fl(0) : __tfw_pool_new(0);
+		BUG_ON(!tp);
+		t0 = jiffies;
+		for (i = 0; i < N; ++i) {
+			if (unlikely(!(i & 0xfff))) {
+				Huge *o = (Huge *)tfw_pool_alloc(tp, sizeof(*o));
+				touch_obj(o);
+				if (h)
+					tfw_pool_free(tp, h, sizeof(*h));
+				h = o;
+			}
+			else if (unlikely(!(i & 3))) {
+				Big *o = (Big *)tfw_pool_alloc(tp, sizeof(*o));
+				touch_obj(o);
+				if (b)
+					tfw_pool_free(tp, b, sizeof(*b));
+				b = o;
+			}
+			else {
+				Small *o = (Small *)tfw_pool_alloc(tp,
+								   sizeof(*o));
+				touch_obj(o);
+			}
+		}
+		t1 = jiffies;
+		tfw_pool_destroy(tp);
+		printk(KERN_ERR "tfw_pool%s w/ dfree (Mix):  %ldms\n",
+		       j ? " fl" : "", t1 - t0);
+	}
+
 	t0 = jiffies;
 	for (i = 0; i < N / 100; ++i) {
 		tp = __tfw_pool_new(0);
@@ -608,12 +1072,53 @@ pool_benchmark(void)
 	t1 = jiffies;
 	printk(KERN_ERR "tfw_pool cr. & destr.:  %ldms\n", t1 - t0);
 
+	/* An array growing by one element at a time. */
+	t0 = jiffies;
+	for (i = 0; i < N / GROW_N; ++i) {
+		Small *o;
+
+		tp = __tfw_pool_new(0);
+		o = (Small *)tfw_pool_alloc(tp, sizeof(*o));
+		touch_obj(o);
+		for (j = 2; j <= GROW_N; ++j) {
+			o = (Small *)tfw_pool_realloc(tp, o,
+						      sizeof(*o) * (j - 1),
+						      sizeof(*o) * j);
+			touch_obj(o);
+			o[j - 1].l[0] = j;
+		}
+		tfw_pool_destroy(tp);
+	}
+	t1 = jiffies;
+	printk(KERN_ERR "tfw_pool realloc (Small):  %ldms\n", t1 - t0);
+
+	t0 = jiffies;
+	for (i = 0; i < N / GROW_N; ++i) {
+		Small *o;
+
+		tp = __tfw_pool_new(0);
+		o = (Small *)tfw_pool_alloc(tp, sizeof(*o));
+		touch_obj(o);
+		for (j = 2; j <= GROW_N; ++j) {
+			Small *n = (Small *)tfw_pool_alloc(tp, sizeof(*n) * j);
+			touch_obj(n);
+			memcpy(n, o, sizeof(*o) * (j - 1));
+			tfw_pool_free(tp, o, sizeof(*o) * (j - 1));
+			o = n;
+			o[j - 1].l[0] = j;
+		}
+		tfw_pool_destroy(tp);
+	}
+	t1 = jiffies;
+	printk(KERN_ERR "tfw_pool alloc & copy (Small):  %ldms\n", t1 - t0);
+
 	return 0;
 }
 
 void __exit
 pool_benchmark_exit(void)
 {
+	tfw_pool_pgcache_destroy();
 }
 
 module_init(pool_benchmark);
@@ -43,18 +43,35 @@
  * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 #include <assert.h>
+#include <malloc.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include <atomic>
 #include <chrono>
+#include <fstream>
 #include <functional>
 #include <iomanip>
 #include <iostream>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <boost/pool/object_pool.hpp>
+#ifdef HAVE_JEMALLOC
+#include <jemalloc/jemalloc.h>
+#endif
+#ifdef HAVE_TCMALLOC
+#include <gperftools/tcmalloc.h>
+#endif
+#ifdef HAVE_TBB
+#include <tbb/scalable_allocator.h>
+#endif
 
 #include <glib.h>
 
+#include "../bench.h"
+
 static const size_t PAGE_SIZE = 4096;
 
 // sizeof(TfwStr)
@@ -86,20 +103,81 @@ struct Huge {
 
 static const size_t N = 20 * 1000 * 1000;
 
+// The numbers of objects of the (Mix) benchmarks.
+static const size_t N_HUGE = (N + 0xfff) / 0x1000;
+static const size_t N_BIG = (N + 3) / 4 - N_HUGE;
+static const size_t N_SMALL = N - N_BIG - N_HUGE;
+
+// Live bytes of the benchmarks allocating @n objects of type T and freeing
+// each 4th object right away.
+template<class T>
+size_t
+live_sz(size_t n, bool free)
+{
+	return (free ? n - (n + 3) / 4 : n) * sizeof(T);
+}
+
+static size_t
+proc_status_kb(const char *field)
+{
+	std::ifstream f("/proc/self/status");
+	size_t len = strlen(field);
+	std::string l;
+
+	while (std::getline(f, l))
+		if (!l.compare(0, len, field))
+			return std::stoul(l.substr(len));
+	return 0;
+}
+
+/**
+ * Besides the time, the benchmark reports:
+ *
+ * rss	- the peak RSS growth during @cb, the memory freed by the previous
+ *	  benchmarks is returned to the OS and the peak is reset through
+ *	  /proc/self/clear_refs (Linux 4.0+) before @cb;
+ * live	- @live bytes allocated and not freed by @cb at its end, or at the
+ *	  peak for the benchmarks freeing all the objects;
+ * held	- the memory held by the allocator after @cb, if @held is specified,
+ *	  and its internal waste against @live.
+ */
 void
-benchmark(std::string &&desc, std::function<void ()> cb)
+benchmark(std::string &&desc, std::function<void ()> cb, size_t live = 0,
+	  std::function<size_t ()> held = nullptr)
 {
 	using namespace std::chrono;
 
+	malloc_trim(0);
+	std::ofstream("/proc/self/clear_refs") << "5";
+	size_t rss = proc_status_kb("VmRSS:");
+
+	struct bench_perf perf;
+	bench_perf_begin(&perf);
 	// steady_clock has the same resolution as high_resolution_clock
 	auto t(steady_clock::now());
 
 	cb();
 
 	auto dt = steady_clock::now() - t;
+	bench_perf_end(&perf);
+	size_t peak = proc_status_kb("VmHWM:");
+
 	std::cout << std::setw(30) << std::right << desc << ":    "
-		  << duration_cast<milliseconds>(dt).count()
-		  << "ms" << std::endl;
+		  << std::setw(5) << duration_cast<milliseconds>(dt).count()
+		  << "ms    rss +" << (peak > rss ? peak - rss : 0) << "KB";
+	if (live)
+		std::cout << "    live " << live / 1024 << "KB";
+	if (held) {
+		size_t h = held();
+
+		std::cout << "    held " << h / 1024 << "KB";
+		if (live)
+			std::cout << "    waste " << (h - live) * 100 / live
+				  << "%";
+	}
+	std::cout << std::endl;
+	// The callbacks do different numbers of operations.
+	bench_report(desc.c_str(), 0, NULL, 0, &perf);
 }
 
 #define touch_obj(o)							\
@@ -110,6 +188,40 @@ benchmark(std::string &&desc, std::function<void ()> cb)
 		*(long *)o = 1;						\
 	}
 
+/**
+ * Run @n threads concurrently, each thread makes 1/@n of N / 100 iterations
+ * of @cb, which creates and destroys 100 objects, and calls @fini at exit.
+ *
+ * The threads are created before the measurement: a new thread initializes
+ * the static TLS, including the big per-thread arrays of the benchmarks
+ * below.
+ */
+void
+benchmark_mt(const char *name, unsigned int n, std::function<void (size_t)> cb,
+	     std::function<void ()> fini = nullptr)
+{
+	std::string desc = std::string(name) + " cr. & destr. ("
+			   + std::to_string(n) + " thr.)";
+	std::vector<std::thread> thr;
+	std::atomic<bool> go(false);
+
+	for (unsigned int t = 0; t < n; ++t)
+		thr.emplace_back([&, t]() {
+			while (!go)
+				std::this_thread::yield();
+			for (size_t i = t; i < N / 100; i += n)
+				cb(i);
+			if (fini)
+				fini();
+		});
+
+	benchmark(std::move(desc), [&]() {
+		go = true;
+		for (auto &t : thr)
+			t.join();
+	});
+}
+
 /*
  * ------------------------------------------------------------------------
  *	Boost::pool
@@ -126,7 +238,7 @@ benchmark_boost_pool()
 			T *o = p.malloc();
 			touch_obj(o);
 		}
-	});
+	}, live_sz<T>(N * sizeof(Small) / sizeof(T), false));
 }
 
 template<class T>
@@ -142,7 +254,7 @@ benchmark_boost_pool_free()
 			if (__builtin_expect(!(i & 3), 0))
 				p.free(o);
 		}
-	});
+	}, live_sz<T>(N * sizeof(Small) / sizeof(T), true));
 }
 
 void
@@ -188,7 +300,7 @@ benchmark_mallocfree()
 		for (size_t i = 0; i < N * sizeof(Small) / sizeof(T); ++i) {
 			free(ptrs[i]);
 		}
-	});
+	}, live_sz<T>(N * sizeof(Small) / sizeof(T), false));
 }
 
 template<class T>
@@ -212,6 +324,58 @@ benchmark_mallocfree_free()
 		for (size_t i = 0; i < N * sizeof(Small) / sizeof(T); ++i) {
 			free(ptrs[i]);
 		}
+	}, live_sz<T>(N * sizeof(Small) / sizeof(T), true));
+}
+
+/*
+ * The general purpose allocators creating and destroying 100 objects in each
+ * iteration on many threads, like the pools in the create and destroy
+ * benchmarks. jemalloc, tcmalloc and TBB are optional, see the Makefile.
+ */
+struct Glibc {
+	static constexpr const char *name = "malloc";
+	static void *alloc(size_t n) { return malloc(n); }
+	static void dealloc(void *p) { free(p); }
+};
+
+#ifdef HAVE_JEMALLOC
+struct Jemalloc {
+	static constexpr const char *name = "jemalloc";
+	static void *alloc(size_t n) { return mallocx(n, 0); }
+	static void dealloc(void *p) { dallocx(p, 0); }
+};
+#endif
+
+#ifdef HAVE_TCMALLOC
+struct Tcmalloc {
+	static constexpr const char *name = "tcmalloc";
+	static void *alloc(size_t n) { return tc_malloc(n); }
+	static void dealloc(void *p) { tc_free(p); }
+};
+#endif
+
+#ifdef HAVE_TBB
+struct Tbb {
+	static constexpr const char *name = "TBB";
+	static void *alloc(size_t n) { return scalable_malloc(n); }
+	static void dealloc(void *p) { scalable_free(p); }
+};
+#endif
+
+template<class A>
+void
+benchmark_malloc_mt(unsigned int n)
+{
+	benchmark_mt(A::name, n, [](size_t i) {
+		void *objs[100];
+
+		for (size_t j = 0; j < 100; ++j) {
+			objs[j] = A::alloc(__builtin_expect(!(i & 3), 0)
+					   ? sizeof(Big) : sizeof(Small));
+			touch_obj(objs[j]);
+		}
+		for (size_t j = 0; j < 100; ++j)
+			A::dealloc(objs[j]);
 	});
 }
 
@@ -236,7 +400,7 @@ benchmark_glib_slices()
 		for (size_t i = 0; i < N * sizeof(Small) / sizeof(T); ++i) {
 			g_slice_free1(sizeof(T), ptrs[i]);
 		}
-	});
+	}, live_sz<T>(N * sizeof(Small) / sizeof(T), false));
 }
 
 template<class T>
@@ -260,7 +424,7 @@ benchmark_glib_slices_free()
 		for (size_t i = 0; i < N * sizeof(Small) / sizeof(T); ++i) {
 			g_slice_free1(sizeof(T), ptrs[i]);
 		}
-	});
+	}, live_sz<T>(N * sizeof(Small) / sizeof(T), true));
 }
 
 /*
@@ -439,6 +603,20 @@ ngx_pfree(ngx_pool_t *pool, void *p)
 	}
 }
 
+static size_t
+ngx_pool_mem(ngx_pool_t *pool)
+{
+	size_t sz = 0;
+
+	for (ngx_pool_t *p = pool; p; p = p->d.next)
+		sz += p->d.end - (unsigned char *)p;
+	for (ngx_pool_large_t *l = pool->large; l; l = l->next)
+		if (l->alloc)
+			sz += malloc_usable_size(l->alloc);
+
+	return sz;
+}
+
 template<class T>
 void
 benchmark_ngx_pool()
@@ -451,7 +629,8 @@ benchmark_ngx_pool()
 			T *o = (T *)ngx_palloc(p, sizeof(T));
 			touch_obj(o);
 		}
-	});
+	}, live_sz<T>(N * sizeof(Small) / sizeof(T), false),
+	   [=]() { return ngx_pool_mem(p); });
 
 	ngx_destroy_pool(p);
 }
@@ -480,7 +659,8 @@ benchmark_ngx_pool_mix_free()
 				touch_obj(o);
 			}
 		}
-	});
+	}, N_BIG * sizeof(Big) + N_SMALL * sizeof(Small),
+	   [=]() { return ngx_pool_mem(p); });
 
 	ngx_destroy_pool(p);
 }
@@ -515,13 +695,16 @@ benchmark_ngx_pool_create_and_destroy()
  * ------------------------------------------------------------------------
  */
 /**
- * Emulation of Linux buddy allocator.
+ * Emulation of Linux buddy allocator and atomics.
  */
 #define GFP_ATOMIC		0
 #define PAGE_MASK		(~(PAGE_SIZE - 1))
 #define likely(x)		__builtin_expect(x, 1)
 #define unlikely(x)		__builtin_expect(x, 0)
 #define free_pages(p, o)	free((void *)(p))
+#define READ_ONCE(x)		(*(volatile __typeof__(x) *)&(x))
+#define cmpxchg(p, o, n)	__sync_val_compare_and_swap(p, o, n)
+#define atomic_inc_return(p)	__sync_add_and_fetch(p, 1)
 #define get_order(n)		(assert((n) < PAGE_SIZE * 128),		\
 				 (n) < PAGE_SIZE ? 0			\
 				 : (n) < PAGE_SIZE * 2 ? 1		\
@@ -561,11 +744,13 @@ struct TfwPoolChunk {
  *
  * @curr	- current chunk to allocate memory from;
  * @order,@off	- cached members of @curr;
+ * @fl		- free lists of the small size classes, NULL if disabled;
  */
 typedef struct {
 	TfwPoolChunk	*curr;
 	unsigned int	order;
 	unsigned int	off;
+	void		**fl;
 } TfwPool;
 
 #define TFW_POOL_CHUNK_SZ(p)	(PAGE_SIZE << (p)->order)
@@ -574,26 +759,204 @@ typedef struct {
 #define TFW_POOL_ALIGN_SZ(n)	(((n) + 7) & ~7UL)
 #define TFW_POOL_HEAD_OFF	(TFW_POOL_ALIGN_SZ(sizeof(TfwPool))	\
 				 + TFW_POOL_ALIGN_SZ(sizeof(TfwPoolChunk)))
-#define TFW_POOL_PGCACHE_SZ	256
+/*
+ * The free lists keep the blocks freed not in the stack order, a size class
+ * for each aligned size up to TFW_POOL_FL_MAX.
+ */
+#define TFW_POOL_FL_MAX		256
+#define TFW_POOL_FL_CLASS(n)	((n) / 8 - 1)
+#define TFW_POOL_FL_SZ		(sizeof(void *)				\
+				 * (TFW_POOL_FL_CLASS(TFW_POOL_FL_MAX) + 1))
+/**
+ * Per-CPU page cache.
+ *
+ * Each CPU (thread in the benchmark) keeps freed chunks of the small orders
+ * in two magazines per order like Bonwick's slab allocator: the pages are
+ * allocated from and freed to the loaded magazine, and the previous one is
+ * swapped in when the loaded magazine is empty or full. Only when both of
+ * them are empty or full a magazine is exchanged with the shared depot, so
+ * the pages freed on one CPU are reused on the others.
+ *
+ * The depot lists are lock-free stacks. The magazines are never freed, they
+ * are taken from a static array of each order, so the stack heads keep
+ * the magazine index tagged with a generation to avoid ABA on pop.
+ */
+#define TFW_POOL_PGCACHE_ORDERS	4
+#define TFW_POOL_MAG_SZ		32
+#define TFW_POOL_DEPOT_MAGS	256
+/* The depot list head: the generation and the magazine index plus one. */
+#define TFW_PG_HEAD_IDX(h)	((unsigned int)(h))
+#define TFW_PG_HEAD(h, i)	((((h) >> 32) + 1) << 32 | (i))
+
+/**
+ * @next	- index plus one of the next magazine in the depot list;
+ * @n		- number of cached chunks;
+ */
+struct TfwPgMag {
+	unsigned int	next;
+	unsigned int	n;
+	unsigned long	pages[TFW_POOL_MAG_SZ];
+};
+
+/**
+ * @full	- magazines with cached chunks;
+ * @empty	- empty magazines;
+ * @used	- number of magazines taken from @mags;
+ */
+struct TfwPgDepot {
+	uint64_t	full;
+	uint64_t	empty;
+	unsigned int	used;
+	TfwPgMag	mags[TFW_POOL_DEPOT_MAGS];
+};
+
+struct TfwPgCpu {
+	TfwPgMag	*loaded[TFW_POOL_PGCACHE_ORDERS];
+	TfwPgMag	*prev[TFW_POOL_PGCACHE_ORDERS];
+};
+
+static TfwPgDepot pg_depot[TFW_POOL_PGCACHE_ORDERS];
+static __thread TfwPgCpu pg_cpu;
+
+static void
+tfw_pg_depot_push(TfwPgDepot *d, uint64_t *head, TfwPgMag *m)
+{
+	uint64_t h;
+
+	do {
+		h = READ_ONCE(*head);
+		m->next = TFW_PG_HEAD_IDX(h);
+	} while (cmpxchg(head, h, TFW_PG_HEAD(h, m - d->mags + 1)) != h);
+}
+
+static TfwPgMag *
+tfw_pg_depot_pop(TfwPgDepot *d, uint64_t *head)
+{
+	uint64_t h;
+	TfwPgMag *m;
+
+	do {
+		h = READ_ONCE(*head);
+		if (!TFW_PG_HEAD_IDX(h))
+			return NULL;
+		m = &d->mags[TFW_PG_HEAD_IDX(h) - 1];
+		/* @m->next is stale if @h is, the generation catches that. */
+	} while (cmpxchg(head, h, TFW_PG_HEAD(h, READ_ONCE(m->next))) != h);
+
+	return m;
+}
+
+static TfwPgMag *
+tfw_pg_depot_get_empty(TfwPgDepot *d)
+{
+	TfwPgMag *m = tfw_pg_depot_pop(d, &d->empty);
+	unsigned int i;
+
+	if (m || READ_ONCE(d->used) >= TFW_POOL_DEPOT_MAGS)
+		return m;
+	i = atomic_inc_return(&d->used) - 1;
+
+	return i < TFW_POOL_DEPOT_MAGS ? &d->mags[i] : NULL;
+}
+
+/**
+ * Load a magazine with cached chunks, the loaded magazine is empty.
+ */
+static TfwPgMag *
+tfw_pg_mag_load_full(TfwPgCpu *pc, unsigned int order)
+{
+	TfwPgDepot *d = &pg_depot[order];
+	TfwPgMag *m, *prev = pc->prev[order];
+
+	if (!prev || !prev->n) {
+		if (!(m = tfw_pg_depot_pop(d, &d->full)))
+			return NULL;
+		if (prev)
+			tfw_pg_depot_push(d, &d->empty, prev);
+		prev = m;
+	}
+	pc->prev[order] = pc->loaded[order];
+
+	return pc->loaded[order] = prev;
+}
+
+/**
+ * Load a magazine with free space, the loaded magazine is full.
+ */
+static TfwPgMag *
+tfw_pg_mag_load_empty(TfwPgCpu *pc, unsigned int order)
+{
+	TfwPgDepot *d = &pg_depot[order];
+	TfwPgMag *m, *prev = pc->prev[order];
 
-static unsigned int pg_next;
-static unsigned long pg_cache[TFW_POOL_PGCACHE_SZ];
+	if (!prev || prev->n == TFW_POOL_MAG_SZ) {
+		if (!(m = tfw_pg_depot_get_empty(d)))
+			return NULL;
+		if (prev)
+			tfw_pg_depot_push(d, &d->full, prev);
+		prev = m;
+	}
+	pc->prev[order] = pc->loaded[order];
+
+	return pc->loaded[order] = prev;
+}
 
 static unsigned long
 tfw_pool_alloc_pages(unsigned int order)
 {
-	if (likely(pg_next && !order))
-		return pg_cache[--pg_next];
-	return __get_free_pages(GFP_ATOMIC, order);
+	TfwPgCpu *pc = &pg_cpu;
+	TfwPgMag *m;
+
+	if (unlikely(order >= TFW_POOL_PGCACHE_ORDERS))
+		return __get_free_pages(GFP_ATOMIC, order);
+
+	m = pc->loaded[order];
+	if (unlikely(!m || !m->n))
+		if (!(m = tfw_pg_mag_load_full(pc, order)))
+			return __get_free_pages(GFP_ATOMIC, order);
+
+	return m->pages[--m->n];
 }
 
 static void
 tfw_pool_free_pages(unsigned long addr, unsigned int order)
 {
-	if (likely(pg_next < TFW_POOL_PGCACHE_SZ && !order)) {
-		pg_cache[pg_next++] = addr;
-	} else {
+	TfwPgCpu *pc = &pg_cpu;
+	TfwPgMag *m;
+
+	if (unlikely(order >= TFW_POOL_PGCACHE_ORDERS)) {
 		free_pages(addr, order);
+		return;
+	}
+
+	m = pc->loaded[order];
+	if (unlikely(!m || m->n == TFW_POOL_MAG_SZ))
+		if (!(m = tfw_pg_mag_load_empty(pc, order))) {
+			free_pages(addr, order);
+			return;
+		}
+
+	m->pages[m->n++] = addr;
+}
+
+/**
+ * Return the magazines of the current CPU to the depot, called on a thread
+ * exit.
+ */
+static void
+tfw_pool_pgcache_drain(void)
+{
+	TfwPgCpu *pc = &pg_cpu;
+
+	for (unsigned int o = 0; o < TFW_POOL_PGCACHE_ORDERS; ++o) {
+		TfwPgDepot *d = &pg_depot[o];
+		TfwPgMag *mags[2] = { pc->loaded[o], pc->prev[o] };
+
+		for (TfwPgMag *m : mags)
+			if (m)
+				tfw_pg_depot_push(d, m->n ? &d->full : &d->empty,
+						  m);
+		pc->loaded[o] = pc->prev[o] = NULL;
 	}
 }
 
@@ -616,6 +979,25 @@ __tfw_pool_new(size_t n)
 	p->order = order;
 	p->off = TFW_POOL_HEAD_OFF;
 	p->curr = c;
+	p->fl = NULL;
+
+	return p;
+}
+
+/**
+ * A pool reusing the small blocks freed not in the stack order, e.g. for
+ * long living connections.
+ */
+TfwPool *
+tfw_pool_new_fl(size_t n)
+{
+	TfwPool *p = __tfw_pool_new(TFW_POOL_ALIGN_SZ(n) + TFW_POOL_FL_SZ);
+
+	if (unlikely(!p))
+		return NULL;
+	p->fl = (void **)TFW_POOL_CHUNK_END(p);
+	p->off += TFW_POOL_FL_SZ;
+	memset(p->fl, 0, TFW_POOL_FL_SZ);
 
 	return p;
 }
@@ -627,6 +1009,13 @@ tfw_pool_alloc(TfwPool *p, size_t n)
 
 	n = TFW_POOL_ALIGN_SZ(n);
 
+	if (unlikely(p->fl != NULL) && n <= TFW_POOL_FL_MAX
+	    && (a = p->fl[TFW_POOL_FL_CLASS(n)]))
+	{
+		p->fl[TFW_POOL_FL_CLASS(n)] = *(void **)a;
+		return a;
+	}
+
 	if (unlikely(p->off + n > TFW_POOL_CHUNK_SZ(p))) {
 		TfwPoolChunk *c, *curr = p->curr;
 		unsigned int off = TFW_POOL_ALIGN_SZ(sizeof(TfwPoolChunk)) + n;
@@ -653,14 +1042,46 @@ tfw_pool_alloc(TfwPool *p, size_t n)
 	return a;
 }
 
+/**
+ * Grow or shrink the last allocation in place if the chunk has space,
+ * otherwise allocate a new block and copy the data. The old block isn't
+ * freed in the latter case: it isn't the last allocation any more.
+ */
+void *
+tfw_pool_realloc(TfwPool *p, void *ptr, size_t old_n, size_t new_n)
+{
+	void *a;
+
+	old_n = TFW_POOL_ALIGN_SZ(old_n);
+	new_n = TFW_POOL_ALIGN_SZ(new_n);
+
+	if ((char *)ptr + old_n == (char *)TFW_POOL_CHUNK_END(p)
+	    && p->off - old_n + new_n <= TFW_POOL_CHUNK_SZ(p))
+	{
+		p->off += new_n - old_n;
+		return ptr;
+	}
+
+	a = tfw_pool_alloc(p, new_n);
+	if (a)
+		memcpy(a, ptr, old_n);
+
+	return a;
+}
+
 void
 tfw_pool_free(TfwPool *p, void *ptr, size_t n)
 {
 	n = TFW_POOL_ALIGN_SZ(n);
 
 	/* Stack-like usage is expected. */
-	if (unlikely((char *)ptr + n != (char *)TFW_POOL_CHUNK_END(p)))
+	if (unlikely((char *)ptr + n != (char *)TFW_POOL_CHUNK_END(p))) {
+		if (p->fl && n <= TFW_POOL_FL_MAX) {
+			*(void **)ptr = p->fl[TFW_POOL_FL_CLASS(n)];
+			p->fl[TFW_POOL_FL_CLASS(n)] = ptr;
+		}
 		return;
+	}
 
 	p->off -= n;
 
@@ -679,12 +1100,25 @@ tfw_pool_destroy(TfwPool *p)
 {
 	TfwPoolChunk *c, *next;
 
+	/* The current chunk order is cached in the pool descriptor. */
+	p->curr->order = p->order;
 	for (c = p->curr; c; c = next) {
 		next = c->next;
 		tfw_pool_free_pages(TFW_POOL_CHUNK_BASE(c), c->order);
 	}
 }
 
+static size_t
+tfw_pool_mem(TfwPool *p)
+{
+	size_t sz = TFW_POOL_CHUNK_SZ(p);
+
+	for (TfwPoolChunk *c = p->curr->next; c; c = c->next)
+		sz += PAGE_SIZE << c->order;
+
+	return sz;
+}
+
 template<class T>
 void
 benchmark_tfw_pool()
@@ -697,7 +1131,8 @@ benchmark_tfw_pool()
 			T *o = (T *)tfw_pool_alloc(p, sizeof(T));
 			touch_obj(o);
 		}
-	});
+	}, live_sz<T>(N * sizeof(Small) / sizeof(T), false),
+	   [=]() { return tfw_pool_mem(p); });
 
 	tfw_pool_destroy(p);
 }
@@ -716,7 +1151,8 @@ benchmark_tfw_pool_free()
 			if (__builtin_expect(!(i & 3), 0))
 				tfw_pool_free(p, o, sizeof(T));
 		}
-	});
+	}, live_sz<T>(N * sizeof(Small) / sizeof(T), true),
+	   [&]() { return tfw_pool_mem(p); });
 
 	tfw_pool_destroy(p);
 }
@@ -748,7 +1184,52 @@ benchmark_tfw_pool_mix_free()
 				touch_obj(o);
 			}
 		}
-	});
+	}, N_SMALL * sizeof(Small), [=]() { return tfw_pool_mem(p); });
+
+	tfw_pool_destroy(p);
+}
+
+/**
+ * The same mix, but the previous Big or Huge object is freed instead of
+ * the just allocated one, so the freed blocks aren't on the top of the pool.
+ * The free lists of @fl pool reuse the Big blocks.
+ */
+void
+benchmark_tfw_pool_mix_delayed_free(bool fl)
+{
+	TfwPool *p = fl ? tfw_pool_new_fl(0) : __tfw_pool_new(0);
+	assert(p);
+
+	benchmark(std::move(std::string(fl ? "tfw_pool fl w/ dfree (Mix)"
+					    : "tfw_pool w/ dfree (Mix)")),
+		  [=]() {
+		Huge *h = NULL;
+		Big *b = NULL;
+
+		for (size_t i = 0; i < N; ++i) {
+			if (__builtin_expect(!(i & 0xfff), 0)) {
+				Huge *o;
+				o = (Huge *)tfw_pool_alloc(p, sizeof(*o));
+				touch_obj(o);
+				if (h)
+					tfw_pool_free(p, h, sizeof(*h));
+				h = o;
+			}
+			else if (__builtin_expect(!(i & 3), 0)) {
+				Big *o = (Big *)tfw_pool_alloc(p, sizeof(*o));
+				touch_obj(o);
+				if (b)
+					tfw_pool_free(p, b, sizeof(*b));
+				b = o;
+			}
+			else {
+				Small *o;
+				o = (Small *)tfw_pool_alloc(p, sizeof(*o));
+				touch_obj(o);
+			}
+		}
+	}, N_SMALL * sizeof(Small) + sizeof(Big) + sizeof(Huge),
+	   [=]() { return tfw_pool_mem(p); });
 
 	tfw_pool_destroy(p);
 }
@@ -777,6 +1258,80 @@ benchmark_tfw_pool_create_and_destroy()
 	});
 }
 
+/*
+ * HTTP message assembly: an array grows by one element at a time, either in
+ * place or by a new allocation and copying for each element.
+ */
+#define GROW_N		256
+
+void
+benchmark_tfw_pool_realloc()
+{
+	benchmark(std::move(std::string("tfw_pool realloc (Small)")), []() {
+		for (size_t i = 0; i < N / GROW_N; ++i) {
+			TfwPool *p = __tfw_pool_new(0);
+			Small *o = (Small *)tfw_pool_alloc(p, sizeof(*o));
+			touch_obj(o);
+			for (size_t j = 2; j <= GROW_N; ++j) {
+				o = (Small *)tfw_pool_realloc(p, o,
+							      sizeof(*o) * (j - 1),
+							      sizeof(*o) * j);
+				touch_obj(o);
+				o[j - 1].l[0] = j;
+			}
+			tfw_pool_destroy(p);
+		}
+	});
+}
+
+void
+benchmark_tfw_pool_alloc_copy()
+{
+	benchmark(std::move(std::string("tfw_pool alloc & copy (Small)")),
+		  []() {
+		for (size_t i = 0; i < N / GROW_N; ++i) {
+			TfwPool *p = __tfw_pool_new(0);
+			Small *o = (Small *)tfw_pool_alloc(p, sizeof(*o));
+			touch_obj(o);
+			for (size_t j = 2; j <= GROW_N; ++j) {
+				Small *n = (Small *)tfw_pool_alloc(p,
+							sizeof(*n) * j);
+				touch_obj(n);
+				memcpy(n, o, sizeof(*o) * (j - 1));
+				tfw_pool_free(p, o, sizeof(*o) * (j - 1));
+				o = n;
+				o[j - 1].l[0] = j;
+			}
+			tfw_pool_destroy(p);
+		}
+	});
+}
+
+/**
+ * The same pools creation and destruction on @n threads concurrently, the
+ * threads finish at different times, so the magazines returned by
+ * the finished threads to the depot are reused by the others.
+ */
+void
+benchmark_tfw_pool_create_and_destroy_mt(unsigned int n)
+{
+	benchmark_mt("tfw_pool", n, [](size_t i) {
+		TfwPool *p = __tfw_pool_new(0);
+		for (size_t j = 0; j < 100; ++j) {
+			if (__builtin_expect(!(i & 3), 0)) {
+				Big *o;
+				o = (Big *)tfw_pool_alloc(p, sizeof(*o));
+				touch_obj(o);
+			} else {
+				Small *o;
+				o = (Small *)tfw_pool_alloc(p, sizeof(*o));
+				touch_obj(o);
+			}
+		}
+		tfw_pool_destroy(p);
+	}, tfw_pool_pgcache_drain);
+}
+
 /*
  * ------------------------------------------------------------------------
  *	Main part of the benchmark
@@ -829,7 +1384,25 @@ main()
 	benchmark_tfw_pool<Big>();
 	benchmark_tfw_pool_free<Big>();
 	benchmark_tfw_pool_mix_free();
+	benchmark_tfw_pool_mix_delayed_free(false);
+	benchmark_tfw_pool_mix_delayed_free(true);
 	benchmark_tfw_pool_create_and_destroy();
+	benchmark_tfw_pool_realloc();
+	benchmark_tfw_pool_alloc_copy();
+	std::cout << std::endl;
+
+	unsigned int thr_n = std::max(4U, std::thread::hardware_concurrency());
+	benchmark_malloc_mt<Glibc>(thr_n);
+#ifdef HAVE_JEMALLOC
+	benchmark_malloc_mt<Jemalloc>(thr_n);
+#endif
+#ifdef HAVE_TCMALLOC
+	benchmark_malloc_mt<Tcmalloc>(thr_n);
+#endif
+#ifdef HAVE_TBB
+	benchmark_malloc_mt<Tbb>(thr_n);
+#endif
+	benchmark_tfw_pool_create_and_destroy_mt(thr_n);
 
 	return 0;
 }
@@ -0,0 +1,254 @@
+/*
+ * Sustained spawn rates: HelperPool against the one-shot posix_spawnp()
+ * with an output pipe, as in posix_spawn_pipe.cc, and Spawner. 4 client
+ * threads issue "echo" commands at the target rate for a second and each
+ * mode reports the achieved rate and the latency percentiles of a command.
+ *
+ * Usage: helper_pool [RSS MB]
+ */
+#include <spawn.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "helper_pool.h"
+
+#define N_THR	4
+
+static char *const argv_echo[] = {(char *)"echo", (char *)"hello", nullptr};
+static const char expected[] = "hello\n";
+
+static HelperPool pool;
+
+static int
+cmd_echo(int argc, char *const argv[], HelperPool::Out &out)
+{
+	for (int i = 1; i < argc; ++i) {
+		out.write(argv[i], strlen(argv[i]));
+		out.write(i + 1 < argc ? " " : "\n", 1);
+	}
+
+	return 0;
+}
+
+/* 16MB of output: the caller buffer can't grow under a small RLIMIT_AS. */
+static int
+cmd_big(int argc, char *const argv[], HelperPool::Out &out)
+{
+	static char buf[HelperPool::MSG_SZ];
+
+	memset(buf, 'x', sizeof(buf));
+	for (int i = 0; i < 256; ++i)
+		if (out.write(buf, sizeof(buf)))
+			return 1;
+
+	return 0;
+}
+
+static int
+cmd_die(int argc, char *const argv[], HelperPool::Out &out)
+{
+	_exit(1);
+}
+
+static int
+do_posix_spawn(OutBuf &out)
+{
+	int pipefd[2], status, r;
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	pid_t pid;
+
+	if (pipe(pipefd))
+		return -errno;
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_USEVFORK);
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addclose(&actions, pipefd[0]);
+	posix_spawn_file_actions_adddup2(&actions, pipefd[1], 1);
+	posix_spawn_file_actions_addclose(&actions, pipefd[1]);
+
+	r = posix_spawnp(&pid, "echo", &actions, &attr, argv_echo, environ);
+	close(pipefd[1]);
+	if (!r) {
+		while (out.read_from(pipefd[0]) > 0)
+			;
+		waitpid(pid, &status, 0);
+	}
+	close(pipefd[0]);
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+
+	return r ? -r : status;
+}
+
+static int
+do_spawner(OutBuf &out)
+{
+	static thread_local Spawner s;
+
+	return s.run(argv_echo, out);
+}
+
+static int
+do_pool(OutBuf &out)
+{
+	return pool.run(argv_echo, out);
+}
+
+/*
+ * A failed command must leave the worker ready for the next command: the rest
+ * of the output is drained on an output allocation failure and a dead worker
+ * is replaced. The idle workers are reused in LIFO order, so the next command
+ * runs on the same worker.
+ */
+static void
+check_errors()
+{
+	char *const argv_big[] = {(char *)"big", nullptr};
+	char *const argv_die[] = {(char *)"die", nullptr};
+	struct rlimit rl0, rl;
+	unsigned long vm = 0;
+	OutBuf out, out_big;
+	FILE *f;
+	int r;
+
+	if ((f = fopen("/proc/self/statm", "r"))) {
+		if (fscanf(f, "%lu", &vm) != 1)
+			vm = 0;
+		fclose(f);
+	}
+	if (!vm || getrlimit(RLIMIT_AS, &rl0)) {
+		std::cout << "cannot get the address space size!!!" << std::endl;
+		exit(1);
+	}
+	rl = rl0;
+	rl.rlim_cur = vm * sysconf(_SC_PAGESIZE) + (4 << 20);
+	setrlimit(RLIMIT_AS, &rl);
+	r = pool.run(argv_big, out_big);
+	setrlimit(RLIMIT_AS, &rl0);
+	if (r != -ENOMEM || do_pool(out) || out.len != sizeof(expected) - 1
+	    || memcmp(out.data, expected, out.len))
+	{
+		std::cout << "bad result after allocation failure!!!"
+			  << std::endl;
+		exit(1);
+	}
+
+	out.clear();
+	if (pool.run(argv_die, out) != -EIO || do_pool(out)
+	    || out.len != sizeof(expected) - 1
+	    || memcmp(out.data, expected, out.len))
+	{
+		std::cout << "bad result after worker death!!!" << std::endl;
+		exit(1);
+	}
+}
+
+static const struct {
+	const char	*name;
+	int		(*fn)(OutBuf &out);
+} modes[] = {
+	{ "posix_spawn", do_posix_spawn },
+	{ "vfork spawner", do_spawner },
+	{ "helper pool", do_pool },
+};
+
+/*
+ * Issues the commands at @rate / N_THR per second for a second. A thread
+ * doesn't try to catch up if it falls behind the schedule, so the achieved
+ * rate shows the saturation.
+ */
+static void
+client(int (*fn)(OutBuf &), int rate, std::vector<double> *lat)
+{
+	using namespace std::chrono;
+	auto period = duration<double>(1.0 * N_THR / rate);
+	auto t_end = steady_clock::now() + seconds(1);
+	auto next = steady_clock::now();
+	OutBuf out;
+
+	while (next < t_end) {
+		std::this_thread::sleep_until(next);
+		auto t0 = steady_clock::now();
+		out.clear();
+		if (fn(out) || out.len != sizeof(expected) - 1
+		    || memcmp(out.data, expected, out.len))
+		{
+			std::cout << "bad command result!!!" << std::endl;
+			exit(1);
+		}
+		auto t1 = steady_clock::now();
+		lat->push_back(duration<double, std::micro>(t1 - t0).count());
+		next = std::max(next + duration_cast<steady_clock::duration>(period),
+				t1);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	size_t rss = (argc > 1 ? atol(argv[1]) : 512) << 20;
+
+	// Fork the workers before the parent grows.
+	pool.add_command("echo", cmd_echo);
+	pool.add_command("big", cmd_big);
+	pool.add_command("die", cmd_die);
+	if (pool.start(N_THR)) {
+		std::cout << "cannot start the pool!!!" << std::endl;
+		exit(1);
+	}
+	// Not registered commands are spawned by the worker.
+	{
+		char *const argv_sh[] = {(char *)"sh", (char *)"-c",
+					 (char *)"echo hello; exit 3", nullptr};
+		OutBuf out;
+
+		if (pool.run(argv_sh, out) != W_EXITCODE(3, 0)
+		    || out.len != sizeof(expected) - 1
+		    || memcmp(out.data, expected, out.len))
+		{
+			std::cout << "bad exec fallback result!!!" << std::endl;
+			exit(1);
+		}
+	}
+	check_errors();
+
+	char *p = (char *)mmap(nullptr, rss, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		std::cout << "cannot inflate RSS!!!" << std::endl;
+		exit(1);
+	}
+	for (size_t i = 0; i < rss; i += 4096)
+		p[i] = 1;
+
+	printf("%-16s %8s %10s %10s %10s\n", "mode", "rate", "achieved",
+	       "p50 us", "p99 us");
+	for (auto &m : modes)
+		for (int rate : {100, 1000, 10000}) {
+			std::vector<double> lat[N_THR], all;
+			std::thread thr[N_THR];
+
+			for (int i = 0; i < N_THR; ++i)
+				thr[i] = std::thread(client, m.fn, rate, &lat[i]);
+			for (int i = 0; i < N_THR; ++i) {
+				thr[i].join();
+				all.insert(all.end(), lat[i].begin(), lat[i].end());
+			}
+			std::sort(all.begin(), all.end());
+			printf("%-16s %8d %10zu %10.1f %10.1f\n", m.name, rate,
+			       all.size(), all[all.size() / 2],
+			       all[all.size() * 99 / 100]);
+		}
+
+	pool.stop();
+}
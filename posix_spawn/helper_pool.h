@@ -0,0 +1,339 @@
+/**
+ * Pool of pre-forked helper processes. The workers are forked once, when
+ * the parent is still small, and receive the commands over Unix sockets,
+ * so the commands pay neither fork() of the large parent nor exec() and
+ * the dynamic linking: the registered commands run as functions in the
+ * worker, the other commands are spawned by the worker with Spawner from
+ * the small worker process. The output is streamed back in packets.
+ *
+ * LockFreeQueue from lockfree_rb_q.cc identifies the producers and
+ * consumers by the thread local ids, so it doesn't work between processes;
+ * SOCK_SEQPACKET sockets keep the message boundaries and wake up the idle
+ * workers without polling.
+ *
+ * run() is thread safe, each call occupies one worker.
+ */
+#ifndef __HELPER_POOL_H__
+#define __HELPER_POOL_H__
+
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "spawner.h"
+
+class HelperPool {
+public:
+	static const size_t MSG_SZ = 64 * 1024;
+	static const int MAX_ARGS = 64;
+
+	/* Output of a registered command, sent to the caller by packets. */
+	class Out {
+	public:
+		Out(int sd) : sd_(sd), len_(1) { buf_[0] = 'D'; }
+
+		int
+		write(const char *data, size_t n)
+		{
+			while (n) {
+				size_t c = std::min(n, MSG_SZ - len_);
+
+				memcpy(buf_ + len_, data, c);
+				len_ += c;
+				data += c;
+				n -= c;
+				if (len_ == MSG_SZ && flush())
+					return -errno;
+			}
+
+			return 0;
+		}
+
+		int
+		flush()
+		{
+			if (len_ > 1 && send(sd_, buf_, len_, MSG_NOSIGNAL) < 0)
+				return -errno;
+			len_ = 1;
+
+			return 0;
+		}
+
+	private:
+		int	sd_;
+		size_t	len_;
+		char	buf_[MSG_SZ];
+	};
+
+	/* @return the exit code of the command. */
+	typedef int (*Handler)(int argc, char *const argv[], Out &out);
+
+	HelperPool() {}
+
+	~HelperPool() { stop(); }
+
+	HelperPool(const HelperPool &) = delete;
+	HelperPool &operator=(const HelperPool &) = delete;
+
+	/* The commands must be registered before start(). */
+	void
+	add_command(const char *name, Handler h)
+	{
+		cmds_.push_back({ name, h });
+	}
+
+	/**
+	 * Forks @n workers. Call it early, before the parent grows, to keep
+	 * the workers small.
+	 */
+	int
+	start(unsigned int n)
+	{
+		for (unsigned int i = 0; i < n; ++i) {
+			int r;
+
+			workers_.push_back({ -1, -1 });
+			if ((r = fork_worker(workers_.back()))) {
+				workers_.pop_back();
+				return r;
+			}
+			idle_.push_back(workers_.size() - 1);
+			++live_;
+		}
+
+		return 0;
+	}
+
+	void
+	stop()
+	{
+		for (auto &w : workers_) {
+			// A dropped worker, see restart_worker().
+			if (w.sd < 0)
+				continue;
+			// The worker exits on EOF.
+			close(w.sd);
+			waitpid(w.pid, nullptr, 0);
+		}
+		workers_.clear();
+		idle_.clear();
+		live_ = 0;
+	}
+
+	/**
+	 * Runs @argv in a worker and collects the output to @out.
+	 * @return the command wait status or -ECHILD if the pool has no
+	 * workers.
+	 */
+	int
+	run(char *const argv[], OutBuf &out)
+	{
+		char msg[MSG_SZ];
+		size_t len = 0;
+		int r, err = 0, status;
+		unsigned int w;
+
+		for (int i = 0; argv[i]; ++i) {
+			size_t n = strlen(argv[i]) + 1;
+
+			if (i == MAX_ARGS - 1 || len + n >= MSG_SZ)
+				return -E2BIG;
+			memcpy(msg + len, argv[i], n);
+			len += n;
+		}
+
+		if ((r = get_worker()) < 0)
+			return r;
+		w = r;
+		if (send(workers_[w].sd, msg, len, MSG_NOSIGNAL) < 0) {
+			r = -errno;
+			restart_worker(w);
+			return r;
+		}
+		/*
+		 * Read the whole command output up to the exit status even on
+		 * errors, so the next command on the worker doesn't get it.
+		 */
+		while ((r = recv(workers_[w].sd, msg, MSG_SZ, 0)) > 0
+		       && msg[0] != 'E')
+		{
+			if (err)
+				continue;
+			if (out.reserve(r - 1)) {
+				err = -ENOMEM;
+				continue;
+			}
+			memcpy(out.data + out.len, msg + 1, r - 1);
+			out.len += r - 1;
+		}
+		if (r <= 0) {
+			r = r ? -errno : -EIO;
+			restart_worker(w);
+			return r;
+		}
+		put_worker(w);
+		if (err)
+			return err;
+		memcpy(&status, msg + 1, sizeof(status));
+
+		return status;
+	}
+
+private:
+	struct Command {
+		const char	*name;
+		Handler		h;
+	};
+
+	struct Worker {
+		pid_t	pid;
+		int	sd;
+	};
+
+	std::vector<Command>		cmds_;
+	std::vector<Worker>		workers_;
+	std::vector<unsigned int>	idle_;
+	unsigned int			live_ = 0;
+	std::mutex			mtx_;
+	std::condition_variable		cv_;
+
+	/* @return an idle worker or -ECHILD if all the workers are dropped. */
+	int
+	get_worker()
+	{
+		std::unique_lock<std::mutex> lock(mtx_);
+		int w;
+
+		cv_.wait(lock, [this] { return !idle_.empty() || !live_; });
+		if (idle_.empty())
+			return -ECHILD;
+		w = idle_.back();
+		idle_.pop_back();
+
+		return w;
+	}
+
+	void
+	put_worker(unsigned int w)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			idle_.push_back(w);
+		}
+		cv_.notify_one();
+	}
+
+	int
+	fork_worker(Worker &w)
+	{
+		int sv[2];
+
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv))
+			return -errno;
+		if ((w.pid = fork()) < 0) {
+			close(sv[0]);
+			close(sv[1]);
+			return -errno;
+		}
+		if (!w.pid) {
+			close(sv[0]);
+			// Don't keep the sockets of the other workers.
+			for (auto &o : workers_)
+				if (o.sd >= 0)
+					close(o.sd);
+			_exit(worker(sv[1]));
+		}
+		close(sv[1]);
+		w.sd = sv[0];
+
+		return 0;
+	}
+
+	/*
+	 * The worker died or its socket is broken, so its state is unknown:
+	 * reap it and fork a new worker in its place. The new worker is forked
+	 * from the large parent, but this is rare, and out of the lock, so
+	 * the other threads keep running their commands. The worker is dropped
+	 * from the pool if the fork fails. When the last worker is dropped,
+	 * the waiting callers get -ECHILD.
+	 */
+	void
+	restart_worker(unsigned int w)
+	{
+		close(workers_[w].sd);
+		workers_[w].sd = -1;
+		waitpid(workers_[w].pid, nullptr, 0);
+		if (!fork_worker(workers_[w])) {
+			put_worker(w);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			--live_;
+		}
+		cv_.notify_all();
+	}
+
+	/*
+	 * Executes a command which isn't registered: spawns it from the worker
+	 * and streams the spawned process output.
+	 */
+	static int
+	exec_cmd(Spawner &s, char *const argv[], Out &out)
+	{
+		OutBuf ob;
+		int status = s.run(argv, ob);
+
+		if (ob.len && out.write(ob.data, ob.len))
+			return -errno;
+
+		return status;
+	}
+
+	int
+	worker(int sd)
+	{
+		static char msg[MSG_SZ];
+		static Out out(sd);
+		Spawner s;
+		ssize_t r;
+
+		while ((r = recv(sd, msg, MSG_SZ - 1, 0)) > 0) {
+			char *argv[MAX_ARGS];
+			int argc = 0, status = -ENOENT;
+			char end[1 + sizeof(int)];
+			Handler h = nullptr;
+
+			msg[r] = 0;
+			for (char *p = msg; p < msg + r; p += strlen(p) + 1)
+				argv[argc++] = p;
+			argv[argc] = nullptr;
+			if (!argc)
+				continue;
+
+			for (auto &c : cmds_)
+				if (!strcmp(c.name, argv[0])) {
+					h = c.h;
+					break;
+				}
+			if (h)
+				status = W_EXITCODE(h(argc, argv, out) & 0xff, 0);
+			else
+				status = exec_cmd(s, argv, out);
+
+			if (out.flush())
+				return 1;
+			end[0] = 'E';
+			memcpy(end + 1, &status, sizeof(status));
+			if (send(sd, end, sizeof(end), MSG_NOSIGNAL) < 0)
+				return 1;
+		}
+
+		return 0;
+	}
+};
+
+#endif /* __HELPER_POOL_H__ */
@@ -0,0 +1,166 @@
+/*
+ * Spawn latency under a large parent: the benchmark first inflates RSS and
+ * the number of threads as in a production process, then measures the
+ * latency percentiles of running a trivial command with the different
+ * spawn methods. fork() copies the parent page tables, so its cost grows
+ * with RSS, while the vfork()-like methods don't depend on it. Note that
+ * popen() and system() in glibc 2.29 and later use posix_spawn() internally.
+ *
+ * Usage: spawn_latency [RSS MB] [threads] [iterations]
+ */
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "spawner.h"
+
+static char *const argv_true[] = {(char *)"true", nullptr};
+
+static void
+do_popen()
+{
+	char line[1024];
+	FILE *pipe = popen("true", "r");
+
+	while (fgets(line, sizeof(line), pipe) != nullptr)
+		;
+	pclose(pipe);
+}
+
+static void
+do_system()
+{
+	if (system("true")) {
+		std::cout << "system failed!!!" << std::endl;
+		exit(1);
+	}
+}
+
+static void
+do_posix_spawn()
+{
+	pid_t pid;
+	int status;
+
+	if (posix_spawnp(&pid, "true", nullptr, nullptr, argv_true, environ)) {
+		std::cout << "posix_spawn failed!!!" << std::endl;
+		exit(1);
+	}
+	waitpid(pid, &status, 0);
+}
+
+static void
+do_fork()
+{
+	int status;
+	pid_t pid = fork();
+
+	if (pid < 0) {
+		std::cout << "fork failed!!!" << std::endl;
+		exit(1);
+	}
+	if (!pid) {
+		execvp("true", argv_true);
+		_exit(127);
+	}
+	waitpid(pid, &status, 0);
+}
+
+static void
+do_spawner()
+{
+	static Spawner s;
+	OutBuf out;
+
+	if (s.run(argv_true, out)) {
+		std::cout << "spawner failed!!!" << std::endl;
+		exit(1);
+	}
+}
+
+static const struct {
+	const char	*name;
+	void		(*fn)();
+} modes[] = {
+	{ "popen", do_popen },
+	{ "system", do_system },
+	{ "posix_spawn", do_posix_spawn },
+	{ "fork+exec", do_fork },
+	{ "vfork spawner", do_spawner },
+};
+
+/*
+ * Touches every page of @mb megabytes and locks them like the HTrie region,
+ * if the memlock limit allows that.
+ */
+static void *
+inflate_rss(size_t mb)
+{
+	size_t sz = mb << 20;
+	char *p;
+
+	if (!sz)
+		return nullptr;
+	p = (char *)mmap(nullptr, sz, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		std::cout << "cannot map " << mb << "MB" << std::endl;
+		exit(1);
+	}
+	for (size_t i = 0; i < sz; i += 4096)
+		p[i] = 1;
+	if (mlock(p, sz))
+		std::cout << "mlock failed, the memory isn't locked" << std::endl;
+
+	return p;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t rss_mb = argc > 1 ? atol(argv[1]) : 1024;
+	int n_thr = argc > 2 ? atoi(argv[2]) : 64;
+	int iter = argc > 3 ? atoi(argv[3]) : 200;
+	std::atomic<bool> stop(false);
+	std::vector<std::thread> thr;
+	std::vector<double> lat(iter);
+
+	inflate_rss(rss_mb);
+	// Idle threads only add the per-thread kernel state to the parent.
+	for (int i = 0; i < n_thr; ++i)
+		thr.emplace_back([&stop] {
+			while (!stop.load(std::memory_order_relaxed))
+				std::this_thread::sleep_for(
+					std::chrono::milliseconds(10));
+		});
+
+	std::cout << "RSS " << rss_mb << "MB, " << n_thr << " threads, "
+		  << iter << " spawns, latency in microseconds" << std::endl;
+	printf("%-16s %10s %10s %10s\n", "mode", "p50", "p99", "max");
+	for (auto &m : modes) {
+		for (int i = 0; i < iter; ++i) {
+			auto t0 = std::chrono::steady_clock::now();
+			m.fn();
+			auto t1 = std::chrono::steady_clock::now();
+			lat[i] = std::chrono::duration<double, std::micro>(t1 - t0)
+				 .count();
+		}
+		std::sort(lat.begin(), lat.end());
+		printf("%-16s %10.1f %10.1f %10.1f\n", m.name, lat[iter / 2],
+		       lat[iter * 99 / 100], lat[iter - 1]);
+	}
+
+	stop = true;
+	for (auto &t : thr)
+		t.join();
+}
@@ -0,0 +1,508 @@
+/**
+ * Process spawner for high spawn rates: clone(CLONE_VM | CLONE_VFORK) with
+ * a preallocated child stack and file actions, the child output read right
+ * into a growing buffer or spliced to a file descriptor, and asynchronous
+ * completion of many children through pidfd and epoll.
+ *
+ * Unlike fork() the parent page tables are not copied, so the spawn cost
+ * doesn't depend on the parent RSS. Unlike posix_spawn() the exec() errors
+ * are returned to the caller directly through the shared memory.
+ *
+ * A Spawner is not thread safe, use one Spawner per thread. Since the child
+ * shares the memory with the parent until exec(), the signal handlers of
+ * the parent must not rely on the thread identity.
+ *
+ * The functions return negative errno on errors.
+ */
+#ifndef __SPAWNER_H__
+#define __SPAWNER_H__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <functional>
+
+#ifndef CLONE_PIDFD
+#define CLONE_PIDFD	0x00001000
+#endif
+#ifndef P_PIDFD
+#define P_PIDFD		3
+#endif
+
+extern char **environ;
+
+/**
+ * Output buffer growing in place, the pipe data is read directly to its
+ * tail. Owns the memory.
+ */
+struct OutBuf {
+	char	*data;
+	size_t	len;
+	size_t	cap;
+
+	OutBuf() : data(nullptr), len(0), cap(0) {}
+	~OutBuf() { free(data); }
+	OutBuf(const OutBuf &) = delete;
+	OutBuf &operator=(const OutBuf &) = delete;
+
+	void clear() { len = 0; }
+
+	int
+	reserve(size_t n)
+	{
+		size_t c = cap ? cap : 4096;
+		char *p;
+
+		if (len + n <= cap)
+			return 0;
+		while (c < len + n)
+			c *= 2;
+		if (!(p = (char *)realloc(data, c)))
+			return -ENOMEM;
+		data = p;
+		cap = c;
+
+		return 0;
+	}
+
+	/*
+	 * Reads all the available data from @fd with one readv() per the pipe
+	 * buffer: the free buffer tail goes first, the rest spills to a stack
+	 * area and is appended after the buffer growth.
+	 *
+	 * @return 0 on EOF, positive on read data, negative errno on error,
+	 * -EAGAIN if a nonblocking @fd has no more data.
+	 */
+	int
+	read_from(int fd)
+	{
+		char spill[16384];
+		struct iovec iov[2];
+		ssize_t r;
+
+		if (cap - len < 1024 && reserve(cap ? cap : 4096))
+			return -ENOMEM;
+		iov[0].iov_base = data + len;
+		iov[0].iov_len = cap - len;
+		iov[1].iov_base = spill;
+		iov[1].iov_len = sizeof(spill);
+
+		while ((r = readv(fd, iov, 2)) < 0 && errno == EINTR)
+			;
+		if (r <= 0)
+			return r ? -errno : 0;
+
+		if ((size_t)r <= iov[0].iov_len) {
+			len += r;
+		} else {
+			size_t s = r - iov[0].iov_len;
+
+			len = cap;
+			if (reserve(s))
+				return -ENOMEM;
+			memcpy(data + len, spill, s);
+			len += s;
+		}
+
+		return 1;
+	}
+};
+
+class Spawner {
+public:
+	/* Placeholder for the write end of the output pipe in file actions. */
+	static const int OUT_PIPE = -2;
+	static const int MAX_ACTIONS = 8;
+	static const size_t STACK_SZ = 64 * 1024;
+
+	/**
+	 * A child started by start(): the read end of its output pipe and
+	 * the pidfd, both close-on-exec and owned by the caller.
+	 */
+	struct Child {
+		pid_t	pid;
+		int	pidfd;
+		int	out_fd;
+	};
+
+	Spawner()
+		: stack_(nullptr), n_actions_(0)
+	{
+		void *s = mmap(nullptr, STACK_SZ, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+		if (s != MAP_FAILED)
+			stack_ = (char *)s;
+		// Child stdout goes to the pipe by default.
+		add_dup2(OUT_PIPE, 1);
+	}
+
+	~Spawner()
+	{
+		if (stack_)
+			munmap(stack_, STACK_SZ);
+	}
+
+	Spawner(const Spawner &) = delete;
+	Spawner &operator=(const Spawner &) = delete;
+
+	bool ok() const { return stack_; }
+
+	/**
+	 * File actions executed by the child before exec(), in the order of
+	 * addition. @fd may be OUT_PIPE. The actions are kept for all the
+	 * subsequent spawns.
+	 */
+	int
+	add_dup2(int fd, int newfd)
+	{
+		return add_action(A_DUP2, fd, newfd);
+	}
+
+	int
+	add_close(int fd)
+	{
+		return add_action(A_CLOSE, fd, -1);
+	}
+
+	void reset_actions() { n_actions_ = 0; }
+
+	/**
+	 * Starts @argv[0], searched in PATH, with the output pipe and pidfd.
+	 * Returns after the child exec() or failure, the failed exec() errno
+	 * is returned.
+	 */
+	int
+	start(char *const argv[], Child &c)
+	{
+		int pipefd[2], pidfd = -1, r;
+		sigset_t all, old;
+		pid_t pid;
+
+		if (!stack_)
+			return -ENOMEM;
+		if (pipe2(pipefd, O_CLOEXEC))
+			return -errno;
+
+		ca_.argv = argv;
+		ca_.out = pipefd[1];
+		ca_.err = 0;
+
+		/*
+		 * Don't run the parent signal handlers on the child stack,
+		 * the child restores the mask right before exec().
+		 */
+		sigfillset(&all);
+		pthread_sigmask(SIG_SETMASK, &all, &old);
+		ca_.mask = &old;
+		pid = clone(child_fn, stack_ + STACK_SZ,
+			    CLONE_VM | CLONE_VFORK | CLONE_PIDFD | SIGCHLD,
+			    this, &pidfd);
+		r = errno;
+		pthread_sigmask(SIG_SETMASK, &old, nullptr);
+
+		close(pipefd[1]);
+		if (pid < 0) {
+			close(pipefd[0]);
+			return -r;
+		}
+		if (ca_.err) {
+			// The child has exited, reap it.
+			waitpid(pid, nullptr, 0);
+			close(pidfd);
+			close(pipefd[0]);
+			return -ca_.err;
+		}
+
+		c.pid = pid;
+		c.pidfd = pidfd;
+		c.out_fd = pipefd[0];
+
+		return 0;
+	}
+
+	/**
+	 * Runs @argv synchronously and collects its output to @out.
+	 * @return the child wait status.
+	 */
+	int
+	run(char *const argv[], OutBuf &out)
+	{
+		Child c = { -1, -1, -1 };
+		int r;
+
+		if ((r = start(argv, c)))
+			return r;
+
+		while ((r = out.read_from(c.out_fd)) > 0)
+			;
+
+		return finish(c, r);
+	}
+
+	/**
+	 * Runs @argv synchronously and streams its output to @sink, e.g.
+	 * a socket or a file, without copying it to the user space.
+	 */
+	int
+	run(char *const argv[], int sink)
+	{
+		Child c = { -1, -1, -1 };
+		ssize_t n;
+		int r;
+
+		if ((r = start(argv, c)))
+			return r;
+
+		while ((n = splice(c.out_fd, nullptr, sink, nullptr, 1 << 16,
+				   SPLICE_F_MOVE | SPLICE_F_MORE)) != 0)
+			if (n < 0 && errno != EINTR) {
+				r = -errno;
+				break;
+			}
+
+		return finish(c, r);
+	}
+
+	/**
+	 * Reaps the exited child. @return the wait status.
+	 */
+	static int
+	reap(Child &c)
+	{
+		siginfo_t si;
+
+		si.si_pid = 0;
+		while (waitid((idtype_t)P_PIDFD, c.pidfd, &si, WEXITED) < 0)
+			if (errno != EINTR)
+				return -errno;
+
+		close(c.pidfd);
+		c.pidfd = -1;
+
+		return si.si_code == CLD_EXITED ? W_EXITCODE(si.si_status, 0)
+						: si.si_status;
+	}
+
+private:
+	enum {
+		A_DUP2,
+		A_CLOSE,
+	};
+
+	struct Action {
+		int	op;
+		int	fd;
+		int	newfd;
+	};
+
+	/* Data shared with the child, valid until its exec(). */
+	struct ChildArgs {
+		char *const	*argv;
+		sigset_t	*mask;
+		int		out;
+		int		err;
+	};
+
+	char		*stack_;
+	int		n_actions_;
+	Action		actions_[MAX_ACTIONS];
+	ChildArgs	ca_;
+
+	int
+	add_action(int op, int fd, int newfd)
+	{
+		if (n_actions_ == MAX_ACTIONS)
+			return -ENOSPC;
+		actions_[n_actions_++] = { op, fd, newfd };
+
+		return 0;
+	}
+
+	int
+	finish(Child &c, int r)
+	{
+		int status;
+
+		close(c.out_fd);
+		status = reap(c);
+
+		return r < 0 ? r : status;
+	}
+
+	/*
+	 * Runs in the parent memory on a separate stack until exec(), so only
+	 * the async-signal-safe calls and no memory allocations.
+	 */
+	static int
+	child_fn(void *arg)
+	{
+		Spawner *s = (Spawner *)arg;
+		ChildArgs *ca = &s->ca_;
+
+		for (int i = 0; i < s->n_actions_; ++i) {
+			const Action *a = &s->actions_[i];
+			int fd = a->fd == OUT_PIPE ? ca->out : a->fd;
+
+			if (a->op == A_DUP2) {
+				// dup2() to itself doesn't clear close-on-exec.
+				if (fd == a->newfd) {
+					if (fcntl(fd, F_SETFD, 0))
+						goto err;
+				}
+				else if (dup2(fd, a->newfd) < 0) {
+					goto err;
+				}
+			}
+			else if (close(fd) && errno != EBADF) {
+				goto err;
+			}
+		}
+
+		pthread_sigmask(SIG_SETMASK, ca->mask, nullptr);
+		execvpe(ca->argv[0], ca->argv, environ);
+	err:
+		ca->err = errno;
+		_exit(127);
+	}
+};
+
+/**
+ * Asynchronous spawns: the child output and exit are watched by epoll
+ * through the output pipe and the pidfd, the completion callback is called
+ * from poll() with the wait status and the collected output.
+ */
+class SpawnLoop {
+public:
+	typedef std::function<void (int status, OutBuf &out)> Callback;
+
+	SpawnLoop() : n_(0) { ep_ = epoll_create1(EPOLL_CLOEXEC); }
+
+	~SpawnLoop()
+	{
+		if (ep_ >= 0)
+			close(ep_);
+	}
+
+	SpawnLoop(const SpawnLoop &) = delete;
+	SpawnLoop &operator=(const SpawnLoop &) = delete;
+
+	/* Number of the running children. */
+	unsigned int pending() const { return n_; }
+
+	int
+	submit(Spawner &s, char *const argv[], Callback cb)
+	{
+		Task *t = new Task;
+		struct epoll_event ev;
+		int r;
+
+		if ((r = s.start(argv, t->c))) {
+			delete t;
+			return r;
+		}
+		fcntl(t->c.out_fd, F_SETFL, O_NONBLOCK);
+		t->cb = std::move(cb);
+		t->eof = false;
+		t->exited = false;
+		t->w_out = { t, false };
+		t->w_pid = { t, true };
+
+		ev.events = EPOLLIN;
+		ev.data.ptr = &t->w_out;
+		if (epoll_ctl(ep_, EPOLL_CTL_ADD, t->c.out_fd, &ev))
+			goto err;
+		ev.data.ptr = &t->w_pid;
+		if (epoll_ctl(ep_, EPOLL_CTL_ADD, t->c.pidfd, &ev))
+			goto err;
+		++n_;
+
+		return 0;
+	err:
+		r = -errno;
+		// Wait for the child and forget it.
+		close(t->c.out_fd);
+		Spawner::reap(t->c);
+		delete t;
+		return r;
+	}
+
+	/**
+	 * Processes the events for up to @timeout milliseconds, -1 waits
+	 * for the first event. @return number of completed children.
+	 */
+	int
+	poll(int timeout)
+	{
+		struct epoll_event ev[64];
+		int n, done = 0;
+
+		if ((n = epoll_wait(ep_, ev, 64, timeout)) < 0)
+			return errno == EINTR ? 0 : -errno;
+
+		for (int i = 0; i < n; ++i) {
+			Watch *w = (Watch *)ev[i].data.ptr;
+			Task *t = w->t;
+
+			if (w->pid) {
+				epoll_ctl(ep_, EPOLL_CTL_DEL, t->c.pidfd, nullptr);
+				t->status = Spawner::reap(t->c);
+				t->exited = true;
+			} else {
+				int r;
+
+				while ((r = t->out.read_from(t->c.out_fd)) > 0)
+					;
+				if (r == -EAGAIN)
+					continue;
+				epoll_ctl(ep_, EPOLL_CTL_DEL, t->c.out_fd, nullptr);
+				close(t->c.out_fd);
+				t->eof = true;
+			}
+			/*
+			 * The child may exit before its output is read, the
+			 * task completes with both the events.
+			 */
+			if (t->eof && t->exited) {
+				t->cb(t->status, t->out);
+				delete t;
+				--n_;
+				++done;
+			}
+		}
+
+		return done;
+	}
+
+private:
+	struct Task;
+
+	struct Watch {
+		Task	*t;
+		bool	pid;
+	};
+
+	struct Task {
+		Spawner::Child	c;
+		OutBuf		out;
+		Callback	cb;
+		Watch		w_out;
+		Watch		w_pid;
+		int		status;
+		bool		eof;
+		bool		exited;
+	};
+
+	int		ep_;
+	unsigned int	n_;
+};
+
+#endif /* __SPAWNER_H__ */
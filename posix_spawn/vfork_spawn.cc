@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "spawner.h"
+
+static std::string
+popen_output(const char *cmd)
+{
+	std::string s;
+	char line[1024];
+	FILE *pipe = popen(cmd, "r");
+
+	while (fgets(line, sizeof(line), pipe) != nullptr)
+		s += line;
+	pclose(pipe);
+
+	return s;
+}
+
+void test(const std::string *expected)
+{
+	Spawner s;
+	OutBuf out;
+	char *argv[2] = {(char *)"ls", nullptr};
+
+	for (int i = 0; i < 1000; ++i) {
+		out.clear();
+		if (s.run(argv, out)) {
+			std::cout << "spawn failed!!!" << std::endl;
+			exit(1);
+		}
+		if (std::string(out.data, out.len) != *expected) {
+			std::cout << "bad output!!!" << std::endl;
+			exit(1);
+		}
+	}
+}
+
+/*
+ * The same 4000 spawns from one thread with up to 16 children at a time.
+ */
+void test_async(const std::string *expected)
+{
+	Spawner s;
+	SpawnLoop loop;
+	char *argv[2] = {(char *)"ls", nullptr};
+	int started = 0, done = 0;
+
+	auto cb = [&](int status, OutBuf &out) {
+		if (status || std::string(out.data, out.len) != *expected) {
+			std::cout << "bad async output!!!" << std::endl;
+			exit(1);
+		}
+	};
+
+	while (done < 4000) {
+		while (started < 4000 && loop.pending() < 16) {
+			if (loop.submit(s, argv, cb)) {
+				std::cout << "async spawn failed!!!" << std::endl;
+				exit(1);
+			}
+			++started;
+		}
+		int r = loop.poll(-1);
+		if (r < 0) {
+			std::cout << "epoll failed!!!" << std::endl;
+			exit(1);
+		}
+		done += r;
+	}
+}
+
+int main()
+{
+	std::thread thr[4];
+	std::string expected = popen_output("ls");
+	char *bad_argv[2] = {(char *)"no-such-command-xyz", nullptr};
+	Spawner s;
+	OutBuf out;
+
+	// exec() errors are reported to the parent.
+	if (s.run(bad_argv, out) != -ENOENT) {
+		std::cout << "exec error isn't reported!!!" << std::endl;
+		exit(1);
+	}
+
+	auto t0 = std::chrono::steady_clock::now();
+	for (auto &t : thr)
+		t = std::thread(test, &expected);
+	for (auto &t : thr)
+		t.join();
+	auto t1 = std::chrono::steady_clock::now();
+	test_async(&expected);
+	auto t2 = std::chrono::steady_clock::now();
+
+	std::cout << "sync:  "
+		  << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0)
+		     .count()
+		  << "ms" << std::endl;
+	std::cout << "async: "
+		  << std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1)
+		     .count()
+		  << "ms" << std::endl;
+}
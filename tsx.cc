@@ -1,8 +1,10 @@
 /**
  * Compile by:
- * $ g++ -O2 -std=c++11 -DL1DSZ=$(getconf LEVEL1_DCACHE_LINESIZE) -DCORES=$(grep -c processor /proc/cpuinfo) tsx.cc -lpthread
+ * $ g++ -O2 -std=c++11 -DL1DSZ=$(getconf LEVEL1_DCACHE_LINESIZE) -DCORES=$(grep -c processor /proc/cpuinfo) tsx.cc -lpthread -lm
  *
- * Add -DABORT_COUNT to get TSX aborts statistic in the program output.
+ * Add -DABORT_COUNT to get per-thread TSX abort causes in the program output,
+ * -DTRX_PROF to get the cycle histograms of the committed and the lock paths
+ * and -DPERF_EVENTS to count the transactional aborts with the PMU.
  *
  * Copyright (C) 2013 Alexander Krizhanovsky (ak@tempesta-tech.com).
  *
@@ -26,14 +28,25 @@
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
+#include <cpuid.h>
 #include <pthread.h>
-#include <sys/time.h>
+#ifdef PERF_EVENTS
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
+#include <algorithm>
 #include <atomic>
 #include <iostream>
 #include <thread>
 
-#include <immintrin.h>
+// Only _mm_pause() is needed, the newer immintrin.h also defines RTM intrinsics
+// conflicting with the ones below.
+#include <xmmintrin.h>
+
+#include "bench.h"
 
 // TSX code is stolen from glibc-2.18
 
@@ -41,6 +54,9 @@
 #define _XA_RETRY		1
 #define _XA_CONFLICT		2
 #define _XA_CAPACITY		3
+// Not a status bit: aborts without a cause, e.g. due to interrupts.
+#define _XA_OTHER		4
+#define _XA_NUM			5
 
 #define _XBEGIN_STARTED		(~0u)
 #define _XABORT_EXPLICIT	(1 << _XA_EXPLICIT)
@@ -76,6 +92,13 @@ static __force_inline void _xabort(const unsigned int status)
 			:: "i" (status) : "memory");
 }
 
+static __force_inline unsigned long long _rdtsc(void)
+{
+	unsigned lo, hi;
+	asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((unsigned long long)hi << 32) | lo;
+}
+
 static __force_inline int _xtest(void)
 {
 	unsigned char out;
@@ -88,6 +111,7 @@ static const auto TRX_BUF_SZ_MAX = 8192UL;
 enum class Sync : unsigned char {
 	TSX,
 	SpinLock,
+	Elided,
 };
 
 pthread_spinlock_t spin_l;
@@ -117,15 +141,135 @@ static CacheLine credit[TRX_BUF_SZ_MAX] __attribute__((aligned(L1DSZ)));
 std::atomic<long> aborts(0), retries(0);
 __thread long _aborts __attribute__((aligned(L1DSZ)));
 __thread long _retries __attribute__((aligned(L1DSZ)));
-#ifdef ABORT_COUNT
-__thread unsigned _abrt[4] __attribute__((aligned(L1DSZ)));
-#define ABRT_COUNT(type, status)					\
+
+// Abort causes by the status bits, one abort may have several bits set.
+static const char *abrt_name[_XA_NUM] = {
+	"explicit", "retry", "conflict", "capacity", "other"
+};
+std::atomic<unsigned long> abrt[_XA_NUM];
+__thread unsigned long _abrt[_XA_NUM] __attribute__((aligned(L1DSZ)));
+
+static inline void
+abrt_count(unsigned status)
+{
+	if (!(status & (_XABORT_EXPLICIT | _XABORT_RETRY | _XABORT_CONFLICT
+			| _XABORT_CAPACITY)))
+		++_abrt[_XA_OTHER];
+	for (int t = _XA_EXPLICIT; t <= _XA_CAPACITY; ++t)
+		if (status & (1 << t))
+			++_abrt[t];
+}
+
+// Log2 histograms of the critical section cycles for the committed
+// transactions and the lock (fallback or spin lock) paths.
+#ifdef TRX_PROF
+static const int CYC_BUCKETS = 32;
+enum { CYC_COMMIT, CYC_LOCK, CYC_PATHS };
+static const char *cyc_name[CYC_PATHS] = { "commit", "lock" };
+std::atomic<unsigned long> cyc[CYC_PATHS][CYC_BUCKETS];
+__thread unsigned long _cyc[CYC_PATHS][CYC_BUCKETS]
+	__attribute__((aligned(L1DSZ)));
+#define PROF_START()	unsigned long long _t0 = _rdtsc()
+#define PROF_END(committed)						\
 do {									\
-	if (status & (1 << type))					\
-		_abrt[type]++;						\
+	unsigned long long _d = _rdtsc() - _t0;				\
+	int _b = _d ? 64 - __builtin_clzll(_d) : 0;			\
+	++_cyc[(committed) ? CYC_COMMIT : CYC_LOCK]			\
+	      [std::min(_b, CYC_BUCKETS - 1)];				\
 } while (0)
 #else
-#define ABRT_COUNT(...)
+#define PROF_START()
+#define PROF_END(committed)	(void)(committed)
+#endif
+
+#ifdef PERF_EVENTS
+// The transactional PMU events exported by the kernel for TSX capable CPUs,
+// counted for each thread in the user space.
+static const int PE_NUM = 3;
+static const char *pe_name[PE_NUM] = { "tx-abort", "tx-conflict", "tx-capacity" };
+static unsigned long long pe_config[PE_NUM];
+std::atomic<unsigned long> pe_cnt[PE_NUM];
+
+// Reads the raw config of the events like "event=0xc9,umask=0x4".
+// Leaves zero config for unsupported events.
+static void
+perf_events_init()
+{
+	for (int e = 0; e < PE_NUM; ++e) {
+		char path[128], buf[128];
+		snprintf(path, sizeof(path),
+			 "/sys/bus/event_source/devices/cpu/events/%s",
+			 pe_name[e]);
+		FILE *f = fopen(path, "r");
+		if (!f || !fgets(buf, sizeof(buf), f)) {
+			std::cout << "no PMU event " << pe_name[e] << std::endl;
+			if (f)
+				fclose(f);
+			continue;
+		}
+		fclose(f);
+
+		unsigned long long cfg = 0;
+		for (char *t = strtok(buf, ",\n"); t; t = strtok(NULL, ",\n")) {
+			if (!strncmp(t, "event=", 6)) {
+				cfg |= strtoull(t + 6, NULL, 0);
+			}
+			else if (!strncmp(t, "umask=", 6)) {
+				cfg |= strtoull(t + 6, NULL, 0) << 8;
+			}
+			else {
+				std::cout << "unsupported PMU event term " << t
+					  << " for " << pe_name[e] << std::endl;
+				cfg = 0;
+				break;
+			}
+		}
+		pe_config[e] = cfg;
+	}
+}
+
+class PerfEvents {
+public:
+	PerfEvents()
+	{
+		struct perf_event_attr attr;
+
+		for (int e = 0; e < PE_NUM; ++e) {
+			fd_[e] = -1;
+			if (!pe_config[e])
+				continue;
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = PERF_TYPE_RAW;
+			attr.config = pe_config[e];
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			fd_[e] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+		}
+		for (int e = 0; e < PE_NUM; ++e)
+			if (fd_[e] >= 0)
+				ioctl(fd_[e], PERF_EVENT_IOC_ENABLE, 0);
+	}
+
+	~PerfEvents()
+	{
+		for (int e = 0; e < PE_NUM; ++e)
+			if (fd_[e] >= 0)
+				ioctl(fd_[e], PERF_EVENT_IOC_DISABLE, 0);
+		for (int e = 0; e < PE_NUM; ++e) {
+			unsigned long long v;
+			if (fd_[e] < 0)
+				continue;
+			if (read(fd_[e], &v, sizeof(v)) == sizeof(v))
+				pe_cnt[e] += v;
+			close(fd_[e]);
+		}
+	}
+
+private:
+	int fd_[PE_NUM];
+};
 #endif
 
 static unsigned char abrt_fallback[] __attribute__((aligned(L1DSZ))) = {
@@ -166,6 +310,17 @@ warm_and_clear_memory()
 {
 	aborts = 0;
 	retries = 0;
+	for (auto &a : abrt)
+		a = 0;
+#ifdef TRX_PROF
+	for (auto &p : cyc)
+		for (auto &c : p)
+			c = 0;
+#endif
+#ifdef PERF_EVENTS
+	for (auto &c : pe_cnt)
+		c = 0;
+#endif
 
 	memset(debit, 0, sizeof(debit));
 	memset(credit, 0, sizeof(credit));
@@ -195,7 +350,7 @@ execute_spinlock_trx(unsigned long thr_id, unsigned long trx_sz, int trx_count,
 // Transaction.
 // Reruns transaction specified number of times before abort.
 // @return false if the transaction is aborted and true otherwise.
-static void
+static bool
 execute_short_trx(unsigned long trx_id, unsigned long trx_sz, int trx_count,
 		  int overlap)
 {
@@ -215,13 +370,10 @@ execute_short_trx(unsigned long trx_id, unsigned long trx_sz, int trx_count,
 
 			_xend();
 
-			return;
+			return true;
 		}
 
-		ABRT_COUNT(_XA_RETRY, status);
-		ABRT_COUNT(_XA_EXPLICIT, status);
-		ABRT_COUNT(_XA_CONFLICT, status);
-		ABRT_COUNT(_XA_CAPACITY, status);
+		abrt_count(status);
 
 		if (__builtin_expect(!(status & _XABORT_RETRY), 0)) {
 			++_aborts;
@@ -259,8 +411,206 @@ execute_short_trx(unsigned long trx_id, unsigned long trx_sz, int trx_count,
 
 	// fallback to spinlock.
 	execute_spinlock_trx(trx_id, trx_sz, trx_count, overlap);
+
+	return false;
 }
 
+// Lock elision.
+//
+// The retry budget depends on the abort cause: capacity aborts without
+// the retry hint go to the lock at once, conflicts spend the budget with
+// the randomized backoffs, busy lock aborts wait for the lock release
+// and other aborts (interrupts, unknown explicit codes) get a couple of
+// retries. Each lock keeps the history over windows of ELIDE_WIN critical
+// sections: the budget grows while the retries pay off and halves while
+// they end on the lock, and ELIDE_HOT_WINS windows in a row with more than
+// ELIDE_HOT_PCT% of the sections on the lock switch the lock to plain
+// locking for good. Without RTM the lock is hot from the beginning.
+static const unsigned ELIDE_WIN = 1024;
+static const unsigned ELIDE_HOT_PCT = 50;
+static const unsigned ELIDE_HOT_WINS = 4;
+static const unsigned ELIDE_RETRY_MAX = 64;
+static const unsigned ELIDE_RETRY_MISC = 2;
+static const unsigned ELIDE_BUSY_MAX = 8;
+
+static bool
+rtm_supported()
+{
+	unsigned a, b, c, d;
+
+	if (__get_cpuid_max(0, NULL) < 7)
+		return false;
+	__cpuid_count(7, 0, a, b, c, d);
+
+	return b & bit_RTM;
+}
+
+class ElidedLock;
+
+// Per-thread history window, merged to the lock at the window end to not
+// write the shared history on each critical section.
+struct ElideWin {
+	ElidedLock *lock;
+	unsigned ops, fallbacks, retry_ok, exhausted;
+};
+static __thread ElideWin ew __attribute__((aligned(L1DSZ)));
+
+class ElidedLock {
+public:
+	ElidedLock() : l_(0)
+	{
+		reset();
+	}
+
+	void
+	reset()
+	{
+		budget_ = ELIDE_RETRY_MAX / 4;
+		hot_wins_ = 0;
+		hot_ = !rtm_supported();
+	}
+
+	unsigned budget() const { return budget_.load(); }
+	bool hot() const { return hot_.load(); }
+
+	// @return true if the critical section is committed as a transaction.
+	template<typename F>
+	bool
+	operator()(F &&f)
+	{
+		if (__builtin_expect(hot_.load(std::memory_order_relaxed), 0)) {
+			lock_section(f);
+			return false;
+		}
+
+		// Randomize the budget to desynchronize the aborting threads.
+		unsigned lim = 1 + abrt_fallback[af]
+			       * budget_.load(std::memory_order_relaxed) / 0x40;
+		unsigned abrt = 0, busy = 0, misc = 0;
+		bool exhausted = false;
+
+		while (1) {
+			unsigned status = _xbegin();
+
+			if (__builtin_expect(status == _XBEGIN_STARTED, 1)) {
+				if (__builtin_expect(locked(), 0))
+					_xabort(_ABORT_LOCK_BUSY);
+
+				f();
+
+				_xend();
+
+				account(abrt, false, false);
+				return true;
+			}
+
+			abrt_count(status);
+
+			++abrt;
+			++_aborts;
+
+			if ((status & _XABORT_EXPLICIT)
+			    && _XABORT_CODE(status) == _ABORT_LOCK_BUSY)
+			{
+				if (++busy > ELIDE_BUSY_MAX)
+					break;
+				while (locked())
+					_mm_pause();
+			}
+			else if (status & _XABORT_CAPACITY) {
+				if (!(status & _XABORT_RETRY))
+					break;
+				if (abrt >= lim) {
+					exhausted = true;
+					break;
+				}
+			}
+			else if (status & (_XABORT_RETRY | _XABORT_CONFLICT)) {
+				if (abrt >= lim) {
+					exhausted = true;
+					break;
+				}
+			}
+			else if (++misc > ELIDE_RETRY_MISC) {
+				break;
+			}
+
+			++_retries;
+			_mm_pause();
+		}
+
+		af = (af + 1) % (sizeof(abrt_fallback) / sizeof(*abrt_fallback));
+		lock_section(f);
+		account(abrt, true, exhausted);
+
+		return false;
+	}
+
+private:
+	// Own lock word instead of the hacky pthread spin lock check in
+	// execute_short_trx(): the spin lock layout differs between glibc
+	// versions.
+	bool
+	locked() const
+	{
+		return l_.load(std::memory_order_relaxed);
+	}
+
+	template<typename F>
+	void
+	lock_section(F &f)
+	{
+		while (l_.exchange(1, std::memory_order_acquire))
+			while (locked())
+				_mm_pause();
+		f();
+		l_.store(0, std::memory_order_release);
+	}
+
+	void
+	account(unsigned abrt, bool fallback, bool exhausted)
+	{
+		if (ew.lock != this)
+			ew = {this, 0, 0, 0, 0};
+
+		++ew.ops;
+		ew.fallbacks += fallback;
+		ew.retry_ok += abrt && !fallback;
+		ew.exhausted += exhausted;
+		if (ew.ops < ELIDE_WIN)
+			return;
+
+		// Races between the threads merging their windows only make
+		// the heuristic a bit less precise.
+		unsigned b = budget_.load(std::memory_order_relaxed);
+		if (ew.exhausted > ew.retry_ok)
+			b = std::max(b / 2, 1U);
+		else if (ew.exhausted && b < ELIDE_RETRY_MAX)
+			++b;
+		budget_.store(b, std::memory_order_relaxed);
+
+		if (ew.fallbacks * 100 > ELIDE_HOT_PCT * ew.ops) {
+			if (hot_wins_.fetch_add(1, std::memory_order_relaxed) + 1
+			    >= ELIDE_HOT_WINS)
+				hot_.store(true, std::memory_order_relaxed);
+		} else {
+			hot_wins_.store(0, std::memory_order_relaxed);
+		}
+
+		ew = {this, 0, 0, 0, 0};
+	}
+
+	std::atomic<int>	l_;
+	// The history is read and written out of transactions, so keep it
+	// out of the lock word cache line which is in each transaction
+	// read set.
+	std::atomic<unsigned>	budget_ __attribute__((aligned(L1DSZ)));
+	std::atomic<unsigned>	hot_wins_;
+	std::atomic<bool>	hot_;
+};
+
+static ElidedLock elided_l;
+
 struct Thr {
 	unsigned long trx_sz;
 	unsigned long iter;
@@ -268,10 +618,10 @@ struct Thr {
 	int trx_count, overlap;
 	Sync sync;
 
-	Thr(int trx_sz, int trx_count, int interleace, int iter, int thr_num,
+	Thr(int trx_sz, int trx_count, int overlap, int iter, int thr_num,
 	    int thr_id, Sync sync)
-		: trx_sz(trx_sz), trx_count(trx_count), overlap(overlap),
-		iter(iter), thr_num(thr_num), thr_id(thr_id), sync(sync)
+		: trx_sz(trx_sz), iter(iter), thr_num(thr_num), thr_id(thr_id),
+		trx_count(trx_count), overlap(overlap), sync(sync)
 	{
 		assert(thr_id < CORES);
 		assert(thr_id < thr_num);
@@ -285,71 +635,86 @@ struct Thr {
 
 		set_affinity();
 
-		for (unsigned long i = 0; i < iter; ++i) {
-			switch (sync) {
-			case Sync::TSX:
-				execute_short_trx(thr_id, trx_sz, trx_count,
-						  overlap);
-				break;
-			case Sync::SpinLock:
-				execute_spinlock_trx(thr_id, trx_sz, trx_count,
-						     overlap);
-				break;
-			default:
-				abort();
-			}
+		{
+#ifdef PERF_EVENTS
+			PerfEvents pe;
+#endif
+			for (unsigned long i = 0; i < iter; ++i)
+				run_trx();
 		}
 
 		// merge statistics
 		aborts += _aborts;
 		retries += _retries;
+		for (int t = 0; t < _XA_NUM; ++t)
+			abrt[t] += _abrt[t];
+#ifdef TRX_PROF
+		for (int p = 0; p < CYC_PATHS; ++p)
+			for (int b = 0; b < CYC_BUCKETS; ++b)
+				cyc[p][b] += _cyc[p][b];
+#endif
 #ifdef ABORT_COUNT
 		pthread_spin_lock(&spin_l);
-		std::cout << "\t\texplicit abrt: " << _abrt[_XA_EXPLICIT]
-			  << "\n\t\tretry abrt: " << _abrt[_XA_RETRY]
-			  << "\n\t\tconflict abrt: " << _abrt[_XA_CONFLICT]
-			  << "\n\t\tcapacity abrt: " << _abrt[_XA_CAPACITY]
-			  << std::endl;
+		std::cout << "\t\tthread " << thr_id << ":";
+		for (int t = 0; t < _XA_NUM; ++t)
+			std::cout << "\n\t\t" << abrt_name[t] << " abrt: "
+				  << _abrt[t];
+		std::cout << std::endl;
 		pthread_spin_unlock(&spin_l);
 #endif
 		return *this;
 	}
 
 private:
-	// Sets affinity for i7-4650U (dual core with hyper threading).
-	// This processor has 4 virtual processors (visible to Linux):
-	// cpus 0 and 2 are threads of 1st core and cpus 1 and 3 are threads
-	// of 2nd core.
-	// So set affinity to cpus 0 and 1 if thr_num == 2.
+	void
+	run_trx()
+	{
+		bool committed = false;
+
+		PROF_START();
+
+		switch (sync) {
+		case Sync::TSX:
+			committed = execute_short_trx(thr_id, trx_sz, trx_count,
+						      overlap);
+			break;
+		case Sync::SpinLock:
+			execute_spinlock_trx(thr_id, trx_sz, trx_count,
+					     overlap);
+			break;
+		case Sync::Elided:
+			committed = elided_l([this]() {
+				trx_func(thr_id, trx_sz, trx_count, overlap);
+			});
+			break;
+		default:
+			abort();
+		}
+
+		PROF_END(committed);
+	}
+
+	// The threads take the CPUs in the BENCH_CPUS order, e.g. on
+	// i7-4650U (dual core with hyper threading) cpus 0 and 2 are threads
+	// of 1st core and cpus 1 and 3 are threads of 2nd core, so
+	// BENCH_CPUS=0,1,2,3 runs 2 threads on different cores.
 	void
 	set_affinity()
 	{
-		cpu_set_t cpuset;
-		CPU_ZERO(&cpuset);
-		CPU_SET(thr_id, &cpuset);
-		int r = pthread_setaffinity_np(pthread_self(), sizeof(cpuset),
-					       &cpuset);
-		assert(!r);
+		bench_pin_thread(thr_id);
 	}
 };
 
-static inline unsigned long
-tv_to_ms(const struct timeval &tv)
-{
-	return ((unsigned long)tv.tv_sec * 1000000 + tv.tv_usec) / 1000;
-}
-
 static void
 run_test(int thr_num, int trx_sz, int trx_count, int overlap, int iter,
 	 Sync sync)
 {
-	struct timeval tv0, tv1;
 	std::thread thr[thr_num];
 
 	warm_and_clear_memory();
+	elided_l.reset();
 
-	int r = gettimeofday(&tv0, NULL);
-	assert(!r);
+	uint64_t t0 = bench_now_ns();
 
 	for (int i = 0; i < thr_num; ++i)
 		thr[i] = std::thread(Thr(trx_sz, trx_count, overlap, iter,
@@ -358,25 +723,54 @@ run_test(int thr_num, int trx_sz, int trx_count, int overlap, int iter,
 	for (auto &t : thr)
 		t.join();
 
-	r = gettimeofday(&tv1, NULL);
-	assert(!r);
+	uint64_t t1 = bench_now_ns();
 
 	check_consistency(thr_num * trx_sz);
 
 	std::cout << "thr=" << thr_num << "\ttrx_sz=" << trx_sz
 		<< "\ttrx_count=" << trx_count << "\toverlap=" << overlap
 		<< "\titer=" << iter
-		<< "\ttime=" << (tv_to_ms(tv1) - tv_to_ms(tv0)) << "ms"
+		<< "\ttime=" << (t1 - t0) / 1000000 << "ms"
 		<< "\taborts=" << aborts.load()
 		<< "(" << (aborts.load() * 100 / (iter * thr_num)) << "%)"
-		<< "\tretries=" << retries.load()
-		<< std::endl;
+		<< "\tretries=" << retries.load();
+	if (sync == Sync::Elided)
+		std::cout << "\tbudget=" << elided_l.budget()
+			  << (elided_l.hot() ? "\thot" : "");
+	std::cout << std::endl;
+
+	if (aborts.load()) {
+		std::cout << "\tabort causes:";
+		for (int t = 0; t < _XA_NUM; ++t)
+			std::cout << " " << abrt_name[t] << "=" << abrt[t].load();
+		std::cout << std::endl;
+	}
+#ifdef TRX_PROF
+	for (int p = 0; p < CYC_PATHS; ++p) {
+		std::cout << "\tcycles " << cyc_name[p] << ":";
+		for (int b = 0; b < CYC_BUCKETS; ++b)
+			if (cyc[p][b].load())
+				std::cout << " <2^" << b << "="
+					  << cyc[p][b].load();
+		std::cout << std::endl;
+	}
+#endif
+#ifdef PERF_EVENTS
+	std::cout << "\tPMU:";
+	for (int e = 0; e < PE_NUM; ++e)
+		if (pe_config[e])
+			std::cout << " " << pe_name[e] << "=" << pe_cnt[e].load();
+	std::cout << std::endl;
+#endif
 }
 
 int
 main(int argc, char *argv[])
 {
 	pthread_spin_init(&spin_l, 0);
+#ifdef PERF_EVENTS
+	perf_events_init();
+#endif
 
 	unsigned long iter = 10UL * 1000 * 1000;
 
@@ -400,8 +794,12 @@ main(int argc, char *argv[])
 	 * Compare TSX and spin lock performance depending on transaction
 	 * work set for 2 concurrent threads.
 	 */
-	for (int trx_sz = 1; trx_sz <= 256; trx_sz <<= 1)
-		run_test(2, trx_sz, 1, 0, iter, Sync::TSX);
+	if (rtm_supported())
+		for (int trx_sz = 1; trx_sz <= 256; trx_sz <<= 1)
+			run_test(2, trx_sz, 1, 0, iter, Sync::TSX);
+	else
+		std::cout << "No RTM, only the elided lock fallback is tested"
+			  << std::endl;
 	//for (int trx_sz = 1; trx_sz <= 256; trx_sz <<= 1)
 	//	run_test(2, trx_sz, 1, 0, iter, Sync::SpinLock);
 
@@ -414,6 +812,16 @@ main(int argc, char *argv[])
 	//for (int overlap = 0; overlap <= 32; overlap++)
 	//	run_test(2, 32, 1, overlap, iter, Sync::SpinLock);
 
+	/*
+	 * Elided lock with the adaptive fallback depending on the work set
+	 * and data overlapping: the budget and the hot lock switch follow
+	 * the abort rate.
+	 */
+	for (int trx_sz = 2; trx_sz <= 256; trx_sz <<= 1)
+		for (int overlap = 0; overlap <= trx_sz;
+		     overlap += (trx_sz + 3) / 4)
+			run_test(2, trx_sz, 1, overlap, iter, Sync::Elided);
+
 	pthread_spin_destroy(&spin_l);
 
 	return 0;